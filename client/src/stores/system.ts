@@ -78,6 +78,7 @@ export interface AlertInfoResponse {
 export interface SystemRuntimeOverviewResponse {
     total_logs: number
     ai_call_total: number
+    ai_cache_hit_total?: number
     ai_queue_wait_ms: number
     ai_inference_latency_ms: number
     memory_rss_mb: number
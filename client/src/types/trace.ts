@@ -5,10 +5,12 @@
 
 export type RiskLevel = 'Critical' | 'Error' | 'Warning' | 'Info' | 'Safe' | 'Unknown'
 // TraceAiStatus 只表达执行态，不表达最终分析内容。
-// 也就是说 completed 之外的状态都可能没有 ai_analysis，但前端仍然能知道原因。
+// 也就是说 completed / completed_cache 之外的状态都可能没有 ai_analysis，但前端仍然能知道原因。
+// completed_cache 表示结论复用自结构相同的 trace，本条没有单独调模型。
 export type TraceAiStatus =
   | 'pending'
   | 'completed'
+  | 'completed_cache'
   | 'skipped_manual'
   | 'skipped_circuit'
   | 'failed_primary'
@@ -64,6 +66,7 @@ export interface TraceSearchRequestPayload {
   risk_levels?: string[] // 风险等级数组（按后端存储值传递）
   page: number // 页码，从 1 开始
   page_size: number // 每页条数
+  cursor?: string // 上一页响应里的 next_cursor；带上后按游标往后翻，忽略 page
 }
 
 /**
@@ -86,7 +89,9 @@ export interface TraceListItemDto {
  */
 export interface TraceSearchResponseDto {
   total: number
+  total_approximate?: boolean // total 含按时长折算的部分时为 true
   items: TraceListItemDto[]
+  next_cursor?: string | null // 还有下一页时的游标，到底了为 null
 }
 
 /**
@@ -1,6 +1,8 @@
 #pragma once
+#include<map>
 #include<string>
 #include<optional>
+#include<vector>
 #include<nlohmann/json.hpp>
 
 enum class RiskLevel {
@@ -51,3 +53,19 @@ struct BatchAnalysisResult{
     std::string global_summary;
     std::map<std::string,LogAnalysisResult> trace_id_to_result;
 };
+
+// 批量 Trace 分析的单个输入项。
+// id 只在一次批量请求内部有意义，用来把 proxy 返回的结果对回原来的 trace，
+// 所以调用方用数组下标之类的短串就够了，不必把真实 trace_id 也塞给模型。
+struct TraceAiBatchItem{
+    std::string id;
+    std::string trace_payload;
+};
+
+struct TraceAiBatchResponse{
+    // 只收成功解析的条目；模型漏回、id 对不上或单条校验失败的 trace 不会出现在这里，
+    // 由调用方自己决定是单条重试还是整体失败。
+    std::map<std::string,TraceAiResponse> results;
+    // 一次批量请求只有一份整体 usage，按条拆分交给上层做，因为只有上层知道每条 payload 有多大。
+    std::optional<TraceAiUsage> usage;
+};
@@ -0,0 +1,216 @@
+#include "ai/AsyncHttpClient.h"
+
+#include <curl/curl.h>
+
+#include <algorithm>
+#include <utility>
+
+namespace
+{
+size_t AppendResponseBody(char* data, size_t size, size_t count, void* user)
+{
+    static_cast<std::string*>(user)->append(data, size * count);
+    return size * count;
+}
+
+// curl_global_init 不是线程安全的，而且整个进程只需要做一次；
+// 这里借函数内静态变量的初始化保证，cpr 自己也会调，重复调用由 libcurl 内部计数兜住。
+void EnsureCurlGlobalInit()
+{
+    static const CURLcode kInitResult = curl_global_init(CURL_GLOBAL_DEFAULT);
+    (void)kInitResult;
+}
+} // namespace
+
+struct AsyncHttpClient::Transfer
+{
+    AsyncHttpRequest request;
+    Callback callback;
+    CURL* easy = nullptr;
+    curl_slist* header_list = nullptr;
+    std::string response_body;
+    char error_buffer[CURL_ERROR_SIZE] = {0};
+
+    ~Transfer()
+    {
+        if (easy) {
+            curl_easy_cleanup(easy);
+        }
+        if (header_list) {
+            curl_slist_free_all(header_list);
+        }
+    }
+};
+
+AsyncHttpClient::AsyncHttpClient(size_t max_inflight)
+    : max_inflight_(std::max<size_t>(1, max_inflight))
+{
+    EnsureCurlGlobalInit();
+    multi_ = curl_multi_init();
+    loop_thread_ = std::thread(&AsyncHttpClient::Loop, this);
+}
+
+AsyncHttpClient::~AsyncHttpClient()
+{
+    {
+        // stop_ 和 Post 的入队 + 唤醒在同一把锁下互斥：锁一放，就不会再有 Post 去碰 multi_，
+        // 后面的 curl_multi_cleanup 不会和别的线程里的 curl_multi_wakeup 撞上。
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        stop_.store(true, std::memory_order_release);
+        if (multi_) {
+            curl_multi_wakeup(static_cast<CURLM*>(multi_));
+        }
+    }
+    if (loop_thread_.joinable()) {
+        loop_thread_.join();
+    }
+    if (multi_) {
+        curl_multi_cleanup(static_cast<CURLM*>(multi_));
+        multi_ = nullptr;
+    }
+}
+
+void AsyncHttpClient::Post(AsyncHttpRequest request, Callback callback)
+{
+    auto transfer = std::make_unique<Transfer>();
+    transfer->request = std::move(request);
+    transfer->callback = std::move(callback);
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        if (!stop_.load(std::memory_order_acquire) && multi_) {
+            queued_.push_back(std::move(transfer));
+            pending_count_.fetch_add(1, std::memory_order_relaxed);
+            // 唤醒必须在锁内做：析构在同一把锁下置 stop_，之后才 cleanup，锁内看到 !stop_ 就保证 multi_ 还活着。
+            curl_multi_wakeup(static_cast<CURLM*>(multi_));
+        }
+    }
+    if (transfer) {
+        AsyncHttpResponse response;
+        response.error = "AsyncHttpClient is shut down";
+        transfer->callback(std::move(response));
+    }
+}
+
+size_t AsyncHttpClient::PendingCount() const
+{
+    return pending_count_.load(std::memory_order_relaxed);
+}
+
+void AsyncHttpClient::Loop()
+{
+    CURLM* multi = static_cast<CURLM*>(multi_);
+    if (!multi) {
+        return;
+    }
+    while (!stop_.load(std::memory_order_acquire)) {
+        StartQueuedTransfers();
+        int still_running = 0;
+        curl_multi_perform(multi, &still_running);
+        DrainFinishedTransfers();
+        // 没有在途传输时 poll 只等唤醒；有在途传输时 libcurl 会按自己的超时需求提前返回。
+        curl_multi_poll(multi, nullptr, 0, 1000, nullptr);
+    }
+    FailAll("AsyncHttpClient is shut down");
+}
+
+void AsyncHttpClient::StartQueuedTransfers()
+{
+    CURLM* multi = static_cast<CURLM*>(multi_);
+    std::vector<std::unique_ptr<Transfer>> ready;
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        while (!queued_.empty() && running_.size() + ready.size() < max_inflight_) {
+            ready.push_back(std::move(queued_.front()));
+            queued_.pop_front();
+        }
+    }
+    for (std::unique_ptr<Transfer>& transfer : ready) {
+        CURL* easy = curl_easy_init();
+        if (!easy) {
+            AsyncHttpResponse response;
+            response.error = "curl_easy_init failed";
+            pending_count_.fetch_sub(1, std::memory_order_relaxed);
+            transfer->callback(std::move(response));
+            continue;
+        }
+        transfer->easy = easy;
+        for (const std::string& header : transfer->request.headers) {
+            transfer->header_list = curl_slist_append(transfer->header_list, header.c_str());
+        }
+        curl_easy_setopt(easy, CURLOPT_URL, transfer->request.url.c_str());
+        curl_easy_setopt(easy, CURLOPT_HTTPHEADER, transfer->header_list);
+        // body 由 Transfer 自己持有，生命周期覆盖整个传输，所以这里直接借指针，不让 libcurl 再拷一份。
+        curl_easy_setopt(easy, CURLOPT_POSTFIELDS, transfer->request.body.data());
+        curl_easy_setopt(easy, CURLOPT_POSTFIELDSIZE_LARGE,
+                         static_cast<curl_off_t>(transfer->request.body.size()));
+        curl_easy_setopt(easy, CURLOPT_TIMEOUT_MS, static_cast<long>(transfer->request.timeout_ms));
+        // 多线程进程里必须关掉信号，否则 DNS 超时会用 SIGALRM 打断别的线程。
+        curl_easy_setopt(easy, CURLOPT_NOSIGNAL, 1L);
+        curl_easy_setopt(easy, CURLOPT_WRITEFUNCTION, &AppendResponseBody);
+        curl_easy_setopt(easy, CURLOPT_WRITEDATA, &transfer->response_body);
+        curl_easy_setopt(easy, CURLOPT_ERRORBUFFER, transfer->error_buffer);
+        curl_easy_setopt(easy, CURLOPT_PRIVATE, transfer.get());
+        curl_multi_add_handle(multi, easy);
+        running_.push_back(std::move(transfer));
+    }
+}
+
+void AsyncHttpClient::DrainFinishedTransfers()
+{
+    CURLM* multi = static_cast<CURLM*>(multi_);
+    int messages_left = 0;
+    while (CURLMsg* message = curl_multi_info_read(multi, &messages_left)) {
+        if (message->msg != CURLMSG_DONE) {
+            continue;
+        }
+        CURL* easy = message->easy_handle;
+        const CURLcode result = message->data.result;
+        Transfer* raw = nullptr;
+        curl_easy_getinfo(easy, CURLINFO_PRIVATE, &raw);
+        curl_multi_remove_handle(multi, easy);
+
+        auto iter = std::find_if(running_.begin(), running_.end(),
+                                 [raw](const std::unique_ptr<Transfer>& item) { return item.get() == raw; });
+        if (iter == running_.end()) {
+            continue;
+        }
+        std::unique_ptr<Transfer> transfer = std::move(*iter);
+        // 完成顺序和发起顺序无关，这里用 swap+pop_back 摘掉，避免中间删除带来的搬移。
+        *iter = std::move(running_.back());
+        running_.pop_back();
+
+        AsyncHttpResponse response;
+        if (result == CURLE_OK) {
+            curl_easy_getinfo(easy, CURLINFO_RESPONSE_CODE, &response.status_code);
+            response.body = std::move(transfer->response_body);
+        } else {
+            response.error = transfer->error_buffer[0] != '\0' ? std::string(transfer->error_buffer)
+                                                               : std::string(curl_easy_strerror(result));
+        }
+        pending_count_.fetch_sub(1, std::memory_order_relaxed);
+        transfer->callback(std::move(response));
+    }
+}
+
+void AsyncHttpClient::FailAll(const std::string& reason)
+{
+    CURLM* multi = static_cast<CURLM*>(multi_);
+    std::vector<std::unique_ptr<Transfer>> failed = std::move(running_);
+    running_.clear();
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        while (!queued_.empty()) {
+            failed.push_back(std::move(queued_.front()));
+            queued_.pop_front();
+        }
+    }
+    for (std::unique_ptr<Transfer>& transfer : failed) {
+        if (transfer->easy) {
+            curl_multi_remove_handle(multi, transfer->easy);
+        }
+        AsyncHttpResponse response;
+        response.error = reason;
+        pending_count_.fetch_sub(1, std::memory_order_relaxed);
+        transfer->callback(std::move(response));
+    }
+}
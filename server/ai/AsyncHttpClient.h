@@ -0,0 +1,72 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct AsyncHttpRequest
+{
+    std::string url;
+    std::string body;
+    // 形如 "Content-Type: application/json" 的原始头部行，直接交给 curl_slist。
+    std::vector<std::string> headers;
+    int timeout_ms = 10000;
+};
+
+struct AsyncHttpResponse
+{
+    // status_code 为 0 表示请求根本没拿到 HTTP 响应（连接失败、超时、客户端已关闭），
+    // 这时 error 里带 curl 的错误描述；拿到响应时 error 为空，不管状态码是不是 200。
+    long status_code = 0;
+    std::string body;
+    std::string error;
+};
+
+// AsyncHttpClient 是一个自带 loop 线程的 libcurl multi 客户端：
+// 1) Post 只负责把请求挂进待发送队列并唤醒 loop，调用方线程立刻返回；
+// 2) loop 线程用 curl_multi_poll 同时驱动所有在途连接，单线程就能维持成百上千个慢请求；
+// 3) 请求结束（成功、HTTP 错误或传输失败）后在 loop 线程里调用回调。
+// 回调跑在 loop 线程上，所以里面不能做阻塞动作；需要落库或发通知的调用方应该自己切回业务线程池。
+class AsyncHttpClient
+{
+public:
+    using Callback = std::function<void(AsyncHttpResponse)>;
+
+    // max_inflight 限制同时挂在 multi handle 上的传输数，超出的请求在待发送队列里排队，
+    // 避免瞬时大批 trace 把下游 proxy 的连接数一下子打满。
+    explicit AsyncHttpClient(size_t max_inflight = 256);
+    ~AsyncHttpClient();
+
+    AsyncHttpClient(const AsyncHttpClient&) = delete;
+    AsyncHttpClient& operator=(const AsyncHttpClient&) = delete;
+
+    // 客户端已关闭时直接在调用方线程里回调一个带 error 的响应，不会静默丢请求。
+    void Post(AsyncHttpRequest request, Callback callback);
+    // 已提交但还没回调的请求数（含排队和在途），给运行态统计和测试用。
+    size_t PendingCount() const;
+
+private:
+    struct Transfer;
+
+    void Loop();
+    void StartQueuedTransfers();
+    void DrainFinishedTransfers();
+    void FailAll(const std::string& reason);
+
+    const size_t max_inflight_;
+    void* multi_ = nullptr;
+    std::thread loop_thread_;
+    std::atomic<bool> stop_{false};
+    std::atomic<size_t> pending_count_{0};
+
+    mutable std::mutex queue_mutex_;
+    std::deque<std::unique_ptr<Transfer>> queued_;
+    // running_ 只在 loop 线程里访问，不需要加锁。
+    std::vector<std::unique_ptr<Transfer>> running_;
+};
@@ -0,0 +1,243 @@
+#include "ai/BatchingTraceAi.h"
+
+#include <algorithm>
+#include <future>
+#include <utility>
+
+namespace
+{
+constexpr size_t kCharsPerToken = 4;
+
+// 一次批量请求只有一份整体 usage；按每条 payload 的字节数占比拆回各条 trace，
+// 最后一条拿余数，保证各条加总后和 provider 报的总量严格一致，系统监控里的 token 总数不会因为拆分而漂移。
+size_t ShareOf(size_t total, size_t weight, size_t total_weight, size_t* assigned, bool last)
+{
+    if (last) {
+        return total - *assigned;
+    }
+    const size_t share =
+        total_weight == 0 ? 0 : static_cast<size_t>(static_cast<unsigned long long>(total) * weight / total_weight);
+    *assigned += share;
+    return share;
+}
+} // namespace
+
+BatchingTraceAi::BatchingTraceAi(std::shared_ptr<TraceAiProvider> inner, TraceAiBatchingOptions options)
+    : inner_(std::move(inner)),
+      options_([&options]() {
+          options.max_traces = std::max<size_t>(1, options.max_traces);
+          options.max_tokens = std::max<size_t>(1, options.max_tokens);
+          options.linger_ms = std::max(0, options.linger_ms);
+          return options;
+      }())
+{
+    flusher_ = std::thread(&BatchingTraceAi::FlusherLoop, this);
+}
+
+BatchingTraceAi::~BatchingTraceAi()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    cv_.notify_all();
+    if (flusher_.joinable()) {
+        flusher_.join();
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+    inflight_cv_.wait(lock, [this]() { return inflight_batches_ == 0; });
+}
+
+size_t BatchingTraceAi::EstimateTokens(const std::string& trace_payload)
+{
+    return std::max<size_t>(1, (trace_payload.size() + kCharsPerToken - 1) / kCharsPerToken);
+}
+
+TraceAiResponse BatchingTraceAi::AnalyzeTrace(const std::string& trace_payload)
+{
+    std::promise<TraceAiResponse> promise;
+    std::future<TraceAiResponse> future = promise.get_future();
+    AnalyzeTraceAsync(trace_payload, [&promise](TraceAiResponse response, std::exception_ptr error) {
+        if (error) {
+            promise.set_exception(error);
+        } else {
+            promise.set_value(std::move(response));
+        }
+    });
+    return future.get();
+}
+
+void BatchingTraceAi::AnalyzeTraceAsync(const std::string& trace_payload, TraceAiCallback callback)
+{
+    PendingTrace trace;
+    trace.payload = trace_payload;
+    trace.callback = std::move(callback);
+    trace.estimated_tokens = EstimateTokens(trace_payload);
+
+    // 一次入队最多让两批变成“可发”：先前攒着的一批放不下这条了，以及加上这条后刚好满了的一批。
+    Batch overflow;
+    Batch full;
+    bool wake_flusher = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stop_) {
+            // 析构已经开始，flusher 不会再处理新批次；直接走单条接口，不让这条 trace 无声丢掉。
+            full.push_back(std::move(trace));
+        } else {
+            if (!pending_.empty() && pending_tokens_ + trace.estimated_tokens > options_.max_tokens) {
+                overflow = TakePendingLocked();
+            }
+            if (pending_.empty()) {
+                pending_since_ = std::chrono::steady_clock::now();
+                wake_flusher = true;
+            }
+            pending_tokens_ += trace.estimated_tokens;
+            pending_.push_back(std::move(trace));
+            if (pending_.size() >= options_.max_traces || pending_tokens_ >= options_.max_tokens) {
+                full = TakePendingLocked();
+                wake_flusher = false;
+            }
+        }
+    }
+    if (wake_flusher) {
+        cv_.notify_one();
+    }
+    // 满批直接在调用线程里发出：Dispatch 只是把请求挂到 inner 的 IO loop 上，不阻塞，
+    // 省掉一次唤醒 flusher 线程的切换；flusher 只负责 linger 到期的那部分。
+    Dispatch(std::move(overflow));
+    Dispatch(std::move(full));
+}
+
+BatchingTraceAi::Stats BatchingTraceAi::GetStats() const
+{
+    Stats stats;
+    stats.batches_sent = batches_sent_.load(std::memory_order_relaxed);
+    stats.batched_traces = batched_traces_.load(std::memory_order_relaxed);
+    stats.single_calls = single_calls_.load(std::memory_order_relaxed);
+    stats.fallback_traces = fallback_traces_.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void BatchingTraceAi::FlusherLoop()
+{
+    const auto linger = std::chrono::milliseconds(options_.linger_ms);
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!stop_) {
+        if (pending_.empty()) {
+            cv_.wait(lock);
+            continue;
+        }
+        // 这里每轮都重新读 pending_since_：等待期间批次可能已被入队线程凑满取走，
+        // 新批次的截止时间要从新的第一条重新算。
+        const auto deadline = pending_since_ + linger;
+        if (std::chrono::steady_clock::now() < deadline) {
+            cv_.wait_until(lock, deadline);
+            continue;
+        }
+        Batch batch = TakePendingLocked();
+        lock.unlock();
+        Dispatch(std::move(batch));
+        lock.lock();
+    }
+    Batch remaining = TakePendingLocked();
+    lock.unlock();
+    Dispatch(std::move(remaining));
+}
+
+BatchingTraceAi::Batch BatchingTraceAi::TakePendingLocked()
+{
+    Batch batch;
+    batch.swap(pending_);
+    pending_tokens_ = 0;
+    return batch;
+}
+
+void BatchingTraceAi::Dispatch(Batch batch)
+{
+    if (batch.empty()) {
+        return;
+    }
+    if (batch.size() == 1) {
+        // 只凑到一条时没必要套批量协议，单条路由的 prompt 和输出结构都更贴合单个 trace。
+        single_calls_.fetch_add(1, std::memory_order_relaxed);
+        inner_->AnalyzeTraceAsync(batch.front().payload, std::move(batch.front().callback));
+        return;
+    }
+
+    std::vector<TraceAiBatchItem> items;
+    items.reserve(batch.size());
+    for (size_t i = 0; i < batch.size(); ++i) {
+        // id 只需要在本批内唯一，用下标即可；真实 trace_id 不出 C++ 进程，也就不用担心模型把它改写。
+        items.push_back(TraceAiBatchItem{std::to_string(i), batch[i].payload});
+    }
+    batches_sent_.fetch_add(1, std::memory_order_relaxed);
+    batched_traces_.fetch_add(batch.size(), std::memory_order_relaxed);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ++inflight_batches_;
+    }
+    // 批次本身要活到回调里做扇出，但 TraceAiBatchCallback 是 std::function，要求可拷贝，
+    // 所以这里放进 shared_ptr 再交给回调。
+    auto shared_batch = std::make_shared<Batch>(std::move(batch));
+    inner_->AnalyzeTraceBatchAsync(items,
+                                   [this, shared_batch](TraceAiBatchResponse response, std::exception_ptr error) {
+                                       OnBatchComplete(*shared_batch, std::move(response), error);
+                                   });
+}
+
+void BatchingTraceAi::OnBatchComplete(Batch& batch, TraceAiBatchResponse response, std::exception_ptr error)
+{
+    if (error) {
+        // 整批失败不代表每条 trace 都分析不了：常见原因是合并后的输出超长或某条内容触发了模型拒答，
+        // 所以逐条回退到单条接口，让失败被限制在真正有问题的那条 trace 上。
+        for (PendingTrace& trace : batch) {
+            FallbackToSingle(trace);
+        }
+    } else {
+        size_t matched_weight = 0;
+        size_t matched_count = 0;
+        for (size_t i = 0; i < batch.size(); ++i) {
+            if (response.results.count(std::to_string(i)) > 0) {
+                matched_weight += batch[i].payload.size();
+                ++matched_count;
+            }
+        }
+
+        TraceAiUsage assigned;
+        size_t seen = 0;
+        for (size_t i = 0; i < batch.size(); ++i) {
+            auto iter = response.results.find(std::to_string(i));
+            if (iter == response.results.end()) {
+                FallbackToSingle(batch[i]);
+                continue;
+            }
+            TraceAiResponse item_response = std::move(iter->second);
+            if (response.usage.has_value()) {
+                const TraceAiUsage& total = response.usage.value();
+                const size_t weight = batch[i].payload.size();
+                const bool last = ++seen == matched_count;
+                TraceAiUsage share;
+                share.input_tokens = ShareOf(total.input_tokens, weight, matched_weight, &assigned.input_tokens, last);
+                share.output_tokens = ShareOf(total.output_tokens, weight, matched_weight, &assigned.output_tokens, last);
+                share.total_tokens = ShareOf(total.total_tokens, weight, matched_weight, &assigned.total_tokens, last);
+                share.cached_tokens = ShareOf(total.cached_tokens, weight, matched_weight, &assigned.cached_tokens, last);
+                share.thoughts_tokens =
+                    ShareOf(total.thoughts_tokens, weight, matched_weight, &assigned.thoughts_tokens, last);
+                item_response.usage = share;
+            }
+            batch[i].callback(std::move(item_response), nullptr);
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    --inflight_batches_;
+    if (inflight_batches_ == 0) {
+        inflight_cv_.notify_all();
+    }
+}
+
+void BatchingTraceAi::FallbackToSingle(PendingTrace& trace)
+{
+    fallback_traces_.fetch_add(1, std::memory_order_relaxed);
+    inner_->AnalyzeTraceAsync(trace.payload, std::move(trace.callback));
+}
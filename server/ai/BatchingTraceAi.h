@@ -0,0 +1,103 @@
+#pragma once
+
+#include "ai/TraceAiProvider.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct TraceAiBatchingOptions
+{
+    // 一批最多装几条 trace；达到上限立即发出，不再等 linger。
+    size_t max_traces = 8;
+    // 一批累计的估算 token 上限，防止几条大 trace 拼在一起把模型上下文撑爆。
+    size_t max_tokens = 32000;
+    // 第一条 trace 入队后最多等多久凑批。等待是纯增加的延迟，所以默认只给几十毫秒。
+    int linger_ms = 20;
+};
+
+// BatchingTraceAi 是挂在 TraceAiProvider 前面的攒批装饰器：
+// 1) AnalyzeTraceAsync 只把 trace 放进待发批次，凑满 max_traces/max_tokens 或等满 linger_ms 就整批发出；
+// 2) 整批通过 inner->AnalyzeTraceBatchAsync 走一次 /analyze/trace/{provider} 请求，结果按 id 扇出回每条 trace 的回调；
+// 3) 整批失败或某条结果缺失时，只对受影响的 trace 单独回退到 inner->AnalyzeTraceAsync，
+//    回退后的成功/失败仍按单条协议回给调用方，manager 的 ai_status、熔断和告警逻辑完全不用感知批量的存在。
+// inner 必须 SupportsBatch()，工厂只在这种情况下才会套上这一层。
+class BatchingTraceAi : public TraceAiProvider
+{
+public:
+    struct Stats
+    {
+        // 真正以批量协议发出去的请求数，以及这些请求一共带了多少条 trace。
+        uint64_t batches_sent = 0;
+        uint64_t batched_traces = 0;
+        // 凑不成批（linger 到期时只有一条）而直接走单条接口的次数。
+        uint64_t single_calls = 0;
+        // 因整批失败或结果缺失而回退到单条接口的 trace 数。
+        uint64_t fallback_traces = 0;
+    };
+
+    BatchingTraceAi(std::shared_ptr<TraceAiProvider> inner, TraceAiBatchingOptions options);
+    // 析构时先把还没发出的 trace 整批发出，再等所有在途批次回调完成，保证不会有回调打到已销毁的对象上。
+    ~BatchingTraceAi() override;
+
+    BatchingTraceAi(const BatchingTraceAi&) = delete;
+    BatchingTraceAi& operator=(const BatchingTraceAi&) = delete;
+
+    // 同步入口同样参与攒批：调用线程挂在 future 上等结果。
+    // 这样没开异步派发的部署，多个 worker 同时分析的 trace 也能被合进同一次请求。
+    TraceAiResponse AnalyzeTrace(const std::string& trace_payload) override;
+
+    bool SupportsAsync() const override
+    {
+        return true;
+    }
+    void AnalyzeTraceAsync(const std::string& trace_payload, TraceAiCallback callback) override;
+
+    Stats GetStats() const;
+
+    // 和 TokenEstimator 同一口径：按 4 字符约 1 token 粗估，只用来控制批大小，不追求和 tokenizer 对齐。
+    static size_t EstimateTokens(const std::string& trace_payload);
+
+private:
+    struct PendingTrace
+    {
+        std::string payload;
+        TraceAiCallback callback;
+        size_t estimated_tokens = 0;
+    };
+    using Batch = std::vector<PendingTrace>;
+
+    void FlusherLoop();
+    Batch TakePendingLocked();
+    void Dispatch(Batch batch);
+    void OnBatchComplete(Batch& batch, TraceAiBatchResponse response, std::exception_ptr error);
+    void FallbackToSingle(PendingTrace& trace);
+
+    const std::shared_ptr<TraceAiProvider> inner_;
+    const TraceAiBatchingOptions options_;
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    Batch pending_;
+    size_t pending_tokens_ = 0;
+    // 当前批次第一条 trace 的入队时间，linger 截止时间从它算起，而不是从最后一条算起，
+    // 否则持续小流量时批次会被不断续命，单条延迟没有上界。
+    std::chrono::steady_clock::time_point pending_since_;
+    bool stop_ = false;
+    // 已发出、回调还没跑完的批次数，析构时等它归零。
+    size_t inflight_batches_ = 0;
+    std::condition_variable inflight_cv_;
+    std::thread flusher_;
+
+    std::atomic<uint64_t> batches_sent_{0};
+    std::atomic<uint64_t> batched_traces_{0};
+    std::atomic<uint64_t> single_calls_{0};
+    std::atomic<uint64_t> fallback_traces_{0};
+};
@@ -1,5 +1,6 @@
 // ai/MockTraceAi.cpp
 #include "ai/MockTraceAi.h"
+#include "ai/AsyncHttpClient.h"
 #include <cpr/cpr.h>
 #include <nlohmann/json.hpp> // 解析代理返回的 JSON 字段，避免手写解析出错
 #include <chrono>
@@ -26,18 +27,49 @@ TraceAiResponse MockTraceAi::AnalyzeTrace(const std::string& trace_payload)
     session_.SetBody(cpr::Body{trace_payload});
 
     cpr::Response r = session_.Post();
+    return ParseResponseOrThrow(r.status_code, r.text);
+}
 
-    if (r.status_code != 200)
+void MockTraceAi::AnalyzeTraceAsync(const std::string& trace_payload, TraceAiCallback callback)
+{
+    std::call_once(async_client_once_, [this]() {
+        async_client_ = std::make_unique<AsyncHttpClient>();
+    });
+    AsyncHttpRequest request;
+    request.url = analyze_trace_url_;
+    request.body = trace_payload;
+    request.headers.push_back("Content-Type: text/plain");
+    request.timeout_ms = 10000;
+    async_client_->Post(std::move(request), [callback = std::move(callback)](AsyncHttpResponse http_response) {
+        TraceAiResponse response;
+        std::exception_ptr error;
+        try
+        {
+            // 传输层失败（连不上、超时）没有 HTTP 状态码，这里按 0 交给同一套校验，和同步路径的报错保持一致。
+            response = ParseResponseOrThrow(http_response.status_code,
+                                            http_response.error.empty() ? http_response.body : http_response.error);
+        }
+        catch (...)
+        {
+            error = std::current_exception();
+        }
+        callback(std::move(response), error);
+    });
+}
+
+TraceAiResponse MockTraceAi::ParseResponseOrThrow(long status_code, const std::string& body)
+{
+    if (status_code != 200)
     {
         // 失败时直接抛异常，避免后续解析误导定位问题。
-        throw std::runtime_error("Trace AI Proxy Error: HTTP " + std::to_string(r.status_code) +
-                                 ", Body: " + r.text);
+        throw std::runtime_error("Trace AI Proxy Error: HTTP " + std::to_string(status_code) +
+                                 ", Body: " + body);
     }
 
     nlohmann::json response_json;
     try
     {
-        response_json = nlohmann::json::parse(r.text);
+        response_json = nlohmann::json::parse(body);
     }
     catch (const nlohmann::json::parse_error &e)
     {
@@ -2,12 +2,15 @@
 #pragma once
 
 #include "ai/TraceAiProvider.h"
+#include <memory>
+#include <mutex>
 #include <string>
 
 // 前向声明，避免在头文件里引入 cpr 头文件导致编译依赖膨胀。
 namespace cpr {
     class Session;
 }
+class AsyncHttpClient;
 
 // MockTraceAi 作为 Trace AI 的占位实现，便于先打通代理调用流程。
 class MockTraceAi : public TraceAiProvider
@@ -20,6 +23,18 @@ public:
     // mock 默认不返回 usage，让上层继续走本地估算回退路径。
     TraceAiResponse AnalyzeTrace(const std::string& trace_payload) override;
 
+    // mock 同样支持异步接口，压测时可以在不接真模型的情况下验证“大量 AI 请求同时在途”的派发路径。
+    bool SupportsAsync() const override
+    {
+        return true;
+    }
+    void AnalyzeTraceAsync(const std::string& trace_payload, TraceAiCallback callback) override;
+
 private:
+    // 同步/异步两条传输路径共用的响应校验，保证两边报出来的错误文本一致。
+    static TraceAiResponse ParseResponseOrThrow(long status_code, const std::string& body);
+
     std::string analyze_trace_url_;
+    std::once_flag async_client_once_;
+    std::unique_ptr<AsyncHttpClient> async_client_;
 };
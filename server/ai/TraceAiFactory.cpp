@@ -1,14 +1,24 @@
 #include "ai/TraceAiFactory.h"
 
+#include "ai/BatchingTraceAi.h"
 #include "ai/TraceProxyAi.h"
 
 std::shared_ptr<TraceAiProvider> CreateTraceAiProvider(const TraceAiFactoryOptions& options)
 {
     // 工厂这里不参与 Prompt 组装，只负责把启动期已经算好的冷启动模板交给具体 provider。
-    return std::make_shared<TraceProxyAi>(options.base_url,
-                                          options.backend,
-                                          options.timeout_ms,
-                                          options.prompt_template,
-                                          options.model,
-                                          options.api_key);
+    std::shared_ptr<TraceAiProvider> provider = std::make_shared<TraceProxyAi>(options.base_url,
+                                                                               options.backend,
+                                                                               options.timeout_ms,
+                                                                               options.prompt_template,
+                                                                               options.model,
+                                                                               options.api_key,
+                                                                               options.async_max_inflight);
+    if (options.batch_max_traces <= 1 || !provider->SupportsBatch()) {
+        return provider;
+    }
+    TraceAiBatchingOptions batching;
+    batching.max_traces = options.batch_max_traces;
+    batching.max_tokens = options.batch_max_tokens;
+    batching.linger_ms = options.batch_linger_ms;
+    return std::make_shared<BatchingTraceAi>(std::move(provider), batching);
 }
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "ai/TraceAiBackend.h"
+#include <cstddef>
 #include <memory>
 #include <string>
 
@@ -18,6 +19,13 @@ struct TraceAiFactoryOptions
     // 这样 trace AI 就不会再出现“语言和 prompt 吃的是 Settings，新模型和新密钥还停留在另一条旧链路”这种语义分裂。
     std::string model;
     std::string api_key;
+    // 异步调用路径同时在途的请求上限，只在 manager 开了异步派发时才会真正用到。
+    size_t async_max_inflight = 256;
+    // 攒批参数：batch_max_traces <= 1 表示不攒批，provider 原样返回；
+    // 大于 1 时在 provider 外面套一层 BatchingTraceAi，把 linger 窗口内的多条 trace 合成一次 proxy 请求。
+    size_t batch_max_traces = 0;
+    size_t batch_max_tokens = 32000;
+    int batch_linger_ms = 20;
 };
 
 // 工厂职责：根据配置创建 TraceAiProvider，避免 main.cpp 堆叠选择逻辑。
@@ -1,9 +1,20 @@
 // ai/TraceAiProvider.h
 #pragma once
 
+#include <exception>
+#include <functional>
+#include <stdexcept>
 #include <string>
+#include <vector>
 #include "ai/AiTypes.h"
 
+// 异步分析的完成回调：成功时 error 为空、response 有效；
+// 失败时 error 携带的异常和同步 AnalyzeTrace 会抛出的那一个完全一致，调用方可以复用同一套失败归类逻辑。
+using TraceAiCallback = std::function<void(TraceAiResponse response, std::exception_ptr error)>;
+// 批量分析的完成回调：error 非空表示整批请求失败（传输失败、proxy 返回 ok=false 或 provider 不支持批量），
+// 此时 response 里没有任何有效结果；error 为空时 response.results 可能只覆盖部分 item。
+using TraceAiBatchCallback = std::function<void(TraceAiBatchResponse response, std::exception_ptr error)>;
+
 // TraceAiProvider 作为 Trace 语义分析的抽象接口，便于后续替换不同模型或代理实现。
 class TraceAiProvider
 {
@@ -15,4 +26,45 @@ public:
     // 既然后续系统监控和告警 token_count 都会依赖 usage，
     // 那就不应该再把“真实 token 使用量”硬塞进 analysis JSON 里假装它是业务字段。
     virtual TraceAiResponse AnalyzeTrace(const std::string& trace_payload) = 0;
+
+    // 是否真正实现了非阻塞的 AnalyzeTraceAsync。
+    // 返回 false 的 provider 走下面的默认实现，本质上还是同步调用，manager 据此决定要不要走异步派发路径。
+    virtual bool SupportsAsync() const
+    {
+        return false;
+    }
+
+    // 发起一次分析后立即返回，结果通过 callback 交回。
+    // 真正的异步实现会在自己的 IO loop 线程里回调，所以回调里不能做阻塞动作；
+    // 默认实现只是把同步结果转成回调形式，让还没接 IO loop 的 provider 也能满足同一份接口。
+    virtual void AnalyzeTraceAsync(const std::string& trace_payload, TraceAiCallback callback)
+    {
+        TraceAiResponse response;
+        std::exception_ptr error;
+        try {
+            response = AnalyzeTrace(trace_payload);
+        } catch (...) {
+            error = std::current_exception();
+        }
+        // 回调放在 try 外面，避免回调自己抛异常时又被当成 provider 失败再回调一次。
+        callback(std::move(response), error);
+    }
+
+    // 是否支持把多条 trace 合成一次请求发给 proxy。
+    // BatchingTraceAi 只会包装返回 true 的 provider，否则批量失败后每条都要再走一遍单条回退，等于白白多一次往返。
+    virtual bool SupportsBatch() const
+    {
+        return false;
+    }
+
+    // 一次请求分析多条 trace，结果按 item.id 对回。
+    // 默认实现直接报“不支持”，而不是偷偷循环调用单条接口：
+    // 既然调用方选择批量就是为了省往返，那静默退化成 N 次串行调用只会让延迟问题更难排查。
+    virtual void AnalyzeTraceBatchAsync(const std::vector<TraceAiBatchItem>& items,
+                                        TraceAiBatchCallback callback)
+    {
+        (void)items;
+        callback(TraceAiBatchResponse{},
+                 std::make_exception_ptr(std::runtime_error("Trace AI batch analysis is not supported")));
+    }
 };
@@ -1,5 +1,6 @@
 #include "ai/TraceProxyProtocol.h"
 #include "ai/TraceProxyAi.h"
+#include "ai/AsyncHttpClient.h"
 
 #include <cpr/cpr.h>
 #include <nlohmann/json.hpp>
@@ -10,11 +11,13 @@ TraceProxyAi::TraceProxyAi(std::string base_url,
                            int timeout_ms,
                            std::string prompt_template,
                            std::string model,
-                           std::string api_key)
+                           std::string api_key,
+                           size_t async_max_inflight)
     : timeout_ms_(timeout_ms > 0 ? timeout_ms : 10000),
       prompt_template_(std::move(prompt_template)),
       model_(std::move(model)),
-      api_key_(std::move(api_key))
+      api_key_(std::move(api_key)),
+      async_max_inflight_(async_max_inflight > 0 ? async_max_inflight : 256)
 {
     if (!base_url.empty() && base_url.back() == '/') {
         base_url.pop_back();
@@ -24,43 +27,108 @@ TraceProxyAi::TraceProxyAi(std::string base_url,
 
 TraceProxyAi::~TraceProxyAi() = default;
 
-TraceAiResponse TraceProxyAi::AnalyzeTrace(const std::string& trace_payload)
+std::string TraceProxyAi::BuildRequestBody(const std::string& trace_payload) const
 {
-    cpr::Session session;
-    session.SetHeader(cpr::Header{{"Content-Type", "application/json"}});
-    session.SetTimeout(cpr::Timeout{timeout_ms_});
-    session.SetUrl(cpr::Url{analyze_trace_url_});
     // Trace 路由这里改成 JSON，不再只发裸文本。
     // 原因是 ai_language 和业务 prompt 都已经在 C++ 启动期收口成冷启动模板，
     // 只有把 prompt 显式下发给 proxy，Settings 里的 Prompt/语言配置才算真的进入 trace AI 主链。
     nlohmann::json request_json;
     request_json["trace_text"] = trace_payload;
-    request_json["prompt"] = prompt_template_;
+    AppendProviderConfig(&request_json);
+    return request_json.dump();
+}
+
+std::string TraceProxyAi::BuildBatchRequestBody(const std::vector<TraceAiBatchItem>& items) const
+{
+    nlohmann::json request_json;
+    nlohmann::json traces = nlohmann::json::array();
+    for (const TraceAiBatchItem& item : items) {
+        traces.push_back({{"id", item.id}, {"trace_text", item.trace_payload}});
+    }
+    request_json["traces"] = std::move(traces);
+    AppendProviderConfig(&request_json);
+    return request_json.dump();
+}
+
+void TraceProxyAi::AppendProviderConfig(nlohmann::json* request_json) const
+{
+    (*request_json)["prompt"] = prompt_template_;
     // 这里不强行要求 model/api_key 一定非空。
     // 既然 provider 本身已经支持“优先吃请求值，没有就回退默认配置”，
     // 那 TraceProxyAi 只负责把冷启动阶段算好的值尽量透传过去。
     if (!model_.empty()) {
-        request_json["model"] = model_;
+        (*request_json)["model"] = model_;
     }
     if (!api_key_.empty()) {
-        request_json["api_key"] = api_key_;
+        (*request_json)["api_key"] = api_key_;
     }
-    session.SetBody(cpr::Body{request_json.dump()});
+}
+
+TraceAiResponse TraceProxyAi::AnalyzeTrace(const std::string& trace_payload)
+{
+    cpr::Session session;
+    session.SetHeader(cpr::Header{{"Content-Type", "application/json"}});
+    session.SetTimeout(cpr::Timeout{timeout_ms_});
+    session.SetUrl(cpr::Url{analyze_trace_url_});
+    session.SetBody(cpr::Body{BuildRequestBody(trace_payload)});
 
     cpr::Response r = session.Post();
-    if (r.status_code != 200) {
-        throw std::runtime_error("Trace AI Proxy Error: HTTP " + std::to_string(r.status_code) +
-                                 ", Body: " + r.text);
-    }
+    return ParseTraceProxyHttpResponseOrThrow(r.status_code, r.text);
+}
 
-    nlohmann::json response_json;
-    try {
-        response_json = nlohmann::json::parse(r.text);
-    } catch (const nlohmann::json::parse_error& e) {
-        throw std::runtime_error("Trace AI Protocol Error: invalid JSON from proxy. " + std::string(e.what()));
-    }
+AsyncHttpClient& TraceProxyAi::async_client()
+{
+    std::call_once(async_client_once_, [this]() {
+        async_client_ = std::make_unique<AsyncHttpClient>(async_max_inflight_);
+    });
+    return *async_client_;
+}
 
-    // proxy 现在会把 provider 失败也编码进 JSON body，而不是只靠 HTTP 500 文本。
-    // 所以这里解析完 JSON 后必须继续吃一层协议语义，才能把 ok=false 转成 manager 可落库的失败信息。
-    return ParseTraceProxyResponseOrThrow(response_json);
+void TraceProxyAi::AnalyzeTraceAsync(const std::string& trace_payload, TraceAiCallback callback)
+{
+    AsyncHttpRequest request;
+    request.url = analyze_trace_url_;
+    request.body = BuildRequestBody(trace_payload);
+    request.headers.push_back("Content-Type: application/json");
+    request.timeout_ms = timeout_ms_;
+    async_client().Post(std::move(request), [callback = std::move(callback)](AsyncHttpResponse http_response) {
+        TraceAiResponse response;
+        std::exception_ptr error;
+        try {
+            if (!http_response.error.empty()) {
+                // 没拿到 HTTP 响应时，同步 cpr 路径看到的是 status_code=0；这里沿用同一条错误文本格式，
+                // 只是把 curl 的错误描述放进 Body 位置，方便排查是连接失败还是超时。
+                throw std::runtime_error("Trace AI Proxy Error: HTTP 0, Body: " + http_response.error);
+            }
+            response = ParseTraceProxyHttpResponseOrThrow(http_response.status_code, http_response.body);
+        } catch (...) {
+            error = std::current_exception();
+        }
+        callback(std::move(response), error);
+    });
+}
+
+void TraceProxyAi::AnalyzeTraceBatchAsync(const std::vector<TraceAiBatchItem>& items,
+                                          TraceAiBatchCallback callback)
+{
+    AsyncHttpRequest request;
+    request.url = analyze_trace_url_;
+    request.body = BuildBatchRequestBody(items);
+    request.headers.push_back("Content-Type: application/json");
+    // 一次批量请求里模型要输出 N 份结论，耗时明显比单条长；超时仍沿用同一个配置值，
+    // 由部署方按批大小调大 --trace-ai-timeout-ms，而不是在这里偷偷放大，免得超时语义对不上配置。
+    request.timeout_ms = timeout_ms_;
+    async_client().Post(std::move(request), [callback = std::move(callback)](AsyncHttpResponse http_response) {
+        TraceAiBatchResponse response;
+        std::exception_ptr error;
+        try {
+            if (!http_response.error.empty()) {
+                throw std::runtime_error("Trace AI Proxy Error: HTTP 0, Body: " + http_response.error);
+            }
+            response = ParseTraceProxyBatchHttpResponseOrThrow(http_response.status_code, http_response.body);
+        } catch (...) {
+            error = std::current_exception();
+        }
+        callback(std::move(response), error);
+    });
 }
@@ -2,7 +2,13 @@
 
 #include "ai/TraceAiBackend.h"
 #include "ai/TraceAiProvider.h"
+#include <cstddef>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <vector>
+
+class AsyncHttpClient;
 
 // 统一通过 Python proxy 的 trace 分析实现。
 // backend 控制访问 /analyze/trace/{mock|gemini} 哪个路由。
@@ -14,14 +20,39 @@ public:
                           int timeout_ms = 10000,
                           std::string prompt_template = "",
                           std::string model = "",
-                          std::string api_key = "");
+                          std::string api_key = "",
+                          // 异步路径同时挂在 curl multi 上的最大请求数，超出的在客户端内部排队。
+                          size_t async_max_inflight = 256);
     ~TraceProxyAi() override;
 
     // 代理返回现在既包含结构化 analysis，也可能带 usage 元数据。
     // 所以这里直接把两者一起还给上层，避免 manager 再自己反序列化 HTTP JSON。
     TraceAiResponse AnalyzeTrace(const std::string& trace_payload) override;
 
+    bool SupportsAsync() const override
+    {
+        return true;
+    }
+    // 请求体和同步路径完全一样，只是改由 AsyncHttpClient 的 loop 线程发出；
+    // worker 线程提交完就返回，不再被模型延迟钉住。
+    void AnalyzeTraceAsync(const std::string& trace_payload, TraceAiCallback callback) override;
+
+    bool SupportsBatch() const override
+    {
+        return true;
+    }
+    // 批量请求复用同一条 /analyze/trace/{provider} 路由，只是 body 里用 traces 数组代替单个 trace_text；
+    // proxy 据此把多条 trace 合进一次模型调用，结果按 id 回传。
+    void AnalyzeTraceBatchAsync(const std::vector<TraceAiBatchItem>& items,
+                                TraceAiBatchCallback callback) override;
+
 private:
+    std::string BuildRequestBody(const std::string& trace_payload) const;
+    std::string BuildBatchRequestBody(const std::vector<TraceAiBatchItem>& items) const;
+    void AppendProviderConfig(nlohmann::json* request_json) const;
+    // 异步客户端按需创建：没开异步派发的部署不会多起一个 loop 线程。
+    AsyncHttpClient& async_client();
+
     std::string analyze_trace_url_;
     int timeout_ms_ = 10000;
     // 这里缓存的是“已经带语言约束和业务 guidance 的 Trace Prompt 模板”，
@@ -31,4 +62,7 @@ private:
     // 这样 TraceSessionManager 后面每次只管提交 trace payload，不需要再自己关心 provider 的动态配置细节。
     std::string model_;
     std::string api_key_;
+    size_t async_max_inflight_ = 256;
+    std::once_flag async_client_once_;
+    std::unique_ptr<AsyncHttpClient> async_client_;
 };
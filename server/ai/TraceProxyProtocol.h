@@ -6,6 +6,7 @@
 #include <optional>
 #include <sstream>
 #include <stdexcept>
+#include <string>
 #include <vector>
 
 // 这里专门收口 Python proxy -> C++ 的 Trace AI 协议解析。
@@ -141,3 +142,64 @@ inline TraceAiResponse ParseTraceProxyResponseOrThrow(const nlohmann::json& resp
     response.usage = ParseTraceProxyUsageOrThrow(response_json);
     return response;
 }
+
+// 同步 cpr 路径和异步 curl-multi 路径拿到的都是“状态码 + 原始 body”，
+// 这里把 HTTP 状态判断、JSON 解析和协议语义解释收成一处，保证两条传输路径抛出的错误文本完全一致。
+inline nlohmann::json ParseTraceProxyHttpJsonOrThrow(long status_code, const std::string& body)
+{
+    if (status_code != 200) {
+        throw std::runtime_error("Trace AI Proxy Error: HTTP " + std::to_string(status_code) +
+                                 ", Body: " + body);
+    }
+
+    try {
+        return nlohmann::json::parse(body);
+    } catch (const nlohmann::json::parse_error& e) {
+        throw std::runtime_error("Trace AI Protocol Error: invalid JSON from proxy. " + std::string(e.what()));
+    }
+}
+
+inline TraceAiResponse ParseTraceProxyHttpResponseOrThrow(long status_code, const std::string& body)
+{
+    // proxy 现在会把 provider 失败也编码进 JSON body，而不是只靠 HTTP 500 文本。
+    // 所以这里解析完 JSON 后必须继续吃一层协议语义，才能把 ok=false 转成 manager 可落库的失败信息。
+    return ParseTraceProxyResponseOrThrow(ParseTraceProxyHttpJsonOrThrow(status_code, body));
+}
+
+// 批量协议：{"ok":true,"results":[{"id":"0","analysis":{...}}, ...],"usage":{...}}。
+// 整批失败（ok=false 或 results 缺失）直接抛，和单条协议报同一类错误文本；
+// 单条 item 解析失败只把它从结果里剔掉，不拖累同批其它 trace，调用方会对缺失的 id 单独回退。
+inline TraceAiBatchResponse ParseTraceProxyBatchResponseOrThrow(const nlohmann::json& response_json)
+{
+    if (response_json.contains("ok") && response_json["ok"].is_boolean() &&
+        !response_json["ok"].get<bool>()) {
+        throw std::runtime_error(BuildTraceProxyFailureMessage(response_json));
+    }
+    if (!response_json.contains("results") || !response_json["results"].is_array()) {
+        throw std::runtime_error("Trace AI Protocol Error: missing 'results' field");
+    }
+
+    TraceAiBatchResponse response;
+    for (const auto& item_json : response_json["results"]) {
+        if (!item_json.is_object() || !item_json.contains("id") || !item_json["id"].is_string()) {
+            continue;
+        }
+        if (item_json.contains("ok") && item_json["ok"].is_boolean() && !item_json["ok"].get<bool>()) {
+            continue;
+        }
+        try {
+            TraceAiResponse item_response;
+            item_response.analysis = ParseTraceProxyAnalysisOrThrow(item_json);
+            response.results.emplace(item_json["id"].get<std::string>(), std::move(item_response));
+        } catch (const std::exception&) {
+            continue;
+        }
+    }
+    response.usage = ParseTraceProxyUsageOrThrow(response_json);
+    return response;
+}
+
+inline TraceAiBatchResponse ParseTraceProxyBatchHttpResponseOrThrow(long status_code, const std::string& body)
+{
+    return ParseTraceProxyBatchResponseOrThrow(ParseTraceProxyHttpJsonOrThrow(status_code, body));
+}
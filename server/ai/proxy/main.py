@@ -7,6 +7,7 @@ from typing import List, Dict, Any, Optional
 from pydantic import BaseModel, ValidationError
 from pathlib import Path
 import uvicorn
+import json
 import sys
 # ==========================================
 # 1. 路径与环境配置 (最先执行)
@@ -123,6 +124,38 @@ def render_trace_prompt(prompt_template: str, trace_text: str) -> str:
         return prompt_template.replace("{{TRACE_CONTEXT}}", trace_text)
     return f"{prompt_template}\n\n<trace_context>\n{trace_text}\n</trace_context>"
 
+def render_trace_batch_prompt(prompt_template: str, traces: List[Dict[str, str]]) -> str:
+    """
+    批量请求复用同一份单条 Trace 模板，只把 TRACE_CONTEXT 换成带 id 的 JSON 数组，
+    再补一段“逐条独立分析、按 id 回传”的输出约束。
+    这样业务 guidance 和语言约束依旧只在 C++ 冷启动阶段定义一次，不会因为攒批再分叉出第二套 prompt。
+    """
+    traces_json = json.dumps(traces, ensure_ascii=False, indent=2)
+    batch_rules = (
+        "\n\nBatch mode:\n"
+        f"The trace context above is a JSON array of {len(traces)} independent traces, each with an 'id'.\n"
+        "Analyze each trace INDEPENDENTLY and return ONLY one JSON object of the form "
+        "{\"results\": [{\"id\": <id>, \"analysis\": {summary, risk_level, root_cause, solution}}]}.\n"
+        "Every input id must appear exactly once in results, unchanged."
+    )
+    return render_trace_prompt(prompt_template, traces_json) + batch_rules
+
+
+def normalize_trace_batch_result(provider_name: str, result: Any) -> Dict[str, Any]:
+    """
+    批量结果的外层契约和单条保持一致（ok/provider/usage），只是 analysis 换成 results 数组。
+    provider 直接返回列表时按旧 analyze_batch 的 [{id, analysis}] 结构兼容。
+    """
+    if isinstance(result, list):
+        return {"ok": True, "provider": provider_name, "results": result, "usage": None}
+    normalized = dict(result)
+    normalized["provider"] = provider_name
+    if normalized.get("ok", True):
+        normalized["ok"] = True
+        normalized.setdefault("results", [])
+        normalized.setdefault("usage", None)
+    return normalized
+
 # --- Provider 实例化和注册 ---
 # 在这里，我们创建所有可用的'转换插头'实例，并放入一个字典中进行管理。
 # 这种方式使得添加新的 Provider 变得非常容易。
@@ -182,7 +215,7 @@ async def analyze_log(provider_name: str, request: Request):
 async def analyze_trace(provider_name: str, request: Request):
     """
     Trace 聚合结果分析端点。
-    当前接收 text/plain 的序列化 trace payload。
+    接收 text/plain 的序列化 trace payload，或 JSON 形式的单条 trace_text / 批量 traces。
     """
     provider = providers.get(provider_name)
     if not provider:
@@ -204,6 +237,17 @@ async def analyze_trace(provider_name: str, request: Request):
                 prompt_template = payload.prompt
             model = payload.model
             api_key = payload.api_key
+            if payload.traces is not None:
+                # C++ 攒批后的请求：一次模型调用分析整批 trace，结果按 id 回传。
+                traces = [item.model_dump() for item in payload.traces]
+                result = await call_provider_in_threadpool(
+                    provider.analyze_trace_batch,
+                    traces=traces,
+                    prompt=render_trace_batch_prompt(prompt_template, traces),
+                    api_key=api_key,
+                    model=model,
+                )
+                return normalize_trace_batch_result(provider_name, result)
         else:
             trace_text = body.decode('utf-8')
             model = None
@@ -23,6 +23,17 @@ class AIProvider(ABC):
         """
         pass
 
+    def analyze_trace_batch(self, traces: List[Dict[str, str]], prompt: str, api_key: Optional[str] = None, model: Optional[str] = None) -> Dict[str, Any]:
+        """
+        一次模型调用分析多条 Trace。
+
+        :param traces: [{"id": ..., "trace_text": ...}]，id 必须原样回传。
+        :param prompt: 已经注入全部 trace 的最终 prompt。
+        :return: {"ok": True, "results": [{"id": ..., "analysis": ...}], "usage": ...}
+        不是每家 provider 都适合批量，这里默认直接报不支持，C++ 侧收到失败后会逐条回退到单条分析。
+        """
+        raise NotImplementedError(f"{type(self).__name__} does not support trace batch analysis")
+
     @abstractmethod
     def chat(self, history: List[Dict[str, Any]], new_message: str) -> str:
         """
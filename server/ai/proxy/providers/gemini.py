@@ -154,6 +154,47 @@ class GeminiProvider(AIProvider):
             # 如果继续伪造一份成功 analysis，C++ 会把真正的 provider 错误误判成一条高风险业务结论。
             return self._build_trace_error_payload(e)
 
+    def analyze_trace_batch(self, traces: List[Dict[str, str]], prompt: str, api_key: Optional[str] = None, model: Optional[str] = None) -> Dict[str, Any]:
+        """
+        批量 Trace 分析：多条 trace 已经由路由注入同一份 prompt，这里只做一次 generate_content，
+        用 BatchResponseSchema 约束模型按 id 逐条输出结论。
+        """
+        try:
+            client, target_model = self._get_client_and_model(api_key, model)
+        except ValueError as e:
+            print(f"[Gemini] Trace 批量分析失败: {e}")
+            return self._build_trace_error_payload(e, default_status="CONFIG_ERROR")
+
+        try:
+            response = client.models.generate_content(
+                model=target_model,
+                contents=prompt,
+                config={
+                    "response_mime_type": "application/json",
+                    "response_schema": BatchResponseSchema
+                }
+            )
+            usage_metadata = getattr(response, "usage_metadata", None)
+            usage = None
+            if usage_metadata is not None:
+                usage = {
+                    "input_tokens": int(getattr(usage_metadata, "prompt_token_count", 0) or 0),
+                    "output_tokens": int(getattr(usage_metadata, "candidates_token_count", 0) or 0),
+                    "total_tokens": int(getattr(usage_metadata, "total_token_count", 0) or 0),
+                    "cached_tokens": int(getattr(usage_metadata, "cached_content_token_count", 0) or 0),
+                    "thoughts_tokens": int(getattr(usage_metadata, "thoughts_token_count", 0) or 0),
+                }
+            resp_data = json.loads(response.text)
+            return {
+                "ok": True,
+                "results": resp_data.get("results", []),
+                "usage": usage,
+            }
+        except Exception as e:
+            print(f"Error calling Gemini API for trace batch analysis: {e}")
+            # 整批失败同样如实上报，C++ 侧会把这一批逐条回退到单条分析。
+            return self._build_trace_error_payload(e)
+
     def chat(self, history: List[Dict[str, Any]], new_message: str) -> str:
         """
         实现多轮对话功能。
@@ -70,6 +70,23 @@ class MockProvider(AIProvider):
         actual_delay = self.delay + random.uniform(0, 0.1)
         time.sleep(actual_delay)
 
+        return json.dumps(self._mock_trace_analysis(trace_text))
+
+    def analyze_trace_batch(self, traces: List[Dict[str, str]], prompt: str, api_key: Optional[str] = None, model: Optional[str] = None) -> Dict[str, Any]:
+        """
+        模拟批量 Trace 分析：整批只睡一次，模拟“一次模型调用返回多条结论”。
+        这样压测时能直观看到攒批把 N 次往返压成 1 次的效果。
+        """
+        actual_delay = self.delay + random.uniform(0, 0.1)
+        time.sleep(actual_delay)
+
+        results = [
+            {"id": item.get("id"), "analysis": self._mock_trace_analysis(item.get("trace_text", ""))}
+            for item in traces
+        ]
+        return {"ok": True, "results": results, "usage": None}
+
+    def _mock_trace_analysis(self, trace_text: str) -> Dict[str, str]:
         trace_lower = trace_text.lower()
 
         risk = "safe"
@@ -88,15 +105,13 @@ class MockProvider(AIProvider):
             risk = "info"
             summary = "Trace contains informational spans."
 
-        result = {
+        return {
             "summary": summary,
             "risk_level": risk,
             "root_cause": f"Mocked trace root cause for: {trace_text[:30]}...",
             "solution": "This is a mock trace solution. 1. Inspect trace. 2. Correlate spans. 3. Verify service health."
         }
 
-        return json.dumps(result)
-
     def chat(self, history: List[Dict[str, Any]], new_message: str) -> str:
         """
         模拟多轮对话。
@@ -40,8 +40,14 @@ class SummarizeRequest(BaseModel):
     model: Optional[str] = None
     prompt: Optional[str] = None
 
-class TraceAnalyzeRequest(BaseModel):
+class TraceBatchItem(BaseModel):
+    id: str = Field(..., description="批内序号，只用来把结果对回 C++ 端的那条 trace")
     trace_text: str
+
+class TraceAnalyzeRequest(BaseModel):
+    # 单条请求带 trace_text；C++ 攒批后改带 traces 数组，两者走同一条路由。
+    trace_text: str = ""
+    traces: Optional[List[TraceBatchItem]] = None
     prompt: Optional[str] = None
     model: Optional[str] = None
     api_key: Optional[str] = None
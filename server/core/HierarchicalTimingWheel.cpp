@@ -0,0 +1,141 @@
+#include "core/HierarchicalTimingWheel.h"
+
+namespace
+{
+constexpr uint64_t LevelSpan(size_t level)
+{
+    return uint64_t{1} << (HierarchicalTimingWheel::kSlotBits * level);
+}
+
+// 整个轮子能直接表达的最远距离；更远的到期点先按这个距离挂到最高层，轮到时再重新分级。
+constexpr uint64_t kMaxDelta = LevelSpan(HierarchicalTimingWheel::kLevels) - 1;
+} // namespace
+
+HierarchicalTimingWheel::HierarchicalTimingWheel()
+{
+    for (TimingWheelNode& head : slots_)
+    {
+        head.prev_ = &head;
+        head.next_ = &head;
+    }
+}
+
+void HierarchicalTimingWheel::Schedule(TimingWheelNode* node, size_t key, uint64_t expire_tick, uint64_t current_tick)
+{
+    if (!node)
+    {
+        return;
+    }
+    if (node->linked())
+    {
+        Unlink(node);
+        ++stats_.relinked;
+    }
+    node->key_ = key;
+    node->expire_tick_ = expire_tick > current_tick ? expire_tick : current_tick + 1;
+    Place(node, current_tick);
+}
+
+void HierarchicalTimingWheel::Cancel(TimingWheelNode* node)
+{
+    if (node && node->linked())
+    {
+        Unlink(node);
+    }
+}
+
+void HierarchicalTimingWheel::Advance(uint64_t new_tick, std::vector<size_t>* expired_keys)
+{
+    // 从高层往低层降级：同一个 tick 上多层同时翻边界时，高层下放的节点可能正好落进本 tick 要降级的低层槽，
+    // 先高后低才能保证它们在本 tick 内继续往下走，最后由第 0 级统一到期。
+    for (size_t level = kLevels - 1; level > 0; --level)
+    {
+        if (new_tick % LevelSpan(level) != 0)
+        {
+            continue;
+        }
+        TimingWheelNode& head = SlotHead(level, (new_tick >> (kSlotBits * level)) % kSlotsPerLevel);
+        while (head.next_ != &head)
+        {
+            TimingWheelNode* node = head.next_;
+            Unlink(node);
+            Place(node, new_tick);
+            ++stats_.cascaded;
+        }
+    }
+
+    TimingWheelNode& head = SlotHead(0, new_tick % kSlotsPerLevel);
+    while (head.next_ != &head)
+    {
+        TimingWheelNode* node = head.next_;
+        Unlink(node);
+        if (node->expire_tick_ > new_tick)
+        {
+            // 正常分级下第 0 级的槽只会放本 tick 到期的节点；这里只是兜底，放回去等它真正到期。
+            Place(node, new_tick);
+            continue;
+        }
+        ++stats_.expired;
+        if (expired_keys)
+        {
+            expired_keys->push_back(node->key_);
+        }
+    }
+}
+
+void HierarchicalTimingWheel::Clear()
+{
+    for (TimingWheelNode& head : slots_)
+    {
+        while (head.next_ != &head)
+        {
+            Unlink(head.next_);
+        }
+    }
+}
+
+HierarchicalTimingWheel::Stats HierarchicalTimingWheel::GetStats() const
+{
+    return stats_;
+}
+
+void HierarchicalTimingWheel::Place(TimingWheelNode* node, uint64_t base_tick)
+{
+    const uint64_t delta = node->expire_tick_ > base_tick ? node->expire_tick_ - base_tick : 0;
+    uint64_t target_tick = node->expire_tick_;
+    size_t level = 0;
+    if (delta > kMaxDelta)
+    {
+        level = kLevels - 1;
+        target_tick = base_tick + kMaxDelta;
+    }
+    else
+    {
+        while (level + 1 < kLevels && delta >= LevelSpan(level + 1))
+        {
+            ++level;
+        }
+    }
+    node->level_ = static_cast<uint8_t>(level);
+    Link(&SlotHead(level, (target_tick >> (kSlotBits * level)) % kSlotsPerLevel), node);
+}
+
+void HierarchicalTimingWheel::Link(TimingWheelNode* head, TimingWheelNode* node)
+{
+    node->prev_ = head->prev_;
+    node->next_ = head;
+    head->prev_->next_ = node;
+    head->prev_ = node;
+    ++stats_.occupancy;
+    ++stats_.level_occupancy[node->level_];
+}
+
+void HierarchicalTimingWheel::Unlink(TimingWheelNode* node)
+{
+    node->prev_->next_ = node->next_;
+    node->next_->prev_ = node->prev_;
+    node->prev_ = nullptr;
+    node->next_ = nullptr;
+    --stats_.occupancy;
+    --stats_.level_occupancy[node->level_];
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class HierarchicalTimingWheel;
+
+// 侵入式定时节点：直接嵌在被调度的对象里（当前是 TraceSession），一个对象同一时刻只挂在一个槽上。
+// 重新调度时先 O(1) 从旧槽摘下再挂新槽，不再像懒删除那样把旧节点留在槽里等扫到时才丢。
+// 拷贝语义和 boost::intrusive 的 hook 一致：拷贝出来的节点总是未挂链状态，赋值不改变自身的挂链状态，
+// 这样宿主对象照常可以拷贝/整体赋值，而不会把链表指针复制成两份。
+struct TimingWheelNode
+{
+    TimingWheelNode() = default;
+    TimingWheelNode(const TimingWheelNode&) {}
+    TimingWheelNode& operator=(const TimingWheelNode&) { return *this; }
+
+    bool linked() const { return prev_ != nullptr; }
+    // 最近一次调度的到期 tick 和调用方给的 key；节点摘下后仍保留，便于排障和单测观察。
+    uint64_t expire_tick() const { return expire_tick_; }
+    size_t key() const { return key_; }
+
+private:
+    friend class HierarchicalTimingWheel;
+    TimingWheelNode* prev_ = nullptr;
+    TimingWheelNode* next_ = nullptr;
+    uint64_t expire_tick_ = 0;
+    size_t key_ = 0;
+    uint8_t level_ = 0;
+};
+
+// HierarchicalTimingWheel 是按 tick 推进的多级时间轮：
+// 1) 每级 64 个槽，第 k 级一个槽覆盖 64^k 个 tick，4 级合计约 1677 万 tick，超出的先挂在最高级，轮到时再重新分级；
+// 2) 到期点离得远的节点挂在高层，tick 走到对应边界时整槽降级（cascade）到低层，最终在第 0 级按精确 tick 到期；
+// 3) 槽是带哨兵的双向循环链表，节点侵入在宿主里，挂链/摘链都不分配内存。
+// 它不持锁也不认识 TraceSession，调用方（TraceSessionManager 的 shard）负责加锁，并保证 tick 逐个连续推进。
+class HierarchicalTimingWheel
+{
+public:
+    static constexpr size_t kSlotBits = 6;
+    static constexpr size_t kSlotsPerLevel = size_t{1} << kSlotBits;
+    static constexpr size_t kLevels = 4;
+
+    struct Stats
+    {
+        // 当前挂在轮上的节点总数，以及按层拆开的分布。
+        size_t occupancy = 0;
+        std::array<size_t, kLevels> level_occupancy{};
+        // 已经挂链的节点被重新调度（旧计划原地摘掉）的次数；懒删除实现里这些都会变成槽里的过期节点。
+        uint64_t relinked = 0;
+        // 从高层降到低层的节点次数。
+        uint64_t cascaded = 0;
+        // 在第 0 级到期被摘下交给调用方的次数。
+        uint64_t expired = 0;
+    };
+
+    HierarchicalTimingWheel();
+
+    HierarchicalTimingWheel(const HierarchicalTimingWheel&) = delete;
+    HierarchicalTimingWheel& operator=(const HierarchicalTimingWheel&) = delete;
+
+    // 把节点挂到 expire_tick 上；节点已挂链时先摘掉旧计划。current_tick 是调用方最近一次推进完的 tick，
+    // expire_tick 不晚于它时按 current_tick + 1 处理，保证节点一定会在未来某次 Advance 里被看到。
+    void Schedule(TimingWheelNode* node, size_t key, uint64_t expire_tick, uint64_t current_tick);
+    // 节点未挂链时什么也不做。
+    void Cancel(TimingWheelNode* node);
+    // 处理刚推进到的 new_tick：先把需要降级的高层槽整槽下放，再摘下第 0 级这个 tick 的全部节点，
+    // 把它们的 key 追加到 expired_keys。调用方必须按 1,2,3... 逐个推进，不能跳 tick。
+    void Advance(uint64_t new_tick, std::vector<size_t>* expired_keys);
+    // 摘下所有节点，统计计数保留。
+    void Clear();
+
+    Stats GetStats() const;
+
+private:
+    TimingWheelNode& SlotHead(size_t level, size_t slot) { return slots_[level * kSlotsPerLevel + slot]; }
+    // 按 expire_tick 相对 base_tick 的距离选层选槽并挂链；不做“过去时间”修正，cascade 时到期点可能正好等于 base_tick。
+    void Place(TimingWheelNode* node, uint64_t base_tick);
+    void Link(TimingWheelNode* head, TimingWheelNode* node);
+    void Unlink(TimingWheelNode* node);
+
+    // 每个槽一个哨兵节点，构造后地址固定，所以时间轮本身不可拷贝也不可移动。
+    std::array<TimingWheelNode, kLevels * kSlotsPerLevel> slots_;
+    Stats stats_;
+};
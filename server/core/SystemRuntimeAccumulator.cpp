@@ -134,6 +134,11 @@ void SystemRuntimeAccumulator::RecordAiCallStarted()
     ai_call_total_.fetch_add(1, std::memory_order_relaxed);
 }
 
+void SystemRuntimeAccumulator::RecordAiCacheHit()
+{
+    ai_cache_hit_total_.fetch_add(1, std::memory_order_relaxed);
+}
+
 void SystemRuntimeAccumulator::RecordAiCallCompleted(uint64_t queue_wait_ms,
                                                     uint64_t inference_latency_ms,
                                                     std::optional<TraceAiUsage> usage)
@@ -215,6 +220,7 @@ SystemRuntimeSnapshot SystemRuntimeAccumulator::BuildSnapshotLocked() const
     SystemRuntimeSnapshot snapshot;
     snapshot.overview.total_logs = total_logs_.load(std::memory_order_relaxed);
     snapshot.overview.ai_call_total = ai_call_total_.load(std::memory_order_relaxed);
+    snapshot.overview.ai_cache_hit_total = ai_cache_hit_total_.load(std::memory_order_relaxed);
     snapshot.overview.memory_rss_mb = BytesToMb(memory_rss_bytes_.load(std::memory_order_relaxed));
     snapshot.overview.backpressure_status =
         ToStatusString(backpressure_status_.load(std::memory_order_relaxed));
@@ -22,6 +22,8 @@ struct SystemOverviewSnapshot
 {
     uint64_t total_logs = 0;
     uint64_t ai_call_total = 0;
+    // 结构指纹缓存命中、直接复用历史结果的 trace 数；这些 trace 没有真正调模型，不计入 ai_call_total。
+    uint64_t ai_cache_hit_total = 0;
     uint64_t ai_queue_wait_ms = 0;
     uint64_t ai_inference_latency_ms = 0;
     uint64_t memory_rss_mb = 0;
@@ -73,6 +75,10 @@ public:
     // 这样后面系统监控才能区分“已经发起了多少次”和“真正完成了多少次”。
     void RecordAiCallStarted();
 
+    // 结构指纹缓存命中时记一次。命中不产生模型调用，也没有推理耗时和 usage，
+    // 所以单独计数，不走 started/completed 两步，避免把延迟样本和平均 token 摊薄。
+    void RecordAiCacheHit();
+
     // AI 完成一次调用后，把排队等待、真实推理耗时和可选 usage 一起记进系统运行态。
     // 这里的两张延迟卡吃的是“最近 N 次完成调用”的固定样本平均，而不是全局累计平均。
     void RecordAiCallCompleted(uint64_t queue_wait_ms,
@@ -130,6 +136,7 @@ private:
     std::atomic<uint64_t> ingest_total_{0};
     std::atomic<uint64_t> ai_call_total_{0};
     std::atomic<uint64_t> ai_completion_total_{0};
+    std::atomic<uint64_t> ai_cache_hit_total_{0};
     std::atomic<uint64_t> input_tokens_total_{0};
     std::atomic<uint64_t> output_tokens_total_{0};
     std::atomic<uint64_t> total_tokens_total_{0};
@@ -0,0 +1,100 @@
+#include "core/TraceAiResultCache.h"
+
+#include <utility>
+
+TraceAiResultCache::TraceAiResultCache(size_t capacity, int64_t ttl_ms)
+    : capacity_(capacity),
+      ttl_ms_(ttl_ms)
+{
+}
+
+bool TraceAiResultCache::IsExpired(const Entry& entry, int64_t now_ms) const
+{
+    return ttl_ms_ > 0 && now_ms >= entry.expire_at_ms;
+}
+
+TraceAiResultCache::LookupResult TraceAiResultCache::Lookup(uint64_t key,
+                                                            int64_t now_ms,
+                                                            TraceAiResponse* hit,
+                                                            const WaiterFactory& make_waiter)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto entry_iter = entries_.find(key);
+    if (entry_iter != entries_.end()) {
+        if (!IsExpired(*entry_iter->second, now_ms)) {
+            lru_.splice(lru_.begin(), lru_, entry_iter->second);
+            if (hit) {
+                *hit = entry_iter->second->response;
+            }
+            ++stats_.hits;
+            return LookupResult::Hit;
+        }
+        // 过期条目在查找时顺手清掉，不单独起后台扫描：缓存规模很小，惰性删除足够。
+        lru_.erase(entry_iter->second);
+        entries_.erase(entry_iter);
+        ++stats_.expirations;
+    }
+
+    auto inflight_iter = inflight_.find(key);
+    if (inflight_iter != inflight_.end()) {
+        inflight_iter->second.push_back(make_waiter ? make_waiter() : Waiter{});
+        ++stats_.coalesced;
+        return LookupResult::Joined;
+    }
+    inflight_.emplace(key, std::vector<Waiter>{});
+    ++stats_.misses;
+    return LookupResult::Leader;
+}
+
+void TraceAiResultCache::Complete(uint64_t key, const TraceAiResponse* response, int64_t now_ms)
+{
+    std::vector<Waiter> waiters;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto inflight_iter = inflight_.find(key);
+        if (inflight_iter != inflight_.end()) {
+            waiters = std::move(inflight_iter->second);
+            inflight_.erase(inflight_iter);
+        }
+        if (response && capacity_ > 0) {
+            Entry entry;
+            entry.key = key;
+            entry.response = *response;
+            // 缓存里的结果不再对应任何一次真实模型调用，usage 不能跟着复用，否则命中一次 token 统计就虚增一份。
+            entry.response.usage.reset();
+            entry.expire_at_ms = now_ms + ttl_ms_;
+            auto entry_iter = entries_.find(key);
+            if (entry_iter != entries_.end()) {
+                *entry_iter->second = std::move(entry);
+                lru_.splice(lru_.begin(), lru_, entry_iter->second);
+            } else {
+                lru_.push_front(std::move(entry));
+                entries_.emplace(key, lru_.begin());
+                if (lru_.size() > capacity_) {
+                    entries_.erase(lru_.back().key);
+                    lru_.pop_back();
+                    ++stats_.evictions;
+                }
+            }
+        }
+    }
+
+    std::optional<TraceAiResponse> shared;
+    if (response) {
+        shared = *response;
+        shared->usage.reset();
+    }
+    for (Waiter& waiter : waiters) {
+        if (waiter) {
+            waiter(shared);
+        }
+    }
+}
+
+TraceAiResultCache::Stats TraceAiResultCache::GetStats() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    Stats stats = stats_;
+    stats.size = lru_.size();
+    return stats;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+#include "ai/AiTypes.h"
+
+// TraceAiResultCache 按 trace 的结构指纹缓存 AI 分析结果：
+// 1) 命中且没过 TTL 时直接复用上一次的 TraceAiResponse，不再调模型；
+// 2) 同一指纹已经有一条 trace 正在调模型时，后来者不再各自发请求，而是挂在这次调用上等结果（singleflight）；
+// 3) 容量按条数封顶，满了按 LRU 淘汰。
+// 指纹怎么算由 TraceSessionManager 决定，这一层只认 uint64 key，不理解 trace 结构。
+class TraceAiResultCache
+{
+public:
+    // 挂起等待者拿到的结果：有值表示领头调用成功并带回了可复用的结果；
+    // nullopt 表示领头调用失败或根本没调（熔断、provider 缺失），等待者要自己走一遍正常 AI 调用。
+    using Waiter = std::function<void(std::optional<TraceAiResponse>)>;
+    // 等待者通常要把整个任务搬进堆上的共享上下文才能挂起，这一步只有真的要排队时才值得做，
+    // 所以 Lookup 收的是 waiter 的工厂：只在返回 Joined 的那一次、在缓存锁内调用它。
+    using WaiterFactory = std::function<Waiter()>;
+
+    enum class LookupResult
+    {
+        // 直接命中，结果已经写进出参。
+        Hit,
+        // 同指纹已有领头调用在途，waiter 已挂上，结果回来时由 Complete 回调。
+        Joined,
+        // 没命中也没人在途，当前调用方成为领头者，拿到结果后必须调用 Complete，否则挂上的等待者永远不会被唤醒。
+        Leader
+    };
+
+    struct Stats
+    {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t coalesced = 0;
+        uint64_t evictions = 0;
+        uint64_t expirations = 0;
+        size_t size = 0;
+    };
+
+    // capacity=0 表示不缓存结果，但 singleflight 合并仍然生效；ttl_ms<=0 表示条目不过期，只靠 LRU 淘汰。
+    TraceAiResultCache(size_t capacity, int64_t ttl_ms);
+
+    TraceAiResultCache(const TraceAiResultCache&) = delete;
+    TraceAiResultCache& operator=(const TraceAiResultCache&) = delete;
+
+    // 只有返回 Joined 时才会调用 make_waiter；工厂里不能再回头访问这个缓存，否则会自锁。
+    LookupResult Lookup(uint64_t key, int64_t now_ms, TraceAiResponse* hit, const WaiterFactory& make_waiter);
+    // 领头者收尾：response 非空时写入缓存并把结果分发给等待者，为空时只唤醒等待者让它们各自重试。
+    // 等待者回调在锁外、在调用 Complete 的线程上同步执行。
+    void Complete(uint64_t key, const TraceAiResponse* response, int64_t now_ms);
+
+    Stats GetStats() const;
+
+private:
+    struct Entry
+    {
+        uint64_t key = 0;
+        TraceAiResponse response;
+        int64_t expire_at_ms = 0;
+    };
+    using LruList = std::list<Entry>;
+
+    bool IsExpired(const Entry& entry, int64_t now_ms) const;
+
+    const size_t capacity_;
+    const int64_t ttl_ms_;
+
+    mutable std::mutex mutex_;
+    // 链表头是最近用过的条目；map 存链表迭代器，命中时 splice 到表头，全程不拷贝 response。
+    LruList lru_;
+    std::unordered_map<uint64_t, LruList::iterator> entries_;
+    // 在途的领头调用：key -> 挂在它上面的等待者。
+    std::unordered_map<uint64_t, std::vector<Waiter>> inflight_;
+    Stats stats_;
+};
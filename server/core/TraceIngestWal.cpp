@@ -0,0 +1,900 @@
+#include "core/TraceIngestWal.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <unistd.h>
+#include <utility>
+
+#include "core/TraceSessionManager.h"
+
+namespace
+{
+constexpr char kSegmentMagic[8] = {'L', 'S', 'W', 'A', 'L', '0', '0', '1'};
+// 记录头：u32 payload 长度 + u32 payload 的 FNV-1a 校验 + u8 记录类型。
+constexpr size_t kRecordHeaderSize = 9;
+constexpr uint8_t kRecordSpan = 1;
+constexpr uint8_t kRecordRelease = 2;
+constexpr const char* kSegmentPrefix = "ingest-";
+constexpr const char* kSegmentSuffix = ".wal";
+// 重放等待 sweep 腾空间时，按这个粒度检查一次 should_stop，关停时不用等满整个重试间隔。
+constexpr int64_t kReplayStopPollMs = 50;
+
+// span 的可选字段压成一个标志字节，缺省字段不占 payload。
+constexpr uint8_t kHasParent = 1u << 0;
+constexpr uint8_t kHasEnd = 1u << 1;
+constexpr uint8_t kHasStatus = 1u << 2;
+constexpr uint8_t kHasKind = 1u << 3;
+constexpr uint8_t kHasTraceEnd = 1u << 4;
+constexpr uint8_t kTraceEndValue = 1u << 5;
+
+uint64_t NowSteadyNs()
+{
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+uint32_t Fnv1a(const char* data, size_t size)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < size; ++i)
+    {
+        hash ^= static_cast<unsigned char>(data[i]);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+template <typename T>
+void PutRaw(std::string* out, T value)
+{
+    out->append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+void PutString(std::string* out, const std::string& value)
+{
+    PutRaw<uint32_t>(out, static_cast<uint32_t>(value.size()));
+    out->append(value);
+}
+
+// 先占住记录头，payload 写完再回填长度和校验，整条记录只在一块 string 里拼一次。
+void BeginRecord(std::string* out, uint8_t type)
+{
+    out->clear();
+    out->resize(kRecordHeaderSize);
+    (*out)[8] = static_cast<char>(type);
+}
+
+void FinishRecord(std::string* out)
+{
+    const uint32_t payload_size = static_cast<uint32_t>(out->size() - kRecordHeaderSize);
+    const uint32_t checksum = Fnv1a(out->data() + kRecordHeaderSize, payload_size);
+    std::memcpy(out->data(), &payload_size, sizeof(payload_size));
+    std::memcpy(out->data() + 4, &checksum, sizeof(checksum));
+}
+
+void EncodeSpan(std::string* out, const SpanEvent& span)
+{
+    uint8_t flags = 0;
+    flags |= span.parent_span_id.has_value() ? kHasParent : 0;
+    flags |= span.end_time.has_value() ? kHasEnd : 0;
+    flags |= span.status.has_value() ? kHasStatus : 0;
+    flags |= span.kind.has_value() ? kHasKind : 0;
+    if (span.trace_end.has_value())
+    {
+        flags |= kHasTraceEnd;
+        flags |= span.trace_end.value() ? kTraceEndValue : 0;
+    }
+    PutRaw<uint64_t>(out, span.trace_key);
+    PutRaw<uint64_t>(out, span.span_id);
+    PutRaw<uint8_t>(out, flags);
+    if (span.parent_span_id.has_value())
+    {
+        PutRaw<uint64_t>(out, span.parent_span_id.value());
+    }
+    PutRaw<int64_t>(out, span.start_time_ms);
+    if (span.end_time.has_value())
+    {
+        PutRaw<int64_t>(out, span.end_time.value());
+    }
+    if (span.status.has_value())
+    {
+        PutRaw<uint8_t>(out, static_cast<uint8_t>(span.status.value()));
+    }
+    if (span.kind.has_value())
+    {
+        PutRaw<uint8_t>(out, static_cast<uint8_t>(span.kind.value()));
+    }
+    PutString(out, span.name);
+    PutString(out, span.service_name);
+    PutRaw<uint32_t>(out, static_cast<uint32_t>(span.attributes.size()));
+    for (const auto& [key, value] : span.attributes)
+    {
+        PutString(out, key);
+        PutString(out, value);
+    }
+}
+
+// 和 TraceSpillQueue 一样只做越界检查，不信任长度字段。
+class PayloadReader
+{
+public:
+    PayloadReader(const char* data, size_t size) : data_(data), size_(size) {}
+
+    template <typename T>
+    bool GetRaw(T* value)
+    {
+        if (size_ - pos_ < sizeof(T))
+        {
+            return false;
+        }
+        std::memcpy(value, data_ + pos_, sizeof(T));
+        pos_ += sizeof(T);
+        return true;
+    }
+
+    bool GetString(std::string* value)
+    {
+        uint32_t length = 0;
+        if (!GetRaw(&length) || size_ - pos_ < length)
+        {
+            return false;
+        }
+        value->assign(data_ + pos_, length);
+        pos_ += length;
+        return true;
+    }
+
+    bool Done() const { return pos_ == size_; }
+
+private:
+    const char* data_;
+    size_t size_;
+    size_t pos_ = 0;
+};
+
+bool DecodeSpan(PayloadReader* in, SpanEvent* span)
+{
+    uint64_t trace_key = 0;
+    uint64_t span_id = 0;
+    uint8_t flags = 0;
+    if (!in->GetRaw(&trace_key) || !in->GetRaw(&span_id) || !in->GetRaw(&flags))
+    {
+        return false;
+    }
+    span->trace_key = static_cast<size_t>(trace_key);
+    span->span_id = static_cast<size_t>(span_id);
+    if (flags & kHasParent)
+    {
+        uint64_t parent = 0;
+        if (!in->GetRaw(&parent))
+        {
+            return false;
+        }
+        span->parent_span_id = static_cast<size_t>(parent);
+    }
+    if (!in->GetRaw(&span->start_time_ms))
+    {
+        return false;
+    }
+    if (flags & kHasEnd)
+    {
+        int64_t end_time = 0;
+        if (!in->GetRaw(&end_time))
+        {
+            return false;
+        }
+        span->end_time = end_time;
+    }
+    if (flags & kHasStatus)
+    {
+        uint8_t status = 0;
+        if (!in->GetRaw(&status) || status > static_cast<uint8_t>(SpanEvent::Status::Error))
+        {
+            return false;
+        }
+        span->status = static_cast<SpanEvent::Status>(status);
+    }
+    if (flags & kHasKind)
+    {
+        uint8_t kind = 0;
+        if (!in->GetRaw(&kind) || kind > static_cast<uint8_t>(SpanEvent::Kind::Consumer))
+        {
+            return false;
+        }
+        span->kind = static_cast<SpanEvent::Kind>(kind);
+    }
+    if (flags & kHasTraceEnd)
+    {
+        span->trace_end = (flags & kTraceEndValue) != 0;
+    }
+    uint32_t attribute_count = 0;
+    if (!in->GetString(&span->name) || !in->GetString(&span->service_name) || !in->GetRaw(&attribute_count))
+    {
+        return false;
+    }
+    for (uint32_t i = 0; i < attribute_count; ++i)
+    {
+        std::string key;
+        std::string value;
+        if (!in->GetString(&key) || !in->GetString(&value))
+        {
+            return false;
+        }
+        span->attributes.emplace(std::move(key), std::move(value));
+    }
+    return true;
+}
+
+bool WriteAll(int fd, const char* data, size_t size)
+{
+    while (size > 0)
+    {
+        const ssize_t n = ::write(fd, data, size);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return false;
+        }
+        data += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+// 新段文件的目录项也要落盘，否则掉电后文件本身可能整个不见；每段只做一次，成本可以忽略。
+void SyncDirectory(const std::string& dir)
+{
+    const int dir_fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd >= 0)
+    {
+        (void)::fsync(dir_fd);
+        ::close(dir_fd);
+    }
+}
+}
+
+TraceIngestWal::TraceIngestWal(Options options)
+    : options_(std::move(options))
+{
+    std::error_code ec;
+    std::filesystem::create_directories(options_.dir, ec);
+    if (ec)
+    {
+        throw std::runtime_error("TraceIngestWal: failed to create " + options_.dir + ": " + ec.message());
+    }
+    ScanExistingSegments();
+    const size_t stripe_count = std::max<size_t>(1, options_.stripes);
+    stripes_.reserve(stripe_count);
+    for (size_t i = 0; i < stripe_count; ++i)
+    {
+        stripes_.push_back(std::make_unique<Stripe>());
+    }
+    // 第一个段在构造期就打开：目录不可写这类问题启动时直接失败，而不是等第一次 group commit 才发现。
+    const uint64_t first_segment = recovered_segments_.empty() ? 1 : recovered_segments_.back() + 1;
+    if (!OpenSegmentForWrite(first_segment))
+    {
+        throw std::runtime_error("TraceIngestWal: failed to open " + SegmentPath(first_segment) + ": " +
+                                 std::strerror(errno));
+    }
+    sync_thread_ = std::thread(&TraceIngestWal::SyncLoop, this);
+}
+
+TraceIngestWal::~TraceIngestWal()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    sync_cv_.notify_all();
+    round_cv_.notify_all();
+    if (sync_thread_.joinable())
+    {
+        sync_thread_.join();
+    }
+    if (write_fd_ >= 0)
+    {
+        ::close(write_fd_);
+    }
+}
+
+std::string TraceIngestWal::SegmentPath(uint64_t segment) const
+{
+    // 段号补零到 20 位，目录里按文件名排序就是写入顺序，排查时 ls 一眼能看出先后。
+    char name[64];
+    std::snprintf(name, sizeof(name), "%s%020llu%s", kSegmentPrefix, static_cast<unsigned long long>(segment),
+                  kSegmentSuffix);
+    return (std::filesystem::path(options_.dir) / name).string();
+}
+
+void TraceIngestWal::ScanExistingSegments()
+{
+    const std::string prefix = kSegmentPrefix;
+    const std::string suffix = kSegmentSuffix;
+    for (const auto& entry : std::filesystem::directory_iterator(options_.dir))
+    {
+        const std::string name = entry.path().filename().string();
+        if (name.size() <= prefix.size() + suffix.size() || name.compare(0, prefix.size(), prefix) != 0 ||
+            name.compare(name.size() - suffix.size(), suffix.size(), suffix) != 0)
+        {
+            continue;
+        }
+        const std::string digits = name.substr(prefix.size(), name.size() - prefix.size() - suffix.size());
+        if (!std::all_of(digits.begin(), digits.end(), [](char c) { return c >= '0' && c <= '9'; }))
+        {
+            continue;
+        }
+        recovered_segments_.push_back(std::strtoull(digits.c_str(), nullptr, 10));
+    }
+    std::sort(recovered_segments_.begin(), recovered_segments_.end());
+}
+
+std::vector<SpanEvent> TraceIngestWal::TakeRecoveredSpans()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<SpanEvent> spans;
+    if (recovered_taken_)
+    {
+        return spans;
+    }
+    recovered_taken_ = true;
+
+    // 同一个 trace_key 的 span 下标；读到它的释放标记时，之前记下的 span 全部作废。
+    std::vector<bool> released;
+    std::unordered_map<size_t, std::vector<size_t>> indices_by_trace;
+    for (uint64_t segment : recovered_segments_)
+    {
+        const std::string path = SegmentPath(segment);
+        std::ifstream in(path, std::ios::binary);
+        const std::string content((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        if (content.size() < sizeof(kSegmentMagic) ||
+            std::memcmp(content.data(), kSegmentMagic, sizeof(kSegmentMagic)) != 0)
+        {
+            // 文件头都没写完就掉电的段，或者目录里混进了别的文件；里面没有可信的记录。
+            continue;
+        }
+        size_t offset = sizeof(kSegmentMagic);
+        while (content.size() - offset >= kRecordHeaderSize)
+        {
+            uint32_t payload_size = 0;
+            uint32_t checksum = 0;
+            std::memcpy(&payload_size, content.data() + offset, sizeof(payload_size));
+            std::memcpy(&checksum, content.data() + offset + 4, sizeof(checksum));
+            const uint8_t type = static_cast<uint8_t>(content[offset + 8]);
+            const size_t payload_offset = offset + kRecordHeaderSize;
+            if (content.size() - payload_offset < payload_size ||
+                Fnv1a(content.data() + payload_offset, payload_size) != checksum)
+            {
+                // 半截记录或者校验不对：只可能是崩溃时最后一次 group commit 没写完，这一段后面不会再有有效记录。
+                break;
+            }
+            PayloadReader reader(content.data() + payload_offset, payload_size);
+            if (type == kRecordSpan)
+            {
+                SpanEvent span;
+                if (DecodeSpan(&reader, &span) && reader.Done())
+                {
+                    indices_by_trace[span.trace_key].push_back(spans.size());
+                    spans.push_back(std::move(span));
+                    released.push_back(false);
+                }
+            }
+            else if (type == kRecordRelease)
+            {
+                uint64_t trace_key = 0;
+                if (reader.GetRaw(&trace_key) && reader.Done())
+                {
+                    auto iter = indices_by_trace.find(static_cast<size_t>(trace_key));
+                    if (iter != indices_by_trace.end())
+                    {
+                        for (size_t index : iter->second)
+                        {
+                            released[index] = true;
+                        }
+                        indices_by_trace.erase(iter);
+                    }
+                }
+            }
+            offset = payload_offset + payload_size;
+        }
+    }
+
+    std::vector<SpanEvent> live;
+    live.reserve(spans.size());
+    for (size_t i = 0; i < spans.size(); ++i)
+    {
+        if (released[i])
+        {
+            ++stats_.recovered_skipped_spans;
+            continue;
+        }
+        live.push_back(std::move(spans[i]));
+    }
+    stats_.recovered_spans += live.size();
+    return live;
+}
+
+void TraceIngestWal::DropRecoveredSegments()
+{
+    std::vector<uint64_t> segments;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        segments.swap(recovered_segments_);
+        stats_.deleted_segments += segments.size();
+    }
+    for (uint64_t segment : segments)
+    {
+        (void)::unlink(SegmentPath(segment).c_str());
+    }
+}
+
+TraceIngestWal::ReplayResult TraceIngestWal::ReplayRecovered(TraceSessionManager& manager,
+                                                             size_t chunk_spans,
+                                                             int64_t retry_delay_ms,
+                                                             const std::function<bool()>& should_stop)
+{
+    ReplayResult result;
+    std::vector<SpanEvent> spans = TakeRecoveredSpans();
+    result.recovered_spans = spans.size();
+    uint64_t dropped_before = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        dropped_before = stats_.dropped_bytes;
+    }
+
+    const size_t chunk_size = std::max<size_t>(1, chunk_spans);
+    std::vector<SpanEvent> chunk;
+    size_t cursor = 0;
+    while (cursor < spans.size())
+    {
+        if (should_stop && should_stop())
+        {
+            break;
+        }
+        const size_t end = std::min(spans.size(), cursor + chunk_size);
+        chunk.assign(std::make_move_iterator(spans.begin() + static_cast<std::ptrdiff_t>(cursor)),
+                     std::make_move_iterator(spans.begin() + static_cast<std::ptrdiff_t>(end)));
+        for (SpanEvent& span : chunk)
+        {
+            // 带着重放标记进聚合态：落库时只有这些 trace 的主键冲突会被当成“崩溃前已经写过”跳过。
+            span.replayed = true;
+        }
+        const std::vector<TraceSessionManager::PushResult> results = manager.PushBatch(chunk);
+
+        // 被拒的 span 按原顺序挪回这一块的末尾，下一次从它们开始重推；已经收下的 span 不会再推第二遍。
+        std::vector<SpanEvent> rejected;
+        for (size_t i = 0; i < chunk.size(); ++i)
+        {
+            if (results[i] == TraceSessionManager::PushResult::RejectedOverload ||
+                results[i] == TraceSessionManager::PushResult::RejectedUnavailable)
+            {
+                rejected.push_back(std::move(chunk[i]));
+                continue;
+            }
+            ++result.accepted_spans;
+        }
+        cursor = end - rejected.size();
+        std::move(rejected.begin(), rejected.end(), spans.begin() + static_cast<std::ptrdiff_t>(cursor));
+        if (rejected.empty())
+        {
+            continue;
+        }
+
+        // 聚合态满了：等 sweep 把到期的 trace 分发出去再试，分段睡眠，关停时能及时退出。
+        ++result.retries;
+        for (int64_t waited_ms = 0; waited_ms < retry_delay_ms; waited_ms += kReplayStopPollMs)
+        {
+            if (should_stop && should_stop())
+            {
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(std::min(kReplayStopPollMs, retry_delay_ms - waited_ms)));
+        }
+    }
+    if (cursor < spans.size())
+    {
+        // 中途放弃：已经收下的 span 也记进了新段，下次启动新旧段一起重放，重放出来的重复 trace 在落库时按主键跳过。
+        return result;
+    }
+
+    // 新段落盘成功、期间也没有记录因积压超限被丢弃，重放进来的 span 才算有了新的持久副本，旧段这时才能删。
+    const bool synced = Sync();
+    bool dropped_during_replay = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        dropped_during_replay = stats_.dropped_bytes != dropped_before;
+    }
+    if (synced && !dropped_during_replay)
+    {
+        DropRecoveredSegments();
+        result.segments_dropped = true;
+    }
+    return result;
+}
+
+TraceIngestWal::Stripe& TraceIngestWal::StripeFor(size_t trace_key)
+{
+    return *stripes_[trace_key % stripes_.size()];
+}
+
+void TraceIngestWal::Append(const SpanEvent& span, bool pin_trace)
+{
+    // 编码在锁外的线程局部缓冲里做完，持锁期间只剩一次 memcpy 和几次计数；缓冲容量跨调用复用，稳态下不再分配。
+    thread_local std::string record;
+    BeginRecord(&record, kRecordSpan);
+    EncodeSpan(&record, span);
+    FinishRecord(&record);
+
+    Stripe& stripe = StripeFor(span.trace_key);
+    std::lock_guard<std::mutex> lock(stripe.mutex);
+    stripe.staged.bytes.append(record);
+    ++stripe.appended_spans;
+    stripe.appended_bytes += record.size();
+    if (!pin_trace)
+    {
+        return;
+    }
+    auto iter = stripe.pin_counts.try_emplace(span.trace_key, 0).first;
+    const int64_t count = ++iter->second;
+    if (count == 1)
+    {
+        // 段号要等这批记录真正写进某个段才知道，这里只记一个“开始钉”的事件，交给收集侧落到段上。
+        stripe.staged.pin_events.push_back(PinEvent{span.trace_key, true});
+        ++stripe.pinned_traces;
+    }
+    else if (count == 0)
+    {
+        // 释放已经抢先到过（见 Stripe::pin_counts），这一钉和它抵消，不再占段。
+        stripe.pin_counts.erase(iter);
+    }
+}
+
+void TraceIngestWal::ReleaseTrace(size_t trace_key)
+{
+    Stripe& stripe = StripeFor(trace_key);
+    std::lock_guard<std::mutex> lock(stripe.mutex);
+    ReleaseTraceInStripe(stripe, trace_key);
+}
+
+void TraceIngestWal::ReleaseTraces(const std::vector<persistence::TraceSummary>& summaries)
+{
+    for (const auto& summary : summaries)
+    {
+        char* end = nullptr;
+        const unsigned long long trace_key = std::strtoull(summary.trace_id.c_str(), &end, 10);
+        if (summary.trace_id.empty() || end == nullptr || *end != '\0')
+        {
+            continue;
+        }
+        ReleaseTrace(static_cast<size_t>(trace_key));
+    }
+}
+
+void TraceIngestWal::ReleaseTraceInStripe(Stripe& stripe, size_t trace_key)
+{
+    auto iter = stripe.pin_counts.try_emplace(trace_key, 0).first;
+    const int64_t count = --iter->second;
+    if (count > 0)
+    {
+        // 同一个 trace_key 还有别的 session 钉着，它的 span 不能被释放标记一起作废。
+        return;
+    }
+    if (count == 0)
+    {
+        stripe.pin_counts.erase(iter);
+        stripe.staged.pin_events.push_back(PinEvent{trace_key, false});
+        --stripe.pinned_traces;
+    }
+
+    // 释放标记让重启时跳过这条 trace 在老段里的 span；段本身等下一轮 group commit 之后再判断能不能删。
+    std::string record;
+    BeginRecord(&record, kRecordRelease);
+    PutRaw<uint64_t>(&record, static_cast<uint64_t>(trace_key));
+    FinishRecord(&record);
+    stripe.staged.bytes.append(record);
+    ++stripe.released_traces;
+}
+
+bool TraceIngestWal::Sync()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (stopping_)
+    {
+        return false;
+    }
+    // 只认调用之后才开始的那一轮：它收集条带时，调用前追加的记录一定已经在条带或积压里。
+    const uint64_t target = started_rounds_ + 1;
+    sync_requested_ = true;
+    sync_cv_.notify_one();
+    round_cv_.wait(lock, [this, target]() { return completed_rounds_ >= target || stopping_; });
+    return last_ok_round_ >= target;
+}
+
+void TraceIngestWal::SyncLoop()
+{
+    const auto interval = std::chrono::milliseconds(std::max<int64_t>(1, options_.sync_interval_ms));
+    // 每个条带一块收集缓冲，和条带里的缓冲来回交换，容量跨轮复用。
+    std::vector<StagedBatch> round(stripes_.size());
+    while (true)
+    {
+        uint64_t round_id = 0;
+        bool stopping = false;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            sync_cv_.wait_for(lock, interval, [this]() { return stopping_ || sync_requested_; });
+            sync_requested_ = false;
+            round_id = ++started_rounds_;
+            stopping = stopping_;
+        }
+
+        // 收集：条带锁只持有一次 swap 的时间，热路径几乎感觉不到写盘线程。
+        uint64_t round_bytes = 0;
+        for (size_t i = 0; i < stripes_.size(); ++i)
+        {
+            {
+                std::lock_guard<std::mutex> lock(stripes_[i]->mutex);
+                std::swap(stripes_[i]->staged, round[i]);
+            }
+            round_bytes += round[i].bytes.size();
+        }
+        bool dropped = false;
+        if (backlog_bytes_ > 0 && backlog_bytes_ + round_bytes > options_.max_backlog_bytes)
+        {
+            // 磁盘一直写不进去、积压已经到上限：丢掉本轮新收的记录，钉子事件照常保留，段的保留判断不乱。
+            for (StagedBatch& batch : round)
+            {
+                batch.bytes.clear();
+            }
+            dropped = round_bytes > 0;
+            std::lock_guard<std::mutex> lock(mutex_);
+            stats_.dropped_bytes += round_bytes;
+            round_bytes = 0;
+        }
+
+        // 先写积压再写本轮：同一个条带的记录和钉子事件始终按发生顺序落盘、落账。
+        std::vector<const StagedBatch*> batches;
+        batches.reserve(backlog_.size() + round.size());
+        for (const StagedBatch& batch : backlog_)
+        {
+            batches.push_back(&batch);
+        }
+        for (const StagedBatch& batch : round)
+        {
+            batches.push_back(&batch);
+        }
+        const uint64_t total_bytes = backlog_bytes_ + round_bytes;
+        const uint64_t begin_ns = NowSteadyNs();
+        const bool ok = WriteStaged(batches, total_bytes);
+        const uint64_t elapsed_ns = NowSteadyNs() - begin_ns;
+
+        std::vector<uint64_t> deletable;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (total_bytes > 0)
+            {
+                ++stats_.sync_count;
+                stats_.sync_total_ns += elapsed_ns;
+                stats_.sync_max_ns = std::max(stats_.sync_max_ns, elapsed_ns);
+            }
+            if (ok)
+            {
+                ApplyPinEventsLocked(batches, write_segment_);
+                // 只有写盘成功之后才删段：失败时积压的记录还没有新副本，老段里的那份不能动。
+                deletable = CollectDeletableSegmentsLocked();
+            }
+            else
+            {
+                // 磁盘满/IO 错误：入口请求照常收，WAL 是兜底，不是主链路；记录留在内存里下一轮换新段重写。
+                ++stats_.sync_fail_count;
+            }
+        }
+
+        if (ok)
+        {
+            backlog_.clear();
+            backlog_bytes_ = 0;
+            for (StagedBatch& batch : round)
+            {
+                batch.bytes.clear();
+                batch.pin_events.clear();
+            }
+        }
+        else
+        {
+            for (StagedBatch& batch : round)
+            {
+                if (!batch.bytes.empty() || !batch.pin_events.empty())
+                {
+                    backlog_bytes_ += batch.bytes.size();
+                    backlog_.push_back(std::move(batch));
+                    batch = StagedBatch();
+                }
+            }
+        }
+
+        // 先删段再宣布这一轮结束：Sync 返回时调用方能看到释放带来的删段效果。
+        for (uint64_t segment : deletable)
+        {
+            (void)::unlink(SegmentPath(segment).c_str());
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stats_.deleted_segments += deletable.size();
+            stats_.backlog_bytes = backlog_bytes_;
+            completed_rounds_ = round_id;
+            if (ok && !dropped)
+            {
+                last_ok_round_ = round_id;
+            }
+        }
+        round_cv_.notify_all();
+
+        if (stopping)
+        {
+            break;
+        }
+    }
+}
+
+bool TraceIngestWal::WriteStaged(const std::vector<const StagedBatch*>& batches, uint64_t total_bytes)
+{
+    if (total_bytes == 0)
+    {
+        return true;
+    }
+    if (write_fd_ >= 0 && write_segment_bytes_ > sizeof(kSegmentMagic) &&
+        write_segment_bytes_ + total_bytes > options_.segment_bytes)
+    {
+        // 当前段装不下这一轮：上一轮结束时它已经 fdatasync 过，直接关掉，整轮写进新段。
+        ::close(write_fd_);
+        write_fd_ = -1;
+    }
+    if (write_fd_ < 0 && !OpenSegmentForWrite(write_segment_ + 1))
+    {
+        return false;
+    }
+
+    bool ok = true;
+    for (const StagedBatch* batch : batches)
+    {
+        if (!batch->bytes.empty() && !WriteAll(write_fd_, batch->bytes.data(), batch->bytes.size()))
+        {
+            ok = false;
+            break;
+        }
+    }
+    ok = ok && ::fdatasync(write_fd_) == 0;
+    if (!ok)
+    {
+        // 这个段的尾巴可能只写了一半；不再往里追加，下一轮整份积压写进新段，重放时半截记录会让这个段在断点处停下。
+        ::close(write_fd_);
+        write_fd_ = -1;
+        return false;
+    }
+    write_segment_bytes_ += total_bytes;
+    return true;
+}
+
+bool TraceIngestWal::OpenSegmentForWrite(uint64_t segment)
+{
+    const std::string path = SegmentPath(segment);
+    const int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        return false;
+    }
+    if (!WriteAll(fd, kSegmentMagic, sizeof(kSegmentMagic)))
+    {
+        ::close(fd);
+        return false;
+    }
+    SyncDirectory(options_.dir);
+    write_fd_ = fd;
+    write_segment_ = segment;
+    write_segment_bytes_ = sizeof(kSegmentMagic);
+    std::lock_guard<std::mutex> lock(mutex_);
+    live_segments_.push_back(segment);
+    return true;
+}
+
+void TraceIngestWal::ApplyPinEventsLocked(const std::vector<const StagedBatch*>& batches, uint64_t segment)
+{
+    for (const StagedBatch* batch : batches)
+    {
+        for (const PinEvent& event : batch->pin_events)
+        {
+            if (event.pinned)
+            {
+                if (trace_segments_.emplace(event.trace_key, segment).second)
+                {
+                    ++segment_pins_[segment];
+                }
+                continue;
+            }
+            auto iter = trace_segments_.find(event.trace_key);
+            if (iter == trace_segments_.end())
+            {
+                continue;
+            }
+            auto segment_iter = segment_pins_.find(iter->second);
+            if (segment_iter != segment_pins_.end() && --segment_iter->second == 0)
+            {
+                segment_pins_.erase(segment_iter);
+            }
+            trace_segments_.erase(iter);
+        }
+    }
+}
+
+std::vector<uint64_t> TraceIngestWal::CollectDeletableSegmentsLocked()
+{
+    // 还要保留的最老段：最老的钉子和写盘线程正开着的段取较小值。
+    // 还在条带里没收走的记录只会写进当前段或之后的段，不影响判断。
+    uint64_t keep_from = write_segment_;
+    if (!segment_pins_.empty())
+    {
+        keep_from = std::min(keep_from, segment_pins_.begin()->first);
+    }
+    std::vector<uint64_t> deletable;
+    auto split = std::lower_bound(live_segments_.begin(), live_segments_.end(), keep_from);
+    deletable.assign(live_segments_.begin(), split);
+    live_segments_.erase(live_segments_.begin(), split);
+    return deletable;
+}
+
+TraceIngestWal::Stats TraceIngestWal::SnapshotStats() const
+{
+    Stats stats;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stats = stats_;
+        stats.live_segments = live_segments_.size() + recovered_segments_.size();
+    }
+    // 追加侧的计数分散在各条带里，逐个加锁累加；不和 mutex_ 嵌套，避免和收集线程形成锁序。
+    for (const auto& stripe : stripes_)
+    {
+        std::lock_guard<std::mutex> lock(stripe->mutex);
+        stats.appended_spans += stripe->appended_spans;
+        stats.appended_bytes += stripe->appended_bytes;
+        stats.released_traces += stripe->released_traces;
+        stats.pinned_traces += stripe->pinned_traces;
+    }
+    return stats;
+}
+
+std::string TraceIngestWal::DescribeStats() const
+{
+    const Stats stats = SnapshotStats();
+    std::ostringstream oss;
+    oss << "wal_appended_spans=" << stats.appended_spans
+        << ", wal_appended_bytes=" << stats.appended_bytes
+        << ", wal_released_traces=" << stats.released_traces
+        << ", wal_sync_count=" << stats.sync_count
+        << ", wal_sync_fail_count=" << stats.sync_fail_count
+        << ", wal_sync_avg_ms="
+        << (stats.sync_count > 0 ? (static_cast<double>(stats.sync_total_ns) / stats.sync_count / 1'000'000.0) : 0.0)
+        << ", wal_sync_max_ms=" << (static_cast<double>(stats.sync_max_ns) / 1'000'000.0)
+        << ", wal_spans_per_sync="
+        << (stats.sync_count > 0 ? (static_cast<double>(stats.appended_spans) / stats.sync_count) : 0.0)
+        << ", wal_backlog_bytes=" << stats.backlog_bytes
+        << ", wal_dropped_bytes=" << stats.dropped_bytes
+        << ", wal_live_segments=" << stats.live_segments
+        << ", wal_deleted_segments=" << stats.deleted_segments
+        << ", wal_pinned_traces=" << stats.pinned_traces
+        << ", wal_recovered_spans=" << stats.recovered_spans
+        << ", wal_recovered_skipped_spans=" << stats.recovered_skipped_spans;
+    return oss.str();
+}
@@ -0,0 +1,188 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "persistence/TraceTypes.h"
+
+struct SpanEvent;
+class TraceSessionManager;
+
+// TraceIngestWal 是入口侧的预写日志：/logs/spans 返回 202 之后，span 在落库之前只活在 TraceSessionManager 的内存里，
+// 进程崩溃会丢掉 idle_timeout + flush 间隔这么长的数据。打开 WAL 后：
+// 1) Push 在放掉 shard 锁之后把 span 编码进线程局部缓冲，再追加到 trace_key 对应的条带（stripe）缓冲里；
+//    条带按 trace_key 取模，条带数和 session shard 数对齐，热路径上只有一次编码和一把条带锁，不碰磁盘，也没有全局锁；
+// 2) 后台线程按 sync_interval_ms 做 group commit：把各条带攒下的记录收走，一次 write + fdatasync，
+//    所以崩溃最多丢一个同步间隔的数据，而不是每个 span 一次 fsync。写盘失败的记录留在内存里，下一轮换一个新段重写；
+// 3) 文件按 segment_bytes 切段，一轮收走的记录整块写进同一段，所以段大小是软上限。
+//    每条 trace 在条带里记一个钉子计数，第一次钉住时在收集侧记下“这轮记录写进了哪个段”，等它的主数据落进 SQLite
+//    或溢出文件（或者被尾部采样丢弃）才解钉；写失败又没能溢出的 trace 一直钉着，下次启动重放。
+//    最老的钉子之前的段在一轮写盘成功之后整段删除；
+// 4) 启动时按段号顺序读回旧段，跳过已经写过“释放”标记的 trace，剩下的 span 由 ReplayRecovered 分块重新 Push 进
+//    TraceSessionManager；全部被收下并且落进新段之后，旧段才删。
+// 释放标记和 span 记录一样走 group commit；崩溃前最后一个同步间隔里释放的 trace 可能被重放第二次，
+// 这是“至少一次”语义的代价：重放的 span 带 replayed 标记，SQLite 侧只对这些 trace 按主键跳过重复行并计数；
+// 分发时库里已经有分析结果的重放 trace 不再调模型、不再告警，避免崩溃重启后同一条 trace 重复告警。
+// 整数按本机字节序写入，WAL 只在本机重放，不作为跨机器交换格式。
+class TraceIngestWal
+{
+public:
+    struct Options
+    {
+        // 段文件所在目录，不存在时自动创建。
+        std::string dir;
+        // 单个段文件的大小上限，超过后下一轮记录写进新段。
+        uint64_t segment_bytes = 64 * 1024 * 1024;
+        // group commit 间隔：一个间隔内追加的记录共用一次 fdatasync。
+        int64_t sync_interval_ms = 20;
+        // 追加侧的条带数，main 里取 session shard 数；同一个 trace_key 总落在同一个条带，记录顺序和钉子计数都在条带内自洽。
+        size_t stripes = 16;
+        // 写盘持续失败时内存里最多积压多少字节等着重写；超出后新收上来的记录直接丢弃并计数，不让故障磁盘拖垮内存。
+        uint64_t max_backlog_bytes = 256 * 1024 * 1024;
+    };
+
+    struct Stats
+    {
+        // 追加的 span 记录数 / 编码后的字节数，以及释放标记数。
+        uint64_t appended_spans = 0;
+        uint64_t appended_bytes = 0;
+        uint64_t released_traces = 0;
+        // group commit 次数、累计和最长的 write + fdatasync 耗时，以及写盘失败次数。
+        uint64_t sync_count = 0;
+        uint64_t sync_total_ns = 0;
+        uint64_t sync_max_ns = 0;
+        uint64_t sync_fail_count = 0;
+        // 写盘失败后等着重写的字节数，以及积压超限被丢弃的字节数。
+        uint64_t backlog_bytes = 0;
+        uint64_t dropped_bytes = 0;
+        // 磁盘上还留着的段数、已删除的段数，以及当前被钉住的 trace 数。
+        uint64_t live_segments = 0;
+        uint64_t deleted_segments = 0;
+        uint64_t pinned_traces = 0;
+        // 启动时从旧段读回的 span 数，以及因为已释放而跳过的 span 数。
+        uint64_t recovered_spans = 0;
+        uint64_t recovered_skipped_spans = 0;
+    };
+
+    struct ReplayResult
+    {
+        // 读回的 span 数、最终被 TraceSessionManager 收下的 span 数，以及因为过载/不可用被拒后重试的次数。
+        size_t recovered_spans = 0;
+        size_t accepted_spans = 0;
+        size_t retries = 0;
+        // 旧段是否已经删除：只有全部 span 被收下、并且新段 Sync 成功时才删；否则旧段留着，下次启动再重放。
+        bool segments_dropped = false;
+    };
+
+    // 目录建不起来、段文件打不开或者文件头不对时抛 std::runtime_error，和 TraceSpillQueue 的处理方式一致。
+    explicit TraceIngestWal(Options options);
+    ~TraceIngestWal();
+
+    TraceIngestWal(const TraceIngestWal&) = delete;
+    TraceIngestWal& operator=(const TraceIngestWal&) = delete;
+
+    // 启动时读回旧段里还没释放的 span，按原始到达顺序返回；只能调一次。
+    // 调用方把它们重新 Push 进 TraceSessionManager（重新记进新段）并且 Sync 成功之后，再调 DropRecoveredSegments 删掉旧段。
+    std::vector<SpanEvent> TakeRecoveredSpans();
+    void DropRecoveredSegments();
+    // 启动重放的完整流程：每块 chunk_spans 个 span 调一次 PushBatch，被过载/不可用拒掉的 span 等 retry_delay_ms
+    // 后按原顺序重推，等 sweep 把聚合态腾出空间；should_stop 返回 true 时放弃，旧段保留。
+    // 会阻塞到重放结束，main 放在后台线程里跑，sweep 定时器要先注册好。
+    ReplayResult ReplayRecovered(TraceSessionManager& manager,
+                                 size_t chunk_spans,
+                                 int64_t retry_delay_ms,
+                                 const std::function<bool()>& should_stop);
+
+    // 由 TraceSessionManager 在放掉 shard 锁之后调用。pin_trace=true 表示这是 session 的第一个 span，要把 trace 钉住。
+    void Append(const SpanEvent& span, bool pin_trace);
+    // 解钉一条 trace。同一个 trace_key 被钉了几次（旧 session 还在刷盘时又来了新 session）就要释放几次，
+    // 计数归零时才写释放标记。
+    void ReleaseTrace(size_t trace_key);
+    // BufferedTraceRepository 的 primary flush 回调入口；trace_id 按 TraceSessionManager 的约定是 trace_key 的十进制串。
+    void ReleaseTraces(const std::vector<persistence::TraceSummary>& summaries);
+    // 立刻做一次 group commit 并等它结束。返回 true 表示调用之前追加的记录都已经 fdatasync 落盘；
+    // 写盘失败、这一轮有记录因积压超限被丢弃，或者 WAL 正在析构时返回 false。
+    bool Sync();
+
+    Stats SnapshotStats() const;
+    std::string DescribeStats() const;
+
+private:
+    // 钉子的开始/结束事件，按条带内的发生顺序交给收集侧，在记录写盘成功之后落到具体段号上。
+    struct PinEvent
+    {
+        size_t trace_key = 0;
+        bool pinned = false;
+    };
+
+    // 一个条带一次收走的内容：编码好的记录和这段时间里的钉子事件。
+    struct StagedBatch
+    {
+        std::string bytes;
+        std::vector<PinEvent> pin_events;
+    };
+
+    struct Stripe
+    {
+        std::mutex mutex;
+        StagedBatch staged;
+        // trace_key -> 钉子计数。计数带符号：Append 放在 shard 锁外，极少数情况下释放会抢在钉子前面，
+        // 先减到 -1 再被补回 0，不会把计数记乱。
+        std::unordered_map<size_t, int64_t> pin_counts;
+        uint64_t pinned_traces = 0;
+        uint64_t appended_spans = 0;
+        uint64_t appended_bytes = 0;
+        uint64_t released_traces = 0;
+    };
+
+    std::string SegmentPath(uint64_t segment) const;
+    void ScanExistingSegments();
+    Stripe& StripeFor(size_t trace_key);
+    void ReleaseTraceInStripe(Stripe& stripe, size_t trace_key);
+    void SyncLoop();
+    // 把积压和本轮收上来的记录写进当前段并 fdatasync；需要时先切到新段。只由 sync 线程调用。
+    bool WriteStaged(const std::vector<const StagedBatch*>& batches, uint64_t total_bytes);
+    bool OpenSegmentForWrite(uint64_t segment);
+    void ApplyPinEventsLocked(const std::vector<const StagedBatch*>& batches, uint64_t segment);
+    std::vector<uint64_t> CollectDeletableSegmentsLocked();
+
+    const Options options_;
+    std::vector<std::unique_ptr<Stripe>> stripes_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable sync_cv_;
+    std::condition_variable round_cv_;
+    bool stopping_ = false;
+    bool sync_requested_ = false;
+    // 每轮 group commit 开始时 started_rounds_ 加一，结束时 completed_rounds_ 跟上；
+    // last_ok_round_ 是最近一轮写盘成功且没有丢记录的轮次，Sync 据此判断调用前的记录是否已经落盘。
+    uint64_t started_rounds_ = 0;
+    uint64_t completed_rounds_ = 0;
+    uint64_t last_ok_round_ = 0;
+    // 收集侧的钉子：trace_key -> 它第一次被钉住时记录写进的段号；段号 -> 钉在该段上的 trace 数，begin() 就是最老的还要保留的段。
+    std::unordered_map<size_t, uint64_t> trace_segments_;
+    std::map<uint64_t, size_t> segment_pins_;
+    // 本次启动后写出的段（不含待重放的旧段），按段号递增。
+    std::vector<uint64_t> live_segments_;
+    std::vector<uint64_t> recovered_segments_;
+    bool recovered_taken_ = false;
+    Stats stats_;
+
+    // 写盘侧只由 sync 线程访问：写失败留待重写的积压、当前段的 fd / 段号 / 已写字节数。
+    std::vector<StagedBatch> backlog_;
+    uint64_t backlog_bytes_ = 0;
+    int write_fd_ = -1;
+    uint64_t write_segment_ = 0;
+    uint64_t write_segment_bytes_ = 0;
+
+    std::thread sync_thread_;
+};
@@ -78,6 +78,9 @@ void TraceRetentionService::RunCleanupJob()
 
         const int64_t now_ms = now_ms_fn_();
         const int64_t cutoff_ms = ComputeCutoffMs(now_ms);
+        // 分区模式下过期数据先整分区删文件，不和在线写入抢写锁，也不留空闲页；
+        // 主库里剩下的未分区数据（开启分区前的旧数据）照旧按批删。
+        repo_->DropExpiredPartitions(cutoff_ms);
         for (size_t batch_index = 0; batch_index < config_.max_batches_per_run; ++batch_index) {
             const size_t deleted =
                 repo_->DeleteExpiredTracesBatch(cutoff_ms, config_.batch_size);
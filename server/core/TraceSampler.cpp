@@ -0,0 +1,117 @@
+#include "core/TraceSampler.h"
+
+#include <utility>
+
+#include "core/TraceSessionManager.h"
+
+namespace
+{
+// splitmix64 的 finalizer：trace_key 常常是连续自增或带公共前缀的，直接取模会让保留比例严重偏斜。
+uint64_t MixTraceKey(uint64_t x)
+{
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+const std::string kEmptyServiceName;
+} // namespace
+
+bool TraceSamplingPolicy::SamplingEnabled() const
+{
+    if (healthy_keep_ratio < 1.0)
+    {
+        return true;
+    }
+    for (const auto &[service_name, ratio] : service_keep_ratio)
+    {
+        (void)service_name;
+        if (ratio < 1.0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+TraceSampler::TraceSampler(TraceSamplingPolicy policy)
+    : policy_(std::move(policy))
+{
+}
+
+TraceSampler::Decision TraceSampler::Decide(const TraceSession &session)
+{
+    bool slow = false;
+    for (const SpanEvent &span : session.spans)
+    {
+        if (span.status.has_value() && span.status.value() == SpanEvent::Status::Error)
+        {
+            kept_error_.fetch_add(1, std::memory_order_relaxed);
+            return Decision::KeepError;
+        }
+        if (!slow && span.end_time.has_value())
+        {
+            const int64_t threshold_ms = SlowThresholdFor(span.name);
+            slow = threshold_ms > 0 && span.end_time.value() - span.start_time_ms >= threshold_ms;
+        }
+    }
+    if (slow)
+    {
+        kept_slow_.fetch_add(1, std::memory_order_relaxed);
+        return Decision::KeepSlow;
+    }
+
+    const double ratio = KeepRatioFor(RootServiceName(session));
+    // 取哈希高 53 位映射到 [0,1)，和 double 尾数位数一致，比例 1.0 时一定保留，0 时一定丢弃。
+    const double point =
+        static_cast<double>(MixTraceKey(session.trace_key) >> 11) * (1.0 / static_cast<double>(1ULL << 53));
+    if (point < ratio)
+    {
+        kept_sampled_.fetch_add(1, std::memory_order_relaxed);
+        return Decision::KeepSampled;
+    }
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+    return Decision::Drop;
+}
+
+TraceSampler::Stats TraceSampler::GetStats() const
+{
+    Stats stats;
+    stats.kept_error = kept_error_.load(std::memory_order_relaxed);
+    stats.kept_slow = kept_slow_.load(std::memory_order_relaxed);
+    stats.kept_sampled = kept_sampled_.load(std::memory_order_relaxed);
+    stats.dropped = dropped_.load(std::memory_order_relaxed);
+    return stats;
+}
+
+const std::string &TraceSampler::RootServiceName(const TraceSession &session)
+{
+    for (const SpanEvent &span : session.spans)
+    {
+        if (!span.parent_span_id.has_value())
+        {
+            return span.service_name;
+        }
+    }
+    return session.spans.empty() ? kEmptyServiceName : session.spans.front().service_name;
+}
+
+int64_t TraceSampler::SlowThresholdFor(const std::string &operation) const
+{
+    if (!policy_.operation_slow_threshold_ms.empty())
+    {
+        auto iter = policy_.operation_slow_threshold_ms.find(operation);
+        if (iter != policy_.operation_slow_threshold_ms.end())
+        {
+            return iter->second;
+        }
+    }
+    return policy_.slow_span_threshold_ms;
+}
+
+double TraceSampler::KeepRatioFor(const std::string &service_name) const
+{
+    auto iter = policy_.service_keep_ratio.find(service_name);
+    return iter != policy_.service_keep_ratio.end() ? iter->second : policy_.healthy_keep_ratio;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+struct TraceSession;
+
+// 尾部采样策略：trace 收齐、准备分发时才做决定，所以能看到整条 trace 的错误和耗时。
+// 比例都取 [0,1]，1 表示健康 trace 全部保留；所有比例都是 1 时采样整体关闭，分发路径不做任何额外扫描。
+struct TraceSamplingPolicy
+{
+    // 健康 trace（无错误 span、无慢 span）的默认保留比例。
+    double healthy_keep_ratio = 1.0;
+    // 按根服务单独指定的保留比例，优先于 healthy_keep_ratio；流量大又稳定的服务可以压得更低。
+    std::unordered_map<std::string, double> service_keep_ratio;
+    // 任一 span 耗时达到阈值就整条保留。operation_slow_threshold_ms 按 span name 查，查不到用默认值；<=0 表示不按耗时保留。
+    int64_t slow_span_threshold_ms = 0;
+    std::unordered_map<std::string, int64_t> operation_slow_threshold_ms;
+
+    bool SamplingEnabled() const;
+};
+
+// TraceSampler 只负责“留还是丢”的判定和计数，不碰持久化和 AI。
+// 健康 trace 的取舍按 trace_key 哈希决定而不是随机数：同一条 trace 无论判几次结论都一样，多实例部署时也不会各留各的。
+// Decide 只读 session，内部没有锁，计数用原子量，dispatch 线程并发调用是安全的。
+class TraceSampler
+{
+public:
+    enum class Decision
+    {
+        // 含 ERROR 状态 span，必保留。
+        KeepError,
+        // 含超过耗时阈值的 span，必保留。
+        KeepSlow,
+        // 健康 trace，按比例抽中保留。
+        KeepSampled,
+        // 健康 trace，未抽中：不写主数据、不调 AI，但服务监控照常记账。
+        Drop
+    };
+
+    struct Stats
+    {
+        uint64_t kept_error = 0;
+        uint64_t kept_slow = 0;
+        uint64_t kept_sampled = 0;
+        uint64_t dropped = 0;
+    };
+
+    explicit TraceSampler(TraceSamplingPolicy policy);
+
+    TraceSampler(const TraceSampler&) = delete;
+    TraceSampler& operator=(const TraceSampler&) = delete;
+
+    Decision Decide(const TraceSession& session);
+    Stats GetStats() const;
+
+private:
+    // 根服务取到达顺序里第一个没有 parent 的 span；全是子 span（根还没到）时退回第一个 span。
+    static const std::string& RootServiceName(const TraceSession& session);
+    int64_t SlowThresholdFor(const std::string& operation) const;
+    double KeepRatioFor(const std::string& service_name) const;
+
+    TraceSamplingPolicy policy_;
+    std::atomic<uint64_t> kept_error_{0};
+    std::atomic<uint64_t> kept_slow_{0};
+    std::atomic<uint64_t> kept_sampled_{0};
+    std::atomic<uint64_t> dropped_{0};
+};
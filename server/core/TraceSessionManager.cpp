@@ -3,12 +3,17 @@
 #include "ai/TraceAiProvider.h"
 #include "core/ServiceRuntimeAccumulator.h"
 #include "core/SystemRuntimeAccumulator.h"
+#include "core/TraceAiResultCache.h"
+#include "core/TraceIngestWal.h"
+#include "core/TraceSessionPool.h"
 #include "persistence/BufferedTraceRepository.h"
 #include "persistence/TraceRepository.h"
 #include "notification/INotifier.h"
 #include <algorithm>
 #include <cctype>
+#include <charconv>
 #include <chrono>
+#include <deque>
 #include <iostream>
 #include <limits>
 #include <nlohmann/json.hpp>
@@ -18,6 +23,8 @@ namespace
 {
     constexpr size_t kMaxTraceAiErrorLength = 1024;
     constexpr const char* kAiStatusCompleted = "completed";
+    // 结构指纹缓存命中：analysis 是复用同形 trace 的历史结果，没有为这条 trace 单独调模型。
+    constexpr const char* kAiStatusCompletedCache = "completed_cache";
     constexpr const char* kAiStatusSkippedManual = "skipped_manual";
     constexpr const char* kAiStatusSkippedCircuit = "skipped_circuit";
     constexpr const char* kAiStatusFailedPrimary = "failed_primary";
@@ -30,6 +37,236 @@ namespace
         return value;
     }
 
+    // SerializeTrace 预留容量时，每个 span 除 name/service/attributes 之外的固定字段大致占多少字节。
+    // 只是估算值，偏小时 string 自己会扩容，不影响正确性。
+    constexpr size_t kSerializedSpanFixedBytes = 256;
+
+    // session 池里单个 span 槽位最多保留的堆内存；普通 span 远小于这个值，只有带大 body/堆栈 attribute 的才会被挡掉。
+    constexpr size_t kMaxPooledSlotBytes = 16 * 1024;
+
+    template <typename Integer>
+    void AppendJsonInteger(std::string *out, Integer value)
+    {
+        char buffer[24];
+        const auto result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+        out->append(buffer, result.ptr);
+    }
+
+    // 按 Unicode 规范里“合法 UTF-8 字节序列”那张表校验一个多字节字符，返回它的长度；不合法返回 0。
+    // 和 nlohmann 的 UTF-8 解码 DFA 判定一致：过长编码、代理区和超出 U+10FFFF 都算非法。
+    size_t ValidUtf8SequenceLength(const std::string &value, size_t pos)
+    {
+        const auto byte_at = [&value](size_t index) -> unsigned char
+        {
+            return index < value.size() ? static_cast<unsigned char>(value[index]) : 0;
+        };
+        const auto continuation = [](unsigned char c, unsigned char low = 0x80, unsigned char high = 0xBF)
+        {
+            return c >= low && c <= high;
+        };
+        const unsigned char lead = byte_at(pos);
+        if (lead >= 0xC2 && lead <= 0xDF)
+        {
+            return continuation(byte_at(pos + 1)) ? 2 : 0;
+        }
+        if (lead >= 0xE0 && lead <= 0xEF)
+        {
+            const unsigned char low = lead == 0xE0 ? 0xA0 : 0x80;
+            const unsigned char high = lead == 0xED ? 0x9F : 0xBF;
+            return continuation(byte_at(pos + 1), low, high) && continuation(byte_at(pos + 2)) ? 3 : 0;
+        }
+        if (lead >= 0xF0 && lead <= 0xF4)
+        {
+            const unsigned char low = lead == 0xF0 ? 0x90 : 0x80;
+            const unsigned char high = lead == 0xF4 ? 0x8F : 0xBF;
+            return continuation(byte_at(pos + 1), low, high) && continuation(byte_at(pos + 2)) &&
+                           continuation(byte_at(pos + 3))
+                       ? 4
+                       : 0;
+        }
+        return 0;
+    }
+
+    // 和 nlohmann::json::dump() 默认参数（ensure_ascii=false）的转义规则逐字节对齐：
+    // 引号、反斜杠和 5 个常见控制字符用短转义，其余 0x00-0x1F 用小写 \u00xx，非 ASCII 原样输出。
+    void AppendJsonString(std::string *out, const std::string &value)
+    {
+        static constexpr char kHex[] = "0123456789abcdef";
+        const size_t begin_size = out->size();
+        out->push_back('"');
+        size_t pos = 0;
+        while (pos < value.size())
+        {
+            const unsigned char c = static_cast<unsigned char>(value[pos]);
+            if (c >= 0x80)
+            {
+                const size_t length = ValidUtf8SequenceLength(value, pos);
+                if (length == 0)
+                {
+                    // 非法 UTF-8 时原 DOM 版本在 dump 里直接抛 type_error；这里退回 nlohmann 让它抛出同一个异常，
+                    // 不自己发明另一套容错口径。
+                    out->resize(begin_size);
+                    out->append(nlohmann::json(value).dump());
+                    return;
+                }
+                out->append(value, pos, length);
+                pos += length;
+                continue;
+            }
+            switch (c)
+            {
+            case '"':
+                out->append("\\\"");
+                break;
+            case '\\':
+                out->append("\\\\");
+                break;
+            case '\b':
+                out->append("\\b");
+                break;
+            case '\f':
+                out->append("\\f");
+                break;
+            case '\n':
+                out->append("\\n");
+                break;
+            case '\r':
+                out->append("\\r");
+                break;
+            case '\t':
+                out->append("\\t");
+                break;
+            default:
+                if (c < 0x20)
+                {
+                    out->append("\\u00");
+                    out->push_back(kHex[c >> 4]);
+                    out->push_back(kHex[c & 0x0F]);
+                }
+                else
+                {
+                    out->push_back(static_cast<char>(c));
+                }
+                break;
+            }
+            ++pos;
+        }
+        out->push_back('"');
+    }
+
+    using SortedAttributes = std::vector<std::pair<const std::string *, const std::string *>>;
+
+    // attributes 是 unordered_map，nlohmann 会把它转成按 key 字典序排列的 object；这里先排好指针再写，
+    // 输出和 nlohmann::json(attributes).dump() 一致。scratch 由调用方复用，避免每个 span 分配一次。
+    void AppendJsonAttributes(std::string *out,
+                              const std::unordered_map<std::string, std::string> &attributes,
+                              SortedAttributes *scratch)
+    {
+        scratch->clear();
+        for (const auto &attribute : attributes)
+        {
+            scratch->emplace_back(&attribute.first, &attribute.second);
+        }
+        std::sort(scratch->begin(), scratch->end(), [](const auto &left, const auto &right)
+                  { return *left.first < *right.first; });
+        out->push_back('{');
+        for (size_t i = 0; i < scratch->size(); ++i)
+        {
+            if (i > 0)
+            {
+                out->push_back(',');
+            }
+            AppendJsonString(out, *(*scratch)[i].first);
+            out->push_back(':');
+            AppendJsonString(out, *(*scratch)[i].second);
+        }
+        out->push_back('}');
+    }
+
+    const char *SpanStatusJson(const std::optional<SpanEvent::Status> &status)
+    {
+        if (!status.has_value())
+        {
+            return "null";
+        }
+        switch (status.value())
+        {
+        case SpanEvent::Status::Unset:
+            return "\"UNSET\"";
+        case SpanEvent::Status::Ok:
+            return "\"OK\"";
+        case SpanEvent::Status::Error:
+            return "\"ERROR\"";
+        }
+        return "null";
+    }
+
+    const char *SpanKindJson(const std::optional<SpanEvent::Kind> &kind)
+    {
+        if (!kind.has_value())
+        {
+            return "null";
+        }
+        switch (kind.value())
+        {
+        case SpanEvent::Kind::Internal:
+            return "\"INTERNAL\"";
+        case SpanEvent::Kind::Server:
+            return "\"SERVER\"";
+        case SpanEvent::Kind::Client:
+            return "\"CLIENT\"";
+        case SpanEvent::Kind::Producer:
+            return "\"PRODUCER\"";
+        case SpanEvent::Kind::Consumer:
+            return "\"CONSUMER\"";
+        }
+        return "null";
+    }
+
+    // 结构指纹用的字符串哈希：FNV-1a 64 位，足够把 service/name 打散，又不用引入额外依赖。
+    uint64_t HashFingerprintString(const std::string& value)
+    {
+        uint64_t hash = 0xcbf29ce484222325ULL;
+        for (unsigned char c : value)
+        {
+            hash ^= c;
+            hash *= 0x100000001b3ULL;
+        }
+        return hash;
+    }
+
+    // 把一个分量并进累计哈希。先做一轮 splitmix64 混洗，避免小整数分量（kind/status/桶号）彼此抵消。
+    uint64_t MixFingerprint(uint64_t seed, uint64_t value)
+    {
+        uint64_t x = seed ^ (value + 0x9e3779b97f4a7c15ULL + (seed << 6) + (seed >> 2));
+        x ^= x >> 30;
+        x *= 0xbf58476d1ce4e5b9ULL;
+        x ^= x >> 27;
+        x *= 0x94d049bb133111ebULL;
+        x ^= x >> 31;
+        return x;
+    }
+
+    // 耗时按 2 的幂分桶：1ms 和 1.5ms 算同一种形状，10ms 和 1000ms 则不是。
+    // 没有 end_time 的 span 单独占 0 号桶，和“耗时 0ms”区分开。
+    uint64_t FingerprintDurationBucket(const SpanEvent& span)
+    {
+        if (!span.end_time.has_value())
+        {
+            return 0;
+        }
+        uint64_t duration = span.end_time.value() > span.start_time_ms
+                                ? static_cast<uint64_t>(span.end_time.value() - span.start_time_ms)
+                                : 0;
+        uint64_t bucket = 1;
+        while (duration > 0)
+        {
+            ++bucket;
+            duration >>= 1;
+        }
+        return bucket;
+    }
+
     int64_t NowSteadyMs()
     {
         return std::chrono::duration_cast<std::chrono::milliseconds>(
@@ -211,6 +448,149 @@ TraceSession::TraceSession(size_t capacity)
     spans.reserve(capacity);
 }
 
+void TraceSession::AppendSpan(const SpanEvent &span)
+{
+    replayed = replayed || span.replayed;
+    if (span_slab.empty())
+    {
+        spans.push_back(span);
+        return;
+    }
+    // 拷贝赋值会尽量复用目标里已有的 string 缓冲和 unordered_map 节点，随后的移动构造只是转交指针。
+    SpanEvent &slot = span_slab.back();
+    slot = span;
+    spans.push_back(std::move(slot));
+    span_slab.pop_back();
+}
+
+void TraceSession::Reset(size_t max_slot_bytes)
+{
+    std::vector<SpanEvent> retained_spans = std::move(spans);
+    std::vector<SpanEvent> retained_slab = std::move(span_slab);
+    std::unordered_set<size_t> retained_ids = std::move(span_ids);
+    // 还没被用掉的旧槽位重新算一遍：AppendSpan 取走槽位时不扣 slab_bytes，这里一次性对齐。
+    size_t retained_slab_bytes = 0;
+    for (const SpanEvent &slot : retained_slab)
+    {
+        retained_slab_bytes += EstimateSlotBytes(slot);
+    }
+    // 槽位总数不超过 capacity：sealed 窗口里多吸收的 late span 不再留着，避免槽位只增不减。
+    for (SpanEvent &span : retained_spans)
+    {
+        if (retained_slab.size() >= capacity)
+        {
+            break;
+        }
+        // 带大 attribute 的 span 不进槽位：槽位被拷贝赋值复用时 string 只涨不缩，留下来就是一直攥着这块峰值内存。
+        const size_t slot_bytes = EstimateSlotBytes(span);
+        if (slot_bytes > max_slot_bytes)
+        {
+            continue;
+        }
+        retained_slab_bytes += slot_bytes;
+        retained_slab.push_back(std::move(span));
+    }
+    retained_spans.clear();
+    retained_ids.clear();
+
+    // 其余字段整体换成一个新构造的默认值，以后 TraceSession 新增字段也不会在这里漏清。
+    const size_t retained_capacity = capacity;
+    *this = TraceSession(0);
+    capacity = retained_capacity;
+    spans = std::move(retained_spans);
+    span_slab = std::move(retained_slab);
+    span_ids = std::move(retained_ids);
+    slab_bytes = retained_slab_bytes;
+}
+
+size_t TraceSession::PooledBytes() const
+{
+    return slab_bytes + (spans.capacity() + span_slab.capacity()) * sizeof(SpanEvent) +
+           span_ids.bucket_count() * sizeof(void *);
+}
+
+size_t TraceSession::EstimateSlotBytes(const SpanEvent &span)
+{
+    // 和 EstimateSpanBytes 口径一致，只是字符串按容量算：槽位真正攥着的是 string 的缓冲，不是当前内容。
+    // sizeof(SpanEvent) 本体已经算在 spans/span_slab 的数组里，这里只算挂在槽位外面的堆内存。
+    constexpr size_t kAttributeEntryOverhead =
+        sizeof(std::pair<const std::string, std::string>) + 3 * sizeof(void *);
+    size_t bytes = span.name.capacity() + span.service_name.capacity() +
+                   span.attributes.bucket_count() * sizeof(void *);
+    for (const auto &[key, value] : span.attributes)
+    {
+        bytes += kAttributeEntryOverhead + key.capacity() + value.capacity();
+    }
+    return bytes;
+}
+
+// AI 收尾任务的投递口。异步 provider 的回调跑在它自己的 IO loop 线程上，缓存等待者的唤醒跑在领头者的收尾线程上，
+// 两处都不能就地做 AppendAnalysis、备路调用、告警这类可能阻塞的动作：
+// 1) 正常情况交给 worker 线程池；
+// 2) 线程池拒收（队列满或已经 shutdown）时转给这里的专用完成线程，按到达顺序逐个执行。
+// 完成线程第一次溢出时才启动，平时不占线程；队列不设上限，里面的任务数受在途 AI 调用数约束，每条都已经持有自己的 session。
+struct TraceSessionManager::AiCompletionQueue
+{
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<ThreadPool::Task> tasks;
+    bool stopping = false;
+    std::thread thread;
+    std::atomic<uint64_t> overflow_count{0};
+
+    void Submit(ThreadPool *pool, ThreadPool::Task task)
+    {
+        // submit 被拒时 task 原样留在本地，可以继续转交。
+        if (pool && pool->submit(std::move(task)))
+        {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!thread.joinable())
+            {
+                thread = std::thread([this]() { Loop(); });
+            }
+            tasks.push_back(std::move(task));
+        }
+        overflow_count.fetch_add(1, std::memory_order_relaxed);
+        cv.notify_one();
+    }
+
+    void Loop()
+    {
+        while (true)
+        {
+            ThreadPool::Task task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait(lock, [this]() { return stopping || !tasks.empty(); });
+                if (tasks.empty())
+                {
+                    return;
+                }
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            }
+            task();
+        }
+    }
+
+    // 只在 manager 析构、在途 AI 和缓存等待者都归零之后调用，此后不会再有新任务进来；剩下的任务跑完再退出。
+    void Stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        cv.notify_all();
+        if (thread.joinable())
+        {
+            thread.join();
+        }
+    }
+};
+
 TraceSessionManager::TraceSessionManager(ThreadPool *thread_pool,
                                          BufferedTraceRepository *buffered_trace_repo,
                                          TraceAiProvider *trace_ai,
@@ -237,21 +617,65 @@ TraceSessionManager::TraceSessionManager(ThreadPool *thread_pool,
                                          size_t ai_failure_threshold,
                                          int64_t ai_cooldown_ms,
                                          TraceAiProvider* fallback_trace_ai,
-                                         bool ai_auto_degrade_enabled)
-    : thread_pool_(thread_pool), buffered_trace_repo_(buffered_trace_repo), trace_ai_(trace_ai), notifier_(notifier), service_runtime_accumulator_(service_runtime_accumulator), system_runtime_accumulator_(system_runtime_accumulator), ai_analysis_enabled_(ai_analysis_enabled), ai_circuit_breaker_enabled_(ai_circuit_breaker_enabled), fallback_trace_ai_(fallback_trace_ai), ai_auto_degrade_enabled_(ai_auto_degrade_enabled), ai_failure_threshold_(std::max<size_t>(1, ai_failure_threshold)), ai_cooldown_ms_(ai_cooldown_ms > 0 ? ai_cooldown_ms : 60000), capacity_(capacity), token_limit_(token_limit), wheel_size_(wheel_size > 0 ? wheel_size : 512), idle_timeout_ms_(idle_timeout_ms > 0 ? idle_timeout_ms : 5000), wheel_tick_ms_(wheel_tick_ms > 0 ? wheel_tick_ms : 500), buffered_span_hard_limit_(buffered_span_hard_limit > 0 ? buffered_span_hard_limit : 4096), active_session_hard_limit_(active_session_hard_limit > 0 ? active_session_hard_limit : 1024)
+                                         bool ai_auto_degrade_enabled,
+                                         size_t session_shard_count,
+                                         bool ai_async_dispatch_enabled,
+                                         size_t ai_result_cache_capacity,
+                                         int64_t ai_result_cache_ttl_ms,
+                                         size_t session_pool_size,
+                                         size_t buffered_bytes_hard_limit,
+                                         int buffered_bytes_overload_percent,
+                                         int buffered_bytes_critical_percent,
+                                         TraceSamplingPolicy sampling_policy,
+                                         TraceIngestWal* ingest_wal)
+    : thread_pool_(thread_pool), buffered_trace_repo_(buffered_trace_repo), trace_ai_(trace_ai), notifier_(notifier), service_runtime_accumulator_(service_runtime_accumulator), system_runtime_accumulator_(system_runtime_accumulator), ai_analysis_enabled_(ai_analysis_enabled), ai_circuit_breaker_enabled_(ai_circuit_breaker_enabled), fallback_trace_ai_(fallback_trace_ai), ai_auto_degrade_enabled_(ai_auto_degrade_enabled), ai_async_dispatch_enabled_(ai_async_dispatch_enabled), ai_failure_threshold_(std::max<size_t>(1, ai_failure_threshold)), ai_cooldown_ms_(ai_cooldown_ms > 0 ? ai_cooldown_ms : 60000), capacity_(capacity), token_limit_(token_limit), wheel_size_(wheel_size > 0 ? wheel_size : 512), idle_timeout_ms_(idle_timeout_ms > 0 ? idle_timeout_ms : 5000), wheel_tick_ms_(wheel_tick_ms > 0 ? wheel_tick_ms : 500), buffered_span_hard_limit_(buffered_span_hard_limit > 0 ? buffered_span_hard_limit : 4096), active_session_hard_limit_(active_session_hard_limit > 0 ? active_session_hard_limit : 1024), buffered_bytes_hard_limit_(buffered_bytes_hard_limit > 0 ? buffered_bytes_hard_limit : 256 * 1024 * 1024)
 {
-    timeout_ticks_ = ComputeTimeoutTicks();
+    timeout_ticks_.store(ComputeTimeoutTicks(), std::memory_order_relaxed);
+    ingest_wal_ = ingest_wal;
+    ai_completion_queue_ = std::make_unique<AiCompletionQueue>();
+    if (ai_result_cache_capacity > 0)
+    {
+        ai_result_cache_ = std::make_unique<TraceAiResultCache>(ai_result_cache_capacity, ai_result_cache_ttl_ms);
+    }
+    if (session_pool_size > 0)
+    {
+        // 回收的 session 最多保留 capacity 个 span 的数组；capacity=0（不限）时不设上限。
+        // 空闲 session 合计攥着的内存不计入 buffered_bytes 水位，所以单独按聚合态字节上限的 1/8 封顶。
+        session_pool_ = std::make_unique<TraceSessionPool>(session_pool_size,
+                                                           capacity_,
+                                                           buffered_bytes_hard_limit_ / 8,
+                                                           kMaxPooledSlotBytes);
+    }
+    if (sampling_policy.SamplingEnabled())
+    {
+        trace_sampler_ = std::make_unique<TraceSampler>(std::move(sampling_policy));
+    }
     // sealed/retry 这两档时间现在也跟着启动配置走，避免状态机里继续保留 1/2 tick 的硬编码。
     sealed_grace_ticks_ = ComputeDelayTicks(sealed_grace_window_ms);
     retry_base_delay_ticks_ = ComputeDelayTicks(retry_base_delay_ms);
-    time_wheel_.resize(wheel_size_);
-    // 先把 completed tombstone 的桶位也按同样的 wheel_size 建好。
-    // 这样后面只要跟着 current_tick_ 同步推进，就能在同一套 tick 节奏里做过期回收。
-    completed_trace_wheel_.resize(wheel_size_);
-    // 三组背压阈值现在改成 Settings 冷启动配置驱动，避免继续把 55/75/90 写死在状态机里。
+    // shard 数量构造后固定不变；活跃 session 的分层时间轮随 Shard 一起构造，tombstone 时间轮按 wheel_size 建槽。
+    // completed tombstone 的桶位跟着 shard 自己的 current_tick_ 同步推进，就能在同一套 tick 节奏里做过期回收。
+    const size_t shard_count = std::max<size_t>(1, session_shard_count);
+    shards_.reserve(shard_count);
+    for (size_t i = 0; i < shard_count; ++i)
+    {
+        auto shard = std::make_unique<Shard>();
+        shard->completed_trace_wheel_.resize(wheel_size_);
+        shards_.push_back(std::move(shard));
+    }
+    // 各组背压阈值现在改成 Settings 冷启动配置驱动，避免继续把 55/75/90 写死在状态机里。
     buffered_span_watermark_ = BuildWatermark(buffered_span_hard_limit_,
                                               buffered_spans_overload_percent,
                                               buffered_spans_critical_percent);
+    buffered_bytes_watermark_ = BuildWatermark(buffered_bytes_hard_limit_,
+                                               buffered_bytes_overload_percent,
+                                               buffered_bytes_critical_percent);
+    // SQLite 落后时积压会从聚合态转移到 BufferedTraceRepository 的满桶里；这条水位把它推回入口 503。
+    // 它和聚合态字节预算同属“进程内积压内存”，所以直接复用 wm_buffered_bytes 的两档百分比，不再单开一组 Settings。
+    pending_flush_hard_limit_ = buffered_trace_repo_ ? buffered_trace_repo_->MaxPendingFlushBytes() : 0;
+    pending_flush_watermark_ = BuildWatermark(pending_flush_hard_limit_,
+                                              buffered_bytes_overload_percent,
+                                              buffered_bytes_critical_percent);
     active_session_watermark_ = BuildWatermark(active_session_hard_limit_,
                                                active_session_overload_percent,
                                                active_session_critical_percent);
@@ -301,6 +725,16 @@ void TraceSessionManager::RecordAiCircuitFailure(int64_t now_ms)
 TraceSessionManager::~TraceSessionManager()
 {
     StopDispatchThread();
+    // 异步 AI 回调持有 manager 裸指针，必须等在途调用全部收尾后才能继续析构。
+    // provider 自己有请求超时兜底，所以这里不会无限等下去。
+    // 缓存等待者挂在领头调用上，领头收尾时才会被唤醒，所以两个计数要一起等。
+    while (ai_async_inflight_.load(std::memory_order_acquire) > 0 ||
+           ai_cache_waiting_.load(std::memory_order_acquire) > 0)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    // 两个计数都是在收尾任务里减的，完成线程要等它们归零之后才能停。
+    ai_completion_queue_->Stop();
     const RuntimeStatsSnapshot stats = SnapshotRuntimeStats();
     if (stats.dispatch_count == 0 && stats.worker_begin_count == 0 && stats.analysis_enqueue_calls == 0)
     {
@@ -396,8 +830,27 @@ void TraceSessionManager::StopDispatchThread()
 
 size_t TraceSessionManager::size() const
 {
-    std::lock_guard<std::mutex> lock(mutex_);
-    return sessions_.size();
+    // 逐个 shard 加锁累加；结果只是近似快照，但每个 shard 自身的 sessions_ 读取仍是线程安全的。
+    size_t total = 0;
+    for (const auto &shard : shards_)
+    {
+        std::lock_guard<std::mutex> lock(shard->mutex_);
+        total += shard->sessions_.size();
+    }
+    return total;
+}
+
+TraceSessionManager::Shard &TraceSessionManager::ShardFor(size_t trace_key) const
+{
+    // trace_key 可能来自上游自增 id，低位分布很有规律；直接取模会让相邻 trace 扎堆落在少数 shard。
+    // 这里先过一遍 splitmix64 的混洗步骤再取模，成本只有几次乘法和移位。
+    uint64_t x = static_cast<uint64_t>(trace_key);
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return *shards_[static_cast<size_t>(x % shards_.size())];
 }
 
 TraceSessionManager::RuntimeStatsSnapshot TraceSessionManager::SnapshotRuntimeStats() const
@@ -412,6 +865,56 @@ TraceSessionManager::RuntimeStatsSnapshot TraceSessionManager::SnapshotRuntimeSt
     stats.ai_total_ns = ai_total_ns_.load(std::memory_order_relaxed);
     stats.analysis_enqueue_calls = analysis_enqueue_calls_.load(std::memory_order_relaxed);
     stats.analysis_enqueue_total_ns = analysis_enqueue_total_ns_.load(std::memory_order_relaxed);
+    stats.ai_async_inflight = ai_async_inflight_.load(std::memory_order_relaxed);
+    stats.ai_cache_waiting = ai_cache_waiting_.load(std::memory_order_relaxed);
+    stats.ai_completion_overflow = ai_completion_queue_->overflow_count.load(std::memory_order_relaxed);
+    stats.replayed_analysis_skipped = replayed_analysis_skipped_.load(std::memory_order_relaxed);
+    stats.buffered_spans = total_buffered_spans_.load(std::memory_order_relaxed);
+    stats.buffered_bytes = total_buffered_bytes_.load(std::memory_order_relaxed);
+    stats.pending_flush_bytes = buffered_trace_repo_ ? buffered_trace_repo_->PendingFlushBytes() : 0;
+    if (ai_result_cache_)
+    {
+        const TraceAiResultCache::Stats cache_stats = ai_result_cache_->GetStats();
+        stats.ai_cache_hits = cache_stats.hits;
+        stats.ai_cache_misses = cache_stats.misses;
+        stats.ai_cache_coalesced = cache_stats.coalesced;
+        stats.ai_cache_evictions = cache_stats.evictions;
+        stats.ai_cache_expirations = cache_stats.expirations;
+        stats.ai_cache_size = cache_stats.size;
+    }
+    if (session_pool_)
+    {
+        const TraceSessionPool::Stats pool_stats = session_pool_->GetStats();
+        stats.session_pool_reused = pool_stats.reused;
+        stats.session_pool_created = pool_stats.created;
+        stats.session_pool_recycled = pool_stats.recycled;
+        stats.session_pool_dropped = pool_stats.dropped;
+        stats.session_pool_idle = pool_stats.idle;
+        stats.session_pool_idle_bytes = pool_stats.idle_bytes;
+        stats.session_pool_trimmed = pool_stats.trimmed;
+    }
+    if (trace_sampler_)
+    {
+        const TraceSampler::Stats sampler_stats = trace_sampler_->GetStats();
+        stats.sampling_kept_error = sampler_stats.kept_error;
+        stats.sampling_kept_slow = sampler_stats.kept_slow;
+        stats.sampling_kept_sampled = sampler_stats.kept_sampled;
+        stats.sampling_dropped = sampler_stats.dropped;
+    }
+    for (const auto &shard : shards_)
+    {
+        std::lock_guard<std::mutex> lock(shard->mutex_);
+        const HierarchicalTimingWheel::Stats wheel_stats = shard->time_wheel_.GetStats();
+        stats.timer_wheel_occupancy += wheel_stats.occupancy;
+        stats.timer_wheel_level0 += wheel_stats.level_occupancy[0];
+        stats.timer_wheel_level1 += wheel_stats.level_occupancy[1];
+        stats.timer_wheel_level2 += wheel_stats.level_occupancy[2];
+        stats.timer_wheel_level3 += wheel_stats.level_occupancy[3];
+        stats.timer_wheel_relinks += wheel_stats.relinked;
+        stats.timer_wheel_cascades += wheel_stats.cascaded;
+        stats.tombstone_wheel_entries += shard->completed_trace_wheel_entries_;
+        stats.tombstone_stale_skipped += shard->completed_trace_stale_skipped_;
+    }
     return stats;
 }
 
@@ -433,17 +936,132 @@ std::string TraceSessionManager::DescribeRuntimeStats() const
         << ", analysis_enqueue_calls=" << stats.analysis_enqueue_calls
         << ", analysis_enqueue_total_ns=" << stats.analysis_enqueue_total_ns
         << ", analysis_enqueue_avg_ms="
-        << (stats.analysis_enqueue_calls > 0 ? (static_cast<double>(stats.analysis_enqueue_total_ns) / stats.analysis_enqueue_calls / 1'000'000.0) : 0.0);
+        << (stats.analysis_enqueue_calls > 0 ? (static_cast<double>(stats.analysis_enqueue_total_ns) / stats.analysis_enqueue_calls / 1'000'000.0) : 0.0)
+        << ", ai_async_inflight=" << stats.ai_async_inflight
+        << ", ai_cache_hits=" << stats.ai_cache_hits
+        << ", ai_cache_misses=" << stats.ai_cache_misses
+        << ", ai_cache_coalesced=" << stats.ai_cache_coalesced
+        << ", ai_cache_evictions=" << stats.ai_cache_evictions
+        << ", ai_cache_expirations=" << stats.ai_cache_expirations
+        << ", ai_cache_size=" << stats.ai_cache_size
+        << ", ai_cache_waiting=" << stats.ai_cache_waiting
+        << ", ai_completion_overflow=" << stats.ai_completion_overflow
+        << ", replayed_analysis_skipped=" << stats.replayed_analysis_skipped
+        << ", session_pool_reused=" << stats.session_pool_reused
+        << ", session_pool_created=" << stats.session_pool_created
+        << ", session_pool_recycled=" << stats.session_pool_recycled
+        << ", session_pool_dropped=" << stats.session_pool_dropped
+        << ", session_pool_idle=" << stats.session_pool_idle
+        << ", session_pool_idle_bytes=" << stats.session_pool_idle_bytes
+        << ", session_pool_trimmed=" << stats.session_pool_trimmed
+        << ", timer_wheel_occupancy=" << stats.timer_wheel_occupancy
+        << ", timer_wheel_levels=" << stats.timer_wheel_level0 << "/" << stats.timer_wheel_level1
+        << "/" << stats.timer_wheel_level2 << "/" << stats.timer_wheel_level3
+        << ", timer_wheel_relinks=" << stats.timer_wheel_relinks
+        << ", timer_wheel_cascades=" << stats.timer_wheel_cascades
+        << ", tombstone_wheel_entries=" << stats.tombstone_wheel_entries
+        << ", tombstone_stale_skipped=" << stats.tombstone_stale_skipped
+        << ", buffered_spans=" << stats.buffered_spans
+        << ", buffered_bytes=" << stats.buffered_bytes
+        << ", pending_flush_bytes=" << stats.pending_flush_bytes
+        << ", sampling_kept_error=" << stats.sampling_kept_error
+        << ", sampling_kept_slow=" << stats.sampling_kept_slow
+        << ", sampling_kept_sampled=" << stats.sampling_kept_sampled
+        << ", sampling_dropped=" << stats.sampling_dropped
+        << ", session_shards=" << shards_.size();
     return oss.str();
 }
 
+std::unique_ptr<TraceSession> TraceSessionManager::AcquireSession()
+{
+    if (!session_pool_)
+    {
+        return std::make_unique<TraceSession>(capacity_);
+    }
+    return session_pool_->Acquire(capacity_);
+}
+
+void TraceSessionManager::RecycleSession(std::unique_ptr<TraceSession> session)
+{
+    if (!session_pool_)
+    {
+        return;
+    }
+    session_pool_->Release(std::move(session));
+}
+
 TraceSessionManager::PushResult TraceSessionManager::Push(const SpanEvent &span)
 {
-    std::lock_guard<std::mutex> lock(mutex_);
-    return PushLocked(span, NowSteadyMs());
+    // 只锁 trace_key 所在的 shard；不同 shard 上的 trace 可以在多个 IO 线程里并行聚合。
+    Shard &shard = ShardFor(span.trace_key);
+    WalAppend wal_append;
+    PushResult result = PushResult::RejectedUnavailable;
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex_);
+        result = PushLocked(shard, span, NowSteadyMs(), &wal_append);
+    }
+    if (wal_append.record)
+    {
+        // 记 WAL 放在 shard 锁外：编码和条带锁都不再拉长 shard 临界区，同 shard 的其他 IO 线程不用陪着等。
+        ingest_wal_->Append(span, wal_append.pin);
+    }
+    return result;
+}
+
+std::vector<TraceSessionManager::PushResult> TraceSessionManager::PushBatch(const std::vector<SpanEvent> &spans)
+{
+    std::vector<PushResult> results(spans.size(), PushResult::RejectedUnavailable);
+    if (spans.empty())
+    {
+        return results;
+    }
+
+    // 先按 trace_key 分组，再按“trace 首次出现的顺序”逐组推进。
+    // 组内下标保持请求里的原始顺序，这样 trace_end 之后的 late span 仍然走 sealed 吸收语义，不会被重排到前面。
+    std::unordered_map<size_t, std::vector<size_t>> indices_by_trace;
+    std::vector<size_t> trace_order;
+    indices_by_trace.reserve(spans.size());
+    for (size_t i = 0; i < spans.size(); ++i)
+    {
+        auto &indices = indices_by_trace[spans[i].trace_key];
+        if (indices.empty())
+        {
+            trace_order.push_back(spans[i].trace_key);
+        }
+        indices.push_back(i);
+    }
+
+    // 同一批次共用一个 now_ms：它们本来就是同一个请求里同时到达的，逐条取时钟只会多出系统调用。
+    const int64_t now_ms = NowSteadyMs();
+    std::vector<WalAppend> wal_appends;
+    for (size_t trace_key : trace_order)
+    {
+        Shard &shard = ShardFor(trace_key);
+        const std::vector<size_t> &indices = indices_by_trace[trace_key];
+        wal_appends.assign(indices.size(), WalAppend());
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex_);
+            for (size_t i = 0; i < indices.size(); ++i)
+            {
+                results[indices[i]] = PushLocked(shard, spans[indices[i]], now_ms, &wal_appends[i]);
+            }
+        }
+        // 和单条 Push 一样，这一组 trace 的 WAL 记录等放掉 shard 锁之后按原顺序补记。
+        for (size_t i = 0; i < indices.size(); ++i)
+        {
+            if (wal_appends[i].record)
+            {
+                ingest_wal_->Append(spans[indices[i]], wal_appends[i].pin);
+            }
+        }
+    }
+    return results;
 }
 
-TraceSessionManager::PushResult TraceSessionManager::PushLocked(const SpanEvent &span, int64_t now_ms)
+TraceSessionManager::PushResult TraceSessionManager::PushLocked(Shard &shard,
+                                                               const SpanEvent &span,
+                                                               int64_t now_ms,
+                                                               WalAppend *wal_append)
 {
     // 线程池是 trace 异步分发链路的硬依赖；缺失时直接拒绝，避免后续误报 accepted 后又静默丢数据。
     // TraceSessionManager 现在只认双缓冲写入器。既然主数据和分析结果都要走分段 append，
@@ -452,19 +1070,19 @@ TraceSessionManager::PushResult TraceSessionManager::PushLocked(const SpanEvent
     {
         return PushResult::RejectedUnavailable;
     }
-    auto iter = index_by_trace_.find(span.trace_key);
-    const bool trace_exists = (iter != index_by_trace_.end());
+    auto iter = shard.index_by_trace_.find(span.trace_key);
+    const bool trace_exists = (iter != shard.index_by_trace_.end());
     if (!trace_exists)
     {
-        auto inflight_iter = dispatching_inflight_.find(span.trace_key);
-        if (inflight_iter != dispatching_inflight_.end())
+        auto inflight_iter = shard.dispatching_inflight_.find(span.trace_key);
+        if (inflight_iter != shard.dispatching_inflight_.end())
         {
             // dispatching inflight 代表这条 trace 已离开 manager、但还没进入 tombstone。
             // 第一步先按“延后吸收”处理，至少避免晚到 span 直接把旧 trace 复活成新 session。
             return PushResult::AcceptedDeferred;
         }
     }
-    if (!trace_exists && IsCompletedTombstoneAliveLocked(span.trace_key))
+    if (!trace_exists && IsCompletedTombstoneAliveLocked(shard, span.trace_key))
     {
         // 这条 trace 已经完成并处于短暂 TIME_WAIT。
         // 既然现在来的是晚到 span，那么直接幂等吸收即可，不能再把旧 trace 复活成新 session。
@@ -476,20 +1094,20 @@ TraceSessionManager::PushResult TraceSessionManager::PushLocked(const SpanEvent
         return PushResult::RejectedOverload;
     }
 
-    if (iter == index_by_trace_.end())
+    if (iter == shard.index_by_trace_.end())
     {
-        auto session = std::make_unique<TraceSession>(capacity_);
+        auto session = AcquireSession();
         session->trace_key = span.trace_key;
         session->created_at_ms = now_ms;
         session->last_update_ms = now_ms;
-        session->session_epoch = ++session_epoch_seq_;
-        sessions_.push_back(std::move(session));
-        index_by_trace_[span.trace_key] = sessions_.size() - 1;
-        active_sessions_ += 1;
-        iter = index_by_trace_.find(span.trace_key);
+        session->session_epoch = ++shard.session_epoch_seq_;
+        shard.sessions_.push_back(std::move(session));
+        shard.index_by_trace_[span.trace_key] = shard.sessions_.size() - 1;
+        active_sessions_.fetch_add(1, std::memory_order_relaxed);
+        iter = shard.index_by_trace_.find(span.trace_key);
     }
 
-    TraceSession &session = *sessions_[iter->second];
+    TraceSession &session = *shard.sessions_[iter->second];
     if (session.lifecycle_state == TraceSession::LifecycleState::ReadyRetryLater)
     {
         // ready retry 会话已经完成主数据收口；这时再并入新 span，会把内存里的 trace 和已入缓冲的 primary 语义撕裂。
@@ -504,7 +1122,7 @@ TraceSessionManager::PushResult TraceSessionManager::PushLocked(const SpanEvent
             {
                 session.duplicate_span_id = span.span_id;
             }
-            SealSessionLocked(session, TraceSession::SealReason::DuplicateSpan);
+            SealSessionLocked(shard, session, TraceSession::SealReason::DuplicateSpan);
             RefreshOverloadState();
             return PushResult::Accepted;
         }
@@ -516,8 +1134,20 @@ TraceSessionManager::PushResult TraceSessionManager::PushLocked(const SpanEvent
 
     // 先按到达顺序追加，后续聚合阶段再按 parent_id 重建结构。
     const bool already_sealed = (session.lifecycle_state == TraceSession::LifecycleState::Sealed);
-    session.spans.push_back(span);
-    total_buffered_spans_ += 1;
+    session.AppendSpan(span);
+    if (ingest_wal_)
+    {
+        // 要不要钉在 shard 锁里决定，session 上的标记和“分发后解钉”的判断看到的是同一份状态；
+        // 真正的 Append 由调用方放锁之后做。万一解钉抢在 Append 前面，WAL 条带里的带符号计数会把两者抵消。
+        wal_append->record = true;
+        wal_append->pin = !session.wal_pinned;
+        session.wal_pinned = true;
+    }
+    total_buffered_spans_.fetch_add(1, std::memory_order_relaxed);
+    // 字节数在入口按原始 span 一次算好并记在 session 上，dispatch/回滚时原样扣减/加回，不再重算。
+    const size_t span_bytes = EstimateSpanBytes(span);
+    session.buffered_bytes += span_bytes;
+    total_buffered_bytes_.fetch_add(span_bytes, std::memory_order_relaxed);
     session.token_count += token_estimator_.Estimate(span);
     session.last_update_ms = now_ms;
     if (!already_sealed)
@@ -536,14 +1166,14 @@ TraceSessionManager::PushResult TraceSessionManager::PushLocked(const SpanEvent
 
     if (span.trace_end.has_value() && span.trace_end.value())
     {
-        SealSessionLocked(session, TraceSession::SealReason::TraceEnd);
+        SealSessionLocked(shard, session, TraceSession::SealReason::TraceEnd);
         RefreshOverloadState();
         return PushResult::Accepted;
     }
 
     if (token_limit_ > 0 && session.token_count >= token_limit_)
     {
-        SealSessionLocked(session, TraceSession::SealReason::TokenLimit);
+        SealSessionLocked(shard, session, TraceSession::SealReason::TokenLimit);
         RefreshOverloadState();
         return PushResult::Accepted;
     }
@@ -551,24 +1181,24 @@ TraceSessionManager::PushResult TraceSessionManager::PushLocked(const SpanEvent
     if (session.capacity > 0 && session.spans.size() >= session.capacity)
     {
         // 达到容量上限时先封口，再给一个最短 grace tick 吸收少量乱序 span。
-        SealSessionLocked(session, TraceSession::SealReason::Capacity);
+        SealSessionLocked(shard, session, TraceSession::SealReason::Capacity);
         RefreshOverloadState();
         return PushResult::Accepted;
     }
 
     // collecting 会话继续按“等待后续 span”语义重排超时计划。
-    // 这里采用懒删除策略：不回删旧槽，只给会话 version+1 并插入新节点。
-    ScheduleSessionNode(session);
+    // timer_node 是侵入式节点，重排就是 O(1) 摘下旧槽再挂新槽，热 trace 每来一个 span 也不会在轮里堆旧节点。
+    ScheduleSessionNode(shard, session);
     RefreshOverloadState();
 
     // 当前仅做本地写入与分发占位，先返回成功；后续接入背压分支后再细分 AcceptedDeferred/RejectedOverload。
     return PushResult::Accepted;
 }
 
-std::unique_ptr<TraceSession> TraceSessionManager::DetachSessionLocked(size_t trace_key, size_t *span_count)
+std::unique_ptr<TraceSession> TraceSessionManager::DetachSessionLocked(Shard &shard, size_t trace_key, size_t *span_count)
 {
-    auto iter = index_by_trace_.find(trace_key);
-    if (iter == index_by_trace_.end())
+    auto iter = shard.index_by_trace_.find(trace_key);
+    if (iter == shard.index_by_trace_.end())
     {
         if (span_count)
         {
@@ -578,33 +1208,28 @@ std::unique_ptr<TraceSession> TraceSessionManager::DetachSessionLocked(size_t tr
     }
 
     const size_t index = iter->second;
-    std::unique_ptr<TraceSession> session = std::move(sessions_[index]);
+    std::unique_ptr<TraceSession> session = std::move(shard.sessions_[index]);
     const size_t local_span_count = session ? session->spans.size() : 0;
-    index_by_trace_.erase(iter);
-
-    if (index < sessions_.size() - 1)
-    {
-        sessions_[index] = std::move(sessions_.back());
-        sessions_.pop_back();
-        index_by_trace_[sessions_[index]->trace_key] = index;
-    }
-    else
+    const size_t local_byte_count = session ? session->buffered_bytes : 0;
+    shard.index_by_trace_.erase(iter);
+    if (session)
     {
-        sessions_.pop_back();
+        // 离开 shard 前先从时间轮摘掉，槽里不能留下指向已移交 session 的节点。
+        shard.time_wheel_.Cancel(&session->timer_node);
     }
 
-    if (active_sessions_ > 0)
-    {
-        active_sessions_ -= 1;
-    }
-    if (total_buffered_spans_ >= local_span_count)
+    if (index < shard.sessions_.size() - 1)
     {
-        total_buffered_spans_ -= local_span_count;
+        shard.sessions_[index] = std::move(shard.sessions_.back());
+        shard.sessions_.pop_back();
+        shard.index_by_trace_[shard.sessions_[index]->trace_key] = index;
     }
     else
     {
-        total_buffered_spans_ = 0;
+        shard.sessions_.pop_back();
     }
+
+    ReleaseSessionCounters(local_span_count, local_byte_count);
     RefreshOverloadState();
 
     if (span_count)
@@ -614,7 +1239,7 @@ std::unique_ptr<TraceSession> TraceSessionManager::DetachSessionLocked(size_t tr
     return session;
 }
 
-void TraceSessionManager::RestoreSessionLocked(std::unique_ptr<TraceSession> session, size_t span_count)
+void TraceSessionManager::RestoreSessionLocked(Shard &shard, std::unique_ptr<TraceSession> session, size_t span_count)
 {
     if (!session)
     {
@@ -625,13 +1250,14 @@ void TraceSessionManager::RestoreSessionLocked(std::unique_ptr<TraceSession> ses
     session->last_update_ms = NowSteadyMs();
     session->retry_count += 1;
     session->next_retry_tick =
-        current_tick_ + ComputeRetryDelayTicks(session->retry_count);
+        shard.current_tick_ + ComputeRetryDelayTicks(session->retry_count);
     const size_t trace_key = session->trace_key;
-    sessions_.push_back(std::move(session));
-    index_by_trace_[trace_key] = sessions_.size() - 1;
-    active_sessions_ += 1;
-    total_buffered_spans_ += span_count;
-    ScheduleSessionNode(*sessions_.back());
+    total_buffered_bytes_.fetch_add(session->buffered_bytes, std::memory_order_relaxed);
+    shard.sessions_.push_back(std::move(session));
+    shard.index_by_trace_[trace_key] = shard.sessions_.size() - 1;
+    active_sessions_.fetch_add(1, std::memory_order_relaxed);
+    total_buffered_spans_.fetch_add(span_count, std::memory_order_relaxed);
+    ScheduleSessionNode(shard, *shard.sessions_.back());
     RefreshOverloadState();
 }
 
@@ -657,24 +1283,51 @@ void TraceSessionManager::SweepExpiredSessions(int64_t now_ms,
                                                int64_t idle_timeout_ms,
                                                size_t max_dispatch_per_tick)
 {
-    std::lock_guard<std::mutex> lock(mutex_);
-    if (sessions_.empty() && completed_trace_expire_tick_.empty())
-    {
-        return;
-    }
-    if (idle_timeout_ms > 0 && idle_timeout_ms != idle_timeout_ms_)
+    std::lock_guard<std::mutex> sweep_lock(sweep_mutex_);
+    const bool rebuild_time_wheel = idle_timeout_ms > 0 && idle_timeout_ms != idle_timeout_ms_;
+    if (rebuild_time_wheel)
     {
         // 运行中调整超时策略时重建时间轮，避免继续使用旧超时计划。
+        // idle_timeout_ms_ 只在 sweep 线程里改；Push 侧只读 timeout_ticks_，所以后者用原子量发布。
         idle_timeout_ms_ = idle_timeout_ms;
-        timeout_ticks_ = ComputeTimeoutTicks();
-        RebuildTimeWheel();
+        timeout_ticks_.store(ComputeTimeoutTicks(), std::memory_order_relaxed);
+    }
+
+    // max_dispatch_per_tick 是整轮 sweep 的全局预算，不按 shard 平分。
+    // 这样 shard 数量变化时，下游 dispatch queue 看到的每轮最大注入量保持不变。
+    size_t dispatch_budget =
+        max_dispatch_per_tick > 0 ? max_dispatch_per_tick : std::numeric_limits<size_t>::max();
+    const size_t shard_count = shards_.size();
+    const size_t start = sweep_cursor_++ % shard_count;
+    for (size_t i = 0; i < shard_count; ++i)
+    {
+        Shard &shard = *shards_[(start + i) % shard_count];
+        // 每个 shard 只在自己的 sweep 步骤里持锁，其他 shard 上的 Push 不受影响。
+        // 预算耗尽后仍然要继续推进后面 shard 的 tick，只是到期节点统一顺延一 tick。
+        std::lock_guard<std::mutex> lock(shard.mutex_);
+        const size_t dispatched = SweepShardLocked(shard, now_ms, rebuild_time_wheel, dispatch_budget);
+        if (dispatch_budget != std::numeric_limits<size_t>::max())
+        {
+            dispatch_budget -= std::min(dispatch_budget, dispatched);
+        }
+    }
+}
+
+size_t TraceSessionManager::SweepShardLocked(Shard &shard,
+                                             int64_t now_ms,
+                                             bool rebuild_time_wheel,
+                                             size_t dispatch_budget)
+{
+    if (rebuild_time_wheel)
+    {
+        RebuildTimeWheelLocked(shard);
     }
 
-    if (last_tick_now_ms_ == 0)
+    if (shard.last_tick_now_ms_ == 0)
     {
-        last_tick_now_ms_ = now_ms;
+        shard.last_tick_now_ms_ = now_ms;
     }
-    int64_t elapsed_ms = now_ms - last_tick_now_ms_;
+    int64_t elapsed_ms = now_ms - shard.last_tick_now_ms_;
     uint64_t advance_ticks = 1;
     if (elapsed_ms > 0 && wheel_tick_ms_ > 0)
     {
@@ -684,71 +1337,62 @@ void TraceSessionManager::SweepExpiredSessions(int64_t now_ms,
             advance_ticks = 1;
         }
     }
-    // 防止长时间阻塞后一次性补 tick 过多导致本轮回调卡死。
-    if (advance_ticks > wheel_size_)
+    // 不再按 wheel_size_ 封顶：分层时间轮能表达任意远的到期点，封顶只会让 current_tick_ 落后于真实时间，
+    // 之后按 current_tick_ + timeout_ticks 排的计划全都跟着失真。
+    shard.last_tick_now_ms_ = now_ms;
+    if (shard.sessions_.empty() && shard.completed_trace_expire_tick_.empty())
     {
-        advance_ticks = wheel_size_;
+        // 空 shard 的时间轮和 tombstone 里都没有有效节点，直接把 tick 拨到现在，不必逐个推进。
+        // 分片后空闲 shard 是常态：如果这里直接返回，tick 会停在上次有数据的时候，
+        // 下一条新 trace 按陈旧的 current_tick_ 排计划，紧接着的 sweep 一次性补齐几百个 tick，它就被提前分发了。
+        shard.current_tick_ += advance_ticks;
+        return 0;
     }
-    last_tick_now_ms_ = now_ms;
 
     std::vector<size_t> expired_trace_keys;
-    expired_trace_keys.reserve(max_dispatch_per_tick > 0 ? max_dispatch_per_tick : sessions_.size());
-    std::unordered_set<size_t> scheduled_once;
-    scheduled_once.reserve(expired_trace_keys.capacity() > 0 ? expired_trace_keys.capacity() : 8);
+    expired_trace_keys.reserve(std::min(dispatch_budget, shard.sessions_.size()));
+    // 每个 tick 到期的 trace_key；节点在 Advance 里已经摘下，每个 session 在轮上只有一份计划，
+    // 所以这里拿到的 key 天然不重复，也不再需要 version/epoch 校验。
+    std::vector<size_t> due_trace_keys;
 
     for (uint64_t step = 0; step < advance_ticks; ++step)
     {
-        ++current_tick_;
-        const size_t slot = static_cast<size_t>(current_tick_ % wheel_size_);
-        SweepCompletedTombstonesLocked(slot);
-        std::vector<TimeWheelNode> bucket = std::move(time_wheel_[slot]);
-        time_wheel_[slot].clear();
+        ++shard.current_tick_;
+        const size_t slot = static_cast<size_t>(shard.current_tick_ % wheel_size_);
+        SweepCompletedTombstonesLocked(shard, slot);
+        due_trace_keys.clear();
+        shard.time_wheel_.Advance(shard.current_tick_, &due_trace_keys);
 
-        for (auto &node : bucket)
+        for (size_t trace_key : due_trace_keys)
         {
-            auto idx_iter = index_by_trace_.find(node.trace_key);
-            if (idx_iter == index_by_trace_.end())
-            {
-                // 会话已分发并从内存移除，旧节点自然失效。
-                continue;
-            }
-            TraceSession &session = *sessions_[idx_iter->second];
-            if (session.session_epoch != node.epoch || session.timer_version != node.version)
-            {
-                // 非当前版本节点（旧计划）直接丢弃。
-                continue;
-            }
-            if (node.expire_tick > current_tick_)
+            auto idx_iter = shard.index_by_trace_.find(trace_key);
+            if (idx_iter == shard.index_by_trace_.end())
             {
-                // 补 tick 场景下，如果还没到期，放回目标槽等待后续 tick。
-                time_wheel_[node.expire_tick % wheel_size_].push_back(node);
+                // 离开 shard 的 session 都会先 Cancel；走到这里说明节点和索引不一致，只能丢弃。
                 continue;
             }
+            TraceSession &session = *shard.sessions_[idx_iter->second];
             if (session.lifecycle_state == TraceSession::LifecycleState::ReadyRetryLater &&
-                current_tick_ < session.next_retry_tick)
+                shard.current_tick_ < session.next_retry_tick)
             {
                 // retry 会话只有到达 next_retry_tick 才允许重投，避免固定频率打桩。
-                time_wheel_[session.next_retry_tick % wheel_size_].push_back(node);
+                ScheduleRetryNode(shard, session);
                 continue;
             }
             if (session.lifecycle_state == TraceSession::LifecycleState::Sealed &&
-                current_tick_ < session.sealed_deadline_tick)
+                shard.current_tick_ < session.sealed_deadline_tick)
             {
                 // sealed 会话允许并入 late span，但 deadline 固定，不会因为后续 push 被重新向后推。
-                time_wheel_[session.sealed_deadline_tick % wheel_size_].push_back(node);
+                ScheduleSealedNode(shard, session);
                 continue;
             }
-            if (max_dispatch_per_tick > 0 && expired_trace_keys.size() >= max_dispatch_per_tick)
+            if (expired_trace_keys.size() >= dispatch_budget)
             {
                 // 本轮达到上限时，将当前有效节点顺延一 tick，避免被直接丢失。
-                node.expire_tick = current_tick_ + 1;
-                time_wheel_[node.expire_tick % wheel_size_].push_back(node);
+                shard.time_wheel_.Schedule(&session.timer_node, session.trace_key, shard.current_tick_ + 1, shard.current_tick_);
                 continue;
             }
-            if (scheduled_once.insert(node.trace_key).second)
-            {
-                expired_trace_keys.push_back(node.trace_key);
-            }
+            expired_trace_keys.push_back(trace_key);
         }
     }
 
@@ -757,13 +1401,13 @@ void TraceSessionManager::SweepExpiredSessions(int64_t now_ms,
         dispatch_count_.fetch_add(1, std::memory_order_relaxed);
 
         size_t span_count = 0;
-        std::unique_ptr<TraceSession> session = DetachSessionLocked(trace_key, &span_count);
+        std::unique_ptr<TraceSession> session = DetachSessionLocked(shard, trace_key, &span_count);
         if (!session)
         {
             continue;
         }
 
-        dispatching_inflight_[trace_key] = DispatchingInflightState{session->session_epoch};
+        shard.dispatching_inflight_[trace_key] = DispatchingInflightState{session->session_epoch};
         DispatchJob job;
         job.session = std::move(session);
         if (EnqueueDispatchJobLocked(&job))
@@ -772,9 +1416,10 @@ void TraceSessionManager::SweepExpiredSessions(int64_t now_ms,
         }
 
         submit_fail_count_.fetch_add(1, std::memory_order_relaxed);
-        dispatching_inflight_.erase(trace_key);
-        RestoreSessionLocked(std::move(job.session), span_count);
+        shard.dispatching_inflight_.erase(trace_key);
+        RestoreSessionLocked(shard, std::move(job.session), span_count);
     }
+    return expired_trace_keys.size();
 }
 
 uint64_t TraceSessionManager::ComputeTimeoutTicks() const
@@ -786,196 +1431,275 @@ uint64_t TraceSessionManager::ComputeTimeoutTicks() const
     return static_cast<uint64_t>((idle_timeout_ms_ + wheel_tick_ms_ - 1) / wheel_tick_ms_);
 }
 
-void TraceSessionManager::AddCompletedTombstoneLocked(size_t trace_key)
+void TraceSessionManager::AddCompletedTombstoneLocked(Shard &shard, size_t trace_key)
 {
-    const uint64_t expire_tick = current_tick_ + completed_trace_tombstone_ticks_;
-    completed_trace_expire_tick_[trace_key] = expire_tick;
-    completed_trace_wheel_[expire_tick % wheel_size_].push_back(trace_key);
+    const uint64_t expire_tick = shard.current_tick_ + completed_trace_tombstone_ticks_;
+    shard.completed_trace_expire_tick_[trace_key] = expire_tick;
+    shard.completed_trace_wheel_[expire_tick % wheel_size_].push_back(trace_key);
+    ++shard.completed_trace_wheel_entries_;
 }
 
-bool TraceSessionManager::IsCompletedTombstoneAliveLocked(size_t trace_key)
+bool TraceSessionManager::IsCompletedTombstoneAliveLocked(Shard &shard, size_t trace_key)
 {
-    auto iter = completed_trace_expire_tick_.find(trace_key);
-    if (iter == completed_trace_expire_tick_.end())
+    auto iter = shard.completed_trace_expire_tick_.find(trace_key);
+    if (iter == shard.completed_trace_expire_tick_.end())
     {
         return false;
     }
-    if (iter->second > current_tick_)
+    if (iter->second > shard.current_tick_)
     {
         return true;
     }
-    completed_trace_expire_tick_.erase(iter);
+    shard.completed_trace_expire_tick_.erase(iter);
     return false;
 }
 
-void TraceSessionManager::SweepCompletedTombstonesLocked(size_t slot)
+void TraceSessionManager::SweepCompletedTombstonesLocked(Shard &shard, size_t slot)
 {
-    std::vector<size_t> bucket = std::move(completed_trace_wheel_[slot]);
-    completed_trace_wheel_[slot].clear();
+    std::vector<size_t> bucket = std::move(shard.completed_trace_wheel_[slot]);
+    shard.completed_trace_wheel_[slot].clear();
+    shard.completed_trace_wheel_entries_ -= bucket.size();
 
     for (size_t trace_key : bucket)
     {
-        auto iter = completed_trace_expire_tick_.find(trace_key);
-        if (iter == completed_trace_expire_tick_.end())
+        auto iter = shard.completed_trace_expire_tick_.find(trace_key);
+        if (iter == shard.completed_trace_expire_tick_.end())
         {
-            // 已被新 tombstone 覆盖或已过期删除，旧 wheel 节点直接丢弃。
+            // 已过期删除（或 late span 查询时顺手删掉）的 tombstone，旧 wheel 节点直接丢弃。
+            ++shard.completed_trace_stale_skipped_;
             continue;
         }
-        if (iter->second > current_tick_)
+        if (iter->second > shard.current_tick_)
         {
             // 由于是取模回环，同一个槽里可能混着未来很多轮才真正到期的 tombstone。
             // 这里必须按真实 expire_tick 重新挂回去，不能因为扫到当前槽就提前遗忘。
-            completed_trace_wheel_[iter->second % wheel_size_].push_back(trace_key);
+            shard.completed_trace_wheel_[iter->second % wheel_size_].push_back(trace_key);
+            ++shard.completed_trace_wheel_entries_;
             continue;
         }
-        completed_trace_expire_tick_.erase(iter);
+        shard.completed_trace_expire_tick_.erase(iter);
     }
 }
 
-void TraceSessionManager::ScheduleTimeoutNode(TraceSession &session)
+void TraceSessionManager::ScheduleTimeoutNode(Shard &shard, TraceSession &session)
 {
-    session.timer_version += 1;
-    const uint64_t expire_tick = current_tick_ + timeout_ticks_;
-    const size_t slot = static_cast<size_t>(expire_tick % wheel_size_);
-    TimeWheelNode node;
-    node.trace_key = session.trace_key;
-    node.version = session.timer_version;
-    node.epoch = session.session_epoch;
-    node.expire_tick = expire_tick;
-    time_wheel_[slot].push_back(std::move(node));
+    const uint64_t expire_tick = shard.current_tick_ + timeout_ticks_.load(std::memory_order_relaxed);
+    shard.time_wheel_.Schedule(&session.timer_node, session.trace_key, expire_tick, shard.current_tick_);
 }
 
-void TraceSessionManager::ScheduleSealedNode(TraceSession &session)
+void TraceSessionManager::ScheduleSealedNode(Shard &shard, TraceSession &session)
 {
-    session.timer_version += 1;
-    const uint64_t expire_tick =
-        session.sealed_deadline_tick > current_tick_ ? session.sealed_deadline_tick : current_tick_ + 1;
-    const size_t slot = static_cast<size_t>(expire_tick % wheel_size_);
-    TimeWheelNode node;
-    node.trace_key = session.trace_key;
-    node.version = session.timer_version;
-    node.epoch = session.session_epoch;
-    node.expire_tick = expire_tick;
-    time_wheel_[slot].push_back(std::move(node));
+    // deadline 已经过去时由时间轮顺延到 current_tick_ + 1。
+    shard.time_wheel_.Schedule(&session.timer_node, session.trace_key, session.sealed_deadline_tick, shard.current_tick_);
 }
 
-void TraceSessionManager::ScheduleRetryNode(TraceSession &session)
+void TraceSessionManager::ScheduleRetryNode(Shard &shard, TraceSession &session)
 {
-    session.timer_version += 1;
-    const uint64_t retry_tick =
-        session.next_retry_tick > current_tick_ ? session.next_retry_tick : current_tick_ + 1;
-    const size_t slot = static_cast<size_t>(retry_tick % wheel_size_);
-    TimeWheelNode node;
-    node.trace_key = session.trace_key;
-    node.version = session.timer_version;
-    node.epoch = session.session_epoch;
-    node.expire_tick = retry_tick;
-    time_wheel_[slot].push_back(std::move(node));
+    shard.time_wheel_.Schedule(&session.timer_node, session.trace_key, session.next_retry_tick, shard.current_tick_);
 }
 
-void TraceSessionManager::ScheduleSessionNode(TraceSession &session)
+void TraceSessionManager::ScheduleSessionNode(Shard &shard, TraceSession &session)
 {
     if (session.lifecycle_state == TraceSession::LifecycleState::Sealed)
     {
-        ScheduleSealedNode(session);
+        ScheduleSealedNode(shard, session);
         return;
     }
     if (session.lifecycle_state == TraceSession::LifecycleState::ReadyRetryLater)
     {
-        ScheduleRetryNode(session);
+        ScheduleRetryNode(shard, session);
         return;
     }
-    ScheduleTimeoutNode(session);
+    ScheduleTimeoutNode(shard, session);
 }
 
-void TraceSessionManager::SealSessionLocked(TraceSession &session, TraceSession::SealReason reason)
+void TraceSessionManager::SealSessionLocked(Shard &shard, TraceSession &session, TraceSession::SealReason reason)
 {
     session.lifecycle_state = TraceSession::LifecycleState::Sealed;
     session.seal_reason = reason;
-    session.sealed_deadline_tick = current_tick_ + ComputeSealDelayTicks(reason);
-    ScheduleSessionNode(session);
+    session.sealed_deadline_tick = shard.current_tick_ + ComputeSealDelayTicks(reason);
+    ScheduleSessionNode(shard, session);
 }
 
 void TraceSessionManager::RebuildTimeWheel()
 {
-    for (auto &bucket : time_wheel_)
+    for (auto &shard : shards_)
     {
-        bucket.clear();
+        std::lock_guard<std::mutex> lock(shard->mutex_);
+        RebuildTimeWheelLocked(*shard);
     }
-    for (auto &session_ptr : sessions_)
+}
+
+void TraceSessionManager::RebuildTimeWheelLocked(Shard &shard)
+{
+    shard.time_wheel_.Clear();
+    for (auto &session_ptr : shard.sessions_)
     {
         if (!session_ptr)
         {
             continue;
         }
         // collecting / sealed / retry_later 三种时间语义不同，重建时必须按当前生命周期分别重排。
-        ScheduleSessionNode(*session_ptr);
+        ScheduleSessionNode(shard, *session_ptr);
     }
 }
 
 bool TraceSessionManager::Dispatch(size_t trace_key)
 {
-    std::lock_guard<std::mutex> lock(mutex_);
-    return DispatchLocked(trace_key);
+    Shard &shard = ShardFor(trace_key);
+    std::lock_guard<std::mutex> lock(shard.mutex_);
+    return DispatchLocked(shard, trace_key);
+}
+
+void TraceSessionManager::DirectDispatchWorkerTask::operator()()
+{
+    if (!manager || !session) {
+        return;
+    }
+    // 直调路径的 payload/summary 都是独立拷贝，session 到这里只剩所有权，开工前就可以还回池子。
+    manager->RecycleSession(std::move(session));
+    manager->worker_begin_count_.fetch_add(1, std::memory_order_relaxed);
+    const uint64_t worker_begin_ns = NowSteadyNs();
+    const uint64_t queue_wait_ms =
+        worker_begin_ns >= worker_enqueue_ns ? (worker_begin_ns - worker_enqueue_ns) / 1000000ULL : 0;
+
+    TraceRepository::TraceAnalysisRecord analysis_record;
+    TraceRepository::TraceAnalysisRecord* analysis_ptr = nullptr;
+    size_t alert_token_count = summary.token_count;
+    std::optional<TraceAiUsage> completed_usage;
+    if (trace_ai && !manager->ReplayedTraceAlreadyAnalyzed(summary)) {
+        if (system_runtime_accumulator) {
+            // AI 调用总数表达的是“真正开始发起模型调用”的次数。
+            // 所以 started 记在 worker 真开始调 AnalyzeTrace 之前，而不是 trace 刚被系统接住时。
+            system_runtime_accumulator->RecordAiCallStarted();
+        }
+        manager->ai_calls_.fetch_add(1, std::memory_order_relaxed);
+        const uint64_t ai_begin_ns = NowSteadyNs();
+        uint64_t inference_latency_ms = 0;
+        try {
+            TraceAiResponse ai_response = trace_ai->AnalyzeTrace(trace_payload);
+            analysis_record = manager->BuildAnalysisRecord(summary.trace_id, ai_response.analysis);
+            analysis_ptr = &analysis_record;
+            alert_token_count = ResolveAlertTokenCount(summary, ai_response.usage);
+            completed_usage = ai_response.usage;
+        } catch (const std::exception& e) {
+            analysis_record.trace_id = summary.trace_id;
+            analysis_record.risk_level = "unknown";
+            analysis_record.summary = "AI_ANALYSIS_FAILED";
+            analysis_record.root_cause = e.what();
+            analysis_record.solution = "请检查 AI 代理与模型服务状态，稍后重试该 trace 的分析。";
+            analysis_record.confidence = 0.0;
+            analysis_ptr = &analysis_record;
+        } catch (...) {
+            analysis_record.trace_id = summary.trace_id;
+            analysis_record.risk_level = "unknown";
+            analysis_record.summary = "AI_ANALYSIS_FAILED";
+            analysis_record.root_cause = "Unknown non-std exception";
+            analysis_record.solution = "请检查 AI 代理与模型服务状态，稍后重试该 trace 的分析。";
+            analysis_record.confidence = 0.0;
+            analysis_ptr = &analysis_record;
+        }
+        const uint64_t ai_end_ns = NowSteadyNs();
+        manager->ai_total_ns_.fetch_add(ai_end_ns - ai_begin_ns, std::memory_order_relaxed);
+        inference_latency_ms = ai_end_ns >= ai_begin_ns ? (ai_end_ns - ai_begin_ns) / 1000000ULL : 0;
+        if (system_runtime_accumulator) {
+            // queue_wait 和 inference_latency 都属于同一次 AI 调用的收尾结果。
+            // 这里在调用结束后一次性提交，避免把两张延迟卡拆成两个成熟时机不同的半成品。
+            system_runtime_accumulator->RecordAiCallCompleted(queue_wait_ms, inference_latency_ms, completed_usage);
+        }
+    }
+
+    manager->analysis_enqueue_calls_.fetch_add(1, std::memory_order_relaxed);
+    const uint64_t enqueue_begin_ns = NowSteadyNs();
+    bool saved = true;
+    if (!buffered_trace_repo) {
+        saved = false;
+    } else {
+        BufferedTraceRepository::TraceAnalysisWrite analysis_write;
+        if (analysis_ptr) {
+            analysis_write.analysis = *analysis_ptr;
+            analysis_write.analysis->replayed = summary.replayed;
+        }
+        saved = buffered_trace_repo->AppendAnalysis(std::move(analysis_write));
+    }
+    manager->analysis_enqueue_total_ns_.fetch_add(NowSteadyNs() - enqueue_begin_ns, std::memory_order_relaxed);
+    manager->worker_done_count_.fetch_add(1, std::memory_order_relaxed);
+    if (!saved || !notifier || !analysis_ptr) {
+        return;
+    }
+
+    const std::string risk_level = toLowerCopy(analysis_ptr->risk_level);
+    if (risk_level != "critical") {
+        return;
+    }
+
+    TraceAlertEvent event;
+    event.trace_id = summary.trace_id;
+    event.service_name = summary.service_name;
+    event.start_time_ms = summary.start_time_ms;
+    event.duration_ms = summary.duration_ms;
+    event.span_count = summary.span_count;
+    event.token_count = alert_token_count;
+    event.risk_level = analysis_ptr->risk_level;
+    event.summary = analysis_ptr->summary;
+    event.root_cause = analysis_ptr->root_cause;
+    event.solution = analysis_ptr->solution;
+    event.confidence = analysis_ptr->confidence;
+    notifier->notifyTraceAlert(event);
 }
 
-bool TraceSessionManager::DispatchLocked(size_t trace_key)
+bool TraceSessionManager::DispatchLocked(Shard &shard, size_t trace_key)
 {
     // 双保险：正常路径已在 Push 入口拒绝无线程池情况；这里继续防御，避免未来别的路径直接调 Dispatch 时删掉 session。
     if (!thread_pool_)
     {
         return false;
     }
-    auto iter = index_by_trace_.find(trace_key);
-    if (iter == index_by_trace_.end())
+    auto iter = shard.index_by_trace_.find(trace_key);
+    if (iter == shard.index_by_trace_.end())
     {
         return true;
     }
     dispatch_count_.fetch_add(1, std::memory_order_relaxed);
 
     const size_t index = iter->second;
-    std::unique_ptr<TraceSession> session = std::move(sessions_[index]);
+    std::unique_ptr<TraceSession> session = std::move(shard.sessions_[index]);
     const size_t span_count = session ? session->spans.size() : 0;
-    index_by_trace_.erase(iter);
-
-    if (index < sessions_.size() - 1)
-    {
-        // swap+pop_back：用最后一个元素覆盖被移除位置，保持容器紧凑并避免线性搬移。
-        sessions_[index] = std::move(sessions_.back());
-        sessions_.pop_back();
-        index_by_trace_[sessions_[index]->trace_key] = index;
-    }
-    else
-    {
-        sessions_.pop_back();
-    }
-    if (active_sessions_ > 0)
+    const size_t byte_count = session ? session->buffered_bytes : 0;
+    shard.index_by_trace_.erase(iter);
+    if (session)
     {
-        active_sessions_ -= 1;
+        shard.time_wheel_.Cancel(&session->timer_node);
     }
-    if (total_buffered_spans_ >= span_count)
+
+    if (index < shard.sessions_.size() - 1)
     {
-        total_buffered_spans_ -= span_count;
+        // swap+pop_back：用最后一个元素覆盖被移除位置，保持容器紧凑并避免线性搬移。
+        shard.sessions_[index] = std::move(shard.sessions_.back());
+        shard.sessions_.pop_back();
+        shard.index_by_trace_[shard.sessions_[index]->trace_key] = index;
     }
     else
     {
-        total_buffered_spans_ = 0;
+        shard.sessions_.pop_back();
     }
+    ReleaseSessionCounters(span_count, byte_count);
     RefreshOverloadState();
 
-    auto rollback_session = [this, trace_key, span_count](std::unique_ptr<TraceSession> restored_session)
+    auto rollback_session = [this, &shard, trace_key, span_count, byte_count](std::unique_ptr<TraceSession> restored_session)
     {
         restored_session->lifecycle_state = TraceSession::LifecycleState::ReadyRetryLater;
         restored_session->sealed_deadline_tick = 0;
         restored_session->last_update_ms = NowSteadyMs();
         restored_session->retry_count += 1;
         restored_session->next_retry_tick =
-            current_tick_ + ComputeRetryDelayTicks(restored_session->retry_count);
-        sessions_.push_back(std::move(restored_session));
-        index_by_trace_[trace_key] = sessions_.size() - 1;
-        active_sessions_ += 1;
-        total_buffered_spans_ += span_count;
-        ScheduleSessionNode(*sessions_.back());
+            shard.current_tick_ + ComputeRetryDelayTicks(restored_session->retry_count);
+        shard.sessions_.push_back(std::move(restored_session));
+        shard.index_by_trace_[trace_key] = shard.sessions_.size() - 1;
+        active_sessions_.fetch_add(1, std::memory_order_relaxed);
+        total_buffered_spans_.fetch_add(span_count, std::memory_order_relaxed);
+        total_buffered_bytes_.fetch_add(byte_count, std::memory_order_relaxed);
+        ScheduleSessionNode(shard, *shard.sessions_.back());
         RefreshOverloadState();
     };
 
@@ -1004,116 +1728,419 @@ bool TraceSessionManager::DispatchLocked(size_t trace_key)
         session->primary_enqueued = true;
     }
 
-    auto session_holder = std::make_shared<std::unique_ptr<TraceSession>>(std::move(session));
-    TraceSessionManager *manager = this;
-    BufferedTraceRepository *buffered_trace_repo = buffered_trace_repo_;
-    TraceAiProvider *trace_ai = trace_ai_;
-    INotifier *notifier = notifier_;
-    SystemRuntimeAccumulator* system_runtime_accumulator = system_runtime_accumulator_;
-    const uint64_t worker_enqueue_ns = NowSteadyNs();
-    if (!thread_pool_->submit([manager, buffered_trace_repo, trace_ai, notifier, system_runtime_accumulator, worker_enqueue_ns, session_holder, trace_payload = std::move(trace_payload), summary = std::move(summary), span_records = std::move(span_records)]() mutable
-                              {
-        if (!manager || !session_holder || !(*session_holder)) {
-            return;
-        }
-        manager->worker_begin_count_.fetch_add(1, std::memory_order_relaxed);
-        const uint64_t worker_begin_ns = NowSteadyNs();
-        const uint64_t queue_wait_ms =
-            worker_begin_ns >= worker_enqueue_ns ? (worker_begin_ns - worker_enqueue_ns) / 1000000ULL : 0;
-
-        TraceRepository::TraceAnalysisRecord analysis_record;
-        TraceRepository::TraceAnalysisRecord* analysis_ptr = nullptr;
-        size_t alert_token_count = summary.token_count;
-        std::optional<TraceAiUsage> completed_usage;
-        if (trace_ai) {
-            if (system_runtime_accumulator) {
-                // AI 调用总数表达的是“真正开始发起模型调用”的次数。
-                // 所以 started 记在 worker 真开始调 AnalyzeTrace 之前，而不是 trace 刚被系统接住时。
-                system_runtime_accumulator->RecordAiCallStarted();
-            }
-            manager->ai_calls_.fetch_add(1, std::memory_order_relaxed);
-            const uint64_t ai_begin_ns = NowSteadyNs();
-            uint64_t inference_latency_ms = 0;
-            try {
-                TraceAiResponse ai_response = trace_ai->AnalyzeTrace(trace_payload);
-                analysis_record = manager->BuildAnalysisRecord(summary.trace_id, ai_response.analysis);
-                analysis_ptr = &analysis_record;
-                alert_token_count = ResolveAlertTokenCount(summary, ai_response.usage);
-                completed_usage = ai_response.usage;
-            } catch (const std::exception& e) {
-                analysis_record.trace_id = summary.trace_id;
-                analysis_record.risk_level = "unknown";
-                analysis_record.summary = "AI_ANALYSIS_FAILED";
-                analysis_record.root_cause = e.what();
-                analysis_record.solution = "请检查 AI 代理与模型服务状态，稍后重试该 trace 的分析。";
-                analysis_record.confidence = 0.0;
-                analysis_ptr = &analysis_record;
-            } catch (...) {
-                analysis_record.trace_id = summary.trace_id;
-                analysis_record.risk_level = "unknown";
-                analysis_record.summary = "AI_ANALYSIS_FAILED";
-                analysis_record.root_cause = "Unknown non-std exception";
-                analysis_record.solution = "请检查 AI 代理与模型服务状态，稍后重试该 trace 的分析。";
-                analysis_record.confidence = 0.0;
-                analysis_ptr = &analysis_record;
-            }
-            const uint64_t ai_end_ns = NowSteadyNs();
-            manager->ai_total_ns_.fetch_add(ai_end_ns - ai_begin_ns, std::memory_order_relaxed);
-            inference_latency_ms = ai_end_ns >= ai_begin_ns ? (ai_end_ns - ai_begin_ns) / 1000000ULL : 0;
-            if (system_runtime_accumulator) {
-                // queue_wait 和 inference_latency 都属于同一次 AI 调用的收尾结果。
-                // 这里在调用结束后一次性提交，避免把两张延迟卡拆成两个成熟时机不同的半成品。
-                system_runtime_accumulator->RecordAiCallCompleted(queue_wait_ms, inference_latency_ms, completed_usage);
-            }
-        }
+    DirectDispatchWorkerTask worker;
+    worker.manager = this;
+    worker.buffered_trace_repo = buffered_trace_repo_;
+    worker.trace_ai = trace_ai_;
+    worker.notifier = notifier_;
+    worker.system_runtime_accumulator = system_runtime_accumulator_;
+    worker.worker_enqueue_ns = NowSteadyNs();
+    worker.session = std::move(session);
+    worker.trace_payload = std::move(trace_payload);
+    worker.summary = std::move(summary);
+    worker.span_records = std::move(span_records);
+    ThreadPool::Task task(std::move(worker));
+    if (!thread_pool_->submit(std::move(task)))
+    {
+        submit_fail_count_.fetch_add(1, std::memory_order_relaxed);
+        // submit 被拒时 task 原样留在本地，直接从里面把 session 取回来回滚。
+        rollback_session(std::move(task.target<DirectDispatchWorkerTask>()->session));
+        return false;
+    }
+    AddCompletedTombstoneLocked(shard, trace_key);
+    submit_ok_count_.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
 
-        manager->analysis_enqueue_calls_.fetch_add(1, std::memory_order_relaxed);
-        const uint64_t enqueue_begin_ns = NowSteadyNs();
-        bool saved = true;
-        if (!buffered_trace_repo) {
-            saved = false;
-        } else {
-            BufferedTraceRepository::TraceAnalysisWrite analysis_write;
-            if (analysis_ptr) {
-                analysis_write.analysis = *analysis_ptr;
-            }
-            saved = buffered_trace_repo->AppendAnalysis(std::move(analysis_write));
-        }
-        manager->analysis_enqueue_total_ns_.fetch_add(NowSteadyNs() - enqueue_begin_ns, std::memory_order_relaxed);
-        manager->worker_done_count_.fetch_add(1, std::memory_order_relaxed);
-        if (!saved || !notifier || !analysis_ptr) {
-            return;
-        }
+// AiOutcome 收拢一次 AI 调用从开始到收尾要带着走的全部状态。
+// 同步路径里它就是栈上的局部变量；异步路径里它和任务本体一起挂在回调上，等 provider 回来后接着用。
+struct TraceSessionManager::DispatchWorkerTask::AiOutcome
+{
+    uint64_t queue_wait_ms = 0;
+    uint64_t ai_begin_ns = 0;
+    TraceRepository::TraceAnalysisRecord analysis_record;
+    bool has_analysis = false;
+    size_t alert_token_count = 0;
+    std::optional<TraceAiUsage> completed_usage;
+    std::string ai_status_override;
+    std::string ai_error_override;
+    // 本任务是缓存里这个指纹的领头者：Finish 时必须把结果（或失败）交回缓存，唤醒挂在它上面的等待者。
+    bool cache_leader = false;
+    // 领头者拿到的原始结论，留着交回缓存；analysis_record 已经是落库形态，换不回 TraceAiResponse。
+    std::optional<LogAnalysisResult> cacheable_analysis;
+};
+
+void TraceSessionManager::DispatchWorkerTask::operator()()
+{
+    if (!manager || !session || !worker_trace_payload || !worker_summary) {
+        return;
+    }
+    manager->worker_begin_count_.fetch_add(1, std::memory_order_relaxed);
+    const uint64_t worker_begin_ns = NowSteadyNs();
 
-        const std::string risk_level = toLowerCopy(analysis_ptr->risk_level);
-        if (risk_level != "critical") {
-            return;
-        }
+    AiOutcome outcome;
+    outcome.queue_wait_ms =
+        worker_begin_ns >= worker_enqueue_ns ? (worker_begin_ns - worker_enqueue_ns) / 1000000ULL : 0;
+    outcome.alert_token_count = worker_summary->token_count;
+    if (manager->ReplayedTraceAlreadyAnalyzed(*worker_summary)) {
+        // 没有 analysis、也没有状态覆盖：Finish 什么都不写、不告警，只把 session 还回池子。
+        Finish(&outcome);
+        return;
+    }
+    if (manager->ai_result_cache_ && manager->ai_analysis_enabled_ && session->prepared_fingerprint.has_value() &&
+        !LookupCachedResult(&outcome)) {
+        return;
+    }
+    RunAiCall(&outcome);
+}
 
-        TraceAlertEvent event;
-        event.trace_id = summary.trace_id;
-        event.service_name = summary.service_name;
-        event.start_time_ms = summary.start_time_ms;
-        event.duration_ms = summary.duration_ms;
-        event.span_count = summary.span_count;
-        event.token_count = alert_token_count;
-        event.risk_level = analysis_ptr->risk_level;
-        event.summary = analysis_ptr->summary;
-        event.root_cause = analysis_ptr->root_cause;
-        event.solution = analysis_ptr->solution;
-        event.confidence = analysis_ptr->confidence;
-        notifier->notifyTraceAlert(event); }))
-    {
-        submit_fail_count_.fetch_add(1, std::memory_order_relaxed);
-        std::unique_ptr<TraceSession> restored_session = std::move(*session_holder);
-        rollback_session(std::move(restored_session));
+bool TraceSessionManager::DispatchWorkerTask::LookupCachedResult(AiOutcome* outcome)
+{
+    const uint64_t fingerprint = session->prepared_fingerprint.value();
+    TraceAiResponse cached;
+    // 同指纹已有调用在途时，把任务连同 outcome 搬进共享上下文挂到缓存上；领头收尾时在它的线程上回调。
+    // 工厂只在真要排队时才跑，命中和领头这两条主路径都不会为此多一次堆分配。
+    auto make_waiter = [this, outcome]() -> TraceAiResultCache::Waiter {
+        struct CacheWait
+        {
+            DispatchWorkerTask task;
+            AiOutcome outcome;
+        };
+        auto wait = std::make_shared<CacheWait>(CacheWait{std::move(*this), std::move(*outcome)});
+        wait->task.manager->ai_cache_waiting_.fetch_add(1, std::memory_order_relaxed);
+        return [wait](std::optional<TraceAiResponse> response) {
+            // 这里跑在领头者的收尾线程上，可能就是 provider 的 IO loop 线程；收尾和重新调模型都可能阻塞，
+            // 和异步 AI 回调一样经完成队列交回 worker 线程池，线程池拒收时由专用完成线程接手，绝不就地执行。
+            TraceSessionManager* owner = wait->task.manager;
+            ThreadPool::Task resume([wait, owner, response = std::move(response)]() mutable {
+                if (response.has_value()) {
+                    wait->task.FinishFromCache(response.value(), &wait->outcome);
+                } else {
+                    // 领头没拿到可复用的结果：这条 trace 自己再走一遍完整调用，熔断/降级判断都照常生效。
+                    wait->task.RunAiCall(&wait->outcome);
+                }
+                owner->ai_cache_waiting_.fetch_sub(1, std::memory_order_release);
+            });
+            owner->ai_completion_queue_->Submit(owner->thread_pool_, std::move(resume));
+        };
+    };
+    switch (manager->ai_result_cache_->Lookup(fingerprint, NowSteadyMs(), &cached, make_waiter)) {
+    case TraceAiResultCache::LookupResult::Hit:
+        FinishFromCache(cached, outcome);
         return false;
+    case TraceAiResultCache::LookupResult::Joined:
+        // 任务本体已经搬走，这里之后不能再碰任何成员。
+        return false;
+    case TraceAiResultCache::LookupResult::Leader:
+        break;
     }
-    AddCompletedTombstoneLocked(trace_key);
-    submit_ok_count_.fetch_add(1, std::memory_order_relaxed);
+    outcome->cache_leader = true;
+    return true;
+}
+
+void TraceSessionManager::DispatchWorkerTask::FinishFromCache(const TraceAiResponse& response, AiOutcome* outcome)
+{
+    // 命中不算一次 AI 调用：不记 ai_calls/耗时，也不动熔断计数，只把复用的结论落成这条 trace 自己的 analysis。
+    outcome->analysis_record = manager->BuildAnalysisRecord(worker_summary->trace_id, response.analysis);
+    outcome->analysis_record.ai_status = kAiStatusCompletedCache;
+    outcome->has_analysis = true;
+    if (system_runtime_accumulator) {
+        system_runtime_accumulator->RecordAiCacheHit();
+    }
+    Finish(outcome);
+}
+
+void TraceSessionManager::DispatchWorkerTask::RunAiCall(AiOutcome* outcome)
+{
+    if (!BeginAiCall(outcome)) {
+        Finish(outcome);
+        return;
+    }
+
+    if (manager->ai_async_dispatch_enabled_ && trace_ai->SupportsAsync()) {
+        // 异步路径：worker 只负责把请求交给 provider 的 IO loop，然后立刻回到线程池吃下一条 trace。
+        // 任务本体和 outcome 一起搬进共享上下文挂在回调上，这是整条派发链路里唯一一次额外堆分配，
+        // 换来的是 AI 并发不再受 worker 线程数限制。
+        struct AsyncAiCall
+        {
+            DispatchWorkerTask task;
+            AiOutcome outcome;
+        };
+        auto call = std::make_shared<AsyncAiCall>(AsyncAiCall{std::move(*this), std::move(*outcome)});
+        TraceSessionManager* owner = call->task.manager;
+        owner->ai_async_inflight_.fetch_add(1, std::memory_order_relaxed);
+        call->task.trace_ai->AnalyzeTraceAsync(*call->task.worker_trace_payload,
+                                    [call, owner](TraceAiResponse response, std::exception_ptr error) mutable {
+            // 回调跑在 provider 自己的 loop 线程上，而收尾要做 AppendAnalysis、备路调用、告警通知这类可能阻塞的动作，
+            // 所以这里只负责把结果经完成队列转交出去：线程池拒收时由专用完成线程接手，loop 线程上不做任何收尾。
+            ThreadPool::Task finish([call, owner, response = std::move(response), error]() mutable {
+                // CompleteAiCall 可能把任务本体再搬进备路的异步上下文，之后只能用提前取出的 owner。
+                call->task.CompleteAiCall(std::move(response), error, &call->outcome);
+                owner->ai_async_inflight_.fetch_sub(1, std::memory_order_release);
+            });
+            owner->ai_completion_queue_->Submit(owner->thread_pool_, std::move(finish));
+        });
+        return;
+    }
+
+    TraceAiResponse response;
+    std::exception_ptr error;
+    try {
+        response = trace_ai->AnalyzeTrace(*worker_trace_payload);
+    } catch (...) {
+        error = std::current_exception();
+    }
+    CompleteAiCall(std::move(response), error, outcome);
+}
+
+bool TraceSessionManager::DispatchWorkerTask::BeginAiCall(AiOutcome* outcome)
+{
+    const int64_t ai_now_ms = NowSteadyMs();
+    if (!manager->ai_analysis_enabled_) {
+        // 这里是用户主动关闭 AI 的语义，不是失败。
+        // 所以 worker 仍要正常收尾，只把 summary 状态改成 skipped_manual，不能伪造一条失败 analysis。
+        outcome->ai_status_override = kAiStatusSkippedManual;
+        return false;
+    }
+    if (manager->IsAiCircuitOpen(ai_now_ms)) {
+        // 熔断打开时这条 trace 仍然要正常落主数据，只是跳过本次 AI 调用。
+        // 这里不再递增失败次数，因为 skipped_circuit 表达的是“被保护性短路”，不是一次新的 provider 调用失败。
+        outcome->ai_status_override = kAiStatusSkippedCircuit;
+        return false;
+    }
+    if (!trace_ai) {
+        // provider 为空时这条 trace 不可能真的完成分析。
+        // 这里直接记 failed_primary，避免主记录永远卡在 pending。
+        outcome->ai_status_override = kAiStatusFailedPrimary;
+        outcome->ai_error_override = "Trace AI provider unavailable";
+        manager->RecordAiCircuitFailure(ai_now_ms);
+        return false;
+    }
+    if (system_runtime_accumulator) {
+        // 系统监控里的 AI 调用总数要落在“真正准备调模型”的时间点，
+        // 不能在 submit 成功时就提前加，否则排队中断或后续没进入模型都算脏数据。
+        system_runtime_accumulator->RecordAiCallStarted();
+    }
+    manager->ai_calls_.fetch_add(1, std::memory_order_relaxed);
+    outcome->ai_begin_ns = NowSteadyNs();
     return true;
 }
 
+void TraceSessionManager::DispatchWorkerTask::ApplyAiResponse(const TraceAiResponse& response, AiOutcome* outcome)
+{
+    outcome->analysis_record = manager->BuildAnalysisRecord(worker_summary->trace_id, response.analysis);
+    outcome->has_analysis = true;
+    // worker_summary 指向的是已经落完 primary 的只读摘要，这里不能回写它本体。
+    // 所以后面发告警时单独走 alert_token_count，避免为了一个展示口径去改数据库主记录。
+    outcome->alert_token_count = ResolveAlertTokenCount(*worker_summary, response.usage);
+    outcome->completed_usage = response.usage;
+    if (outcome->cache_leader) {
+        outcome->cacheable_analysis = response.analysis;
+    }
+    manager->RecordAiCircuitSuccess();
+}
+
+void TraceSessionManager::DispatchWorkerTask::CompleteAiCall(TraceAiResponse response,
+                                                             std::exception_ptr error,
+                                                             AiOutcome* outcome)
+{
+    if (!error) {
+        try {
+            ApplyAiResponse(response, outcome);
+        } catch (...) {
+            // 主路响应本身解析失败也算主路失败，和原先把整段调用包在一个 try 里的语义保持一致。
+            error = std::current_exception();
+        }
+    }
+    if (!error) {
+        EndAiCall(outcome);
+        return;
+    }
+
+    std::string primary_error;
+    try {
+        std::rethrow_exception(error);
+    } catch (const std::exception& e) {
+        // 这里吃到的 e.what() 现在既可能是本地 HTTP/JSON 协议错误，
+        // 也可能是 proxy 已经归一好的 provider 失败文本（例如 [429 RESOURCE_EXHAUSTED] quota exhausted）。
+        primary_error = TruncateTraceAiError(e.what());
+    } catch (...) {
+        primary_error = "Unknown non-std exception";
+    }
+    const bool should_try_fallback =
+        manager->ai_auto_degrade_enabled_ && fallback_trace_ai != nullptr;
+    if (!should_try_fallback) {
+        // 如果当前没开自动降级，就直接把主路失败写回 ai_error。
+        outcome->ai_status_override = kAiStatusFailedPrimary;
+        outcome->ai_error_override = primary_error;
+        manager->RecordAiCircuitFailure(NowSteadyMs());
+        EndAiCall(outcome);
+        return;
+    }
+
+    // 自动降级只在主路真正失败后才触发，而且 fallback 仍然复用同一份 trace payload。
+    // 这样不会把 provider 切换的复杂度扩散到序列化或提示词渲染层。
+    if (manager->ai_async_dispatch_enabled_ && fallback_trace_ai->SupportsAsync()) {
+        // 异步模式下备路也走非阻塞调用：主路大面积失败时 worker 不会被一条条同步备路调用占满。
+        RunFallbackAsync(std::move(primary_error), outcome);
+        return;
+    }
+    // 备路不支持异步时同步调用。走到这里的线程只可能是 worker 或专用完成线程，不会是 provider 的 loop 线程。
+    TraceAiResponse fallback_response;
+    std::exception_ptr fallback_error;
+    try {
+        fallback_response = fallback_trace_ai->AnalyzeTrace(*worker_trace_payload);
+    } catch (...) {
+        fallback_error = std::current_exception();
+    }
+    CompleteFallback(std::move(fallback_response), fallback_error, primary_error, outcome);
+}
+
+void TraceSessionManager::DispatchWorkerTask::RunFallbackAsync(std::string primary_error, AiOutcome* outcome)
+{
+    // 和主路异步调用同样的搬家方式；主路那份上下文里的任务本体从这里起就是空壳了。
+    struct AsyncFallbackCall
+    {
+        DispatchWorkerTask task;
+        AiOutcome outcome;
+        std::string primary_error;
+    };
+    auto call = std::make_shared<AsyncFallbackCall>(
+        AsyncFallbackCall{std::move(*this), std::move(*outcome), std::move(primary_error)});
+    TraceSessionManager* owner = call->task.manager;
+    owner->ai_async_inflight_.fetch_add(1, std::memory_order_relaxed);
+    call->task.fallback_trace_ai->AnalyzeTraceAsync(*call->task.worker_trace_payload,
+                                             [call, owner](TraceAiResponse response, std::exception_ptr error) mutable {
+        ThreadPool::Task finish([call, owner, response = std::move(response), error]() mutable {
+            call->task.CompleteFallback(std::move(response), error, call->primary_error, &call->outcome);
+            owner->ai_async_inflight_.fetch_sub(1, std::memory_order_release);
+        });
+        owner->ai_completion_queue_->Submit(owner->thread_pool_, std::move(finish));
+    });
+}
+
+void TraceSessionManager::DispatchWorkerTask::CompleteFallback(TraceAiResponse response,
+                                                               std::exception_ptr error,
+                                                               const std::string& primary_error,
+                                                               AiOutcome* outcome)
+{
+    if (!error) {
+        try {
+            ApplyAiResponse(response, outcome);
+        } catch (...) {
+            error = std::current_exception();
+        }
+    }
+    if (error) {
+        std::string fallback_error;
+        try {
+            std::rethrow_exception(error);
+        } catch (const std::exception& e) {
+            fallback_error = TruncateTraceAiError(e.what());
+        } catch (...) {
+            fallback_error = "Unknown non-std exception";
+        }
+        outcome->ai_status_override = kAiStatusFailedBoth;
+        outcome->ai_error_override = BuildDualAiError(primary_error, fallback_error);
+        manager->RecordAiCircuitFailure(NowSteadyMs());
+    }
+    EndAiCall(outcome);
+}
+
+void TraceSessionManager::DispatchWorkerTask::EndAiCall(AiOutcome* outcome)
+{
+    const uint64_t ai_end_ns = NowSteadyNs();
+    manager->ai_total_ns_.fetch_add(ai_end_ns - outcome->ai_begin_ns, std::memory_order_relaxed);
+    const uint64_t inference_latency_ms =
+        ai_end_ns >= outcome->ai_begin_ns ? (ai_end_ns - outcome->ai_begin_ns) / 1000000ULL : 0;
+    if (system_runtime_accumulator) {
+        // 这里把排队等待和真实推理耗时作为同一条完成样本写进去。
+        // 前者在 worker 开始时就能算，但只有到 AI 收尾时，这条调用样本才算真正成熟。
+        system_runtime_accumulator->RecordAiCallCompleted(outcome->queue_wait_ms,
+                                                          inference_latency_ms,
+                                                          outcome->completed_usage);
+    }
+    Finish(outcome);
+}
+
+void TraceSessionManager::DispatchWorkerTask::Finish(AiOutcome* outcome)
+{
+    DeliverOutcome(outcome);
+    // worker_summary/worker_trace_payload 指向 session 内部，收尾全部做完之后才能把 session 还回池子。
+    worker_summary = nullptr;
+    worker_trace_payload = nullptr;
+    manager->RecycleSession(std::move(session));
+}
+
+void TraceSessionManager::DispatchWorkerTask::DeliverOutcome(AiOutcome* outcome)
+{
+    const TraceRepository::TraceAnalysisRecord* analysis_ptr =
+        outcome->has_analysis ? &outcome->analysis_record : nullptr;
+    if (outcome->cache_leader) {
+        // 领头者不管成败都要交回缓存：所有提前返回（熔断、provider 缺失）和失败路径最后都汇到 Finish，
+        // 这里是唯一能保证等待者一定被唤醒的位置。先于落库做，等待者不用陪着领头等 AppendAnalysis。
+        outcome->cache_leader = false;
+        std::optional<TraceAiResponse> shared;
+        if (outcome->cacheable_analysis.has_value()) {
+            shared.emplace();
+            shared->analysis = std::move(outcome->cacheable_analysis.value());
+        }
+        manager->ai_result_cache_->Complete(session->prepared_fingerprint.value(),
+                                            shared.has_value() ? &shared.value() : nullptr,
+                                            NowSteadyMs());
+    }
+    manager->analysis_enqueue_calls_.fetch_add(1, std::memory_order_relaxed);
+    const uint64_t enqueue_begin_ns = NowSteadyNs();
+    bool saved = true;
+    if (!buffered_trace_repo) {
+        saved = false;
+    } else if (analysis_ptr) {
+        BufferedTraceRepository::TraceAnalysisWrite analysis_write;
+        analysis_write.analysis = *analysis_ptr;
+        analysis_write.analysis->replayed = worker_summary->replayed;
+        saved = buffered_trace_repo->AppendAnalysis(std::move(analysis_write));
+    } else if (!outcome->ai_status_override.empty()) {
+        // 没有 analysis 可写时，必须把最终状态直接落回 summary。
+        // 否则查询层只能看到 pending，却分不清是人工关闭、provider 缺失还是调用失败。
+        saved = buffered_trace_repo->UpdateTraceAiState(worker_summary->trace_id,
+                                                        outcome->ai_status_override,
+                                                        outcome->ai_error_override);
+    }
+    manager->analysis_enqueue_total_ns_.fetch_add(NowSteadyNs() - enqueue_begin_ns, std::memory_order_relaxed);
+    manager->worker_done_count_.fetch_add(1, std::memory_order_relaxed);
+    if (service_runtime_accumulator && analysis_ptr && analysis_observation_span_records)
+    {
+        // AI 回来后只补最近样本，不再回写 overview / 服务统计，避免同一条 trace 重复记账。
+        service_runtime_accumulator->OnAnalysisReady(
+            BuildAnalysisObservation(*worker_summary,
+                                     *analysis_observation_span_records,
+                                     analysis_ptr->summary,
+                                     analysis_ptr->risk_level));
+    }
+    if (!saved || !notifier || !analysis_ptr) {
+        return;
+    }
+
+    const std::string risk_level = toLowerCopy(analysis_ptr->risk_level);
+    if (risk_level != "critical") {
+        return;
+    }
+
+    TraceAlertEvent event;
+    event.trace_id = worker_summary->trace_id;
+    event.service_name = worker_summary->service_name;
+    event.start_time_ms = worker_summary->start_time_ms;
+    event.duration_ms = worker_summary->duration_ms;
+    event.span_count = worker_summary->span_count;
+    event.token_count = outcome->alert_token_count;
+    event.risk_level = analysis_ptr->risk_level;
+    event.summary = analysis_ptr->summary;
+    event.root_cause = analysis_ptr->root_cause;
+    event.solution = analysis_ptr->solution;
+    event.confidence = analysis_ptr->confidence;
+    notifier->notifyTraceAlert(event);
+}
+
 void TraceSessionManager::ProcessDispatchJob(DispatchJob job)
 {
     std::unique_ptr<TraceSession> session = std::move(job.session);
@@ -1142,6 +2169,15 @@ void TraceSessionManager::ProcessDispatchJob(DispatchJob job)
         summary_ptr = &session->prepared_summary.value();
     }
 
+    // 尾部采样只在第一次分发时判定：primary 已经入缓冲的 retry 会话说明上次已经决定保留。
+    // 判定放在建树/序列化之前，被丢弃的 trace 连 payload 都不用生成。
+    if (trace_sampler_ && !session->primary_enqueued &&
+        trace_sampler_->Decide(*session) == TraceSampler::Decision::Drop)
+    {
+        FinishSampledOutTrace(std::move(session));
+        return;
+    }
+
     const bool need_payload = (trace_payload_ptr == nullptr);
     const bool need_summary = (summary_ptr == nullptr);
     const bool need_primary = !session->primary_enqueued;
@@ -1211,6 +2247,12 @@ void TraceSessionManager::ProcessDispatchJob(DispatchJob job)
         span_records = BuildSpanRecords(ready_order);
     }
 
+    if (ai_result_cache_ && !session->prepared_fingerprint.has_value())
+    {
+        // 指纹复用本轮已经建好的 TraceIndex；retry 时 session 上已经带着第一次算好的指纹，不会为它再单独建一次树。
+        session->prepared_fingerprint = ComputeTraceFingerprint(ensure_trace_index());
+    }
+
     // 服务监控 observation 需要一份“这条 trace 的错误 span 平铺视图”。
     // 第一刀先直接复用 span_records；如果当前是 retry 路径且主数据已入缓冲，就补建一份临时 records，
     // 这样既不重复写主数据，也不用让服务监控再去理解 TraceSession 的内部结构。
@@ -1235,13 +2277,21 @@ void TraceSessionManager::ProcessDispatchJob(DispatchJob job)
     {
         primary_observation = BuildPrimaryObservation(*summary_ptr, *observation_span_records_ptr);
     }
-    std::shared_ptr<std::vector<TraceRepository::TraceSpanRecord>> analysis_observation_span_records;
+    std::optional<std::vector<TraceRepository::TraceSpanRecord>> analysis_observation_span_records;
     if (service_runtime_accumulator_ && observation_span_records_ptr)
     {
-        // worker 线程会晚于当前函数返回才真正执行，所以这里必须把 observation 用到的 span 视图单独拷出去，
+        // worker 线程会晚于当前函数返回才真正执行，所以 observation 用到的 span 视图必须跟着任务走，
         // 不能把局部 vector 的地址直接借给异步任务，否则 ProcessDispatchJob 退栈后就是悬空指针。
-        analysis_observation_span_records =
-            std::make_shared<std::vector<TraceRepository::TraceSpanRecord>>(*observation_span_records_ptr);
+        // 单独补建的那份本线程后面不再用，直接 move 进任务；复用 span_records 的情况下，
+        // span_records 马上还要 move 给 AppendPrimary，这里只能拷一份。
+        if (observation_span_records_ptr == &observation_span_records)
+        {
+            analysis_observation_span_records = std::move(observation_span_records);
+        }
+        else
+        {
+            analysis_observation_span_records = *observation_span_records_ptr;
+        }
     }
 
     // 上面三个缺口都补完后，worker 与 append 路径只读 session 内部 prepared 数据即可。
@@ -1286,18 +2336,19 @@ void TraceSessionManager::ProcessDispatchJob(DispatchJob job)
             // 1) manager 里查不到这条 session；
             // 2) tombstone 也还没建立；
             // 3) 晚到 span 会落在“旧 session 已摘走、新 session 还没回滚”的缝里，状态会乱。
-            // 所以这里必须在同一把 manager 锁里做三件事：
+            // 所以这里必须在同一把 shard 锁里做三件事：
             // - 删掉 inflight 标记
             // - 把 session 放回 manager
             // - 改成 ReadyRetryLater，挂上下一次 retry tick
-            std::lock_guard<std::mutex> lock(mutex_);
-            auto inflight_iter = dispatching_inflight_.find(trace_key);
-            if (inflight_iter != dispatching_inflight_.end() &&
+            Shard &shard = ShardFor(trace_key);
+            std::lock_guard<std::mutex> lock(shard.mutex_);
+            auto inflight_iter = shard.dispatching_inflight_.find(trace_key);
+            if (inflight_iter != shard.dispatching_inflight_.end() &&
                 inflight_iter->second.session_epoch == session_epoch)
             {
-                dispatching_inflight_.erase(inflight_iter);
+                shard.dispatching_inflight_.erase(inflight_iter);
             }
-            RestoreSessionLocked(std::move(session), span_count);
+            RestoreSessionLocked(shard, std::move(session), span_count);
             return;
         }
         // 只有 AppendPrimary 成功后，才能把 primary_enqueued 置 true。
@@ -1306,210 +2357,49 @@ void TraceSessionManager::ProcessDispatchJob(DispatchJob job)
         session->primary_enqueued = true;
     }
 
-    auto session_holder = std::make_shared<std::unique_ptr<TraceSession>>(std::move(session));
-    TraceSessionManager *manager = this;
-    BufferedTraceRepository *buffered_trace_repo = buffered_trace_repo_;
-    TraceAiProvider *trace_ai = trace_ai_;
-    TraceAiProvider *fallback_trace_ai = fallback_trace_ai_;
-    INotifier *notifier = notifier_;
-    ServiceRuntimeAccumulator* service_runtime_accumulator = service_runtime_accumulator_;
-    SystemRuntimeAccumulator* system_runtime_accumulator = system_runtime_accumulator_;
-    const std::string *worker_trace_payload = trace_payload_ptr;
-    const TraceRepository::TraceSummary *worker_summary = summary_ptr;
-    const uint64_t worker_enqueue_ns = NowSteadyNs();
-    if (!thread_pool_->submit([manager, buffered_trace_repo, trace_ai, fallback_trace_ai, notifier, service_runtime_accumulator, system_runtime_accumulator, worker_enqueue_ns, session_holder, worker_trace_payload, worker_summary, analysis_observation_span_records]() mutable
-                              {
-        if (!manager || !session_holder || !(*session_holder) || !worker_trace_payload || !worker_summary) {
-            return;
-        }
-        manager->worker_begin_count_.fetch_add(1, std::memory_order_relaxed);
-        const uint64_t worker_begin_ns = NowSteadyNs();
-        const uint64_t queue_wait_ms =
-            worker_begin_ns >= worker_enqueue_ns ? (worker_begin_ns - worker_enqueue_ns) / 1000000ULL : 0;
-
-        TraceRepository::TraceAnalysisRecord analysis_record;
-        TraceRepository::TraceAnalysisRecord* analysis_ptr = nullptr;
-        size_t alert_token_count = worker_summary->token_count;
-        std::optional<TraceAiUsage> completed_usage;
-        std::string ai_status_override;
-        std::string ai_error_override;
-        const int64_t ai_now_ms = NowSteadyMs();
-        if (!manager->ai_analysis_enabled_) {
-            // 这里是用户主动关闭 AI 的语义，不是失败。
-            // 所以 worker 仍要正常收尾，只把 summary 状态改成 skipped_manual，不能伪造一条失败 analysis。
-            ai_status_override = kAiStatusSkippedManual;
-        } else if (manager->IsAiCircuitOpen(ai_now_ms)) {
-            // 熔断打开时这条 trace 仍然要正常落主数据，只是跳过本次 AI 调用。
-            // 这里不再递增失败次数，因为 skipped_circuit 表达的是“被保护性短路”，不是一次新的 provider 调用失败。
-            ai_status_override = kAiStatusSkippedCircuit;
-        } else if (!trace_ai) {
-            // provider 为空时这条 trace 不可能真的完成分析。
-            // 这里直接记 failed_primary，避免主记录永远卡在 pending。
-            ai_status_override = kAiStatusFailedPrimary;
-            ai_error_override = "Trace AI provider unavailable";
-            manager->RecordAiCircuitFailure(ai_now_ms);
-        } else {
-            if (system_runtime_accumulator) {
-                // 系统监控里的 AI 调用总数要落在“真正准备调模型”的时间点，
-                // 不能在 submit 成功时就提前加，否则排队中断或后续没进入模型都算脏数据。
-                system_runtime_accumulator->RecordAiCallStarted();
-            }
-            manager->ai_calls_.fetch_add(1, std::memory_order_relaxed);
-            const uint64_t ai_begin_ns = NowSteadyNs();
-            uint64_t inference_latency_ms = 0;
-            try {
-                TraceAiResponse ai_response = trace_ai->AnalyzeTrace(*worker_trace_payload);
-                analysis_record = manager->BuildAnalysisRecord(worker_summary->trace_id, ai_response.analysis);
-                analysis_ptr = &analysis_record;
-                // worker_summary 指向的是已经落完 primary 的只读摘要，这里不能回写它本体。
-                // 所以后面发告警时单独走 alert_token_count，避免为了一个展示口径去改数据库主记录。
-                alert_token_count = ResolveAlertTokenCount(*worker_summary, ai_response.usage);
-                completed_usage = ai_response.usage;
-                manager->RecordAiCircuitSuccess();
-            } catch (const std::exception& e) {
-                const std::string primary_error = TruncateTraceAiError(e.what());
-                const bool should_try_fallback =
-                    manager->ai_auto_degrade_enabled_ && fallback_trace_ai != nullptr;
-                if (!should_try_fallback) {
-                    // 这里吃到的 e.what() 现在既可能是本地 HTTP/JSON 协议错误，
-                    // 也可能是 proxy 已经归一好的 provider 失败文本（例如 [429 RESOURCE_EXHAUSTED] quota exhausted）。
-                    // 如果当前没开自动降级，就直接把主路失败写回 ai_error。
-                    ai_status_override = kAiStatusFailedPrimary;
-                    ai_error_override = primary_error;
-                    manager->RecordAiCircuitFailure(NowSteadyMs());
-                } else {
-                    try {
-                        // 自动降级只在主路真正失败后才触发，而且 fallback 仍然复用同一份 trace payload。
-                        // 这样不会把 provider 切换的复杂度扩散到序列化或提示词渲染层。
-                        TraceAiResponse fallback_response = fallback_trace_ai->AnalyzeTrace(*worker_trace_payload);
-                        analysis_record = manager->BuildAnalysisRecord(worker_summary->trace_id, fallback_response.analysis);
-                        analysis_ptr = &analysis_record;
-                        alert_token_count = ResolveAlertTokenCount(*worker_summary, fallback_response.usage);
-                        completed_usage = fallback_response.usage;
-                        manager->RecordAiCircuitSuccess();
-                    } catch (const std::exception& fallback_error) {
-                        ai_status_override = kAiStatusFailedBoth;
-                        ai_error_override = BuildDualAiError(primary_error,
-                                                             TruncateTraceAiError(fallback_error.what()));
-                        manager->RecordAiCircuitFailure(NowSteadyMs());
-                    } catch (...) {
-                        ai_status_override = kAiStatusFailedBoth;
-                        ai_error_override = BuildDualAiError(primary_error,
-                                                             "Unknown non-std exception");
-                        manager->RecordAiCircuitFailure(NowSteadyMs());
-                    }
-                }
-            } catch (...) {
-                const std::string primary_error = "Unknown non-std exception";
-                const bool should_try_fallback =
-                    manager->ai_auto_degrade_enabled_ && fallback_trace_ai != nullptr;
-                if (!should_try_fallback) {
-                    ai_status_override = kAiStatusFailedPrimary;
-                    ai_error_override = primary_error;
-                    manager->RecordAiCircuitFailure(NowSteadyMs());
-                } else {
-                    try {
-                        TraceAiResponse fallback_response = fallback_trace_ai->AnalyzeTrace(*worker_trace_payload);
-                        analysis_record = manager->BuildAnalysisRecord(worker_summary->trace_id, fallback_response.analysis);
-                        analysis_ptr = &analysis_record;
-                        alert_token_count = ResolveAlertTokenCount(*worker_summary, fallback_response.usage);
-                        completed_usage = fallback_response.usage;
-                        manager->RecordAiCircuitSuccess();
-                    } catch (const std::exception& fallback_error) {
-                        ai_status_override = kAiStatusFailedBoth;
-                        ai_error_override = BuildDualAiError(primary_error,
-                                                             TruncateTraceAiError(fallback_error.what()));
-                        manager->RecordAiCircuitFailure(NowSteadyMs());
-                    } catch (...) {
-                        ai_status_override = kAiStatusFailedBoth;
-                        ai_error_override = BuildDualAiError(primary_error,
-                                                             "Unknown non-std exception");
-                        manager->RecordAiCircuitFailure(NowSteadyMs());
-                    }
-                }
-            }
-            const uint64_t ai_end_ns = NowSteadyNs();
-            manager->ai_total_ns_.fetch_add(ai_end_ns - ai_begin_ns, std::memory_order_relaxed);
-            inference_latency_ms = ai_end_ns >= ai_begin_ns ? (ai_end_ns - ai_begin_ns) / 1000000ULL : 0;
-            if (system_runtime_accumulator) {
-                // 这里把排队等待和真实推理耗时作为同一条完成样本写进去。
-                // 前者在 worker 开始时就能算，但只有到 AI 收尾时，这条调用样本才算真正成熟。
-                system_runtime_accumulator->RecordAiCallCompleted(queue_wait_ms, inference_latency_ms, completed_usage);
-            }
-        }
-
-        manager->analysis_enqueue_calls_.fetch_add(1, std::memory_order_relaxed);
-        const uint64_t enqueue_begin_ns = NowSteadyNs();
-        bool saved = true;
-        if (!buffered_trace_repo) {
-            saved = false;
-        } else if (analysis_ptr) {
-            BufferedTraceRepository::TraceAnalysisWrite analysis_write;
-            analysis_write.analysis = *analysis_ptr;
-            saved = buffered_trace_repo->AppendAnalysis(std::move(analysis_write));
-        } else if (!ai_status_override.empty()) {
-            // 没有 analysis 可写时，必须把最终状态直接落回 summary。
-            // 否则查询层只能看到 pending，却分不清是人工关闭、provider 缺失还是调用失败。
-            saved = buffered_trace_repo->UpdateTraceAiState(worker_summary->trace_id,
-                                                            ai_status_override,
-                                                            ai_error_override);
-        }
-        manager->analysis_enqueue_total_ns_.fetch_add(NowSteadyNs() - enqueue_begin_ns, std::memory_order_relaxed);
-        manager->worker_done_count_.fetch_add(1, std::memory_order_relaxed);
-        if (service_runtime_accumulator && analysis_ptr && analysis_observation_span_records)
-        {
-            // AI 回来后只补最近样本，不再回写 overview / 服务统计，避免同一条 trace 重复记账。
-            service_runtime_accumulator->OnAnalysisReady(
-                BuildAnalysisObservation(*worker_summary,
-                                         *analysis_observation_span_records,
-                                         analysis_ptr->summary,
-                                         analysis_ptr->risk_level));
-        }
-        if (!saved || !notifier || !analysis_ptr) {
-            return;
-        }
-
-        const std::string risk_level = toLowerCopy(analysis_ptr->risk_level);
-        if (risk_level != "critical") {
-            return;
-        }
-
-        TraceAlertEvent event;
-        event.trace_id = worker_summary->trace_id;
-        event.service_name = worker_summary->service_name;
-        event.start_time_ms = worker_summary->start_time_ms;
-        event.duration_ms = worker_summary->duration_ms;
-        event.span_count = worker_summary->span_count;
-        event.token_count = alert_token_count;
-        event.risk_level = analysis_ptr->risk_level;
-        event.summary = analysis_ptr->summary;
-        event.root_cause = analysis_ptr->root_cause;
-        event.solution = analysis_ptr->solution;
-        event.confidence = analysis_ptr->confidence;
-        notifier->notifyTraceAlert(event); }))
+    // 任务体积一旦超过内联缓冲，每条 trace 的派发就会多一次堆分配；这里在编译期卡住，加字段时要同步评估。
+    static_assert(sizeof(DispatchWorkerTask) <= ThreadPool::kTaskInlineSize,
+                  "DispatchWorkerTask must fit into ThreadPool::Task inline storage");
+    DispatchWorkerTask worker;
+    worker.manager = this;
+    worker.buffered_trace_repo = buffered_trace_repo_;
+    worker.trace_ai = trace_ai_;
+    worker.fallback_trace_ai = fallback_trace_ai_;
+    worker.notifier = notifier_;
+    worker.service_runtime_accumulator = service_runtime_accumulator_;
+    worker.system_runtime_accumulator = system_runtime_accumulator_;
+    worker.worker_enqueue_ns = NowSteadyNs();
+    worker.session = std::move(session);
+    worker.worker_trace_payload = trace_payload_ptr;
+    worker.worker_summary = summary_ptr;
+    worker.analysis_observation_span_records = std::move(analysis_observation_span_records);
+    ThreadPool::Task task(std::move(worker));
+    if (!thread_pool_->submit(std::move(task)))
     {
         submit_fail_count_.fetch_add(1, std::memory_order_relaxed);
-        std::unique_ptr<TraceSession> restored_session = std::move(*session_holder);
-        std::lock_guard<std::mutex> lock(mutex_);
-        auto inflight_iter = dispatching_inflight_.find(trace_key);
-        if (inflight_iter != dispatching_inflight_.end() &&
+        std::unique_ptr<TraceSession> restored_session = std::move(task.target<DispatchWorkerTask>()->session);
+        Shard &shard = ShardFor(trace_key);
+        std::lock_guard<std::mutex> lock(shard.mutex_);
+        auto inflight_iter = shard.dispatching_inflight_.find(trace_key);
+        if (inflight_iter != shard.dispatching_inflight_.end() &&
             inflight_iter->second.session_epoch == session_epoch)
         {
-            dispatching_inflight_.erase(inflight_iter);
+            shard.dispatching_inflight_.erase(inflight_iter);
         }
-        RestoreSessionLocked(std::move(restored_session), span_count);
+        RestoreSessionLocked(shard, std::move(restored_session), span_count);
         return;
     }
 
     {
-        std::lock_guard<std::mutex> lock(mutex_);
-        auto inflight_iter = dispatching_inflight_.find(trace_key);
-        if (inflight_iter != dispatching_inflight_.end() &&
+        Shard &shard = ShardFor(trace_key);
+        std::lock_guard<std::mutex> lock(shard.mutex_);
+        auto inflight_iter = shard.dispatching_inflight_.find(trace_key);
+        if (inflight_iter != shard.dispatching_inflight_.end() &&
             inflight_iter->second.session_epoch == session_epoch)
         {
-            dispatching_inflight_.erase(inflight_iter);
+            shard.dispatching_inflight_.erase(inflight_iter);
         }
-        AddCompletedTombstoneLocked(trace_key);
+        AddCompletedTombstoneLocked(shard, trace_key);
     }
     if (service_runtime_accumulator_ && primary_observation.has_value())
     {
@@ -1520,55 +2410,139 @@ void TraceSessionManager::ProcessDispatchJob(DispatchJob job)
     submit_ok_count_.fetch_add(1, std::memory_order_relaxed);
 }
 
-void TraceSessionManager::RefreshOverloadState()
+size_t TraceSessionManager::EstimateSpanBytes(const SpanEvent &span)
 {
-    const size_t pending_tasks = thread_pool_ ? thread_pool_->pendingTasks() : 0;
-
-    const bool hit_critical =
-        total_buffered_spans_ >= buffered_span_watermark_.critical ||
-        active_sessions_ >= active_session_watermark_.critical ||
-        pending_tasks >= pending_task_watermark_.critical;
-    const bool hit_high =
-        total_buffered_spans_ >= buffered_span_watermark_.high ||
-        active_sessions_ >= active_session_watermark_.high ||
-        pending_tasks >= pending_task_watermark_.high;
-    const bool back_to_low =
-        total_buffered_spans_ <= buffered_span_watermark_.low &&
-        active_sessions_ <= active_session_watermark_.low &&
-        pending_tasks <= pending_task_watermark_.low;
-
-    if (hit_critical)
+    // unordered_map 每个条目至少是一个堆上哈希节点：next 指针 + 缓存的哈希值 + pair 本身，
+    // 再加上桶数组里摊到的一个指针。字符串超出 SSO 的部分另算。
+    constexpr size_t kAttributeEntryOverhead =
+        sizeof(std::pair<const std::string, std::string>) + 3 * sizeof(void *);
+    size_t bytes = sizeof(SpanEvent) + span.name.size() + span.service_name.size();
+    for (const auto &[key, value] : span.attributes)
     {
-        overload_state_ = OverloadState::Critical;
+        bytes += kAttributeEntryOverhead + key.size() + value.size();
     }
-    else if (overload_state_ == OverloadState::Normal)
+    return bytes;
+}
+
+void TraceSessionManager::FinishSampledOutTrace(std::unique_ptr<TraceSession> session)
+{
+    const size_t trace_key = session->trace_key;
+    const uint64_t session_epoch = session->session_epoch;
+    if (service_runtime_accumulator_)
     {
-        overload_state_ = hit_high ? OverloadState::Overload : OverloadState::Normal;
+        // 服务监控的窗口统计必须覆盖全部 trace，不能因为采样丢了主数据就少记。
+        // 这里不需要 DFS 顺序，按到达顺序平铺 span 就能得到和保留路径一样的 observation。
+        std::vector<const SpanEvent *> arrival_order;
+        arrival_order.reserve(session->spans.size());
+        for (const SpanEvent &span : session->spans)
+        {
+            arrival_order.push_back(&span);
+        }
+        const TraceRepository::TraceSummary summary = BuildTraceSummary(*session, {});
+        service_runtime_accumulator_->OnPrimaryCommitted(
+            BuildPrimaryObservation(summary, BuildSpanRecords(arrival_order)));
     }
-    else if (back_to_low)
     {
-        overload_state_ = OverloadState::Normal;
+        // 和正常分发成功一样收口：清掉 inflight，写 tombstone，让晚到 span 被幂等吸收而不是复活成新 trace。
+        Shard &shard = ShardFor(trace_key);
+        std::lock_guard<std::mutex> lock(shard.mutex_);
+        auto inflight_iter = shard.dispatching_inflight_.find(trace_key);
+        if (inflight_iter != shard.dispatching_inflight_.end() &&
+            inflight_iter->second.session_epoch == session_epoch)
+        {
+            shard.dispatching_inflight_.erase(inflight_iter);
+        }
+        AddCompletedTombstoneLocked(shard, trace_key);
     }
-    else
+    if (ingest_wal_ && session->wal_pinned)
     {
-        overload_state_ = OverloadState::Overload;
+        // 被采样丢弃的 trace 永远不会走到 SavePrimaryBatch，只能在这里解钉，否则它所在的 WAL 段永远删不掉。
+        ingest_wal_->ReleaseTrace(trace_key);
     }
+    RecycleSession(std::move(session));
+}
+
+void TraceSessionManager::ReleaseSessionCounters(size_t span_count, size_t byte_count)
+{
+    // 分片后这两个全局计数由各 shard 并发增减。
+    // 每个 shard 只会扣掉自己之前加上去的量（session 数 1、span 数等于该 session 的 spans.size()），
+    // 所以直接 fetch_sub 不会下溢，也不需要再做“先判断再减”的非原子防御。
+    active_sessions_.fetch_sub(1, std::memory_order_relaxed);
+    total_buffered_spans_.fetch_sub(span_count, std::memory_order_relaxed);
+    total_buffered_bytes_.fetch_sub(byte_count, std::memory_order_relaxed);
+}
+
+void TraceSessionManager::RefreshOverloadState()
+{
+    const size_t pending_tasks = thread_pool_ ? thread_pool_->pendingTasks() : 0;
+    const size_t buffered_spans = total_buffered_spans_.load(std::memory_order_relaxed);
+    const size_t buffered_bytes = total_buffered_bytes_.load(std::memory_order_relaxed);
+    const size_t active_sessions = active_sessions_.load(std::memory_order_relaxed);
+    // 下游不设上限时按 0 处理：low 至少是 1，这条水位永远不会越线，也不会挡住回落。
+    const size_t pending_flush_bytes =
+        pending_flush_hard_limit_ > 0 ? buffered_trace_repo_->PendingFlushBytes() : 0;
+
+    // span 条数和字节数两条水位并列：任一条越线都算过载，两条都回落到 low 才解除。
+    // 持久化滞后同理：SQLite 卡住时聚合态可能很空，但待刷字节在涨，入口一样要开始拒。
+    const bool hit_critical =
+        buffered_spans >= buffered_span_watermark_.critical ||
+        buffered_bytes >= buffered_bytes_watermark_.critical ||
+        active_sessions >= active_session_watermark_.critical ||
+        pending_tasks >= pending_task_watermark_.critical ||
+        pending_flush_bytes >= pending_flush_watermark_.critical;
+    const bool hit_high =
+        buffered_spans >= buffered_span_watermark_.high ||
+        buffered_bytes >= buffered_bytes_watermark_.high ||
+        active_sessions >= active_session_watermark_.high ||
+        pending_tasks >= pending_task_watermark_.high ||
+        pending_flush_bytes >= pending_flush_watermark_.high;
+    const bool back_to_low =
+        buffered_spans <= buffered_span_watermark_.low &&
+        buffered_bytes <= buffered_bytes_watermark_.low &&
+        active_sessions <= active_session_watermark_.low &&
+        pending_tasks <= pending_task_watermark_.low &&
+        pending_flush_bytes <= pending_flush_watermark_.low;
+
+    // 分片后多个 shard 会各自在自己的锁里刷新水位，这里不能再依赖一把全局锁串行化回滞判断。
+    // 用 CAS 推进：基于读到的旧状态算出新状态，期间若被别的 shard 改过就按新旧状态重算一次。
+    OverloadState current = overload_state_.load(std::memory_order_relaxed);
+    OverloadState next = current;
+    do
+    {
+        if (hit_critical)
+        {
+            next = OverloadState::Critical;
+        }
+        else if (current == OverloadState::Normal)
+        {
+            next = hit_high ? OverloadState::Overload : OverloadState::Normal;
+        }
+        else if (back_to_low)
+        {
+            next = OverloadState::Normal;
+        }
+        else
+        {
+            next = OverloadState::Overload;
+        }
+    } while (!overload_state_.compare_exchange_weak(current, next, std::memory_order_relaxed));
 
     if (system_runtime_accumulator_)
     {
         // 系统监控只展示“综合背压结论”，不直接暴露 manager 内部的高水位实现细节。
         // 所以这里统一把内部 overload_state 映射成前端更容易解释的 Normal/Active/Full 三档。
-        system_runtime_accumulator_->UpdateBackpressureStatus(ToSystemBackpressureStatus(overload_state_));
+        system_runtime_accumulator_->UpdateBackpressureStatus(ToSystemBackpressureStatus(next));
     }
 }
 
 bool TraceSessionManager::ShouldRejectIncomingTrace(bool trace_exists) const
 {
-    if (overload_state_ == OverloadState::Normal)
+    const OverloadState state = overload_state_.load(std::memory_order_relaxed);
+    if (state == OverloadState::Normal)
     {
         return false;
     }
-    if (overload_state_ == OverloadState::Critical)
+    if (state == OverloadState::Critical)
     {
         return true;
     }
@@ -1577,195 +2551,331 @@ bool TraceSessionManager::ShouldRejectIncomingTrace(bool trace_exists) const
 
 TraceSessionManager::TraceIndex TraceSessionManager::BuildTraceIndex(const TraceSession &session)
 {
+    // 整个构建只有固定几次数组分配，和 span 数无关：排序去重得到 nodes，再用计数排序把子节点按父节点分段，
+    // 最后每段内部按 start_time/span_id 排序。总复杂度 O(n log n)。
     TraceIndex index;
-    index.span_map.reserve(session.spans.size());
-
+    const size_t span_count = session.spans.size();
+    index.nodes.reserve(span_count);
     for (const auto &span : session.spans)
     {
-        index.span_map[span.span_id] = &span;
+        index.nodes.push_back(&span);
     }
+    // span 都在同一个 vector 里，地址顺序就是到达顺序；拿地址做第二排序键，等价于稳定排序但不需要额外缓冲区。
+    std::sort(index.nodes.begin(), index.nodes.end(), [](const SpanEvent *left, const SpanEvent *right)
+              {
+        if (left->span_id != right->span_id) {
+            return left->span_id < right->span_id;
+        }
+        return std::less<const SpanEvent *>()(left, right); });
+    // 同一个 span_id 只留最后到达的那份。
+    size_t unique_count = 0;
+    for (size_t i = 0; i < index.nodes.size(); ++i)
+    {
+        if (i + 1 < index.nodes.size() && index.nodes[i + 1]->span_id == index.nodes[i]->span_id)
+        {
+            continue;
+        }
+        index.nodes[unique_count++] = index.nodes[i];
+    }
+    index.nodes.resize(unique_count);
 
-    for (const auto &span : session.spans)
+    // 第一遍：按到达顺序给每个 span 找到自身节点和父节点，找不到父节点或没有 parent_id 时视为 root；
+    // 同时统计每个父节点的子节点个数，child_offsets[p + 1] 先当计数用。
+    std::vector<uint32_t> parent_of(span_count, 0);
+    std::vector<uint32_t> node_of(span_count, 0);
+    index.child_offsets.assign(unique_count + 1, 0);
+    for (size_t i = 0; i < span_count; ++i)
     {
-        if (span.parent_span_id.has_value())
+        const SpanEvent &span = session.spans[i];
+        node_of[i] = static_cast<uint32_t>(index.Find(span.span_id));
+        const size_t parent = span.parent_span_id.has_value() ? index.Find(span.parent_span_id.value()) : TraceIndex::npos;
+        if (parent == TraceIndex::npos)
         {
-            const size_t parent_id = span.parent_span_id.value();
-            if (index.span_map.find(parent_id) != index.span_map.end())
-            {
-                index.children[parent_id].push_back(span.span_id);
-                continue;
-            }
+            parent_of[i] = static_cast<uint32_t>(unique_count);
+            index.roots.push_back(node_of[i]);
+            continue;
+        }
+        parent_of[i] = static_cast<uint32_t>(parent);
+        ++index.child_offsets[parent + 1];
+    }
+    for (size_t i = 0; i < unique_count; ++i)
+    {
+        index.child_offsets[i + 1] += index.child_offsets[i];
+    }
+
+    // 第二遍：按计数排序的位置把子节点填进对应分段。
+    index.children.resize(index.child_offsets[unique_count]);
+    std::vector<uint32_t> cursor(index.child_offsets.begin(), index.child_offsets.end() - 1);
+    for (size_t i = 0; i < span_count; ++i)
+    {
+        if (parent_of[i] == unique_count)
+        {
+            continue;
+        }
+        index.children[cursor[parent_of[i]]++] = node_of[i];
+    }
+    const auto by_start_time = [&index](uint32_t left, uint32_t right)
+    {
+        const SpanEvent &left_span = *index.nodes[left];
+        const SpanEvent &right_span = *index.nodes[right];
+        if (left_span.start_time_ms != right_span.start_time_ms)
+        {
+            return left_span.start_time_ms < right_span.start_time_ms;
+        }
+        return left_span.span_id < right_span.span_id;
+    };
+    for (size_t i = 0; i < unique_count; ++i)
+    {
+        const auto begin = index.children.begin() + index.child_offsets[i];
+        const auto end = index.children.begin() + index.child_offsets[i + 1];
+        if (end - begin > 1)
+        {
+            std::sort(begin, end, by_start_time);
         }
-        // 找不到父节点或没有 parent_id 时，视为 root。
-        index.roots.push_back(span.span_id);
     }
 
     return index;
 }
 
-std::string TraceSessionManager::SerializeTrace(const TraceIndex &index, std::vector<const SpanEvent *> *order)
+size_t TraceSessionManager::TraceIndex::Find(size_t span_id) const
 {
-    nlohmann::json output;
-    std::unordered_set<size_t> visited;
-    visited.reserve(index.span_map.size());
-    bool has_cycle = false;
-    std::vector<size_t> cycle_spans;
+    const auto iter = std::lower_bound(nodes.begin(), nodes.end(), span_id, [](const SpanEvent *span, size_t id)
+                                       { return span->span_id < id; });
+    if (iter == nodes.end() || (*iter)->span_id != span_id)
+    {
+        return npos;
+    }
+    return static_cast<size_t>(iter - nodes.begin());
+}
+
+uint64_t TraceSessionManager::ComputeTraceFingerprint(const TraceIndex &index) const
+{
+    std::vector<char> visited(index.nodes.size(), 0);
 
-    auto build_node = [&index, order, &visited, &has_cycle, &cycle_spans](size_t span_id, const auto &self_ref) -> nlohmann::json
+    // 自底向上算：节点哈希 = 自身属性 + 排好序的子节点哈希。
+    // 子节点先排序再合并，所以同一棵树不管 span 以什么顺序到达、兄弟之间谁先开始，指纹都一样。
+    auto hash_node = [&index, &visited](uint32_t node, const auto &self_ref) -> uint64_t
     {
-        nlohmann::json node;
-        if (!visited.insert(span_id).second)
+        if (visited[node])
         {
-            // 发现环时仅记录异常，避免继续递归导致无限循环。
-            has_cycle = true;
-            cycle_spans.push_back(span_id);
-            return node;
+            // 环只在脏数据里出现；给一个固定标记值参与合并即可，不再往下递归。
+            return 0x6379636c65ULL;
+        }
+        visited[node] = 1;
+        const SpanEvent &span = *index.nodes[node];
+        uint64_t hash = HashFingerprintString(span.service_name);
+        hash = MixFingerprint(hash, HashFingerprintString(span.name));
+        hash = MixFingerprint(hash, span.kind.has_value() ? 1 + static_cast<uint64_t>(span.kind.value()) : 0);
+        hash = MixFingerprint(hash, span.status.has_value() ? 1 + static_cast<uint64_t>(span.status.value()) : 0);
+        hash = MixFingerprint(hash, FingerprintDurationBucket(span));
+
+        const uint32_t child_begin = index.child_offsets[node];
+        const uint32_t child_end = index.child_offsets[node + 1];
+        std::vector<uint64_t> child_hashes;
+        child_hashes.reserve(child_end - child_begin);
+        for (uint32_t i = child_begin; i < child_end; ++i)
+        {
+            child_hashes.push_back(self_ref(index.children[i], self_ref));
         }
-        auto span_iter = index.span_map.find(span_id);
-        if (span_iter == index.span_map.end())
+        std::sort(child_hashes.begin(), child_hashes.end());
+        // 子节点个数也并进去，避免“一个子节点”和“哈希恰好能拼出同值的多个子节点”混淆。
+        hash = MixFingerprint(hash, child_hashes.size());
+        for (uint64_t child_hash : child_hashes)
         {
-            return node;
+            hash = MixFingerprint(hash, child_hash);
         }
-        const SpanEvent &span = *span_iter->second;
-        if (order)
+        return hash;
+    };
+
+    std::vector<uint64_t> root_hashes;
+    root_hashes.reserve(index.roots.size());
+    for (uint32_t root : index.roots)
+    {
+        root_hashes.push_back(hash_node(root, hash_node));
+    }
+    std::sort(root_hashes.begin(), root_hashes.end());
+    uint64_t fingerprint = MixFingerprint(0, root_hashes.size());
+    for (uint64_t root_hash : root_hashes)
+    {
+        fingerprint = MixFingerprint(fingerprint, root_hash);
+    }
+    return fingerprint;
+}
+
+std::string TraceSessionManager::SerializeTrace(const TraceIndex &index, std::vector<const SpanEvent *> *order)
+{
+    // 这里不再先搭一棵 nlohmann DOM 再 dump：大 trace 下每个 span 都要分配一个 object、一个 children array
+    // 和一份 attributes 拷贝，dispatch 线程上全是小块堆分配。现在改成一次迭代 DFS 直接往预留好的 string 里写。
+    // 输出必须和原来 DOM dump 的结果逐字节一致（AI 缓存、提示词和测试都依赖它），所以下面几条约束不能动：
+    // 1) nlohmann 的 object 按 key 字典序输出，所以每个 span 的字段按字典序写，attributes 也要先排序；
+    // 2) 命中环/缺失的子节点直接跳过，不写空对象；
+    // 3) 有环时 anomalies 在 spans 前面（同样是字典序），只能等 DFS 结束后再补到开头。
+    size_t reserve_bytes = 16;
+    for (const SpanEvent *node : index.nodes)
+    {
+        const SpanEvent &span = *node;
+        reserve_bytes += kSerializedSpanFixedBytes + span.name.size() + span.service_name.size();
+        for (const auto &attribute : span.attributes)
         {
-            order->push_back(&span);
+            reserve_bytes += attribute.first.size() + attribute.second.size() + 6;
         }
+    }
+    std::string output;
+    output.reserve(reserve_bytes);
+    if (order)
+    {
+        order->reserve(order->size() + index.nodes.size());
+    }
 
-        node["trace_id"] = span.trace_key;
-        node["span_id"] = span.span_id;
-        if (span.parent_span_id.has_value())
+    std::vector<char> visited(index.nodes.size(), 0);
+    std::vector<size_t> cycle_spans;
+
+    // 进入节点时做和原递归版本完全相同的判定：重复访问记一次环。
+    // 返回 nullptr 表示这个节点不输出，调用方据此决定要不要补逗号。
+    auto enter_node = [&index, &visited, &cycle_spans](uint32_t node) -> const SpanEvent *
+    {
+        if (visited[node])
         {
-            node["parent_id"] = span.parent_span_id.value();
+            // 发现环时仅记录异常，避免继续递归导致无限循环。
+            cycle_spans.push_back(index.nodes[node]->span_id);
+            return nullptr;
         }
-        else
+        visited[node] = 1;
+        return index.nodes[node];
+    };
+
+    // 显式栈代替递归：每一帧是一个已经写完自身字段、正在逐个输出子节点的 span。
+    // 子节点在索引里已经按 start_time/span_id 排好，帧里只记还没走完的那段区间。
+    struct Frame
+    {
+        const SpanEvent *span = nullptr;
+        uint32_t next_child = 0;
+        uint32_t child_end = 0;
+        bool wrote_child = false;
+    };
+    std::vector<Frame> stack;
+    SortedAttributes sorted_attributes;
+
+    auto open_node = [&](uint32_t node, const SpanEvent &span)
+    {
+        if (order)
         {
-            node["parent_id"] = nullptr;
+            order->push_back(&span);
         }
-        node["name"] = span.name;
-        node["service_name"] = span.service_name;
-        node["start_time_ms"] = span.start_time_ms;
+        output += "{\"attributes\":";
+        AppendJsonAttributes(&output, span.attributes, &sorted_attributes);
+        output += ",\"children\":[";
+
+        // children 之后的字段要等子树写完才能输出，所以这里只把子节点区间压栈，
+        // 尾部字段在 close_node 里补。
+        Frame frame;
+        frame.span = &span;
+        frame.next_child = index.child_offsets[node];
+        frame.child_end = index.child_offsets[node + 1];
+        stack.push_back(frame);
+    };
+
+    auto close_node = [&output](const SpanEvent &span)
+    {
+        output += "],\"end_time_ms\":";
         if (span.end_time.has_value())
         {
-            node["end_time_ms"] = span.end_time.value();
+            AppendJsonInteger(&output, span.end_time.value());
         }
         else
         {
-            node["end_time_ms"] = nullptr;
+            output += "null";
         }
-
-        if (span.status.has_value())
+        output += ",\"kind\":";
+        output += SpanKindJson(span.kind);
+        output += ",\"name\":";
+        AppendJsonString(&output, span.name);
+        output += ",\"parent_id\":";
+        if (span.parent_span_id.has_value())
         {
-            switch (span.status.value())
-            {
-            case SpanEvent::Status::Unset:
-                node["status"] = "UNSET";
-                break;
-            case SpanEvent::Status::Ok:
-                node["status"] = "OK";
-                break;
-            case SpanEvent::Status::Error:
-                node["status"] = "ERROR";
-                break;
-            }
+            AppendJsonInteger(&output, span.parent_span_id.value());
         }
         else
         {
-            node["status"] = nullptr;
-        }
+            output += "null";
+        }
+        output += ",\"service_name\":";
+        AppendJsonString(&output, span.service_name);
+        output += ",\"span_id\":";
+        AppendJsonInteger(&output, span.span_id);
+        output += ",\"start_time_ms\":";
+        AppendJsonInteger(&output, span.start_time_ms);
+        output += ",\"status\":";
+        output += SpanStatusJson(span.status);
+        output += ",\"trace_id\":";
+        AppendJsonInteger(&output, span.trace_key);
+        output += '}';
+    };
 
-        if (span.kind.has_value())
-        {
-            switch (span.kind.value())
-            {
-            case SpanEvent::Kind::Internal:
-                node["kind"] = "INTERNAL";
-                break;
-            case SpanEvent::Kind::Server:
-                node["kind"] = "SERVER";
-                break;
-            case SpanEvent::Kind::Client:
-                node["kind"] = "CLIENT";
-                break;
-            case SpanEvent::Kind::Producer:
-                node["kind"] = "PRODUCER";
-                break;
-            case SpanEvent::Kind::Consumer:
-                node["kind"] = "CONSUMER";
-                break;
-            }
-        }
-        else
+    output += "{\"spans\":[";
+    bool wrote_root = false;
+    for (uint32_t root_node : index.roots)
+    {
+        const SpanEvent *root = enter_node(root_node);
+        if (!root)
         {
-            node["kind"] = nullptr;
+            continue;
         }
-
-        node["attributes"] = span.attributes;
-
-        auto child_iter = index.children.find(span_id);
-        const std::vector<size_t> *children_ids = nullptr;
-        if (child_iter != index.children.end())
+        if (wrote_root)
         {
-            children_ids = &child_iter->second;
+            output += ',';
         }
-
-        node["children"] = nlohmann::json::array();
-        if (children_ids)
+        wrote_root = true;
+        open_node(root_node, *root);
+        while (!stack.empty())
         {
-            std::vector<size_t> ordered_children = *children_ids;
-            std::sort(ordered_children.begin(), ordered_children.end(), [&index](size_t left, size_t right)
-                      {
-                const auto left_iter = index.span_map.find(left);
-                const auto right_iter = index.span_map.find(right);
-                if (left_iter == index.span_map.end() || right_iter == index.span_map.end()) {
-                    return left < right;
-                }
-                const SpanEvent& left_span = *left_iter->second;
-                const SpanEvent& right_span = *right_iter->second;
-                if (left_span.start_time_ms != right_span.start_time_ms) {
-                    return left_span.start_time_ms < right_span.start_time_ms;
-                }
-                return left_span.span_id < right_span.span_id; });
-            for (size_t child_id : ordered_children)
+            Frame &frame = stack.back();
+            if (frame.next_child >= frame.child_end)
             {
-                nlohmann::json child_node = self_ref(child_id, self_ref);
-                if (!child_node.is_null() && !child_node.empty())
-                {
-                    node["children"].push_back(std::move(child_node));
-                }
+                close_node(*frame.span);
+                stack.pop_back();
+                continue;
             }
-        }
-
-        return node;
-    };
-
-    output["spans"] = nlohmann::json::array();
-    for (size_t root_id : index.roots)
-    {
-        nlohmann::json root_node = build_node(root_id, build_node);
-        if (!root_node.is_null() && !root_node.empty())
-        {
-            output["spans"].push_back(std::move(root_node));
+            const uint32_t child_node = index.children[frame.next_child++];
+            const SpanEvent *child = enter_node(child_node);
+            if (!child)
+            {
+                continue;
+            }
+            if (frame.wrote_child)
+            {
+                output += ',';
+            }
+            frame.wrote_child = true;
+            // open_node 会往 stack 里压新帧，frame 引用可能因扩容失效，所以上面先把这一帧的状态改完。
+            open_node(child_node, *child);
         }
     }
-    if (has_cycle)
+    output += "]}";
+
+    if (!cycle_spans.empty())
     {
         // 记录位置（第一处）：
-        // 1) 异常会写入当前序列化结果 output["anomalies"]，并随 trace_payload 继续流转。
+        // 1) 异常会写入当前序列化结果的 anomalies，并随 trace_payload 继续流转。
         // 2) 当前实现不单独持久化 anomalies 表，因此排障时应优先看 AI 输入/日志中的 payload 内容。
         // 因为有环所以没有root所以就是dfs根本不会跑，导致order为空，ai无法具有分析性
-        nlohmann::json anomalies = nlohmann::json::array();
-        for (size_t span_id : cycle_spans)
+        std::string anomalies = "\"anomalies\":[";
+        for (size_t i = 0; i < cycle_spans.size(); ++i)
         {
-            nlohmann::json item;
-            item["type"] = "cycle_detected";
-            item["span_id"] = span_id;
-            anomalies.push_back(std::move(item));
+            if (i > 0)
+            {
+                anomalies += ',';
+            }
+            anomalies += "{\"span_id\":";
+            AppendJsonInteger(&anomalies, cycle_spans[i]);
+            anomalies += ",\"type\":\"cycle_detected\"}";
         }
-        output["anomalies"] = std::move(anomalies);
+        anomalies += "],";
+        // 有环是脏数据场景，这里多一次整体搬移可以接受，换来正常路径不用先缓存整段 spans。
+        output.insert(1, anomalies);
     }
 
-    return output.dump();
+    return output;
 }
 
 TraceRepository::TraceSummary TraceSessionManager::BuildTraceSummary(const TraceSession &session,
@@ -1796,6 +2906,7 @@ TraceRepository::TraceSummary TraceSessionManager::BuildTraceSummary(const Trace
     summary.span_count = session.spans.size();
     summary.token_count = session.token_count;
     summary.risk_level = "unknown";
+    summary.replayed = session.replayed;
 
     return summary;
 }
@@ -1805,6 +2916,7 @@ std::vector<TraceRepository::TraceSpanRecord> TraceSessionManager::BuildSpanReco
 {
     std::vector<TraceRepository::TraceSpanRecord> span_records;
     span_records.reserve(order.size());
+    SortedAttributes sorted_attributes;
 
     for (const SpanEvent *span_ptr : order)
     {
@@ -1844,13 +2956,24 @@ std::vector<TraceRepository::TraceSpanRecord> TraceSessionManager::BuildSpanReco
             }
         }
 
-        record.attributes_json = nlohmann::json(span.attributes).dump();
+        // 和 SerializeTrace 共用同一套流式写法，不再为每个 span 临时搭一个 json object。
+        AppendJsonAttributes(&record.attributes_json, span.attributes, &sorted_attributes);
         span_records.push_back(std::move(record));
     }
 
     return span_records;
 }
 
+bool TraceSessionManager::ReplayedTraceAlreadyAnalyzed(const TraceRepository::TraceSummary &summary)
+{
+    if (!summary.replayed || !buffered_trace_repo_ || !buffered_trace_repo_->HasStoredAnalysis(summary.trace_id))
+    {
+        return false;
+    }
+    replayed_analysis_skipped_.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
 TraceRepository::TraceAnalysisRecord TraceSessionManager::BuildAnalysisRecord(const std::string &trace_id,
                                                                               const LogAnalysisResult &analysis)
 {
@@ -4,6 +4,7 @@
 #include <cstddef>
 #include <cstdint>
 #include <condition_variable>
+#include <exception>
 #include <memory>
 #include <mutex>
 #include <optional>
@@ -14,6 +15,8 @@
 #include <unordered_set>
 #include <vector>
 
+#include "core/HierarchicalTimingWheel.h"
+#include "core/TraceSampler.h"
 #include "core/TokenEstimator.h"
 #include "ai/AiTypes.h"
 #include "persistence/TraceRepository.h"
@@ -24,6 +27,9 @@ class TraceAiProvider;
 class INotifier;
 class ServiceRuntimeAccumulator;
 class SystemRuntimeAccumulator;
+class TraceAiResultCache;
+class TraceSessionPool;
+class TraceIngestWal;
 
 struct SpanEvent
 {
@@ -62,6 +68,8 @@ struct SpanEvent
     std::optional<bool> trace_end;
     // 扩展字段先用字符串承载，保持解析与落库路径简单，后续可升级为 variant。
     std::unordered_map<std::string, std::string> attributes;
+    // replayed 只由 TraceIngestWal::ReplayRecovered 置位，表示这个 span 是启动时从 WAL 旧段里读回来的，不走网络解析。
+    bool replayed = false;
 };
 
 struct TraceSession
@@ -90,6 +98,15 @@ struct TraceSession
 
     // capacity 作为每条 Trace 的最大 span 容量，用于触发提前分发。
     explicit TraceSession(size_t capacity);
+    // 追加一个 span：有空闲槽位时先把 span 拷进槽位（复用槽位里 string/attributes 已有的堆内存），再整体挪进 spans。
+    void AppendSpan(const SpanEvent& span);
+    // 给 TraceSessionPool 回收用：除 capacity 外所有字段回到默认值；spans 里的 SpanEvent 挪进槽位留给下一条 trace，
+    // spans/span_ids 自身的容量也保留。单个槽位攥着的堆内存超过 max_slot_bytes 时不留，直接还给分配器。
+    void Reset(size_t max_slot_bytes);
+    // 回收后这个 session 还攥着的估算内存：槽位里的字符串/attribute 节点，加上 spans/span_slab/span_ids 的数组。
+    size_t PooledBytes() const;
+    // 一个槽位除 SpanEvent 本体外攥着的堆内存，字符串按 capacity 算。
+    static size_t EstimateSlotBytes(const SpanEvent& span);
     // 先用 size_t 作为 trace_id 的紧凑标识，减少基础结构的负担，后续再视需求调整为原始 ID。
     size_t trace_key = 0;
     size_t capacity = 0;
@@ -97,18 +114,27 @@ struct TraceSession
     // size_t token_limit = 0;
     // token_count 作为累计 token 计数占位，后续由 TokenEstimator 驱动更新。
     size_t token_count = 0;
+    // buffered_bytes 是已收下 span 的估算内存占用（EstimateSpanBytes 之和），
+    // session 离开 shard 时按这个值原样从全局字节计数里扣掉，保证加减对称。
+    size_t buffered_bytes = 0;
     // spans 采用到达顺序存储，便于后续批量遍历与一次性序列化。
     std::vector<SpanEvent> spans;
     // span_ids 用于去重与快速检测异常输入，避免重复 span 破坏聚合逻辑。
     std::unordered_set<size_t> span_ids;
+    // span_slab 存放上一条 trace 用过的 SpanEvent 槽位，只在 session 被池子回收过之后才非空。
+    std::vector<SpanEvent> span_slab;
+    // span_slab 里各槽位堆内存的估算之和（按 string 容量算，不是按内容长度），由 Reset 算好；AppendSpan 取槽位时不更新。
+    size_t slab_bytes = 0;
     // duplicate_span_id 记录首个重复 span_id，便于后续告警或异常处理。
     std::optional<size_t> duplicate_span_id;
     // 时间戳用于“超时分发”判定：trace 长时间未补齐时也能被强制刷盘。
     int64_t created_at_ms = 0;
     int64_t last_update_ms = 0;
-    // timer_version 用于时间轮懒删除：每次“续命重排”就递增，旧槽节点会自然失效。
-    uint64_t timer_version = 0;
-    // session_epoch 用于防止 trace_key 复用误命中旧节点。
+    // timer_node 是 session 在 shard 时间轮上的侵入式节点：每次“续命重排”都是原地摘下再挂新槽，
+    // 时间轮里任何时刻最多只有这一份计划，不再留下等 sweep 丢弃的旧节点。
+    // session 离开 shard（分发/摘出）时必须先从时间轮上摘掉，否则槽里会留下悬空指针。
+    TimingWheelNode timer_node;
+    // session_epoch 用于防止 trace_key 复用误命中旧的 dispatching_inflight 记录。
     uint64_t session_epoch = 0;
     // lifecycle_state 用来区分“仍在收集”和“已 ready 但等待重投”，避免复用同一套超时语义。
     LifecycleState lifecycle_state = LifecycleState::Collecting;
@@ -127,6 +153,14 @@ struct TraceSession
     // 既然 ready retry 会话已经不再吸收新 span，那么这两份 prepared 数据可以安全复用。
     std::optional<std::string> prepared_trace_payload;
     std::optional<TraceRepository::TraceSummary> prepared_summary;
+    // 结构指纹只在开了 AI 结果缓存时才算；和 payload 一样跟着 session 走，retry 时不重算。
+    std::optional<uint64_t> prepared_fingerprint;
+    // 开了入口 WAL 时，第一个 span 记进 WAL 的同时把这条 trace 钉在当前段上；
+    // 之后的 span 不再重复钉，采样丢弃或主数据刷进 SQLite 时各解钉一次。
+    bool wal_pinned = false;
+    // 收到过 WAL 重放出来的 span：这条 trace 崩溃前可能已经落过库，summary/analysis 带着标记去写，
+    // 存储层只对这类行做主键冲突跳过。
+    bool replayed = false;
 };
 
 class TraceSessionManager
@@ -143,6 +177,53 @@ public:
         uint64_t ai_total_ns = 0;
         uint64_t analysis_enqueue_calls = 0;
         uint64_t analysis_enqueue_total_ns = 0;
+        // 已发给异步 provider、结果还没收尾的 AI 调用数；同步模式下恒为 0。
+        uint64_t ai_async_inflight = 0;
+        // 结构指纹缓存：命中/未命中/合并到在途调用的次数，以及淘汰、过期和当前条目数。没开缓存时全为 0。
+        uint64_t ai_cache_hits = 0;
+        uint64_t ai_cache_misses = 0;
+        uint64_t ai_cache_coalesced = 0;
+        uint64_t ai_cache_evictions = 0;
+        uint64_t ai_cache_expirations = 0;
+        uint64_t ai_cache_size = 0;
+        // 挂在同指纹领头调用上、还没收尾的 trace 数。
+        uint64_t ai_cache_waiting = 0;
+        // 线程池拒收、转给专用完成线程执行的 AI 收尾任务数。
+        uint64_t ai_completion_overflow = 0;
+        // WAL 重放出来、库里已经有分析结果的 trace 数：这些 trace 不再调模型，也不再发告警。
+        uint64_t replayed_analysis_skipped = 0;
+        // session 池：新 trace 复用回收 session 的次数、池子空着只能新建的次数、放回池子/直接释放的次数和当前空闲数。
+        // 没开池子时全为 0。
+        uint64_t session_pool_reused = 0;
+        uint64_t session_pool_created = 0;
+        uint64_t session_pool_recycled = 0;
+        uint64_t session_pool_dropped = 0;
+        uint64_t session_pool_idle = 0;
+        // 空闲 session 合计攥着的估算字节数，以及因为超出池子字节预算被清空槽位再放回的次数。
+        uint64_t session_pool_idle_bytes = 0;
+        uint64_t session_pool_trimmed = 0;
+        // 当前聚合态积压：span 条数和按 EstimateSpanBytes 估算的字节数，后者驱动 buffered_bytes 水位。
+        uint64_t buffered_spans = 0;
+        uint64_t buffered_bytes = 0;
+        // 下游 BufferedTraceRepository 里已收下、还没刷进 SQLite 的估算字节数，驱动持久化滞后水位。
+        uint64_t pending_flush_bytes = 0;
+        // 尾部采样：因含错误 span / 慢 span 必留、健康但抽中保留、健康且被丢弃的 trace 数。没开采样时全为 0。
+        uint64_t sampling_kept_error = 0;
+        uint64_t sampling_kept_slow = 0;
+        uint64_t sampling_kept_sampled = 0;
+        uint64_t sampling_dropped = 0;
+        // 活跃 session 时间轮（所有 shard 合计）：当前挂着的节点数和按层分布，重排时原地摘掉旧计划的次数，
+        // 高层降到低层的节点次数。relinks 在懒删除实现里对应的就是槽里堆积的过期节点数。
+        uint64_t timer_wheel_occupancy = 0;
+        uint64_t timer_wheel_level0 = 0;
+        uint64_t timer_wheel_level1 = 0;
+        uint64_t timer_wheel_level2 = 0;
+        uint64_t timer_wheel_level3 = 0;
+        uint64_t timer_wheel_relinks = 0;
+        uint64_t timer_wheel_cascades = 0;
+        // completed tombstone 时间轮仍是懒删除：当前槽里的条目数，以及 sweep 时遇到的已被覆盖/已过期条目数。
+        uint64_t tombstone_wheel_entries = 0;
+        uint64_t tombstone_stale_skipped = 0;
     };
 
     enum class PushResult
@@ -207,11 +288,40 @@ public:
                                  // fallback_trace_ai 和 ai_auto_degrade_enabled 共同决定“主路失败后要不要再试一次备路”。
                                  // 这一步先只做固定主/备两路，不把 provider 切换逻辑塞回 TraceProxyAi 动态改请求。
                                  TraceAiProvider* fallback_trace_ai = nullptr,
-                                 bool ai_auto_degrade_enabled = false);
+                                 bool ai_auto_degrade_enabled = false,
+                                 // session_shard_count 决定聚合态拆成几个独立分片，每片各自一把锁。
+                                 // 默认 1 片保持旧的单锁语义；多 IO 线程部署时由 main 按冷启动参数放大。
+                                 size_t session_shard_count = 1,
+                                 // ai_async_dispatch_enabled 打开且 provider 支持 AnalyzeTraceAsync 时，
+                                 // worker 只负责发起 AI 请求，模型延迟期间不再占着线程；provider 不支持时自动退回同步调用。
+                                 bool ai_async_dispatch_enabled = false,
+                                 // ai_result_cache_capacity>0 时按 trace 结构指纹缓存 AI 结果，并把同指纹的并发调用合并成一次；
+                                 // 0 表示关闭。ttl 控制一条结果最多被复用多久，<=0 表示只靠 LRU 淘汰。
+                                 size_t ai_result_cache_capacity = 0,
+                                 int64_t ai_result_cache_ttl_ms = 600000,
+                                 // session_pool_size>0 时分发完的 TraceSession 连同预留好的 spans 数组和 span 槽位放回池子，
+                                 // 新 trace 直接复用，减少持续摄入下的小块堆分配和 RSS 爬升；0 表示每条 trace 都重新 new。
+                                 size_t session_pool_size = 0,
+                                 // buffered_bytes_hard_limit 是聚合态 span 内容的字节预算，和 span 数/会话数水位并列参与背压：
+                                 // 同样 4096 个 span，带 50KB attribute 和只有几百字节的内存占用能差上百倍，只按条数算会两头失准。
+                                 // 0 表示使用默认的 256MiB。
+                                 size_t buffered_bytes_hard_limit = 0,
+                                 // 这两档百分比同时用于 BufferedTraceRepository 待刷字节的持久化滞后水位。
+                                 int buffered_bytes_overload_percent = 75,
+                                 int buffered_bytes_critical_percent = 90,
+                                 // sampling_policy 打开后，分发时对健康 trace 做尾部采样：错误/慢 trace 必留，
+                                 // 其余按比例抽样，没抽中的不写主数据也不调 AI，只给服务监控记账。默认全部保留。
+                                 TraceSamplingPolicy sampling_policy = {},
+                                 // ingest_wal 非空时，Push 收下的每个 span 先追加进入口 WAL，崩溃重启后由 main 重放；
+                                 // 生命周期由调用方负责，必须比 manager 和 BufferedTraceRepository 都活得久。
+                                 TraceIngestWal* ingest_wal = nullptr);
     ~TraceSessionManager();
 
     size_t size() const;
     PushResult Push(const SpanEvent& span);
+    // 批量入口：先按 trace_key 分组（组内保持到达顺序），每个 trace 只拿一次所属 shard 的锁，
+    // 把整组 span 连续 Push 进去。返回值和入参按下标一一对应，调用方据此逐条回报 accepted/rejected。
+    std::vector<PushResult> PushBatch(const std::vector<SpanEvent>& spans);
     // 当前主链路不依赖这个公开 Dispatch 入口。
     // 现在推荐的正常路径是：Push/Seal -> 时间轮 sweep -> dispatch queue -> ProcessDispatchJob。
     // 这里暂时保留，主要是为了兼容少量旧测试/手工触发入口，后续若彻底无调用方再考虑继续收口。
@@ -243,6 +353,15 @@ private:
     // 自动降级和熔断不是一回事：
     // 前者表达“主路失败后要不要再试备路”，后者表达“这一小段时间内是否整条 AI 链都先别打了”。
     bool ai_auto_degrade_enabled_ = false;
+    bool ai_async_dispatch_enabled_ = false;
+    // 为空表示没开结果缓存，worker 直接走原来的调用路径。
+    std::unique_ptr<TraceAiResultCache> ai_result_cache_;
+    // 为空表示不回收 session，Push 每次 make_unique、worker 收尾时直接释放。
+    std::unique_ptr<TraceSessionPool> session_pool_;
+    // 为空表示不做尾部采样，每条 trace 都写主数据、走 AI。
+    std::unique_ptr<TraceSampler> trace_sampler_;
+    // 为空表示没开入口 WAL，span 只活在内存里。
+    TraceIngestWal* ingest_wal_ = nullptr;
     size_t ai_failure_threshold_ = 5;
     int64_t ai_cooldown_ms_ = 60000;
     // 熔断状态只需要两份最小运行态：
@@ -254,19 +373,23 @@ private:
     size_t token_limit_ = 0;
     TokenEstimator token_estimator_;
 
+    // 扁平的 trace 索引：整条 trace 只用几段连续数组表示，不再是每个 span 一个哈希节点、每个父节点一个 vector。
+    // 下面所有表里的“节点”都是 nodes 的下标：
+    // 1) nodes 按 span_id 升序，同一个 span_id 重复上报时只保留最后到达的那份（和原来 map 覆盖写的语义一致）；
+    // 2) children 按 (父节点下标, start_time, span_id) 排好序，节点 i 的子节点是
+    //    children[child_offsets[i], child_offsets[i + 1])，DFS 直接按这个顺序走，不再逐层拷贝再排序；
+    // 3) roots 按 span 到达顺序记录找不到父节点的 span；重复上报的 root/child 会出现多次，DFS 里按环处理。
     struct TraceIndex
     {
-        std::unordered_map<size_t, const SpanEvent*> span_map;
-        std::unordered_map<size_t, std::vector<size_t>> children;
-        std::vector<size_t> roots;
-    };
-    struct TimeWheelNode
-    {
-        // trace_key + version + epoch 共同定位“当前有效超时计划”。
-        size_t trace_key = 0;
-        uint64_t version = 0;
-        uint64_t epoch = 0;
-        uint64_t expire_tick = 0;
+        static constexpr size_t npos = static_cast<size_t>(-1);
+
+        std::vector<const SpanEvent*> nodes;
+        std::vector<uint32_t> children;
+        std::vector<uint32_t> child_offsets;
+        std::vector<uint32_t> roots;
+
+        // 按 span_id 二分查找节点下标，找不到时返回 npos。
+        size_t Find(size_t span_id) const;
     };
     struct Watermark
     {
@@ -285,11 +408,114 @@ private:
         // 第二步先把 queue 骨架搭起来，job 直接持有 session 所有权，避免后面又回 manager 取一次。
         std::unique_ptr<TraceSession> session;
     };
+    // 交给线程池的 AI/收尾任务。
+    // 之所以写成具名结构体而不是 lambda：ThreadPool::Task 只要求可移动，session 和 observation 视图可以直接 move 进来，
+    // 不必再为了 std::function 的“可拷贝”要求套 shared_ptr；同时 submit 被拒时，调用方能通过 Task::target
+    // 按类型把 session 取回来回滚——lambda 的捕获成员没有名字，做不到这一点。
+    // 体积控制在 ThreadPool::kTaskInlineSize 以内（.cpp 里有 static_assert），入队全程不碰堆。
+    struct DispatchWorkerTask
+    {
+        TraceSessionManager* manager = nullptr;
+        BufferedTraceRepository* buffered_trace_repo = nullptr;
+        TraceAiProvider* trace_ai = nullptr;
+        TraceAiProvider* fallback_trace_ai = nullptr;
+        INotifier* notifier = nullptr;
+        ServiceRuntimeAccumulator* service_runtime_accumulator = nullptr;
+        SystemRuntimeAccumulator* system_runtime_accumulator = nullptr;
+        uint64_t worker_enqueue_ns = 0;
+        std::unique_ptr<TraceSession> session;
+        // 两个指针都指向 session 内部的 prepared 缓存；session 本身在堆上，随任务移动时地址不变。
+        const std::string* worker_trace_payload = nullptr;
+        const TraceRepository::TraceSummary* worker_summary = nullptr;
+        std::optional<std::vector<TraceRepository::TraceSpanRecord>> analysis_observation_span_records;
+
+        void operator()();
+
+    private:
+        // 一次 AI 调用从开始到收尾要带着走的状态，定义放在 .cpp 里。
+        struct AiOutcome;
+        // 下面几段把 worker 逻辑按阶段拆开，同步调用和异步回调两条路径共用同一套前置判断、失败归类和收尾：
+        // BeginAiCall 处理人工关闭/熔断/provider 缺失，返回 false 表示本次不调模型；
+        // CompleteAiCall 接住主路结果（失败时转备路）；Finish 负责落 analysis 和发告警，
+        // 最后把 session 还给池子。
+        // LookupCachedResult 在调模型前查结构指纹缓存：命中就直接收尾，同指纹已有调用在途就把任务挂上去等；
+        // 返回 true 表示本任务成了领头者或没法查缓存，要继续走 RunAiCall。
+        bool LookupCachedResult(AiOutcome* outcome);
+        void FinishFromCache(const TraceAiResponse& response, AiOutcome* outcome);
+        // RunAiCall 从 BeginAiCall 开始，按配置走同步或异步调用；挂起的等待者被领头失败唤醒后也从这里重新开始。
+        void RunAiCall(AiOutcome* outcome);
+        bool BeginAiCall(AiOutcome* outcome);
+        void ApplyAiResponse(const TraceAiResponse& response, AiOutcome* outcome);
+        void CompleteAiCall(TraceAiResponse response, std::exception_ptr error, AiOutcome* outcome);
+        // 主路失败后的备路：异步模式下走 fallback 的 AnalyzeTraceAsync，结果回来后同样经完成队列回到 worker 收尾；
+        // CompleteFallback 接住备路结果，EndAiCall 记 AI 耗时后进入 Finish。
+        void RunFallbackAsync(std::string primary_error, AiOutcome* outcome);
+        void CompleteFallback(TraceAiResponse response,
+                              std::exception_ptr error,
+                              const std::string& primary_error,
+                              AiOutcome* outcome);
+        void EndAiCall(AiOutcome* outcome);
+        void Finish(AiOutcome* outcome);
+        void DeliverOutcome(AiOutcome* outcome);
+    };
+    // DispatchLocked 直调路径的任务：payload/summary/span_records 都是本轮现算的值，直接 move 进来。
+    // 这份任务体积超过内联缓冲，会退回一次堆分配，但仍然省掉了 shared_ptr 控制块。
+    struct DirectDispatchWorkerTask
+    {
+        TraceSessionManager* manager = nullptr;
+        BufferedTraceRepository* buffered_trace_repo = nullptr;
+        TraceAiProvider* trace_ai = nullptr;
+        INotifier* notifier = nullptr;
+        SystemRuntimeAccumulator* system_runtime_accumulator = nullptr;
+        uint64_t worker_enqueue_ns = 0;
+        std::unique_ptr<TraceSession> session;
+        std::string trace_payload;
+        TraceRepository::TraceSummary summary;
+        std::vector<TraceRepository::TraceSpanRecord> span_records;
+
+        void operator()();
+    };
+    // Shard 把原来整把 manager 锁保护的聚合态按 trace_key 拆开。
+    // 同一个 trace_key 永远落在同一个 shard，所以单条 trace 的收集/封口/重投/tombstone 语义不变；
+    // 不同 trace 只要落在不同 shard，Push 和 sweep 就不会再互相抢同一把锁。
+    // alignas(64) 是为了让相邻 shard 的 mutex 不挤在同一条 cache line 上，避免锁拆开了还在伪共享。
+    struct alignas(64) Shard
+    {
+        // 使用 unique_ptr 保证对象地址稳定，后续可安全转移所有权给线程池处理。
+        std::vector<std::unique_ptr<TraceSession>> sessions_;
+        // 通过 trace_key 快速定位到 vector 下标，避免线性扫描带来的开销。
+        std::unordered_map<size_t, size_t> index_by_trace_;
+        // 时间轮主状态：分层挂着每个活跃 session 的 timer_node，key 是 trace_key。
+        HierarchicalTimingWheel time_wheel_;
+        // completed tombstone 只记“最近刚完成过的 trace_key”，用于短时间内拦截 late span 复活旧 trace。
+        // map 负责 O(1) 判断是否仍在 tombstone 窗口内，value 是它的过期 tick。
+        std::unordered_map<size_t, uint64_t> completed_trace_expire_tick_;
+        // dispatching_inflight_ 记录“已离开 manager、但尚未进入 tombstone”的 trace。
+        std::unordered_map<size_t, DispatchingInflightState> dispatching_inflight_;
+        // 和活跃 session 时间轮分开存，避免把“等待 dispatch”和“等待遗忘”两套语义塞进同一种节点。
+        std::vector<std::vector<size_t>> completed_trace_wheel_;
+        // tombstone 轮里当前条目总数（含已失效但还没扫到的），以及 sweep 时丢弃的失效条目累计数。
+        size_t completed_trace_wheel_entries_ = 0;
+        uint64_t completed_trace_stale_skipped_ = 0;
+        // tick 跟着 shard 走：空 shard 不推进 tick，和拆分前“空 manager 直接跳过 sweep”的语义保持一致。
+        uint64_t current_tick_ = 0;
+        int64_t last_tick_now_ms_ = 0;
+        uint64_t session_epoch_seq_ = 0;
+        // 每个 shard 自己的一把锁；IO 线程 Push、主 loop sweep、dispatch 线程回滚都只锁目标 shard。
+        mutable std::mutex mutex_;
+    };
+
+    // 新 trace 从池子里取 session，worker 收尾后还回去；没开池子时退化成 make_unique / 直接释放。
+    std::unique_ptr<TraceSession> AcquireSession();
+    void RecycleSession(std::unique_ptr<TraceSession> session);
 
     // 构建 trace 的父子关系索引，后续用于树形遍历与序列化。
     TraceIndex BuildTraceIndex(const TraceSession& session);
     // 将 trace 按树形结构序列化为可传递的字符串，同时产出 DFS 顺序缓存。
     std::string SerializeTrace(const TraceIndex& index, std::vector<const SpanEvent*>* order);
+    // 结构指纹：只看调用树形状、每个 span 的 service/name/kind/status 和按 2 的幂分桶的耗时，
+    // 不看 trace/span id、绝对时间和 attributes。兄弟节点排序后再合并，所以 span 到达顺序不影响结果。
+    uint64_t ComputeTraceFingerprint(const TraceIndex& index) const;
 
     // 将复杂组装逻辑拆分为独立步骤，避免在 Dispatch 中堆叠细节，便于单测与迭代。
     TraceRepository::TraceSummary BuildTraceSummary(const TraceSession& session,
@@ -297,6 +523,9 @@ private:
     std::vector<TraceRepository::TraceSpanRecord> BuildSpanRecords(const std::vector<const SpanEvent*>& order);
     TraceRepository::TraceAnalysisRecord BuildAnalysisRecord(const std::string& trace_id,
                                                              const LogAnalysisResult& analysis);
+    // WAL 重放出来的 trace 崩溃前可能已经分析、告警过：库里已有分析结果时返回 true，worker 直接收尾，
+    // 不重新调模型、不重复告警。非重放 trace 不查库。
+    bool ReplayedTraceAlreadyAnalyzed(const TraceRepository::TraceSummary& summary);
     // 计算当前 idle_timeout 对应的 tick 数；至少返回 1，避免 0 tick 导致不触发。
     uint64_t ComputeTimeoutTicks() const;
     // 毫秒配置在进入状态机前统一折算成 tick。
@@ -322,56 +551,71 @@ private:
     // AI 调用最终失败后累计连续失败次数；达到阈值时打开冷却窗口。
     void RecordAiCircuitFailure(int64_t now_ms);
     // completed tombstone 进入 TIME_WAIT：写入精确查找表并挂进独立 wheel，避免晚到 span 复活旧 trace。
-    void AddCompletedTombstoneLocked(size_t trace_key);
+    void AddCompletedTombstoneLocked(Shard& shard, size_t trace_key);
     // 命中且仍未过期时返回 true；若发现只是 map 里的过期脏数据，会在这里顺手清掉。
-    bool IsCompletedTombstoneAliveLocked(size_t trace_key);
+    bool IsCompletedTombstoneAliveLocked(Shard& shard, size_t trace_key);
     // 扫描当前 tick 的 completed tombstone 桶：到期则删除，未到期则按真实 expire_tick 重新挂回。
-    void SweepCompletedTombstonesLocked(size_t slot);
+    void SweepCompletedTombstonesLocked(Shard& shard, size_t slot);
     // Push/Dispatch 的共享状态会同时被 IO loop 和主 loop 定时器线程访问，这里拆出持锁版本，
     // 避免公开入口互相调用时重复加锁导致死锁。
-    PushResult PushLocked(const SpanEvent& span, int64_t now_ms);
-    bool DispatchLocked(size_t trace_key);
+    // PushLocked 只决定这个 span 要不要记进入口 WAL、要不要钉住 trace；Append 由 Push/PushBatch 放掉 shard 锁后再做。
+    struct WalAppend
+    {
+        bool record = false;
+        bool pin = false;
+    };
+    PushResult PushLocked(Shard& shard, const SpanEvent& span, int64_t now_ms, WalAppend* wal_append);
+    bool DispatchLocked(Shard& shard, size_t trace_key);
     // 从 manager 主容器中摘出一条 session，后续交给 dispatch 线程锁外处理。
-    std::unique_ptr<TraceSession> DetachSessionLocked(size_t trace_key, size_t* span_count);
+    std::unique_ptr<TraceSession> DetachSessionLocked(Shard& shard, size_t trace_key, size_t* span_count);
     // dispatch 失败时把 session 放回 manager，并切到 ReadyRetryLater 语义等待后续重投。
-    void RestoreSessionLocked(std::unique_ptr<TraceSession> session, size_t span_count);
+    void RestoreSessionLocked(Shard& shard, std::unique_ptr<TraceSession> session, size_t span_count);
     // 有界 dispatch queue 的最小入队入口；第一步先只表达“能否抢到分发通道”。
     bool EnqueueDispatchJobLocked(DispatchJob* job);
     // dispatch 线程消费 job 后继续沿用现有主链路逻辑；后续再逐步拆成更细阶段。
     void ProcessDispatchJob(DispatchJob job);
+    // 尾部采样丢弃的 trace 在这里收尾：只给服务监控记账，然后像分发成功一样写 tombstone、回收 session。
+    void FinishSampledOutTrace(std::unique_ptr<TraceSession> session);
+    // session 离开 shard 时扣减全局 active_sessions_ / total_buffered_spans_ / total_buffered_bytes_ 计数。
+    void ReleaseSessionCounters(size_t span_count, size_t byte_count);
+    // 单个 span 在聚合态里的估算内存：结构体本身 + 字符串内容 + 每个 attribute 条目的哈希节点开销。
+    // 只看 size() 不看 capacity()，同一个 span 在入口和扣减时算出来的值一定相同。
+    static size_t EstimateSpanBytes(const SpanEvent& span);
     // 基于当前积压指标刷新 overload_state_，统一收口新老 trace 的准入门禁状态。
     void RefreshOverloadState();
     // 当前请求是否应该在入口被拒绝：Overload 拒新 trace，Critical 新老都拒。
     bool ShouldRejectIncomingTrace(bool trace_exists) const;
-    // 在时间轮中为会话安排最新超时节点（旧节点不删，靠 version/epoch 失效）。
-    void ScheduleTimeoutNode(TraceSession& session);
+    // 在时间轮中为会话安排最新超时节点；timer_node 已挂链时原地摘下旧计划再挂新槽。
+    void ScheduleTimeoutNode(Shard& shard, TraceSession& session);
     // sealed 会话使用独立的 deadline tick；后续 late span 可以并入，但不能续命。
-    void ScheduleSealedNode(TraceSession& session);
+    void ScheduleSealedNode(Shard& shard, TraceSession& session);
     // ready trace 投递失败后，安排一个更短的“尽快重试”时点，避免继续沿用收集超时语义。
-    void ScheduleRetryNode(TraceSession& session);
+    void ScheduleRetryNode(Shard& shard, TraceSession& session);
     // 按会话当前生命周期选择调度语义：Collecting 走收集超时，ReadyRetryLater 走快速重投。
-    void ScheduleSessionNode(TraceSession& session);
+    void ScheduleSessionNode(Shard& shard, TraceSession& session);
     // 将 collecting 会话收口到 sealed，后续只等固定短窗口，不再被新 span 延长。
-    void SealSessionLocked(TraceSession& session, TraceSession::SealReason reason);
+    void SealSessionLocked(Shard& shard, TraceSession& session, TraceSession::SealReason reason);
     // timeout 参数变化时重建时间轮，避免旧参数下的节点继续误导触发时机。
     void RebuildTimeWheel();
+    void RebuildTimeWheelLocked(Shard& shard);
+    // 按 trace_key 选 shard；先混洗再取模，避免连续自增的 trace_key 扎堆落进少数几个 shard。
+    Shard& ShardFor(size_t trace_key) const;
+    // 单个 shard 的一轮 sweep：推进该 shard 的 tick，摘出到期 session 并投进 dispatch queue。
+    // dispatch_budget 是本轮还允许分发的数量，返回值是这个 shard 实际摘出的条数。
+    size_t SweepShardLocked(Shard& shard,
+                            int64_t now_ms,
+                            bool rebuild_time_wheel,
+                            size_t dispatch_budget);
     // dispatch 线程第一步只做生命周期与队列骨架占位，后面再逐步接业务逻辑。
     void DispatchLoop();
     void StopDispatchThread();
-    // 使用 unique_ptr 保证对象地址稳定，后续可安全转移所有权给线程池处理。
-    std::vector<std::unique_ptr<TraceSession>> sessions_;
-    // 通过 trace_key 快速定位到 vector 下标，避免线性扫描带来的开销。
-    std::unordered_map<size_t, size_t> index_by_trace_;
-    // 时间轮主状态：按槽位存储超时候选节点。
-    std::vector<std::vector<TimeWheelNode>> time_wheel_;
-    // completed tombstone 只记“最近刚完成过的 trace_key”，用于短时间内拦截 late span 复活旧 trace。
-    // map 负责 O(1) 判断是否仍在 tombstone 窗口内，value 是它的过期 tick。
-    std::unordered_map<size_t, uint64_t> completed_trace_expire_tick_;
-    // dispatching_inflight_ 记录“已离开 manager、但尚未进入 tombstone”的 trace。
-    // 第一步先只做轻量占位，不在这里再次持有 session 所有权，避免状态双持有。
-    std::unordered_map<size_t, DispatchingInflightState> dispatching_inflight_;
-    // 和活跃 session 时间轮分开存，避免把“等待 dispatch”和“等待遗忘”两套语义塞进同一种节点。
-    std::vector<std::vector<size_t>> completed_trace_wheel_;
+    // 聚合态按 trace_key 分片；shard 数量在构造期固定，运行中不扩缩，所以 ShardFor 不需要加锁。
+    std::vector<std::unique_ptr<Shard>> shards_;
+    // 轮转起点：max_dispatch_per_tick 是全局预算，每轮从不同 shard 开始扫，避免编号靠后的 shard 长期饿死。
+    size_t sweep_cursor_ = 0;
+    // sweep 只该由主 loop 串行驱动；这把锁只防止测试/手工入口并发 sweep，不会和 Push 争用。
+    std::mutex sweep_mutex_;
+    // 活跃 session 改用分层时间轮后，wheel_size_ 只决定 tombstone 轮的槽数。
     size_t wheel_size_ = 512;
     int64_t idle_timeout_ms_ = 5000;
     int64_t wheel_tick_ms_ = 500;
@@ -380,24 +624,30 @@ private:
     uint64_t retry_base_delay_ticks_ = 1;
     // completed tombstone 默认保留 25 tick；当前 tick=200ms 时大约是 5s。
     uint64_t completed_trace_tombstone_ticks_ = 25;
-    uint64_t timeout_ticks_ = 10;
-    uint64_t current_tick_ = 0;
-    int64_t last_tick_now_ms_ = 0;
-    uint64_t session_epoch_seq_ = 0;
-    // active_sessions_ 与 total_buffered_spans_ 直接反映入口聚合态积压，用于实时背压门禁。
-    size_t active_sessions_ = 0;
-    size_t total_buffered_spans_ = 0;
+    // sweep 调整 idle_timeout 时会改写它，而各 shard 的 Push 会并发读取，所以用原子量。
+    std::atomic<uint64_t> timeout_ticks_{10};
+    // active_sessions_ / total_buffered_spans_ / total_buffered_bytes_ 直接反映入口聚合态积压，用于实时背压门禁。
+    // 分片后它们仍是全局口径：各 shard 在自己的锁内增减，水位判断读的是所有 shard 的合计。
+    std::atomic<size_t> active_sessions_{0};
+    std::atomic<size_t> total_buffered_spans_{0};
+    // total_buffered_bytes_ 和 total_buffered_spans_ 同口径增减，只是按 span 体积加权。
+    std::atomic<size_t> total_buffered_bytes_{0};
     // 第一版先硬编码接入，后续再迁移到配置层；这里存每个指标自己的硬上限基数。
     size_t buffered_span_hard_limit_ = 4096;
     size_t active_session_hard_limit_ = 1024;
+    size_t buffered_bytes_hard_limit_ = 256 * 1024 * 1024;
     // watermark_ 在构造期预计算，避免每次 Push/Dispatch 都重复按比例换算阈值。
     Watermark buffered_span_watermark_;
+    Watermark buffered_bytes_watermark_;
+    // 持久化滞后水位的硬上限直接取 BufferedTraceRepository 自己的待刷字节上限；0 表示下游不设上限，这条水位不参与判断。
+    size_t pending_flush_hard_limit_ = 0;
+    Watermark pending_flush_watermark_;
     Watermark active_session_watermark_;
     Watermark pending_task_watermark_;
     Watermark dispatch_queue_watermark_;
     size_t dispatch_queue_hard_limit_ = 1;
-    // overload_state_ 先作为背压状态机占位，后续由多指标水位共同驱动。
-    OverloadState overload_state_ = OverloadState::Normal;
+    // overload_state_ 由多指标水位共同驱动；多个 shard 会并发刷新它，所以回滞状态机用 CAS 推进。
+    std::atomic<OverloadState> overload_state_{OverloadState::Normal};
     // 这批统计只服务“后链路是否真的跑了、各阶段墙钟耗时多少”，
     // 不参与业务判断，因此第一版直接用全局原子累加，先把账记清楚。
     std::atomic<uint64_t> dispatch_count_{0};
@@ -409,13 +659,19 @@ private:
     std::atomic<uint64_t> ai_total_ns_{0};
     std::atomic<uint64_t> analysis_enqueue_calls_{0};
     std::atomic<uint64_t> analysis_enqueue_total_ns_{0};
+    // 异步 AI 在途数：发起时加一，结果在 worker 上收尾完才减一；析构时等它归零，避免回调摸到已销毁的 manager。
+    std::atomic<uint64_t> ai_async_inflight_{0};
+    // 挂在缓存领头调用上的等待任务数；和 ai_async_inflight_ 一样，析构要等它归零，因为等待者回调里也持有 manager 裸指针。
+    std::atomic<uint64_t> ai_cache_waiting_{0};
+    // 异步 AI 回调、缓存等待者唤醒这类收尾任务的投递口，定义在 .cpp 里：先交线程池，拒收时转给专用完成线程，
+    // 不在 provider 的 IO loop 线程或领头者的收尾线程上就地执行。
+    struct AiCompletionQueue;
+    std::unique_ptr<AiCompletionQueue> ai_completion_queue_;
+    std::atomic<uint64_t> replayed_analysis_skipped_{0};
     // 独立 dispatch 线程的有界队列：第一步先占好结构，后面再把 sweep/dispatch 逐步接过来。
     std::mutex dispatch_queue_mutex_;
     std::condition_variable dispatch_queue_cv_;
     std::queue<DispatchJob> dispatch_queue_;
     bool dispatch_stopping_ = false;
     std::thread dispatch_thread_;
-    // TraceSessionManager 当前会被 HTTP 处理线程和主 loop 定时器线程同时访问，
-    // 这把锁先用最保守的方式把内部状态机串行化，优先保证正确性。
-    mutable std::mutex mutex_;
 };
@@ -0,0 +1,114 @@
+#include "core/TraceSessionPool.h"
+
+#include <limits>
+#include <utility>
+
+#include "core/TraceSessionManager.h"
+
+TraceSessionPool::TraceSessionPool(size_t max_idle,
+                                   size_t max_spans_per_session,
+                                   size_t max_idle_bytes,
+                                   size_t max_slot_bytes)
+    : max_idle_(max_idle),
+      max_spans_per_session_(max_spans_per_session),
+      max_idle_bytes_(max_idle_bytes),
+      max_slot_bytes_(max_slot_bytes > 0 ? max_slot_bytes : std::numeric_limits<size_t>::max())
+{
+    idle_.reserve(max_idle_);
+}
+
+TraceSessionPool::~TraceSessionPool() = default;
+
+std::unique_ptr<TraceSession> TraceSessionPool::Acquire(size_t capacity)
+{
+    std::unique_ptr<TraceSession> session;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!idle_.empty())
+        {
+            session = std::move(idle_.back());
+            idle_.pop_back();
+            idle_bytes_ -= session->PooledBytes();
+            ++stats_.reused;
+        }
+        else
+        {
+            ++stats_.created;
+        }
+    }
+    if (!session)
+    {
+        return std::make_unique<TraceSession>(capacity);
+    }
+    session->capacity = capacity;
+    if (session->spans.capacity() < capacity)
+    {
+        session->spans.reserve(capacity);
+    }
+    return session;
+}
+
+void TraceSessionPool::Release(std::unique_ptr<TraceSession> session)
+{
+    if (!session)
+    {
+        return;
+    }
+    // 只在 sealed 窗口吸收过大量 late span 的 session 才会超过上限；这种一次性的大块直接还给分配器，
+    // 不让偶发的大 trace 把池子里每个 session 都撑成峰值大小。
+    const bool oversized = max_spans_per_session_ > 0 && session->spans.capacity() > max_spans_per_session_;
+    if (max_idle_ == 0 || oversized)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ++stats_.dropped;
+        return;
+    }
+
+    // Reset 只是把字段清回默认值、把 span 挪进槽位（超大的槽位就地释放），不碰锁，放在锁外做。
+    session->Reset(max_slot_bytes_);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (idle_.size() >= max_idle_)
+        {
+            ++stats_.dropped;
+            return;
+        }
+        const size_t bytes = session->PooledBytes();
+        if (FitsLocked(bytes))
+        {
+            idle_.push_back(std::move(session));
+            idle_bytes_ += bytes;
+            ++stats_.recycled;
+            return;
+        }
+    }
+
+    // 超出字节预算：槽位整体还给分配器，只留 session 本体和预留好的数组。释放内存放在锁外。
+    session->span_slab = std::vector<SpanEvent>();
+    session->slab_bytes = 0;
+    const size_t trimmed_bytes = session->PooledBytes();
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (idle_.size() >= max_idle_ || !FitsLocked(trimmed_bytes))
+    {
+        ++stats_.dropped;
+        return;
+    }
+    idle_.push_back(std::move(session));
+    idle_bytes_ += trimmed_bytes;
+    ++stats_.recycled;
+    ++stats_.trimmed;
+}
+
+bool TraceSessionPool::FitsLocked(size_t bytes) const
+{
+    return max_idle_bytes_ == 0 || idle_bytes_ + bytes <= max_idle_bytes_;
+}
+
+TraceSessionPool::Stats TraceSessionPool::GetStats() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    Stats stats = stats_;
+    stats.idle = idle_.size();
+    stats.idle_bytes = idle_bytes_;
+    return stats;
+}
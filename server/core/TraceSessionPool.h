@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+struct TraceSession;
+
+// TraceSessionPool 回收已经分发完的 TraceSession，下一条新 trace 直接复用：
+// 1) session 对象本身、按 capacity 预留好的 spans 数组和 span_ids 的桶都原样留着，不再每条 trace 重新 new 一遍；
+// 2) 上一轮的 SpanEvent 进了 session 自己的 span 槽位，新 span 拷进去时复用这些槽位里 string/attributes 已有的堆内存；
+// 3) 空闲数量按条数封顶，超出的以及在 sealed 窗口里长得比 capacity 还大的 session 直接释放，避免池子把峰值内存永久攥住；
+// 4) 空闲 session 合计攥着的字节数也有上限：单个槽位太大的在 Reset 时就不留，放回时超出预算的 session 先清空槽位，
+//    只留 session 本体和数组，还超就整个释放。这部分内存不算进 buffered_bytes 水位，只能靠池子自己封顶。
+// 回收和取用可能在不同线程（worker 还、Push 取），所以内部一把锁；Reset 在锁外由归还方做完。
+class TraceSessionPool
+{
+public:
+    struct Stats
+    {
+        // 取用时命中空闲 session 的次数 / 池子空着只能新建的次数。
+        uint64_t reused = 0;
+        uint64_t created = 0;
+        // 成功放回池子的次数 / 因池满或超大被直接释放的次数。
+        uint64_t recycled = 0;
+        uint64_t dropped = 0;
+        // 放回前因为超出字节预算被清空槽位的次数。
+        uint64_t trimmed = 0;
+        size_t idle = 0;
+        // 空闲 session 合计攥着的估算字节数（TraceSession::PooledBytes 之和）。
+        size_t idle_bytes = 0;
+    };
+
+    // max_idle=0 表示不缓存任何 session，Acquire 每次新建、Release 直接释放。
+    // max_spans_per_session 是一条被回收的 session 最多保留的 span 数组容量，0 表示不限。
+    // max_idle_bytes 是空闲 session 合计的字节预算，max_slot_bytes 是单个 span 槽位最多保留的堆内存，0 都表示不限。
+    TraceSessionPool(size_t max_idle, size_t max_spans_per_session, size_t max_idle_bytes, size_t max_slot_bytes);
+    ~TraceSessionPool();
+
+    TraceSessionPool(const TraceSessionPool&) = delete;
+    TraceSessionPool& operator=(const TraceSessionPool&) = delete;
+
+    // 返回的 session 所有字段都是默认值，capacity 为本次传入的值。
+    std::unique_ptr<TraceSession> Acquire(size_t capacity);
+    void Release(std::unique_ptr<TraceSession> session);
+
+    Stats GetStats() const;
+
+private:
+    // 调用方持锁。
+    bool FitsLocked(size_t bytes) const;
+
+    const size_t max_idle_;
+    const size_t max_spans_per_session_;
+    const size_t max_idle_bytes_;
+    const size_t max_slot_bytes_;
+
+    mutable std::mutex mutex_;
+    std::vector<std::unique_ptr<TraceSession>> idle_;
+    size_t idle_bytes_ = 0;
+    Stats stats_;
+};
@@ -160,7 +160,7 @@ void ConfigHandler::handleGetSettings(const HttpRequest &req, HttpResponse *resp
 void ConfigHandler::handleUpdateAppConfig(const HttpRequest &req, HttpResponse *resp, const MiniMuduo::net::TcpConnectionPtr &conn)
 {
     std::weak_ptr<MiniMuduo::net::TcpConnection> weakConn(conn);
-    std::string requestBody = req.body_;
+    std::string requestBody(req.bodyView());
 
     auto work = [repo = repo_, weakConn, requestBody]()
     {
@@ -224,7 +224,7 @@ void ConfigHandler::handleUpdateAppConfig(const HttpRequest &req, HttpResponse *
 void ConfigHandler::handleUpdatePrompts(const HttpRequest &req, HttpResponse *resp, const MiniMuduo::net::TcpConnectionPtr &conn)
 {
     std::weak_ptr<MiniMuduo::net::TcpConnection> weakConn(conn);
-    std::string requestBody = req.body_;
+    std::string requestBody(req.bodyView());
 
     auto work = [repo = repo_, weakConn, requestBody]()
     {
@@ -286,7 +286,7 @@ void ConfigHandler::handleUpdatePrompts(const HttpRequest &req, HttpResponse *re
 void ConfigHandler::handleUpdateChannels(const HttpRequest &req, HttpResponse *resp, const MiniMuduo::net::TcpConnectionPtr &conn)
 {
     std::weak_ptr<MiniMuduo::net::TcpConnection> weakConn(conn);
-    std::string requestBody = req.body_;
+    std::string requestBody(req.bodyView());
 
     auto work = [repo = repo_, weakConn, requestBody]()
     {
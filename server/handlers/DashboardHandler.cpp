@@ -12,6 +12,7 @@ nlohmann::json BuildDashboardSnapshotJson(const SystemRuntimeSnapshot& snapshot)
     body["overview"] = {
         {"total_logs", snapshot.overview.total_logs},
         {"ai_call_total", snapshot.overview.ai_call_total},
+        {"ai_cache_hit_total", snapshot.overview.ai_cache_hit_total},
         {"ai_queue_wait_ms", snapshot.overview.ai_queue_wait_ms},
         {"ai_inference_latency_ms", snapshot.overview.ai_inference_latency_ms},
         {"memory_rss_mb", snapshot.overview.memory_rss_mb},
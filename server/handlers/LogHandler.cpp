@@ -1,304 +1,16 @@
 #include "handlers/LogHandler.h"
 #include "core/SystemRuntimeAccumulator.h"
 #include "core/TraceSessionManager.h"
-#include <algorithm>
-#include <cctype>
 #include <nlohmann/json.hpp>
 
-namespace
-{
-std::string toLowerCopy(std::string value)
-{
-    std::transform(value.begin(), value.end(), value.begin(), [](unsigned char c) {
-        return static_cast<char>(std::tolower(c));
-    });
-    return value;
-}
-
-std::string JsonValueToAttributeString(const nlohmann::json& value)
-{
-    if (value.is_string()) {
-        return value.get<std::string>();
-    }
-    return value.dump();
-}
-
-bool IsKnownTraceSpanField(const std::string& key)
-{
-    static const std::unordered_set<std::string> known_fields = {
-        "trace_key",
-        "trace_id",
-        "span_id",
-        "parent_span_id",
-        "start_time_ms",
-        "end_time_ms",
-        "name",
-        "service_name",
-        "status",
-        "kind",
-        "attributes"
-    };
-    return known_fields.find(key) != known_fields.end();
-}
-
-bool ParseOptionalBoolByField(const nlohmann::json& body,
-                              const std::string& field,
-                              std::optional<bool>* out,
-                              std::string* error)
-{
-    if (field.empty()) {
-        return true;
-    }
-    if (!body.contains(field) || body.at(field).is_null()) {
-        return true;
-    }
-    const nlohmann::json& value = body.at(field);
-    if (!value.is_boolean()) {
-        *error = std::string("Field must be bool: ") + field;
-        return false;
-    }
-    *out = value.get<bool>();
-    return true;
-}
-
-bool ParseConfiguredTraceEnd(const nlohmann::json& body,
-                             const std::string& primary_field,
-                             const std::vector<std::string>& aliases,
-                             std::optional<bool>* out,
-                             std::string* error)
-{
-    std::optional<bool> parsed;
-    // 这里明确采用“主字段优先，别名顺序回退”的规则：
-    // 既然 Settings 已经允许用户指定主字段名，那么主字段一旦命中，就不再继续看别名；
-    // 如果主字段没出现，再按别名列表顺序找第一个合法 bool，避免同一条请求里被多个名字来回覆盖。
-    if (!ParseOptionalBoolByField(body, primary_field, &parsed, error)) {
-        return false;
-    }
-    if (parsed.has_value()) {
-        *out = parsed;
-        return true;
-    }
-
-    for (const std::string& alias : aliases) {
-        parsed.reset();
-        if (!ParseOptionalBoolByField(body, alias, &parsed, error)) {
-            return false;
-        }
-        if (parsed.has_value()) {
-            *out = parsed;
-            return true;
-        }
-    }
-    return true;
-}
-
-void CollectUnknownTopLevelAttributes(const nlohmann::json& body,
-                                      const std::unordered_set<std::string>& dynamic_known_fields,
-                                      std::unordered_map<std::string, std::string>* attributes)
-{
-    for (auto it = body.begin(); it != body.end(); ++it) {
-        if (IsKnownTraceSpanField(it.key()) ||
-            dynamic_known_fields.find(it.key()) != dynamic_known_fields.end()) {
-            continue;
-        }
-        // 顶层未知字段统一收敛到 attributes，目的是让客户端新增指标时服务端无需立刻改协议。
-        // dynamic_known_fields 会额外带上当前请求生效的 trace_end 主字段和别名，
-        // 避免这些字段一边被标准化成 span.trace_end，一边又脏兮兮地落进 attributes。
-        // 这里用 emplace 不覆盖已存在键，确保显式 attributes 的值优先级更高，避免歧义覆盖。
-        attributes->emplace(it.key(), JsonValueToAttributeString(it.value()));
-    }
-}
-
-bool ParseRequiredUint(const nlohmann::json& body, const char* field, size_t* out, std::string* error)
-{
-    if (!body.contains(field)) {
-        *error = std::string("Missing required field: ") + field;
-        return false;
-    }
-    const nlohmann::json& value = body.at(field);
-    if (!value.is_number_integer() && !value.is_number_unsigned()) {
-        *error = std::string("Field must be integer: ") + field;
-        return false;
-    }
-    const int64_t parsed = value.get<int64_t>();
-    if (parsed < 0) {
-        *error = std::string("Field must be non-negative: ") + field;
-        return false;
-    }
-    *out = static_cast<size_t>(parsed);
-    return true;
-}
-
-bool ParseOptionalUint(const nlohmann::json& body, const char* field, std::optional<size_t>* out, std::string* error)
-{
-    if (!body.contains(field) || body.at(field).is_null()) {
-        return true;
-    }
-    size_t value = 0;
-    if (!ParseRequiredUint(body, field, &value, error)) {
-        return false;
-    }
-    *out = value;
-    return true;
-}
-
-bool ParseRequiredInt64(const nlohmann::json& body, const char* field, int64_t* out, std::string* error)
-{
-    if (!body.contains(field)) {
-        *error = std::string("Missing required field: ") + field;
-        return false;
-    }
-    const nlohmann::json& value = body.at(field);
-    if (!value.is_number_integer() && !value.is_number_unsigned()) {
-        *error = std::string("Field must be integer: ") + field;
-        return false;
-    }
-    *out = value.get<int64_t>();
-    return true;
-}
-
-bool ParseOptionalInt64(const nlohmann::json& body, const char* field, std::optional<int64_t>* out, std::string* error)
-{
-    if (!body.contains(field) || body.at(field).is_null()) {
-        return true;
-    }
-    int64_t value = 0;
-    if (!ParseRequiredInt64(body, field, &value, error)) {
-        return false;
-    }
-    *out = value;
-    return true;
-}
-
-bool ParseRequiredString(const nlohmann::json& body, const char* field, std::string* out, std::string* error)
-{
-    if (!body.contains(field)) {
-        *error = std::string("Missing required field: ") + field;
-        return false;
-    }
-    const nlohmann::json& value = body.at(field);
-    if (!value.is_string()) {
-        *error = std::string("Field must be string: ") + field;
-        return false;
-    }
-    *out = value.get<std::string>();
-    return true;
-}
-
-bool ParseOptionalBool(const nlohmann::json& body, const char* field, std::optional<bool>* out, std::string* error)
-{
-    if (!body.contains(field) || body.at(field).is_null()) {
-        return true;
-    }
-    const nlohmann::json& value = body.at(field);
-    if (!value.is_boolean()) {
-        *error = std::string("Field must be bool: ") + field;
-        return false;
-    }
-    *out = value.get<bool>();
-    return true;
-}
-
-bool ParseOptionalStatus(const nlohmann::json& body, std::optional<SpanEvent::Status>* status, std::string* error)
-{
-    if (!body.contains("status") || body.at("status").is_null()) {
-        return true;
-    }
-    const nlohmann::json& value = body.at("status");
-    if (!value.is_string()) {
-        *error = "Field must be string: status";
-        return false;
-    }
-
-    const std::string lower = toLowerCopy(value.get<std::string>());
-    if (lower == "unset") {
-        *status = SpanEvent::Status::Unset;
-        return true;
-    }
-    if (lower == "ok") {
-        *status = SpanEvent::Status::Ok;
-        return true;
-    }
-    if (lower == "error") {
-        *status = SpanEvent::Status::Error;
-        return true;
-    }
-
-    *error = "Invalid status, expected one of: UNSET/OK/ERROR";
-    return false;
-}
-
-bool ParseOptionalKind(const nlohmann::json& body, std::optional<SpanEvent::Kind>* kind, std::string* error)
-{
-    if (!body.contains("kind") || body.at("kind").is_null()) {
-        return true;
-    }
-    const nlohmann::json& value = body.at("kind");
-    if (!value.is_string()) {
-        *error = "Field must be string: kind";
-        return false;
-    }
-
-    const std::string lower = toLowerCopy(value.get<std::string>());
-    if (lower == "internal") {
-        *kind = SpanEvent::Kind::Internal;
-        return true;
-    }
-    if (lower == "server") {
-        *kind = SpanEvent::Kind::Server;
-        return true;
-    }
-    if (lower == "client") {
-        *kind = SpanEvent::Kind::Client;
-        return true;
-    }
-    if (lower == "producer") {
-        *kind = SpanEvent::Kind::Producer;
-        return true;
-    }
-    if (lower == "consumer") {
-        *kind = SpanEvent::Kind::Consumer;
-        return true;
-    }
-
-    *error = "Invalid kind, expected one of: INTERNAL/SERVER/CLIENT/PRODUCER/CONSUMER";
-    return false;
-}
-
-bool ParseOptionalAttributes(const nlohmann::json& body,
-                             std::unordered_map<std::string, std::string>* attributes,
-                             std::string* error)
-{
-    if (!body.contains("attributes") || body.at("attributes").is_null()) {
-        return true;
-    }
-    const nlohmann::json& value = body.at("attributes");
-    if (!value.is_object()) {
-        *error = "Field must be object: attributes";
-        return false;
-    }
-
-    for (auto it = value.begin(); it != value.end(); ++it) {
-        // 统一转字符串是为了让 TraceSessionManager 的最小模型稳定，后续再按类型升级。
-        (*attributes)[it.key()] = JsonValueToAttributeString(it.value());
-    }
-    return true;
-}
-} // namespace
-
 LogHandler::LogHandler(TraceSessionManager* trace_session_manager,
                        SystemRuntimeAccumulator* system_runtime_accumulator,
                        std::string trace_end_field,
                        std::vector<std::string> trace_end_aliases)
     : trace_session_manager_(trace_session_manager),
       system_runtime_accumulator_(system_runtime_accumulator),
-      trace_end_field_(trace_end_field.empty() ? "trace_end" : std::move(trace_end_field)),
-      trace_end_aliases_(std::move(trace_end_aliases))
+      span_parser_(std::move(trace_end_field), std::move(trace_end_aliases))
 {
-    // 主字段和别名已经被收口成冷启动配置，所以这里直接在构造时预展开 known field 集合。
-    // 这样 handleTracePost() 里既不用每次读快照，也不用每次为了过滤 attributes 临时拼一遍 set。
-    trace_end_known_fields_.insert(trace_end_field_);
-    trace_end_known_fields_.insert(trace_end_aliases_.begin(), trace_end_aliases_.end());
 }
 
 void LogHandler::handleTracePost(const HttpRequest &req, HttpResponse *resp, const MiniMuduo::net::TcpConnectionPtr &conn)
@@ -313,59 +25,26 @@ void LogHandler::handleTracePost(const HttpRequest &req, HttpResponse *resp, con
         return;
     }
 
-    nlohmann::json body;
-    try {
-        body = nlohmann::json::parse(req.body_);
-    } catch (const nlohmann::json::parse_error&) {
+    // 单条入口是最热的路径：这里直接用单遍解析器从 body 字节流填 SpanEvent，
+    // 不再先建一棵 nlohmann DOM 再逐字段 contains/at 查找；错误文案和旧 DOM 口径保持一致。
+    SpanEvent span;
+    std::string error;
+    const TraceSpanParser::Status parse_status = span_parser_.ParseBody(req.bodyView(), &span, &error);
+    if (parse_status == TraceSpanParser::Status::InvalidJson) {
         resp->setStatusCode(HttpResponse::HttpStatusCode::k400BadRequest);
         resp->body_ = "{\"error\": \"Invalid JSON body\"}";
         return;
     }
-
-    if (!body.is_object()) {
+    if (parse_status == TraceSpanParser::Status::NotObject) {
         resp->setStatusCode(HttpResponse::HttpStatusCode::k400BadRequest);
         resp->body_ = "{\"error\": \"Body must be a JSON object\"}";
         return;
     }
-
-    SpanEvent span;
-    std::string error;
-    if (body.contains("trace_key")) {
-        if (!ParseRequiredUint(body, "trace_key", &span.trace_key, &error)) {
-            resp->setStatusCode(HttpResponse::HttpStatusCode::k400BadRequest);
-            resp->body_ = nlohmann::json{{"error", error}}.dump();
-            return;
-        }
-    } else if (body.contains("trace_id")) {
-        // 兼容 trace_id 别名是为了降低接入方切换成本，避免首版就要求全量改字段名。
-        if (!ParseRequiredUint(body, "trace_id", &span.trace_key, &error)) {
-            resp->setStatusCode(HttpResponse::HttpStatusCode::k400BadRequest);
-            resp->body_ = nlohmann::json{{"error", error}}.dump();
-            return;
-        }
-    } else {
-        resp->setStatusCode(HttpResponse::HttpStatusCode::k400BadRequest);
-        resp->body_ = "{\"error\": \"Missing required field: trace_key\"}";
-        return;
-    }
-
-    if (!ParseRequiredUint(body, "span_id", &span.span_id, &error) ||
-        !ParseRequiredInt64(body, "start_time_ms", &span.start_time_ms, &error) ||
-        !ParseRequiredString(body, "name", &span.name, &error) ||
-        !ParseRequiredString(body, "service_name", &span.service_name, &error) ||
-        !ParseOptionalUint(body, "parent_span_id", &span.parent_span_id, &error) ||
-        !ParseOptionalInt64(body, "end_time_ms", &span.end_time, &error) ||
-        !ParseConfiguredTraceEnd(body, trace_end_field_, trace_end_aliases_, &span.trace_end, &error) ||
-        !ParseOptionalStatus(body, &span.status, &error) ||
-        !ParseOptionalKind(body, &span.kind, &error) ||
-        !ParseOptionalAttributes(body, &span.attributes, &error)) {
+    if (parse_status != TraceSpanParser::Status::Ok) {
         resp->setStatusCode(HttpResponse::HttpStatusCode::k400BadRequest);
         resp->body_ = nlohmann::json{{"error", error}}.dump();
         return;
     }
-    // 顶层未知字段收集也跟着这份冷启动口径走：
-    // 既然主字段/别名在进程启动后就固定了，这里直接复用构造期准备好的 known field 集合即可。
-    CollectUnknownTopLevelAttributes(body, trace_end_known_fields_, &span.attributes);
 
     const TraceSessionManager::PushResult push_result = trace_session_manager_->Push(span);
     if (push_result == TraceSessionManager::PushResult::RejectedUnavailable) {
@@ -405,3 +84,196 @@ void LogHandler::handleTracePost(const HttpRequest &req, HttpResponse *resp, con
     }
     resp->body_ = response_body.dump();
 }
+
+void LogHandler::handleTraceBatchPost(const HttpRequest &req, HttpResponse *resp, const MiniMuduo::net::TcpConnectionPtr &conn)
+{
+    (void)conn;
+    resp->setHeader("Content-Type", "application/json");
+    resp->addCorsHeaders();
+
+    if (!trace_session_manager_) {
+        resp->setStatusCode(HttpResponse::HttpStatusCode::k503ServiceUnavailable);
+        resp->body_ = "{\"error\": \"Trace pipeline is unavailable\"}";
+        return;
+    }
+
+    // 每条输入先落成一个 item：解析成功的带上 SpanEvent，失败的只留错误文本。
+    // 这样后面 Push 结果和解析错误可以按原始 index 合并回一份逐条结果。
+    struct BatchItem
+    {
+        std::optional<SpanEvent> span;
+        std::string error;
+    };
+    std::vector<BatchItem> items;
+
+    // body 统一按 view 读：零拷贝解析模式下它直接指向连接 Buffer，下面逐行切分也不会产生拷贝。
+    const std::string_view request_body = req.bodyView();
+    const size_t first = request_body.find_first_not_of(" \t\r\n");
+    if (first != std::string_view::npos && request_body[first] == '[') {
+        // JSON 数组形态：整体语法错误没法定位到哪一条，直接按整包 400 处理。
+        nlohmann::json body;
+        try {
+            body = nlohmann::json::parse(request_body);
+        } catch (const nlohmann::json::parse_error&) {
+            resp->setStatusCode(HttpResponse::HttpStatusCode::k400BadRequest);
+            resp->body_ = "{\"error\": \"Invalid JSON body\"}";
+            return;
+        }
+        if (body.size() > kMaxBatchSpans) {
+            resp->setStatusCode(HttpResponse::HttpStatusCode::k400BadRequest);
+            resp->body_ = nlohmann::json{
+                {"error", "Batch exceeds max span count: " + std::to_string(kMaxBatchSpans)}
+            }.dump();
+            return;
+        }
+        items.resize(body.size());
+        for (size_t i = 0; i < body.size(); ++i) {
+            const nlohmann::json& element = body[i];
+            SpanEvent span;
+            const TraceSpanParser::Status parse_status = span_parser_.ParseObject(element, &span, &items[i].error);
+            if (parse_status == TraceSpanParser::Status::NotObject) {
+                items[i].error = "Span must be a JSON object";
+            } else if (parse_status == TraceSpanParser::Status::Ok) {
+                items[i].span = std::move(span);
+            }
+        }
+    } else {
+        // NDJSON 形态：逐行解析，空行跳过；某一行坏了只影响这一行，不拖累同批其他 span。
+        size_t line_begin = 0;
+        while (line_begin < request_body.size()) {
+            size_t line_end = request_body.find('\n', line_begin);
+            if (line_end == std::string_view::npos) {
+                line_end = request_body.size();
+            }
+            const size_t content_begin = request_body.find_first_not_of(" \t\r", line_begin);
+            if (content_begin != std::string_view::npos && content_begin < line_end) {
+                if (items.size() >= kMaxBatchSpans) {
+                    resp->setStatusCode(HttpResponse::HttpStatusCode::k400BadRequest);
+                    resp->body_ = nlohmann::json{
+                        {"error", "Batch exceeds max span count: " + std::to_string(kMaxBatchSpans)}
+                    }.dump();
+                    return;
+                }
+                // NDJSON 每一行本身就是一个完整 span 对象，正好复用单条入口的单遍解析器。
+                BatchItem item;
+                SpanEvent span;
+                const std::string_view line = request_body.substr(line_begin, line_end - line_begin);
+                const TraceSpanParser::Status parse_status = span_parser_.ParseBody(line, &span, &item.error);
+                if (parse_status == TraceSpanParser::Status::InvalidJson) {
+                    item.error = "Invalid JSON line";
+                } else if (parse_status == TraceSpanParser::Status::NotObject) {
+                    item.error = "Span must be a JSON object";
+                } else if (parse_status == TraceSpanParser::Status::Ok) {
+                    item.span = std::move(span);
+                }
+                items.push_back(std::move(item));
+            }
+            line_begin = line_end + 1;
+        }
+    }
+
+    if (items.empty()) {
+        resp->setStatusCode(HttpResponse::HttpStatusCode::k400BadRequest);
+        resp->body_ = "{\"error\": \"Batch must contain at least one span\"}";
+        return;
+    }
+
+    // 只把解析成功的 span 交给 manager；push_index 记录它们在 items 里的原始位置。
+    std::vector<SpanEvent> spans;
+    std::vector<size_t> push_index;
+    spans.reserve(items.size());
+    push_index.reserve(items.size());
+    for (size_t i = 0; i < items.size(); ++i) {
+        if (items[i].span.has_value()) {
+            push_index.push_back(i);
+            spans.push_back(std::move(*items[i].span));
+        }
+    }
+    const std::vector<TraceSessionManager::PushResult> push_results =
+        trace_session_manager_->PushBatch(spans);
+
+    size_t accepted_count = 0;
+    size_t deferred_count = 0;
+    size_t overload_count = 0;
+    size_t unavailable_count = 0;
+    std::vector<nlohmann::json> per_item(items.size());
+    for (size_t i = 0; i < items.size(); ++i) {
+        if (!items[i].span.has_value()) {
+            per_item[i] = nlohmann::json{
+                {"index", i},
+                {"accepted", false},
+                {"retryable", false},
+                {"error", items[i].error}
+            };
+        }
+    }
+    for (size_t k = 0; k < spans.size(); ++k) {
+        const size_t i = push_index[k];
+        const SpanEvent& span = spans[k];
+        nlohmann::json entry{
+            {"index", i},
+            {"trace_key", span.trace_key},
+            {"span_id", span.span_id}
+        };
+        switch (push_results[k]) {
+        case TraceSessionManager::PushResult::Accepted:
+            entry["accepted"] = true;
+            ++accepted_count;
+            break;
+        case TraceSessionManager::PushResult::AcceptedDeferred:
+            entry["accepted"] = true;
+            entry["deferred"] = true;
+            ++accepted_count;
+            ++deferred_count;
+            break;
+        case TraceSessionManager::PushResult::RejectedOverload:
+            // 过载拒绝是可重试的：调用方应按 index 只重发这几条，而不是整批重放。
+            entry["accepted"] = false;
+            entry["retryable"] = true;
+            entry["error"] = "Trace pipeline is overloaded";
+            ++overload_count;
+            break;
+        case TraceSessionManager::PushResult::RejectedUnavailable:
+            entry["accepted"] = false;
+            entry["retryable"] = true;
+            entry["error"] = "Trace pipeline is unavailable";
+            ++unavailable_count;
+            break;
+        }
+        per_item[i] = std::move(entry);
+    }
+    nlohmann::json results = nlohmann::json::array();
+    for (auto& entry : per_item) {
+        results.push_back(std::move(entry));
+    }
+
+    if (system_runtime_accumulator_ && accepted_count > 0) {
+        // 和单条入口同一口径：只累计入口真正接住的 span 数，被拒绝的不算。
+        system_runtime_accumulator_->RecordAcceptedLogs(accepted_count);
+    }
+
+    nlohmann::json response_body{
+        {"accepted_count", accepted_count},
+        {"rejected_count", items.size() - accepted_count},
+        {"results", std::move(results)}
+    };
+    if (deferred_count > 0) {
+        response_body["deferred_count"] = deferred_count;
+    }
+    if (overload_count > 0) {
+        // 只要批次里出现过载拒绝，就带上 Retry-After，方便调用方对被拒绝的子集做统一退避。
+        resp->setHeader("Retry-After", "1");
+        response_body["retry_after_seconds"] = 1;
+    }
+
+    // 返回码口径：至少收下一条就是 202（逐条结果看 results）；
+    // 一条都没收下时，按主要拒绝原因退化成和单条入口一致的 503/400。
+    if (accepted_count > 0) {
+        resp->setStatusCode(HttpResponse::HttpStatusCode::k202Acceptd);
+    } else if (overload_count > 0 || unavailable_count > 0) {
+        resp->setStatusCode(HttpResponse::HttpStatusCode::k503ServiceUnavailable);
+    } else {
+        resp->setStatusCode(HttpResponse::HttpStatusCode::k400BadRequest);
+    }
+    resp->body_ = response_body.dump();
+}
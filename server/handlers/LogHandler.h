@@ -1,13 +1,14 @@
 #pragma once
 #include "http/HttpRequest.h"
 #include "http/HttpResponse.h"
+#include "handlers/TraceSpanParser.h"
 #include <MiniMuduo/net/TcpConnection.h>
 #include <string>
-#include <unordered_set>
 #include <vector>
 
 class TraceSessionManager;
 class SystemRuntimeAccumulator;
+struct SpanEvent;
 
 class LogHandler {
 public:
@@ -25,14 +26,18 @@ public:
                std::vector<std::string> trace_end_aliases = {});
 
     void handleTracePost(const HttpRequest& req, HttpResponse* resp, const MiniMuduo::net::TcpConnectionPtr& conn);
+    // `/logs/spans:batch` 一次收多条 span，body 可以是 JSON 数组，也可以是 NDJSON（一行一个 span 对象）。
+    // 单条 span 的字段口径和 `/logs/spans` 完全一致；响应里逐条回报 accepted/rejected，
+    // 这样部分过载时调用方只需要按 index 重发被拒绝的那几条。
+    void handleTraceBatchPost(const HttpRequest& req, HttpResponse* resp, const MiniMuduo::net::TcpConnectionPtr& conn);
+
+    // 单个批次最多接收的 span 数量；超过直接 400，避免一个请求把整轮聚合锁和内存都吃满。
+    static constexpr size_t kMaxBatchSpans = 1000;
 
 private:
     TraceSessionManager* trace_session_manager_ = nullptr;
     SystemRuntimeAccumulator* system_runtime_accumulator_ = nullptr;
-    // 结束字段口径在构造时固定下来，后续请求直接复用，避免再为这两个冷启动字段做按请求快照读取。
-    std::string trace_end_field_;
-    std::vector<std::string> trace_end_aliases_;
-    // 顶层未知字段收集每次请求都会用到这组字段名；既然主字段和别名已经是冷启动配置，
-    // 那就一并在构造时预展开成 set，避免每个请求重复插入。
-    std::unordered_set<std::string> trace_end_known_fields_;
+    // 单条 span 的解析口径（含 trace_end 主字段/别名这份冷启动配置）统一收在 TraceSpanParser 里，
+    // 单条入口、NDJSON 和 JSON 数组三条路径共用同一个实例，保证字段语义不会分叉。
+    TraceSpanParser span_parser_;
 };
@@ -5,6 +5,7 @@
 #include "MiniMuduo/net/EventLoop.h"
 #include <nlohmann/json.hpp>
 
+#include <charconv>
 #include <optional>
 #include <string>
 
@@ -94,6 +95,36 @@ bool ParseOptionalSizeField(const nlohmann::json& body,
     return true;
 }
 
+// 游标对前端是不透明字符串，格式是 "<start_time_ms>:<trace_id>"，就是上一页最后一条的排序键。
+std::string EncodeSearchCursor(const TraceSearchCursor& cursor)
+{
+    return std::to_string(cursor.start_time_ms) + ":" + cursor.trace_id;
+}
+
+bool DecodeSearchCursor(const std::string& text, TraceSearchCursor* cursor)
+{
+    const size_t colon = text.find(':');
+    if (colon == std::string::npos || colon == 0 || colon + 1 >= text.size()) {
+        return false;
+    }
+    int64_t start_time_ms = 0;
+    const char* begin = text.data();
+    const auto [start_end, start_ec] = std::from_chars(begin, begin + colon, start_time_ms);
+    if (start_ec != std::errc() || start_end != begin + colon) {
+        return false;
+    }
+    uint64_t trace_key = 0;
+    const char* id_begin = begin + colon + 1;
+    const char* id_end = begin + text.size();
+    const auto [id_ptr, id_ec] = std::from_chars(id_begin, id_end, trace_key);
+    if (id_ec != std::errc() || id_ptr != id_end) {
+        return false;
+    }
+    cursor->start_time_ms = start_time_ms;
+    cursor->trace_id = text.substr(colon + 1);
+    return true;
+}
+
 std::string StripQueryString(const std::string& raw_path)
 {
     const size_t query_pos = raw_path.find('?');
@@ -123,6 +154,7 @@ nlohmann::json BuildDebugSearchRequestJson(const TraceSearchRequest& request)
     root["risk_levels"] = request.risk_levels;
     root["page"] = request.page;
     root["page_size"] = request.page_size;
+    root["cursor"] = request.cursor.has_value() ? nlohmann::json(EncodeSearchCursor(*request.cursor)) : nlohmann::json(nullptr);
     return root;
 }
 
@@ -146,7 +178,10 @@ nlohmann::json BuildSearchResultJson(const TraceSearchResult& result)
 
     nlohmann::json root;
     root["total"] = result.total;
+    root["total_approximate"] = result.total_is_approximate;
     root["items"] = std::move(items);
+    root["next_cursor"] = result.next_cursor.has_value() ? nlohmann::json(EncodeSearchCursor(*result.next_cursor))
+                                                        : nlohmann::json(nullptr);
     return root;
 }
 
@@ -240,7 +275,7 @@ void TraceQueryHandler::handleSearchTraces(const HttpRequest& req,
 
     nlohmann::json body;
     try {
-        body = nlohmann::json::parse(req.body_);
+        body = nlohmann::json::parse(req.bodyView());
     } catch (const nlohmann::json::parse_error&) {
         resp->setStatusCode(HttpResponse::HttpStatusCode::k400BadRequest);
         resp->body_ = "{\"error\":\"Invalid JSON body\"}";
@@ -277,6 +312,22 @@ void TraceQueryHandler::handleSearchTraces(const HttpRequest& req,
         return;
     }
 
+    const std::optional<std::string> cursor_text = ParseOptionalStringField(body, "cursor", &error);
+    if (!error.empty()) {
+        resp->setStatusCode(HttpResponse::HttpStatusCode::k400BadRequest);
+        resp->body_ = nlohmann::json{{"error", error}}.dump();
+        return;
+    }
+    if (cursor_text.has_value()) {
+        TraceSearchCursor cursor;
+        if (!DecodeSearchCursor(*cursor_text, &cursor)) {
+            resp->setStatusCode(HttpResponse::HttpStatusCode::k400BadRequest);
+            resp->body_ = "{\"error\":\"Invalid cursor\"}";
+            return;
+        }
+        request.cursor = std::move(cursor);
+    }
+
     // 这里先在 Handler 层把分页边界收口，避免后续 repo 层再到处写同样的防御代码。
     if (request.page < 1) {
         request.page = 1;
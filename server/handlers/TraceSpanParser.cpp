@@ -0,0 +1,1139 @@
+#include "handlers/TraceSpanParser.h"
+#include "core/TraceSessionManager.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <utility>
+
+namespace
+{
+std::string toLowerCopy(std::string value)
+{
+    std::transform(value.begin(), value.end(), value.begin(), [](unsigned char c) {
+        return static_cast<char>(std::tolower(c));
+    });
+    return value;
+}
+
+std::string JsonValueToAttributeString(const nlohmann::json& value)
+{
+    if (value.is_string()) {
+        return value.get<std::string>();
+    }
+    return value.dump();
+}
+
+bool IsKnownTraceSpanField(std::string_view key)
+{
+    static const std::unordered_set<std::string_view> known_fields = {
+        "trace_key",
+        "trace_id",
+        "span_id",
+        "parent_span_id",
+        "start_time_ms",
+        "end_time_ms",
+        "name",
+        "service_name",
+        "status",
+        "kind",
+        "attributes"
+    };
+    return known_fields.find(key) != known_fields.end();
+}
+
+bool ParseStatusText(const std::string& text, std::optional<SpanEvent::Status>* status, std::string* error)
+{
+    const std::string lower = toLowerCopy(text);
+    if (lower == "unset") {
+        *status = SpanEvent::Status::Unset;
+        return true;
+    }
+    if (lower == "ok") {
+        *status = SpanEvent::Status::Ok;
+        return true;
+    }
+    if (lower == "error") {
+        *status = SpanEvent::Status::Error;
+        return true;
+    }
+
+    *error = "Invalid status, expected one of: UNSET/OK/ERROR";
+    return false;
+}
+
+bool ParseKindText(const std::string& text, std::optional<SpanEvent::Kind>* kind, std::string* error)
+{
+    const std::string lower = toLowerCopy(text);
+    if (lower == "internal") {
+        *kind = SpanEvent::Kind::Internal;
+        return true;
+    }
+    if (lower == "server") {
+        *kind = SpanEvent::Kind::Server;
+        return true;
+    }
+    if (lower == "client") {
+        *kind = SpanEvent::Kind::Client;
+        return true;
+    }
+    if (lower == "producer") {
+        *kind = SpanEvent::Kind::Producer;
+        return true;
+    }
+    if (lower == "consumer") {
+        *kind = SpanEvent::Kind::Consumer;
+        return true;
+    }
+
+    *error = "Invalid kind, expected one of: INTERNAL/SERVER/CLIENT/PRODUCER/CONSUMER";
+    return false;
+}
+
+// ---------------- DOM 路径：对已解析好的 nlohmann::json 逐字段取值 ----------------
+
+bool ParseOptionalBoolByField(const nlohmann::json& body,
+                              const std::string& field,
+                              std::optional<bool>* out,
+                              std::string* error)
+{
+    if (field.empty()) {
+        return true;
+    }
+    if (!body.contains(field) || body.at(field).is_null()) {
+        return true;
+    }
+    const nlohmann::json& value = body.at(field);
+    if (!value.is_boolean()) {
+        *error = std::string("Field must be bool: ") + field;
+        return false;
+    }
+    *out = value.get<bool>();
+    return true;
+}
+
+bool ParseConfiguredTraceEnd(const nlohmann::json& body,
+                             const std::string& primary_field,
+                             const std::vector<std::string>& aliases,
+                             std::optional<bool>* out,
+                             std::string* error)
+{
+    std::optional<bool> parsed;
+    // 这里明确采用“主字段优先，别名顺序回退”的规则：
+    // 既然 Settings 已经允许用户指定主字段名，那么主字段一旦命中，就不再继续看别名；
+    // 如果主字段没出现，再按别名列表顺序找第一个合法 bool，避免同一条请求里被多个名字来回覆盖。
+    if (!ParseOptionalBoolByField(body, primary_field, &parsed, error)) {
+        return false;
+    }
+    if (parsed.has_value()) {
+        *out = parsed;
+        return true;
+    }
+
+    for (const std::string& alias : aliases) {
+        parsed.reset();
+        if (!ParseOptionalBoolByField(body, alias, &parsed, error)) {
+            return false;
+        }
+        if (parsed.has_value()) {
+            *out = parsed;
+            return true;
+        }
+    }
+    return true;
+}
+
+void CollectUnknownTopLevelAttributes(const nlohmann::json& body,
+                                      const std::unordered_set<std::string>& dynamic_known_fields,
+                                      std::unordered_map<std::string, std::string>* attributes)
+{
+    for (auto it = body.begin(); it != body.end(); ++it) {
+        if (IsKnownTraceSpanField(it.key()) ||
+            dynamic_known_fields.find(it.key()) != dynamic_known_fields.end()) {
+            continue;
+        }
+        // 顶层未知字段统一收敛到 attributes，目的是让客户端新增指标时服务端无需立刻改协议。
+        // dynamic_known_fields 会额外带上当前请求生效的 trace_end 主字段和别名，
+        // 避免这些字段一边被标准化成 span.trace_end，一边又脏兮兮地落进 attributes。
+        // 这里用 emplace 不覆盖已存在键，确保显式 attributes 的值优先级更高，避免歧义覆盖。
+        attributes->emplace(it.key(), JsonValueToAttributeString(it.value()));
+    }
+}
+
+bool ParseRequiredUint(const nlohmann::json& body, const char* field, size_t* out, std::string* error)
+{
+    if (!body.contains(field)) {
+        *error = std::string("Missing required field: ") + field;
+        return false;
+    }
+    const nlohmann::json& value = body.at(field);
+    if (!value.is_number_integer() && !value.is_number_unsigned()) {
+        *error = std::string("Field must be integer: ") + field;
+        return false;
+    }
+    const int64_t parsed = value.get<int64_t>();
+    if (parsed < 0) {
+        *error = std::string("Field must be non-negative: ") + field;
+        return false;
+    }
+    *out = static_cast<size_t>(parsed);
+    return true;
+}
+
+bool ParseOptionalUint(const nlohmann::json& body, const char* field, std::optional<size_t>* out, std::string* error)
+{
+    if (!body.contains(field) || body.at(field).is_null()) {
+        return true;
+    }
+    size_t value = 0;
+    if (!ParseRequiredUint(body, field, &value, error)) {
+        return false;
+    }
+    *out = value;
+    return true;
+}
+
+bool ParseRequiredInt64(const nlohmann::json& body, const char* field, int64_t* out, std::string* error)
+{
+    if (!body.contains(field)) {
+        *error = std::string("Missing required field: ") + field;
+        return false;
+    }
+    const nlohmann::json& value = body.at(field);
+    if (!value.is_number_integer() && !value.is_number_unsigned()) {
+        *error = std::string("Field must be integer: ") + field;
+        return false;
+    }
+    *out = value.get<int64_t>();
+    return true;
+}
+
+bool ParseOptionalInt64(const nlohmann::json& body, const char* field, std::optional<int64_t>* out, std::string* error)
+{
+    if (!body.contains(field) || body.at(field).is_null()) {
+        return true;
+    }
+    int64_t value = 0;
+    if (!ParseRequiredInt64(body, field, &value, error)) {
+        return false;
+    }
+    *out = value;
+    return true;
+}
+
+bool ParseRequiredString(const nlohmann::json& body, const char* field, std::string* out, std::string* error)
+{
+    if (!body.contains(field)) {
+        *error = std::string("Missing required field: ") + field;
+        return false;
+    }
+    const nlohmann::json& value = body.at(field);
+    if (!value.is_string()) {
+        *error = std::string("Field must be string: ") + field;
+        return false;
+    }
+    *out = value.get<std::string>();
+    return true;
+}
+
+bool ParseOptionalStatus(const nlohmann::json& body, std::optional<SpanEvent::Status>* status, std::string* error)
+{
+    if (!body.contains("status") || body.at("status").is_null()) {
+        return true;
+    }
+    const nlohmann::json& value = body.at("status");
+    if (!value.is_string()) {
+        *error = "Field must be string: status";
+        return false;
+    }
+    return ParseStatusText(value.get<std::string>(), status, error);
+}
+
+bool ParseOptionalKind(const nlohmann::json& body, std::optional<SpanEvent::Kind>* kind, std::string* error)
+{
+    if (!body.contains("kind") || body.at("kind").is_null()) {
+        return true;
+    }
+    const nlohmann::json& value = body.at("kind");
+    if (!value.is_string()) {
+        *error = "Field must be string: kind";
+        return false;
+    }
+    return ParseKindText(value.get<std::string>(), kind, error);
+}
+
+bool ParseOptionalAttributes(const nlohmann::json& body,
+                             std::unordered_map<std::string, std::string>* attributes,
+                             std::string* error)
+{
+    if (!body.contains("attributes") || body.at("attributes").is_null()) {
+        return true;
+    }
+    const nlohmann::json& value = body.at("attributes");
+    if (!value.is_object()) {
+        *error = "Field must be object: attributes";
+        return false;
+    }
+
+    for (auto it = value.begin(); it != value.end(); ++it) {
+        // 统一转字符串是为了让 TraceSessionManager 的最小模型稳定，后续再按类型升级。
+        (*attributes)[it.key()] = JsonValueToAttributeString(it.value());
+    }
+    return true;
+}
+
+// ---------------- 单遍路径：直接扫描 body 字节流 ----------------
+
+// 单遍扫描时先把每个已知字段的“最后一次出现的值”记下来，扫描结束后再按 DOM 路径的固定顺序做校验。
+// 这样既能一遍扫完，又能保证“同一个 body 报哪条错误”和 DOM 路径完全一致（DOM 里重复键也是后者覆盖前者）。
+struct CapturedValue
+{
+    enum class Type
+    {
+        Absent,
+        Null,
+        Bool,
+        Integer,
+        Float,
+        String,
+        Object,
+        Array
+    };
+    Type type = Type::Absent;
+    bool bool_value = false;
+    // 和 nlohmann 的 get<int64_t>() 对齐：超过 int64 上限的无符号数会按位转成负数，
+    // 于是后面 ParseRequiredUint 口径下会报 non-negative，而不是 integer。
+    int64_t int_value = 0;
+    std::string string_value;
+
+    bool IsAbsentOrNull() const { return type == Type::Absent || type == Type::Null; }
+};
+
+enum KnownField : size_t
+{
+    kTraceKey = 0,
+    kTraceId,
+    kSpanId,
+    kParentSpanId,
+    kStartTimeMs,
+    kEndTimeMs,
+    kName,
+    kServiceName,
+    kStatus,
+    kKind,
+    kAttributes,
+    kKnownFieldCount
+};
+
+constexpr std::string_view kKnownFieldNames[kKnownFieldCount] = {
+    "trace_key",
+    "trace_id",
+    "span_id",
+    "parent_span_id",
+    "start_time_ms",
+    "end_time_ms",
+    "name",
+    "service_name",
+    "status",
+    "kind",
+    "attributes"
+};
+
+size_t LookupKnownField(std::string_view key)
+{
+    for (size_t i = 0; i < kKnownFieldCount; ++i) {
+        if (kKnownFieldNames[i] == key) {
+            return i;
+        }
+    }
+    return kKnownFieldCount;
+}
+
+// 跳过嵌套对象/数组时允许的最大深度。SkipContainer 是递归实现，/logs/spans 的 body 又没有大小上限，
+// 一个几十万层的 [[[[… 就能把 IO 线程的栈打穿；正常 span 的 attributes 嵌套不过几层，超出直接按非法 JSON 处理。
+// 这是两条路径唯一有意不一致的地方：DOM 路径能解析的超深 body，这里返回 InvalidJson。
+constexpr size_t kMaxNestingDepth = 256;
+
+// JsonCursor 是一个只服务于 span body 的极简 JSON 词法器。
+// 它的合法性判断刻意跟 nlohmann 的 lexer 对齐（空白字符集合、BOM、UTF-8 校验、\u 代理对、数字语法），
+// 这样同一个 body 在两条路径上要么都是 "Invalid JSON body"，要么都能进入字段校验。
+class JsonCursor
+{
+public:
+    explicit JsonCursor(std::string_view input)
+        : data_(input.data()), size_(input.size())
+    {
+    }
+
+    size_t position() const { return pos_; }
+    bool AtEnd() const { return pos_ >= size_; }
+    char Peek() const { return pos_ < size_ ? data_[pos_] : '\0'; }
+    std::string_view Slice(size_t begin, size_t end) const { return std::string_view(data_ + begin, end - begin); }
+
+    void SkipBom()
+    {
+        if (size_ >= 3 &&
+            static_cast<unsigned char>(data_[0]) == 0xEF &&
+            static_cast<unsigned char>(data_[1]) == 0xBB &&
+            static_cast<unsigned char>(data_[2]) == 0xBF) {
+            pos_ = 3;
+        }
+    }
+
+    void SkipWhitespace()
+    {
+        while (pos_ < size_) {
+            const char c = data_[pos_];
+            if (c != ' ' && c != '\t' && c != '\n' && c != '\r') {
+                return;
+            }
+            ++pos_;
+        }
+    }
+
+    bool Consume(char expected)
+    {
+        if (pos_ < size_ && data_[pos_] == expected) {
+            ++pos_;
+            return true;
+        }
+        return false;
+    }
+
+    // 解析一个 JSON 字符串并写出解码后的内容；out 为空时只校验并跳过。
+    bool ParseString(std::string* out)
+    {
+        if (!Consume('"')) {
+            return false;
+        }
+        if (out) {
+            out->clear();
+        }
+        size_t run_begin = pos_;
+        while (pos_ < size_) {
+            const unsigned char c = static_cast<unsigned char>(data_[pos_]);
+            if (c == '"') {
+                if (out) {
+                    out->append(data_ + run_begin, pos_ - run_begin);
+                }
+                ++pos_;
+                return true;
+            }
+            if (c == '\\') {
+                if (out) {
+                    out->append(data_ + run_begin, pos_ - run_begin);
+                }
+                ++pos_;
+                if (!ParseEscape(out)) {
+                    return false;
+                }
+                run_begin = pos_;
+                continue;
+            }
+            if (c < 0x20) {
+                return false;
+            }
+            if (c < 0x80) {
+                ++pos_;
+                continue;
+            }
+            if (!SkipUtf8Sequence()) {
+                return false;
+            }
+        }
+        return false;
+    }
+
+    struct NumberToken
+    {
+        size_t begin = 0;
+        size_t end = 0;
+        bool is_integer = false;
+        bool negative = false;
+        uint64_t magnitude = 0;
+    };
+
+    // 数字语法按 RFC 8259：-?(0|[1-9][0-9]*)(\.[0-9]+)?([eE][+-]?[0-9]+)?
+    // 不带小数和指数、且能放进 int64/uint64 的算整数；其余（含溢出）按 nlohmann 口径都算浮点数。
+    bool ParseNumber(NumberToken* token)
+    {
+        token->begin = pos_;
+        token->negative = Consume('-');
+        if (pos_ >= size_ || !IsDigit(data_[pos_])) {
+            return false;
+        }
+        bool overflow = false;
+        uint64_t magnitude = 0;
+        if (data_[pos_] == '0') {
+            ++pos_;
+        } else {
+            while (pos_ < size_ && IsDigit(data_[pos_])) {
+                const uint64_t digit = static_cast<uint64_t>(data_[pos_] - '0');
+                if (magnitude > (std::numeric_limits<uint64_t>::max() - digit) / 10) {
+                    overflow = true;
+                } else {
+                    magnitude = magnitude * 10 + digit;
+                }
+                ++pos_;
+            }
+        }
+        bool is_integer = true;
+        if (Consume('.')) {
+            is_integer = false;
+            if (pos_ >= size_ || !IsDigit(data_[pos_])) {
+                return false;
+            }
+            while (pos_ < size_ && IsDigit(data_[pos_])) {
+                ++pos_;
+            }
+        }
+        if (pos_ < size_ && (data_[pos_] == 'e' || data_[pos_] == 'E')) {
+            is_integer = false;
+            ++pos_;
+            if (pos_ < size_ && (data_[pos_] == '+' || data_[pos_] == '-')) {
+                ++pos_;
+            }
+            if (pos_ >= size_ || !IsDigit(data_[pos_])) {
+                return false;
+            }
+            while (pos_ < size_ && IsDigit(data_[pos_])) {
+                ++pos_;
+            }
+        }
+        const uint64_t negative_limit = static_cast<uint64_t>(std::numeric_limits<int64_t>::max()) + 1;
+        if (overflow || (token->negative && magnitude > negative_limit)) {
+            is_integer = false;
+        }
+        token->end = pos_;
+        token->is_integer = is_integer;
+        token->magnitude = magnitude;
+        return true;
+    }
+
+    bool ParseLiteral(std::string_view literal)
+    {
+        if (size_ - pos_ < literal.size() || std::string_view(data_ + pos_, literal.size()) != literal) {
+            return false;
+        }
+        pos_ += literal.size();
+        return true;
+    }
+
+    // 校验并跳过任意 JSON 值；对象/数组递归处理。
+    bool SkipValue()
+    {
+        switch (Peek()) {
+        case '"':
+            return ParseString(nullptr);
+        case '{':
+            return SkipContainer('{', '}', true);
+        case '[':
+            return SkipContainer('[', ']', false);
+        case 't':
+            return ParseLiteral("true");
+        case 'f':
+            return ParseLiteral("false");
+        case 'n':
+            return ParseLiteral("null");
+        default: {
+            NumberToken token;
+            return ParseNumber(&token);
+        }
+        }
+    }
+
+private:
+    static bool IsDigit(char c) { return c >= '0' && c <= '9'; }
+
+    static int HexValue(char c)
+    {
+        if (c >= '0' && c <= '9') {
+            return c - '0';
+        }
+        if (c >= 'a' && c <= 'f') {
+            return c - 'a' + 10;
+        }
+        if (c >= 'A' && c <= 'F') {
+            return c - 'A' + 10;
+        }
+        return -1;
+    }
+
+    bool ParseHex4(uint32_t* out)
+    {
+        if (size_ - pos_ < 4) {
+            return false;
+        }
+        uint32_t value = 0;
+        for (int i = 0; i < 4; ++i) {
+            const int digit = HexValue(data_[pos_ + i]);
+            if (digit < 0) {
+                return false;
+            }
+            value = (value << 4) | static_cast<uint32_t>(digit);
+        }
+        pos_ += 4;
+        *out = value;
+        return true;
+    }
+
+    static void AppendUtf8(uint32_t codepoint, std::string* out)
+    {
+        if (codepoint < 0x80) {
+            out->push_back(static_cast<char>(codepoint));
+        } else if (codepoint < 0x800) {
+            out->push_back(static_cast<char>(0xC0 | (codepoint >> 6)));
+            out->push_back(static_cast<char>(0x80 | (codepoint & 0x3F)));
+        } else if (codepoint < 0x10000) {
+            out->push_back(static_cast<char>(0xE0 | (codepoint >> 12)));
+            out->push_back(static_cast<char>(0x80 | ((codepoint >> 6) & 0x3F)));
+            out->push_back(static_cast<char>(0x80 | (codepoint & 0x3F)));
+        } else {
+            out->push_back(static_cast<char>(0xF0 | (codepoint >> 18)));
+            out->push_back(static_cast<char>(0x80 | ((codepoint >> 12) & 0x3F)));
+            out->push_back(static_cast<char>(0x80 | ((codepoint >> 6) & 0x3F)));
+            out->push_back(static_cast<char>(0x80 | (codepoint & 0x3F)));
+        }
+    }
+
+    bool ParseEscape(std::string* out)
+    {
+        if (pos_ >= size_) {
+            return false;
+        }
+        const char c = data_[pos_++];
+        char decoded = 0;
+        switch (c) {
+        case '"': decoded = '"'; break;
+        case '\\': decoded = '\\'; break;
+        case '/': decoded = '/'; break;
+        case 'b': decoded = '\b'; break;
+        case 'f': decoded = '\f'; break;
+        case 'n': decoded = '\n'; break;
+        case 'r': decoded = '\r'; break;
+        case 't': decoded = '\t'; break;
+        case 'u': {
+            uint32_t codepoint = 0;
+            if (!ParseHex4(&codepoint)) {
+                return false;
+            }
+            if (codepoint >= 0xD800 && codepoint <= 0xDBFF) {
+                // 高代理必须紧跟一个 \u 低代理，否则和 nlohmann 一样按非法输入处理。
+                uint32_t low = 0;
+                if (!Consume('\\') || !Consume('u') || !ParseHex4(&low) || low < 0xDC00 || low > 0xDFFF) {
+                    return false;
+                }
+                codepoint = 0x10000 + ((codepoint - 0xD800) << 10) + (low - 0xDC00);
+            } else if (codepoint >= 0xDC00 && codepoint <= 0xDFFF) {
+                return false;
+            }
+            if (out) {
+                AppendUtf8(codepoint, out);
+            }
+            return true;
+        }
+        default:
+            return false;
+        }
+        if (out) {
+            out->push_back(decoded);
+        }
+        return true;
+    }
+
+    bool InRange(size_t offset, unsigned char low, unsigned char high) const
+    {
+        if (pos_ + offset >= size_) {
+            return false;
+        }
+        const unsigned char c = static_cast<unsigned char>(data_[pos_ + offset]);
+        return c >= low && c <= high;
+    }
+
+    // 按 RFC 3629 的合法区间校验一个多字节 UTF-8 序列（拒绝 overlong、代理区和超出 U+10FFFF 的编码）。
+    bool SkipUtf8Sequence()
+    {
+        const unsigned char c = static_cast<unsigned char>(data_[pos_]);
+        size_t length = 0;
+        if (c >= 0xC2 && c <= 0xDF) {
+            length = InRange(1, 0x80, 0xBF) ? 2 : 0;
+        } else if (c == 0xE0) {
+            length = (InRange(1, 0xA0, 0xBF) && InRange(2, 0x80, 0xBF)) ? 3 : 0;
+        } else if ((c >= 0xE1 && c <= 0xEC) || c == 0xEE || c == 0xEF) {
+            length = (InRange(1, 0x80, 0xBF) && InRange(2, 0x80, 0xBF)) ? 3 : 0;
+        } else if (c == 0xED) {
+            length = (InRange(1, 0x80, 0x9F) && InRange(2, 0x80, 0xBF)) ? 3 : 0;
+        } else if (c == 0xF0) {
+            length = (InRange(1, 0x90, 0xBF) && InRange(2, 0x80, 0xBF) && InRange(3, 0x80, 0xBF)) ? 4 : 0;
+        } else if (c >= 0xF1 && c <= 0xF3) {
+            length = (InRange(1, 0x80, 0xBF) && InRange(2, 0x80, 0xBF) && InRange(3, 0x80, 0xBF)) ? 4 : 0;
+        } else if (c == 0xF4) {
+            length = (InRange(1, 0x80, 0x8F) && InRange(2, 0x80, 0xBF) && InRange(3, 0x80, 0xBF)) ? 4 : 0;
+        }
+        if (length == 0) {
+            return false;
+        }
+        pos_ += length;
+        return true;
+    }
+
+    bool SkipContainer(char open, char close, bool is_object)
+    {
+        if (depth_ >= kMaxNestingDepth || !Consume(open)) {
+            return false;
+        }
+        // 递归出口都要把深度还回去，用一个小守卫省得每个 return 前手动减。
+        struct DepthGuard
+        {
+            size_t* depth;
+            ~DepthGuard() { --*depth; }
+        } guard{&depth_};
+        ++depth_;
+        SkipWhitespace();
+        if (Consume(close)) {
+            return true;
+        }
+        while (true) {
+            SkipWhitespace();
+            if (is_object) {
+                if (!ParseString(nullptr)) {
+                    return false;
+                }
+                SkipWhitespace();
+                if (!Consume(':')) {
+                    return false;
+                }
+                SkipWhitespace();
+            }
+            if (!SkipValue()) {
+                return false;
+            }
+            SkipWhitespace();
+            if (Consume(close)) {
+                return true;
+            }
+            if (!Consume(',')) {
+                return false;
+            }
+        }
+    }
+
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+    size_t pos_ = 0;
+    // 当前 SkipContainer 的递归层数，上限见 kMaxNestingDepth。
+    size_t depth_ = 0;
+};
+
+// 读一个任意值并转成 attributes 用的字符串，口径等同于 JsonValueToAttributeString：
+// 字符串取解码后的原文，标量按 nlohmann dump 的写法；对象/数组和浮点数这种少见情况，
+// 直接把原文交给 nlohmann 解析再 dump，保证键排序、转义和浮点格式跟 DOM 路径逐字节一致。
+bool ReadAttributeValue(JsonCursor* cursor, std::string* out)
+{
+    switch (cursor->Peek()) {
+    case '"':
+        return cursor->ParseString(out);
+    case 't':
+        *out = "true";
+        return cursor->ParseLiteral("true");
+    case 'f':
+        *out = "false";
+        return cursor->ParseLiteral("false");
+    case 'n':
+        *out = "null";
+        return cursor->ParseLiteral("null");
+    case '{':
+    case '[': {
+        const size_t begin = cursor->position();
+        if (!cursor->SkipValue()) {
+            return false;
+        }
+        const std::string_view raw = cursor->Slice(begin, cursor->position());
+        try {
+            *out = nlohmann::json::parse(raw.begin(), raw.end()).dump();
+        } catch (const nlohmann::json::parse_error&) {
+            return false;
+        }
+        return true;
+    }
+    default: {
+        JsonCursor::NumberToken token;
+        if (!cursor->ParseNumber(&token)) {
+            return false;
+        }
+        if (token.is_integer) {
+            if (!token.negative) {
+                *out = std::to_string(token.magnitude);
+            } else if (token.magnitude == 0) {
+                *out = "0";
+            } else {
+                *out = "-" + std::to_string(token.magnitude);
+            }
+            return true;
+        }
+        const std::string_view raw = cursor->Slice(token.begin, token.end);
+        try {
+            *out = nlohmann::json::parse(raw.begin(), raw.end()).dump();
+        } catch (const nlohmann::json::parse_error&) {
+            return false;
+        }
+        return true;
+    }
+    }
+}
+
+// 读一个值并只保留字段校验需要的信息；对象/数组只记类型，不展开。
+bool ReadCapturedValue(JsonCursor* cursor, CapturedValue* out)
+{
+    switch (cursor->Peek()) {
+    case '"':
+        out->type = CapturedValue::Type::String;
+        return cursor->ParseString(&out->string_value);
+    case 't':
+        out->type = CapturedValue::Type::Bool;
+        out->bool_value = true;
+        return cursor->ParseLiteral("true");
+    case 'f':
+        out->type = CapturedValue::Type::Bool;
+        out->bool_value = false;
+        return cursor->ParseLiteral("false");
+    case 'n':
+        out->type = CapturedValue::Type::Null;
+        return cursor->ParseLiteral("null");
+    case '{':
+        out->type = CapturedValue::Type::Object;
+        return cursor->SkipValue();
+    case '[':
+        out->type = CapturedValue::Type::Array;
+        return cursor->SkipValue();
+    default: {
+        JsonCursor::NumberToken token;
+        if (!cursor->ParseNumber(&token)) {
+            return false;
+        }
+        if (!token.is_integer) {
+            out->type = CapturedValue::Type::Float;
+            return true;
+        }
+        out->type = CapturedValue::Type::Integer;
+        if (token.negative) {
+            // magnitude 最大是 2^63，用无符号取反再转回 int64，避免 -INT64_MIN 的有符号溢出。
+            out->int_value = static_cast<int64_t>(~token.magnitude + 1);
+        } else {
+            out->int_value = static_cast<int64_t>(token.magnitude);
+        }
+        return true;
+    }
+    }
+}
+
+bool CapturedRequiredUint(const CapturedValue& value, const char* field, size_t* out, std::string* error)
+{
+    if (value.type == CapturedValue::Type::Absent) {
+        *error = std::string("Missing required field: ") + field;
+        return false;
+    }
+    if (value.type != CapturedValue::Type::Integer) {
+        *error = std::string("Field must be integer: ") + field;
+        return false;
+    }
+    if (value.int_value < 0) {
+        *error = std::string("Field must be non-negative: ") + field;
+        return false;
+    }
+    *out = static_cast<size_t>(value.int_value);
+    return true;
+}
+
+bool CapturedOptionalUint(const CapturedValue& value, const char* field, std::optional<size_t>* out, std::string* error)
+{
+    if (value.IsAbsentOrNull()) {
+        return true;
+    }
+    size_t parsed = 0;
+    if (!CapturedRequiredUint(value, field, &parsed, error)) {
+        return false;
+    }
+    *out = parsed;
+    return true;
+}
+
+bool CapturedRequiredInt64(const CapturedValue& value, const char* field, int64_t* out, std::string* error)
+{
+    if (value.type == CapturedValue::Type::Absent) {
+        *error = std::string("Missing required field: ") + field;
+        return false;
+    }
+    if (value.type != CapturedValue::Type::Integer) {
+        *error = std::string("Field must be integer: ") + field;
+        return false;
+    }
+    *out = value.int_value;
+    return true;
+}
+
+bool CapturedOptionalInt64(const CapturedValue& value, const char* field, std::optional<int64_t>* out, std::string* error)
+{
+    if (value.IsAbsentOrNull()) {
+        return true;
+    }
+    int64_t parsed = 0;
+    if (!CapturedRequiredInt64(value, field, &parsed, error)) {
+        return false;
+    }
+    *out = parsed;
+    return true;
+}
+
+bool CapturedRequiredString(CapturedValue& value, const char* field, std::string* out, std::string* error)
+{
+    if (value.type == CapturedValue::Type::Absent) {
+        *error = std::string("Missing required field: ") + field;
+        return false;
+    }
+    if (value.type != CapturedValue::Type::String) {
+        *error = std::string("Field must be string: ") + field;
+        return false;
+    }
+    // 捕获值只用这一次，直接 move 走，省掉一次字符串拷贝。
+    *out = std::move(value.string_value);
+    return true;
+}
+} // namespace
+
+TraceSpanParser::TraceSpanParser(std::string trace_end_field, std::vector<std::string> trace_end_aliases)
+    : trace_end_field_(trace_end_field.empty() ? "trace_end" : std::move(trace_end_field)),
+      trace_end_aliases_(std::move(trace_end_aliases))
+{
+    trace_end_known_fields_.insert(trace_end_field_);
+    trace_end_known_fields_.insert(trace_end_aliases_.begin(), trace_end_aliases_.end());
+}
+
+TraceSpanParser::Status TraceSpanParser::ParseObject(const nlohmann::json& body, SpanEvent* span, std::string* error) const
+{
+    if (!body.is_object()) {
+        return Status::NotObject;
+    }
+    if (body.contains("trace_key")) {
+        if (!ParseRequiredUint(body, "trace_key", &span->trace_key, error)) {
+            return Status::InvalidField;
+        }
+    } else if (body.contains("trace_id")) {
+        // 兼容 trace_id 别名是为了降低接入方切换成本，避免首版就要求全量改字段名。
+        if (!ParseRequiredUint(body, "trace_id", &span->trace_key, error)) {
+            return Status::InvalidField;
+        }
+    } else {
+        *error = "Missing required field: trace_key";
+        return Status::InvalidField;
+    }
+
+    if (!ParseRequiredUint(body, "span_id", &span->span_id, error) ||
+        !ParseRequiredInt64(body, "start_time_ms", &span->start_time_ms, error) ||
+        !ParseRequiredString(body, "name", &span->name, error) ||
+        !ParseRequiredString(body, "service_name", &span->service_name, error) ||
+        !ParseOptionalUint(body, "parent_span_id", &span->parent_span_id, error) ||
+        !ParseOptionalInt64(body, "end_time_ms", &span->end_time, error) ||
+        !ParseConfiguredTraceEnd(body, trace_end_field_, trace_end_aliases_, &span->trace_end, error) ||
+        !ParseOptionalStatus(body, &span->status, error) ||
+        !ParseOptionalKind(body, &span->kind, error) ||
+        !ParseOptionalAttributes(body, &span->attributes, error)) {
+        return Status::InvalidField;
+    }
+    // 顶层未知字段收集也跟着这份冷启动口径走：
+    // 既然主字段/别名在进程启动后就固定了，这里直接复用构造期准备好的 known field 集合即可。
+    CollectUnknownTopLevelAttributes(body, trace_end_known_fields_, &span->attributes);
+    return Status::Ok;
+}
+
+TraceSpanParser::Status TraceSpanParser::ParseBody(std::string_view body, SpanEvent* span, std::string* error) const
+{
+    JsonCursor cursor(body);
+    cursor.SkipBom();
+    cursor.SkipWhitespace();
+    if (cursor.Peek() != '{') {
+        // 顶层不是对象属于少见的错误请求：这里不值得再手写一套通用 JSON 校验，
+        // 直接交给 nlohmann 判断它是“合法但不是对象”还是“根本不是合法 JSON”。
+        if (!nlohmann::json::accept(body.begin(), body.end())) {
+            return Status::InvalidJson;
+        }
+        return Status::NotObject;
+    }
+    cursor.Consume('{');
+
+    CapturedValue known[kKnownFieldCount];
+    // 下标 0 是主字段，后面依次是别名，和 ParseConfiguredTraceEnd 的回退顺序一致。
+    std::vector<CapturedValue> trace_end_values(1 + trace_end_aliases_.size());
+    // attributes 对象在扫描时直接展开成 map；重复出现的 attributes 键以最后一次为准。
+    std::unordered_map<std::string, std::string> explicit_attributes;
+    // 顶层未知字段按出现顺序暂存，最后倒序 emplace，等价于 DOM 里“重复键后者覆盖前者”。
+    std::vector<std::pair<std::string, std::string>> unknown_fields;
+    std::string key;
+
+    cursor.SkipWhitespace();
+    if (!cursor.Consume('}')) {
+        while (true) {
+            cursor.SkipWhitespace();
+            if (!cursor.ParseString(&key)) {
+                return Status::InvalidJson;
+            }
+            cursor.SkipWhitespace();
+            if (!cursor.Consume(':')) {
+                return Status::InvalidJson;
+            }
+            cursor.SkipWhitespace();
+
+            const size_t known_index = LookupKnownField(key);
+            const bool is_trace_end_field = trace_end_known_fields_.find(key) != trace_end_known_fields_.end();
+            // 同一个键可能同时是主字段和若干别名（配置允许），所以要把值写进所有同名槽位。
+            auto capture_trace_end = [&](const CapturedValue& value) {
+                if (trace_end_field_ == key) {
+                    trace_end_values[0] = value;
+                }
+                for (size_t i = 0; i < trace_end_aliases_.size(); ++i) {
+                    if (trace_end_aliases_[i] == key) {
+                        trace_end_values[i + 1] = value;
+                    }
+                }
+            };
+            if (known_index == kAttributes && cursor.Peek() == '{') {
+                known[kAttributes].type = CapturedValue::Type::Object;
+                if (is_trace_end_field) {
+                    capture_trace_end(known[kAttributes]);
+                }
+                explicit_attributes.clear();
+                cursor.Consume('{');
+                cursor.SkipWhitespace();
+                if (!cursor.Consume('}')) {
+                    std::string attribute_key;
+                    while (true) {
+                        cursor.SkipWhitespace();
+                        if (!cursor.ParseString(&attribute_key)) {
+                            return Status::InvalidJson;
+                        }
+                        cursor.SkipWhitespace();
+                        if (!cursor.Consume(':')) {
+                            return Status::InvalidJson;
+                        }
+                        cursor.SkipWhitespace();
+                        std::string attribute_value;
+                        if (!ReadAttributeValue(&cursor, &attribute_value)) {
+                            return Status::InvalidJson;
+                        }
+                        explicit_attributes[attribute_key] = std::move(attribute_value);
+                        cursor.SkipWhitespace();
+                        if (cursor.Consume('}')) {
+                            break;
+                        }
+                        if (!cursor.Consume(',')) {
+                            return Status::InvalidJson;
+                        }
+                    }
+                }
+            } else if (known_index != kKnownFieldCount || is_trace_end_field) {
+                CapturedValue value;
+                if (!ReadCapturedValue(&cursor, &value)) {
+                    return Status::InvalidJson;
+                }
+                if (is_trace_end_field) {
+                    capture_trace_end(value);
+                }
+                if (known_index != kKnownFieldCount) {
+                    if (known_index == kAttributes) {
+                        explicit_attributes.clear();
+                    }
+                    known[known_index] = std::move(value);
+                }
+            } else {
+                std::string value;
+                if (!ReadAttributeValue(&cursor, &value)) {
+                    return Status::InvalidJson;
+                }
+                unknown_fields.emplace_back(key, std::move(value));
+            }
+
+            cursor.SkipWhitespace();
+            if (cursor.Consume('}')) {
+                break;
+            }
+            if (!cursor.Consume(',')) {
+                return Status::InvalidJson;
+            }
+        }
+    }
+    cursor.SkipWhitespace();
+    if (!cursor.AtEnd()) {
+        return Status::InvalidJson;
+    }
+
+    // 扫描结束后按 DOM 路径完全相同的顺序校验，保证报错文案和优先级一致。
+    if (known[kTraceKey].type != CapturedValue::Type::Absent) {
+        if (!CapturedRequiredUint(known[kTraceKey], "trace_key", &span->trace_key, error)) {
+            return Status::InvalidField;
+        }
+    } else if (known[kTraceId].type != CapturedValue::Type::Absent) {
+        if (!CapturedRequiredUint(known[kTraceId], "trace_id", &span->trace_key, error)) {
+            return Status::InvalidField;
+        }
+    } else {
+        *error = "Missing required field: trace_key";
+        return Status::InvalidField;
+    }
+    if (!CapturedRequiredUint(known[kSpanId], "span_id", &span->span_id, error) ||
+        !CapturedRequiredInt64(known[kStartTimeMs], "start_time_ms", &span->start_time_ms, error) ||
+        !CapturedRequiredString(known[kName], "name", &span->name, error) ||
+        !CapturedRequiredString(known[kServiceName], "service_name", &span->service_name, error) ||
+        !CapturedOptionalUint(known[kParentSpanId], "parent_span_id", &span->parent_span_id, error) ||
+        !CapturedOptionalInt64(known[kEndTimeMs], "end_time_ms", &span->end_time, error)) {
+        return Status::InvalidField;
+    }
+
+    // trace_end：主字段优先，别名按配置顺序回退；空字段名和 DOM 路径一样直接跳过。
+    for (size_t i = 0; i < trace_end_values.size(); ++i) {
+        const std::string& field = i == 0 ? trace_end_field_ : trace_end_aliases_[i - 1];
+        const CapturedValue& value = trace_end_values[i];
+        if (field.empty() || value.IsAbsentOrNull()) {
+            continue;
+        }
+        if (value.type != CapturedValue::Type::Bool) {
+            *error = std::string("Field must be bool: ") + field;
+            return Status::InvalidField;
+        }
+        span->trace_end = value.bool_value;
+        break;
+    }
+
+    if (!known[kStatus].IsAbsentOrNull()) {
+        if (known[kStatus].type != CapturedValue::Type::String) {
+            *error = "Field must be string: status";
+            return Status::InvalidField;
+        }
+        if (!ParseStatusText(known[kStatus].string_value, &span->status, error)) {
+            return Status::InvalidField;
+        }
+    }
+    if (!known[kKind].IsAbsentOrNull()) {
+        if (known[kKind].type != CapturedValue::Type::String) {
+            *error = "Field must be string: kind";
+            return Status::InvalidField;
+        }
+        if (!ParseKindText(known[kKind].string_value, &span->kind, error)) {
+            return Status::InvalidField;
+        }
+    }
+    if (!known[kAttributes].IsAbsentOrNull()) {
+        if (known[kAttributes].type != CapturedValue::Type::Object) {
+            *error = "Field must be object: attributes";
+            return Status::InvalidField;
+        }
+        for (auto& entry : explicit_attributes) {
+            span->attributes[entry.first] = std::move(entry.second);
+        }
+    }
+    // 显式 attributes 优先；未知字段倒序 emplace，让重复键里最后一次出现的值生效。
+    for (auto it = unknown_fields.rbegin(); it != unknown_fields.rend(); ++it) {
+        span->attributes.emplace(std::move(it->first), std::move(it->second));
+    }
+    return Status::Ok;
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include <nlohmann/json.hpp>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+struct SpanEvent;
+
+// TraceSpanParser 把 `/logs/spans` 单条 span 的字段口径收在一处。
+// 它提供两条等价路径：
+// 1) ParseBody：热路径用的单遍解析器，直接从请求 body 的字节流填 SpanEvent，不构建 nlohmann DOM；
+// 2) ParseObject：对已经解析好的 nlohmann::json 对象逐字段取值，给 JSON 数组批量入口复用，也作为单遍解析器的对照口径。
+// 两条路径的校验顺序、错误文案、trace_end 主字段/别名回退规则和顶层未知字段折叠规则必须完全一致，
+// 单测里会拿同一批输入对拍。
+class TraceSpanParser
+{
+public:
+    enum class Status
+    {
+        // 解析成功，SpanEvent 已填好。
+        Ok,
+        // body 本身不是合法 JSON，请求层返回 "Invalid JSON body"。
+        InvalidJson,
+        // body 是合法 JSON，但顶层不是对象，请求层返回 "Body must be a JSON object"。
+        NotObject,
+        // 顶层是对象，但字段缺失或类型不对；error 里是和旧实现一致的具体文案。
+        InvalidField
+    };
+
+    // trace_end 主字段和别名是冷启动配置，构造时固定下来，后面每个请求复用。
+    explicit TraceSpanParser(std::string trace_end_field = "trace_end",
+                             std::vector<std::string> trace_end_aliases = {});
+
+    Status ParseBody(std::string_view body, SpanEvent* span, std::string* error) const;
+    Status ParseObject(const nlohmann::json& body, SpanEvent* span, std::string* error) const;
+
+    const std::string& trace_end_field() const { return trace_end_field_; }
+    const std::vector<std::string>& trace_end_aliases() const { return trace_end_aliases_; }
+
+private:
+    std::string trace_end_field_;
+    std::vector<std::string> trace_end_aliases_;
+    // 顶层未知字段折叠时要排除当前生效的 trace_end 主字段和别名，构造时预展开成 set。
+    std::unordered_set<std::string> trace_end_known_fields_;
+};
@@ -1,8 +1,13 @@
 #include "http/HttpContext.h"
 #include <algorithm>
+#include <charconv>
 //#include <MiniMuduo/base/LogMessage.h>
 HttpContext::ParseResult HttpContext::parseRequest(MiniMuduo::net::Buffer *buf)
 {
+    if (zero_copy_)
+    {
+        return parseRequestInPlace(buf);
+    }
     bool hasMore = true;
     // 没有想到的是，可以直接请求行结束，然后下面是\r\n\r\n
     while (hasMore)
@@ -222,4 +227,135 @@ const char *HttpContext::findCRLFCRLF(const char *start, const char *end)
     // std::search 可以在一个序列中查找另一个子序列
     const char *result = std::search(start, end, crlf, crlf + 4);
     return result == end ? nullptr : result;
-}
\ No newline at end of file
+}
+
+HttpContext::ParseResult HttpContext::parseRequestInPlace(MiniMuduo::net::Buffer *buf)
+{
+    if (state_ == State::kGotAll)
+    {
+        // 上一条请求还没 retrieveParsed + reset，view 仍指向 Buffer，这里不能继续往后解析。
+        return ParseResult::kSuccess;
+    }
+    const char *begin = buf->peek();
+    const char *end = begin + buf->readableBytes();
+    if (expected_total_bytes_ > 0 && buf->readableBytes() < expected_total_bytes_)
+    {
+        // 请求头已经扫过、只差请求体：数据没到齐之前不必重扫请求头。
+        return ParseResult::kNeedMoreData;
+    }
+
+    // 零拷贝模式按“整条请求到齐再一次性解析”处理：先找头部结束的空行，
+    // 找不到就等下一次 onMessage；这样所有 view 都能在同一次调用里指向同一块连续内存。
+    const char *header_end = findCRLFCRLF(begin, end);
+    if (!header_end)
+    {
+        return ParseResult::kNeedMoreData;
+    }
+    const char *line_end = findCRLF(begin, header_end + 2);
+    if (!parseRequestLineView(begin, line_end))
+    {
+        state_ = State::KError;
+        return ParseResult::kError;
+    }
+    request_.zero_copy_ = true;
+    request_.header_view_count_ = 0;
+    const char *line_start = line_end + 2;
+    while (line_start < header_end + 2)
+    {
+        line_end = findCRLF(line_start, header_end + 2);
+        if (!parseOneHeaderLineView(line_start, line_end))
+        {
+            state_ = State::KError;
+            return ParseResult::kError;
+        }
+        line_start = line_end + 2;
+    }
+
+    const size_t header_bytes = static_cast<size_t>(header_end + 4 - begin);
+    size_t body_bytes = 0;
+    if (request_.method_view_ == "POST")
+    {
+        const std::string_view length_text = request_.headerView("content-length");
+        if (length_text.empty())
+        {
+            state_ = State::KError;
+            return ParseResult::kError;
+        }
+        // 用 from_chars 而不是 stoul：不分配、不抛异常，非法长度直接按解析错误处理。
+        const auto [ptr, ec] = std::from_chars(length_text.data(), length_text.data() + length_text.size(), body_bytes);
+        if (ec != std::errc() || ptr != length_text.data() + length_text.size())
+        {
+            state_ = State::KError;
+            return ParseResult::kError;
+        }
+    }
+    if (buf->readableBytes() - header_bytes < body_bytes)
+    {
+        expected_total_bytes_ = header_bytes + body_bytes;
+        return ParseResult::kNeedMoreData;
+    }
+    request_.body_view_ = std::string_view(begin + header_bytes, body_bytes);
+    consumed_bytes_ = header_bytes + body_bytes;
+    expected_total_bytes_ = 0;
+    state_ = State::kGotAll;
+    return ParseResult::kSuccess;
+}
+
+bool HttpContext::parseRequestLineView(const char *start, const char *end)
+{
+    // 和 parseRequestLine 同一套宽松规则（容忍多余空格），只是结果落成 view，并且所有查找都限定在行内。
+    auto skipSpaces = [end](const char *pos) {
+        while (pos < end && *pos == ' ')
+            pos++;
+        return pos;
+    };
+    const char *pos = skipSpaces(start);
+    const char *token_end = std::find(pos, end, ' ');
+    if (token_end == end || token_end == pos)
+        return false;
+    request_.method_view_ = std::string_view(pos, token_end - pos);
+    pos = skipSpaces(token_end);
+    token_end = std::find(pos, end, ' ');
+    if (token_end == end || token_end == pos)
+        return false;
+    request_.path_view_ = std::string_view(pos, token_end - pos);
+    pos = skipSpaces(token_end);
+    if (end - pos < 5 || std::strncmp(pos, "HTTP/", 5) != 0)
+        return false;
+    pos += 5;
+    if (end - pos <= 0)
+        return false;
+    request_.version_view_ = std::string_view(pos, end - pos);
+    return true;
+}
+
+bool HttpContext::parseOneHeaderLineView(const char *start, const char *end)
+{
+    if (request_.header_view_count_ >= HttpRequest::kMaxHeaderViews)
+    {
+        return false;
+    }
+    const char *colon = std::find(start, end, ':');
+    if (colon == end)
+        return false;
+    const char *key_start = start;
+    const char *key_end = colon;
+    while (key_start < key_end && *key_start == ' ')
+        key_start++;
+    while (key_end > key_start && *(key_end - 1) == ' ')
+        key_end--;
+    if (key_end == key_start)
+        return false;
+    const char *value_start = colon + 1;
+    const char *value_end = end;
+    while (value_start < value_end && *value_start == ' ')
+        value_start++;
+    while (value_end > value_start && *(value_end - 1) == ' ')
+        value_end--;
+    if (value_end == value_start)
+        return false;
+    HttpHeaderView &header = request_.header_views_[request_.header_view_count_++];
+    header.key = std::string_view(key_start, key_end - key_start);
+    header.value = std::string_view(value_start, value_end - value_start);
+    return true;
+}
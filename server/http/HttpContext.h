@@ -26,6 +26,21 @@ class HttpContext
         {
             state_=State::kExpectRequestLine;
             request_.reset();
+            consumed_bytes_=0;
+            expected_total_bytes_=0;
+        }
+        // 零拷贝解析模式：请求行/头/体不再拷进 std::string 和哈希表，而是以 string_view 指向 Buffer。
+        // 这个模式下 parseRequest 成功后不会 retrieve，调用方必须在 handler 返回后调用 retrieveParsed，
+        // 再 reset 进入下一条请求；非零拷贝模式下 retrieveParsed 是空操作，调用顺序保持一致即可。
+        void setZeroCopy(bool enabled){zero_copy_=enabled;}
+        bool zeroCopy() const{return zero_copy_;}
+        void retrieveParsed(MiniMuduo::net::Buffer *buf)
+        {
+            if (consumed_bytes_ > 0)
+            {
+                buf->retrieve(consumed_bytes_);
+                consumed_bytes_=0;
+            }
         }
         const HttpRequest& request() const
         {
@@ -42,6 +57,14 @@ class HttpContext
     private:
         State state_=State::kExpectRequestLine;
         HttpRequest request_;
+        bool zero_copy_=false;
+        // 零拷贝模式下当前请求在 Buffer 里占用的总字节数（请求行+头+体），handler 返回后一次性 retrieve。
+        size_t consumed_bytes_=0;
+        // 零拷贝模式下请求体还没收齐时记住整条请求需要的字节数，数据没到齐之前不再重复扫描请求头。
+        size_t expected_total_bytes_=0;
+        ParseResult parseRequestInPlace(MiniMuduo::net::Buffer *buf);
+        bool parseRequestLineView(const char* start,const char* end);
+        bool parseOneHeaderLineView(const char* start,const char* end);
         //左闭右开，cpp标准
         bool parseRequestLine(const char* start,const char* end);
         bool parseHeaders(const char* start,const char* end);
@@ -1,9 +1,21 @@
 #pragma once
 #include<string>
+#include<string_view>
 #include<unordered_map>
+#include<array>
 #include<algorithm>
 #include<cctype>
+// 零拷贝解析模式下的一条请求头：key/value 都直接指向连接 Buffer 里的原始字节，不做小写化。
+struct HttpHeaderView{
+        std::string_view key;
+        std::string_view value;
+};
 struct HttpRequest{
+        // 零拷贝模式下最多保留的请求头条数。
+        // 常见客户端（curl/wrk/浏览器/SDK）一般十几个头就够了，固定数组能让解析阶段完全不碰堆；
+        // 超过上限的请求直接按解析错误处理，而不是悄悄丢头。
+        static constexpr size_t kMaxHeaderViews=32;
+
         void reset()
         {
             method_.clear();
@@ -12,6 +24,12 @@ struct HttpRequest{
             headers_.clear();
             body_.clear();
             trace_id.clear();
+            zero_copy_=false;
+            method_view_={};
+            path_view_={};
+            version_view_={};
+            body_view_={};
+            header_view_count_=0;
         }
         //追踪id
         std::string trace_id;
@@ -27,19 +45,69 @@ struct HttpRequest{
         //第三部分：请求体
         std::string body_;
 
-        const std::string getHeader(std::string key) const
+        // 零拷贝模式：上面四组字段保持为空，请求行/头/体都以 string_view 形式指向连接 Buffer。
+        // 这些 view 只在 handler 同步执行期间有效：HttpServer 在 handler 返回后才 retrieve 这段字节，
+        // 所以需要异步处理的 handler 必须在返回前把要用的内容拷出去（现有异步 handler 都是这么做的）。
+        bool zero_copy_=false;
+        std::string_view method_view_;
+        std::string_view path_view_;
+        std::string_view version_view_;
+        std::string_view body_view_;
+        std::array<HttpHeaderView,kMaxHeaderViews> header_views_{};
+        size_t header_view_count_=0;
+
+        // 下面这组 view 访问器对两种解析模式都成立，handler 统一走它们就不用关心请求是怎么解析出来的。
+        std::string_view methodView() const{
+            return zero_copy_?method_view_:std::string_view(method_);
+        }
+        std::string_view pathView() const{
+            return zero_copy_?path_view_:std::string_view(path_);
+        }
+        std::string_view versionView() const{
+            return zero_copy_?version_view_:std::string_view(version_);
+        }
+        std::string_view bodyView() const{
+            return zero_copy_?body_view_:std::string_view(body_);
+        }
+
+        // 按大小写不敏感的方式找请求头；找不到返回空 view。
+        // 零拷贝模式下是对固定数组的线性扫描：头数量很少，线性比较比建哈希表更省。
+        std::string_view headerView(std::string_view key) const
         {
-            // 解析阶段会把 header key 统一转小写，这里读取也做同样标准化，避免大小写不一致导致取值失败。
-            std::transform(key.begin(), key.end(), key.begin(),
+            if (zero_copy_)
+            {
+                for (size_t i = 0; i < header_view_count_; ++i)
+                {
+                    const std::string_view candidate = header_views_[i].key;
+                    if (candidate.size() == key.size() &&
+                        std::equal(candidate.begin(), candidate.end(), key.begin(),
+                            [](char a, char b) {
+                                return std::tolower(static_cast<unsigned char>(a)) ==
+                                       std::tolower(static_cast<unsigned char>(b));
+                            }))
+                    {
+                        return header_views_[i].value;
+                    }
+                }
+                return {};
+            }
+            std::string lowered(key);
+            std::transform(lowered.begin(), lowered.end(), lowered.begin(),
                 [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
-            auto it = headers_.find(key);
+            auto it = headers_.find(lowered);
             if (it == headers_.end())
             {
-                return "";
+                return {};
             }
             return it->second;
         }
 
+        const std::string getHeader(std::string key) const
+        {
+            // 解析阶段会把 header key 统一转小写，这里读取也做同样标准化，避免大小写不一致导致取值失败。
+            return std::string(headerView(key));
+        }
+
         void setTraceId(std::string id){
             trace_id=std::move(id);
         }
@@ -48,14 +116,14 @@ struct HttpRequest{
         }
 
         const std::string path() const{
-            return path_;
+            return std::string(pathView());
         }
 
         const std::string method() const{
-            return method_;
+            return std::string(methodView());
         }
 
         const std::string version() const{
-            return version_;
+            return std::string(versionView());
         }
 };
@@ -18,7 +18,9 @@ void HttpServer::onConnection(const MiniMuduo::net::TcpConnectionPtr &conn)
 {
     if (conn->connected())
     {
-        conn->setContext(HttpContext());
+        HttpContext context;
+        context.setZeroCopy(zero_copy_parsing_);
+        conn->setContext(std::move(context));
     }
 }
 void HttpServer::onMessage(const MiniMuduo::net::TcpConnectionPtr &conn,
@@ -44,6 +46,8 @@ void HttpServer::onMessage(const MiniMuduo::net::TcpConnectionPtr &conn,
         // LOG_STREAM_INFO<< "[trace: " << trace_id_ << "] Response for " << context->request().path()<<" to : "<<conn->peerAddress().toIpPort()<<" with answer : "<<resp.body_;
         if (resp.closeConnection_)
             conn->shutdown();
+        // 零拷贝模式下 request 里的 view 一直指向 buf，直到这里 handler 已经返回才真正消费这段字节。
+        context->retrieveParsed(buf);
         context->reset();
     }
     if (context->states() == HttpContext::State::KError)
@@ -16,6 +16,8 @@ class HttpServer
         void setTimeOut(double times){server_.setIdleTimeout(times);}
 
         void setCancelThreshold(double times){server_.setCancelThreshold(times);}
+        // 新连接是否使用 HttpContext 的零拷贝解析模式；只影响之后建立的连接，需要在 start() 前设置。
+        void setZeroCopyParsing(bool enabled){zero_copy_parsing_=enabled;}
         
     private:
         void onConnection(const MiniMuduo::net::TcpConnectionPtr& conn);
@@ -23,5 +25,6 @@ class HttpServer
     private:
         MiniMuduo::net::TcpServer server_;
         HttpCallback httpCallback_;
+        bool zero_copy_parsing_=false;
 
 };
\ No newline at end of file
@@ -15,7 +15,7 @@ void Router::add(const std::string &method, const std::string &path, HttpHandler
 bool Router::dispatch(const HttpRequest &request, HttpResponse *response, const std::shared_ptr<MiniMuduo::net::TcpConnection> &conn)
 {
     //cors预检
-    if(request.method()=="OPTIONS"){
+    if(request.methodView()=="OPTIONS"){
         response->setStatusCode(HttpResponse::HttpStatusCode::k200Ok);
         response->setHeader("Access-Control-Allow-Origin","*");
         response->setHeader("Access-Control-Allow-Methods","POST,GET,OPTIONS");
@@ -26,7 +26,12 @@ bool Router::dispatch(const HttpRequest &request, HttpResponse *response, const
         conn->send(std::move(buf));
         return true;
     }
-    std::string key=request.method()+":"+request.path();
+    // 直接从 view 拼路由键，一次 reserve 搞定，不再为 method()/path() 各拷一份临时串。
+    const std::string_view method=request.methodView();
+    const std::string_view path=request.pathView();
+    std::string key;
+    key.reserve(method.size()+1+path.size());
+    key.append(method).append(1,':').append(path);
     if(exactRoutes_.count(key)){
         exactRoutes_[key](request,response,conn);
         return true;
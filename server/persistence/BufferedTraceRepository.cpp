@@ -15,12 +15,23 @@ int64_t NowMs()
         .count();
 }
 
+// 队头记录在 sink 明明可写的情况下连续回放失败这么多次，就认定是记录本身写不进去（比如重复主键、
+// 外键指向的 summary 早就丢了），放弃它，免得一条坏记录把后面所有溢出数据都堵死。
+constexpr uint32_t kMaxSpillHeadFailures = 3;
+
 uint64_t NowNs()
 {
     return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
                                      std::chrono::steady_clock::now().time_since_epoch())
                                      .count());
 }
+
+void UpdateMax(std::atomic<uint64_t>* target, uint64_t value)
+{
+    uint64_t current = target->load(std::memory_order_relaxed);
+    while (value > current && !target->compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+    }
+}
 }
 
 BufferedTraceRepository::BufferedTraceRepository(std::shared_ptr<TraceRepository> sink)
@@ -50,17 +61,24 @@ BufferedTraceRepository::BufferedTraceRepository(std::shared_ptr<TraceRepository
         free_analysis_buffers_.push_back(CreateAnalysisBuffer());
     }
 
-    flush_thread_ = std::thread(&BufferedTraceRepository::FlushLoop, this);
+    if (!config_.spill_path.empty()) {
+        // 上次进程退出前没回放完的溢出记录在这里重新排进队列，primary flush 线程第一轮就会开始回放。
+        spill_queue_ = std::make_unique<persistence::TraceSpillQueue>(config_.spill_path, config_.max_spill_bytes);
+    }
+
+    primary_flush_thread_ = std::thread(&BufferedTraceRepository::PrimaryFlushLoop, this);
+    analysis_flush_thread_ = std::thread(&BufferedTraceRepository::AnalysisFlushLoop, this);
 }
 
 BufferedTraceRepository::~BufferedTraceRepository()
 {
-    StopFlushThread();
+    StopFlushThreads();
     const RuntimeStatsSnapshot stats = SnapshotRuntimeStats();
     if (stats.primary_append_calls == 0 &&
         stats.analysis_append_calls == 0 &&
         stats.primary_flush_calls == 0 &&
-        stats.analysis_flush_calls == 0) {
+        stats.analysis_flush_calls == 0 &&
+        stats.spill_replayed_records == 0) {
         return;
     }
     std::clog << "[BufferedTraceRuntimeStats] " << DescribeRuntimeStats() << std::endl;
@@ -69,8 +87,19 @@ BufferedTraceRepository::~BufferedTraceRepository()
 bool BufferedTraceRepository::AppendPrimary(TracePrimaryWrite write)
 {
     primary_append_calls_.fetch_add(1, std::memory_order_relaxed);
+    const size_t write_bytes = EstimatePrimaryWriteBytes(write);
     std::lock_guard<std::mutex> lock(primary_mutex_);
 
+    // 只卡 primary：analysis 是已经花了一次模型调用换来的结果，体积也小，拒掉就真丢了；
+    // primary 被拒时 trace 还完整留在上游聚合态里，可以按 retry 节奏重投。
+    // 缓冲层完全空着时单条超大 trace 也放行，避免它永远进不来。
+    const size_t pending_bytes = pending_flush_bytes_.load(std::memory_order_relaxed);
+    if (config_.max_pending_flush_bytes > 0 && pending_bytes > 0 &&
+        pending_bytes + write_bytes > config_.max_pending_flush_bytes) {
+        primary_append_rejected_count_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
     if (!current_primary_) {
         current_primary_ = CreatePrimaryBuffer();
     }
@@ -86,13 +115,16 @@ bool BufferedTraceRepository::AppendPrimary(TracePrimaryWrite write)
     current_primary_->spans.insert(current_primary_->spans.end(),
                                    std::make_move_iterator(write.spans.begin()),
                                    std::make_move_iterator(write.spans.end()));
+    current_primary_->last_append_seq = primary_appended_seq_.fetch_add(1, std::memory_order_acq_rel) + 1;
+    current_primary_->pending_bytes += write_bytes;
+    pending_flush_bytes_.fetch_add(write_bytes, std::memory_order_relaxed);
 
     if (!ShouldFlushPrimaryCurrentBySizeLocked()) {
         return true;
     }
 
     RotatePrimaryBuffersLocked();
-    flush_cv_.notify_one();
+    primary_cv_.notify_one();
     return true;
 }
 
@@ -113,7 +145,13 @@ bool BufferedTraceRepository::AppendAnalysis(TraceAnalysisWrite write)
     }
 
     if (write.analysis.has_value()) {
+        const size_t analysis_bytes = EstimateAnalysisBytes(write.analysis.value());
+        current_analysis_->pending_bytes += analysis_bytes;
+        pending_flush_bytes_.fetch_add(analysis_bytes, std::memory_order_relaxed);
         current_analysis_->analyses.push_back(std::move(write.analysis.value()));
+        // 调用方总是先 AppendPrimary 再等 AI 结果，所以此刻读到的序号一定覆盖了这条 analysis 对应的 summary。
+        // 这里按全局序号做屏障是偏保守的：它也会等同一时刻之前追加的其它 trace，但不需要再维护 trace_id 索引。
+        current_analysis_->primary_seq_barrier = primary_appended_seq_.load(std::memory_order_acquire);
     }
 
     if (!ShouldFlushAnalysisCurrentBySizeLocked()) {
@@ -121,10 +159,15 @@ bool BufferedTraceRepository::AppendAnalysis(TraceAnalysisWrite write)
     }
 
     RotateAnalysisBuffersLocked();
-    flush_cv_.notify_one();
+    analysis_cv_.notify_one();
     return true;
 }
 
+bool BufferedTraceRepository::HasStoredAnalysis(const std::string& trace_id)
+{
+    return sink_ && sink_->HasTraceAnalysis(trace_id);
+}
+
 bool BufferedTraceRepository::UpdateTraceAiState(const std::string& trace_id,
                                                  const std::string& ai_status,
                                                  const std::string& ai_error)
@@ -137,6 +180,35 @@ bool BufferedTraceRepository::UpdateTraceAiState(const std::string& trace_id,
     return sink_->UpdateTraceAiState(trace_id, ai_status, ai_error);
 }
 
+size_t BufferedTraceRepository::PendingFlushBytes() const
+{
+    return pending_flush_bytes_.load(std::memory_order_relaxed);
+}
+
+size_t BufferedTraceRepository::MaxPendingFlushBytes() const
+{
+    return config_.max_pending_flush_bytes;
+}
+
+size_t BufferedTraceRepository::EstimatePrimaryWriteBytes(const TracePrimaryWrite& write)
+{
+    size_t bytes = sizeof(TraceSummary) + write.summary.trace_id.size() + write.summary.service_name.size() +
+                   write.summary.risk_level.size() + write.summary.ai_status.size() + write.summary.ai_error.size();
+    for (const auto& span : write.spans) {
+        bytes += sizeof(TraceSpanRecord) + span.trace_id.size() + span.span_id.size() +
+                 (span.parent_id ? span.parent_id->size() : 0) + span.service_name.size() +
+                 span.operation.size() + span.status.size() + span.attributes_json.size();
+    }
+    return bytes;
+}
+
+size_t BufferedTraceRepository::EstimateAnalysisBytes(const TraceAnalysisRecord& analysis)
+{
+    return sizeof(TraceAnalysisRecord) + analysis.trace_id.size() + analysis.risk_level.size() +
+           analysis.summary.size() + analysis.root_cause.size() + analysis.solution.size() +
+           analysis.ai_status.size();
+}
+
 BufferedTraceRepository::PrimaryBufferPtr BufferedTraceRepository::CreatePrimaryBuffer() const
 {
     auto buffer = std::make_unique<PrimaryBufferGroup>();
@@ -292,8 +364,13 @@ void BufferedTraceRepository::RecyclePrimaryBuffer(PrimaryBufferPtr buffer)
     if (!buffer) {
         return;
     }
-    buffer->ClearButKeepCapacity();
     std::lock_guard<std::mutex> lock(primary_mutex_);
+    // 空闲池最多留 initial_buffer_count 只：磁盘卡顿期间临时多建的桶刷完就释放，
+    // 不把一次积压峰值的容量永久留在进程里。
+    if (free_primary_buffers_.size() >= config_.initial_buffer_count) {
+        return;
+    }
+    buffer->ClearButKeepCapacity();
     free_primary_buffers_.push_back(std::move(buffer));
 }
 
@@ -302,120 +379,311 @@ void BufferedTraceRepository::RecycleAnalysisBuffer(AnalysisBufferPtr buffer)
     if (!buffer) {
         return;
     }
-    buffer->ClearButKeepCapacity();
     std::lock_guard<std::mutex> lock(analysis_mutex_);
+    if (free_analysis_buffers_.size() >= config_.initial_buffer_count) {
+        return;
+    }
+    buffer->ClearButKeepCapacity();
     free_analysis_buffers_.push_back(std::move(buffer));
 }
 
-void BufferedTraceRepository::FlushLoop()
+bool BufferedTraceRepository::PrimaryFlushRequestedLocked() const
 {
-    const auto primary_interval = std::chrono::milliseconds(std::max<int64_t>(1, config_.primary_flush_interval_ms));
-    const auto analysis_interval = std::chrono::milliseconds(std::max<int64_t>(1, config_.analysis_flush_interval_ms));
-    const auto sleep_interval = std::min(primary_interval, analysis_interval);
+    // 只有 current 里确实压着 analysis 在等的数据时才算“被催”；
+    // 已经切出去的满桶本来就会按顺序刷，不需要额外提前切 current。
+    return primary_flush_target_seq_ > primary_flushed_seq_.load(std::memory_order_acquire) &&
+           current_primary_ && !current_primary_->Empty();
+}
 
-    std::unique_lock<std::mutex> lock(state_mutex_);
-    while (!stopping_) {
-        // 这里只负责“把后台线程叫醒”，不要把 stopping_ 写成唯一 predicate。
-        // 既然前台写满桶时会 notify_one()，那这里就应该立刻醒来；
-        // 醒来以后再统一检查 stopping_、满桶队列和按时间切 current 的条件。
-        flush_cv_.wait_for(lock, sleep_interval);
-        if (stopping_) {
-            break;
-        }
-        lock.unlock();
+void BufferedTraceRepository::WaitForPrimaryBarrier(uint64_t barrier)
+{
+    if (primary_flushed_seq_.load(std::memory_order_acquire) >= barrier) {
+        return;
+    }
 
-        PrimaryBufferPtr primary_buffer;
-        AnalysisBufferPtr analysis_buffer;
-        const int64_t now_ms = NowMs();
+    {
+        std::lock_guard<std::mutex> primary_lock(primary_mutex_);
+        primary_flush_target_seq_ = std::max(primary_flush_target_seq_, barrier);
+    }
+    primary_cv_.notify_one();
 
-        {
-            std::lock_guard<std::mutex> primary_lock(primary_mutex_);
-            primary_buffer = TakeOnePrimaryBufferForFlushLocked(now_ms, false);
-        }
-        {
-            std::lock_guard<std::mutex> analysis_lock(analysis_mutex_);
-            analysis_buffer = TakeOneAnalysisBufferForFlushLocked(now_ms, false);
-        }
+    // primary 线程退出前一定已经把所有桶 drain 完，所以 primary_worker_exited_ 也算屏障满足，
+    // 避免 primary 写失败或者析构时序问题把 analysis 线程永远挂在这里。
+    std::unique_lock<std::mutex> analysis_lock(analysis_mutex_);
+    analysis_cv_.wait(analysis_lock, [this, barrier]() {
+        return primary_flushed_seq_.load(std::memory_order_acquire) >= barrier || primary_worker_exited_;
+    });
+}
 
-        if (primary_buffer) {
-            if (!primary_buffer->summaries.empty() || !primary_buffer->spans.empty()) {
-                const uint64_t flush_begin_ns = NowNs();
-                const bool saved = sink_->SavePrimaryBatch(primary_buffer->summaries, primary_buffer->spans);
-                primary_flush_calls_.fetch_add(1, std::memory_order_relaxed);
-                primary_flush_total_ns_.fetch_add(NowNs() - flush_begin_ns, std::memory_order_relaxed);
-                primary_flushed_summary_count_.fetch_add(primary_buffer->summaries.size(), std::memory_order_relaxed);
-                primary_flushed_span_count_.fetch_add(primary_buffer->spans.size(), std::memory_order_relaxed);
-                if (!saved) {
-                    primary_flush_fail_count_.fetch_add(1, std::memory_order_relaxed);
-                }
-            }
-            RecyclePrimaryBuffer(std::move(primary_buffer));
-        }
+int64_t BufferedTraceRepository::FlushIntervalMs(Pipeline pipeline) const
+{
+    const int64_t interval_ms = pipeline == Pipeline::Primary ? config_.primary_flush_interval_ms
+                                                              : config_.analysis_flush_interval_ms;
+    return std::max<int64_t>(1, interval_ms);
+}
 
-        if (analysis_buffer) {
-            if (!analysis_buffer->analyses.empty()) {
-                const uint64_t flush_begin_ns = NowNs();
-                const bool saved = sink_->SaveAnalysisBatch(analysis_buffer->analyses);
-                analysis_flush_calls_.fetch_add(1, std::memory_order_relaxed);
-                analysis_flush_total_ns_.fetch_add(NowNs() - flush_begin_ns, std::memory_order_relaxed);
-                analysis_flushed_analysis_count_.fetch_add(analysis_buffer->analyses.size(), std::memory_order_relaxed);
-                if (!saved) {
-                    analysis_flush_fail_count_.fetch_add(1, std::memory_order_relaxed);
-                }
-            }
-            RecycleAnalysisBuffer(std::move(analysis_buffer));
-        }
+bool BufferedTraceRepository::OtherPipelineHasPriorityLocked(Pipeline pipeline, int64_t now_ms) const
+{
+    const Pipeline other = pipeline == Pipeline::Primary ? Pipeline::Analysis : Pipeline::Primary;
+    const WriterRequest& mine = writer_requests_[static_cast<size_t>(pipeline)];
+    const WriterRequest& theirs = writer_requests_[static_cast<size_t>(other)];
+    if (!theirs.waiting) {
+        return false;
+    }
+
+    // 两边的桶按“已经等了几个自己的 flush 间隔”比较：200ms 间隔的 primary 等了 400ms 和
+    // 500ms 间隔的 analysis 等了 1000ms 同样是 2 倍，谁的倍数大谁更该先写。
+    // 交叉相乘比较，避免除法丢精度；倍数相同时让 primary 先走，analysis 反正还要等它的外键数据。
+    const int64_t mine_age_ms = std::max<int64_t>(0, now_ms - mine.first_enqueue_ms);
+    const int64_t theirs_age_ms = std::max<int64_t>(0, now_ms - theirs.first_enqueue_ms);
+    const long double mine_urgency = static_cast<long double>(mine_age_ms) * FlushIntervalMs(other);
+    const long double theirs_urgency = static_cast<long double>(theirs_age_ms) * FlushIntervalMs(pipeline);
+    if (theirs_urgency != mine_urgency) {
+        return theirs_urgency > mine_urgency;
+    }
+    return other == Pipeline::Primary;
+}
+
+void BufferedTraceRepository::GrantWriterLocked(int64_t now_ms)
+{
+    if (writer_busy_) {
+        return;
+    }
+    WriterRequest& primary = writer_requests_[static_cast<size_t>(Pipeline::Primary)];
+    WriterRequest& analysis = writer_requests_[static_cast<size_t>(Pipeline::Analysis)];
+    if (!primary.waiting && !analysis.waiting) {
+        return;
+    }
+    // 优先级随时间变化（两边的 age 乘的是不同的间隔，两条线会交叉），所以只能在这里用一个 now_ms 比一次。
+    // 以前让两个等待方被唤醒后各自拿 NowMs() 比较，先后差 1ms 就可能都认为对方优先，一起睡死、写锁空着没人拿。
+    WriterRequest& winner =
+        !analysis.waiting || (primary.waiting && !OtherPipelineHasPriorityLocked(Pipeline::Primary, now_ms))
+            ? primary
+            : analysis;
+    winner.waiting = false;
+    winner.granted = true;
+    writer_busy_ = true;
+}
 
-        lock.lock();
+uint64_t BufferedTraceRepository::AcquireWriter(Pipeline pipeline, int64_t first_enqueue_ms)
+{
+    const uint64_t wait_begin_ns = NowNs();
+    std::unique_lock<std::mutex> lock(writer_mutex_);
+    WriterRequest& request = writer_requests_[static_cast<size_t>(pipeline)];
+    request.waiting = true;
+    request.granted = false;
+    request.first_enqueue_ms = first_enqueue_ms;
+    // 写锁空着就当场指派给自己；忙的话等持有者 ReleaseWriter 时统一指派。
+    GrantWriterLocked(NowMs());
+    writer_cv_.wait(lock, [&request]() { return request.granted; });
+    request.granted = false;
+    return NowNs() - wait_begin_ns;
+}
+
+void BufferedTraceRepository::ReleaseWriter()
+{
+    {
+        std::lock_guard<std::mutex> lock(writer_mutex_);
+        writer_busy_ = false;
+        GrantWriterLocked(NowMs());
     }
+    writer_cv_.notify_all();
+}
 
-    lock.unlock();
+bool BufferedTraceRepository::SpillFailedBatch(const PrimaryBufferGroup* primary, const AnalysisBufferGroup* analysis)
+{
+    if (!spill_queue_) {
+        return false;
+    }
+    const bool spilled = primary ? spill_queue_->AppendPrimary(primary->summaries, primary->spans)
+                                 : spill_queue_->AppendAnalysis(analysis->analyses);
+    if (!spilled) {
+        // 溢出文件也写不进去（磁盘满、超过 max_spill_bytes），这批数据只能丢弃，和没开溢出时一样。
+        spill_write_fail_count_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    spill_written_records_.fetch_add(1, std::memory_order_relaxed);
+    // 刚失败过，不急着马上回放；要么等一个回放间隔，要么等下一次正常 flush 成功把时间点清零。
+    spill_next_replay_ms_.store(NowMs() + std::max<int64_t>(1, config_.spill_replay_interval_ms),
+                                std::memory_order_relaxed);
+    return true;
+}
 
-    while (true) {
-        PrimaryBufferPtr primary_buffer;
-        AnalysisBufferPtr analysis_buffer;
-        const int64_t now_ms = NowMs();
+void BufferedTraceRepository::ReplaySpilledBatches(bool force)
+{
+    if (!spill_queue_ || spill_queue_->PendingRecords() == 0) {
+        return;
+    }
+    if (!force && NowMs() < spill_next_replay_ms_.load(std::memory_order_relaxed)) {
+        return;
+    }
 
-        {
-            std::lock_guard<std::mutex> primary_lock(primary_mutex_);
-            primary_buffer = TakeOnePrimaryBufferForFlushLocked(now_ms, true);
+    const uint64_t replay_begin_ns = NowNs();
+    persistence::TraceSpillQueue::Record record;
+    while (spill_queue_->PeekFront(&record)) {
+        // 每条记录单独拿一次写锁：积压很深时回放可能持续很久，不能一直压着 analysis 线程不让写。
+        AcquireWriter(Pipeline::Primary, NowMs());
+        const bool saved = record.kind == persistence::TraceSpillQueue::RecordKind::PrimaryBatch
+                               ? sink_->SavePrimaryBatch(record.summaries, record.spans)
+                               : sink_->SaveAnalysisBatch(record.analyses);
+        ReleaseWriter();
+
+        if (saved) {
+            spill_queue_->PopFront();
+            spill_replayed_records_.fetch_add(1, std::memory_order_relaxed);
+            spill_head_failures_ = 0;
+            continue;
+        }
+
+        spill_replay_fail_count_.fetch_add(1, std::memory_order_relaxed);
+        if (sink_succeeded_since_replay_failure_.exchange(false, std::memory_order_relaxed) &&
+            ++spill_head_failures_ >= kMaxSpillHeadFailures) {
+            spill_queue_->PopFront();
+            spill_dropped_records_.fetch_add(1, std::memory_order_relaxed);
+            spill_head_failures_ = 0;
+            continue;
+        }
+        spill_next_replay_ms_.store(NowMs() + std::max<int64_t>(1, config_.spill_replay_interval_ms),
+                                    std::memory_order_relaxed);
+        break;
+    }
+    spill_replay_total_ns_.fetch_add(NowNs() - replay_begin_ns, std::memory_order_relaxed);
+}
+
+void BufferedTraceRepository::FlushPrimaryBuffer(PrimaryBufferPtr buffer)
+{
+    const uint64_t last_append_seq = buffer->last_append_seq;
+    if (!buffer->summaries.empty() || !buffer->spans.empty()) {
+        const uint64_t writer_wait_ns = AcquireWriter(Pipeline::Primary, buffer->first_enqueue_ms);
+        const uint64_t queue_latency_ms = static_cast<uint64_t>(std::max<int64_t>(0, NowMs() - buffer->first_enqueue_ms));
+        const uint64_t flush_begin_ns = NowNs();
+        const bool saved = sink_->SavePrimaryBatch(buffer->summaries, buffer->spans);
+        const uint64_t flush_ns = NowNs() - flush_begin_ns;
+        ReleaseWriter();
+
+        primary_flush_calls_.fetch_add(1, std::memory_order_relaxed);
+        primary_flush_total_ns_.fetch_add(flush_ns, std::memory_order_relaxed);
+        primary_flushed_summary_count_.fetch_add(buffer->summaries.size(), std::memory_order_relaxed);
+        primary_flushed_span_count_.fetch_add(buffer->spans.size(), std::memory_order_relaxed);
+        primary_writer_wait_total_ns_.fetch_add(writer_wait_ns, std::memory_order_relaxed);
+        primary_queue_latency_total_ms_.fetch_add(queue_latency_ms, std::memory_order_relaxed);
+        UpdateMax(&primary_queue_latency_max_ms_, queue_latency_ms);
+        bool durable = saved;
+        if (saved) {
+            sink_succeeded_since_replay_failure_.store(true, std::memory_order_relaxed);
+            spill_next_replay_ms_.store(0, std::memory_order_relaxed);
+        } else {
+            primary_flush_fail_count_.fetch_add(1, std::memory_order_relaxed);
+            // 必须赶在下面发布 primary 序号之前落盘：analysis 线程过了屏障以后如果也写失败，
+            // 它的溢出记录要排在这批 primary 后面，回放时外键依赖才能按顺序满足。
+            durable = SpillFailedBatch(buffer.get(), nullptr);
         }
+        // 只有进了 SQLite 或者溢出文件才算有了别的落盘副本；两边都没写进去时入口 WAL 就是最后一份，
+        // 不能解钉，留给下次启动重放。
+        if (durable && config_.on_primary_flushed) {
+            config_.on_primary_flushed(buffer->summaries);
+        }
+    }
+    // 写失败也一样扣回：这批数据已经离开缓冲层，不能让它继续占着背压预算。
+    pending_flush_bytes_.fetch_sub(buffer->pending_bytes, std::memory_order_relaxed);
+    RecyclePrimaryBuffer(std::move(buffer));
+
+    // 写失败也照样推进序号：这批数据已经没有机会再落库，继续卡住 analysis 只会把它也一起拖死。
+    // 满桶按 FIFO 刷，所以序号单调递增。
+    if (last_append_seq > primary_flushed_seq_.load(std::memory_order_acquire)) {
+        primary_flushed_seq_.store(last_append_seq, std::memory_order_release);
         {
+            // 先进一下 analysis_mutex_ 再 notify，防止 analysis 线程刚检查完条件、还没睡下就错过这次唤醒。
             std::lock_guard<std::mutex> analysis_lock(analysis_mutex_);
-            analysis_buffer = TakeOneAnalysisBufferForFlushLocked(now_ms, true);
         }
+        analysis_cv_.notify_all();
+    }
+}
 
-        if (!primary_buffer && !analysis_buffer) {
-            break;
+void BufferedTraceRepository::FlushAnalysisBuffer(AnalysisBufferPtr buffer)
+{
+    if (!buffer->analyses.empty()) {
+        WaitForPrimaryBarrier(buffer->primary_seq_barrier);
+        const uint64_t writer_wait_ns = AcquireWriter(Pipeline::Analysis, buffer->first_enqueue_ms);
+        const uint64_t queue_latency_ms = static_cast<uint64_t>(std::max<int64_t>(0, NowMs() - buffer->first_enqueue_ms));
+        const uint64_t flush_begin_ns = NowNs();
+        const bool saved = sink_->SaveAnalysisBatch(buffer->analyses);
+        const uint64_t flush_ns = NowNs() - flush_begin_ns;
+        ReleaseWriter();
+
+        analysis_flush_calls_.fetch_add(1, std::memory_order_relaxed);
+        analysis_flush_total_ns_.fetch_add(flush_ns, std::memory_order_relaxed);
+        analysis_flushed_analysis_count_.fetch_add(buffer->analyses.size(), std::memory_order_relaxed);
+        analysis_writer_wait_total_ns_.fetch_add(writer_wait_ns, std::memory_order_relaxed);
+        analysis_queue_latency_total_ms_.fetch_add(queue_latency_ms, std::memory_order_relaxed);
+        UpdateMax(&analysis_queue_latency_max_ms_, queue_latency_ms);
+        if (saved) {
+            sink_succeeded_since_replay_failure_.store(true, std::memory_order_relaxed);
+            spill_next_replay_ms_.store(0, std::memory_order_relaxed);
+        } else {
+            analysis_flush_fail_count_.fetch_add(1, std::memory_order_relaxed);
+            SpillFailedBatch(nullptr, buffer.get());
         }
+    }
+    pending_flush_bytes_.fetch_sub(buffer->pending_bytes, std::memory_order_relaxed);
+    RecycleAnalysisBuffer(std::move(buffer));
+}
 
-        if (primary_buffer) {
-            if (!primary_buffer->summaries.empty() || !primary_buffer->spans.empty()) {
-                const uint64_t flush_begin_ns = NowNs();
-                const bool saved = sink_->SavePrimaryBatch(primary_buffer->summaries, primary_buffer->spans);
-                primary_flush_calls_.fetch_add(1, std::memory_order_relaxed);
-                primary_flush_total_ns_.fetch_add(NowNs() - flush_begin_ns, std::memory_order_relaxed);
-                primary_flushed_summary_count_.fetch_add(primary_buffer->summaries.size(), std::memory_order_relaxed);
-                primary_flushed_span_count_.fetch_add(primary_buffer->spans.size(), std::memory_order_relaxed);
-                if (!saved) {
-                    primary_flush_fail_count_.fetch_add(1, std::memory_order_relaxed);
-                }
+void BufferedTraceRepository::PrimaryFlushLoop()
+{
+    const auto interval = std::chrono::milliseconds(FlushIntervalMs(Pipeline::Primary));
+
+    while (true) {
+        PrimaryBufferPtr buffer;
+        {
+            std::unique_lock<std::mutex> lock(primary_mutex_);
+            // 满桶、analysis 催刷、停止这三种情况要立刻醒；按时间切桶则靠 wait_for 超时兜底。
+            primary_cv_.wait_for(lock, interval, [this]() {
+                return stopping_.load(std::memory_order_acquire) ||
+                       !full_primary_buffers_.empty() ||
+                       PrimaryFlushRequestedLocked();
+            });
+            const bool stopping = stopping_.load(std::memory_order_acquire);
+            buffer = TakeOnePrimaryBufferForFlushLocked(NowMs(), stopping || PrimaryFlushRequestedLocked());
+            if (!buffer && stopping) {
+                break;
             }
-            RecyclePrimaryBuffer(std::move(primary_buffer));
         }
+        // 先回放溢出记录再刷新桶，尽量让老数据先落库。
+        ReplaySpilledBatches(false);
+        if (buffer) {
+            FlushPrimaryBuffer(std::move(buffer));
+        }
+    }
+
+    // 退出前不管间隔再试一次；sink 还是写不进去的话，记录留在溢出文件里等下次启动再回放。
+    ReplaySpilledBatches(true);
+    {
+        std::lock_guard<std::mutex> analysis_lock(analysis_mutex_);
+        primary_worker_exited_ = true;
+    }
+    analysis_cv_.notify_all();
+}
+
+void BufferedTraceRepository::AnalysisFlushLoop()
+{
+    const auto interval = std::chrono::milliseconds(FlushIntervalMs(Pipeline::Analysis));
 
-        if (analysis_buffer) {
-            if (!analysis_buffer->analyses.empty()) {
-                const uint64_t flush_begin_ns = NowNs();
-                const bool saved = sink_->SaveAnalysisBatch(analysis_buffer->analyses);
-                analysis_flush_calls_.fetch_add(1, std::memory_order_relaxed);
-                analysis_flush_total_ns_.fetch_add(NowNs() - flush_begin_ns, std::memory_order_relaxed);
-                analysis_flushed_analysis_count_.fetch_add(analysis_buffer->analyses.size(), std::memory_order_relaxed);
-                if (!saved) {
-                    analysis_flush_fail_count_.fetch_add(1, std::memory_order_relaxed);
-                }
+    while (true) {
+        AnalysisBufferPtr buffer;
+        {
+            std::unique_lock<std::mutex> lock(analysis_mutex_);
+            analysis_cv_.wait_for(lock, interval, [this]() {
+                return stopping_.load(std::memory_order_acquire) || !full_analysis_buffers_.empty();
+            });
+            const bool stopping = stopping_.load(std::memory_order_acquire);
+            buffer = TakeOneAnalysisBufferForFlushLocked(NowMs(), stopping);
+            if (!buffer && stopping) {
+                break;
             }
-            RecycleAnalysisBuffer(std::move(analysis_buffer));
+        }
+        if (buffer) {
+            FlushAnalysisBuffer(std::move(buffer));
         }
     }
 }
@@ -434,6 +702,24 @@ BufferedTraceRepository::RuntimeStatsSnapshot BufferedTraceRepository::SnapshotR
     stats.analysis_flush_fail_count = analysis_flush_fail_count_.load(std::memory_order_relaxed);
     stats.analysis_flush_total_ns = analysis_flush_total_ns_.load(std::memory_order_relaxed);
     stats.analysis_flushed_analysis_count = analysis_flushed_analysis_count_.load(std::memory_order_relaxed);
+    stats.primary_queue_latency_total_ms = primary_queue_latency_total_ms_.load(std::memory_order_relaxed);
+    stats.primary_queue_latency_max_ms = primary_queue_latency_max_ms_.load(std::memory_order_relaxed);
+    stats.analysis_queue_latency_total_ms = analysis_queue_latency_total_ms_.load(std::memory_order_relaxed);
+    stats.analysis_queue_latency_max_ms = analysis_queue_latency_max_ms_.load(std::memory_order_relaxed);
+    stats.primary_writer_wait_total_ns = primary_writer_wait_total_ns_.load(std::memory_order_relaxed);
+    stats.analysis_writer_wait_total_ns = analysis_writer_wait_total_ns_.load(std::memory_order_relaxed);
+    stats.pending_flush_bytes = pending_flush_bytes_.load(std::memory_order_relaxed);
+    stats.primary_append_rejected_count = primary_append_rejected_count_.load(std::memory_order_relaxed);
+    if (spill_queue_) {
+        stats.spill_pending_records = spill_queue_->PendingRecords();
+        stats.spill_pending_bytes = spill_queue_->PendingBytes();
+    }
+    stats.spill_written_records = spill_written_records_.load(std::memory_order_relaxed);
+    stats.spill_write_fail_count = spill_write_fail_count_.load(std::memory_order_relaxed);
+    stats.spill_replayed_records = spill_replayed_records_.load(std::memory_order_relaxed);
+    stats.spill_replay_fail_count = spill_replay_fail_count_.load(std::memory_order_relaxed);
+    stats.spill_dropped_records = spill_dropped_records_.load(std::memory_order_relaxed);
+    stats.spill_replay_total_ns = spill_replay_total_ns_.load(std::memory_order_relaxed);
     return stats;
 }
 
@@ -455,21 +741,49 @@ std::string BufferedTraceRepository::DescribeRuntimeStats() const
         << ", analysis_flush_total_ns=" << stats.analysis_flush_total_ns
         << ", analysis_flush_avg_ms="
         << (stats.analysis_flush_calls > 0 ? (static_cast<double>(stats.analysis_flush_total_ns) / stats.analysis_flush_calls / 1'000'000.0) : 0.0)
-        << ", analysis_flushed_analysis_count=" << stats.analysis_flushed_analysis_count;
+        << ", analysis_flushed_analysis_count=" << stats.analysis_flushed_analysis_count
+        << ", primary_queue_latency_avg_ms="
+        << (stats.primary_flush_calls > 0 ? (static_cast<double>(stats.primary_queue_latency_total_ms) / stats.primary_flush_calls) : 0.0)
+        << ", primary_queue_latency_max_ms=" << stats.primary_queue_latency_max_ms
+        << ", primary_writer_wait_total_ns=" << stats.primary_writer_wait_total_ns
+        << ", analysis_queue_latency_avg_ms="
+        << (stats.analysis_flush_calls > 0 ? (static_cast<double>(stats.analysis_queue_latency_total_ms) / stats.analysis_flush_calls) : 0.0)
+        << ", analysis_queue_latency_max_ms=" << stats.analysis_queue_latency_max_ms
+        << ", analysis_writer_wait_total_ns=" << stats.analysis_writer_wait_total_ns
+        << ", pending_flush_bytes=" << stats.pending_flush_bytes
+        << ", primary_append_rejected_count=" << stats.primary_append_rejected_count
+        << ", spill_pending_records=" << stats.spill_pending_records
+        << ", spill_pending_bytes=" << stats.spill_pending_bytes
+        << ", spill_written_records=" << stats.spill_written_records
+        << ", spill_write_fail_count=" << stats.spill_write_fail_count
+        << ", spill_replayed_records=" << stats.spill_replayed_records
+        << ", spill_replay_fail_count=" << stats.spill_replay_fail_count
+        << ", spill_dropped_records=" << stats.spill_dropped_records
+        << ", spill_replay_records_per_sec="
+        << (stats.spill_replay_total_ns > 0 ? (static_cast<double>(stats.spill_replayed_records) * 1'000'000'000.0 / stats.spill_replay_total_ns) : 0.0);
     return oss.str();
 }
 
-void BufferedTraceRepository::StopFlushThread()
+void BufferedTraceRepository::StopFlushThreads()
 {
+    if (stopping_.exchange(true, std::memory_order_acq_rel)) {
+        return;
+    }
+    // 两个 worker 都在各自的 pipeline 锁上等，进一下锁再 notify，保证它们不会错过停止信号。
     {
-        std::lock_guard<std::mutex> lock(state_mutex_);
-        if (stopping_) {
-            return;
-        }
-        stopping_ = true;
+        std::lock_guard<std::mutex> primary_lock(primary_mutex_);
+    }
+    primary_cv_.notify_all();
+    {
+        std::lock_guard<std::mutex> analysis_lock(analysis_mutex_);
+    }
+    analysis_cv_.notify_all();
+
+    // 先收 primary：它 drain 完才会放行 analysis 的外键屏障，analysis 再把剩下的桶刷完。
+    if (primary_flush_thread_.joinable()) {
+        primary_flush_thread_.join();
     }
-    flush_cv_.notify_all();
-    if (flush_thread_.joinable()) {
-        flush_thread_.join();
+    if (analysis_flush_thread_.joinable()) {
+        analysis_flush_thread_.join();
     }
 }
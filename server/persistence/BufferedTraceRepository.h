@@ -3,6 +3,7 @@
 #include <condition_variable>
 #include <cstdint>
 #include <atomic>
+#include <functional>
 #include <memory>
 #include <mutex>
 #include <optional>
@@ -11,12 +12,17 @@
 #include <vector>
 
 #include "persistence/TraceRepository.h"
+#include "persistence/TraceSpillQueue.h"
 
 // BufferedTraceRepository 不是底层 Repository 的替身，它更像一个“前面一层的缓冲写入器”。
 // 既然当前持久化时间线已经拆成：
 // 1) Dispatch 前就能拿到 summary + spans
 // 2) AI 返回后才拿到 analysis
 // 那这一层就只暴露两个 append 入口，内部再持有真正的 TraceRepository sink。
+// 两条缓冲线各有一个 flush 线程，互不排队等对方切桶；但 SQLite 只有一个写者，
+// 所以真正落库前还要过一把写锁调度：谁的桶“按自己的 flush 间隔算更老”，谁先拿写锁。
+// analysis 依赖 trace_summary 外键，所以 analysis 桶落库前会先等它之前追加的 primary 都刷完。
+// 配了 spill_path 时，写失败的整批数据会追加进溢出文件，由 primary flush 线程在 sink 恢复后按顺序回放。
 class BufferedTraceRepository
 {
 public:
@@ -32,6 +38,19 @@ public:
         size_t initial_buffer_count = 4;
         int64_t primary_flush_interval_ms = 200;
         int64_t analysis_flush_interval_ms = 500;
+        // 两条线里“已经收下、还没刷进 SQLite”的估算字节上限。磁盘卡住时 flush 跟不上，满桶会一直堆积；
+        // 超过上限后 AppendPrimary 直接返回 false，让上游把 trace 留在聚合态里按 retry 节奏重投，
+        // 而不是在这一层无限新建缓冲桶。0 表示不设上限。
+        size_t max_pending_flush_bytes = 64 * 1024 * 1024;
+        // 写失败批次的溢出文件路径。空字符串表示不落盘，失败批次和以前一样只计数、直接丢弃。
+        std::string spill_path;
+        // 溢出文件大小上限，超过后新的失败批次不再落盘（计入 spill_write_fail_count），避免把本来就满的盘再写一遍。
+        uint64_t max_spill_bytes = 256 * 1024 * 1024;
+        // 回放失败后隔多久再试；期间只要有一次正常 flush 成功，说明 sink 已经恢复，下一轮就会提前回放。
+        int64_t spill_replay_interval_ms = 1000;
+        // 每批 primary 落进 SQLite、或者写失败但已经进了溢出文件之后，在 primary flush 线程上回调；写失败又没能溢出的批次不回调。
+        // 入口 WAL 靠它解钉这些 trace。回调里不能再调本对象的 Append*，否则会和 flush 线程自己抢缓冲。
+        std::function<void(const std::vector<TraceSummary>& summaries)> on_primary_flushed;
     };
 
     struct PrimaryBufferGroup
@@ -39,6 +58,10 @@ public:
         std::vector<TraceSummary> summaries;
         std::vector<TraceSpanRecord> spans;
         int64_t first_enqueue_ms = 0;
+        // 这只桶里最后一次 AppendPrimary 拿到的序号；刷完后发布出去，analysis 线程据此判断外键依赖是否已落库。
+        uint64_t last_append_seq = 0;
+        // 桶内记录的估算字节数，刷完后从 pending_flush_bytes_ 里原样扣回。
+        size_t pending_bytes = 0;
 
         bool Empty() const
         {
@@ -50,6 +73,8 @@ public:
             summaries.clear();
             spans.clear();
             first_enqueue_ms = 0;
+            last_append_seq = 0;
+            pending_bytes = 0;
         }
     };
 
@@ -57,6 +82,10 @@ public:
     {
         std::vector<TraceAnalysisRecord> analyses;
         int64_t first_enqueue_ms = 0;
+        // 追加进这只桶时 primary 已经分配到的最大序号。primary 刷到这个序号之前，这只桶不能落库，
+        // 否则 analysis 可能跑到自己的 trace_summary 前面，被外键约束整批拒掉。
+        uint64_t primary_seq_barrier = 0;
+        size_t pending_bytes = 0;
 
         bool Empty() const
         {
@@ -67,6 +96,8 @@ public:
         {
             analyses.clear();
             first_enqueue_ms = 0;
+            primary_seq_barrier = 0;
+            pending_bytes = 0;
         }
     };
 
@@ -94,6 +125,27 @@ public:
         uint64_t analysis_flush_fail_count = 0;
         uint64_t analysis_flush_total_ns = 0;
         uint64_t analysis_flushed_analysis_count = 0;
+        // 排队延迟：从桶里第一条记录入桶，到这只桶拿到写锁开始落库，total 按 flush 次数累加，max 取进程内最大值。
+        uint64_t primary_queue_latency_total_ms = 0;
+        uint64_t primary_queue_latency_max_ms = 0;
+        uint64_t analysis_queue_latency_total_ms = 0;
+        uint64_t analysis_queue_latency_max_ms = 0;
+        // 其中等写锁的那一段：另一条流水线正在写或者优先级更高时排队的时长。
+        uint64_t primary_writer_wait_total_ns = 0;
+        uint64_t analysis_writer_wait_total_ns = 0;
+        // 当前压在缓冲层、还没刷进 SQLite 的估算字节数，以及因为超过上限被拒掉的 AppendPrimary 次数。
+        uint64_t pending_flush_bytes = 0;
+        uint64_t primary_append_rejected_count = 0;
+        // 溢出队列：当前积压的记录数 / 字节数（spill depth），累计落盘、落盘失败、回放成功、回放失败、
+        // 反复回放都写不进去而放弃的记录数，以及回放耗时（用来算回放速率）。
+        uint64_t spill_pending_records = 0;
+        uint64_t spill_pending_bytes = 0;
+        uint64_t spill_written_records = 0;
+        uint64_t spill_write_fail_count = 0;
+        uint64_t spill_replayed_records = 0;
+        uint64_t spill_replay_fail_count = 0;
+        uint64_t spill_dropped_records = 0;
+        uint64_t spill_replay_total_ns = 0;
     };
 
     explicit BufferedTraceRepository(std::shared_ptr<TraceRepository> sink);
@@ -107,6 +159,11 @@ public:
     bool UpdateTraceAiState(const std::string& trace_id,
                             const std::string& ai_status,
                             const std::string& ai_error);
+    // WAL 重放出来的 trace 开始分析前来问一次；直接透传给底层 repo，缓冲桶里还没刷下去的分析结果不算。
+    bool HasStoredAnalysis(const std::string& trace_id);
+    // TraceSessionManager 拿这两个值做持久化滞后水位：待刷字节逼近上限时从入口 503 把压力推回调用方。
+    size_t PendingFlushBytes() const;
+    size_t MaxPendingFlushBytes() const;
     RuntimeStatsSnapshot SnapshotRuntimeStats() const;
     std::string DescribeRuntimeStats() const;
 
@@ -114,6 +171,24 @@ private:
     using PrimaryBufferPtr = std::unique_ptr<PrimaryBufferGroup>;
     using AnalysisBufferPtr = std::unique_ptr<AnalysisBufferGroup>;
 
+    enum class Pipeline
+    {
+        Primary = 0,
+        Analysis = 1
+    };
+
+    // 写锁调度里每条流水线的登记位：正在等写锁的桶最早入桶时间，用来算它相对自己 flush 间隔的“老化程度”。
+    struct WriterRequest
+    {
+        bool waiting = false;
+        // 写锁已经指派给这条流水线；只由 GrantWriterLocked 置位，等待方只看它，不再自己比较优先级。
+        bool granted = false;
+        int64_t first_enqueue_ms = 0;
+    };
+
+    // 估算口径和 TraceSessionManager::EstimateSpanBytes 一致：结构体本身 + 字符串内容，只看 size() 不看 capacity()。
+    static size_t EstimatePrimaryWriteBytes(const TracePrimaryWrite& write);
+    static size_t EstimateAnalysisBytes(const TraceAnalysisRecord& analysis);
     PrimaryBufferPtr CreatePrimaryBuffer() const;
     AnalysisBufferPtr CreateAnalysisBuffer() const;
     bool ShouldFlushPrimaryCurrentBySizeLocked() const;
@@ -130,8 +205,23 @@ private:
     AnalysisBufferPtr TakeOneAnalysisBufferForFlushLocked(int64_t now_ms, bool draining);
     void RecyclePrimaryBuffer(PrimaryBufferPtr buffer);
     void RecycleAnalysisBuffer(AnalysisBufferPtr buffer);
-    void FlushLoop();
-    void StopFlushThread();
+    bool PrimaryFlushRequestedLocked() const;
+    void WaitForPrimaryBarrier(uint64_t barrier);
+    int64_t FlushIntervalMs(Pipeline pipeline) const;
+    bool OtherPipelineHasPriorityLocked(Pipeline pipeline, int64_t now_ms) const;
+    // 写锁空闲且有人在等时，用同一个 now_ms 选出下一个持有者并置 granted；调用方持 writer_mutex_。
+    void GrantWriterLocked(int64_t now_ms);
+    uint64_t AcquireWriter(Pipeline pipeline, int64_t first_enqueue_ms);
+    void ReleaseWriter();
+    // 写失败的批次落进溢出文件，返回是否落盘成功；没配溢出文件或者落盘也失败时只计数并返回 false。
+    bool SpillFailedBatch(const PrimaryBufferGroup* primary, const AnalysisBufferGroup* analysis);
+    // 只在 primary flush 线程里调用：按写入顺序回放溢出记录，遇到失败就停下等下一轮。
+    void ReplaySpilledBatches(bool force);
+    void FlushPrimaryBuffer(PrimaryBufferPtr buffer);
+    void FlushAnalysisBuffer(AnalysisBufferPtr buffer);
+    void PrimaryFlushLoop();
+    void AnalysisFlushLoop();
+    void StopFlushThreads();
 
     std::shared_ptr<TraceRepository> sink_;
     Config config_;
@@ -142,6 +232,11 @@ private:
     PrimaryBufferPtr next_primary_;
     std::vector<PrimaryBufferPtr> free_primary_buffers_;
     std::vector<PrimaryBufferPtr> full_primary_buffers_;
+    // 序号只在 primary_mutex_ 里递增；做成 atomic 是为了 AppendAnalysis 不必再去抢 primary_mutex_。
+    std::atomic<uint64_t> primary_appended_seq_{0};
+    // analysis 线程等屏障时把目标序号挂在这里，primary 线程看到后不等时间阈值，直接把 current 切出来刷掉。
+    uint64_t primary_flush_target_seq_ = 0;
+    std::atomic<uint64_t> primary_flushed_seq_{0};
 
     std::mutex analysis_mutex_;
     std::condition_variable analysis_cv_;
@@ -149,11 +244,26 @@ private:
     AnalysisBufferPtr next_analysis_;
     std::vector<AnalysisBufferPtr> free_analysis_buffers_;
     std::vector<AnalysisBufferPtr> full_analysis_buffers_;
+    bool primary_worker_exited_ = false;
+
+    // 两条流水线共用的 SQLite 写锁。writer_requests_ 按 Pipeline 下标登记，
+    // 写锁空出来时由“相对 flush 间隔等得更久”的一方先拿；谁拿由登记/释放的一方一次选定，不让两个等待方各自判断。
+    std::mutex writer_mutex_;
+    std::condition_variable writer_cv_;
+    bool writer_busy_ = false;
+    WriterRequest writer_requests_[2];
+
+    std::unique_ptr<persistence::TraceSpillQueue> spill_queue_;
+    // 下次允许回放的时间点；正常 flush 成功时清零，让回放立刻跟上。
+    std::atomic<int64_t> spill_next_replay_ms_{0};
+    // 队头记录上次回放失败以后，sink 是否又成功写过新数据。成功过还写不进去，说明坏的是这条记录本身而不是 SQLite。
+    std::atomic<bool> sink_succeeded_since_replay_failure_{false};
+    // 队头记录在“sink 明明可写”的情况下连续回放失败的次数，只有 primary flush 线程读写。
+    uint32_t spill_head_failures_ = 0;
 
-    std::mutex state_mutex_;
-    std::condition_variable flush_cv_;
-    bool stopping_ = false;
-    std::thread flush_thread_;
+    std::atomic<bool> stopping_{false};
+    std::thread primary_flush_thread_;
+    std::thread analysis_flush_thread_;
 
     std::atomic<uint64_t> primary_append_calls_{0};
     std::atomic<uint64_t> analysis_append_calls_{0};
@@ -166,4 +276,18 @@ private:
     std::atomic<uint64_t> analysis_flush_fail_count_{0};
     std::atomic<uint64_t> analysis_flush_total_ns_{0};
     std::atomic<uint64_t> analysis_flushed_analysis_count_{0};
+    std::atomic<uint64_t> primary_queue_latency_total_ms_{0};
+    std::atomic<uint64_t> primary_queue_latency_max_ms_{0};
+    std::atomic<uint64_t> analysis_queue_latency_total_ms_{0};
+    std::atomic<uint64_t> analysis_queue_latency_max_ms_{0};
+    std::atomic<uint64_t> primary_writer_wait_total_ns_{0};
+    std::atomic<uint64_t> analysis_writer_wait_total_ns_{0};
+    std::atomic<size_t> pending_flush_bytes_{0};
+    std::atomic<uint64_t> primary_append_rejected_count_{0};
+    std::atomic<uint64_t> spill_written_records_{0};
+    std::atomic<uint64_t> spill_write_fail_count_{0};
+    std::atomic<uint64_t> spill_replayed_records_{0};
+    std::atomic<uint64_t> spill_replay_fail_count_{0};
+    std::atomic<uint64_t> spill_dropped_records_{0};
+    std::atomic<uint64_t> spill_replay_total_ns_{0};
 };
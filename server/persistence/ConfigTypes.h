@@ -74,11 +74,14 @@ struct AppConfig {
     int retry_base_delay_ms = 500;
     int sweep_tick_ms = 500;
 
-    // 三类积压指标各自维护 overload / critical 百分比，避免把不同容量基数硬揉成一个总水位。
+    // 四类积压指标各自维护 overload / critical 百分比，避免把不同容量基数硬揉成一个总水位。
+    // buffered_bytes 按 span 内容的估算字节数算，基数是启动参数里的字节预算，补上“span 数相同但体积差百倍”的盲区。
     int wm_active_sessions_overload = 75;
     int wm_active_sessions_critical = 90;
     int wm_buffered_spans_overload = 75;
     int wm_buffered_spans_critical = 90;
+    int wm_buffered_bytes_overload = 75;
+    int wm_buffered_bytes_critical = 90;
     int wm_pending_tasks_overload = 75;
     int wm_pending_tasks_critical = 90;
 
@@ -95,6 +98,7 @@ struct AppConfig {
         collecting_idle_timeout_ms, sealed_grace_window_ms, retry_base_delay_ms, sweep_tick_ms,
         wm_active_sessions_overload, wm_active_sessions_critical,
         wm_buffered_spans_overload, wm_buffered_spans_critical,
+        wm_buffered_bytes_overload, wm_buffered_bytes_critical,
         wm_pending_tasks_overload, wm_pending_tasks_critical
     )
 };
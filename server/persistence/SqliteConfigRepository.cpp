@@ -111,6 +111,8 @@ static void ApplyConfigValue(AppConfig &config, const std::string &key, const st
         else if (key == "wm_active_sessions_critical") config.wm_active_sessions_critical = std::stoi(val);
         else if (key == "wm_buffered_spans_overload") config.wm_buffered_spans_overload = std::stoi(val);
         else if (key == "wm_buffered_spans_critical") config.wm_buffered_spans_critical = std::stoi(val);
+        else if (key == "wm_buffered_bytes_overload") config.wm_buffered_bytes_overload = std::stoi(val);
+        else if (key == "wm_buffered_bytes_critical") config.wm_buffered_bytes_critical = std::stoi(val);
         else if (key == "wm_pending_tasks_overload") config.wm_pending_tasks_overload = std::stoi(val);
         else if (key == "wm_pending_tasks_critical") config.wm_pending_tasks_critical = std::stoi(val);
     }
@@ -230,6 +232,8 @@ SqliteConfigRepository::SqliteConfigRepository(const std::string &db_path)
             ('wm_active_sessions_critical', '90', 'active sessions critical 百分比阈值'),
             ('wm_buffered_spans_overload', '75', 'buffered spans overload 百分比阈值'),
             ('wm_buffered_spans_critical', '90', 'buffered spans critical 百分比阈值'),
+            ('wm_buffered_bytes_overload', '75', 'buffered bytes overload 百分比阈值'),
+            ('wm_buffered_bytes_critical', '90', 'buffered bytes critical 百分比阈值'),
             ('wm_pending_tasks_overload', '75', 'pending tasks overload 百分比阈值'),
             ('wm_pending_tasks_critical', '90', 'pending tasks critical 百分比阈值');
             DELETE FROM app_config
@@ -0,0 +1,96 @@
+#include "persistence/SqliteStatementCache.h"
+
+#include <utility>
+
+namespace persistence {
+
+SqliteStatementCache::Handle::Handle(sqlite3_stmt* stmt, bool* in_use, StmtPtr owned)
+    : stmt_(stmt),
+      in_use_(in_use),
+      owned_(std::move(owned))
+{
+}
+
+SqliteStatementCache::Handle::Handle(Handle&& other) noexcept
+    : stmt_(other.stmt_),
+      in_use_(other.in_use_),
+      owned_(std::move(other.owned_))
+{
+    other.stmt_ = nullptr;
+    other.in_use_ = nullptr;
+}
+
+SqliteStatementCache::Handle::~Handle()
+{
+    if (!stmt_ || owned_) {
+        return;
+    }
+    sqlite3_reset(stmt_);
+    sqlite3_clear_bindings(stmt_);
+    if (in_use_) {
+        *in_use_ = false;
+    }
+}
+
+SqliteStatementCache::SqliteStatementCache(sqlite3* db,
+                                           size_t capacity,
+                                           std::atomic<uint64_t>* hits,
+                                           std::atomic<uint64_t>* misses)
+    : db_(db),
+      capacity_(capacity),
+      hits_(hits),
+      misses_(misses)
+{
+}
+
+SqliteStatementCache::~SqliteStatementCache()
+{
+    // stmt 必须在连接关闭前 finalize；宿主负责让缓存先于连接析构。
+    index_.clear();
+    entries_.clear();
+}
+
+SqliteStatementCache::Handle SqliteStatementCache::Acquire(const std::string& sql, const char* error_context)
+{
+    auto iter = index_.find(sql);
+    if (iter != index_.end() && !iter->second->in_use) {
+        entries_.splice(entries_.begin(), entries_, iter->second);
+        Entry& entry = entries_.front();
+        entry.in_use = true;
+        hits_->fetch_add(1, std::memory_order_relaxed);
+        return Handle(entry.stmt.get(), &entry.in_use, nullptr);
+    }
+
+    misses_->fetch_add(1, std::memory_order_relaxed);
+    sqlite3_stmt* raw_stmt = nullptr;
+    const int rc = sqlite3_prepare_v2(db_, sql.c_str(), -1, &raw_stmt, nullptr);
+    StmtPtr stmt(raw_stmt);
+    checkSqliteError(db_, rc, error_context);
+
+    // 同一条 SQL 正在被外层借用（嵌套使用）或者缓存满了又腾不出位置时，这次用完就丢，不进缓存。
+    const bool cacheable = iter == index_.end() && capacity_ > 0 && (entries_.size() < capacity_ || EvictOneIdle());
+    if (!cacheable) {
+        sqlite3_stmt* owned_raw = stmt.get();
+        return Handle(owned_raw, nullptr, std::move(stmt));
+    }
+    entries_.push_front(Entry{sql, std::move(stmt), true});
+    index_.emplace(sql, entries_.begin());
+    Entry& entry = entries_.front();
+    return Handle(entry.stmt.get(), &entry.in_use, nullptr);
+}
+
+bool SqliteStatementCache::EvictOneIdle()
+{
+    for (auto iter = entries_.end(); iter != entries_.begin();) {
+        --iter;
+        if (iter->in_use) {
+            continue;
+        }
+        index_.erase(iter->sql);
+        entries_.erase(iter);
+        return true;
+    }
+    return false;
+}
+
+} // namespace persistence
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include "persistence/SqliteHelper.h"
+
+namespace persistence {
+
+// SqliteStatementCache 是挂在单条 SQLite 连接上的 prepared statement 缓存：
+// 1) key 直接用 SQL 文本，动态拼出来的 WHERE/IN 形状天然就是不同的 key，不需要调用方再起名字；
+// 2) 命中时复用已经编译好的 stmt，只做 reset + rebind，省掉每次调用都要走一遍的 prepare；
+// 3) 按 LRU 淘汰，容量封顶，避免 retention 删除这类“IN 参数个数每批都不一样”的 SQL 把缓存撑爆。
+// 它和连接一样不做线程同步：写连接在 repo 的 mutex_ 下用，只读连接借出期间只属于一个线程。
+// 命中/未命中计数写到调用方传进来的原子量里，统计快照可以在别的线程无锁读取。
+class SqliteStatementCache
+{
+public:
+    // 借出的 statement。析构时缓存里的 stmt 只做 reset + clear_bindings 放回去，
+    // 这样 SELECT 没读到 SQLITE_DONE 就提前返回时也会及时结束读事务，SQLITE_STATIC 绑定的指针也不会悬空；
+    // 缓存满且都在用时临时 prepare 的 stmt 则直接 finalize。
+    class Handle
+    {
+    public:
+        Handle(Handle&& other) noexcept;
+        Handle& operator=(Handle&&) = delete;
+        Handle(const Handle&) = delete;
+        Handle& operator=(const Handle&) = delete;
+        ~Handle();
+
+        sqlite3_stmt* get() const { return stmt_; }
+
+    private:
+        friend class SqliteStatementCache;
+        Handle(sqlite3_stmt* stmt, bool* in_use, StmtPtr owned);
+
+        sqlite3_stmt* stmt_ = nullptr;
+        bool* in_use_ = nullptr;
+        StmtPtr owned_;
+    };
+
+    SqliteStatementCache(sqlite3* db,
+                         size_t capacity,
+                         std::atomic<uint64_t>* hits,
+                         std::atomic<uint64_t>* misses);
+    ~SqliteStatementCache();
+
+    SqliteStatementCache(const SqliteStatementCache&) = delete;
+    SqliteStatementCache& operator=(const SqliteStatementCache&) = delete;
+
+    // prepare 失败时按 checkSqliteError 的约定抛异常，error_context 和原来各处手写 prepare 的文案保持一致。
+    Handle Acquire(const std::string& sql, const char* error_context);
+    size_t size() const { return entries_.size(); }
+
+private:
+    struct Entry
+    {
+        std::string sql;
+        StmtPtr stmt;
+        bool in_use = false;
+    };
+    using EntryList = std::list<Entry>;
+
+    // 从最久未用的一端找一条没有借出的 entry 淘汰；全部在用时返回 false。
+    bool EvictOneIdle();
+
+    sqlite3* db_;
+    size_t capacity_;
+    std::atomic<uint64_t>* hits_;
+    std::atomic<uint64_t>* misses_;
+    // 头部是最近使用的，尾部是最久未用的。
+    EntryList entries_;
+    std::unordered_map<std::string, EntryList::iterator> index_;
+};
+
+} // namespace persistence
@@ -1,7 +1,16 @@
 #include "persistence/SqliteTraceRepository.h"
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <ctime>
 #include <filesystem>
 #include <iostream>
+#include <limits>
+#include <sstream>
 #include <stdexcept>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
 #include <sqlite3.h>
 #include "persistence/SqliteHelper.h"
 
@@ -11,6 +20,282 @@ constexpr size_t kDefaultTraceSearchPage = 1;
 constexpr size_t kDefaultTraceSearchPageSize = 20;
 constexpr size_t kMaxTraceSearchPageSize = 100;
 constexpr size_t kMaxAiErrorLength = 1024;
+// 每条连接缓存的 statement 上限：常驻的写入/查询 SQL 加上搜索的几种 WHERE 组合只有二三十条，
+// 留出余量给 retention 的 IN 形状，超出后按 LRU 淘汰。
+constexpr size_t kStatementCacheCapacity = 64;
+constexpr int kTraceSchemaVersion = 2;
+// 旧表迁移每批搬的 trace 数和批间停顿：单批事务控制在几毫秒量级，批间把写连接让给 flush 线程。
+constexpr size_t kLegacyMigrationBatchSize = 500;
+constexpr auto kLegacyMigrationBatchPause = std::chrono::milliseconds(5);
+constexpr auto kLegacyMigrationRetryPause = std::chrono::milliseconds(1000);
+constexpr int64_t kMsPerHour = 60LL * 60 * 1000;
+constexpr int64_t kMsPerDay = 24 * kMsPerHour;
+// 分区模式下每个 ATTACH 槽位额外给 statement 缓存预留的条数：分区 SQL 带 schema 前缀，每个分区各是一组 key。
+// 其中批量写的多行 INSERT 按 2 的幂切块，summary/span 各有 log2(kMaxBulkInsertRows) + 1 种形状，占了大头。
+constexpr size_t kPartitionStatementCacheSlots = 24;
+// SavePrimaryBatch 一条多行 INSERT 最多带的行数。实际行数还受 SQLite 单条语句的变量上限约束，并向下取到 2 的幂，
+// 尾巴按 64/32/.../1 拆，语句形状是固定的几种，都能留在 statement 缓存里复用。
+constexpr size_t kMaxBulkInsertRows = 64;
+constexpr size_t kSummaryInsertColumns = 10;
+constexpr size_t kSpanInsertColumns = 9;
+// ingest WAL 回放是至少一次：崩溃前已经落库、但 WAL 还没来得及解钉的 trace 会被再推一遍。
+// 只有带 replayed 标记的行用这组子句，主键冲突时直接跳过，不让一条重复记录把整批连同同批的新 trace 一起打回溢出队列；
+// 普通写入不带它，trace_key 被复用之类的真实冲突照旧让整批失败，不会悄悄丢掉新数据。
+// 跳过的 summary 行不触发 AFTER INSERT 触发器，小时计数也就不会被重复累加。
+constexpr const char* kSummaryConflictClause = " ON CONFLICT(trace_id) DO NOTHING";
+constexpr const char* kSpanConflictClause = " ON CONFLICT(trace_id, span_id) DO NOTHING";
+const std::string kMainSchema = "main";
+// 总数里时间窗两端不满一小时的边角：这个小时的计数不超过该值就按索引精确 COUNT，超过了按覆盖时长比例折算成近似值。
+// 边角 COUNT 只扫一个小时内的索引项，这个上限把单次查询的额外开销压在毫秒级。
+constexpr size_t kExactEdgeCountLimit = 10000;
+
+// 三张 trace 表的建表语句按 schema 模板化：主库和每个分区文件用同一份结构，@db. 在使用前替换成具体 schema 名。
+// 1) trace_summary / trace_analysis 用 INTEGER PRIMARY KEY，trace_id 直接就是 rowid，表本身按 trace_id 聚簇，不再单独存一份主键索引；
+// 2) trace_span 的主键是 (trace_id, span_id) 复合键，用 WITHOUT ROWID 让整张表按主键聚簇，
+//    同一条 trace 的 span 物理上连续，详情页一次范围扫描就能读完，也省掉了 rowid 表 + 主键索引的双份存储。
+//    详情页按 start_time_ms 排序发生在单条 trace 的几十个 span 里，不再单独为它建二级索引。
+// 外键引用不带 schema，SQLite 按子表所在的库解析父表，所以分区之间互不牵连。
+constexpr const char* kCreateTraceTablesSql = R"(
+CREATE TABLE IF NOT EXISTS @db.trace_summary (
+  trace_id INTEGER PRIMARY KEY,
+  service_name TEXT NOT NULL,
+  start_time_ms INTEGER NOT NULL,
+  end_time_ms INTEGER,
+  duration_ms INTEGER NOT NULL,
+  span_count INTEGER NOT NULL,
+  token_count INTEGER NOT NULL,
+  risk_level TEXT NOT NULL,
+  ai_status TEXT NOT NULL DEFAULT 'pending',
+  ai_error TEXT NOT NULL DEFAULT ''
+);
+
+CREATE TABLE IF NOT EXISTS @db.trace_span (
+  trace_id INTEGER NOT NULL,
+  span_id INTEGER NOT NULL,
+  parent_id INTEGER,
+  service_name TEXT NOT NULL,
+  operation TEXT NOT NULL,
+  start_time_ms INTEGER NOT NULL,
+  duration_ms INTEGER NOT NULL,
+  status TEXT NOT NULL,
+  attributes_json TEXT NOT NULL,
+  PRIMARY KEY (trace_id, span_id),
+  FOREIGN KEY (trace_id) REFERENCES trace_summary(trace_id)
+) WITHOUT ROWID;
+
+CREATE TABLE IF NOT EXISTS @db.trace_analysis (
+  trace_id INTEGER PRIMARY KEY,
+  risk_level TEXT NOT NULL,
+  summary TEXT NOT NULL,
+  root_cause TEXT NOT NULL,
+  solution TEXT NOT NULL,
+  confidence REAL NOT NULL,
+  FOREIGN KEY (trace_id) REFERENCES trace_summary(trace_id)
+);
+
+PRAGMA @db.user_version = 2;
+)";
+
+constexpr const char* kCreateTraceIndexesSql = R"(
+CREATE INDEX IF NOT EXISTS @db.idx_trace_summary_start_time_trace_id
+ON trace_summary(start_time_ms DESC, trace_id DESC);
+CREATE INDEX IF NOT EXISTS @db.idx_trace_summary_service_start_time_trace_id
+ON trace_summary(service_name, start_time_ms DESC, trace_id DESC);
+)";
+
+// 列表总数用的计数表：每个库按 (入口服务, 小时桶, 风险等级) 记 trace 条数，小时桶是 start_time_ms / 3600000。
+// 由 trace_summary 上的触发器同步增减，所以批量写、迁移、retention 删除、AI 回写改风险等级都不用在业务代码里各自记账；
+// 计数和数据在同一个事务里提交，不会出现“数据写进去了计数没加上”的中间态。
+// 触发器体里的表名不能带 schema（SQLite 按触发器所在的库解析），所以同一份模板对主库和分区都成立。
+constexpr const char* kCreateTraceCountersSql = R"(
+CREATE TABLE IF NOT EXISTS @db.trace_summary_hourly_counts (
+  service_name TEXT NOT NULL,
+  hour_bucket INTEGER NOT NULL,
+  risk_level TEXT NOT NULL,
+  trace_count INTEGER NOT NULL,
+  PRIMARY KEY (service_name, hour_bucket, risk_level)
+) WITHOUT ROWID;
+CREATE INDEX IF NOT EXISTS @db.idx_trace_summary_hourly_counts_hour
+ON trace_summary_hourly_counts(hour_bucket);
+
+CREATE TRIGGER IF NOT EXISTS @db.trg_trace_summary_count_insert
+AFTER INSERT ON trace_summary
+BEGIN
+  INSERT INTO trace_summary_hourly_counts (service_name, hour_bucket, risk_level, trace_count)
+  VALUES (NEW.service_name, NEW.start_time_ms / 3600000, NEW.risk_level, 1)
+  ON CONFLICT (service_name, hour_bucket, risk_level) DO UPDATE SET trace_count = trace_count + 1;
+END;
+
+CREATE TRIGGER IF NOT EXISTS @db.trg_trace_summary_count_delete
+AFTER DELETE ON trace_summary
+BEGIN
+  UPDATE trace_summary_hourly_counts SET trace_count = trace_count - 1
+  WHERE service_name = OLD.service_name AND hour_bucket = OLD.start_time_ms / 3600000 AND risk_level = OLD.risk_level;
+  DELETE FROM trace_summary_hourly_counts
+  WHERE service_name = OLD.service_name AND hour_bucket = OLD.start_time_ms / 3600000 AND risk_level = OLD.risk_level
+    AND trace_count <= 0;
+END;
+
+CREATE TRIGGER IF NOT EXISTS @db.trg_trace_summary_count_update
+AFTER UPDATE OF service_name, start_time_ms, risk_level ON trace_summary
+WHEN OLD.service_name IS NOT NEW.service_name
+  OR OLD.start_time_ms / 3600000 IS NOT NEW.start_time_ms / 3600000
+  OR OLD.risk_level IS NOT NEW.risk_level
+BEGIN
+  UPDATE trace_summary_hourly_counts SET trace_count = trace_count - 1
+  WHERE service_name = OLD.service_name AND hour_bucket = OLD.start_time_ms / 3600000 AND risk_level = OLD.risk_level;
+  DELETE FROM trace_summary_hourly_counts
+  WHERE service_name = OLD.service_name AND hour_bucket = OLD.start_time_ms / 3600000 AND risk_level = OLD.risk_level
+    AND trace_count <= 0;
+  INSERT INTO trace_summary_hourly_counts (service_name, hour_bucket, risk_level, trace_count)
+  VALUES (NEW.service_name, NEW.start_time_ms / 3600000, NEW.risk_level, 1)
+  ON CONFLICT (service_name, hour_bucket, risk_level) DO UPDATE SET trace_count = trace_count + 1;
+END;
+
+INSERT INTO @db.trace_summary_hourly_counts (service_name, hour_bucket, risk_level, trace_count)
+SELECT service_name, start_time_ms / 3600000, risk_level, COUNT(*)
+FROM @db.trace_summary
+GROUP BY service_name, start_time_ms / 3600000, risk_level;
+)";
+
+// 一次批量写里落到同一个库（main 或某个分区）的记录，指针指向调用方的批数据。
+struct WriteGroup
+{
+    std::string schema;
+    std::vector<const persistence::TraceSummary*> summaries;
+    std::vector<const persistence::TraceSpanRecord*> spans;
+};
+
+// 把 SQL 模板里的 @db. 换成具体 schema。单文件模式下统一是 main.，和不带前缀的写法等价。
+std::string WithSchema(std::string_view sql_template, const std::string& schema)
+{
+    std::string sql;
+    sql.reserve(sql_template.size() + 16);
+    size_t pos = 0;
+    while (true) {
+        const size_t marker = sql_template.find("@db.", pos);
+        if (marker == std::string_view::npos) {
+            sql.append(sql_template.substr(pos));
+            return sql;
+        }
+        sql.append(sql_template.substr(pos, marker - pos));
+        sql += schema;
+        sql += '.';
+        pos = marker + 4;
+    }
+}
+
+int64_t FloorToSpan(int64_t time_ms, int64_t span_ms)
+{
+    int64_t bucket = time_ms / span_ms;
+    if (time_ms % span_ms < 0) {
+        --bucket;
+    }
+    return bucket * span_ms;
+}
+
+// 分区名就是 UTC 日期（按天 YYYYMMDD，按小时 YYYYMMDDHH），运维直接看文件名就知道是哪段数据。
+std::string PartitionLabel(int64_t start_ms, int64_t span_ms)
+{
+    const std::time_t seconds = static_cast<std::time_t>(start_ms / 1000);
+    std::tm tm{};
+    gmtime_r(&seconds, &tm);
+    char buffer[16] = {0};
+    std::strftime(buffer, sizeof(buffer), span_ms == kMsPerHour ? "%Y%m%d%H" : "%Y%m%d", &tm);
+    return buffer;
+}
+
+// 启动时从文件名反推分区覆盖的时间段；两种粒度的文件可以并存（中途切换过 --trace-partition）。
+bool ParsePartitionLabel(std::string_view label, int64_t* start_ms, int64_t* span_ms)
+{
+    if (label.size() != 8 && label.size() != 10) {
+        return false;
+    }
+    auto parse_field = [label](size_t offset, size_t length, int* value) {
+        const char* begin = label.data() + offset;
+        const auto [ptr, ec] = std::from_chars(begin, begin + length, *value);
+        return ec == std::errc() && ptr == begin + length;
+    };
+    std::tm tm{};
+    int year = 0;
+    int month = 0;
+    int day = 0;
+    int hour = 0;
+    if (!parse_field(0, 4, &year) || !parse_field(4, 2, &month) || !parse_field(6, 2, &day) ||
+        (label.size() == 10 && !parse_field(8, 2, &hour))) {
+        return false;
+    }
+    tm.tm_year = year - 1900;
+    tm.tm_mon = month - 1;
+    tm.tm_mday = day;
+    tm.tm_hour = hour;
+    const std::time_t seconds = timegm(&tm);
+    if (seconds == static_cast<std::time_t>(-1)) {
+        return false;
+    }
+    *span_ms = label.size() == 10 ? kMsPerHour : kMsPerDay;
+    *start_ms = static_cast<int64_t>(seconds) * 1000;
+    // 20240231 这种被 timegm 归一化过的非法日期，反格式化回来对不上，直接忽略。
+    return PartitionLabel(*start_ms, *span_ms) == label;
+}
+
+void ExecSchemaSql(sqlite3* db, const std::string& sql, const char* error_context)
+{
+    char* errmsg = nullptr;
+    const int rc = sqlite3_exec(db, sql.c_str(), nullptr, nullptr, &errmsg);
+    if (errmsg) {
+        sqlite3_free(errmsg);
+    }
+    persistence::checkSqliteError(db, rc, error_context);
+}
+
+// trace_id/span_id 在接入侧本来就是 size_t，库里按 INTEGER 存：8 字节定长、比较是整数比较，索引也比十进制字符串小得多。
+// SQLite 的 INTEGER 是有符号 64 位，所以这里按位重解释：>= 2^63 的 key 落库后是负数，读出来再转回无符号，十进制字符串表示保持不变。
+// 上层接口仍然用十进制字符串传 id（HTTP/AI/告警都按字符串用），只在仓库边界做一次转换。
+bool ParseTraceKey(std::string_view text, sqlite3_int64* key)
+{
+    if (text.empty()) {
+        return false;
+    }
+    uint64_t value = 0;
+    const char* begin = text.data();
+    const char* end = begin + text.size();
+    const auto [ptr, ec] = std::from_chars(begin, end, value);
+    if (ec != std::errc() || ptr != end) {
+        return false;
+    }
+    *key = static_cast<sqlite3_int64>(value);
+    return true;
+}
+
+void BindTraceKey(sqlite3_stmt* stmt, int index, const std::string& id)
+{
+    sqlite3_int64 key = 0;
+    if (!ParseTraceKey(id, &key)) {
+        // 写入侧拿到非整数 id 说明上游构造记录出了问题，按普通 SQLite 错误一样抛出，让整批事务回滚。
+        throw std::runtime_error("Invalid trace key: '" + id + "'");
+    }
+    sqlite3_bind_int64(stmt, index, key);
+}
+
+std::string ColumnTraceKey(sqlite3_stmt* stmt, int column)
+{
+    return std::to_string(static_cast<uint64_t>(sqlite3_column_int64(stmt, column)));
+}
+
+void LegacyTraceKeyFunction(sqlite3_context* context, int /*argc*/, sqlite3_value** argv)
+{
+    const unsigned char* text = sqlite3_value_type(argv[0]) == SQLITE_NULL ? nullptr : sqlite3_value_text(argv[0]);
+    sqlite3_int64 key = 0;
+    if (!text ||
+        !ParseTraceKey(std::string_view(reinterpret_cast<const char*>(text),
+                                        static_cast<size_t>(sqlite3_value_bytes(argv[0]))),
+                       &key)) {
+        sqlite3_result_null(context);
+        return;
+    }
+    sqlite3_result_int64(context, key);
+}
 
 std::string BuildInClausePlaceholders(size_t count)
 {
@@ -34,54 +319,406 @@ std::string TruncateAiError(const std::string& ai_error)
 }
 
 void UpdateSummaryAiState(sqlite3* db,
+                          const std::string& schema,
                           const std::string& trace_id,
                           const std::string& ai_status,
                           const std::string& ai_error)
 {
-    const char* sql_update_summary_ai_state = R"(
-        UPDATE trace_summary
+    const std::string sql_update_summary_ai_state = WithSchema(R"(
+        UPDATE @db.trace_summary
         SET ai_status = ?, ai_error = ?
         WHERE trace_id = ?;
-    )";
+    )", schema);
     persistence::StmtPtr update_stmt;
     sqlite3_stmt* raw_stmt = nullptr;
-    const int rc = sqlite3_prepare_v2(db, sql_update_summary_ai_state, -1, &raw_stmt, nullptr);
+    const int rc = sqlite3_prepare_v2(db, sql_update_summary_ai_state.c_str(), -1, &raw_stmt, nullptr);
     persistence::checkSqliteError(db, rc, "Prepare trace_summary ai_state update");
     update_stmt.reset(raw_stmt);
 
     const std::string truncated_ai_error = TruncateAiError(ai_error);
     sqlite3_bind_text(update_stmt.get(), 1, ai_status.c_str(), -1, SQLITE_STATIC);
     sqlite3_bind_text(update_stmt.get(), 2, truncated_ai_error.c_str(), -1, SQLITE_TRANSIENT);
-    sqlite3_bind_text(update_stmt.get(), 3, trace_id.c_str(), -1, SQLITE_STATIC);
+    BindTraceKey(update_stmt.get(), 3, trace_id);
 
     const int step_rc = sqlite3_step(update_stmt.get());
     persistence::checkSqliteError(db, step_rc, "Update trace_summary ai_state");
 }
 
 void UpdateSummaryAnalysisOutcome(sqlite3* db,
+                                  const std::string& schema,
                                   const std::string& trace_id,
-                                  const std::string& risk_level)
+                                  const std::string& risk_level,
+                                  const std::string& ai_status)
 {
-    const char* sql_update_summary_outcome = R"(
-        UPDATE trace_summary
-        SET risk_level = ?, ai_status = 'completed', ai_error = ''
+    const std::string sql_update_summary_outcome = WithSchema(R"(
+        UPDATE @db.trace_summary
+        SET risk_level = ?, ai_status = ?, ai_error = ''
         WHERE trace_id = ?;
-    )";
+    )", schema);
     persistence::StmtPtr update_stmt;
     sqlite3_stmt* raw_stmt = nullptr;
-    const int rc = sqlite3_prepare_v2(db, sql_update_summary_outcome, -1, &raw_stmt, nullptr);
+    const int rc = sqlite3_prepare_v2(db, sql_update_summary_outcome.c_str(), -1, &raw_stmt, nullptr);
     persistence::checkSqliteError(db, rc, "Prepare trace_summary analysis outcome update");
     update_stmt.reset(raw_stmt);
 
     sqlite3_bind_text(update_stmt.get(), 1, risk_level.c_str(), -1, SQLITE_STATIC);
-    sqlite3_bind_text(update_stmt.get(), 2, trace_id.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_text(update_stmt.get(), 2, ai_status.c_str(), -1, SQLITE_STATIC);
+    BindTraceKey(update_stmt.get(), 3, trace_id);
 
     const int step_rc = sqlite3_step(update_stmt.get());
     persistence::checkSqliteError(db, step_rc, "Update trace_summary analysis outcome");
 }
+
+// 一条多行 INSERT 能带的行数：不超过 kMaxBulkInsertRows，也不超过变量上限 / 列数，取 2 的幂。
+size_t BulkInsertRows(sqlite3* db, size_t columns)
+{
+    const int variable_limit = sqlite3_limit(db, SQLITE_LIMIT_VARIABLE_NUMBER, -1);
+    const size_t by_variables = std::max<size_t>(static_cast<size_t>(std::max(variable_limit, 0)) / columns, 1);
+    size_t rows = 1;
+    while (rows * 2 <= std::min(kMaxBulkInsertRows, by_variables)) {
+        rows *= 2;
+    }
+    return rows;
+}
+
+// 多行 INSERT 的 VALUES 部分："(?, ?, ...), (?, ?, ...)"。
+std::string BuildMultiRowValues(size_t rows, size_t columns)
+{
+    std::string row = "(";
+    for (size_t column = 0; column < columns; ++column) {
+        row += column == 0 ? "?" : ", ?";
+    }
+    row += ")";
+    std::string values;
+    values.reserve(rows * (row.size() + 2));
+    for (size_t index = 0; index < rows; ++index) {
+        if (index > 0) {
+            values += ", ";
+        }
+        values += row;
+    }
+    return values;
+}
+
+// 这里沿用 SQLITE_STATIC：批数据在整条语句 step 完之前都由调用方持有，可以避免 SQLite 再做一次字符串拷贝。
+int BindSummaryRow(sqlite3_stmt* stmt, int index, const persistence::TraceSummary& summary)
+{
+    BindTraceKey(stmt, index++, summary.trace_id);
+    sqlite3_bind_text(stmt, index++, summary.service_name.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, index++, summary.start_time_ms);
+    if (summary.end_time_ms.has_value()) {
+        sqlite3_bind_int64(stmt, index++, summary.end_time_ms.value());
+    } else {
+        sqlite3_bind_null(stmt, index++);
+    }
+    sqlite3_bind_int64(stmt, index++, summary.duration_ms);
+    sqlite3_bind_int64(stmt, index++, static_cast<sqlite3_int64>(summary.span_count));
+    sqlite3_bind_int64(stmt, index++, static_cast<sqlite3_int64>(summary.token_count));
+    sqlite3_bind_text(stmt, index++, summary.risk_level.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, index++, summary.ai_status.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, index++, summary.ai_error.c_str(), -1, SQLITE_STATIC);
+    return index;
+}
+
+int BindSpanRow(sqlite3_stmt* stmt, int index, const persistence::TraceSpanRecord& span)
+{
+    BindTraceKey(stmt, index++, span.trace_id);
+    BindTraceKey(stmt, index++, span.span_id);
+    if (span.parent_id.has_value()) {
+        BindTraceKey(stmt, index++, *span.parent_id);
+    } else {
+        sqlite3_bind_null(stmt, index++);
+    }
+    sqlite3_bind_text(stmt, index++, span.service_name.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, index++, span.operation.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, index++, span.start_time_ms);
+    sqlite3_bind_int64(stmt, index++, span.duration_ms);
+    sqlite3_bind_text(stmt, index++, span.status.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, index++, span.attributes_json.c_str(), -1, SQLITE_STATIC);
+    return index;
+}
+
+// 把一组记录按多行 INSERT 写进去：先用最大块，剩下不足一块的尾巴按 2 的幂往下拆。
+// 一次满 buffer 的 flush（几百上千个 span）只剩十几条语句，每条一次 sqlite3_step。
+// insert_suffix 接在 VALUES 之后，重放行用它带上 ON CONFLICT 子句；返回真正插进去的行数，和 rows 的差就是被跳过的行。
+template <typename Record, typename BindRow>
+size_t InsertRowsInChunks(sqlite3* db,
+                        persistence::SqliteStatementCache& stmt_cache,
+                        const std::string& insert_prefix,
+                        const char* insert_suffix,
+                        size_t columns,
+                        const std::vector<const Record*>& rows,
+                        BindRow bind_row,
+                        const char* error_context)
+{
+    const size_t max_chunk = BulkInsertRows(db, columns);
+    size_t offset = 0;
+    size_t inserted = 0;
+    while (offset < rows.size()) {
+        size_t chunk = max_chunk;
+        while (chunk > rows.size() - offset) {
+            chunk /= 2;
+        }
+        persistence::SqliteStatementCache::Handle stmt =
+            stmt_cache.Acquire(insert_prefix + BuildMultiRowValues(chunk, columns) + insert_suffix + ";", error_context);
+        int bind_index = 1;
+        for (size_t index = 0; index < chunk; ++index) {
+            bind_index = bind_row(stmt.get(), bind_index, *rows[offset + index]);
+        }
+        const int rc = sqlite3_step(stmt.get());
+        persistence::checkSqliteError(db, rc, error_context);
+        inserted += static_cast<size_t>(sqlite3_changes(db));
+        offset += chunk;
+    }
+    return inserted;
+}
+
+// 批量写之前把一组记录按主键排好：trace_id 是哈希出来的随机整数，按到达顺序插入时每一行都落在 B 树的随机位置；
+// 排序后同一批的插入沿着主键顺序推进，相邻几行落在同一批页上，页缓存命中更好，页分裂也更少。
+// 解析失败的 key 排在哪里都无所谓，绑定时 BindTraceKey 会照常抛出让整批回滚。
+void SortGroupByPrimaryKey(WriteGroup* group)
+{
+    auto key_of = [](const std::string& id) {
+        sqlite3_int64 key = 0;
+        ParseTraceKey(id, &key);
+        return key;
+    };
+    std::vector<std::pair<sqlite3_int64, const persistence::TraceSummary*>> summary_keys;
+    summary_keys.reserve(group->summaries.size());
+    for (const persistence::TraceSummary* summary : group->summaries) {
+        summary_keys.emplace_back(key_of(summary->trace_id), summary);
+    }
+    std::stable_sort(summary_keys.begin(), summary_keys.end(), [](const auto& lhs, const auto& rhs) {
+        return lhs.first < rhs.first;
+    });
+    for (size_t index = 0; index < summary_keys.size(); ++index) {
+        group->summaries[index] = summary_keys[index].second;
+    }
+
+    struct SpanKey
+    {
+        sqlite3_int64 trace_key;
+        sqlite3_int64 span_key;
+        const persistence::TraceSpanRecord* span;
+    };
+    std::vector<SpanKey> span_keys;
+    span_keys.reserve(group->spans.size());
+    for (const persistence::TraceSpanRecord* span : group->spans) {
+        span_keys.push_back(SpanKey{key_of(span->trace_id), key_of(span->span_id), span});
+    }
+    std::stable_sort(span_keys.begin(), span_keys.end(), [](const SpanKey& lhs, const SpanKey& rhs) {
+        return lhs.trace_key != rhs.trace_key ? lhs.trace_key < rhs.trace_key : lhs.span_key < rhs.span_key;
+    });
+    for (size_t index = 0; index < span_keys.size(); ++index) {
+        group->spans[index] = span_keys[index].span;
+    }
+}
+
+// 老库（以及上一版本建出来的分区文件）没有计数表：建表、建触发器、按现有数据回填放在同一个事务里，
+// 回填和触发器生效之间不会漏记或重记。表已经在的库直接返回。必须在事务外调用。
+void EnsureTraceCounters(sqlite3* db, const std::string& schema)
+{
+    {
+        persistence::StmtPtr exists_stmt;
+        sqlite3_stmt* raw_stmt = nullptr;
+        const std::string sql_exists =
+            "SELECT 1 FROM " + schema + ".sqlite_master WHERE type = 'table' AND name = 'trace_summary_hourly_counts';";
+        const int rc = sqlite3_prepare_v2(db, sql_exists.c_str(), -1, &raw_stmt, nullptr);
+        persistence::checkSqliteError(db, rc, "Prepare trace counter table query");
+        exists_stmt.reset(raw_stmt);
+        if (sqlite3_step(exists_stmt.get()) == SQLITE_ROW) {
+            return;
+        }
+    }
+    const std::string sql = "BEGIN IMMEDIATE;" + WithSchema(kCreateTraceCountersSql, schema) + "COMMIT;";
+    char* errmsg = nullptr;
+    const int rc = sqlite3_exec(db, sql.c_str(), nullptr, nullptr, &errmsg);
+    if (errmsg) {
+        sqlite3_free(errmsg);
+    }
+    if (rc != SQLITE_OK) {
+        sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
+    }
+    persistence::checkSqliteError(db, rc, "Create trace counters");
+}
+
+// 列表搜索的 WHERE：服务、风险等级、时间窗上下界、键集游标各自可选。
+// 时间窗上下界不直接取请求里的值，是因为总数的边角 COUNT 要用同一套过滤条件查自己的小区间。
+std::string BuildTraceFilterSql(const TraceSearchRequest& request, bool has_lower, bool has_upper, bool has_cursor)
+{
+    std::string sql = " WHERE 1 = 1";
+    if (request.service_name.has_value() && !request.service_name->empty()) {
+        sql += " AND service_name = ?";
+    }
+    if (!request.risk_levels.empty()) {
+        sql += " AND risk_level IN " + BuildInClausePlaceholders(request.risk_levels.size());
+    }
+    // 这里很容易混：请求里的 start_time_ms / end_time_ms 是“搜索时间窗边界”，
+    // 不是让 SQL 去比较 trace_summary.end_time_ms 这一列。
+    // 当前列表搜索统一钉在 trace_summary.start_time_ms 上做范围过滤，也就是：
+    // request.start_time_ms <= trace_summary.start_time_ms < request.end_time_ms
+    // 这样时间筛选语义和列表排序字段保持一致，索引也更容易命中。
+    if (has_lower) {
+        sql += " AND start_time_ms >= ?";
+    }
+    if (has_upper) {
+        sql += " AND start_time_ms < ?";
+    }
+    // 行值比较和排序键 (start_time_ms DESC, trace_id DESC) 一致，SQLite 直接把它当成索引上的范围起点。
+    if (has_cursor) {
+        sql += " AND (start_time_ms, trace_id) < (?, ?)";
+    }
+    return sql;
+}
+
+// bind 顺序必须和 BuildTraceFilterSql 追加占位符的顺序完全一致，返回下一个可用的参数位置。
+int BindTraceFilters(sqlite3_stmt* stmt,
+                     const TraceSearchRequest& request,
+                     std::optional<int64_t> lower,
+                     std::optional<int64_t> upper,
+                     const std::optional<std::pair<int64_t, sqlite3_int64>>& cursor)
+{
+    int bind_index = 1;
+    if (request.service_name.has_value() && !request.service_name->empty()) {
+        sqlite3_bind_text(stmt, bind_index++, request.service_name->c_str(), -1, SQLITE_TRANSIENT);
+    }
+    for (const auto& risk_level : request.risk_levels) {
+        sqlite3_bind_text(stmt, bind_index++, risk_level.c_str(), -1, SQLITE_TRANSIENT);
+    }
+    if (lower.has_value()) {
+        sqlite3_bind_int64(stmt, bind_index++, static_cast<sqlite3_int64>(lower.value()));
+    }
+    if (upper.has_value()) {
+        sqlite3_bind_int64(stmt, bind_index++, static_cast<sqlite3_int64>(upper.value()));
+    }
+    if (cursor.has_value()) {
+        sqlite3_bind_int64(stmt, bind_index++, static_cast<sqlite3_int64>(cursor->first));
+        sqlite3_bind_int64(stmt, bind_index++, cursor->second);
+    }
+    return bind_index;
+}
+
+size_t StepCount(sqlite3* db, sqlite3_stmt* stmt, const char* error_context)
+{
+    const int rc = sqlite3_step(stmt);
+    if (rc == SQLITE_ROW) {
+        return static_cast<size_t>(std::max<sqlite3_int64>(sqlite3_column_int64(stmt, 0), 0));
+    }
+    persistence::checkSqliteError(db, rc, error_context);
+    return 0;
+}
+
+// 按索引精确数 [lower, upper) 里满足过滤条件的 trace；没有计数表的库、以及分页跳段需要精确值时用。
+size_t CountTracesExact(sqlite3* db,
+                        persistence::SqliteStatementCache& stmt_cache,
+                        const std::string& schema,
+                        const TraceSearchRequest& request,
+                        std::optional<int64_t> lower,
+                        std::optional<int64_t> upper)
+{
+    const std::string sql = "SELECT COUNT(*) FROM " + schema + ".trace_summary" +
+                            BuildTraceFilterSql(request, lower.has_value(), upper.has_value(), false) + ";";
+    persistence::SqliteStatementCache::Handle stmt = stmt_cache.Acquire(sql, "Prepare trace_summary count query");
+    BindTraceFilters(stmt.get(), request, lower, upper, std::nullopt);
+    return StepCount(db, stmt.get(), "Step trace_summary count query");
+}
+
+// 计数表里小时桶 [first_bucket, end_bucket) 的条数之和，服务和风险等级过滤与列表一致。
+size_t SumTraceCounters(sqlite3* db,
+                        persistence::SqliteStatementCache& stmt_cache,
+                        const std::string& schema,
+                        const TraceSearchRequest& request,
+                        int64_t first_bucket,
+                        int64_t end_bucket)
+{
+    std::string sql = "SELECT COALESCE(SUM(trace_count), 0) FROM " + schema +
+                      ".trace_summary_hourly_counts WHERE hour_bucket >= ? AND hour_bucket < ?";
+    if (request.service_name.has_value() && !request.service_name->empty()) {
+        sql += " AND service_name = ?";
+    }
+    if (!request.risk_levels.empty()) {
+        sql += " AND risk_level IN " + BuildInClausePlaceholders(request.risk_levels.size());
+    }
+    sql += ";";
+    persistence::SqliteStatementCache::Handle stmt = stmt_cache.Acquire(sql, "Prepare trace counter query");
+    int bind_index = 1;
+    sqlite3_bind_int64(stmt.get(), bind_index++, static_cast<sqlite3_int64>(first_bucket));
+    sqlite3_bind_int64(stmt.get(), bind_index++, static_cast<sqlite3_int64>(end_bucket));
+    if (request.service_name.has_value() && !request.service_name->empty()) {
+        sqlite3_bind_text(stmt.get(), bind_index++, request.service_name->c_str(), -1, SQLITE_TRANSIENT);
+    }
+    for (const auto& risk_level : request.risk_levels) {
+        sqlite3_bind_text(stmt.get(), bind_index++, risk_level.c_str(), -1, SQLITE_TRANSIENT);
+    }
+    return StepCount(db, stmt.get(), "Step trace counter query");
+}
+
+bool HasTraceCounters(sqlite3* db, persistence::SqliteStatementCache& stmt_cache, const std::string& schema)
+{
+    persistence::SqliteStatementCache::Handle stmt = stmt_cache.Acquire(
+        "SELECT COUNT(*) FROM " + schema +
+            ".sqlite_master WHERE type = 'table' AND name = 'trace_summary_hourly_counts';",
+        "Prepare trace counter table query");
+    return StepCount(db, stmt.get(), "Step trace counter table query") > 0;
+}
+
+// 一个库里满足搜索条件的 trace 数。整小时直接加计数表；时间窗两端不满一小时的边角先看那个小时的计数：
+// 没数据就是 0，不多时按索引精确 COUNT，很多时按覆盖时长比例折算并把 approximate 置上。
+// 计数表缺失（只读连接碰上还没被写连接补建计数表的老分区）时退回整段精确 COUNT；主库的计数表在构造时就补齐了，不用再查。
+size_t CountSegmentTraces(sqlite3* db,
+                          persistence::SqliteStatementCache& stmt_cache,
+                          const std::string& schema,
+                          const TraceSearchRequest& request,
+                          bool* approximate)
+{
+    if (schema != kMainSchema && !HasTraceCounters(db, stmt_cache, schema)) {
+        return CountTracesExact(db, stmt_cache, schema, request, request.start_time_ms, request.end_time_ms);
+    }
+
+    auto count_edge = [&](int64_t lower, int64_t upper) -> size_t {
+        const int64_t first_bucket = FloorToSpan(lower, kMsPerHour) / kMsPerHour;
+        const int64_t end_bucket = FloorToSpan(upper - 1, kMsPerHour) / kMsPerHour + 1;
+        const size_t bucket_total = SumTraceCounters(db, stmt_cache, schema, request, first_bucket, end_bucket);
+        if (bucket_total == 0) {
+            return 0;
+        }
+        if (bucket_total <= kExactEdgeCountLimit) {
+            return CountTracesExact(db, stmt_cache, schema, request, lower, upper);
+        }
+        *approximate = true;
+        const double covered = static_cast<double>(upper - lower) /
+                               static_cast<double>((end_bucket - first_bucket) * kMsPerHour);
+        return static_cast<size_t>(static_cast<double>(bucket_total) * covered + 0.5);
+    };
+
+    // [first_full, end_full) 是完全落在时间窗里的小时桶；没有上下界的一侧就一直延伸到头。
+    int64_t first_full = std::numeric_limits<int64_t>::min();
+    int64_t end_full = std::numeric_limits<int64_t>::max();
+    if (request.start_time_ms.has_value()) {
+        first_full = FloorToSpan(request.start_time_ms.value() + kMsPerHour - 1, kMsPerHour) / kMsPerHour;
+    }
+    if (request.end_time_ms.has_value()) {
+        end_full = FloorToSpan(request.end_time_ms.value(), kMsPerHour) / kMsPerHour;
+    }
+    if (first_full >= end_full) {
+        // 时间窗没覆盖任何整小时（调用方保证此时上下界都有），整个窗口就是一个边角。
+        return count_edge(request.start_time_ms.value(), request.end_time_ms.value());
+    }
+
+    size_t total = SumTraceCounters(db, stmt_cache, schema, request, first_full, end_full);
+    if (request.start_time_ms.has_value() && request.start_time_ms.value() < first_full * kMsPerHour) {
+        total += count_edge(request.start_time_ms.value(), first_full * kMsPerHour);
+    }
+    if (request.end_time_ms.has_value() && end_full * kMsPerHour < request.end_time_ms.value()) {
+        total += count_edge(end_full * kMsPerHour, request.end_time_ms.value());
+    }
+    return total;
+}
 } // namespace
 
-SqliteTraceRepository::SqliteTraceRepository(const std::string& db_path)
+SqliteTraceRepository::SqliteTraceRepository(const std::string& db_path,
+                                             size_t read_pool_size,
+                                             TracePartitionMode partition_mode)
     : db_path_(db_path)
 {
     std::string final_path;
@@ -98,7 +735,14 @@ SqliteTraceRepository::SqliteTraceRepository(const std::string& db_path)
         final_path = data_path + db_path_;
     }
 
-    int flags = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_FULLMUTEX;
+    final_path_ = final_path;
+    // :memory: 库每条连接各是一份独立的空库，只读连接池在这里没有意义，直接退回读写共用一条连接。
+    read_pool_size_ = final_path_ == ":memory:" ? 0 : read_pool_size;
+    // 分区要落独立文件，:memory: 库没有可以放分区文件的地方，同样退回单库。
+    partition_mode_ = final_path_ == ":memory:" ? TracePartitionMode::None : partition_mode;
+
+    // 写连接的所有访问都已经在 mutex_ 下串行，不再需要 FULLMUTEX 再套一层连接级互斥。
+    int flags = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_NOMUTEX;
     int rc = sqlite3_open_v2(final_path.c_str(), &db_, flags, nullptr);
     if (rc != SQLITE_OK) {
         std::cerr << "Cannot open trace database: " << sqlite3_errmsg(db_) << std::endl;
@@ -124,88 +768,691 @@ SqliteTraceRepository::SqliteTraceRepository(const std::string& db_path)
         errmsg = nullptr;
     }
 
-    const char* sql_create_tables = R"(
-CREATE TABLE IF NOT EXISTS trace_summary (
-  trace_id TEXT PRIMARY KEY,
-  service_name TEXT NOT NULL,
-  start_time_ms INTEGER NOT NULL,
-  end_time_ms INTEGER,
-  duration_ms INTEGER NOT NULL,
-  span_count INTEGER NOT NULL,
-  token_count INTEGER NOT NULL,
-  risk_level TEXT NOT NULL,
-  ai_status TEXT NOT NULL DEFAULT 'pending',
-  ai_error TEXT NOT NULL DEFAULT ''
-);
+    // legacy_trace_key() 只给旧表迁移用：把旧 schema 里的十进制字符串 id 转成新 schema 的整数 key，转不了的返回 NULL。
+    rc = sqlite3_create_function_v2(db_,
+                                    "legacy_trace_key",
+                                    1,
+                                    SQLITE_UTF8 | SQLITE_DETERMINISTIC,
+                                    nullptr,
+                                    LegacyTraceKeyFunction,
+                                    nullptr,
+                                    nullptr,
+                                    nullptr);
+    persistence::checkSqliteError(db_, rc, "Register legacy_trace_key function");
+
+    // schema 版本记在 PRAGMA user_version 里：0/1 是 TEXT 主键的旧表，2 是整数 key 的新表。
+    // 旧库不在构造函数里整库搬迁（大库可能要几分钟，服务起不来），而是先把旧表改名成 legacy_*，
+    // 马上建好新表开始接新数据，旧数据交给后台线程分批搬。
+    int user_version = 0;
+    {
+        persistence::StmtPtr version_stmt;
+        sqlite3_stmt* raw_stmt = nullptr;
+        rc = sqlite3_prepare_v2(db_, "PRAGMA user_version;", -1, &raw_stmt, nullptr);
+        persistence::checkSqliteError(db_, rc, "Prepare trace schema version query");
+        version_stmt.reset(raw_stmt);
+        if (sqlite3_step(version_stmt.get()) == SQLITE_ROW) {
+            user_version = sqlite3_column_int(version_stmt.get(), 0);
+        }
+    }
+    if (user_version < kTraceSchemaVersion) {
+        bool has_legacy_tables = false;
+        {
+            persistence::StmtPtr legacy_stmt;
+            sqlite3_stmt* raw_stmt = nullptr;
+            rc = sqlite3_prepare_v2(db_,
+                                    "SELECT COUNT(*) FROM sqlite_master WHERE type = 'table' AND name = 'trace_summary';",
+                                    -1,
+                                    &raw_stmt,
+                                    nullptr);
+            persistence::checkSqliteError(db_, rc, "Prepare legacy trace table query");
+            legacy_stmt.reset(raw_stmt);
+            has_legacy_tables = sqlite3_step(legacy_stmt.get()) == SQLITE_ROW && sqlite3_column_int(legacy_stmt.get(), 0) > 0;
+        }
+        if (has_legacy_tables) {
+            // 旧表上的排序索引迁移时用不到（按 rowid 分批），先删掉，也给新表腾出同名索引。
+            // 改名时 SQLite 会把子表外键里引用的父表名一起改掉，legacy_* 三张表之间的外键关系保持不变。
+            const char* sql_rename_legacy = R"(
+BEGIN TRANSACTION;
+DROP INDEX IF EXISTS idx_trace_summary_start_time_trace_id;
+DROP INDEX IF EXISTS idx_trace_summary_service_start_time_trace_id;
+DROP INDEX IF EXISTS idx_trace_span_trace_start_time_span_id;
+ALTER TABLE trace_summary RENAME TO legacy_trace_summary;
+ALTER TABLE trace_span RENAME TO legacy_trace_span;
+ALTER TABLE trace_analysis RENAME TO legacy_trace_analysis;
+COMMIT;
+)";
+            errmsg = nullptr;
+            rc = sqlite3_exec(db_, sql_rename_legacy, nullptr, nullptr, &errmsg);
+            if (errmsg) {
+                sqlite3_free(errmsg);
+                errmsg = nullptr;
+            }
+            if (rc != SQLITE_OK) {
+                sqlite3_exec(db_, "ROLLBACK;", nullptr, nullptr, nullptr);
+            }
+            persistence::checkSqliteError(db_, rc, "Rename legacy trace tables");
+        }
+    }
 
-CREATE TABLE IF NOT EXISTS trace_span (
-  trace_id TEXT NOT NULL,
-  span_id TEXT NOT NULL,
-  parent_id TEXT,
-  service_name TEXT NOT NULL,
-  operation TEXT NOT NULL,
-  start_time_ms INTEGER NOT NULL,
-  duration_ms INTEGER NOT NULL,
-  status TEXT NOT NULL,
-  attributes_json TEXT NOT NULL,
-  PRIMARY KEY (trace_id, span_id),
-  FOREIGN KEY (trace_id) REFERENCES trace_summary(trace_id)
-);
+    ExecSchemaSql(db_, WithSchema(kCreateTraceTablesSql, kMainSchema), "Failed to create trace tables");
 
-CREATE TABLE IF NOT EXISTS trace_analysis (
-  trace_id TEXT PRIMARY KEY,
-  risk_level TEXT NOT NULL,
-  summary TEXT NOT NULL,
-  root_cause TEXT NOT NULL,
-  solution TEXT NOT NULL,
-  confidence REAL NOT NULL,
-  FOREIGN KEY (trace_id) REFERENCES trace_summary(trace_id)
-);
-)";
+    errmsg = nullptr;
+    rc = sqlite3_exec(db_, WithSchema(kCreateTraceIndexesSql, kMainSchema).c_str(), nullptr, nullptr, &errmsg);
+    if (errmsg) {
+        sqlite3_free(errmsg);
+        errmsg = nullptr;
+    }
+    if (rc != SQLITE_OK) {
+        std::cerr << "Cannot create trace indexes: " << sqlite3_errmsg(db_) << std::endl;
+    }
+    // 计数表在升级后第一次启动时按现有数据回填一次；旧 schema 迁移过来的数据走 INSERT，由触发器计入。
+    EnsureTraceCounters(db_, kMainSchema);
+
+    if (PartitioningEnabled()) {
+        // 每条连接能同时 ATTACH 的库数是 SQLite 编译期上限（默认 10），分区数超过它时按 LRU 换入换出。
+        attach_capacity_ = static_cast<size_t>(std::max(sqlite3_limit(db_, SQLITE_LIMIT_ATTACHED, -1), 0));
+        if (attach_capacity_ == 0) {
+            std::cerr << "[SqliteTraceRepository] SQLite was built without ATTACH support, trace partitioning disabled"
+                      << std::endl;
+            partition_mode_ = TracePartitionMode::None;
+        }
+    }
+    partition_span_ms_ = partition_mode_ == TracePartitionMode::Hour ? kMsPerHour : kMsPerDay;
+    if (PartitioningEnabled()) {
+        // 分区文件和主库放在同一目录，文件名是 <主库文件名>.p<UTC 日期>；两种粒度的旧文件都认，保证切换粒度后旧数据仍然可查。
+        const std::filesystem::path main_path(final_path_);
+        const std::filesystem::path directory = main_path.has_parent_path() ? main_path.parent_path() : ".";
+        const std::string prefix = main_path.filename().string() + ".p";
+        std::error_code ec;
+        for (const auto& entry : std::filesystem::directory_iterator(directory, ec)) {
+            const std::string name = entry.path().filename().string();
+            if (name.size() <= prefix.size() || name.compare(0, prefix.size(), prefix) != 0) {
+                continue;
+            }
+            int64_t start_ms = 0;
+            int64_t span_ms = 0;
+            const std::string label = name.substr(prefix.size());
+            if (!ParsePartitionLabel(label, &start_ms, &span_ms)) {
+                continue;
+            }
+            partitions_.push_back(PartitionInfo{start_ms, start_ms + span_ms, "p" + label, entry.path().string()});
+        }
+        std::sort(partitions_.begin(), partitions_.end(), [](const PartitionInfo& lhs, const PartitionInfo& rhs) {
+            return lhs.start_ms < rhs.start_ms;
+        });
+        std::cout << "[SqliteTraceRepository] trace partitioning enabled"
+                  << " span=" << (partition_mode_ == TracePartitionMode::Hour ? "hour" : "day")
+                  << " existing_partitions=" << partitions_.size()
+                  << " attach_capacity=" << attach_capacity_ << std::endl;
+    }
+
+    write_stmt_cache_ = std::make_unique<persistence::SqliteStatementCache>(
+        db_,
+        kStatementCacheCapacity + attach_capacity_ * kPartitionStatementCacheSlots,
+        &write_stmt_cache_hits_,
+        &write_stmt_cache_misses_);
+
+    // 上次进程退出时可能还没搬完，所以不看本次有没有改名，只看 legacy 表还在不在。
+    {
+        persistence::StmtPtr pending_stmt;
+        sqlite3_stmt* raw_stmt = nullptr;
+        rc = sqlite3_prepare_v2(db_,
+                                "SELECT COUNT(*) FROM sqlite_master WHERE type = 'table' AND name = 'legacy_trace_summary';",
+                                -1,
+                                &raw_stmt,
+                                nullptr);
+        persistence::checkSqliteError(db_, rc, "Prepare legacy trace migration query");
+        pending_stmt.reset(raw_stmt);
+        legacy_migration_pending_.store(
+            sqlite3_step(pending_stmt.get()) == SQLITE_ROW && sqlite3_column_int(pending_stmt.get(), 0) > 0,
+            std::memory_order_release);
+    }
+    if (legacy_migration_pending_.load(std::memory_order_acquire)) {
+        std::cout << "[SqliteTraceRepository] legacy TEXT-key trace tables found, migrating to schema v"
+                  << kTraceSchemaVersion << " in background" << std::endl;
+        legacy_migration_thread_ = std::thread([this]() { RunLegacyMigration(); });
+    }
+}
+
+SqliteTraceRepository::~SqliteTraceRepository()
+{
+    {
+        std::lock_guard<std::mutex> lock(legacy_migration_mutex_);
+        legacy_migration_stopping_ = true;
+    }
+    legacy_migration_cv_.notify_all();
+    if (legacy_migration_thread_.joinable()) {
+        legacy_migration_thread_.join();
+    }
+    // 析构时不应再有借出的只读连接：持有 repo 的 handler/线程池要先于 repo 回收。
+    idle_read_connections_.clear();
+    // 缓存里的 stmt 要先于写连接 finalize。
+    write_stmt_cache_.reset();
+    if (db_) {
+        sqlite3_close_v2(db_);
+    }
+}
+
+SqliteTraceRepository::ReadConnection::~ReadConnection()
+{
+    stmt_cache.reset();
+    if (db) {
+        sqlite3_close_v2(db);
+    }
+}
+
+SqliteTraceRepository::ReadConnectionLease::ReadConnectionLease(SqliteTraceRepository* repo)
+    : repo_(repo),
+      conn_(repo->AcquireReadConnection())
+{
+}
+
+SqliteTraceRepository::ReadConnectionLease::~ReadConnectionLease()
+{
+    repo_->ReleaseReadConnection(std::move(conn_));
+}
+
+std::unique_ptr<SqliteTraceRepository::ReadConnection> SqliteTraceRepository::AcquireReadConnection()
+{
+    std::unique_ptr<ReadConnection> idle_conn;
+    {
+        std::unique_lock<std::mutex> lock(read_pool_mutex_);
+        read_pool_cv_.wait(lock, [this]() {
+            return !idle_read_connections_.empty() || opened_read_connections_ < read_pool_size_;
+        });
+        if (!idle_read_connections_.empty()) {
+            idle_conn = std::move(idle_read_connections_.back());
+            idle_read_connections_.pop_back();
+        } else {
+            // 先占住名额再出锁打开连接，打开文件期间不挡其它线程归还/借用已有连接。
+            ++opened_read_connections_;
+        }
+    }
+    if (idle_conn) {
+        // 借出期间被 retention 删掉的分区，在下次借出时补 DETACH。
+        if (PartitioningEnabled()) {
+            DetachStalePartitions(idle_conn->db, idle_conn->attached_partitions);
+        }
+        return idle_conn;
+    }
+
+    auto conn = std::make_unique<ReadConnection>();
+    const int flags = SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX;
+    const int rc = sqlite3_open_v2(final_path_.c_str(), &conn->db, flags, nullptr);
+    if (rc != SQLITE_OK) {
+        const std::string error = conn->db ? sqlite3_errmsg(conn->db) : "out of memory";
+        conn.reset();
+        {
+            std::lock_guard<std::mutex> lock(read_pool_mutex_);
+            --opened_read_connections_;
+        }
+        read_pool_cv_.notify_one();
+        throw std::runtime_error("Cannot open trace read connection: " + error);
+    }
+    // WAL 下读者基本不会被写者挡住，只有 checkpoint/恢复等少数时刻会短暂 BUSY，给一个小的等待窗口即可。
+    sqlite3_busy_timeout(conn->db, 1000);
+    conn->stmt_cache = std::make_unique<persistence::SqliteStatementCache>(
+        conn->db,
+        kStatementCacheCapacity + attach_capacity_ * kPartitionStatementCacheSlots,
+        &read_stmt_cache_hits_,
+        &read_stmt_cache_misses_);
+    return conn;
+}
+
+void SqliteTraceRepository::ReleaseReadConnection(std::unique_ptr<ReadConnection> conn)
+{
+    {
+        std::lock_guard<std::mutex> lock(read_pool_mutex_);
+        idle_read_connections_.push_back(std::move(conn));
+    }
+    read_pool_cv_.notify_one();
+}
+
+size_t SqliteTraceRepository::OpenedReadConnections()
+{
+    std::lock_guard<std::mutex> lock(read_pool_mutex_);
+    return opened_read_connections_;
+}
+
+std::vector<SqliteTraceRepository::PartitionInfo> SqliteTraceRepository::SnapshotPartitions()
+{
+    std::lock_guard<std::mutex> lock(partition_mutex_);
+    return partitions_;
+}
+
+std::vector<std::string> SqliteTraceRepository::PartitionNames()
+{
+    std::vector<std::string> names;
+    std::lock_guard<std::mutex> lock(partition_mutex_);
+    names.reserve(partitions_.size());
+    for (const auto& partition : partitions_) {
+        names.push_back(partition.schema);
+    }
+    return names;
+}
+
+bool SqliteTraceRepository::AttachPartition(sqlite3* db,
+                                            AttachedPartitions& attached,
+                                            const PartitionInfo& partition,
+                                            bool create)
+{
+    const auto iter = std::find(attached.begin(), attached.end(), partition.schema);
+    if (iter != attached.end()) {
+        attached.splice(attached.begin(), attached, iter);
+        return true;
+    }
+    if (!create && !std::filesystem::exists(partition.path)) {
+        return false;
+    }
+
+    char* errmsg = nullptr;
+    if (attached.size() >= attach_capacity_) {
+        const std::string detach_sql = "DETACH DATABASE " + attached.back() + ";";
+        const int rc = sqlite3_exec(db, detach_sql.c_str(), nullptr, nullptr, &errmsg);
+        if (errmsg) {
+            sqlite3_free(errmsg);
+            errmsg = nullptr;
+        }
+        persistence::checkSqliteError(db, rc, "Detach least recently used trace partition");
+        attached.pop_back();
+    }
+
+    // schema 名是我们自己按日期生成的 p + 数字，可以直接拼；文件路径走参数绑定，不用关心引号转义。
+    {
+        const std::string attach_sql = "ATTACH DATABASE ? AS " + partition.schema + ";";
+        persistence::StmtPtr attach_stmt;
+        sqlite3_stmt* raw_stmt = nullptr;
+        int rc = sqlite3_prepare_v2(db, attach_sql.c_str(), -1, &raw_stmt, nullptr);
+        persistence::checkSqliteError(db, rc, "Prepare trace partition attach");
+        attach_stmt.reset(raw_stmt);
+        sqlite3_bind_text(attach_stmt.get(), 1, partition.path.c_str(), -1, SQLITE_TRANSIENT);
+        rc = sqlite3_step(attach_stmt.get());
+        persistence::checkSqliteError(db, rc, "Attach trace partition");
+    }
+    attached.push_front(partition.schema);
+    partition_attaches_.fetch_add(1, std::memory_order_relaxed);
+
+    if (create) {
+        // 新分区文件同样开 WAL；journal_mode 只能在事务外设置，所以建表也放在写事务开始之前。
+        ExecSchemaSql(db, "PRAGMA " + partition.schema + ".journal_mode=WAL;", "Set trace partition WAL mode");
+        ExecSchemaSql(db, WithSchema(kCreateTraceTablesSql, partition.schema), "Create trace partition tables");
+        ExecSchemaSql(db, WithSchema(kCreateTraceIndexesSql, partition.schema), "Create trace partition indexes");
+        EnsureTraceCounters(db, partition.schema);
+    }
+    return true;
+}
+
+void SqliteTraceRepository::DetachStalePartitions(sqlite3* db, AttachedPartitions& attached)
+{
+    if (attached.empty()) {
+        return;
+    }
+    const std::vector<PartitionInfo> partitions = SnapshotPartitions();
+    for (auto iter = attached.begin(); iter != attached.end();) {
+        const bool alive = std::any_of(partitions.begin(), partitions.end(), [&iter](const PartitionInfo& partition) {
+            return partition.schema == *iter;
+        });
+        if (alive) {
+            ++iter;
+            continue;
+        }
+        const std::string detach_sql = "DETACH DATABASE " + *iter + ";";
+        char* errmsg = nullptr;
+        const int rc = sqlite3_exec(db, detach_sql.c_str(), nullptr, nullptr, &errmsg);
+        if (rc != SQLITE_OK) {
+            std::cerr << "[SqliteTraceRepository] detach dropped partition failed"
+                      << " schema=" << *iter
+                      << " error=" << (errmsg ? errmsg : "unknown") << std::endl;
+        }
+        if (errmsg) {
+            sqlite3_free(errmsg);
+        }
+        iter = attached.erase(iter);
+    }
+}
+
+std::string SqliteTraceRepository::LocateTraceSchema(sqlite3* db,
+                                                     persistence::SqliteStatementCache& stmt_cache,
+                                                     AttachedPartitions& attached,
+                                                     int64_t trace_key)
+{
+    auto contains_trace = [&](const std::string& schema) {
+        persistence::SqliteStatementCache::Handle probe_stmt = stmt_cache.Acquire(
+            WithSchema("SELECT 1 FROM @db.trace_summary WHERE trace_id = ?;", schema),
+            "Prepare trace partition probe");
+        sqlite3_bind_int64(probe_stmt.get(), 1, trace_key);
+        const int rc = sqlite3_step(probe_stmt.get());
+        persistence::checkSqliteError(db, rc, "Step trace partition probe");
+        return rc == SQLITE_ROW;
+    };
+
+    // 单库模式下不需要探测，调用方的查询本身查不到就是不存在。
+    if (!PartitioningEnabled()) {
+        return kMainSchema;
+    }
+    // 详情/AI 回写基本都落在最近的分区，从新到旧探测通常第一两个分区就能命中；每次探测只是一次主键查找。
+    const std::vector<PartitionInfo> partitions = SnapshotPartitions();
+    for (auto iter = partitions.rbegin(); iter != partitions.rend(); ++iter) {
+        if (AttachPartition(db, attached, *iter, false) && contains_trace(iter->schema)) {
+            return iter->schema;
+        }
+    }
+    return contains_trace(kMainSchema) ? kMainSchema : std::string();
+}
+
+std::string SqliteTraceRepository::ResolveWritePartition(int64_t start_time_ms)
+{
+    if (!PartitioningEnabled()) {
+        return kMainSchema;
+    }
+
+    PartitionInfo target;
+    {
+        std::lock_guard<std::mutex> lock(partition_mutex_);
+        if (start_time_ms < partition_floor_ms_) {
+            return kMainSchema;
+        }
+        const auto covering = std::find_if(partitions_.begin(), partitions_.end(), [start_time_ms](const PartitionInfo& partition) {
+            return partition.start_ms <= start_time_ms && start_time_ms < partition.end_ms;
+        });
+        if (covering != partitions_.end()) {
+            target = *covering;
+        } else {
+            // 新分区按当前粒度对齐；如果和已有分区重叠（运行中途从按小时切到按天），退回按小时建，保证分区时间段互不重叠。
+            int64_t span_ms = partition_span_ms_;
+            int64_t start_ms = FloorToSpan(start_time_ms, span_ms);
+            const bool overlaps = std::any_of(partitions_.begin(), partitions_.end(), [&](const PartitionInfo& partition) {
+                return partition.start_ms < start_ms + span_ms && start_ms < partition.end_ms;
+            });
+            if (overlaps) {
+                span_ms = kMsPerHour;
+                start_ms = FloorToSpan(start_time_ms, span_ms);
+            }
+            const std::string label = PartitionLabel(start_ms, span_ms);
+            target = PartitionInfo{start_ms, start_ms + span_ms, "p" + label, final_path_ + ".p" + label};
+        }
+    }
+
+    const bool created = !std::filesystem::exists(target.path);
+    AttachPartition(db_, write_attached_partitions_, target, true);
+    if (created) {
+        // 先把文件和表建好再登记到分区目录，只读连接看到目录项时文件一定已经存在。
+        std::lock_guard<std::mutex> lock(partition_mutex_);
+        const auto insert_at = std::lower_bound(partitions_.begin(), partitions_.end(), target.start_ms,
+                                                [](const PartitionInfo& partition, int64_t start_ms) {
+                                                    return partition.start_ms < start_ms;
+                                                });
+        if (insert_at == partitions_.end() || insert_at->schema != target.schema) {
+            partitions_.insert(insert_at, target);
+        }
+        std::cout << "[SqliteTraceRepository] created trace partition " << target.path << std::endl;
+    }
+    return target.schema;
+}
+
+void SqliteTraceRepository::AttachWritePartitions(std::vector<std::string>* schemas)
+{
+    std::sort(schemas->begin(), schemas->end());
+    schemas->erase(std::unique(schemas->begin(), schemas->end()), schemas->end());
+    if (!PartitioningEnabled()) {
+        return;
+    }
+    std::vector<std::string> partition_schemas;
+    for (const auto& schema : *schemas) {
+        if (schema != kMainSchema) {
+            partition_schemas.push_back(schema);
+        }
+    }
+    if (partition_schemas.size() > attach_capacity_) {
+        // 一批数据横跨的分区比能同时 ATTACH 的还多（大量很久之前的迟到数据），最老的那些分区改写进主库，
+        // 保证整批仍然在一个事务里提交。schema 名按日期命名，字典序就是时间序。
+        std::cerr << "[SqliteTraceRepository] write batch spans " << partition_schemas.size()
+                  << " partitions, more than attach capacity " << attach_capacity_
+                  << ", oldest ones fall back to the main database" << std::endl;
+        partition_schemas.erase(partition_schemas.begin(),
+                                partition_schemas.end() - static_cast<std::ptrdiff_t>(attach_capacity_));
+    }
+    const std::vector<PartitionInfo> partitions = SnapshotPartitions();
+    std::vector<std::string> attached_schemas;
+    for (const auto& schema : partition_schemas) {
+        const auto partition = std::find_if(partitions.begin(), partitions.end(), [&schema](const PartitionInfo& info) {
+            return info.schema == schema;
+        });
+        if (partition != partitions.end()) {
+            AttachPartition(db_, write_attached_partitions_, *partition, true);
+            attached_schemas.push_back(schema);
+        }
+    }
+    // 调用方拿回来的是最终可写的 schema 集合；不在里面的按主库写。
+    attached_schemas.push_back(kMainSchema);
+    *schemas = std::move(attached_schemas);
+}
+
+std::string SqliteTraceRepository::LocateWriteSchema(const std::string& trace_id)
+{
+    sqlite3_int64 trace_key = 0;
+    if (!PartitioningEnabled() || !ParseTraceKey(trace_id, &trace_key)) {
+        return kMainSchema;
+    }
+    const std::string schema = LocateTraceSchema(db_, *write_stmt_cache_, write_attached_partitions_, trace_key);
+    return schema.empty() ? kMainSchema : schema;
+}
+
+SqliteTraceRepository::RuntimeStatsSnapshot SqliteTraceRepository::SnapshotRuntimeStats()
+{
+    RuntimeStatsSnapshot stats;
+    stats.write_stmt_cache_hits = write_stmt_cache_hits_.load(std::memory_order_relaxed);
+    stats.write_stmt_cache_misses = write_stmt_cache_misses_.load(std::memory_order_relaxed);
+    stats.read_stmt_cache_hits = read_stmt_cache_hits_.load(std::memory_order_relaxed);
+    stats.read_stmt_cache_misses = read_stmt_cache_misses_.load(std::memory_order_relaxed);
+    stats.opened_read_connections = OpenedReadConnections();
+    stats.legacy_migration_pending = LegacyMigrationPending();
+    stats.legacy_migrated_traces = legacy_migrated_traces_.load(std::memory_order_relaxed);
+    stats.legacy_skipped_traces = legacy_skipped_traces_.load(std::memory_order_relaxed);
+    {
+        std::lock_guard<std::mutex> lock(partition_mutex_);
+        stats.partitions = partitions_.size();
+    }
+    stats.partition_attaches = partition_attaches_.load(std::memory_order_relaxed);
+    stats.dropped_partitions = dropped_partitions_.load(std::memory_order_relaxed);
+    stats.replay_skipped_primary_rows = replay_skipped_primary_rows_.load(std::memory_order_relaxed);
+    stats.replay_skipped_analyses = replay_skipped_analyses_.load(std::memory_order_relaxed);
+    return stats;
+}
+
+std::string SqliteTraceRepository::DescribeRuntimeStats()
+{
+    const RuntimeStatsSnapshot stats = SnapshotRuntimeStats();
+    auto hit_rate = [](uint64_t hits, uint64_t misses) {
+        const uint64_t total = hits + misses;
+        return total > 0 ? static_cast<double>(hits) / static_cast<double>(total) : 0.0;
+    };
+    std::ostringstream oss;
+    oss << "write_stmt_cache_hits=" << stats.write_stmt_cache_hits
+        << ", write_stmt_cache_misses=" << stats.write_stmt_cache_misses
+        << ", write_stmt_cache_hit_rate=" << hit_rate(stats.write_stmt_cache_hits, stats.write_stmt_cache_misses)
+        << ", read_stmt_cache_hits=" << stats.read_stmt_cache_hits
+        << ", read_stmt_cache_misses=" << stats.read_stmt_cache_misses
+        << ", read_stmt_cache_hit_rate=" << hit_rate(stats.read_stmt_cache_hits, stats.read_stmt_cache_misses)
+        << ", opened_read_connections=" << stats.opened_read_connections
+        << ", legacy_migration_pending=" << (stats.legacy_migration_pending ? 1 : 0)
+        << ", legacy_migrated_traces=" << stats.legacy_migrated_traces
+        << ", legacy_skipped_traces=" << stats.legacy_skipped_traces
+        << ", partitions=" << stats.partitions
+        << ", partition_attaches=" << stats.partition_attaches
+        << ", dropped_partitions=" << stats.dropped_partitions
+        << ", replay_skipped_primary_rows=" << stats.replay_skipped_primary_rows
+        << ", replay_skipped_analyses=" << stats.replay_skipped_analyses;
+    return oss.str();
+}
+
+bool SqliteTraceRepository::LegacyMigrationPending() const
+{
+    return legacy_migration_pending_.load(std::memory_order_acquire);
+}
+
+size_t SqliteTraceRepository::MigrateLegacyTracesBatch(size_t limit)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!db_ || limit == 0 || !legacy_migration_pending_.load(std::memory_order_acquire)) {
+        return 0;
+    }
+
+    char* errmsg = nullptr;
+    auto rollback = [this]() {
+        char* rollback_err = nullptr;
+        sqlite3_exec(db_, "ROLLBACK;", nullptr, nullptr, &rollback_err);
+        if (rollback_err) {
+            sqlite3_free(rollback_err);
+        }
+    };
+    auto exec_or_throw = [this, &errmsg](const char* sql, const char* error_context) {
+        const int rc = sqlite3_exec(db_, sql, nullptr, nullptr, &errmsg);
+        if (errmsg) {
+            sqlite3_free(errmsg);
+            errmsg = nullptr;
+        }
+        persistence::checkSqliteError(db_, rc, error_context);
+    };
+    // 每条迁移语句都只绑一个参数：本批的 rowid 下界。
+    auto run_batch_statement = [this](const char* sql, const char* error_context, sqlite3_int64 low_rowid) -> size_t {
+        persistence::SqliteStatementCache::Handle stmt = write_stmt_cache_->Acquire(sql, error_context);
+        sqlite3_bind_int64(stmt.get(), 1, low_rowid);
+        const int rc = sqlite3_step(stmt.get());
+        persistence::checkSqliteError(db_, rc, error_context);
+        return static_cast<size_t>(sqlite3_changes(db_));
+    };
 
-    errmsg = nullptr;
-    rc = sqlite3_exec(db_, sql_create_tables, nullptr, nullptr, &errmsg);
-    if (errmsg) {
-        sqlite3_free(errmsg);
-        errmsg = nullptr;
-    }
-    persistence::checkSqliteError(db_, rc, "Failed to create trace tables");
+    try {
+        exec_or_throw("BEGIN TRANSACTION;", "Failed to begin legacy trace migration transaction");
 
-    const char* sql_create_index = R"(
-CREATE INDEX IF NOT EXISTS idx_trace_summary_start_time_trace_id
-ON trace_summary(start_time_ms DESC, trace_id DESC);
-CREATE INDEX IF NOT EXISTS idx_trace_summary_service_start_time_trace_id
-ON trace_summary(service_name, start_time_ms DESC, trace_id DESC);
-CREATE INDEX IF NOT EXISTS idx_trace_span_trace_start_time_span_id
-ON trace_span(trace_id, start_time_ms ASC, span_id ASC);
-)";
-    errmsg = nullptr;
-    rc = sqlite3_exec(db_, sql_create_index, nullptr, nullptr, &errmsg);
-    if (errmsg) {
-        sqlite3_free(errmsg);
-        errmsg = nullptr;
-    }
-    if (rc != SQLITE_OK) {
-        std::cerr << "Cannot create trace indexes: " << sqlite3_errmsg(db_) << std::endl;
+        // 按 rowid 从大到小搬，也就是“最近写入的 trace 先搬”：迁移期间列表页最先恢复的是最新数据。
+        bool has_rows = false;
+        sqlite3_int64 low_rowid = 0;
+        {
+            persistence::SqliteStatementCache::Handle boundary_stmt = write_stmt_cache_->Acquire(
+                "SELECT MIN(rowid) FROM (SELECT rowid FROM legacy_trace_summary ORDER BY rowid DESC LIMIT ?);",
+                "Prepare legacy trace migration boundary");
+            sqlite3_bind_int64(boundary_stmt.get(), 1, static_cast<sqlite3_int64>(limit));
+            const int rc = sqlite3_step(boundary_stmt.get());
+            persistence::checkSqliteError(db_, rc, "Step legacy trace migration boundary");
+            if (rc == SQLITE_ROW && sqlite3_column_type(boundary_stmt.get(), 0) != SQLITE_NULL) {
+                has_rows = true;
+                low_rowid = sqlite3_column_int64(boundary_stmt.get(), 0);
+            }
+        }
+
+        if (!has_rows) {
+            // 旧表搬空了：summary 之外可能还剩没有父记录的孤儿 span/analysis，随表一起删掉。
+            exec_or_throw(R"(
+                DROP TABLE IF EXISTS legacy_trace_analysis;
+                DROP TABLE IF EXISTS legacy_trace_span;
+                DROP TABLE IF EXISTS legacy_trace_summary;
+            )", "Drop legacy trace tables");
+            exec_or_throw("COMMIT;", "Commit legacy trace migration cleanup");
+            legacy_migration_pending_.store(false, std::memory_order_release);
+            std::cout << "[SqliteTraceRepository] legacy trace migration finished"
+                      << " migrated_traces=" << legacy_migrated_traces_.load(std::memory_order_relaxed)
+                      << " skipped_traces=" << legacy_skipped_traces_.load(std::memory_order_relaxed) << std::endl;
+            return 0;
+        }
+
+        // 新表里已经有同 key 的 trace（改名后新接入的数据）时保留新数据，所以统一用 INSERT OR IGNORE；
+        // id 不是合法整数的旧记录转不成新 key，直接跳过并计数。
+        // span/analysis 额外要求新表里有对应 summary，否则会撞外键（外键错误不会被 OR IGNORE 吞掉）。
+        const size_t migrated = run_batch_statement(R"(
+            INSERT OR IGNORE INTO trace_summary
+            (trace_id, service_name, start_time_ms, end_time_ms, duration_ms, span_count, token_count, risk_level, ai_status, ai_error)
+            SELECT legacy_trace_key(trace_id), service_name, start_time_ms, end_time_ms, duration_ms,
+                   span_count, token_count, risk_level, ai_status, ai_error
+            FROM legacy_trace_summary
+            WHERE rowid >= ? AND legacy_trace_key(trace_id) IS NOT NULL;
+        )", "Migrate legacy trace_summary", low_rowid);
+        run_batch_statement(R"(
+            INSERT OR IGNORE INTO trace_span
+            (trace_id, span_id, parent_id, service_name, operation, start_time_ms, duration_ms, status, attributes_json)
+            SELECT legacy_trace_key(sp.trace_id), legacy_trace_key(sp.span_id), legacy_trace_key(sp.parent_id),
+                   sp.service_name, sp.operation, sp.start_time_ms, sp.duration_ms, sp.status, sp.attributes_json
+            FROM legacy_trace_summary s
+            JOIN legacy_trace_span sp ON sp.trace_id = s.trace_id
+            WHERE s.rowid >= ?
+              AND legacy_trace_key(sp.span_id) IS NOT NULL
+              AND EXISTS (SELECT 1 FROM trace_summary t WHERE t.trace_id = legacy_trace_key(s.trace_id));
+        )", "Migrate legacy trace_span", low_rowid);
+        run_batch_statement(R"(
+            INSERT OR IGNORE INTO trace_analysis
+            (trace_id, risk_level, summary, root_cause, solution, confidence)
+            SELECT legacy_trace_key(a.trace_id), a.risk_level, a.summary, a.root_cause, a.solution, a.confidence
+            FROM legacy_trace_summary s
+            JOIN legacy_trace_analysis a ON a.trace_id = s.trace_id
+            WHERE s.rowid >= ?
+              AND EXISTS (SELECT 1 FROM trace_summary t WHERE t.trace_id = legacy_trace_key(s.trace_id));
+        )", "Migrate legacy trace_analysis", low_rowid);
+
+        // 和 retention 删除一样按“从表 -> 父表”的顺序清掉本批旧数据。
+        run_batch_statement(R"(
+            DELETE FROM legacy_trace_analysis
+            WHERE trace_id IN (SELECT trace_id FROM legacy_trace_summary WHERE rowid >= ?);
+        )", "Delete migrated legacy trace_analysis", low_rowid);
+        run_batch_statement(R"(
+            DELETE FROM legacy_trace_span
+            WHERE trace_id IN (SELECT trace_id FROM legacy_trace_summary WHERE rowid >= ?);
+        )", "Delete migrated legacy trace_span", low_rowid);
+        const size_t drained = run_batch_statement("DELETE FROM legacy_trace_summary WHERE rowid >= ?;",
+                                                   "Delete migrated legacy trace_summary",
+                                                   low_rowid);
+
+        exec_or_throw("COMMIT;", "Commit legacy trace migration batch");
+        legacy_migrated_traces_.fetch_add(migrated, std::memory_order_relaxed);
+        legacy_skipped_traces_.fetch_add(drained - migrated, std::memory_order_relaxed);
+        return drained;
+    } catch (const std::exception& e) {
+        std::cerr << "[SqliteTraceRepository] legacy trace migration batch failed"
+                  << " limit=" << limit
+                  << " error=" << e.what() << std::endl;
+        rollback();
+        return 0;
     }
 }
 
-SqliteTraceRepository::~SqliteTraceRepository()
+void SqliteTraceRepository::RunLegacyMigration()
 {
-    if (db_) {
-        sqlite3_close_v2(db_);
+    while (legacy_migration_pending_.load(std::memory_order_acquire)) {
+        const size_t drained = MigrateLegacyTracesBatch(kLegacyMigrationBatchSize);
+        if (!legacy_migration_pending_.load(std::memory_order_acquire)) {
+            return;
+        }
+        // 每批之间停一下，把写连接让给 flush 线程；这一批失败（没搬动）时退避得更久，避免空转刷错误日志。
+        std::unique_lock<std::mutex> lock(legacy_migration_mutex_);
+        legacy_migration_cv_.wait_for(lock,
+                                      drained > 0 ? kLegacyMigrationBatchPause : kLegacyMigrationRetryPause,
+                                      [this]() { return legacy_migration_stopping_; });
+        if (legacy_migration_stopping_) {
+            return;
+        }
     }
 }
 
 TraceSearchResult SqliteTraceRepository::SearchTraces(const TraceSearchRequest& request)
 {
-    // 这里给读侧也串一个 repo 内部互斥，目的不是“把查询做成单线程”，
-    // 而是保证同一个 SQLite 连接上的多步读流程不要和别的查询在连接级别交叉执行。
+    if (read_pool_size_ > 0) {
+        ReadConnectionLease lease(this);
+        return SearchTracesOn(lease.get()->db, *lease.get()->stmt_cache, lease.get()->attached_partitions, request);
+    }
+    // 没有只读连接池时，读也借用写连接：这里仍然要串 mutex_，
+    // 保证同一个 SQLite 连接上的多步读流程不要和写入/别的查询在连接级别交叉执行。
     std::lock_guard<std::mutex> lock(mutex_);
     if (!db_) {
         throw std::runtime_error("Trace database is not available");
     }
+    return SearchTracesOn(db_, *write_stmt_cache_, write_attached_partitions_, request);
+}
 
+TraceSearchResult SqliteTraceRepository::SearchTracesOn(sqlite3* db,
+                                                        persistence::SqliteStatementCache& stmt_cache,
+                                                        AttachedPartitions& attached,
+                                                        const TraceSearchRequest& request)
+{
     TraceSearchResult result;
     const size_t page = request.page < 1 ? kDefaultTraceSearchPage : request.page;
     size_t page_size = request.page_size;
@@ -217,7 +1464,16 @@ TraceSearchResult SqliteTraceRepository::SearchTraces(const TraceSearchRequest&
     }
 
     if (request.trace_id.has_value() && !request.trace_id->empty()) {
-        const char* sql_exact = R"(
+        sqlite3_int64 trace_key = 0;
+        if (!ParseTraceKey(*request.trace_id, &trace_key)) {
+            // 库里只有整数 key，按非数字 trace_id 精确查必然查不到，直接返回空结果。
+            return result;
+        }
+        const std::string schema = LocateTraceSchema(db, stmt_cache, attached, trace_key);
+        if (schema.empty()) {
+            return result;
+        }
+        const std::string sql_exact = WithSchema(R"(
             SELECT trace_id,
                    service_name,
                    start_time_ms,
@@ -227,22 +1483,17 @@ TraceSearchResult SqliteTraceRepository::SearchTraces(const TraceSearchRequest&
                    token_count,
                    risk_level,
                    ai_status
-            FROM trace_summary
+            FROM @db.trace_summary
             WHERE trace_id = ?;
-        )";
-        persistence::StmtPtr exact_stmt;
-        {
-            sqlite3_stmt* raw_stmt = nullptr;
-            const int rc = sqlite3_prepare_v2(db_, sql_exact, -1, &raw_stmt, nullptr);
-            persistence::checkSqliteError(db_, rc, "Prepare exact trace_summary search");
-            exact_stmt.reset(raw_stmt);
-        }
-        sqlite3_bind_text(exact_stmt.get(), 1, request.trace_id->c_str(), -1, SQLITE_TRANSIENT);
+        )", schema);
+        persistence::SqliteStatementCache::Handle exact_stmt =
+            stmt_cache.Acquire(sql_exact, "Prepare exact trace_summary search");
+        sqlite3_bind_int64(exact_stmt.get(), 1, trace_key);
 
         const int step_rc = sqlite3_step(exact_stmt.get());
         if (step_rc == SQLITE_ROW) {
             TraceListItem item;
-            item.trace_id = reinterpret_cast<const char*>(sqlite3_column_text(exact_stmt.get(), 0));
+            item.trace_id = ColumnTraceKey(exact_stmt.get(), 0);
             item.service_name = reinterpret_cast<const char*>(sqlite3_column_text(exact_stmt.get(), 1));
             item.start_time_ms = sqlite3_column_int64(exact_stmt.get(), 2);
             if (sqlite3_column_type(exact_stmt.get(), 3) != SQLITE_NULL) {
@@ -256,7 +1507,7 @@ TraceSearchResult SqliteTraceRepository::SearchTraces(const TraceSearchRequest&
             result.total = 1;
             result.items.push_back(std::move(item));
         } else if (step_rc != SQLITE_DONE) {
-            persistence::checkSqliteError(db_, step_rc, "Step exact trace_summary search");
+            persistence::checkSqliteError(db, step_rc, "Step exact trace_summary search");
         }
         return result;
     }
@@ -267,69 +1518,33 @@ TraceSearchResult SqliteTraceRepository::SearchTraces(const TraceSearchRequest&
         return result;
     }
 
-    std::string where_sql = " WHERE 1 = 1";
-
-    if (request.service_name.has_value() && !request.service_name->empty()) {
-        where_sql += " AND service_name = ?";
-    }
-
-    // 这里很容易混：请求里的 start_time_ms / end_time_ms 是“搜索时间窗边界”，
-    // 不是让 SQL 去比较 trace_summary.end_time_ms 这一列。
-    // 当前列表搜索统一钉在 trace_summary.start_time_ms 上做范围过滤，也就是：
-    // request.start_time_ms <= trace_summary.start_time_ms < request.end_time_ms
-    // 这样时间筛选语义和列表排序字段保持一致，索引也更容易命中。
-    if (request.start_time_ms.has_value()) {
-        where_sql += " AND start_time_ms >= ?";
-    }
-    if (request.end_time_ms.has_value()) {
-        where_sql += " AND start_time_ms < ?";
-    }
-
-    if (!request.risk_levels.empty()) {
-        where_sql += " AND risk_level IN " + BuildInClausePlaceholders(request.risk_levels.size());
+    // 游标里的 trace_id 和库里的 key 一样按位重解释成有符号整数，比较顺序才和索引里的 trace_id DESC 一致。
+    std::optional<std::pair<int64_t, sqlite3_int64>> cursor;
+    if (request.cursor.has_value()) {
+        sqlite3_int64 cursor_key = 0;
+        if (!ParseTraceKey(request.cursor->trace_id, &cursor_key)) {
+            throw std::invalid_argument("Invalid trace search cursor: '" + request.cursor->trace_id + "'");
+        }
+        cursor = std::make_pair(request.cursor->start_time_ms, cursor_key);
     }
 
-    auto bind_common_filters = [&](sqlite3_stmt* stmt, int start_index) -> int {
-        int bind_index = start_index;
-        if (request.service_name.has_value() && !request.service_name->empty()) {
-            sqlite3_bind_text(stmt, bind_index++, request.service_name->c_str(), -1, SQLITE_TRANSIENT);
-        }
-        // bind 顺序必须和上面 where_sql 追加占位符的顺序完全一致；
-        // 既然 end_time_ms 只在“搜索时间窗上界”语义下参与过滤，
-        // 那么这里绑定的也是“上界参数”，不是 trace_summary.end_time_ms 列值。
-        if (request.start_time_ms.has_value()) {
-            sqlite3_bind_int64(stmt, bind_index++, static_cast<sqlite3_int64>(request.start_time_ms.value()));
-        }
-        if (request.end_time_ms.has_value()) {
-            sqlite3_bind_int64(stmt, bind_index++, static_cast<sqlite3_int64>(request.end_time_ms.value()));
-        }
-        for (const auto& risk_level : request.risk_levels) {
-            sqlite3_bind_text(stmt, bind_index++, risk_level.c_str(), -1, SQLITE_TRANSIENT);
+    auto read_item = [](sqlite3_stmt* stmt) {
+        TraceListItem item;
+        item.trace_id = ColumnTraceKey(stmt, 0);
+        item.service_name = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
+        item.start_time_ms = sqlite3_column_int64(stmt, 2);
+        if (sqlite3_column_type(stmt, 3) != SQLITE_NULL) {
+            item.end_time_ms = sqlite3_column_int64(stmt, 3);
         }
-        return bind_index;
+        item.duration_ms = sqlite3_column_int64(stmt, 4);
+        item.span_count = static_cast<size_t>(sqlite3_column_int64(stmt, 5));
+        item.token_count = static_cast<size_t>(sqlite3_column_int64(stmt, 6));
+        item.risk_level = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 7));
+        item.ai_status = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 8));
+        return item;
     };
-
-    const std::string count_sql = "SELECT COUNT(*) FROM trace_summary" + where_sql + ";";
-    persistence::StmtPtr count_stmt;
-    {
-        sqlite3_stmt* raw_stmt = nullptr;
-        const int rc = sqlite3_prepare_v2(db_, count_sql.c_str(), -1, &raw_stmt, nullptr);
-        persistence::checkSqliteError(db_, rc, "Prepare trace_summary count query");
-        count_stmt.reset(raw_stmt);
-    }
-    bind_common_filters(count_stmt.get(), 1);
-    const int count_step_rc = sqlite3_step(count_stmt.get());
-    if (count_step_rc == SQLITE_ROW) {
-        result.total = static_cast<size_t>(sqlite3_column_int64(count_stmt.get(), 0));
-    } else {
-        persistence::checkSqliteError(db_, count_step_rc, "Step trace_summary count query");
-    }
-    if (result.total == 0) {
-        return result;
-    }
-
-    const size_t offset = (page - 1) * page_size;
-    const std::string select_sql = R"(
+    auto build_select_sql = [&request](const std::string& schema, bool has_cursor, bool has_offset) {
+        return R"(
         SELECT trace_id,
                service_name,
                start_time_ms,
@@ -339,59 +1554,172 @@ TraceSearchResult SqliteTraceRepository::SearchTraces(const TraceSearchRequest&
                token_count,
                risk_level,
                ai_status
-        FROM trace_summary
-    )" + where_sql + R"(
+        FROM )" + schema + ".trace_summary" +
+               BuildTraceFilterSql(request, request.start_time_ms.has_value(), request.end_time_ms.has_value(), has_cursor) + R"(
         ORDER BY start_time_ms DESC, trace_id DESC
-        LIMIT ? OFFSET ?;
-    )";
+        LIMIT ?)" + (has_offset ? " OFFSET ?;" : ";");
+    };
 
-    persistence::StmtPtr select_stmt;
-    {
-        sqlite3_stmt* raw_stmt = nullptr;
-        const int rc = sqlite3_prepare_v2(db_, select_sql.c_str(), -1, &raw_stmt, nullptr);
-        persistence::checkSqliteError(db_, rc, "Prepare trace_summary search query");
-        select_stmt.reset(raw_stmt);
+    // 要扫的数据段：时间窗相交的分区从新到旧排，主库（开启分区前的旧数据/兜底写入）作为最老的一段排在最后。
+    // 分区按 start_time_ms 切开且互不重叠，所以“各段内部按 start_time_ms DESC 排序再首尾相接”就是全局顺序，
+    // 分页可以逐段算：先用各段条数跳过整段，落在哪一段就只在那一段里 LIMIT/OFFSET。
+    const std::vector<PartitionInfo> partitions = PartitioningEnabled() ? SnapshotPartitions() : std::vector<PartitionInfo>();
+    std::vector<const PartitionInfo*> segments;
+    for (auto iter = partitions.rbegin(); iter != partitions.rend(); ++iter) {
+        if (request.start_time_ms.has_value() && iter->end_ms <= request.start_time_ms.value()) {
+            continue;
+        }
+        if (request.end_time_ms.has_value() && iter->start_ms >= request.end_time_ms.value()) {
+            continue;
+        }
+        segments.push_back(&*iter);
     }
-    int bind_index = bind_common_filters(select_stmt.get(), 1);
-    sqlite3_bind_int64(select_stmt.get(), bind_index++, static_cast<sqlite3_int64>(page_size));
-    sqlite3_bind_int64(select_stmt.get(), bind_index++, static_cast<sqlite3_int64>(offset));
+    // nullptr 表示主库这一段。
+    segments.push_back(nullptr);
+
+    size_t skip = (page - 1) * page_size;
+    // 游标模式下每段各取 page_size + 1 条按 (start_time_ms, trace_id) 归并；多出来的那一条只用来判断后面还有没有数据。
+    // 主库里的兜底写入可能比分区新，归并而不是逐段首尾相接，保证翻页不重不漏。
+    const size_t cursor_limit = page_size + 1;
+    std::vector<std::pair<sqlite3_int64, TraceListItem>> candidates;
+    auto candidate_before = [](const std::pair<sqlite3_int64, TraceListItem>& lhs,
+                               const std::pair<sqlite3_int64, TraceListItem>& rhs) {
+        if (lhs.second.start_time_ms != rhs.second.start_time_ms) {
+            return lhs.second.start_time_ms > rhs.second.start_time_ms;
+        }
+        return lhs.first > rhs.first;
+    };
 
-    while (true) {
-        const int step_rc = sqlite3_step(select_stmt.get());
-        if (step_rc == SQLITE_DONE) {
-            break;
+    for (const PartitionInfo* partition : segments) {
+        // 分区按需挂到当前连接上；分区多于 ATTACH 上限时按 LRU 换入换出。文件已经被 retention 删掉的直接跳过。
+        if (partition && !AttachPartition(db, attached, *partition, false)) {
+            continue;
+        }
+        const std::string& schema = partition ? partition->schema : kMainSchema;
+
+        bool segment_approximate = false;
+        size_t segment_total = CountSegmentTraces(db, stmt_cache, schema, request, &segment_approximate);
+        // OFFSET 跳段要靠这一段的条数，近似值会让跨段翻页重复或漏行；只有真要拿它跳段时才补一次精确 COUNT。
+        if (segment_approximate && !cursor.has_value() && result.items.size() < page_size &&
+            (skip > 0 || segment_total == 0)) {
+            segment_total = CountTracesExact(db, stmt_cache, schema, request, request.start_time_ms, request.end_time_ms);
+            segment_approximate = false;
+        }
+        result.total += segment_total;
+        result.total_is_approximate = result.total_is_approximate || segment_approximate;
+        if (segment_total == 0) {
+            continue;
         }
-        persistence::checkSqliteError(db_, step_rc, "Step trace_summary search query");
 
-        TraceListItem item;
-        item.trace_id = reinterpret_cast<const char*>(sqlite3_column_text(select_stmt.get(), 0));
-        item.service_name = reinterpret_cast<const char*>(sqlite3_column_text(select_stmt.get(), 1));
-        item.start_time_ms = sqlite3_column_int64(select_stmt.get(), 2);
-        if (sqlite3_column_type(select_stmt.get(), 3) != SQLITE_NULL) {
-            item.end_time_ms = sqlite3_column_int64(select_stmt.get(), 3);
+        if (cursor.has_value()) {
+            // 整段都比游标新的分区不用查；已经凑够一页时，整段都比候选里最旧那条还旧的分区也不用查。
+            if (partition && partition->start_ms > cursor->first) {
+                continue;
+            }
+            if (partition && candidates.size() >= cursor_limit &&
+                candidates.back().second.start_time_ms >= partition->end_ms) {
+                continue;
+            }
+            persistence::SqliteStatementCache::Handle select_stmt =
+                stmt_cache.Acquire(build_select_sql(schema, true, false), "Prepare trace_summary keyset search query");
+            const int bind_index =
+                BindTraceFilters(select_stmt.get(), request, request.start_time_ms, request.end_time_ms, cursor);
+            sqlite3_bind_int64(select_stmt.get(), bind_index, static_cast<sqlite3_int64>(cursor_limit));
+            while (true) {
+                const int step_rc = sqlite3_step(select_stmt.get());
+                if (step_rc == SQLITE_DONE) {
+                    break;
+                }
+                persistence::checkSqliteError(db, step_rc, "Step trace_summary keyset search query");
+                candidates.emplace_back(sqlite3_column_int64(select_stmt.get(), 0), read_item(select_stmt.get()));
+            }
+            std::sort(candidates.begin(), candidates.end(), candidate_before);
+            if (candidates.size() > cursor_limit) {
+                candidates.resize(cursor_limit);
+            }
+            continue;
+        }
+
+        if (result.items.size() >= page_size) {
+            continue;
+        }
+        if (skip >= segment_total) {
+            skip -= segment_total;
+            continue;
+        }
+
+        persistence::SqliteStatementCache::Handle select_stmt =
+            stmt_cache.Acquire(build_select_sql(schema, false, true), "Prepare trace_summary search query");
+        int bind_index = BindTraceFilters(select_stmt.get(), request, request.start_time_ms, request.end_time_ms, std::nullopt);
+        sqlite3_bind_int64(select_stmt.get(), bind_index++, static_cast<sqlite3_int64>(page_size - result.items.size()));
+        sqlite3_bind_int64(select_stmt.get(), bind_index++, static_cast<sqlite3_int64>(skip));
+        skip = 0;
+
+        while (true) {
+            const int step_rc = sqlite3_step(select_stmt.get());
+            if (step_rc == SQLITE_DONE) {
+                break;
+            }
+            persistence::checkSqliteError(db, step_rc, "Step trace_summary search query");
+            result.items.push_back(read_item(select_stmt.get()));
+        }
+    }
+
+    if (cursor.has_value()) {
+        const bool has_more = candidates.size() > page_size;
+        if (has_more) {
+            candidates.resize(page_size);
+        }
+        result.items.reserve(candidates.size());
+        for (auto& candidate : candidates) {
+            result.items.push_back(std::move(candidate.second));
         }
-        item.duration_ms = sqlite3_column_int64(select_stmt.get(), 4);
-        item.span_count = static_cast<size_t>(sqlite3_column_int64(select_stmt.get(), 5));
-        item.token_count = static_cast<size_t>(sqlite3_column_int64(select_stmt.get(), 6));
-        item.risk_level = reinterpret_cast<const char*>(sqlite3_column_text(select_stmt.get(), 7));
-        item.ai_status = reinterpret_cast<const char*>(sqlite3_column_text(select_stmt.get(), 8));
-        result.items.push_back(std::move(item));
+        if (has_more) {
+            result.next_cursor = TraceSearchCursor{result.items.back().start_time_ms, result.items.back().trace_id};
+        }
+        return result;
     }
 
+    // 页码模式也回一个游标，前端可以从第一页起改用游标往后翻；总数是近似值时只要本页满了就给。
+    if (result.items.size() == page_size &&
+        (result.total_is_approximate || page * page_size < result.total)) {
+        result.next_cursor = TraceSearchCursor{result.items.back().start_time_ms, result.items.back().trace_id};
+    }
     return result;
 }
 
 std::optional<TraceDetailRecord> SqliteTraceRepository::GetTraceDetail(const std::string& trace_id)
 {
+    if (read_pool_size_ > 0) {
+        ReadConnectionLease lease(this);
+        return GetTraceDetailOn(lease.get()->db, *lease.get()->stmt_cache, lease.get()->attached_partitions, trace_id);
+    }
     std::lock_guard<std::mutex> lock(mutex_);
     if (!db_) {
         throw std::runtime_error("Trace database is not available");
     }
+    return GetTraceDetailOn(db_, *write_stmt_cache_, write_attached_partitions_, trace_id);
+}
+
+std::optional<TraceDetailRecord> SqliteTraceRepository::GetTraceDetailOn(sqlite3* db,
+                                                                         persistence::SqliteStatementCache& stmt_cache,
+                                                                         AttachedPartitions& attached,
+                                                                         const std::string& trace_id)
+{
+    sqlite3_int64 trace_key = 0;
+    if (!ParseTraceKey(trace_id, &trace_key)) {
+        return std::nullopt;
+    }
+    // 定位分区要在读事务之前做完：SQLite 不允许在事务里 ATTACH。
+    const std::string schema = LocateTraceSchema(db, stmt_cache, attached, trace_key);
+    if (schema.empty()) {
+        return std::nullopt;
+    }
 
     char* errmsg = nullptr;
-    auto rollback = [this]() {
+    auto rollback = [db]() {
         char* rollback_err = nullptr;
-        sqlite3_exec(db_, "ROLLBACK;", nullptr, nullptr, &rollback_err);
+        sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, &rollback_err);
         if (rollback_err) {
             sqlite3_free(rollback_err);
         }
@@ -401,14 +1729,14 @@ std::optional<TraceDetailRecord> SqliteTraceRepository::GetTraceDetail(const std
         // 详情页不是一条 SQL，而是“先查 summary/analysis，再查 spans”。
         // 这里显式开一个读事务，是为了把这两次读取固定到同一份 WAL 快照上，
         // 避免 flush 线程恰好在两次 SELECT 之间写入，导致顶部摘要和 spans 数量对不上。
-        int rc = sqlite3_exec(db_, "BEGIN;", nullptr, nullptr, &errmsg);
+        int rc = sqlite3_exec(db, "BEGIN;", nullptr, nullptr, &errmsg);
         if (errmsg) {
             sqlite3_free(errmsg);
             errmsg = nullptr;
         }
-        persistence::checkSqliteError(db_, rc, "Begin trace detail read transaction");
+        persistence::checkSqliteError(db, rc, "Begin trace detail read transaction");
 
-        const char* sql_detail = R"(
+        const std::string sql_detail = WithSchema(R"(
             SELECT s.trace_id,
                    s.service_name,
                    s.start_time_ms,
@@ -424,32 +1752,29 @@ std::optional<TraceDetailRecord> SqliteTraceRepository::GetTraceDetail(const std
                    a.root_cause,
                    a.solution,
                    a.confidence
-            FROM trace_summary s
-            LEFT JOIN trace_analysis a
+            FROM @db.trace_summary s
+            LEFT JOIN @db.trace_analysis a
               ON a.trace_id = s.trace_id
             WHERE s.trace_id = ?;
-        )";
-        persistence::StmtPtr detail_stmt;
-        sqlite3_stmt* detail_raw_stmt = nullptr;
-        rc = sqlite3_prepare_v2(db_, sql_detail, -1, &detail_raw_stmt, nullptr);
-        persistence::checkSqliteError(db_, rc, "Prepare trace detail summary query");
-        detail_stmt.reset(detail_raw_stmt);
-        sqlite3_bind_text(detail_stmt.get(), 1, trace_id.c_str(), -1, SQLITE_TRANSIENT);
+        )", schema);
+        persistence::SqliteStatementCache::Handle detail_stmt =
+            stmt_cache.Acquire(sql_detail, "Prepare trace detail summary query");
+        sqlite3_bind_int64(detail_stmt.get(), 1, trace_key);
 
         const int detail_step_rc = sqlite3_step(detail_stmt.get());
         if (detail_step_rc == SQLITE_DONE) {
-            rc = sqlite3_exec(db_, "COMMIT;", nullptr, nullptr, &errmsg);
+            rc = sqlite3_exec(db, "COMMIT;", nullptr, nullptr, &errmsg);
             if (errmsg) {
                 sqlite3_free(errmsg);
                 errmsg = nullptr;
             }
-            persistence::checkSqliteError(db_, rc, "Commit empty trace detail read transaction");
+            persistence::checkSqliteError(db, rc, "Commit empty trace detail read transaction");
             return std::nullopt;
         }
-        persistence::checkSqliteError(db_, detail_step_rc, "Step trace detail summary query");
+        persistence::checkSqliteError(db, detail_step_rc, "Step trace detail summary query");
 
         TraceDetailRecord detail;
-        detail.trace_id = reinterpret_cast<const char*>(sqlite3_column_text(detail_stmt.get(), 0));
+        detail.trace_id = ColumnTraceKey(detail_stmt.get(), 0);
         detail.service_name = reinterpret_cast<const char*>(sqlite3_column_text(detail_stmt.get(), 1));
         detail.start_time_ms = sqlite3_column_int64(detail_stmt.get(), 2);
         if (sqlite3_column_type(detail_stmt.get(), 3) != SQLITE_NULL) {
@@ -475,7 +1800,7 @@ std::optional<TraceDetailRecord> SqliteTraceRepository::GetTraceDetail(const std
             detail.analysis = std::move(analysis);
         }
 
-        const char* sql_spans = R"(
+        const std::string sql_spans = WithSchema(R"(
             SELECT span_id,
                    parent_id,
                    service_name,
@@ -483,28 +1808,25 @@ std::optional<TraceDetailRecord> SqliteTraceRepository::GetTraceDetail(const std
                    start_time_ms,
                    duration_ms,
                    status
-            FROM trace_span
+            FROM @db.trace_span
             WHERE trace_id = ?
             ORDER BY start_time_ms ASC, span_id ASC;
-        )";
-        persistence::StmtPtr spans_stmt;
-        sqlite3_stmt* spans_raw_stmt = nullptr;
-        rc = sqlite3_prepare_v2(db_, sql_spans, -1, &spans_raw_stmt, nullptr);
-        persistence::checkSqliteError(db_, rc, "Prepare trace detail spans query");
-        spans_stmt.reset(spans_raw_stmt);
-        sqlite3_bind_text(spans_stmt.get(), 1, trace_id.c_str(), -1, SQLITE_TRANSIENT);
+        )", schema);
+        persistence::SqliteStatementCache::Handle spans_stmt =
+            stmt_cache.Acquire(sql_spans, "Prepare trace detail spans query");
+        sqlite3_bind_int64(spans_stmt.get(), 1, trace_key);
 
         while (true) {
             const int spans_step_rc = sqlite3_step(spans_stmt.get());
             if (spans_step_rc == SQLITE_DONE) {
                 break;
             }
-            persistence::checkSqliteError(db_, spans_step_rc, "Step trace detail spans query");
+            persistence::checkSqliteError(db, spans_step_rc, "Step trace detail spans query");
 
             TraceSpanDetail span;
-            span.span_id = reinterpret_cast<const char*>(sqlite3_column_text(spans_stmt.get(), 0));
+            span.span_id = ColumnTraceKey(spans_stmt.get(), 0);
             if (sqlite3_column_type(spans_stmt.get(), 1) != SQLITE_NULL) {
-                span.parent_id = std::string(reinterpret_cast<const char*>(sqlite3_column_text(spans_stmt.get(), 1)));
+                span.parent_id = ColumnTraceKey(spans_stmt.get(), 1);
             }
             span.service_name = reinterpret_cast<const char*>(sqlite3_column_text(spans_stmt.get(), 2));
             span.operation = reinterpret_cast<const char*>(sqlite3_column_text(spans_stmt.get(), 3));
@@ -514,12 +1836,12 @@ std::optional<TraceDetailRecord> SqliteTraceRepository::GetTraceDetail(const std
             detail.spans.push_back(std::move(span));
         }
 
-        rc = sqlite3_exec(db_, "COMMIT;", nullptr, nullptr, &errmsg);
+        rc = sqlite3_exec(db, "COMMIT;", nullptr, nullptr, &errmsg);
         if (errmsg) {
             sqlite3_free(errmsg);
             errmsg = nullptr;
         }
-        persistence::checkSqliteError(db_, rc, "Commit trace detail read transaction");
+        persistence::checkSqliteError(db, rc, "Commit trace detail read transaction");
         return detail;
     } catch (const std::exception&) {
         rollback();
@@ -527,13 +1849,41 @@ std::optional<TraceDetailRecord> SqliteTraceRepository::GetTraceDetail(const std
     }
 }
 
+bool SqliteTraceRepository::HasTraceAnalysis(const std::string& trace_id)
+{
+    // 只有 WAL 重放出来的 trace 才会来问，量很小；走写连接是为了复用 LocateWriteSchema 找分区，
+    // 顺带保证看到的是已经提交的最新状态。
+    std::lock_guard<std::mutex> lock(mutex_);
+    sqlite3_int64 trace_key = 0;
+    if (!db_ || !ParseTraceKey(trace_id, &trace_key)) {
+        return false;
+    }
+    try {
+        const std::string sql = WithSchema("SELECT 1 FROM @db.trace_analysis WHERE trace_id = ? LIMIT 1;",
+                                           LocateWriteSchema(trace_id));
+        persistence::SqliteStatementCache::Handle stmt =
+            write_stmt_cache_->Acquire(sql, "Prepare trace_analysis existence check");
+        sqlite3_bind_int64(stmt.get(), 1, trace_key);
+        const int rc = sqlite3_step(stmt.get());
+        if (rc == SQLITE_ROW) {
+            return true;
+        }
+        persistence::checkSqliteError(db_, rc, "Step trace_analysis existence check");
+    } catch (const std::exception& e) {
+        std::cerr << "[SqliteTraceRepository] HasTraceAnalysis failed trace_id=" << trace_id
+                  << " error=" << e.what() << std::endl;
+    }
+    return false;
+}
+
 bool SqliteTraceRepository::DeleteTraceById(const std::string& trace_id)
 {
     std::lock_guard<std::mutex> lock(mutex_);
-    if (!db_ || trace_id.empty()) {
+    sqlite3_int64 trace_key = 0;
+    if (!db_ || !ParseTraceKey(trace_id, &trace_key)) {
         return false;
     }
-    return DeleteTracesByIdsAtomic({trace_id});
+    return DeleteTracesByIdsAtomic(LocateWriteSchema(trace_id), {static_cast<int64_t>(trace_key)});
 }
 
 size_t SqliteTraceRepository::DeleteExpiredTracesBatch(int64_t cutoff_ms, size_t limit)
@@ -543,7 +1893,7 @@ size_t SqliteTraceRepository::DeleteExpiredTracesBatch(int64_t cutoff_ms, size_t
         return 0;
     }
 
-    std::vector<std::string> expired_trace_ids;
+    std::vector<int64_t> expired_trace_ids;
     const char* sql_select_expired = R"(
         SELECT trace_id
         FROM trace_summary
@@ -551,23 +1901,15 @@ size_t SqliteTraceRepository::DeleteExpiredTracesBatch(int64_t cutoff_ms, size_t
         ORDER BY COALESCE(end_time_ms, start_time_ms) ASC, trace_id ASC
         LIMIT ?;
     )";
-    persistence::StmtPtr select_stmt;
-    {
-        sqlite3_stmt* raw_stmt = nullptr;
-        const int rc = sqlite3_prepare_v2(db_, sql_select_expired, -1, &raw_stmt, nullptr);
-        persistence::checkSqliteError(db_, rc, "Prepare expired trace_id selection");
-        select_stmt.reset(raw_stmt);
-    }
+    persistence::SqliteStatementCache::Handle select_stmt =
+        write_stmt_cache_->Acquire(sql_select_expired, "Prepare expired trace_id selection");
     sqlite3_bind_int64(select_stmt.get(), 1, cutoff_ms);
     sqlite3_bind_int64(select_stmt.get(), 2, static_cast<sqlite3_int64>(limit));
 
     while (true) {
         const int step_rc = sqlite3_step(select_stmt.get());
         if (step_rc == SQLITE_ROW) {
-            const unsigned char* text = sqlite3_column_text(select_stmt.get(), 0);
-            if (text) {
-                expired_trace_ids.emplace_back(reinterpret_cast<const char*>(text));
-            }
+            expired_trace_ids.push_back(sqlite3_column_int64(select_stmt.get(), 0));
             continue;
         }
         if (step_rc == SQLITE_DONE) {
@@ -582,13 +1924,64 @@ size_t SqliteTraceRepository::DeleteExpiredTracesBatch(int64_t cutoff_ms, size_t
 
     // retention 只在 summary 表统一判断“哪条 trace 已经过期”，
     // 然后再按 trace_id 整条删，避免把一条调用树删成 summary 还在、span 只剩一半的脏状态。
-    if (!DeleteTracesByIdsAtomic(expired_trace_ids)) {
+    // 这里只处理主库；分区模式下分区里的数据由 DropExpiredPartitions 整个文件删除。
+    if (!DeleteTracesByIdsAtomic(kMainSchema, expired_trace_ids)) {
         return 0;
     }
     return expired_trace_ids.size();
 }
 
-bool SqliteTraceRepository::DeleteTracesByIdsAtomic(const std::vector<std::string>& trace_ids)
+size_t SqliteTraceRepository::DropExpiredPartitions(int64_t cutoff_ms)
+{
+    if (!PartitioningEnabled() || cutoff_ms <= 0) {
+        return 0;
+    }
+
+    std::vector<PartitionInfo> expired;
+    {
+        // 先从分区目录摘掉：之后的查询和写入都不会再选中它们，迟到的旧数据也不会把同名文件重新建出来。
+        std::lock_guard<std::mutex> lock(partition_mutex_);
+        auto keep_end = std::stable_partition(partitions_.begin(), partitions_.end(), [cutoff_ms](const PartitionInfo& partition) {
+            return partition.end_ms > cutoff_ms;
+        });
+        expired.assign(keep_end, partitions_.end());
+        partitions_.erase(keep_end, partitions_.end());
+        for (const auto& partition : expired) {
+            partition_floor_ms_ = std::max(partition_floor_ms_, partition.end_ms);
+        }
+    }
+    if (expired.empty()) {
+        return 0;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (db_) {
+            DetachStalePartitions(db_, write_attached_partitions_);
+        }
+    }
+    {
+        // 空闲的只读连接就地 DETACH；正在被查询借走的连接在下次借出时补 DETACH。
+        std::lock_guard<std::mutex> lock(read_pool_mutex_);
+        for (auto& conn : idle_read_connections_) {
+            DetachStalePartitions(conn->db, conn->attached_partitions);
+        }
+    }
+
+    // Linux 下还挂着这个文件的查询会继续读完已经打开的 inode，空间在最后一个连接 DETACH 后才真正回收。
+    for (const auto& partition : expired) {
+        std::error_code ec;
+        for (const char* suffix : {"", "-wal", "-shm"}) {
+            std::filesystem::remove(partition.path + suffix, ec);
+        }
+        std::cout << "[SqliteTraceRepository] dropped expired trace partition " << partition.path
+                  << " cutoff_ms=" << cutoff_ms << std::endl;
+    }
+    dropped_partitions_.fetch_add(expired.size(), std::memory_order_relaxed);
+    return expired.size();
+}
+
+bool SqliteTraceRepository::DeleteTracesByIdsAtomic(const std::string& schema, const std::vector<int64_t>& trace_ids)
 {
     if (!db_ || trace_ids.empty()) {
         return false;
@@ -613,28 +2006,21 @@ bool SqliteTraceRepository::DeleteTracesByIdsAtomic(const std::vector<std::strin
 
         const std::string placeholders = BuildInClausePlaceholders(trace_ids.size());
         const std::string delete_analysis_sql =
-            "DELETE FROM trace_analysis WHERE trace_id IN " + placeholders + ";";
+            "DELETE FROM " + schema + ".trace_analysis WHERE trace_id IN " + placeholders + ";";
         const std::string delete_span_sql =
-            "DELETE FROM trace_span WHERE trace_id IN " + placeholders + ";";
+            "DELETE FROM " + schema + ".trace_span WHERE trace_id IN " + placeholders + ";";
         const std::string delete_summary_sql =
-            "DELETE FROM trace_summary WHERE trace_id IN " + placeholders + ";";
+            "DELETE FROM " + schema + ".trace_summary WHERE trace_id IN " + placeholders + ";";
 
+        // retention 每轮大多是满 batch，IN 的形状基本固定，同样走缓存；只有末尾不满的一批会多 prepare 一次。
         auto delete_by_ids = [this, &trace_ids](const std::string& sql, const char* error_context) -> size_t {
-            persistence::StmtPtr stmt;
-            sqlite3_stmt* raw_stmt = nullptr;
-            int rc = sqlite3_prepare_v2(db_, sql.c_str(), -1, &raw_stmt, nullptr);
-            persistence::checkSqliteError(db_, rc, error_context);
-            stmt.reset(raw_stmt);
+            persistence::SqliteStatementCache::Handle stmt = write_stmt_cache_->Acquire(sql, error_context);
 
             for (size_t index = 0; index < trace_ids.size(); ++index) {
-                sqlite3_bind_text(stmt.get(),
-                                  static_cast<int>(index + 1),
-                                  trace_ids[index].c_str(),
-                                  -1,
-                                  SQLITE_TRANSIENT);
+                sqlite3_bind_int64(stmt.get(), static_cast<int>(index + 1), trace_ids[index]);
             }
 
-            rc = sqlite3_step(stmt.get());
+            const int rc = sqlite3_step(stmt.get());
             persistence::checkSqliteError(db_, rc, error_context);
             return static_cast<size_t>(sqlite3_changes(db_));
         };
@@ -667,20 +2053,21 @@ bool SqliteTraceRepository::SaveSingleTraceSummary(const TraceSummary& summary)
     }
 
     try {
-        const char* sql_insert_summary = R"(
-            INSERT INTO trace_summary
+        const std::string schema = ResolveWritePartition(summary.start_time_ms);
+        const std::string sql_insert_summary = WithSchema(R"(
+            INSERT INTO @db.trace_summary
             (trace_id, service_name, start_time_ms, end_time_ms, duration_ms, span_count, token_count, risk_level, ai_status, ai_error)
             VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?);
-        )";
+        )", schema);
         persistence::StmtPtr summary_stmt;
         {
             sqlite3_stmt* raw_stmt = nullptr;
-            const int rc = sqlite3_prepare_v2(db_, sql_insert_summary, -1, &raw_stmt, nullptr);
+            const int rc = sqlite3_prepare_v2(db_, sql_insert_summary.c_str(), -1, &raw_stmt, nullptr);
             persistence::checkSqliteError(db_, rc, "Prepare trace_summary insert");
             summary_stmt.reset(raw_stmt);
         }
         // 这里沿用 SQLITE_STATIC：入参对象在 sqlite3_step 前保持存活，可以避免 SQLite 再做一次字符串拷贝。
-        sqlite3_bind_text(summary_stmt.get(), 1, summary.trace_id.c_str(), -1, SQLITE_STATIC);
+        BindTraceKey(summary_stmt.get(), 1, summary.trace_id);
         sqlite3_bind_text(summary_stmt.get(), 2, summary.service_name.c_str(), -1, SQLITE_STATIC);
         sqlite3_bind_int64(summary_stmt.get(), 3, summary.start_time_ms);
         if (summary.end_time_ms.has_value()) {
@@ -723,6 +2110,8 @@ bool SqliteTraceRepository::SaveSingleTraceSpans(const std::string& trace_id, co
     };
 
     try {
+        // span 跟着自己的 trace 走：分区模式下先找到 summary 所在的分区，找不到时落主库，由外键照旧拦下。
+        const std::string schema = LocateWriteSchema(trace_id.empty() ? spans.front().trace_id : trace_id);
         int rc = sqlite3_exec(db_, "BEGIN TRANSACTION;", nullptr, nullptr, &errmsg);
         if (errmsg) {
             sqlite3_free(errmsg);
@@ -730,15 +2119,15 @@ bool SqliteTraceRepository::SaveSingleTraceSpans(const std::string& trace_id, co
         }
         persistence::checkSqliteError(db_, rc, "Failed to begin trace_span transaction");
 
-        const char* sql_insert_span = R"(
-            INSERT INTO trace_span
+        const std::string sql_insert_span = WithSchema(R"(
+            INSERT INTO @db.trace_span
             (trace_id, span_id, parent_id, service_name, operation, start_time_ms, duration_ms, status, attributes_json)
             VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?);
-        )";
+        )", schema);
         persistence::StmtPtr span_stmt;
         {
             sqlite3_stmt* raw_stmt = nullptr;
-            rc = sqlite3_prepare_v2(db_, sql_insert_span, -1, &raw_stmt, nullptr);
+            rc = sqlite3_prepare_v2(db_, sql_insert_span.c_str(), -1, &raw_stmt, nullptr);
             persistence::checkSqliteError(db_, rc, "Prepare trace_span insert");
             span_stmt.reset(raw_stmt);
         }
@@ -752,10 +2141,10 @@ bool SqliteTraceRepository::SaveSingleTraceSpans(const std::string& trace_id, co
                 throw std::runtime_error("trace_id mismatch in SaveSingleTraceSpans");
             }
             const std::string& bind_trace_id = trace_id.empty() ? span.trace_id : trace_id;
-            sqlite3_bind_text(span_stmt.get(), 1, bind_trace_id.c_str(), -1, SQLITE_STATIC);
-            sqlite3_bind_text(span_stmt.get(), 2, span.span_id.c_str(), -1, SQLITE_STATIC);
+            BindTraceKey(span_stmt.get(), 1, bind_trace_id);
+            BindTraceKey(span_stmt.get(), 2, span.span_id);
             if (span.parent_id.has_value()) {
-                sqlite3_bind_text(span_stmt.get(), 3, span.parent_id->c_str(), -1, SQLITE_STATIC);
+                BindTraceKey(span_stmt.get(), 3, *span.parent_id);
             } else {
                 sqlite3_bind_null(span_stmt.get(), 3);
             }
@@ -799,6 +2188,7 @@ bool SqliteTraceRepository::SaveSingleTraceAnalysis(const TraceAnalysisRecord& a
     };
 
     try {
+        const std::string schema = LocateWriteSchema(analysis.trace_id);
         int rc = sqlite3_exec(db_, "BEGIN TRANSACTION;", nullptr, nullptr, &errmsg);
         if (errmsg) {
             sqlite3_free(errmsg);
@@ -806,19 +2196,19 @@ bool SqliteTraceRepository::SaveSingleTraceAnalysis(const TraceAnalysisRecord& a
         }
         persistence::checkSqliteError(db_, rc, "Failed to begin trace_analysis transaction");
 
-        const char* sql_insert_analysis = R"(
-            INSERT INTO trace_analysis
+        const std::string sql_insert_analysis = WithSchema(R"(
+            INSERT INTO @db.trace_analysis
             (trace_id, risk_level, summary, root_cause, solution, confidence)
             VALUES (?, ?, ?, ?, ?, ?);
-        )";
+        )", schema);
         persistence::StmtPtr analysis_stmt;
         {
             sqlite3_stmt* raw_stmt = nullptr;
-            rc = sqlite3_prepare_v2(db_, sql_insert_analysis, -1, &raw_stmt, nullptr);
+            rc = sqlite3_prepare_v2(db_, sql_insert_analysis.c_str(), -1, &raw_stmt, nullptr);
             persistence::checkSqliteError(db_, rc, "Prepare trace_analysis insert");
             analysis_stmt.reset(raw_stmt);
         }
-        sqlite3_bind_text(analysis_stmt.get(), 1, analysis.trace_id.c_str(), -1, SQLITE_STATIC);
+        BindTraceKey(analysis_stmt.get(), 1, analysis.trace_id);
         sqlite3_bind_text(analysis_stmt.get(), 2, analysis.risk_level.c_str(), -1, SQLITE_STATIC);
         sqlite3_bind_text(analysis_stmt.get(), 3, analysis.summary.c_str(), -1, SQLITE_STATIC);
         sqlite3_bind_text(analysis_stmt.get(), 4, analysis.root_cause.c_str(), -1, SQLITE_STATIC);
@@ -829,7 +2219,7 @@ bool SqliteTraceRepository::SaveSingleTraceAnalysis(const TraceAnalysisRecord& a
 
         // AI 成功时要把 risk_level 和 ai_status 一起回写到 summary。
         // 否则列表页会看到“风险等级变了，但状态还停在 pending”的脏组合。
-        UpdateSummaryAnalysisOutcome(db_, analysis.trace_id, analysis.risk_level);
+        UpdateSummaryAnalysisOutcome(db_, schema, analysis.trace_id, analysis.risk_level, analysis.ai_status);
 
         rc = sqlite3_exec(db_, "COMMIT;", nullptr, nullptr, &errmsg);
         if (errmsg) {
@@ -854,7 +2244,7 @@ bool SqliteTraceRepository::UpdateTraceAiState(const std::string& trace_id,
     }
 
     try {
-        UpdateSummaryAiState(db_, trace_id, ai_status, ai_error);
+        UpdateSummaryAiState(db_, LocateWriteSchema(trace_id), trace_id, ai_status, ai_error);
     } catch (const std::exception&) {
         return false;
     }
@@ -893,82 +2283,130 @@ bool SqliteTraceRepository::SavePrimaryBatch(const std::vector<TraceSummary>& su
     };
 
     try {
-        int rc = sqlite3_exec(db_, "BEGIN TRANSACTION;", nullptr, nullptr, &errmsg);
-        if (errmsg) {
-            sqlite3_free(errmsg);
-            errmsg = nullptr;
-        }
-        persistence::checkSqliteError(db_, rc, "Failed to begin primary batch transaction");
+        // 分区模式下先把每条 trace 路由到它的分区（按 summary.start_time_ms），span 跟着自己的 trace 走；
+        // 批里没有 summary 的 span 去已有分区里找它的 trace，找不到再按 span 自己的时间路由。
+        // 路由和 ATTACH 都要在写事务开始之前做完。单库模式下只有 main 一组。
+        std::vector<WriteGroup> groups;
+        if (!PartitioningEnabled()) {
+            groups.push_back(WriteGroup{kMainSchema, {}, {}});
+            for (const auto& summary : summaries) {
+                groups.front().summaries.push_back(&summary);
+            }
+            for (const auto& span : spans) {
+                groups.front().spans.push_back(&span);
+            }
+        } else {
+            std::unordered_map<std::string, std::string> trace_schemas;
+            std::vector<std::string> summary_schemas;
+            std::vector<std::string> span_schemas;
+            summary_schemas.reserve(summaries.size());
+            span_schemas.reserve(spans.size());
+            for (const auto& summary : summaries) {
+                summary_schemas.push_back(ResolveWritePartition(summary.start_time_ms));
+                trace_schemas[summary.trace_id] = summary_schemas.back();
+            }
+            for (const auto& span : spans) {
+                auto iter = trace_schemas.find(span.trace_id);
+                if (iter == trace_schemas.end()) {
+                    sqlite3_int64 trace_key = 0;
+                    std::string schema;
+                    if (ParseTraceKey(span.trace_id, &trace_key)) {
+                        schema = LocateTraceSchema(db_, *write_stmt_cache_, write_attached_partitions_, trace_key);
+                    }
+                    if (schema.empty()) {
+                        schema = ResolveWritePartition(span.start_time_ms);
+                    }
+                    iter = trace_schemas.emplace(span.trace_id, std::move(schema)).first;
+                }
+                span_schemas.push_back(iter->second);
+            }
 
-        const char* sql_insert_summary = R"(
-            INSERT INTO trace_summary
-            (trace_id, service_name, start_time_ms, end_time_ms, duration_ms, span_count, token_count, risk_level, ai_status, ai_error)
-            VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?);
-        )";
-        persistence::StmtPtr summary_stmt;
-        {
-            sqlite3_stmt* raw_stmt = nullptr;
-            rc = sqlite3_prepare_v2(db_, sql_insert_summary, -1, &raw_stmt, nullptr);
-            persistence::checkSqliteError(db_, rc, "Prepare trace_summary batch insert");
-            summary_stmt.reset(raw_stmt);
+            std::vector<std::string> writable_schemas;
+            for (const auto& entry : trace_schemas) {
+                writable_schemas.push_back(entry.second);
+            }
+            AttachWritePartitions(&writable_schemas);
+            auto group_for = [&groups, &writable_schemas](const std::string& schema) -> WriteGroup& {
+                const std::string& target =
+                    std::find(writable_schemas.begin(), writable_schemas.end(), schema) != writable_schemas.end()
+                        ? schema
+                        : kMainSchema;
+                for (auto& group : groups) {
+                    if (group.schema == target) {
+                        return group;
+                    }
+                }
+                groups.push_back(WriteGroup{target, {}, {}});
+                return groups.back();
+            };
+            for (size_t index = 0; index < summaries.size(); ++index) {
+                group_for(summary_schemas[index]).summaries.push_back(&summaries[index]);
+            }
+            for (size_t index = 0; index < spans.size(); ++index) {
+                group_for(span_schemas[index]).spans.push_back(&spans[index]);
+            }
         }
 
+        // 排序放在事务外做，写锁只覆盖真正的插入。
+        for (auto& group : groups) {
+            SortGroupByPrimaryKey(&group);
+        }
+        // span 不带 replayed 标记，跟着同批里自己 trace 的 summary 走；绝大多数批次没有重放行，这个集合是空的。
+        std::unordered_set<std::string> replayed_trace_ids;
         for (const auto& summary : summaries) {
-            sqlite3_reset(summary_stmt.get());
-            sqlite3_clear_bindings(summary_stmt.get());
-
-            sqlite3_bind_text(summary_stmt.get(), 1, summary.trace_id.c_str(), -1, SQLITE_STATIC);
-            sqlite3_bind_text(summary_stmt.get(), 2, summary.service_name.c_str(), -1, SQLITE_STATIC);
-            sqlite3_bind_int64(summary_stmt.get(), 3, summary.start_time_ms);
-            if (summary.end_time_ms.has_value()) {
-                sqlite3_bind_int64(summary_stmt.get(), 4, summary.end_time_ms.value());
-            } else {
-                sqlite3_bind_null(summary_stmt.get(), 4);
+            if (summary.replayed) {
+                replayed_trace_ids.insert(summary.trace_id);
             }
-            sqlite3_bind_int64(summary_stmt.get(), 5, summary.duration_ms);
-            sqlite3_bind_int64(summary_stmt.get(), 6, static_cast<sqlite3_int64>(summary.span_count));
-            sqlite3_bind_int64(summary_stmt.get(), 7, static_cast<sqlite3_int64>(summary.token_count));
-            sqlite3_bind_text(summary_stmt.get(), 8, summary.risk_level.c_str(), -1, SQLITE_STATIC);
-            sqlite3_bind_text(summary_stmt.get(), 9, summary.ai_status.c_str(), -1, SQLITE_STATIC);
-            sqlite3_bind_text(summary_stmt.get(), 10, summary.ai_error.c_str(), -1, SQLITE_STATIC);
-
-            rc = sqlite3_step(summary_stmt.get());
-            persistence::checkSqliteError(db_, rc, "Insert trace_summary batch item");
         }
 
-        const char* sql_insert_span = R"(
-            INSERT INTO trace_span
-            (trace_id, span_id, parent_id, service_name, operation, start_time_ms, duration_ms, status, attributes_json)
-            VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?);
-        )";
-        persistence::StmtPtr span_stmt;
-        {
-            sqlite3_stmt* raw_stmt = nullptr;
-            rc = sqlite3_prepare_v2(db_, sql_insert_span, -1, &raw_stmt, nullptr);
-            persistence::checkSqliteError(db_, rc, "Prepare trace_span batch insert");
-            span_stmt.reset(raw_stmt);
+        int rc = sqlite3_exec(db_, "BEGIN TRANSACTION;", nullptr, nullptr, &errmsg);
+        if (errmsg) {
+            sqlite3_free(errmsg);
+            errmsg = nullptr;
         }
+        persistence::checkSqliteError(db_, rc, "Failed to begin primary batch transaction");
 
-        for (const auto& span : spans) {
-            sqlite3_reset(span_stmt.get());
-            sqlite3_clear_bindings(span_stmt.get());
-
-            sqlite3_bind_text(span_stmt.get(), 1, span.trace_id.c_str(), -1, SQLITE_STATIC);
-            sqlite3_bind_text(span_stmt.get(), 2, span.span_id.c_str(), -1, SQLITE_STATIC);
-            if (span.parent_id.has_value()) {
-                sqlite3_bind_text(span_stmt.get(), 3, span.parent_id->c_str(), -1, SQLITE_STATIC);
-            } else {
-                sqlite3_bind_null(span_stmt.get(), 3);
+        size_t replay_rows = 0;
+        size_t replay_inserted = 0;
+        for (const auto& group : groups) {
+            const std::string summary_prefix =
+                WithSchema("INSERT INTO @db.trace_summary (trace_id, service_name, start_time_ms, end_time_ms, "
+                           "duration_ms, span_count, token_count, risk_level, ai_status, ai_error) VALUES ",
+                           group.schema);
+            const std::string span_prefix =
+                WithSchema("INSERT INTO @db.trace_span (trace_id, span_id, parent_id, service_name, operation, "
+                           "start_time_ms, duration_ms, status, attributes_json) VALUES ",
+                           group.schema);
+            if (replayed_trace_ids.empty()) {
+                InsertRowsInChunks(db_, *write_stmt_cache_, summary_prefix, "", kSummaryInsertColumns,
+                                   group.summaries, BindSummaryRow, "Insert trace_summary batch rows");
+                InsertRowsInChunks(db_, *write_stmt_cache_, span_prefix, "", kSpanInsertColumns,
+                                   group.spans, BindSpanRow, "Insert trace_span batch rows");
+                continue;
             }
-            sqlite3_bind_text(span_stmt.get(), 4, span.service_name.c_str(), -1, SQLITE_STATIC);
-            sqlite3_bind_text(span_stmt.get(), 5, span.operation.c_str(), -1, SQLITE_STATIC);
-            sqlite3_bind_int64(span_stmt.get(), 6, span.start_time_ms);
-            sqlite3_bind_int64(span_stmt.get(), 7, span.duration_ms);
-            sqlite3_bind_text(span_stmt.get(), 8, span.status.c_str(), -1, SQLITE_STATIC);
-            sqlite3_bind_text(span_stmt.get(), 9, span.attributes_json.c_str(), -1, SQLITE_STATIC);
 
-            rc = sqlite3_step(span_stmt.get());
-            persistence::checkSqliteError(db_, rc, "Insert trace_span batch item");
+            // 批里混着重放的 trace：普通行和重放行分两组写，只有重放那组带冲突跳过。拆分保持组内的主键顺序。
+            std::vector<const TraceSummary*> fresh_summaries;
+            std::vector<const TraceSummary*> replayed_summaries;
+            for (const TraceSummary* summary : group.summaries) {
+                (summary->replayed ? replayed_summaries : fresh_summaries).push_back(summary);
+            }
+            std::vector<const TraceSpanRecord*> fresh_spans;
+            std::vector<const TraceSpanRecord*> replayed_spans;
+            for (const TraceSpanRecord* span : group.spans) {
+                (replayed_trace_ids.count(span->trace_id) > 0 ? replayed_spans : fresh_spans).push_back(span);
+            }
+            InsertRowsInChunks(db_, *write_stmt_cache_, summary_prefix, "", kSummaryInsertColumns,
+                               fresh_summaries, BindSummaryRow, "Insert trace_summary batch rows");
+            InsertRowsInChunks(db_, *write_stmt_cache_, span_prefix, "", kSpanInsertColumns,
+                               fresh_spans, BindSpanRow, "Insert trace_span batch rows");
+            replay_inserted += InsertRowsInChunks(db_, *write_stmt_cache_, summary_prefix, kSummaryConflictClause,
+                                                  kSummaryInsertColumns, replayed_summaries, BindSummaryRow,
+                                                  "Insert replayed trace_summary batch rows");
+            replay_inserted += InsertRowsInChunks(db_, *write_stmt_cache_, span_prefix, kSpanConflictClause,
+                                                  kSpanInsertColumns, replayed_spans, BindSpanRow,
+                                                  "Insert replayed trace_span batch rows");
+            replay_rows += replayed_summaries.size() + replayed_spans.size();
         }
 
         rc = sqlite3_exec(db_, "COMMIT;", nullptr, nullptr, &errmsg);
@@ -977,6 +2415,13 @@ bool SqliteTraceRepository::SavePrimaryBatch(const std::vector<TraceSummary>& su
             errmsg = nullptr;
         }
         persistence::checkSqliteError(db_, rc, "Commit primary batch transaction");
+        if (replay_rows > replay_inserted) {
+            // 跳过的行要看得见：正常只会是崩溃前已经落库的那几条 trace，数量异常时说明重放范围或 trace_key 有问题。
+            const size_t skipped = replay_rows - replay_inserted;
+            replay_skipped_primary_rows_.fetch_add(skipped, std::memory_order_relaxed);
+            std::cerr << "[SqliteTraceRepository] SavePrimaryBatch skipped " << skipped
+                      << " replayed rows that were already stored" << std::endl;
+        }
     } catch (const std::exception& e) {
         std::cerr << "[SqliteTraceRepository] SavePrimaryBatch failed"
                   << " summary_count=" << summaries.size()
@@ -1012,70 +2457,122 @@ bool SqliteTraceRepository::SaveAnalysisBatch(const std::vector<TraceAnalysisRec
     };
 
     try {
-        int rc = sqlite3_exec(db_, "BEGIN TRANSACTION;", nullptr, nullptr, &errmsg);
-        if (errmsg) {
-            sqlite3_free(errmsg);
-            errmsg = nullptr;
-        }
-        persistence::checkSqliteError(db_, rc, "Failed to begin analysis batch transaction");
-
-        const char* sql_insert_analysis = R"(
-            INSERT INTO trace_analysis
-            (trace_id, risk_level, summary, root_cause, solution, confidence)
-            VALUES (?, ?, ?, ?, ?, ?);
-        )";
-        persistence::StmtPtr analysis_stmt;
-        {
-            sqlite3_stmt* raw_stmt = nullptr;
-            rc = sqlite3_prepare_v2(db_, sql_insert_analysis, -1, &raw_stmt, nullptr);
-            persistence::checkSqliteError(db_, rc, "Prepare trace_analysis batch insert");
-            analysis_stmt.reset(raw_stmt);
-        }
-
-        // analysis 虽然落在附属表，但列表页高频读取的还是 trace_summary。
-        // 所以这里必须把最终 risk_level + ai_status 一起同步回写，避免读侧看到半成熟状态。
-        const char* sql_update_summary_outcome = R"(
-            UPDATE trace_summary
-            SET risk_level = ?, ai_status = 'completed', ai_error = ''
-            WHERE trace_id = ?;
-        )";
-        persistence::StmtPtr update_summary_outcome_stmt;
-        {
-            sqlite3_stmt* raw_stmt = nullptr;
-            rc = sqlite3_prepare_v2(db_, sql_update_summary_outcome, -1, &raw_stmt, nullptr);
-            persistence::checkSqliteError(db_, rc, "Prepare trace_summary outcome batch update");
-            update_summary_outcome_stmt.reset(raw_stmt);
-        }
-
+        // analysis 只带 trace_id，分区模式下要先找到 summary 所在的分区（一般就是最近一两个分区）。
+        std::vector<std::pair<std::string, std::vector<const TraceAnalysisRecord*>>> groups;
         for (const auto& analysis : analyses) {
-            sqlite3_reset(analysis_stmt.get());
-            sqlite3_clear_bindings(analysis_stmt.get());
-
-            sqlite3_bind_text(analysis_stmt.get(), 1, analysis.trace_id.c_str(), -1, SQLITE_STATIC);
-            sqlite3_bind_text(analysis_stmt.get(), 2, analysis.risk_level.c_str(), -1, SQLITE_STATIC);
-            sqlite3_bind_text(analysis_stmt.get(), 3, analysis.summary.c_str(), -1, SQLITE_STATIC);
-            sqlite3_bind_text(analysis_stmt.get(), 4, analysis.root_cause.c_str(), -1, SQLITE_STATIC);
-            sqlite3_bind_text(analysis_stmt.get(), 5, analysis.solution.c_str(), -1, SQLITE_STATIC);
-            sqlite3_bind_double(analysis_stmt.get(), 6, analysis.confidence);
+            const std::string schema = LocateWriteSchema(analysis.trace_id);
+            auto group = std::find_if(groups.begin(), groups.end(), [&schema](const auto& entry) {
+                return entry.first == schema;
+            });
+            if (group == groups.end()) {
+                groups.emplace_back(schema, std::vector<const TraceAnalysisRecord*>());
+                group = groups.end() - 1;
+            }
+            group->second.push_back(&analysis);
+        }
 
-            rc = sqlite3_step(analysis_stmt.get());
-            persistence::checkSqliteError(db_, rc, "Insert trace_analysis batch item");
+        // 横跨的分区超过 ATTACH 上限时（比如 AI 积压了十几个小时的分析结果），按上限分几个事务提交；
+        // analysis 之间没有依赖，部分提交不会留下半条 trace。
+        const size_t chunk_size = PartitioningEnabled() ? attach_capacity_ : groups.size();
+        for (size_t chunk_begin = 0; chunk_begin < groups.size(); chunk_begin += chunk_size) {
+            const size_t chunk_end = std::min(groups.size(), chunk_begin + chunk_size);
+            if (PartitioningEnabled()) {
+                const std::vector<PartitionInfo> partitions = SnapshotPartitions();
+                for (size_t index = chunk_begin; index < chunk_end; ++index) {
+                    const auto partition = std::find_if(partitions.begin(), partitions.end(), [&](const PartitionInfo& info) {
+                        return info.schema == groups[index].first;
+                    });
+                    if (partition != partitions.end()) {
+                        AttachPartition(db_, write_attached_partitions_, *partition, false);
+                    }
+                }
+            }
 
-            // 这里复用同一条 update stmt，避免 batch 内每条 analysis 都重新 prepare 一次 SQL。
-            sqlite3_reset(update_summary_outcome_stmt.get());
-            sqlite3_clear_bindings(update_summary_outcome_stmt.get());
-            sqlite3_bind_text(update_summary_outcome_stmt.get(), 1, analysis.risk_level.c_str(), -1, SQLITE_STATIC);
-            sqlite3_bind_text(update_summary_outcome_stmt.get(), 2, analysis.trace_id.c_str(), -1, SQLITE_STATIC);
-            rc = sqlite3_step(update_summary_outcome_stmt.get());
-            persistence::checkSqliteError(db_, rc, "Update trace_summary outcome batch item");
-        }
+            int rc = sqlite3_exec(db_, "BEGIN TRANSACTION;", nullptr, nullptr, &errmsg);
+            if (errmsg) {
+                sqlite3_free(errmsg);
+                errmsg = nullptr;
+            }
+            persistence::checkSqliteError(db_, rc, "Failed to begin analysis batch transaction");
+            size_t replay_skipped = 0;
+
+            for (size_t index = chunk_begin; index < chunk_end; ++index) {
+                const std::string& schema = groups[index].first;
+                const std::string sql_insert_analysis = WithSchema(R"(
+                    INSERT INTO @db.trace_analysis
+                    (trace_id, risk_level, summary, root_cause, solution, confidence)
+                    VALUES (?, ?, ?, ?, ?, ?);
+                )", schema);
+                persistence::SqliteStatementCache::Handle analysis_stmt =
+                    write_stmt_cache_->Acquire(sql_insert_analysis, "Prepare trace_analysis batch insert");
+                // WAL 回放出来的 trace 可能在崩溃前已经分析过：只有这类记录走带冲突跳过的语句，保留原来那条分析结果；
+                // 普通记录的主键冲突照旧让整批失败。重放记录很少，这条语句按需才 prepare。
+                std::optional<persistence::SqliteStatementCache::Handle> replay_analysis_stmt;
+
+                // analysis 虽然落在附属表，但列表页高频读取的还是 trace_summary。
+                // 所以这里必须把最终 risk_level + ai_status 一起同步回写，避免读侧看到半成熟状态。
+                const std::string sql_update_summary_outcome = WithSchema(R"(
+                    UPDATE @db.trace_summary
+                    SET risk_level = ?, ai_status = ?, ai_error = ''
+                    WHERE trace_id = ?;
+                )", schema);
+                persistence::SqliteStatementCache::Handle update_summary_outcome_stmt =
+                    write_stmt_cache_->Acquire(sql_update_summary_outcome, "Prepare trace_summary outcome batch update");
+
+                for (const TraceAnalysisRecord* analysis_ptr : groups[index].second) {
+                    const TraceAnalysisRecord& analysis = *analysis_ptr;
+                    if (analysis.replayed && !replay_analysis_stmt) {
+                        replay_analysis_stmt.emplace(write_stmt_cache_->Acquire(
+                            WithSchema(R"(
+                                INSERT INTO @db.trace_analysis
+                                (trace_id, risk_level, summary, root_cause, solution, confidence)
+                                VALUES (?, ?, ?, ?, ?, ?)
+                                ON CONFLICT(trace_id) DO NOTHING;
+                            )", schema),
+                            "Prepare replayed trace_analysis batch insert"));
+                    }
+                    sqlite3_stmt* insert_stmt = analysis.replayed ? replay_analysis_stmt->get() : analysis_stmt.get();
+                    sqlite3_reset(insert_stmt);
+                    sqlite3_clear_bindings(insert_stmt);
+
+                    BindTraceKey(insert_stmt, 1, analysis.trace_id);
+                    sqlite3_bind_text(insert_stmt, 2, analysis.risk_level.c_str(), -1, SQLITE_STATIC);
+                    sqlite3_bind_text(insert_stmt, 3, analysis.summary.c_str(), -1, SQLITE_STATIC);
+                    sqlite3_bind_text(insert_stmt, 4, analysis.root_cause.c_str(), -1, SQLITE_STATIC);
+                    sqlite3_bind_text(insert_stmt, 5, analysis.solution.c_str(), -1, SQLITE_STATIC);
+                    sqlite3_bind_double(insert_stmt, 6, analysis.confidence);
+
+                    rc = sqlite3_step(insert_stmt);
+                    persistence::checkSqliteError(db_, rc, "Insert trace_analysis batch item");
+                    if (sqlite3_changes(db_) == 0) {
+                        // 只有重放记录会走到这里：原来那条分析结果留着，summary 上的结论也不拿新结果去覆盖。
+                        ++replay_skipped;
+                        continue;
+                    }
+
+                    // 这里复用同一条 update stmt，避免 batch 内每条 analysis 都重新 prepare 一次 SQL。
+                    sqlite3_reset(update_summary_outcome_stmt.get());
+                    sqlite3_clear_bindings(update_summary_outcome_stmt.get());
+                    sqlite3_bind_text(update_summary_outcome_stmt.get(), 1, analysis.risk_level.c_str(), -1, SQLITE_STATIC);
+                    sqlite3_bind_text(update_summary_outcome_stmt.get(), 2, analysis.ai_status.c_str(), -1, SQLITE_STATIC);
+                    BindTraceKey(update_summary_outcome_stmt.get(), 3, analysis.trace_id);
+                    rc = sqlite3_step(update_summary_outcome_stmt.get());
+                    persistence::checkSqliteError(db_, rc, "Update trace_summary outcome batch item");
+                }
+            }
 
-        rc = sqlite3_exec(db_, "COMMIT;", nullptr, nullptr, &errmsg);
-        if (errmsg) {
-            sqlite3_free(errmsg);
-            errmsg = nullptr;
+            rc = sqlite3_exec(db_, "COMMIT;", nullptr, nullptr, &errmsg);
+            if (errmsg) {
+                sqlite3_free(errmsg);
+                errmsg = nullptr;
+            }
+            persistence::checkSqliteError(db_, rc, "Commit analysis batch transaction");
+            if (replay_skipped > 0) {
+                replay_skipped_analyses_.fetch_add(replay_skipped, std::memory_order_relaxed);
+                std::cerr << "[SqliteTraceRepository] SaveAnalysisBatch skipped " << replay_skipped
+                          << " replayed analyses that were already stored" << std::endl;
+            }
         }
-        persistence::checkSqliteError(db_, rc, "Commit analysis batch transaction");
     } catch (const std::exception&) {
         rollback();
         return false;
@@ -1093,6 +2590,13 @@ bool SqliteTraceRepository::SaveSingleTraceAtomic(const TraceSummary& summary,
         return false;
     }
 
+    std::string schema;
+    try {
+        schema = ResolveWritePartition(summary.start_time_ms);
+    } catch (const std::exception&) {
+        return false;
+    }
+
     char* errmsg = nullptr;
     int rc = sqlite3_exec(db_, "BEGIN TRANSACTION;", nullptr, nullptr, &errmsg);
     if (errmsg) {
@@ -1110,20 +2614,20 @@ bool SqliteTraceRepository::SaveSingleTraceAtomic(const TraceSummary& summary,
     };
 
     try {
-        const char* sql_insert_summary = R"(
-            INSERT INTO trace_summary
+        const std::string sql_insert_summary = WithSchema(R"(
+            INSERT INTO @db.trace_summary
             (trace_id, service_name, start_time_ms, end_time_ms, duration_ms, span_count, token_count, risk_level, ai_status, ai_error)
             VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?);
-        )";
+        )", schema);
         persistence::StmtPtr summary_stmt;
         {
             sqlite3_stmt* raw_stmt = nullptr;
-            rc = sqlite3_prepare_v2(db_, sql_insert_summary, -1, &raw_stmt, nullptr);
+            rc = sqlite3_prepare_v2(db_, sql_insert_summary.c_str(), -1, &raw_stmt, nullptr);
             persistence::checkSqliteError(db_, rc, "Prepare trace_summary insert");
             summary_stmt.reset(raw_stmt);
         }
         // 这里绑定的字符串来自入参对象，生命周期覆盖 sqlite3_step，因此使用 SQLITE_STATIC 减少拷贝。
-        sqlite3_bind_text(summary_stmt.get(), 1, summary.trace_id.c_str(), -1, SQLITE_STATIC);
+        BindTraceKey(summary_stmt.get(), 1, summary.trace_id);
         sqlite3_bind_text(summary_stmt.get(), 2, summary.service_name.c_str(), -1, SQLITE_STATIC);
         sqlite3_bind_int64(summary_stmt.get(), 3, summary.start_time_ms);
         if (summary.end_time_ms.has_value()) {
@@ -1140,25 +2644,25 @@ bool SqliteTraceRepository::SaveSingleTraceAtomic(const TraceSummary& summary,
         rc = sqlite3_step(summary_stmt.get());
         persistence::checkSqliteError(db_, rc, "Insert trace_summary");
 
-        const char* sql_insert_span = R"(
-            INSERT INTO trace_span
+        const std::string sql_insert_span = WithSchema(R"(
+            INSERT INTO @db.trace_span
             (trace_id, span_id, parent_id, service_name, operation, start_time_ms, duration_ms, status, attributes_json)
             VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?);
-        )";
+        )", schema);
         persistence::StmtPtr span_stmt;
         {
             sqlite3_stmt* raw_stmt = nullptr;
-            rc = sqlite3_prepare_v2(db_, sql_insert_span, -1, &raw_stmt, nullptr);
+            rc = sqlite3_prepare_v2(db_, sql_insert_span.c_str(), -1, &raw_stmt, nullptr);
             persistence::checkSqliteError(db_, rc, "Prepare trace_span insert");
             span_stmt.reset(raw_stmt);
         }
         for (const auto& span : spans) {
             sqlite3_reset(span_stmt.get());
             sqlite3_clear_bindings(span_stmt.get());
-            sqlite3_bind_text(span_stmt.get(), 1, span.trace_id.c_str(), -1, SQLITE_STATIC);
-            sqlite3_bind_text(span_stmt.get(), 2, span.span_id.c_str(), -1, SQLITE_STATIC);
+            BindTraceKey(span_stmt.get(), 1, span.trace_id);
+            BindTraceKey(span_stmt.get(), 2, span.span_id);
             if (span.parent_id.has_value()) {
-                sqlite3_bind_text(span_stmt.get(), 3, span.parent_id->c_str(), -1, SQLITE_STATIC);
+                BindTraceKey(span_stmt.get(), 3, *span.parent_id);
             } else {
                 sqlite3_bind_null(span_stmt.get(), 3);
             }
@@ -1175,19 +2679,19 @@ bool SqliteTraceRepository::SaveSingleTraceAtomic(const TraceSummary& summary,
         // 原子写现在只覆盖主链真实会被查询与展示的三段数据：
         // summary / spans / analysis。那张废弃调试附属表已经退出产品路径，这里不再写它。
         if (analysis) {
-            const char* sql_insert_analysis = R"(
-                INSERT INTO trace_analysis
+            const std::string sql_insert_analysis = WithSchema(R"(
+                INSERT INTO @db.trace_analysis
                 (trace_id, risk_level, summary, root_cause, solution, confidence)
                 VALUES (?, ?, ?, ?, ?, ?);
-            )";
+            )", schema);
             persistence::StmtPtr analysis_stmt;
             {
                 sqlite3_stmt* raw_stmt = nullptr;
-                rc = sqlite3_prepare_v2(db_, sql_insert_analysis, -1, &raw_stmt, nullptr);
+                rc = sqlite3_prepare_v2(db_, sql_insert_analysis.c_str(), -1, &raw_stmt, nullptr);
                 persistence::checkSqliteError(db_, rc, "Prepare trace_analysis insert");
                 analysis_stmt.reset(raw_stmt);
             }
-            sqlite3_bind_text(analysis_stmt.get(), 1, analysis->trace_id.c_str(), -1, SQLITE_STATIC);
+            BindTraceKey(analysis_stmt.get(), 1, analysis->trace_id);
             sqlite3_bind_text(analysis_stmt.get(), 2, analysis->risk_level.c_str(), -1, SQLITE_STATIC);
             sqlite3_bind_text(analysis_stmt.get(), 3, analysis->summary.c_str(), -1, SQLITE_STATIC);
             sqlite3_bind_text(analysis_stmt.get(), 4, analysis->root_cause.c_str(), -1, SQLITE_STATIC);
@@ -1196,7 +2700,7 @@ bool SqliteTraceRepository::SaveSingleTraceAtomic(const TraceSummary& summary,
             rc = sqlite3_step(analysis_stmt.get());
             persistence::checkSqliteError(db_, rc, "Insert trace_analysis");
 
-            UpdateSummaryAnalysisOutcome(db_, analysis->trace_id, analysis->risk_level);
+            UpdateSummaryAnalysisOutcome(db_, schema, analysis->trace_id, analysis->risk_level, analysis->ai_status);
         }
 
         rc = sqlite3_exec(db_, "COMMIT;", nullptr, nullptr, &errmsg);
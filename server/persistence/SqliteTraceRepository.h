@@ -1,15 +1,30 @@
 #pragma once
 
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <list>
+#include <memory>
 #include <mutex>
 #include <optional>
 #include <string>
+#include <thread>
 #include <vector>
+#include "persistence/SqliteStatementCache.h"
 #include "persistence/TraceRepository.h"
 
 struct sqlite3;
 
 // 读侧查询类型先放在 SQLite Trace Repo 头文件里，后续如果查询面继续扩大，
 // 再单独抽成 TraceQueryTypes.h，避免当前阶段为了“抽象整齐”先拆过多文件。
+// 键集分页的位置：列表按 (start_time_ms DESC, trace_id DESC) 排序，游标就是上一页最后一条的这两个值，
+// 下一页从严格小于它的位置接着读，直接走 idx_trace_summary_start_time_trace_id 的范围扫描，不再 OFFSET 跳行。
+struct TraceSearchCursor
+{
+    int64_t start_time_ms = 0;
+    std::string trace_id;
+};
+
 struct TraceSearchRequest
 {
     std::optional<std::string> trace_id;
@@ -20,6 +35,8 @@ struct TraceSearchRequest
     std::vector<std::string> risk_levels;
     size_t page = 1;
     size_t page_size = 20;
+    // 带了游标就按键集往后翻，忽略 page；不带时仍按 page/page_size 走 OFFSET，老调用方不受影响。
+    std::optional<TraceSearchCursor> cursor;
 };
 
 struct TraceListItem
@@ -39,7 +56,11 @@ struct TraceListItem
 struct TraceSearchResult
 {
     size_t total = 0;
+    // total 由按小时维护的计数表汇总：整小时精确，时间窗两端不满一小时且数据量很大的边角按时长比例折算，这时标成近似。
+    bool total_is_approximate = false;
     std::vector<TraceListItem> items;
+    // 后面还有数据时给出下一页的游标；到底了为空。
+    std::optional<TraceSearchCursor> next_cursor;
 };
 
 struct TraceSpanDetail
@@ -80,11 +101,53 @@ struct TraceDetailRecord
     std::vector<TraceSpanDetail> spans;
 };
 
+// 分区粒度：None 是单文件（默认）；Hour/Day 按 trace 的 start_time_ms（UTC）把数据写进按时间切开的独立 SQLite 文件。
+enum class TracePartitionMode
+{
+    None,
+    Hour,
+    Day,
+};
+
 // SqliteTraceRepository 作为 SQLite 版本的 Trace 存储占位实现，后续再接入真实 SQL 逻辑。
+// 连接分工：
+// 1) db_ 是唯一的写连接，只给 flush 线程和 retention 清理用，所有访问都在 mutex_ 下串行；
+// 2) read_pool_size > 0 时，SearchTraces/GetTraceDetail 改走只读连接池，每条查询线程借一条 NOMUTEX 只读连接，
+//    读不再拿 mutex_，WAL 下读写互不阻塞，前端查询不会排在批量写入后面；
+// 3) read_pool_size == 0（或 :memory: 库，连接间看不到彼此的数据）时退回旧行为，读也走写连接。
+// 每条连接各带一份 prepared statement 缓存，热路径上的 SQL 只在第一次用到时 prepare。
+// 分区模式下（partition_mode != None）：
+// 1) 每个小时/天一个独立文件 <db>.pYYYYMMDD[HH]，表结构和主库相同，写入时按 summary.start_time_ms 路由；
+// 2) 查询按需把分区 ATTACH 到当前连接上，列表搜索按请求的时间窗裁剪分区，分区之间时间段不重叠，所以可以逐个分区分页；
+// 3) retention 整个分区 DETACH + 删文件，不再逐批 DELETE；主库里的表继续保存开启分区之前的旧数据（以及极少数兜底写入），
+//    按原来的批量删除清理，查询时作为最老的一段排在所有分区之后。
+// 列表总数不再每页 COUNT(*)：每个库（主库/分区）各有一张按 (入口服务, 小时, 风险等级) 计数的表，由触发器随 trace_summary 增删改同步维护。
 class SqliteTraceRepository : public TraceRepository
 {
 public:
-    explicit SqliteTraceRepository(const std::string& db_path);
+    struct RuntimeStatsSnapshot
+    {
+        uint64_t write_stmt_cache_hits = 0;
+        uint64_t write_stmt_cache_misses = 0;
+        uint64_t read_stmt_cache_hits = 0;
+        uint64_t read_stmt_cache_misses = 0;
+        size_t opened_read_connections = 0;
+        // 旧 schema 迁移进度：还剩没搬的数据时 pending 为 true；skipped 是 id 不是合法整数、或新表里已有同 key 而没搬的 trace。
+        bool legacy_migration_pending = false;
+        uint64_t legacy_migrated_traces = 0;
+        uint64_t legacy_skipped_traces = 0;
+        // 当前存活的分区文件数、累计 ATTACH 次数（反映 LRU 换入换出的频率）和 retention 累计删掉的分区数。
+        size_t partitions = 0;
+        uint64_t partition_attaches = 0;
+        uint64_t dropped_partitions = 0;
+        // WAL 重放出来的行因为主键已存在而跳过的累计数（summary/span 和 analysis 分开记）。
+        uint64_t replay_skipped_primary_rows = 0;
+        uint64_t replay_skipped_analyses = 0;
+    };
+
+    explicit SqliteTraceRepository(const std::string& db_path,
+                                   size_t read_pool_size = 0,
+                                   TracePartitionMode partition_mode = TracePartitionMode::None);
     ~SqliteTraceRepository();
 
     bool SaveSingleTraceSummary(const TraceSummary& summary) override;
@@ -99,6 +162,7 @@ public:
     bool SavePrimaryBatch(const std::vector<TraceSummary>& summaries,
                           const std::vector<TraceSpanRecord>& spans) override;
     bool SaveAnalysisBatch(const std::vector<TraceAnalysisRecord>& analyses) override;
+    bool HasTraceAnalysis(const std::string& trace_id) override;
 
     // 读侧先只暴露两个最小入口：列表搜索 + 单条详情。
     // 当前阶段先直接落在 SQLite 仓库里，不急着上升到抽象基类，
@@ -106,12 +170,136 @@ public:
     TraceSearchResult SearchTraces(const TraceSearchRequest& request);
     std::optional<TraceDetailRecord> GetTraceDetail(const std::string& trace_id);
     bool DeleteTraceById(const std::string& trace_id);
+    // 分区模式下只清主库里未分区的数据；分区里的数据由 DropExpiredPartitions 整个分区删除。
     size_t DeleteExpiredTracesBatch(int64_t cutoff_ms, size_t limit);
+    // 删除时间段整体早于 cutoff_ms 的分区：先从分区目录摘掉、从各连接 DETACH，再删文件，返回删掉的分区数。
+    // 粒度是整个分区，所以数据最多比 retention 多留一个分区时长；未开启分区时直接返回 0。
+    size_t DropExpiredPartitions(int64_t cutoff_ms);
+    // 当前存活分区的 schema 名（即文件名后缀，例如 p20240310），按时间升序。
+    std::vector<std::string> PartitionNames();
+
+    // 旧 schema（TEXT 主键）的库在构造时会把旧表改名成 legacy_*，新数据立即写新表，旧数据由后台线程按批搬过来。
+    // 搬迁期间读接口只看新表，最近的 trace 先搬，所以列表页是从新往旧逐步补齐。
+    bool LegacyMigrationPending() const;
+    // 搬一批（最多 limit 条 trace）并返回本批从旧表清掉的 trace 数；旧表已空时删表、结束迁移并返回 0。
+    // 后台线程就是循环调它；单测和运维脚本也可以直接调用来同步推进。
+    size_t MigrateLegacyTracesBatch(size_t limit);
+    // 只读连接池当前已经打开的连接数；按需懒打开，不超过 read_pool_size。
+    size_t OpenedReadConnections();
+    RuntimeStatsSnapshot SnapshotRuntimeStats();
+    std::string DescribeRuntimeStats();
 
 private:
-    bool DeleteTracesByIdsAtomic(const std::vector<std::string>& trace_ids);
+    // 一个分区文件覆盖 [start_ms, end_ms) 这段 trace 起始时间；schema 是 ATTACH 时用的名字。
+    struct PartitionInfo
+    {
+        int64_t start_ms = 0;
+        int64_t end_ms = 0;
+        std::string schema;
+        std::string path;
+    };
+    // 一条连接上当前 ATTACH 着的分区 schema 名，头部是最近用过的；数量受 SQLite 的 ATTACH 上限约束，满了按 LRU DETACH。
+    using AttachedPartitions = std::list<std::string>;
+
+    // 只读连接和它自己的 statement 缓存绑在一起借还；析构时先 finalize 缓存里的 stmt 再关连接。
+    struct ReadConnection
+    {
+        ~ReadConnection();
+
+        sqlite3* db = nullptr;
+        std::unique_ptr<persistence::SqliteStatementCache> stmt_cache;
+        AttachedPartitions attached_partitions;
+    };
+
+    // 借出期间连接只属于当前线程，析构时还回池子；所以只读连接可以用 NOMUTEX，省掉 SQLite 内部的连接锁。
+    class ReadConnectionLease
+    {
+    public:
+        explicit ReadConnectionLease(SqliteTraceRepository* repo);
+        ~ReadConnectionLease();
+        ReadConnectionLease(const ReadConnectionLease&) = delete;
+        ReadConnectionLease& operator=(const ReadConnectionLease&) = delete;
+
+        ReadConnection* get() const { return conn_.get(); }
+
+    private:
+        SqliteTraceRepository* repo_;
+        std::unique_ptr<ReadConnection> conn_;
+    };
+
+    bool DeleteTracesByIdsAtomic(const std::string& schema, const std::vector<int64_t>& trace_ids);
+    // 读流程本身不关心连接来自池子还是写连接，调用方负责保证 db 和它的缓存在调用期间不被别的线程使用。
+    TraceSearchResult SearchTracesOn(sqlite3* db,
+                                     persistence::SqliteStatementCache& stmt_cache,
+                                     AttachedPartitions& attached,
+                                     const TraceSearchRequest& request);
+    std::optional<TraceDetailRecord> GetTraceDetailOn(sqlite3* db,
+                                                      persistence::SqliteStatementCache& stmt_cache,
+                                                      AttachedPartitions& attached,
+                                                      const std::string& trace_id);
+
+    bool PartitioningEnabled() const { return partition_mode_ != TracePartitionMode::None; }
+    std::vector<PartitionInfo> SnapshotPartitions();
+    // 把分区挂到连接上并移到 LRU 头部；已挂上时只调整顺序。必须在事务外调用（SQLite 不允许事务里 ATTACH/DETACH）。
+    // create 只给写连接用：文件不存在时新建并建表。只读连接遇到文件已被 retention 删掉时返回 false，调用方跳过这个分区。
+    bool AttachPartition(sqlite3* db, AttachedPartitions& attached, const PartitionInfo& partition, bool create);
+    // DETACH 掉连接上已经不在分区目录里的分区，让 retention 删掉的文件尽快真正释放。
+    void DetachStalePartitions(sqlite3* db, AttachedPartitions& attached);
+    // 按主键在分区里找 trace：从新到旧逐个分区探测，最后看主库；找到时对应分区已经挂在连接上，找不到返回空串。
+    // 单库模式下直接返回 main，不额外探测。
+    std::string LocateTraceSchema(sqlite3* db,
+                                  persistence::SqliteStatementCache& stmt_cache,
+                                  AttachedPartitions& attached,
+                                  int64_t trace_key);
+    // 写连接专用（mutex_ 下）：给一条新 trace 按 start_time_ms 选分区，没有就新建；返回的 schema 已经挂在写连接上。
+    std::string ResolveWritePartition(int64_t start_time_ms);
+    // 写事务开始前把本次要写的分区全部挂到写连接上；超过 ATTACH 上限的分区（最久没用的）改写进主库，保证一个事务就能写完。
+    void AttachWritePartitions(std::vector<std::string>* schemas);
+    // 写连接上按 trace_id 找它所在的分区（mutex_ 下），找不到时落主库，由主库的外键约束照旧报错。
+    std::string LocateWriteSchema(const std::string& trace_id);
+    void RunLegacyMigration();
+    std::unique_ptr<ReadConnection> AcquireReadConnection();
+    void ReleaseReadConnection(std::unique_ptr<ReadConnection> conn);
 
     std::string db_path_;
+    std::string final_path_;
     sqlite3* db_ = nullptr;
     std::mutex mutex_;
+
+    // 计数按连接类型汇总；缓存本身挂在各自连接上，计数器在这里统一持有，快照时无锁读取。
+    std::atomic<uint64_t> write_stmt_cache_hits_{0};
+    std::atomic<uint64_t> write_stmt_cache_misses_{0};
+    std::atomic<uint64_t> read_stmt_cache_hits_{0};
+    std::atomic<uint64_t> read_stmt_cache_misses_{0};
+    // 写连接的缓存，受 mutex_ 保护。
+    std::unique_ptr<persistence::SqliteStatementCache> write_stmt_cache_;
+
+    size_t read_pool_size_ = 0;
+    std::mutex read_pool_mutex_;
+    std::condition_variable read_pool_cv_;
+    std::vector<std::unique_ptr<ReadConnection>> idle_read_connections_;
+    size_t opened_read_connections_ = 0;
+
+    TracePartitionMode partition_mode_ = TracePartitionMode::None;
+    int64_t partition_span_ms_ = 0;
+    size_t attach_capacity_ = 0;
+    // 分区目录按 start_ms 升序，时间段互不重叠。写连接新建分区、retention 删分区时修改，读连接每次查询前拷一份快照。
+    std::mutex partition_mutex_;
+    std::vector<PartitionInfo> partitions_;
+    // 已经被 retention 整体删掉的时间上界：比它还早的迟到数据不再新建分区，直接写进主库，由批量删除兜底清理。
+    int64_t partition_floor_ms_ = 0;
+    // 写连接上挂着的分区，受 mutex_ 保护。
+    AttachedPartitions write_attached_partitions_;
+    std::atomic<uint64_t> partition_attaches_{0};
+    std::atomic<uint64_t> dropped_partitions_{0};
+    std::atomic<uint64_t> replay_skipped_primary_rows_{0};
+    std::atomic<uint64_t> replay_skipped_analyses_{0};
+
+    std::atomic<bool> legacy_migration_pending_{false};
+    std::atomic<uint64_t> legacy_migrated_traces_{0};
+    std::atomic<uint64_t> legacy_skipped_traces_{0};
+    std::mutex legacy_migration_mutex_;
+    std::condition_variable legacy_migration_cv_;
+    bool legacy_migration_stopping_ = false;
+    std::thread legacy_migration_thread_;
 };
@@ -63,6 +63,14 @@ public:
         return true;
     }
 
+    // 只给入口 WAL 重放用：这条 trace 在库里是否已经有分析结果。重放出来的 trace 崩溃前可能已经分析并告警过，
+    // 已有结果时 worker 不再调模型、也不再发告警。存储实现答不上来时按“没有”处理，宁可多分析一次也不漏告警。
+    virtual bool HasTraceAnalysis(const std::string& trace_id)
+    {
+        (void)trace_id;
+        return false;
+    }
+
     // 批量写分析结果时也只保留 trace_analysis 这一张附属表。
     virtual bool SaveAnalysisBatch(const std::vector<TraceAnalysisRecord>& analyses)
     {
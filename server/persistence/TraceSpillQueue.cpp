@@ -0,0 +1,444 @@
+#include "persistence/TraceSpillQueue.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace persistence {
+
+namespace
+{
+constexpr char kFileMagic[8] = {'L', 'S', 'S', 'P', 'I', 'L', 'L', '1'};
+constexpr size_t kRecordHeaderSize = 12;
+constexpr uint8_t kRecordPending = 0;
+constexpr uint8_t kRecordConsumed = 1;
+// 记录头里原来的保留位用作 payload 版本：0 是最初的编码；1 在每条 summary / analysis 末尾多一个 replayed 字节。
+// 读的时候按记录自己的版本解，升级前留在文件里的旧记录照常回放。
+constexpr uint16_t kPayloadVersionLegacy = 0;
+constexpr uint16_t kPayloadVersionReplayFlag = 1;
+
+uint32_t Fnv1a(const char* data, size_t size)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= static_cast<unsigned char>(data[i]);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+template <typename T>
+void PutRaw(std::string* out, T value)
+{
+    out->append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+void PutString(std::string* out, const std::string& value)
+{
+    PutRaw<uint32_t>(out, static_cast<uint32_t>(value.size()));
+    out->append(value);
+}
+
+// payload 解码只做越界检查，不信任长度字段：校验通过但内容被改坏的文件也只会解码失败，不会读飞。
+class PayloadReader
+{
+public:
+    PayloadReader(const char* data, size_t size) : data_(data), size_(size) {}
+
+    template <typename T>
+    bool GetRaw(T* value)
+    {
+        if (size_ - pos_ < sizeof(T)) {
+            return false;
+        }
+        std::memcpy(value, data_ + pos_, sizeof(T));
+        pos_ += sizeof(T);
+        return true;
+    }
+
+    bool GetString(std::string* value)
+    {
+        uint32_t length = 0;
+        if (!GetRaw(&length) || size_ - pos_ < length) {
+            return false;
+        }
+        value->assign(data_ + pos_, length);
+        pos_ += length;
+        return true;
+    }
+
+    bool Done() const { return pos_ == size_; }
+
+private:
+    const char* data_;
+    size_t size_;
+    size_t pos_ = 0;
+};
+
+void EncodeSummary(std::string* out, const TraceSummary& summary)
+{
+    PutString(out, summary.trace_id);
+    PutString(out, summary.service_name);
+    PutRaw<int64_t>(out, summary.start_time_ms);
+    PutRaw<uint8_t>(out, summary.end_time_ms.has_value() ? 1 : 0);
+    PutRaw<int64_t>(out, summary.end_time_ms.value_or(0));
+    PutRaw<int64_t>(out, summary.duration_ms);
+    PutRaw<uint64_t>(out, summary.span_count);
+    PutRaw<uint64_t>(out, summary.token_count);
+    PutString(out, summary.risk_level);
+    PutString(out, summary.ai_status);
+    PutString(out, summary.ai_error);
+    PutRaw<uint8_t>(out, summary.replayed ? 1 : 0);
+}
+
+bool DecodeSummary(PayloadReader* in, uint16_t version, TraceSummary* summary)
+{
+    uint8_t has_end = 0;
+    int64_t end_time_ms = 0;
+    uint64_t span_count = 0;
+    uint64_t token_count = 0;
+    if (!in->GetString(&summary->trace_id) || !in->GetString(&summary->service_name) ||
+        !in->GetRaw(&summary->start_time_ms) || !in->GetRaw(&has_end) || !in->GetRaw(&end_time_ms) ||
+        !in->GetRaw(&summary->duration_ms) || !in->GetRaw(&span_count) || !in->GetRaw(&token_count) ||
+        !in->GetString(&summary->risk_level) || !in->GetString(&summary->ai_status) ||
+        !in->GetString(&summary->ai_error)) {
+        return false;
+    }
+    if (has_end) {
+        summary->end_time_ms = end_time_ms;
+    }
+    summary->span_count = static_cast<size_t>(span_count);
+    summary->token_count = static_cast<size_t>(token_count);
+    if (version >= kPayloadVersionReplayFlag) {
+        uint8_t replayed = 0;
+        if (!in->GetRaw(&replayed)) {
+            return false;
+        }
+        summary->replayed = replayed != 0;
+    }
+    return true;
+}
+
+void EncodeSpan(std::string* out, const TraceSpanRecord& span)
+{
+    PutString(out, span.trace_id);
+    PutString(out, span.span_id);
+    PutRaw<uint8_t>(out, span.parent_id.has_value() ? 1 : 0);
+    PutString(out, span.parent_id.value_or(std::string()));
+    PutString(out, span.service_name);
+    PutString(out, span.operation);
+    PutRaw<int64_t>(out, span.start_time_ms);
+    PutRaw<int64_t>(out, span.duration_ms);
+    PutString(out, span.status);
+    PutString(out, span.attributes_json);
+}
+
+bool DecodeSpan(PayloadReader* in, TraceSpanRecord* span)
+{
+    uint8_t has_parent = 0;
+    std::string parent_id;
+    if (!in->GetString(&span->trace_id) || !in->GetString(&span->span_id) || !in->GetRaw(&has_parent) ||
+        !in->GetString(&parent_id) || !in->GetString(&span->service_name) || !in->GetString(&span->operation) ||
+        !in->GetRaw(&span->start_time_ms) || !in->GetRaw(&span->duration_ms) || !in->GetString(&span->status) ||
+        !in->GetString(&span->attributes_json)) {
+        return false;
+    }
+    if (has_parent) {
+        span->parent_id = std::move(parent_id);
+    }
+    return true;
+}
+
+void EncodeAnalysis(std::string* out, const TraceAnalysisRecord& analysis)
+{
+    PutString(out, analysis.trace_id);
+    PutString(out, analysis.risk_level);
+    PutString(out, analysis.summary);
+    PutString(out, analysis.root_cause);
+    PutString(out, analysis.solution);
+    PutRaw<double>(out, analysis.confidence);
+    PutString(out, analysis.ai_status);
+    PutRaw<uint8_t>(out, analysis.replayed ? 1 : 0);
+}
+
+bool DecodeAnalysis(PayloadReader* in, uint16_t version, TraceAnalysisRecord* analysis)
+{
+    if (!in->GetString(&analysis->trace_id) || !in->GetString(&analysis->risk_level) ||
+        !in->GetString(&analysis->summary) || !in->GetString(&analysis->root_cause) ||
+        !in->GetString(&analysis->solution) || !in->GetRaw(&analysis->confidence) ||
+        !in->GetString(&analysis->ai_status)) {
+        return false;
+    }
+    uint8_t replayed = 0;
+    if (version >= kPayloadVersionReplayFlag && !in->GetRaw(&replayed)) {
+        return false;
+    }
+    analysis->replayed = replayed != 0;
+    return true;
+}
+
+bool PreadAll(int fd, char* data, size_t size, uint64_t offset)
+{
+    while (size > 0) {
+        const ssize_t n = ::pread(fd, data, size, static_cast<off_t>(offset));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        size -= static_cast<size_t>(n);
+        offset += static_cast<uint64_t>(n);
+    }
+    return true;
+}
+
+bool PwriteAll(int fd, const char* data, size_t size, uint64_t offset)
+{
+    while (size > 0) {
+        const ssize_t n = ::pwrite(fd, data, size, static_cast<off_t>(offset));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        size -= static_cast<size_t>(n);
+        offset += static_cast<uint64_t>(n);
+    }
+    return true;
+}
+}
+
+TraceSpillQueue::TraceSpillQueue(std::string path, uint64_t max_bytes)
+    : path_(std::move(path)), max_bytes_(max_bytes)
+{
+    fd_ = ::open(path_.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd_ < 0) {
+        throw std::runtime_error("TraceSpillQueue: failed to open " + path_ + ": " + std::strerror(errno));
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    try {
+        LoadExistingLocked();
+    } catch (...) {
+        ::close(fd_);
+        fd_ = -1;
+        throw;
+    }
+}
+
+TraceSpillQueue::~TraceSpillQueue()
+{
+    if (fd_ >= 0) {
+        ::close(fd_);
+    }
+}
+
+void TraceSpillQueue::LoadExistingLocked()
+{
+    struct stat st {};
+    if (::fstat(fd_, &st) != 0) {
+        throw std::runtime_error("TraceSpillQueue: failed to stat " + path_);
+    }
+    const uint64_t file_size = static_cast<uint64_t>(st.st_size);
+    if (file_size < sizeof(kFileMagic)) {
+        // 新文件，或者连文件头都没写完就掉电了：直接重写文件头。
+        if (::ftruncate(fd_, 0) != 0 || !PwriteAll(fd_, kFileMagic, sizeof(kFileMagic), 0) || ::fdatasync(fd_) != 0) {
+            throw std::runtime_error("TraceSpillQueue: failed to initialize " + path_);
+        }
+        end_offset_ = sizeof(kFileMagic);
+        return;
+    }
+
+    char magic[sizeof(kFileMagic)] = {};
+    if (!PreadAll(fd_, magic, sizeof(magic), 0) || std::memcmp(magic, kFileMagic, sizeof(kFileMagic)) != 0) {
+        throw std::runtime_error("TraceSpillQueue: " + path_ + " is not a trace spill file");
+    }
+
+    uint64_t offset = sizeof(kFileMagic);
+    std::string payload;
+    while (offset + kRecordHeaderSize <= file_size) {
+        char header[kRecordHeaderSize] = {};
+        if (!PreadAll(fd_, header, sizeof(header), offset)) {
+            break;
+        }
+        uint32_t payload_size = 0;
+        uint32_t checksum = 0;
+        std::memcpy(&payload_size, header + 4, sizeof(payload_size));
+        std::memcpy(&checksum, header + 8, sizeof(checksum));
+        const uint64_t record_end = offset + kRecordHeaderSize + payload_size;
+        if (record_end > file_size) {
+            break;
+        }
+        payload.resize(payload_size);
+        if (!PreadAll(fd_, payload.data(), payload_size, offset + kRecordHeaderSize) ||
+            Fnv1a(payload.data(), payload.size()) != checksum) {
+            break;
+        }
+        if (static_cast<uint8_t>(header[0]) == kRecordPending) {
+            pending_.push_back(PendingEntry{offset, payload_size});
+            pending_bytes_ += kRecordHeaderSize + payload_size;
+        }
+        offset = record_end;
+    }
+
+    // offset 之后是半截记录或者校验对不上的脏尾巴，截掉以后新记录才能接着追加。
+    if (offset < file_size && ::ftruncate(fd_, static_cast<off_t>(offset)) != 0) {
+        throw std::runtime_error("TraceSpillQueue: failed to truncate torn tail of " + path_);
+    }
+    end_offset_ = offset;
+    if (pending_.empty() && end_offset_ > sizeof(kFileMagic)) {
+        // 上次退出前已经全部回放完、只是还没来得及截断，这里顺手收掉。
+        if (::ftruncate(fd_, sizeof(kFileMagic)) == 0) {
+            end_offset_ = sizeof(kFileMagic);
+        }
+    }
+}
+
+bool TraceSpillQueue::AppendPrimary(const std::vector<TraceSummary>& summaries,
+                                    const std::vector<TraceSpanRecord>& spans)
+{
+    std::string payload;
+    PutRaw<uint32_t>(&payload, static_cast<uint32_t>(summaries.size()));
+    for (const auto& summary : summaries) {
+        EncodeSummary(&payload, summary);
+    }
+    PutRaw<uint32_t>(&payload, static_cast<uint32_t>(spans.size()));
+    for (const auto& span : spans) {
+        EncodeSpan(&payload, span);
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    return AppendLocked(RecordKind::PrimaryBatch, payload);
+}
+
+bool TraceSpillQueue::AppendAnalysis(const std::vector<TraceAnalysisRecord>& analyses)
+{
+    std::string payload;
+    PutRaw<uint32_t>(&payload, static_cast<uint32_t>(analyses.size()));
+    for (const auto& analysis : analyses) {
+        EncodeAnalysis(&payload, analysis);
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    return AppendLocked(RecordKind::AnalysisBatch, payload);
+}
+
+bool TraceSpillQueue::AppendLocked(RecordKind kind, const std::string& payload)
+{
+    if (payload.size() > UINT32_MAX) {
+        return false;
+    }
+    const uint64_t record_size = kRecordHeaderSize + payload.size();
+    if (max_bytes_ > 0 && end_offset_ + record_size > max_bytes_) {
+        return false;
+    }
+
+    // 记录头和 payload 拼成一次 pwrite，掉电时最多留下一条半截记录，重启扫描会把它截掉。
+    std::string record;
+    record.reserve(record_size);
+    PutRaw<uint8_t>(&record, kRecordPending);
+    PutRaw<uint8_t>(&record, static_cast<uint8_t>(kind));
+    PutRaw<uint16_t>(&record, kPayloadVersionReplayFlag);
+    PutRaw<uint32_t>(&record, static_cast<uint32_t>(payload.size()));
+    PutRaw<uint32_t>(&record, Fnv1a(payload.data(), payload.size()));
+    record.append(payload);
+
+    if (!PwriteAll(fd_, record.data(), record.size(), end_offset_) || ::fdatasync(fd_) != 0) {
+        // 磁盘满之类的失败：把可能写进去的半截内容截掉，保持“文件尾一定是完整记录”。
+        (void)::ftruncate(fd_, static_cast<off_t>(end_offset_));
+        return false;
+    }
+    pending_.push_back(PendingEntry{end_offset_, static_cast<uint32_t>(payload.size())});
+    pending_bytes_ += record_size;
+    end_offset_ += record_size;
+    return true;
+}
+
+bool TraceSpillQueue::PeekFront(Record* record)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    while (!pending_.empty()) {
+        const PendingEntry entry = pending_.front();
+        char header[kRecordHeaderSize] = {};
+        std::string payload(entry.payload_size, '\0');
+        if (!PreadAll(fd_, header, sizeof(header), entry.offset) ||
+            !PreadAll(fd_, payload.data(), payload.size(), entry.offset + kRecordHeaderSize)) {
+            return false;
+        }
+
+        *record = Record{};
+        record->kind = static_cast<RecordKind>(header[1]);
+        uint16_t version = kPayloadVersionLegacy;
+        std::memcpy(&version, header + 2, sizeof(version));
+        PayloadReader in(payload.data(), payload.size());
+        uint32_t count = 0;
+        bool ok = false;
+        if (record->kind == RecordKind::PrimaryBatch) {
+            ok = in.GetRaw(&count);
+            record->summaries.resize(ok ? count : 0);
+            for (size_t i = 0; ok && i < record->summaries.size(); ++i) {
+                ok = DecodeSummary(&in, version, &record->summaries[i]);
+            }
+            ok = ok && in.GetRaw(&count);
+            record->spans.resize(ok ? count : 0);
+            for (size_t i = 0; ok && i < record->spans.size(); ++i) {
+                ok = DecodeSpan(&in, &record->spans[i]);
+            }
+        } else if (record->kind == RecordKind::AnalysisBatch) {
+            ok = in.GetRaw(&count);
+            record->analyses.resize(ok ? count : 0);
+            for (size_t i = 0; ok && i < record->analyses.size(); ++i) {
+                ok = DecodeAnalysis(&in, version, &record->analyses[i]);
+            }
+        }
+        if (ok && in.Done()) {
+            return true;
+        }
+        // 校验过了但解不出来，只可能是不认识的记录类型或者编码版本不一致；留着它只会永远卡住队头，直接跳过。
+        pending_bytes_ -= kRecordHeaderSize + entry.payload_size;
+        pending_.pop_front();
+    }
+    return false;
+}
+
+void TraceSpillQueue::PopFront()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (pending_.empty()) {
+        return;
+    }
+    const PendingEntry entry = pending_.front();
+    pending_.pop_front();
+    pending_bytes_ -= kRecordHeaderSize + entry.payload_size;
+
+    if (pending_.empty()) {
+        // 队列清空就整体截断回文件头，文件不会因为长期小批量溢出而一直变大。
+        if (::ftruncate(fd_, sizeof(kFileMagic)) == 0 && ::fdatasync(fd_) == 0) {
+            end_offset_ = sizeof(kFileMagic);
+            return;
+        }
+    }
+    // 只改状态字节。这里即使没刷下去，重启后也只是把这条记录再回放一次，由上层按“写不进去就放弃”兜底。
+    const char consumed = static_cast<char>(kRecordConsumed);
+    if (PwriteAll(fd_, &consumed, 1, entry.offset)) {
+        (void)::fdatasync(fd_);
+    }
+}
+
+size_t TraceSpillQueue::PendingRecords() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return pending_.size();
+}
+
+uint64_t TraceSpillQueue::PendingBytes() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return pending_bytes_;
+}
+
+} // namespace persistence
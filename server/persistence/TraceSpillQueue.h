@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "persistence/TraceTypes.h"
+
+namespace persistence {
+
+// TraceSpillQueue 是 BufferedTraceRepository 的落盘兜底：SQLite 写失败（SQLITE_BUSY、磁盘满、长 checkpoint）时，
+// 整批 primary / analysis 原样序列化追加到一个只追加的溢出文件里，等 sink 恢复后再按写入顺序回放。
+// 文件格式刻意做得很简单：
+// 1) 文件头 8 字节魔数；
+// 2) 每条记录 = 12 字节记录头（状态、类型、payload 版本、payload 长度、payload 的 FNV-1a 校验）+ payload；
+// 3) 回放成功的记录只把状态字节原地改成“已消费”，不搬动后面的数据；队列清空时整体截断回文件头。
+// 进程重启时从头扫一遍，把没消费的记录重新排进队列，所以崩溃前溢出的批次也不会丢；
+// 尾部半截记录（写到一半掉电）长度或校验对不上，直接截掉。
+// 整数按本机字节序写入，溢出文件只在本机回放，不作为跨机器交换格式。
+// 追加和出队都会 fdatasync：只有写失败时才走这条路径，频率很低，宁可慢一点也要真正落盘。
+class TraceSpillQueue
+{
+public:
+    enum class RecordKind : uint8_t
+    {
+        PrimaryBatch = 1,
+        AnalysisBatch = 2
+    };
+
+    struct Record
+    {
+        RecordKind kind = RecordKind::PrimaryBatch;
+        std::vector<TraceSummary> summaries;
+        std::vector<TraceSpanRecord> spans;
+        std::vector<TraceAnalysisRecord> analyses;
+    };
+
+    // max_bytes 是溢出文件的大小上限，超过后 Append 直接返回 false，避免磁盘长时间不可写时把盘再写满一次。
+    // 打不开或者文件头不对时抛 std::runtime_error，和 SqliteTraceRepository 打不开库的处理方式一致。
+    TraceSpillQueue(std::string path, uint64_t max_bytes);
+    ~TraceSpillQueue();
+
+    TraceSpillQueue(const TraceSpillQueue&) = delete;
+    TraceSpillQueue& operator=(const TraceSpillQueue&) = delete;
+
+    bool AppendPrimary(const std::vector<TraceSummary>& summaries, const std::vector<TraceSpanRecord>& spans);
+    bool AppendAnalysis(const std::vector<TraceAnalysisRecord>& analyses);
+    // 读出队头但不出队；回放成功（或者确认这条记录永远写不进去）以后再调 PopFront。
+    bool PeekFront(Record* record);
+    void PopFront();
+
+    size_t PendingRecords() const;
+    uint64_t PendingBytes() const;
+    const std::string& path() const { return path_; }
+
+private:
+    struct PendingEntry
+    {
+        uint64_t offset = 0;
+        uint32_t payload_size = 0;
+    };
+
+    bool AppendLocked(RecordKind kind, const std::string& payload);
+    void LoadExistingLocked();
+
+    std::string path_;
+    uint64_t max_bytes_ = 0;
+    int fd_ = -1;
+    mutable std::mutex mutex_;
+    std::deque<PendingEntry> pending_;
+    uint64_t end_offset_ = 0;
+    uint64_t pending_bytes_ = 0;
+};
+
+} // namespace persistence
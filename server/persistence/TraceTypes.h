@@ -24,6 +24,9 @@ struct TraceSummary
     // ai_error 只保留原始异常摘要，不负责前端展示文案。
     // 真正的人话提示由前端根据 ai_status 自己映射，避免数据库里反复存一堆重复文案。
     std::string ai_error;
+    // replayed 标记这条 trace 来自入口 WAL 的启动重放：崩溃前它可能已经落过库，
+    // 只有带这个标记的行在主键冲突时跳过，普通写入遇到冲突照旧让整批失败。这一列不进库。
+    bool replayed = false;
 };
 
 struct TraceSpanRecord
@@ -47,5 +50,11 @@ struct TraceAnalysisRecord
     std::string root_cause;
     std::string solution;
     double confidence = 0.0;
+    // analysis 落库时要同步回写到 trace_summary.ai_status 的终态。
+    // 绝大多数是 completed；结构指纹缓存命中时是 completed_cache，列表页据此区分“模型真算过”还是“复用了同形 trace 的结果”。
+    // 这一列只回写 summary，不进 trace_analysis 表。
+    std::string ai_status = "completed";
+    // 跟着 trace 的 summary.replayed 走：重放出来的 trace 已有分析结果时保留原来那条。这一列不进库。
+    bool replayed = false;
 };
 } // namespace persistence
@@ -19,6 +19,7 @@
 #include "handlers/ConfigHandler.h"
 #include "core/ServiceRuntimeAccumulator.h"
 #include "core/SystemRuntimeAccumulator.h"
+#include "core/TraceIngestWal.h"
 #include "core/TraceRetentionService.h"
 #include "core/TraceSessionManager.h"
 #include "util/DevSubprocessManager.h"
@@ -26,6 +27,7 @@
 #include <chrono>
 #include <csignal>
 #include <optional>
+#include <thread>
 #include <vector>
 
 namespace {
@@ -68,6 +70,27 @@ std::string NormalizeWebhookThreshold(std::string threshold)
     return ToLowerCopy(std::move(threshold));
 }
 
+// 解析 "name=value" 形式的可重复参数，value 必须是 >= 0 的整数。
+bool ParseNamedNonNegativeInt(const std::string& spec, std::string* name, int* value)
+{
+    const size_t eq = spec.rfind('=');
+    if (eq == std::string::npos || eq == 0 || eq + 1 >= spec.size()) {
+        return false;
+    }
+    try {
+        size_t consumed = 0;
+        const int parsed = std::stoi(spec.substr(eq + 1), &consumed);
+        if (consumed != spec.size() - eq - 1 || parsed < 0) {
+            return false;
+        }
+        *name = spec.substr(0, eq);
+        *value = parsed;
+        return true;
+    } catch (const std::exception&) {
+        return false;
+    }
+}
+
 std::vector<WebhookChannel> BuildWebhookChannelsFromSettings(const std::vector<AlertChannel>& alert_channels)
 {
     std::vector<WebhookChannel> channels;
@@ -124,12 +147,57 @@ int main(int argc, char* argv[])
     bool trace_idle_timeout_explicit = false;
     int worker_threads_override = -1;
     int worker_queue_size = 10000;
+    // Trace 查询线程数，同时也是 SQLite 只读连接池的大小：每条查询线程固定能借到一条只读连接。
+    int query_threads = 2;
+    // Trace 存储分区：none 是单个 SQLite 文件；hour/day 按 trace 起始时间写进按时间切开的分区文件，retention 整文件删除。
+    std::string trace_partition = "none";
+    // worker/query 线程池的调度模式：shared 是原来的单锁共享队列，stealing 是每 worker 无锁队列 + 偷任务。
+    std::string worker_pool_mode = "shared";
+    // IO 线程数和 TraceSessionManager 分片数都是冷启动参数，只开 CLI，不进 Settings。
+    // 默认仍是 1 条 IO 线程；分片数默认 0 表示“按 IO 线程数自动推导”。
+    int io_threads = 1;
+    int trace_session_shards = 0;
+    // 分发完的 TraceSession 回收复用的空闲上限；0 表示不回收，每条 trace 都重新分配。
+    int trace_session_pool_size = 256;
+    // 尾部采样：健康 trace 的默认保留百分比，100 表示不采样；--trace-sample-service svc=percent 按根服务覆盖。
+    // 含错误 span 的 trace 总是保留；任一 span 超过 --trace-slow-span-ms（或 --trace-slow-operation op=ms 指定的阈值）也保留。
+    int trace_sample_healthy_percent = 100;
+    std::vector<std::string> trace_sample_service_specs;
+    int trace_slow_span_ms = 1000;
+    std::vector<std::string> trace_slow_operation_specs;
+    // HTTP 零拷贝解析同样是冷启动开关：打开后请求行/头/体都以 view 指向连接 Buffer，
+    // 默认先关着，压测时用 --http-zero-copy 1 和旧路径对比。
+    int http_zero_copy = 0;
+    // 异步 AI 派发同样是冷启动开关：打开后 worker 只发起请求，模型延迟由 provider 自己的 curl-multi loop 承担，
+    // AI 并发不再等于 worker 线程数；max_inflight 是同时挂在 loop 上的请求上限，超出的在客户端内部排队。
+    int trace_ai_async = 0;
+    int trace_ai_async_max_inflight = 256;
+    // 攒批同样是冷启动开关：max_traces <= 1 时完全不攒批；打开后 linger 窗口内的多条 trace
+    // 合成一次 proxy 请求，省掉的是每条 trace 重复发送的 prompt 和一次网络往返。
+    int trace_ai_batch_max_traces = 0;
+    int trace_ai_batch_max_tokens = 32000;
+    int trace_ai_batch_linger_ms = 20;
+    // 结构指纹缓存：capacity>0 时同形 trace（调用树、状态、耗时量级都一样）复用已有的 AI 结论，
+    // 同指纹的并发调用合并成一次。默认关闭，ttl 控制一条结论最多复用多久。
+    int trace_ai_cache_capacity = 0;
+    int trace_ai_cache_ttl_ms = 600000;
     int trace_capacity = 100;
     bool trace_capacity_explicit = false;
     int trace_token_limit = 0;
     bool trace_token_limit_explicit = false;
     int trace_max_dispatch_per_tick = 64;
     int trace_buffered_span_limit = 4096;
+    // 聚合态 span 内容的字节预算（MiB）；和 span 数水位一起参与背压，挡住少量大 attribute span 撑爆内存。
+    int trace_buffered_bytes_limit_mb = 256;
+    // BufferedTraceRepository 里待刷 SQLite 数据的字节上限（MiB）；磁盘卡住时超过它就让主数据回退到聚合态重试，
+    // 同时按 wm_buffered_bytes 的百分比把持久化滞后推到入口 503。
+    int trace_pending_flush_limit_mb = 64;
+    // SQLite 写失败批次的溢出文件上限（MiB），文件固定放在 <db>.spill；0 表示不落盘，失败批次直接丢弃。
+    int trace_spill_limit_mb = 256;
+    // 入口 WAL 的 group commit 间隔（毫秒），WAL 段放在 <db>.ingest-wal/ 目录；0 表示不开 WAL，span 落库前只活在内存里。
+    int trace_wal_sync_ms = 0;
+    // 入口 WAL 单个段文件的大小上限（MiB）。
+    int trace_wal_segment_mb = 64;
     int trace_active_session_limit = 1024;
     int service_monitor_window_minutes = 30;
     int service_monitor_bucket_seconds = 3;
@@ -172,8 +240,45 @@ int main(int argc, char* argv[])
             trace_idle_timeout_explicit = true;
         } else if (arg == "--worker-threads" && i + 1 < argc) {
             worker_threads_override = std::stoi(argv[++i]);
+        } else if (arg == "--query-threads" && i + 1 < argc) {
+            query_threads = std::stoi(argv[++i]);
+        } else if (arg == "--trace-partition" && i + 1 < argc) {
+            trace_partition = argv[++i];
         } else if (arg == "--worker-queue-size" && i + 1 < argc) {
             worker_queue_size = std::stoi(argv[++i]);
+        } else if (arg == "--worker-pool-mode" && i + 1 < argc) {
+            worker_pool_mode = argv[++i];
+        } else if (arg == "--io-threads" && i + 1 < argc) {
+            io_threads = std::stoi(argv[++i]);
+        } else if (arg == "--trace-session-shards" && i + 1 < argc) {
+            // 分片只决定 manager 内部拆几把锁，不影响任何单 trace 语义；压测时可以和 --io-threads 一起扫。
+            trace_session_shards = std::stoi(argv[++i]);
+        } else if (arg == "--trace-session-pool-size" && i + 1 < argc) {
+            trace_session_pool_size = std::stoi(argv[++i]);
+        } else if (arg == "--trace-sample-healthy-percent" && i + 1 < argc) {
+            trace_sample_healthy_percent = std::stoi(argv[++i]);
+        } else if (arg == "--trace-sample-service" && i + 1 < argc) {
+            trace_sample_service_specs.push_back(argv[++i]);
+        } else if (arg == "--trace-slow-span-ms" && i + 1 < argc) {
+            trace_slow_span_ms = std::stoi(argv[++i]);
+        } else if (arg == "--trace-slow-operation" && i + 1 < argc) {
+            trace_slow_operation_specs.push_back(argv[++i]);
+        } else if (arg == "--http-zero-copy" && i + 1 < argc) {
+            http_zero_copy = std::stoi(argv[++i]);
+        } else if (arg == "--trace-ai-async" && i + 1 < argc) {
+            trace_ai_async = std::stoi(argv[++i]);
+        } else if (arg == "--trace-ai-async-max-inflight" && i + 1 < argc) {
+            trace_ai_async_max_inflight = std::stoi(argv[++i]);
+        } else if (arg == "--trace-ai-batch-max-traces" && i + 1 < argc) {
+            trace_ai_batch_max_traces = std::stoi(argv[++i]);
+        } else if (arg == "--trace-ai-batch-max-tokens" && i + 1 < argc) {
+            trace_ai_batch_max_tokens = std::stoi(argv[++i]);
+        } else if (arg == "--trace-ai-batch-linger-ms" && i + 1 < argc) {
+            trace_ai_batch_linger_ms = std::stoi(argv[++i]);
+        } else if (arg == "--trace-ai-cache-capacity" && i + 1 < argc) {
+            trace_ai_cache_capacity = std::stoi(argv[++i]);
+        } else if (arg == "--trace-ai-cache-ttl-ms" && i + 1 < argc) {
+            trace_ai_cache_ttl_ms = std::stoi(argv[++i]);
         } else if (arg == "--trace-capacity" && i + 1 < argc) {
             trace_capacity = std::stoi(argv[++i]);
             trace_capacity_explicit = true;
@@ -184,6 +289,16 @@ int main(int argc, char* argv[])
             trace_max_dispatch_per_tick = std::stoi(argv[++i]);
         } else if (arg == "--trace-buffered-span-limit" && i + 1 < argc) {
             trace_buffered_span_limit = std::stoi(argv[++i]);
+        } else if (arg == "--trace-buffered-bytes-limit-mb" && i + 1 < argc) {
+            trace_buffered_bytes_limit_mb = std::stoi(argv[++i]);
+        } else if (arg == "--trace-pending-flush-limit-mb" && i + 1 < argc) {
+            trace_pending_flush_limit_mb = std::stoi(argv[++i]);
+        } else if (arg == "--trace-spill-limit-mb" && i + 1 < argc) {
+            trace_spill_limit_mb = std::stoi(argv[++i]);
+        } else if (arg == "--trace-wal-sync-ms" && i + 1 < argc) {
+            trace_wal_sync_ms = std::stoi(argv[++i]);
+        } else if (arg == "--trace-wal-segment-mb" && i + 1 < argc) {
+            trace_wal_segment_mb = std::stoi(argv[++i]);
         } else if (arg == "--trace-active-session-limit" && i + 1 < argc) {
             trace_active_session_limit = std::stoi(argv[++i]);
         } else if (arg == "--service-monitor-window-minutes" && i + 1 < argc) {
@@ -218,10 +333,96 @@ int main(int argc, char* argv[])
         std::cerr << "Fatal Error: --worker-threads must be > 0 or omitted" << std::endl;
         return -1;
     }
+    if (query_threads <= 0) {
+        std::cerr << "Fatal Error: --query-threads must be > 0" << std::endl;
+        return -1;
+    }
+    if (trace_partition != "none" && trace_partition != "hour" && trace_partition != "day") {
+        std::cerr << "Fatal Error: --trace-partition must be none, hour or day" << std::endl;
+        return -1;
+    }
+    const TracePartitionMode trace_partition_mode =
+        trace_partition == "hour" ? TracePartitionMode::Hour
+                                  : (trace_partition == "day" ? TracePartitionMode::Day : TracePartitionMode::None);
+    if (io_threads <= 0) {
+        std::cerr << "Fatal Error: --io-threads must be > 0" << std::endl;
+        return -1;
+    }
+    if (trace_session_shards < 0) {
+        std::cerr << "Fatal Error: --trace-session-shards must be >= 0" << std::endl;
+        return -1;
+    }
+    if (trace_session_pool_size < 0) {
+        std::cerr << "Fatal Error: --trace-session-pool-size must be >= 0" << std::endl;
+        return -1;
+    }
+    if (trace_sample_healthy_percent < 0 || trace_sample_healthy_percent > 100) {
+        std::cerr << "Fatal Error: --trace-sample-healthy-percent must be in [0, 100]" << std::endl;
+        return -1;
+    }
+    if (trace_slow_span_ms < 0) {
+        std::cerr << "Fatal Error: --trace-slow-span-ms must be >= 0" << std::endl;
+        return -1;
+    }
+    TraceSamplingPolicy trace_sampling_policy;
+    trace_sampling_policy.healthy_keep_ratio = trace_sample_healthy_percent / 100.0;
+    trace_sampling_policy.slow_span_threshold_ms = trace_slow_span_ms;
+    for (const auto& spec : trace_sample_service_specs) {
+        std::string service_name;
+        int percent = 0;
+        if (!ParseNamedNonNegativeInt(spec, &service_name, &percent) || percent > 100) {
+            std::cerr << "Fatal Error: --trace-sample-service expects service=percent with percent in [0, 100]" << std::endl;
+            return -1;
+        }
+        trace_sampling_policy.service_keep_ratio[service_name] = percent / 100.0;
+    }
+    for (const auto& spec : trace_slow_operation_specs) {
+        std::string operation_name;
+        int threshold_ms = 0;
+        if (!ParseNamedNonNegativeInt(spec, &operation_name, &threshold_ms)) {
+            std::cerr << "Fatal Error: --trace-slow-operation expects operation=ms with ms >= 0" << std::endl;
+            return -1;
+        }
+        trace_sampling_policy.operation_slow_threshold_ms[operation_name] = threshold_ms;
+    }
+    if (http_zero_copy != 0 && http_zero_copy != 1) {
+        std::cerr << "Fatal Error: --http-zero-copy must be 0 or 1" << std::endl;
+        return -1;
+    }
     if (worker_queue_size <= 0) {
         std::cerr << "Fatal Error: --worker-queue-size must be > 0" << std::endl;
         return -1;
     }
+    if (trace_ai_async_max_inflight <= 0) {
+        std::cerr << "Fatal Error: --trace-ai-async-max-inflight must be > 0" << std::endl;
+        return -1;
+    }
+    if (trace_ai_batch_max_traces < 0) {
+        std::cerr << "Fatal Error: --trace-ai-batch-max-traces must be >= 0" << std::endl;
+        return -1;
+    }
+    if (trace_ai_batch_max_tokens <= 0) {
+        std::cerr << "Fatal Error: --trace-ai-batch-max-tokens must be > 0" << std::endl;
+        return -1;
+    }
+    if (trace_ai_batch_linger_ms < 0) {
+        std::cerr << "Fatal Error: --trace-ai-batch-linger-ms must be >= 0" << std::endl;
+        return -1;
+    }
+    if (trace_ai_cache_capacity < 0) {
+        std::cerr << "Fatal Error: --trace-ai-cache-capacity must be >= 0" << std::endl;
+        return -1;
+    }
+    if (trace_ai_cache_ttl_ms < 0) {
+        std::cerr << "Fatal Error: --trace-ai-cache-ttl-ms must be >= 0" << std::endl;
+        return -1;
+    }
+    if (worker_pool_mode != "shared" && worker_pool_mode != "stealing") {
+        std::cerr << "Fatal Error: --worker-pool-mode must be shared or stealing" << std::endl;
+        return -1;
+    }
+    const ThreadPool::Mode thread_pool_mode =
+        worker_pool_mode == "stealing" ? ThreadPool::Mode::kWorkStealing : ThreadPool::Mode::kSharedQueue;
     if (trace_capacity <= 0) {
         std::cerr << "Fatal Error: --trace-capacity must be > 0" << std::endl;
         return -1;
@@ -238,6 +439,26 @@ int main(int argc, char* argv[])
         std::cerr << "Fatal Error: --trace-buffered-span-limit must be > 0" << std::endl;
         return -1;
     }
+    if (trace_buffered_bytes_limit_mb <= 0) {
+        std::cerr << "Fatal Error: --trace-buffered-bytes-limit-mb must be > 0" << std::endl;
+        return -1;
+    }
+    if (trace_pending_flush_limit_mb <= 0) {
+        std::cerr << "Fatal Error: --trace-pending-flush-limit-mb must be > 0" << std::endl;
+        return -1;
+    }
+    if (trace_spill_limit_mb < 0) {
+        std::cerr << "Fatal Error: --trace-spill-limit-mb must be >= 0" << std::endl;
+        return -1;
+    }
+    if (trace_wal_sync_ms < 0) {
+        std::cerr << "Fatal Error: --trace-wal-sync-ms must be >= 0" << std::endl;
+        return -1;
+    }
+    if (trace_wal_segment_mb <= 0) {
+        std::cerr << "Fatal Error: --trace-wal-segment-mb must be > 0" << std::endl;
+        return -1;
+    }
     if (trace_active_session_limit <= 0) {
         std::cerr << "Fatal Error: --trace-active-session-limit must be > 0" << std::endl;
         return -1;
@@ -374,6 +595,10 @@ int main(int argc, char* argv[])
         startup_app_config.wm_buffered_spans_overload;
     const int effective_wm_buffered_spans_critical =
         startup_app_config.wm_buffered_spans_critical;
+    const int effective_wm_buffered_bytes_overload =
+        startup_app_config.wm_buffered_bytes_overload;
+    const int effective_wm_buffered_bytes_critical =
+        startup_app_config.wm_buffered_bytes_critical;
     const int effective_wm_pending_tasks_overload =
         startup_app_config.wm_pending_tasks_overload;
     const int effective_wm_pending_tasks_critical =
@@ -427,6 +652,12 @@ int main(int argc, char* argv[])
         std::cerr << "Fatal Error: buffered spans watermark percentages are invalid" << std::endl;
         return -1;
     }
+    if (effective_wm_buffered_bytes_overload <= 0 || effective_wm_buffered_bytes_overload > 100 ||
+        effective_wm_buffered_bytes_critical < effective_wm_buffered_bytes_overload ||
+        effective_wm_buffered_bytes_critical > 100) {
+        std::cerr << "Fatal Error: buffered bytes watermark percentages are invalid" << std::endl;
+        return -1;
+    }
     if (effective_wm_pending_tasks_overload <= 0 || effective_wm_pending_tasks_overload > 100 ||
         effective_wm_pending_tasks_critical < effective_wm_pending_tasks_overload ||
         effective_wm_pending_tasks_critical > 100) {
@@ -469,15 +700,41 @@ int main(int argc, char* argv[])
         }
     }
 
+    const int num_io_threads = io_threads; // 明确 I/O 线程数量
+    // 分片数默认取 IO 线程数的 4 倍：多条 IO 线程同时 Push 时，落到同一 shard 的概率足够低，
+    // 而 sweep 每轮多扫几个空 shard 的成本可以忽略。
+    const int num_trace_session_shards =
+        trace_session_shards > 0 ? trace_session_shards : num_io_threads * 4;
+
     std::shared_ptr<SqliteTraceRepository> trace_repo;
-    std::shared_ptr<SqliteTraceRepository> trace_read_repo;
     std::shared_ptr<BufferedTraceRepository> buffered_trace_repo;
+    std::shared_ptr<TraceIngestWal> ingest_wal;
     try
     {
-        trace_repo = std::make_shared<SqliteTraceRepository>(db_path);
-        trace_read_repo = std::make_shared<SqliteTraceRepository>(db_path);
+        // 写连接只给 flush 线程和 retention 用；查询走 repo 内部的只读连接池，池大小和查询线程数对齐，
+        // 所以不再额外开一个“读用 repo 实例”来躲开写连接上的互斥。
+        trace_repo = std::make_shared<SqliteTraceRepository>(db_path, static_cast<size_t>(query_threads), trace_partition_mode);
         // Trace 主数据和分析结果现在都先走双缓冲写入器，再由后台 flush 线程批量落到 SQLite。
-        buffered_trace_repo = std::make_shared<BufferedTraceRepository>(trace_repo);
+        BufferedTraceRepository::Config buffer_config;
+        buffer_config.max_pending_flush_bytes = static_cast<size_t>(trace_pending_flush_limit_mb) * 1024 * 1024;
+        if (trace_spill_limit_mb > 0) {
+            buffer_config.spill_path = db_path + ".spill";
+            buffer_config.max_spill_bytes = static_cast<uint64_t>(trace_spill_limit_mb) * 1024 * 1024;
+        }
+        if (trace_wal_sync_ms > 0) {
+            TraceIngestWal::Options wal_options;
+            wal_options.dir = db_path + ".ingest-wal";
+            wal_options.segment_bytes = static_cast<uint64_t>(trace_wal_segment_mb) * 1024 * 1024;
+            wal_options.sync_interval_ms = trace_wal_sync_ms;
+            // WAL 条带和 session shard 一一对应：同一 shard 上的 IO 线程才会争同一把条带锁。
+            wal_options.stripes = static_cast<size_t>(num_trace_session_shards);
+            ingest_wal = std::make_shared<TraceIngestWal>(wal_options);
+            // 回调按值持有 WAL：事件循环里的定时器也拷着 buffered_trace_repo，它的 flush 线程可能比这里的局部变量活得久。
+            buffer_config.on_primary_flushed = [ingest_wal](const std::vector<TraceRepository::TraceSummary>& summaries) {
+                ingest_wal->ReleaseTraces(summaries);
+            };
+        }
+        buffered_trace_repo = std::make_shared<BufferedTraceRepository>(trace_repo, buffer_config);
     }
     catch (const std::exception &e)
     {
@@ -486,7 +743,6 @@ int main(int argc, char* argv[])
     }
 
     const int num_cpu_cores = std::thread::hardware_concurrency();
-    const int num_io_threads = 1; // 明确 I/O 线程数量
     const int default_worker_threads = num_cpu_cores > 1 ? num_cpu_cores - num_io_threads : 1;
     // worker 线程数和端口一样属于冷启动参数：
     // 既然线程池创建后不会在运行中自动扩缩，那么这里就只在启动时做一次“CLI > Settings > 默认值”的决策。
@@ -496,15 +752,18 @@ int main(int argc, char* argv[])
             : (startup_app_config.kernel_worker_threads > 0
                    ? startup_app_config.kernel_worker_threads
                    : default_worker_threads);
-    const int num_query_threads = 1;
+    const int num_query_threads = query_threads;
 
     std::cout << "System Info: " << num_cpu_cores << " cores detected." << std::endl;
     std::cout << "Thread Model: " << num_io_threads << " I/O threads, "
               << num_worker_threads << " worker threads, "
-              << num_query_threads << " query threads." << std::endl;
+              << num_query_threads << " query threads, "
+              << num_trace_session_shards << " trace session shards." << std::endl;
+    std::cout << "HTTP Parsing: " << (http_zero_copy ? "zero-copy" : "copy") << std::endl;
     MiniMuduo::net::EventLoop loop;
     MiniMuduo::net::InetAddress addr(effective_port);
     testServer server(&loop, addr, num_io_threads);
+    server.setZeroCopyParsing(http_zero_copy == 1);
     std::vector<WebhookChannel> webhook_channels =
         BuildWebhookChannelsFromSettings(startup_config_snapshot->channels);
     if (auto_start_webhook_mock) {
@@ -547,6 +806,11 @@ int main(int argc, char* argv[])
         options.prompt_template = effective_trace_prompt_template;
         options.model = effective_trace_ai_model;
         options.api_key = effective_trace_ai_api_key;
+        options.async_max_inflight = static_cast<size_t>(trace_ai_async_max_inflight);
+        // 只有主 provider 攒批；fallback 是主路失败后的兜底，本来就是零散的单条流量，攒批只会白加 linger 延迟。
+        options.batch_max_traces = static_cast<size_t>(trace_ai_batch_max_traces);
+        options.batch_max_tokens = static_cast<size_t>(trace_ai_batch_max_tokens);
+        options.batch_linger_ms = trace_ai_batch_linger_ms;
         trace_ai = CreateTraceAiProvider(options);
         if (effective_ai_auto_degrade) {
             TraceAiBackend fallback_backend = TraceAiBackend::Mock;
@@ -565,6 +829,7 @@ int main(int argc, char* argv[])
             fallback_options.prompt_template = effective_trace_prompt_template;
             fallback_options.model = effective_ai_fallback_model;
             fallback_options.api_key = effective_ai_fallback_api_key;
+            fallback_options.async_max_inflight = static_cast<size_t>(trace_ai_async_max_inflight);
             fallback_trace_ai = CreateTraceAiProvider(fallback_options);
         }
         std::cout << "Trace AI enabled via proxy. provider=" << effective_trace_ai_provider
@@ -577,6 +842,13 @@ int main(int argc, char* argv[])
                   << ", fallback_provider=" << effective_ai_fallback_provider
                   << ", fallback_model=" << effective_ai_fallback_model
                   << ", fallback_api_key=" << (effective_ai_fallback_api_key.empty() ? "<empty>" : "<configured>")
+                  << ", async=" << (trace_ai_async != 0 ? "true" : "false")
+                  << ", async_max_inflight=" << trace_ai_async_max_inflight
+                  << ", batch_max_traces=" << trace_ai_batch_max_traces
+                  << ", batch_max_tokens=" << trace_ai_batch_max_tokens
+                  << ", batch_linger_ms=" << trace_ai_batch_linger_ms
+                  << ", cache_capacity=" << trace_ai_cache_capacity
+                  << ", cache_ttl_ms=" << trace_ai_cache_ttl_ms
                   << std::endl;
     } else {
         // 这里区分的是“主链是否真的允许发起 AI 分析”，不是 trace 查询能力本身。
@@ -590,10 +862,10 @@ int main(int argc, char* argv[])
     // 线程池需要在 trace_ai/notifier 之前回收：
     // 既然 worker 任务里拿的是这些对象的裸指针，那么退出时必须先 join worker，
     // 再销毁依赖对象，否则就会在“任务还在跑、对象先析构”时踩悬空指针。
-    ThreadPool tpool(num_worker_threads, static_cast<size_t>(worker_queue_size));
+    ThreadPool tpool(num_worker_threads, static_cast<size_t>(worker_queue_size), thread_pool_mode);
     // Trace 读请求单独走查询线程池，避免前端查库任务和 AI/聚合任务抢同一条队列。
-    // 当前先固定 1 条查询线程，把“执行通道分离”先做出来，后面再按压测结果调整线程数。
-    ThreadPool query_tpool(static_cast<size_t>(num_query_threads), static_cast<size_t>(worker_queue_size));
+    // 查询线程各自借只读连接，WAL 下和 flush 写入互不阻塞，所以线程数可以按 --query-threads 放大。
+    ThreadPool query_tpool(static_cast<size_t>(num_query_threads), static_cast<size_t>(worker_queue_size), thread_pool_mode);
     TraceRetentionService::Config trace_retention_config;
     trace_retention_config.retention_days = effective_log_retention_days;
     trace_retention_config.batch_size = 500;
@@ -608,6 +880,7 @@ int main(int argc, char* argv[])
                   << ", batch_size=" << trace_retention_config.batch_size
                   << ", max_batches_per_run=" << trace_retention_config.max_batches_per_run
                   << ", cleanup_interval_ms=" << trace_retention_config.cleanup_interval_ms
+                  << ", trace_partition=" << trace_partition
                   << std::endl;
         // 启动后先异步清一轮旧数据，避免答辩或联调一打开就被历史过期 trace 污染。
         // 这里仍然只投递到 query_tpool，不在主线程直接删库，防止启动路径被 SQLite 清理阻塞。
@@ -649,7 +922,17 @@ int main(int argc, char* argv[])
         static_cast<size_t>(effective_ai_failure_threshold),
         effective_ai_cooldown_ms,
         fallback_trace_ai.get(),
-        effective_ai_auto_degrade);
+        effective_ai_auto_degrade,
+        static_cast<size_t>(num_trace_session_shards),
+        trace_ai_async != 0,
+        static_cast<size_t>(trace_ai_cache_capacity),
+        trace_ai_cache_ttl_ms,
+        static_cast<size_t>(trace_session_pool_size),
+        static_cast<size_t>(trace_buffered_bytes_limit_mb) * 1024 * 1024,
+        effective_wm_buffered_bytes_overload,
+        effective_wm_buffered_bytes_critical,
+        trace_sampling_policy,
+        ingest_wal.get());
     const double trace_sweep_interval_sec =
         static_cast<double>(effective_trace_sweep_interval_ms) / 1000.0;
     std::cout << "Trace session sweep enabled. sweep_interval_ms=" << effective_trace_sweep_interval_ms
@@ -661,6 +944,7 @@ int main(int argc, char* argv[])
               << ", trace_token_limit=" << effective_trace_token_limit
               << ", wm_active_sessions=" << effective_wm_active_sessions_overload << "/" << effective_wm_active_sessions_critical
               << ", wm_buffered_spans=" << effective_wm_buffered_spans_overload << "/" << effective_wm_buffered_spans_critical
+              << ", wm_buffered_bytes=" << effective_wm_buffered_bytes_overload << "/" << effective_wm_buffered_bytes_critical
               << ", wm_pending_tasks=" << effective_wm_pending_tasks_overload << "/" << effective_wm_pending_tasks_critical
               << ", ai_analysis_enabled=" << (effective_ai_analysis_enabled ? "true" : "false")
               << ", ai_auto_degrade=" << (effective_ai_auto_degrade ? "true" : "false")
@@ -668,8 +952,18 @@ int main(int argc, char* argv[])
               << ", ai_failure_threshold=" << effective_ai_failure_threshold
               << ", ai_cooldown_seconds=" << effective_ai_cooldown_seconds
               << ", buffered_span_limit=" << trace_buffered_span_limit
+              << ", buffered_bytes_limit_mb=" << trace_buffered_bytes_limit_mb
+              << ", pending_flush_limit_mb=" << trace_pending_flush_limit_mb
+              << ", spill_limit_mb=" << trace_spill_limit_mb
+              << ", wal_sync_ms=" << trace_wal_sync_ms
+              << ", wal_segment_mb=" << trace_wal_segment_mb
               << ", active_session_limit=" << trace_active_session_limit
-              << ", worker_queue_size=" << worker_queue_size << std::endl;
+              << ", session_pool_size=" << trace_session_pool_size
+              << ", sample_healthy_percent=" << trace_sample_healthy_percent
+              << ", sample_service_overrides=" << trace_sample_service_specs.size()
+              << ", slow_span_ms=" << trace_slow_span_ms
+              << ", worker_queue_size=" << worker_queue_size
+              << ", worker_pool_mode=" << worker_pool_mode << std::endl;
     std::cout << "Service monitor window enabled. window_minutes=" << service_monitor_window_minutes
               << ", bucket_seconds=" << service_monitor_bucket_seconds << std::endl;
     TraceSessionManager* trace_session_manager_raw = trace_session_manager.get();
@@ -683,6 +977,24 @@ int main(int argc, char* argv[])
             effective_trace_idle_timeout_ms,
             static_cast<size_t>(trace_max_dispatch_per_tick));
     });
+    std::thread wal_replay_thread;
+    if (ingest_wal) {
+        // 上次崩溃前收下、还没刷进 SQLite 的 span 重新 Push 一遍：它们会被记进本次启动的新段，
+        // 全部被收下、新段 fsync 成功之后旧段才删，中途再崩一次也不会丢。
+        // 重放放在后台线程里分块推：sweep 跑在事件循环上，聚合态满了要等 loop 转起来才腾得出空间，
+        // 在这里同步推的话被拒的 span 永远等不到重试机会。
+        wal_replay_thread = std::thread([ingest_wal, trace_session_manager_raw, effective_trace_sweep_interval_ms]() {
+            const TraceIngestWal::ReplayResult result = ingest_wal->ReplayRecovered(
+                *trace_session_manager_raw,
+                /*chunk_spans*/1024,
+                /*retry_delay_ms*/effective_trace_sweep_interval_ms,
+                []() { return g_shutdown_requested != 0; });
+            std::cout << "Trace ingest WAL replayed. recovered_spans=" << result.recovered_spans
+                      << ", accepted_spans=" << result.accepted_spans
+                      << ", retries=" << result.retries
+                      << ", segments_dropped=" << (result.segments_dropped ? "true" : "false") << std::endl;
+        });
+    }
     ServiceRuntimeAccumulator* service_runtime_accumulator_raw = service_runtime_accumulator.get();
     // 这里先把服务监控快照发布周期压到 1 秒，原因不是统计更“实时”了，
     // 而是答辩演示时不希望前端明明已经过了分钟封口点，却还要额外再等 5 秒才看到榜单变化。
@@ -710,7 +1022,7 @@ int main(int argc, char* argv[])
         trace_retention_service->TrySchedulePeriodicCleanup(now_ms);
     });
     bool shutdown_stats_logged = false;
-    loop.runEvery(0.1, [&loop, &shutdown_stats_logged, trace_session_manager_raw, buffered_trace_repo]() {
+    loop.runEvery(0.1, [&loop, &shutdown_stats_logged, trace_session_manager_raw, buffered_trace_repo, trace_repo, ingest_wal]() {
         // signal handler 里只能做极少的事情，所以这里只记录退出意图；
         // 真正的 quit 放回 EventLoop 线程执行，这样对象析构和埋点打印才会走完整。
         if (g_shutdown_requested != 0) {
@@ -720,13 +1032,18 @@ int main(int argc, char* argv[])
                           << trace_session_manager_raw->DescribeRuntimeStats() << std::endl;
                 std::clog << "[BufferedTraceRuntimeStats] "
                           << buffered_trace_repo->DescribeRuntimeStats() << std::endl;
+                std::clog << "[SqliteTraceRuntimeStats] "
+                          << trace_repo->DescribeRuntimeStats() << std::endl;
+                if (ingest_wal) {
+                    std::clog << "[IngestWalStats] " << ingest_wal->DescribeStats() << std::endl;
+                }
             }
             loop.quit();
         }
     });
     
     std::shared_ptr<Router> router = std::make_shared<Router>();
-    auto trace_query_handler = std::make_shared<TraceQueryHandler>(trace_read_repo, &query_tpool);
+    auto trace_query_handler = std::make_shared<TraceQueryHandler>(trace_repo, &query_tpool);
     auto service_monitor_handler = std::make_shared<ServiceMonitorHandler>(service_runtime_accumulator);
     // MVP5 这一步把主路由显式收口到“新 Trace 读写 + 运行态快照 + Settings”。
     // 旧日志分析链已经退出活代码和构造链，主程序不再保留半退役入口混在这里误导联调。
@@ -767,6 +1084,10 @@ int main(int argc, char* argv[])
     router->add("POST", "/logs/spans", [handler](const HttpRequest& req, HttpResponse* resp, const MiniMuduo::net::TcpConnectionPtr& conn) {
         handler->handleTracePost(req, resp, conn);
     });
+    // 批量入口和单条入口共用同一个 LogHandler：字段口径、trace_end 别名和系统监控埋点都保持一致。
+    router->add("POST", "/logs/spans:batch", [handler](const HttpRequest& req, HttpResponse* resp, const MiniMuduo::net::TcpConnectionPtr& conn) {
+        handler->handleTraceBatchPost(req, resp, conn);
+    });
     // /dashboard 这一刀正式切到 SystemRuntimeAccumulator 快照。
     // 这样系统监控页先吃到主链路埋点的真值，不再绕回 SQLite 旧 dashboard 统计。
     auto dashboard_handler = std::make_shared<DashboardHandler>(system_runtime_accumulator);
@@ -785,5 +1106,10 @@ int main(int argc, char* argv[])
     server.setHttpCallback(onRequest);
     server.start();
     loop.loop();
+    // 事件循环退出时 g_shutdown_requested 已经置位，重放线程会在当前这一块推完后停下；
+    // 必须在 manager 和 WAL 析构之前等它退出。
+    if (wal_replay_thread.joinable()) {
+        wal_replay_thread.join();
+    }
     return 0;
 }
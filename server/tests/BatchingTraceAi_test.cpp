@@ -0,0 +1,295 @@
+#include <gtest/gtest.h>
+
+#include "ai/BatchingTraceAi.h"
+#include "ai/TraceProxyProtocol.h"
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+// 记录所有调用并在调用线程里同步回调的假 provider。
+// 同步回调让测试不需要等 IO loop，断言时所有扇出都已经完成。
+class RecordingBatchTraceAi : public TraceAiProvider
+{
+public:
+    TraceAiResponse AnalyzeTrace(const std::string& trace_payload) override
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        single_payloads.push_back(trace_payload);
+        if (failing_single_payloads.count(trace_payload) > 0) {
+            throw std::runtime_error("single failed: " + trace_payload);
+        }
+        return MakeResponse("single:" + trace_payload);
+    }
+
+    bool SupportsBatch() const override
+    {
+        return true;
+    }
+
+    void AnalyzeTraceBatchAsync(const std::vector<TraceAiBatchItem>& items,
+                                TraceAiBatchCallback callback) override
+    {
+        TraceAiBatchResponse response;
+        bool fail = false;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            batches.push_back(items);
+            fail = fail_batches;
+            for (const TraceAiBatchItem& item : items) {
+                if (dropped_batch_payloads.count(item.trace_payload) > 0) {
+                    continue;
+                }
+                response.results.emplace(item.id, MakeResponse("batch:" + item.trace_payload));
+            }
+            response.usage = batch_usage;
+        }
+        // 回调在锁外调用：失败回退会重新进入 AnalyzeTrace 拿同一把锁。
+        if (fail) {
+            callback(TraceAiBatchResponse{},
+                     std::make_exception_ptr(std::runtime_error("Trace AI Proxy Error: HTTP 500")));
+            return;
+        }
+        callback(std::move(response), nullptr);
+    }
+
+    static TraceAiResponse MakeResponse(const std::string& summary)
+    {
+        TraceAiResponse response;
+        response.analysis.summary = summary;
+        response.analysis.risk_level = RiskLevel::INFO;
+        return response;
+    }
+
+    std::mutex mutex;
+    std::vector<std::vector<TraceAiBatchItem>> batches;
+    std::vector<std::string> single_payloads;
+    std::set<std::string> failing_single_payloads;
+    std::set<std::string> dropped_batch_payloads;
+    bool fail_batches = false;
+    std::optional<TraceAiUsage> batch_usage;
+};
+
+// done 最后写、用 release 发布：linger 路径的回调跑在 flusher 线程上，测试线程靠轮询 done 拿到完整结果。
+struct CallbackResult
+{
+    std::atomic<bool> done{false};
+    std::string summary;
+    std::optional<TraceAiUsage> usage;
+    std::string error;
+};
+
+TraceAiCallback Capture(CallbackResult* result)
+{
+    return [result](TraceAiResponse response, std::exception_ptr error) {
+        if (error) {
+            try {
+                std::rethrow_exception(error);
+            } catch (const std::exception& e) {
+                result->error = e.what();
+            }
+        } else {
+            result->summary = response.analysis.summary;
+            result->usage = response.usage;
+        }
+        result->done.store(true, std::memory_order_release);
+    };
+}
+
+bool WaitDone(const CallbackResult& result)
+{
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (!result.done.load(std::memory_order_acquire)) {
+        if (std::chrono::steady_clock::now() >= deadline) {
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    }
+    return true;
+}
+
+TraceAiBatchingOptions MakeOptions(size_t max_traces, size_t max_tokens, int linger_ms)
+{
+    TraceAiBatchingOptions options;
+    options.max_traces = max_traces;
+    options.max_tokens = max_tokens;
+    options.linger_ms = linger_ms;
+    return options;
+}
+} // namespace
+
+TEST(BatchingTraceAiTest, FullBatchIsSentAsOneRequestAndFannedOutById)
+{
+    auto inner = std::make_shared<RecordingBatchTraceAi>();
+    // linger 故意给得很长：批次只能因为凑满 max_traces 才发出，测的是“满批立即发”这条路径。
+    BatchingTraceAi batching(inner, MakeOptions(/*max_traces*/3, /*max_tokens*/100000, /*linger_ms*/60000));
+
+    CallbackResult first;
+    CallbackResult second;
+    CallbackResult third;
+    batching.AnalyzeTraceAsync("trace-a", Capture(&first));
+    batching.AnalyzeTraceAsync("trace-b", Capture(&second));
+    EXPECT_FALSE(first.done);
+    batching.AnalyzeTraceAsync("trace-c", Capture(&third));
+
+    ASSERT_EQ(inner->batches.size(), 1U);
+    ASSERT_EQ(inner->batches[0].size(), 3U);
+    EXPECT_TRUE(inner->single_payloads.empty());
+    // 每条回调拿到的必须是自己那条 trace 的结论，而不是按完成顺序乱配。
+    EXPECT_EQ(first.summary, "batch:trace-a");
+    EXPECT_EQ(second.summary, "batch:trace-b");
+    EXPECT_EQ(third.summary, "batch:trace-c");
+
+    const BatchingTraceAi::Stats stats = batching.GetStats();
+    EXPECT_EQ(stats.batches_sent, 1U);
+    EXPECT_EQ(stats.batched_traces, 3U);
+    EXPECT_EQ(stats.fallback_traces, 0U);
+}
+
+TEST(BatchingTraceAiTest, LingerExpiryFlushesPartialBatchAndLoneTraceUsesSingleCall)
+{
+    auto inner = std::make_shared<RecordingBatchTraceAi>();
+    BatchingTraceAi batching(inner, MakeOptions(/*max_traces*/8, /*max_tokens*/100000, /*linger_ms*/20));
+
+    CallbackResult first;
+    CallbackResult second;
+    batching.AnalyzeTraceAsync("trace-a", Capture(&first));
+    batching.AnalyzeTraceAsync("trace-b", Capture(&second));
+
+    ASSERT_TRUE(WaitDone(first));
+    ASSERT_TRUE(WaitDone(second));
+    EXPECT_EQ(batching.GetStats().batches_sent, 1U);
+    EXPECT_EQ(first.summary, "batch:trace-a");
+    EXPECT_EQ(second.summary, "batch:trace-b");
+
+    // 凑不成批时不套批量协议，直接走单条接口，单条 prompt 对单个 trace 更合适。
+    CallbackResult lone;
+    batching.AnalyzeTraceAsync("trace-lone", Capture(&lone));
+    ASSERT_TRUE(WaitDone(lone));
+    EXPECT_EQ(batching.GetStats().single_calls, 1U);
+    EXPECT_EQ(lone.summary, "single:trace-lone");
+    EXPECT_EQ(batching.GetStats().batches_sent, 1U);
+}
+
+TEST(BatchingTraceAiTest, BatchFailureFallsBackToSingleCallPerTrace)
+{
+    auto inner = std::make_shared<RecordingBatchTraceAi>();
+    inner->fail_batches = true;
+    inner->failing_single_payloads.insert("trace-bad");
+    BatchingTraceAi batching(inner, MakeOptions(/*max_traces*/2, /*max_tokens*/100000, /*linger_ms*/60000));
+
+    CallbackResult good;
+    CallbackResult bad;
+    batching.AnalyzeTraceAsync("trace-good", Capture(&good));
+    batching.AnalyzeTraceAsync("trace-bad", Capture(&bad));
+
+    // 整批失败后每条 trace 单独重试：好的 trace 不被同批的坏 trace 连累，
+    // 坏 trace 的失败原样交给调用方，后续 ai_status/熔断按单条语义处理。
+    ASSERT_EQ(inner->batches.size(), 1U);
+    EXPECT_EQ(inner->single_payloads.size(), 2U);
+    EXPECT_EQ(good.summary, "single:trace-good");
+    EXPECT_TRUE(good.error.empty());
+    EXPECT_EQ(bad.error, "single failed: trace-bad");
+    EXPECT_EQ(batching.GetStats().fallback_traces, 2U);
+}
+
+TEST(BatchingTraceAiTest, MissingBatchResultFallsBackOnlyForThatTraceAndUsageIsSplit)
+{
+    auto inner = std::make_shared<RecordingBatchTraceAi>();
+    inner->dropped_batch_payloads.insert("trace-missing");
+    TraceAiUsage usage;
+    usage.input_tokens = 101;
+    usage.output_tokens = 33;
+    usage.total_tokens = 134;
+    inner->batch_usage = usage;
+    BatchingTraceAi batching(inner, MakeOptions(/*max_traces*/3, /*max_tokens*/100000, /*linger_ms*/60000));
+
+    CallbackResult short_trace;
+    CallbackResult missing;
+    CallbackResult long_trace;
+    batching.AnalyzeTraceAsync("aa", Capture(&short_trace));
+    batching.AnalyzeTraceAsync("trace-missing", Capture(&missing));
+    batching.AnalyzeTraceAsync("aaaaaaaa", Capture(&long_trace));
+
+    ASSERT_EQ(inner->single_payloads.size(), 1U);
+    EXPECT_EQ(inner->single_payloads[0], "trace-missing");
+    EXPECT_EQ(missing.summary, "single:trace-missing");
+    EXPECT_FALSE(missing.usage.has_value());
+
+    // 整批 usage 只拆给真正拿到批量结果的 trace，且拆完加总严格等于 provider 报的总量。
+    ASSERT_TRUE(short_trace.usage.has_value());
+    ASSERT_TRUE(long_trace.usage.has_value());
+    EXPECT_EQ(short_trace.usage->total_tokens + long_trace.usage->total_tokens, 134U);
+    EXPECT_EQ(short_trace.usage->input_tokens + long_trace.usage->input_tokens, 101U);
+    EXPECT_LT(short_trace.usage->total_tokens, long_trace.usage->total_tokens);
+}
+
+TEST(BatchingTraceAiTest, TokenLimitClosesBatchBeforeItOverflows)
+{
+    auto inner = std::make_shared<RecordingBatchTraceAi>();
+    const std::string payload(40, 'x');
+    const size_t tokens = BatchingTraceAi::EstimateTokens(payload);
+    // token 上限刚好容纳两条：第三条到来时不能硬塞进去，前两条应该先整批发出。
+    BatchingTraceAi batching(inner, MakeOptions(/*max_traces*/8, /*max_tokens*/tokens * 2 + 1, /*linger_ms*/60000));
+
+    CallbackResult results[3];
+    for (CallbackResult& result : results) {
+        batching.AnalyzeTraceAsync(payload, Capture(&result));
+    }
+
+    ASSERT_EQ(inner->batches.size(), 1U);
+    EXPECT_EQ(inner->batches[0].size(), 2U);
+    EXPECT_TRUE(results[0].done);
+    EXPECT_TRUE(results[1].done);
+    EXPECT_FALSE(results[2].done);
+}
+
+TEST(BatchingTraceAiTest, SynchronousCallersOnDifferentThreadsShareOneBatch)
+{
+    auto inner = std::make_shared<RecordingBatchTraceAi>();
+    BatchingTraceAi batching(inner, MakeOptions(/*max_traces*/2, /*max_tokens*/100000, /*linger_ms*/60000));
+
+    std::string first_summary;
+    std::string second_summary;
+    std::thread first([&]() { first_summary = batching.AnalyzeTrace("trace-a").analysis.summary; });
+    std::thread second([&]() { second_summary = batching.AnalyzeTrace("trace-b").analysis.summary; });
+    first.join();
+    second.join();
+
+    ASSERT_EQ(inner->batches.size(), 1U);
+    EXPECT_EQ(first_summary, "batch:trace-a");
+    EXPECT_EQ(second_summary, "batch:trace-b");
+}
+
+TEST(BatchingTraceAiTest, ProxyBatchParserKeepsValidItemsAndDropsBrokenOnes)
+{
+    const std::string body = R"({
+        "ok": true,
+        "results": [
+            {"id": "0", "analysis": {"summary": "s0", "risk_level": "error", "root_cause": "r", "solution": "x"}},
+            {"id": "1", "analysis": {"summary": "s1", "risk_level": "not-a-level", "root_cause": "r", "solution": "x"}},
+            {"id": "2", "ok": false, "error_message": "refused"}
+        ],
+        "usage": {"input_tokens": 10, "output_tokens": 5}
+    })";
+
+    const TraceAiBatchResponse response = ParseTraceProxyBatchHttpResponseOrThrow(200, body);
+    ASSERT_EQ(response.results.size(), 1U);
+    EXPECT_EQ(response.results.at("0").analysis.summary, "s0");
+    ASSERT_TRUE(response.usage.has_value());
+    EXPECT_EQ(response.usage->total_tokens, 15U);
+
+    EXPECT_THROW(ParseTraceProxyBatchHttpResponseOrThrow(
+                     200, R"({"ok": false, "error_status": "RESOURCE_EXHAUSTED"})"),
+                 std::runtime_error);
+    EXPECT_THROW(ParseTraceProxyBatchHttpResponseOrThrow(502, "bad gateway"), std::runtime_error);
+}
@@ -30,6 +30,7 @@ TEST(DashboardHandlerTest, HandleGetStatsReturnsSystemRuntimeSnapshotJson)
                                                                   []() { return 128ULL * 1024ULL * 1024ULL; });
     accumulator->RecordAcceptedLogs(3);
     accumulator->RecordAiCallStarted();
+    accumulator->RecordAiCacheHit();
     accumulator->RecordAiCallCompleted(/*queue_wait_ms*/30,
                                        /*inference_latency_ms*/120,
                                        MakeUsage(9, 6, 15));
@@ -52,6 +53,7 @@ TEST(DashboardHandlerTest, HandleGetStatsReturnsSystemRuntimeSnapshotJson)
     const nlohmann::json body = nlohmann::json::parse(resp.body_);
     EXPECT_EQ(body.at("overview").at("total_logs"), 3);
     EXPECT_EQ(body.at("overview").at("ai_call_total"), 1);
+    EXPECT_EQ(body.at("overview").at("ai_cache_hit_total"), 1);
     EXPECT_EQ(body.at("overview").at("backpressure_status"), "Active");
     EXPECT_EQ(body.at("token_stats").at("total_tokens"), 15);
     ASSERT_TRUE(body.at("timeseries").is_array());
@@ -8,6 +8,7 @@
 #include "core/TraceSessionManager.h"
 #include "core/SystemRuntimeAccumulator.h"
 #include "handlers/LogHandler.h"
+#include "http/HttpContext.h"
 #include "persistence/BufferedTraceRepository.h"
 #include "persistence/TraceRepository.h"
 #include "threadpool/ThreadPool.h"
@@ -90,6 +91,28 @@ protected:
         return span;
     }
 
+    nlohmann::json MakeSpanJson(size_t trace_key, size_t span_id, bool trace_end = false)
+    {
+        return nlohmann::json{
+            {"trace_key", trace_key},
+            {"span_id", span_id},
+            {"start_time_ms", 1000},
+            {"name", "batch-span"},
+            {"service_name", "batch-service"},
+            {"trace_end", trace_end},
+        };
+    }
+
+    HttpRequest MakeBatchRequest(std::string body)
+    {
+        HttpRequest req;
+        req.method_ = "POST";
+        req.path_ = "/logs/spans:batch";
+        req.version_ = "HTTP/1.1";
+        req.body_ = std::move(body);
+        return req;
+    }
+
     nlohmann::json ParseBody(const HttpResponse& resp)
     {
         return nlohmann::json::parse(resp.body_);
@@ -207,6 +230,37 @@ TEST_F(LogHandlerTracePostTest, HandleTracePostReturns202WithoutDeferredBeforeSe
     pool.shutdown();
 }
 
+TEST_F(LogHandlerTracePostTest, HandleTracePostReadsBodyFromZeroCopyRequest)
+{
+    // 目的：锁定 handler 走 bodyView() 读请求体，零拷贝解析出来的请求（body_ 为空，只有指向 Buffer 的 view）
+    // 也能被正常受理，而且 handler 执行期间不会消费 Buffer。
+    ThreadPool pool(1, 0);
+    FakeTraceRepository repo;
+    auto buffered_repo = MakeBufferedTraceRepository(&repo);
+    TraceSessionManager manager(&pool, buffered_repo.get(), nullptr, /*capacity*/ 8, /*token_limit*/ 0);
+    LogHandler handler(&manager);
+
+    const std::string body = MakeTraceRequest(5, 501, false).body_;
+    MiniMuduo::net::Buffer buffer;
+    buffer.append("POST /logs/spans HTTP/1.1\r\nContent-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body);
+    HttpContext context;
+    context.setZeroCopy(true);
+    ASSERT_EQ(context.parseRequest(&buffer), HttpContext::ParseResult::kSuccess);
+    ASSERT_TRUE(context.request().body_.empty());
+    HttpResponse resp;
+
+    handler.handleTracePost(context.request(), &resp, nullptr);
+
+    ASSERT_EQ(resp.statusCode_, HttpResponse::HttpStatusCode::k202Acceptd);
+    const nlohmann::json response_body = ParseBody(resp);
+    EXPECT_EQ(response_body.at("trace_key"), 5);
+    EXPECT_EQ(response_body.at("span_id"), 501);
+    context.retrieveParsed(&buffer);
+    EXPECT_EQ(buffer.readableBytes(), 0u);
+
+    pool.shutdown();
+}
+
 TEST_F(LogHandlerTracePostTest, HandleTracePostRecordsAcceptedLogsIntoSystemRuntimeAccumulator)
 {
     // 目的：锁定 /logs/spans 只要被系统成功接住，就应该累计系统监控里的总处理日志数。
@@ -254,3 +308,168 @@ TEST_F(LogHandlerTracePostTest, HandleTracePostRecordsAcceptedLogsIntoSystemRunt
 
     pool.shutdown();
 }
+
+TEST_F(LogHandlerTracePostTest, HandleTraceBatchPostGroupsJsonArrayByTraceAndRecordsAcceptedLogs)
+{
+    // 目的：JSON 数组批量入口要把同一 trace 的多条 span 并进同一个 session，
+    // 并且按条数累计系统监控的入口日志数。
+    ThreadPool pool(1, 16);
+    FakeTraceRepository repo;
+    auto buffered_repo = MakeBufferedTraceRepository(&repo);
+    int64_t now_ms = 0;
+    SystemRuntimeAccumulator system_runtime_accumulator(/*latency_sample_limit*/4,
+                                                       /*series_limit*/8,
+                                                       [&now_ms]() { return now_ms; },
+                                                       []() { return 0ULL; });
+    TraceSessionManager manager(&pool, buffered_repo.get(), nullptr, /*capacity*/ 8, /*token_limit*/ 0);
+    LogHandler handler(&manager, &system_runtime_accumulator);
+
+    nlohmann::json batch = nlohmann::json::array({
+        MakeSpanJson(21, 1),
+        MakeSpanJson(22, 1),
+        MakeSpanJson(21, 2),
+        MakeSpanJson(21, 3),
+    });
+    HttpRequest req = MakeBatchRequest(batch.dump());
+    HttpResponse resp;
+    handler.handleTraceBatchPost(req, &resp, nullptr);
+
+    ASSERT_EQ(resp.statusCode_, HttpResponse::HttpStatusCode::k202Acceptd);
+    ASSERT_EQ(resp.headers_.at("Content-Type"), "application/json");
+    const nlohmann::json body = ParseBody(resp);
+    EXPECT_EQ(body.at("accepted_count"), 4);
+    EXPECT_EQ(body.at("rejected_count"), 0);
+    ASSERT_EQ(body.at("results").size(), 4u);
+    for (size_t i = 0; i < 4; ++i) {
+        EXPECT_EQ(body.at("results")[i].at("index"), i);
+        EXPECT_EQ(body.at("results")[i].at("accepted"), true);
+    }
+    EXPECT_EQ(body.at("results")[1].at("trace_key"), 22);
+    EXPECT_EQ(manager.size(), 2u);
+
+    now_ms = 1000;
+    system_runtime_accumulator.OnTick();
+    EXPECT_EQ(system_runtime_accumulator.BuildSnapshot().overview.total_logs, 4u);
+
+    pool.shutdown();
+}
+
+TEST_F(LogHandlerTracePostTest, HandleTraceBatchPostReportsPerLineErrorsForNdjson)
+{
+    // 目的：NDJSON 某一行坏掉时只拒绝这一行，其他行照常收下，并且结果按原始行序对齐。
+    ThreadPool pool(1, 16);
+    FakeTraceRepository repo;
+    auto buffered_repo = MakeBufferedTraceRepository(&repo);
+    TraceSessionManager manager(&pool, buffered_repo.get(), nullptr, /*capacity*/ 8, /*token_limit*/ 0);
+    LogHandler handler(&manager);
+
+    nlohmann::json missing_name = MakeSpanJson(32, 1);
+    missing_name.erase("name");
+    const std::string ndjson = MakeSpanJson(31, 1).dump() + "\n" +
+                               "{not json\n" +
+                               "\r\n" +
+                               missing_name.dump() + "\r\n" +
+                               MakeSpanJson(31, 2).dump();
+    HttpRequest req = MakeBatchRequest(ndjson);
+    HttpResponse resp;
+    handler.handleTraceBatchPost(req, &resp, nullptr);
+
+    ASSERT_EQ(resp.statusCode_, HttpResponse::HttpStatusCode::k202Acceptd);
+    const nlohmann::json body = ParseBody(resp);
+    EXPECT_EQ(body.at("accepted_count"), 2);
+    EXPECT_EQ(body.at("rejected_count"), 2);
+    const nlohmann::json& results = body.at("results");
+    ASSERT_EQ(results.size(), 4u);
+    EXPECT_EQ(results[0].at("accepted"), true);
+    EXPECT_EQ(results[1].at("accepted"), false);
+    EXPECT_EQ(results[1].at("retryable"), false);
+    EXPECT_EQ(results[1].at("error"), "Invalid JSON line");
+    EXPECT_EQ(results[2].at("error"), "Missing required field: name");
+    EXPECT_EQ(results[3].at("accepted"), true);
+    EXPECT_EQ(results[3].at("span_id"), 2);
+    EXPECT_EQ(manager.size(), 1u);
+
+    pool.shutdown();
+}
+
+TEST_F(LogHandlerTracePostTest, HandleTraceBatchPostMarksOverloadRejectionsRetryable)
+{
+    // 目的：部分过载时，老 trace 的 span 收下、新 trace 的 span 被标成 retryable，
+    // 调用方可以只按 index 重发被拒绝的子集。
+    ThreadPool pool(1, 16);
+    FakeTraceRepository repo;
+    auto buffered_repo = MakeBufferedTraceRepository(&repo);
+    TraceSessionManager manager(&pool,
+                                buffered_repo.get(),
+                                nullptr,
+                                /*capacity*/ 8,
+                                /*token_limit*/ 0,
+                                nullptr,
+                                /*idle_timeout_ms*/ 5000,
+                                /*wheel_tick_ms*/ 500,
+                                /*sealed_grace_window_ms*/ 1000,
+                                /*retry_base_delay_ms*/ 500,
+                                /*wheel_size*/ 64,
+                                /*buffered_span_hard_limit*/ 1024,
+                                /*active_session_hard_limit*/ 5,
+                                /*active_session_overload_percent*/ 60,
+                                /*active_session_critical_percent*/ 80,
+                                /*buffered_spans_overload_percent*/ 75,
+                                /*buffered_spans_critical_percent*/ 90,
+                                /*pending_tasks_overload_percent*/ 75,
+                                /*pending_tasks_critical_percent*/ 90);
+    LogHandler handler(&manager);
+
+    // 和单条过载用例一样先塞 3 条 collecting trace，把 active_sessions 推到 high=3。
+    ASSERT_EQ(manager.Push(MakeSpan(41, 1)), TraceSessionManager::PushResult::Accepted);
+    ASSERT_EQ(manager.Push(MakeSpan(42, 1)), TraceSessionManager::PushResult::Accepted);
+    ASSERT_EQ(manager.Push(MakeSpan(43, 1)), TraceSessionManager::PushResult::Accepted);
+
+    nlohmann::json batch = nlohmann::json::array({
+        MakeSpanJson(44, 1),
+        MakeSpanJson(41, 2),
+    });
+    HttpRequest req = MakeBatchRequest(batch.dump());
+    HttpResponse resp;
+    handler.handleTraceBatchPost(req, &resp, nullptr);
+
+    ASSERT_EQ(resp.statusCode_, HttpResponse::HttpStatusCode::k202Acceptd);
+    ASSERT_EQ(resp.headers_.at("Retry-After"), "1");
+    const nlohmann::json body = ParseBody(resp);
+    EXPECT_EQ(body.at("accepted_count"), 1);
+    EXPECT_EQ(body.at("rejected_count"), 1);
+    EXPECT_EQ(body.at("results")[0].at("accepted"), false);
+    EXPECT_EQ(body.at("results")[0].at("retryable"), true);
+    EXPECT_EQ(body.at("results")[0].at("error"), "Trace pipeline is overloaded");
+    EXPECT_EQ(body.at("results")[1].at("accepted"), true);
+
+    // 整批都被过载拒绝时退化成和单条入口一致的 503。
+    HttpRequest all_rejected = MakeBatchRequest(MakeSpanJson(45, 1).dump());
+    HttpResponse all_rejected_resp;
+    handler.handleTraceBatchPost(all_rejected, &all_rejected_resp, nullptr);
+    EXPECT_EQ(all_rejected_resp.statusCode_, HttpResponse::HttpStatusCode::k503ServiceUnavailable);
+    EXPECT_EQ(all_rejected_resp.headers_.at("Retry-After"), "1");
+
+    pool.shutdown();
+}
+
+TEST_F(LogHandlerTracePostTest, HandleTraceBatchPostRejectsEmptyAndMalformedArrayBodies)
+{
+    ThreadPool pool(1, 16);
+    FakeTraceRepository repo;
+    auto buffered_repo = MakeBufferedTraceRepository(&repo);
+    TraceSessionManager manager(&pool, buffered_repo.get(), nullptr, /*capacity*/ 8, /*token_limit*/ 0);
+    LogHandler handler(&manager);
+
+    HttpResponse empty_resp;
+    handler.handleTraceBatchPost(MakeBatchRequest("[]"), &empty_resp, nullptr);
+    EXPECT_EQ(empty_resp.statusCode_, HttpResponse::HttpStatusCode::k400BadRequest);
+    EXPECT_EQ(ParseBody(empty_resp).at("error"), "Batch must contain at least one span");
+
+    HttpResponse malformed_resp;
+    handler.handleTraceBatchPost(MakeBatchRequest("[{\"trace_key\": 1,"), &malformed_resp, nullptr);
+    EXPECT_EQ(malformed_resp.statusCode_, HttpResponse::HttpStatusCode::k400BadRequest);
+    EXPECT_EQ(ParseBody(malformed_resp).at("error"), "Invalid JSON body");
+
+    pool.shutdown();
+}
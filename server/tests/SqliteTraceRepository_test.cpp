@@ -1,7 +1,11 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <filesystem>
 #include <gtest/gtest.h>
 #include <optional>
 #include <sqlite3.h>
+#include <thread>
 #include "persistence/SqliteTraceRepository.h"
 
 class SqliteTraceRepositoryTest : public ::testing::Test
@@ -23,8 +27,12 @@ protected:
     }
 
     int QueryCount(const std::string& sql) {
+        return QueryCountAt(db_path, sql);
+    }
+
+    int QueryCountAt(const std::string& path, const std::string& sql) {
         sqlite3* db = nullptr;
-        int rc = sqlite3_open_v2(db_path.c_str(), &db, SQLITE_OPEN_READONLY, nullptr);
+        int rc = sqlite3_open_v2(path.c_str(), &db, SQLITE_OPEN_READONLY, nullptr);
         if (rc != SQLITE_OK) {
             if (db) {
                 sqlite3_close_v2(db);
@@ -169,10 +177,10 @@ protected:
 
 TEST_F(SqliteTraceRepositoryTest, SaveSingleTraceAtomicSummaryAndSpans)
 {
-    persistence::TraceSummary summary = MakeSummary("trace-1");
+    persistence::TraceSummary summary = MakeSummary("1");
     std::vector<persistence::TraceSpanRecord> spans;
-    spans.push_back(MakeSpan("trace-1", "span-1", ""));
-    spans.push_back(MakeSpan("trace-1", "span-2", "span-1"));
+    spans.push_back(MakeSpan("1", "1", ""));
+    spans.push_back(MakeSpan("1", "2", "1"));
 
     bool ok = repo->SaveSingleTraceAtomic(summary, spans, nullptr);
     EXPECT_TRUE(ok);
@@ -183,12 +191,12 @@ TEST_F(SqliteTraceRepositoryTest, SaveSingleTraceAtomicSummaryAndSpans)
 
 TEST_F(SqliteTraceRepositoryTest, SaveSingleTraceSummaryPersistsRow)
 {
-    persistence::TraceSummary summary = MakeSummary("single-summary-1");
+    persistence::TraceSummary summary = MakeSummary("114");
     bool ok = repo->SaveSingleTraceSummary(summary);
     EXPECT_TRUE(ok);
 
     EXPECT_EQ(QueryCount("SELECT COUNT(*) FROM trace_summary;"), 1);
-    auto row = QuerySummary("single-summary-1");
+    auto row = QuerySummary("114");
     ASSERT_TRUE(row.has_value());
     EXPECT_EQ(row->service_name, summary.service_name);
     EXPECT_EQ(row->duration_ms, summary.duration_ms);
@@ -199,12 +207,12 @@ TEST_F(SqliteTraceRepositoryTest, SaveSingleTraceSummaryPersistsRow)
 
 TEST_F(SqliteTraceRepositoryTest, SaveSingleTraceSpansPersistsRows)
 {
-    persistence::TraceSummary summary = MakeSummary("single-span-1");
+    persistence::TraceSummary summary = MakeSummary("112");
     ASSERT_TRUE(repo->SaveSingleTraceSummary(summary));
 
     std::vector<persistence::TraceSpanRecord> spans;
-    spans.push_back(MakeSpan("single-span-1", "span-1", ""));
-    spans.push_back(MakeSpan("single-span-1", "span-2", "span-1"));
+    spans.push_back(MakeSpan("112", "1", ""));
+    spans.push_back(MakeSpan("112", "2", "1"));
 
     bool ok = repo->SaveSingleTraceSpans(summary.trace_id, spans);
     EXPECT_TRUE(ok);
@@ -213,12 +221,12 @@ TEST_F(SqliteTraceRepositoryTest, SaveSingleTraceSpansPersistsRows)
 
 TEST_F(SqliteTraceRepositoryTest, SaveSingleTraceSpansRollbackOnTraceIdMismatch)
 {
-    persistence::TraceSummary summary = MakeSummary("single-span-2");
+    persistence::TraceSummary summary = MakeSummary("113");
     ASSERT_TRUE(repo->SaveSingleTraceSummary(summary));
 
     std::vector<persistence::TraceSpanRecord> spans;
-    spans.push_back(MakeSpan("single-span-2", "span-1", ""));
-    spans.push_back(MakeSpan("other-trace", "span-2", "span-1"));
+    spans.push_back(MakeSpan("113", "1", ""));
+    spans.push_back(MakeSpan("108", "2", "1"));
 
     bool ok = repo->SaveSingleTraceSpans(summary.trace_id, spans);
     EXPECT_FALSE(ok);
@@ -227,7 +235,7 @@ TEST_F(SqliteTraceRepositoryTest, SaveSingleTraceSpansRollbackOnTraceIdMismatch)
 
 TEST_F(SqliteTraceRepositoryTest, SaveSingleTraceAnalysisPersistsRow)
 {
-    persistence::TraceSummary summary = MakeSummary("single-analysis-1");
+    persistence::TraceSummary summary = MakeSummary("111");
     ASSERT_TRUE(repo->SaveSingleTraceSummary(summary));
 
     persistence::TraceAnalysisRecord analysis = MakeAnalysis(summary.trace_id);
@@ -245,7 +253,7 @@ TEST_F(SqliteTraceRepositoryTest, SaveSingleTraceAnalysisPersistsRow)
 
 TEST_F(SqliteTraceRepositoryTest, SaveSingleTraceAnalysisFailsWithoutSummary)
 {
-    persistence::TraceAnalysisRecord analysis = MakeAnalysis("missing-trace");
+    persistence::TraceAnalysisRecord analysis = MakeAnalysis("999999");
     bool ok = repo->SaveSingleTraceAnalysis(analysis);
     EXPECT_FALSE(ok);
     EXPECT_EQ(QueryCount("SELECT COUNT(*) FROM trace_analysis;"), 0);
@@ -253,7 +261,7 @@ TEST_F(SqliteTraceRepositoryTest, SaveSingleTraceAnalysisFailsWithoutSummary)
 
 TEST_F(SqliteTraceRepositoryTest, UpdateTraceAiStatePersistsSkippedManualWithoutAnalysisRow)
 {
-    persistence::TraceSummary summary = MakeSummary("manual-disabled-1");
+    persistence::TraceSummary summary = MakeSummary("107");
     ASSERT_TRUE(repo->SaveSingleTraceSummary(summary));
 
     bool ok = repo->UpdateTraceAiState(summary.trace_id, "skipped_manual", "");
@@ -275,14 +283,14 @@ TEST_F(SqliteTraceRepositoryTest, SchemaDoesNotCreatePromptDebugTable)
 
 TEST_F(SqliteTraceRepositoryTest, SaveSingleTraceAtomicPersistsSummaryFields)
 {
-    persistence::TraceSummary summary = MakeSummary("trace-1");
+    persistence::TraceSummary summary = MakeSummary("1");
     std::vector<persistence::TraceSpanRecord> spans;
-    spans.push_back(MakeSpan("trace-1", "span-1", ""));
+    spans.push_back(MakeSpan("1", "1", ""));
 
     bool ok = repo->SaveSingleTraceAtomic(summary, spans, nullptr);
     EXPECT_TRUE(ok);
 
-    auto row = QuerySummary("trace-1");
+    auto row = QuerySummary("1");
     ASSERT_TRUE(row.has_value());
     EXPECT_EQ(row->service_name, summary.service_name);
     EXPECT_EQ(row->start_time_ms, summary.start_time_ms);
@@ -292,11 +300,11 @@ TEST_F(SqliteTraceRepositoryTest, SaveSingleTraceAtomicPersistsSummaryFields)
 
 TEST_F(SqliteTraceRepositoryTest, SaveSingleTraceAtomicWithAnalysis)
 {
-    persistence::TraceSummary summary = MakeSummary("trace-2");
+    persistence::TraceSummary summary = MakeSummary("2");
     std::vector<persistence::TraceSpanRecord> spans;
-    spans.push_back(MakeSpan("trace-2", "span-1", ""));
+    spans.push_back(MakeSpan("2", "1", ""));
 
-    persistence::TraceAnalysisRecord analysis = MakeAnalysis("trace-2");
+    persistence::TraceAnalysisRecord analysis = MakeAnalysis("2");
 
     // 原子写现在只覆盖 summary / spans / analysis，
     // 所以这个用例就是新的完整路径，不再额外夹带任何废弃调试附属表。
@@ -308,18 +316,18 @@ TEST_F(SqliteTraceRepositoryTest, SaveSingleTraceAtomicWithAnalysis)
 
 TEST_F(SqliteTraceRepositoryTest, SaveSingleTraceAtomicRejectsOrphanSpan)
 {
-    persistence::TraceSummary summary = MakeSummary("trace-4");
+    persistence::TraceSummary summary = MakeSummary("4");
     std::vector<persistence::TraceSpanRecord> spans;
-    spans.push_back(MakeSpan("trace-4", "span-1", ""));
+    spans.push_back(MakeSpan("4", "1", ""));
 
     bool ok = repo->SaveSingleTraceAtomic(summary, spans, nullptr);
     EXPECT_TRUE(ok);
 
     // 直接写入不存在 trace_summary 的 span，应触发外键失败并返回 false
-    persistence::TraceSummary other_summary = MakeSummary("trace-5");
+    persistence::TraceSummary other_summary = MakeSummary("5");
     (void)other_summary;
     std::vector<persistence::TraceSpanRecord> bad_spans;
-    bad_spans.push_back(MakeSpan("missing-trace", "span-x", ""));
+    bad_spans.push_back(MakeSpan("999999", "14", ""));
 
     bool bad = repo->SaveSingleTraceAtomic(summary, bad_spans, nullptr);
     EXPECT_FALSE(bad);
@@ -328,7 +336,7 @@ TEST_F(SqliteTraceRepositoryTest, SaveSingleTraceAtomicRejectsOrphanSpan)
 
 TEST_F(SqliteTraceRepositoryTest, GetTraceDetailReturnsSummarySpansAndAnalysis)
 {
-    persistence::TraceSummary summary = MakeSummary("detail-trace-1");
+    persistence::TraceSummary summary = MakeSummary("102");
     summary.service_name = "order-service";
     summary.start_time_ms = 1000;
     summary.end_time_ms = 1600;
@@ -337,13 +345,13 @@ TEST_F(SqliteTraceRepositoryTest, GetTraceDetailReturnsSummarySpansAndAnalysis)
     summary.token_count = 42;
     ASSERT_TRUE(repo->SaveSingleTraceSummary(summary));
 
-    persistence::TraceSpanRecord child_span = MakeSpan(summary.trace_id, "span-2", "span-1");
+    persistence::TraceSpanRecord child_span = MakeSpan(summary.trace_id, "2", "1");
     child_span.service_name = "payment-service";
     child_span.operation = "charge";
     child_span.start_time_ms = 1200;
     child_span.duration_ms = 200;
 
-    persistence::TraceSpanRecord root_span = MakeSpan(summary.trace_id, "span-1", "");
+    persistence::TraceSpanRecord root_span = MakeSpan(summary.trace_id, "1", "");
     root_span.service_name = "order-service";
     root_span.operation = "create-order";
     root_span.start_time_ms = 1000;
@@ -380,26 +388,26 @@ TEST_F(SqliteTraceRepositoryTest, GetTraceDetailReturnsSummarySpansAndAnalysis)
     EXPECT_DOUBLE_EQ(detail->analysis->confidence, analysis.confidence);
 
     ASSERT_EQ(detail->spans.size(), 2u);
-    EXPECT_EQ(detail->spans[0].span_id, "span-1");
+    EXPECT_EQ(detail->spans[0].span_id, "1");
     EXPECT_EQ(detail->spans[0].service_name, "order-service");
     EXPECT_EQ(detail->spans[0].raw_status, "OK");
-    EXPECT_EQ(detail->spans[1].span_id, "span-2");
+    EXPECT_EQ(detail->spans[1].span_id, "2");
     ASSERT_TRUE(detail->spans[1].parent_id.has_value());
-    EXPECT_EQ(detail->spans[1].parent_id.value(), "span-1");
+    EXPECT_EQ(detail->spans[1].parent_id.value(), "1");
 }
 
 TEST_F(SqliteTraceRepositoryTest, GetTraceDetailReturnsNulloptWhenTraceMissing)
 {
-    std::optional<TraceDetailRecord> detail = repo->GetTraceDetail("missing-trace");
+    std::optional<TraceDetailRecord> detail = repo->GetTraceDetail("999999");
     EXPECT_FALSE(detail.has_value());
 }
 
 TEST_F(SqliteTraceRepositoryTest, DeleteTraceByIdRemovesSummarySpansAndAnalysisTogether)
 {
-    persistence::TraceSummary summary = MakeSummary("delete-trace-1");
+    persistence::TraceSummary summary = MakeSummary("101");
     std::vector<persistence::TraceSpanRecord> spans;
-    spans.push_back(MakeSpan(summary.trace_id, "span-1", ""));
-    spans.push_back(MakeSpan(summary.trace_id, "span-2", "span-1"));
+    spans.push_back(MakeSpan(summary.trace_id, "1", ""));
+    spans.push_back(MakeSpan(summary.trace_id, "2", "1"));
     persistence::TraceAnalysisRecord analysis = MakeAnalysis(summary.trace_id);
 
     ASSERT_TRUE(repo->SaveSingleTraceAtomic(summary, spans, &analysis));
@@ -415,15 +423,15 @@ TEST_F(SqliteTraceRepositoryTest, DeleteTraceByIdRemovesSummarySpansAndAnalysisT
 
 TEST_F(SqliteTraceRepositoryTest, DeleteExpiredTracesBatchRemovesOnlyExpiredTraceIds)
 {
-    persistence::TraceSummary expired_with_end = MakeSummary("expired-end");
+    persistence::TraceSummary expired_with_end = MakeSummary("103");
     expired_with_end.start_time_ms = 1000;
     expired_with_end.end_time_ms = 1500;
 
-    persistence::TraceSummary expired_without_end = MakeSummary("expired-start");
+    persistence::TraceSummary expired_without_end = MakeSummary("104");
     expired_without_end.start_time_ms = 1800;
     expired_without_end.end_time_ms.reset();
 
-    persistence::TraceSummary fresh = MakeSummary("fresh-trace");
+    persistence::TraceSummary fresh = MakeSummary("105");
     fresh.start_time_ms = 4000;
     fresh.end_time_ms = 5000;
     persistence::TraceAnalysisRecord expired_with_end_analysis = MakeAnalysis(expired_with_end.trace_id);
@@ -432,15 +440,15 @@ TEST_F(SqliteTraceRepositoryTest, DeleteExpiredTracesBatchRemovesOnlyExpiredTrac
 
     ASSERT_TRUE(repo->SaveSingleTraceAtomic(
         expired_with_end,
-        {MakeSpan(expired_with_end.trace_id, "span-a", "")},
+        {MakeSpan(expired_with_end.trace_id, "11", "")},
         &expired_with_end_analysis));
     ASSERT_TRUE(repo->SaveSingleTraceAtomic(
         expired_without_end,
-        {MakeSpan(expired_without_end.trace_id, "span-b", "")},
+        {MakeSpan(expired_without_end.trace_id, "12", "")},
         &expired_without_end_analysis));
     ASSERT_TRUE(repo->SaveSingleTraceAtomic(
         fresh,
-        {MakeSpan(fresh.trace_id, "span-c", "")},
+        {MakeSpan(fresh.trace_id, "13", "")},
         &fresh_analysis));
 
     const size_t deleted = repo->DeleteExpiredTracesBatch(/*cutoff_ms*/3000, /*limit*/10);
@@ -448,22 +456,22 @@ TEST_F(SqliteTraceRepositoryTest, DeleteExpiredTracesBatchRemovesOnlyExpiredTrac
     EXPECT_EQ(QueryCount("SELECT COUNT(*) FROM trace_summary;"), 1);
     EXPECT_EQ(QueryCount("SELECT COUNT(*) FROM trace_span;"), 1);
     EXPECT_EQ(QueryCount("SELECT COUNT(*) FROM trace_analysis;"), 1);
-    EXPECT_TRUE(QuerySummary("fresh-trace").has_value());
-    EXPECT_FALSE(QuerySummary("expired-end").has_value());
-    EXPECT_FALSE(QuerySummary("expired-start").has_value());
+    EXPECT_TRUE(QuerySummary("105").has_value());
+    EXPECT_FALSE(QuerySummary("103").has_value());
+    EXPECT_FALSE(QuerySummary("104").has_value());
 }
 
 TEST_F(SqliteTraceRepositoryTest, DeleteExpiredTracesBatchDeletesOldestExpiredTracesFirst)
 {
-    persistence::TraceSummary oldest = MakeSummary("trace-oldest");
+    persistence::TraceSummary oldest = MakeSummary("115");
     oldest.start_time_ms = 1000;
     oldest.end_time_ms = 1100;
 
-    persistence::TraceSummary middle = MakeSummary("trace-middle");
+    persistence::TraceSummary middle = MakeSummary("116");
     middle.start_time_ms = 2000;
     middle.end_time_ms = 2100;
 
-    persistence::TraceSummary newest_expired = MakeSummary("trace-newest-expired");
+    persistence::TraceSummary newest_expired = MakeSummary("117");
     newest_expired.start_time_ms = 2500;
     newest_expired.end_time_ms = 2600;
     persistence::TraceAnalysisRecord oldest_analysis = MakeAnalysis(oldest.trace_id);
@@ -471,19 +479,684 @@ TEST_F(SqliteTraceRepositoryTest, DeleteExpiredTracesBatchDeletesOldestExpiredTr
     persistence::TraceAnalysisRecord newest_analysis = MakeAnalysis(newest_expired.trace_id);
 
     ASSERT_TRUE(repo->SaveSingleTraceAtomic(oldest,
-                                            {MakeSpan(oldest.trace_id, "span-oldest", "")},
+                                            {MakeSpan(oldest.trace_id, "23", "")},
                                             &oldest_analysis));
     ASSERT_TRUE(repo->SaveSingleTraceAtomic(middle,
-                                            {MakeSpan(middle.trace_id, "span-middle", "")},
+                                            {MakeSpan(middle.trace_id, "21", "")},
                                             &middle_analysis));
     ASSERT_TRUE(repo->SaveSingleTraceAtomic(newest_expired,
-                                            {MakeSpan(newest_expired.trace_id, "span-newest", "")},
+                                            {MakeSpan(newest_expired.trace_id, "22", "")},
                                             &newest_analysis));
 
     // 这里锁死“最老优先 + limit 生效”的删除语义，避免 retention 一轮删的是随机过期 trace。
     const size_t deleted = repo->DeleteExpiredTracesBatch(/*cutoff_ms*/3000, /*limit*/2);
     EXPECT_EQ(deleted, 2u);
-    EXPECT_FALSE(QuerySummary("trace-oldest").has_value());
-    EXPECT_FALSE(QuerySummary("trace-middle").has_value());
-    EXPECT_TRUE(QuerySummary("trace-newest-expired").has_value());
+    EXPECT_FALSE(QuerySummary("115").has_value());
+    EXPECT_FALSE(QuerySummary("116").has_value());
+    EXPECT_TRUE(QuerySummary("117").has_value());
+}
+
+TEST_F(SqliteTraceRepositoryTest, ReadPoolServesQueriesFromReadOnlyConnections)
+{
+    repo.reset();
+    repo = std::make_unique<SqliteTraceRepository>(db_path, /*read_pool_size*/2);
+    EXPECT_EQ(repo->OpenedReadConnections(), 0u);
+
+    persistence::TraceSummary summary = MakeSummary("109");
+    ASSERT_TRUE(repo->SaveSingleTraceAtomic(summary,
+                                            {MakeSpan(summary.trace_id, "1", ""),
+                                             MakeSpan(summary.trace_id, "2", "1")},
+                                            nullptr));
+
+    // 写连接提交后，只读连接上的新读事务能立刻看到；单线程顺序查询只会懒打开一条连接并反复复用。
+    TraceSearchRequest request;
+    TraceSearchResult result = repo->SearchTraces(request);
+    ASSERT_EQ(result.total, 1u);
+    EXPECT_EQ(result.items[0].trace_id, summary.trace_id);
+    std::optional<TraceDetailRecord> detail = repo->GetTraceDetail(summary.trace_id);
+    ASSERT_TRUE(detail.has_value());
+    EXPECT_EQ(detail->spans.size(), 2u);
+    EXPECT_FALSE(repo->GetTraceDetail("999999").has_value());
+    EXPECT_EQ(repo->OpenedReadConnections(), 1u);
+}
+
+TEST_F(SqliteTraceRepositoryTest, ReadPoolKeepsDetailSnapshotConsistentWhileFlushWrites)
+{
+    repo.reset();
+    repo = std::make_unique<SqliteTraceRepository>(db_path, /*read_pool_size*/3);
+
+    persistence::TraceSummary seed = MakeSummary("110");
+    ASSERT_TRUE(repo->SaveSingleTraceAtomic(seed,
+                                            {MakeSpan(seed.trace_id, "1", ""),
+                                             MakeSpan(seed.trace_id, "2", "1")},
+                                            nullptr));
+
+    std::atomic<bool> stop{false};
+    std::atomic<int> read_errors{0};
+    std::atomic<int> read_rounds{0};
+    std::vector<std::thread> readers;
+    for (int reader = 0; reader < 3; ++reader) {
+        readers.emplace_back([this, &stop, &read_errors, &read_rounds]() {
+            while (!stop.load(std::memory_order_acquire)) {
+                try {
+                    TraceSearchRequest request;
+                    const TraceSearchResult result = repo->SearchTraces(request);
+                    if (result.total == 0 || result.items.empty()) {
+                        read_errors.fetch_add(1);
+                    }
+                    const std::optional<TraceDetailRecord> detail = repo->GetTraceDetail("110");
+                    if (!detail.has_value() || detail->spans.size() != detail->span_count) {
+                        read_errors.fetch_add(1);
+                    }
+                } catch (const std::exception&) {
+                    read_errors.fetch_add(1);
+                }
+                read_rounds.fetch_add(1, std::memory_order_relaxed);
+            }
+        });
+    }
+
+    // 写侧模拟 flush 线程持续批量写入，读线程并发查询不应报错，也不应读到半个事务。
+    for (int batch = 0; batch < 50; ++batch) {
+        std::vector<persistence::TraceSummary> summaries;
+        std::vector<persistence::TraceSpanRecord> spans;
+        for (int i = 0; i < 10; ++i) {
+            persistence::TraceSummary summary = MakeSummary(std::to_string(1000 + batch * 10 + i));
+            summaries.push_back(summary);
+            spans.push_back(MakeSpan(summary.trace_id, "1", ""));
+            spans.push_back(MakeSpan(summary.trace_id, "2", "1"));
+        }
+        ASSERT_TRUE(repo->SavePrimaryBatch(summaries, spans));
+    }
+    stop.store(true, std::memory_order_release);
+    for (std::thread& reader : readers) {
+        reader.join();
+    }
+
+    EXPECT_EQ(read_errors.load(), 0);
+    EXPECT_GT(read_rounds.load(), 0);
+    EXPECT_LE(repo->OpenedReadConnections(), 3u);
+    EXPECT_EQ(repo->SearchTraces(TraceSearchRequest{}).total, 501u);
+}
+
+TEST_F(SqliteTraceRepositoryTest, StatementCacheReusesBatchInsertsAndSearchShapes)
+{
+    repo.reset();
+    repo = std::make_unique<SqliteTraceRepository>(db_path, /*read_pool_size*/1);
+
+    for (int batch = 0; batch < 3; ++batch) {
+        persistence::TraceSummary summary = MakeSummary(std::to_string(2000 + batch));
+        ASSERT_TRUE(repo->SavePrimaryBatch({summary}, {MakeSpan(summary.trace_id, "1", "")}));
+    }
+    SqliteTraceRepository::RuntimeStatsSnapshot stats = repo->SnapshotRuntimeStats();
+    // summary/span 两条插入语句各只在第一批 prepare 一次。
+    EXPECT_EQ(stats.write_stmt_cache_misses, 2u);
+    EXPECT_EQ(stats.write_stmt_cache_hits, 4u);
+
+    TraceSearchRequest request;
+    request.service_name = "service";
+    ASSERT_EQ(repo->SearchTraces(request).total, 3u);
+    ASSERT_EQ(repo->SearchTraces(request).total, 3u);
+    stats = repo->SnapshotRuntimeStats();
+    EXPECT_EQ(stats.read_stmt_cache_misses, 2u);
+    EXPECT_EQ(stats.read_stmt_cache_hits, 2u);
+
+    // WHERE 组合不同就是另一种 SQL 形状，单独缓存；同形状不同参数值照样命中。
+    request.risk_levels = {"unknown"};
+    ASSERT_EQ(repo->SearchTraces(request).total, 3u);
+    request.service_name = "other-service";
+    EXPECT_EQ(repo->SearchTraces(request).total, 0u);
+    stats = repo->SnapshotRuntimeStats();
+    EXPECT_EQ(stats.read_stmt_cache_misses, 4u);
+    EXPECT_EQ(stats.read_stmt_cache_hits, 3u);
+    EXPECT_NE(repo->DescribeRuntimeStats().find("read_stmt_cache_hit_rate="), std::string::npos);
+}
+
+TEST_F(SqliteTraceRepositoryTest, SavePrimaryBatchWritesLargeBatchesAsMultiRowChunks)
+{
+    auto build_batch = [this](int first, std::vector<persistence::TraceSummary>* summaries,
+                              std::vector<persistence::TraceSpanRecord>* spans) {
+        summaries->clear();
+        spans->clear();
+        for (int trace = first; trace < first + 150; ++trace) {
+            summaries->push_back(MakeSummary(std::to_string(trace)));
+            for (int span = 1; span <= 3; ++span) {
+                spans->push_back(MakeSpan(std::to_string(trace), std::to_string(span), span == 1 ? "" : "1"));
+            }
+        }
+    };
+    std::vector<persistence::TraceSummary> summaries;
+    std::vector<persistence::TraceSpanRecord> spans;
+    build_batch(10000, &summaries, &spans);
+    ASSERT_TRUE(repo->SavePrimaryBatch(summaries, spans));
+    EXPECT_EQ(QueryCount("SELECT COUNT(*) FROM trace_summary;"), 150);
+    EXPECT_EQ(QueryCount("SELECT COUNT(*) FROM trace_span;"), 450);
+
+    // 150 = 64 + 64 + 16 + 4 + 2，450 = 64 * 7 + 2：尾巴按 2 的幂拆，整批只用到 6 种语句形状。
+    SqliteTraceRepository::RuntimeStatsSnapshot stats = repo->SnapshotRuntimeStats();
+    EXPECT_EQ(stats.write_stmt_cache_misses, 6u);
+    build_batch(20000, &summaries, &spans);
+    ASSERT_TRUE(repo->SavePrimaryBatch(summaries, spans));
+    stats = repo->SnapshotRuntimeStats();
+    EXPECT_EQ(stats.write_stmt_cache_misses, 6u);
+
+    // 某一块里有一行冲突，整批（包括已经写进去的前几块）一起回滚。
+    build_batch(30000, &summaries, &spans);
+    spans.back().trace_id = "10000";
+    spans.back().span_id = "1";
+    EXPECT_FALSE(repo->SavePrimaryBatch(summaries, spans));
+    EXPECT_EQ(QueryCount("SELECT COUNT(*) FROM trace_summary;"), 300);
+    EXPECT_EQ(QueryCount("SELECT COUNT(*) FROM trace_span;"), 900);
+}
+
+TEST_F(SqliteTraceRepositoryTest, SavePrimaryBatchSkipsOnlyReplayedTracesAlreadyStored)
+{
+    // 第一次落库：trace 700 两个 span。
+    persistence::TraceSummary stored = MakeSummary("700");
+    stored.service_name = "original";
+    ASSERT_TRUE(repo->SavePrimaryBatch({stored}, {MakeSpan("700", "1", ""), MakeSpan("700", "2", "1")}));
+
+    // WAL 回放把 700 又推了一遍，和新 trace 701 混在同一批里：批次照样成功，701 正常落库，
+    // 700 保留第一次写入的内容，小时计数不重复累加，跳过的行记进统计。
+    persistence::TraceSummary replayed = MakeSummary("700");
+    replayed.service_name = "replayed";
+    replayed.replayed = true;
+    persistence::TraceSummary fresh = MakeSummary("701");
+    ASSERT_TRUE(repo->SavePrimaryBatch({replayed, fresh},
+                                       {MakeSpan("700", "1", ""), MakeSpan("700", "2", "1"), MakeSpan("701", "1", "")}));
+    EXPECT_EQ(QueryCount("SELECT COUNT(*) FROM trace_summary;"), 2);
+    EXPECT_EQ(QueryCount("SELECT COUNT(*) FROM trace_span;"), 3);
+    EXPECT_EQ(QueryCount("SELECT COUNT(*) FROM trace_summary WHERE trace_id = 700 AND service_name = 'original';"), 1);
+    EXPECT_EQ(QueryCount("SELECT SUM(trace_count) FROM trace_summary_hourly_counts;"), 2);
+    EXPECT_EQ(repo->SnapshotRuntimeStats().replay_skipped_primary_rows, 3u);
+
+    // 不是重放出来的同 key trace（比如 trace_key 被复用）不能被悄悄吞掉：冲突照旧让整批失败，交给上层溢出重试。
+    persistence::TraceSummary reused = MakeSummary("700");
+    reused.service_name = "reused";
+    persistence::TraceSummary other = MakeSummary("702");
+    EXPECT_FALSE(repo->SavePrimaryBatch({reused, other}, {MakeSpan("700", "9", ""), MakeSpan("702", "1", "")}));
+    EXPECT_EQ(QueryCount("SELECT COUNT(*) FROM trace_summary;"), 2);
+    EXPECT_EQ(QueryCount("SELECT COUNT(*) FROM trace_span;"), 3);
+    EXPECT_EQ(repo->SnapshotRuntimeStats().replay_skipped_primary_rows, 3u);
+}
+
+TEST_F(SqliteTraceRepositoryTest, SaveAnalysisBatchSkipsOnlyReplayedAnalysesAlreadyStored)
+{
+    ASSERT_TRUE(repo->SavePrimaryBatch({MakeSummary("710"), MakeSummary("711")},
+                                       {MakeSpan("710", "1", ""), MakeSpan("711", "1", "")}));
+    persistence::TraceAnalysisRecord original = MakeAnalysis("710");
+    original.risk_level = "critical";
+    ASSERT_TRUE(repo->SaveAnalysisBatch({original}));
+    // 重放出来的 trace 开始分析前靠它判断崩溃前是否已经分析过。
+    EXPECT_TRUE(repo->HasTraceAnalysis("710"));
+    EXPECT_FALSE(repo->HasTraceAnalysis("711"));
+    EXPECT_FALSE(repo->HasTraceAnalysis("not-a-key"));
+
+    // 重放出来的 trace 重新做完 AI 分析：已有的分析结果和 summary 上的结论都保留，同批其他 trace 照常回写。
+    persistence::TraceAnalysisRecord replayed = MakeAnalysis("710");
+    replayed.risk_level = "info";
+    replayed.replayed = true;
+    ASSERT_TRUE(repo->SaveAnalysisBatch({replayed, MakeAnalysis("711")}));
+    EXPECT_EQ(QueryCount("SELECT COUNT(*) FROM trace_analysis;"), 2);
+    EXPECT_EQ(QueryCount("SELECT COUNT(*) FROM trace_analysis WHERE trace_id = 710 AND risk_level = 'critical';"), 1);
+    EXPECT_EQ(QueryCount("SELECT COUNT(*) FROM trace_summary WHERE trace_id = 710 AND risk_level = 'critical';"), 1);
+    EXPECT_EQ(repo->SnapshotRuntimeStats().replay_skipped_analyses, 1u);
+
+    // 普通记录撞上已有分析结果仍然是错误。
+    EXPECT_FALSE(repo->SaveAnalysisBatch({MakeAnalysis("710")}));
+}
+
+TEST_F(SqliteTraceRepositoryTest, StatementCacheEvictsLruAndResetsStatementsOnRelease)
+{
+    ASSERT_TRUE(repo->SaveSingleTraceAtomic(MakeSummary("106"), {MakeSpan("106", "1", "")}, nullptr));
+
+    sqlite3* db = nullptr;
+    ASSERT_EQ(sqlite3_open_v2(db_path.c_str(), &db, SQLITE_OPEN_READONLY, nullptr), SQLITE_OK);
+    std::atomic<uint64_t> hits{0};
+    std::atomic<uint64_t> misses{0};
+    {
+        persistence::SqliteStatementCache cache(db, /*capacity*/2, &hits, &misses);
+        const std::string sql_a = "SELECT trace_id FROM trace_summary;";
+        const std::string sql_b = "SELECT COUNT(*) FROM trace_summary;";
+        const std::string sql_c = "SELECT COUNT(*) FROM trace_span;";
+        {
+            persistence::SqliteStatementCache::Handle stmt = cache.Acquire(sql_a, "Prepare a");
+            ASSERT_EQ(sqlite3_step(stmt.get()), SQLITE_ROW);
+            // 同一条 SQL 还在外层借用时，嵌套借用拿到的是临时 stmt，不会和外层共用游标。
+            persistence::SqliteStatementCache::Handle nested = cache.Acquire(sql_a, "Prepare a");
+            EXPECT_NE(nested.get(), stmt.get());
+            EXPECT_EQ(cache.size(), 1u);
+        }
+        // 提前返回的 SELECT 在归还时已经 reset，连接上不再挂着读事务。
+        EXPECT_TRUE(sqlite3_get_autocommit(db));
+        ASSERT_NE(sqlite3_next_stmt(db, nullptr), nullptr);
+        EXPECT_EQ(sqlite3_stmt_busy(sqlite3_next_stmt(db, nullptr)), 0);
+
+        { persistence::SqliteStatementCache::Handle stmt = cache.Acquire(sql_b, "Prepare b"); }
+        { persistence::SqliteStatementCache::Handle stmt = cache.Acquire(sql_a, "Prepare a"); }
+        // 容量 2：插入 c 淘汰最久未用的 b，a 仍然命中。
+        { persistence::SqliteStatementCache::Handle stmt = cache.Acquire(sql_c, "Prepare c"); }
+        EXPECT_EQ(cache.size(), 2u);
+        const uint64_t hits_before = hits.load();
+        { persistence::SqliteStatementCache::Handle stmt = cache.Acquire(sql_a, "Prepare a"); }
+        EXPECT_EQ(hits.load(), hits_before + 1);
+        const uint64_t misses_before = misses.load();
+        { persistence::SqliteStatementCache::Handle stmt = cache.Acquire(sql_b, "Prepare b"); }
+        EXPECT_EQ(misses.load(), misses_before + 1);
+
+        EXPECT_THROW(cache.Acquire("SELECT * FROM missing_table;", "Prepare missing"), std::runtime_error);
+    }
+    // 缓存析构时已经 finalize 掉全部 stmt，连接可以干净关闭。
+    EXPECT_EQ(sqlite3_next_stmt(db, nullptr), nullptr);
+    EXPECT_EQ(sqlite3_close(db), SQLITE_OK);
+}
+
+TEST_F(SqliteTraceRepositoryTest, SchemaStoresIntegerKeysAcrossFullUint64Range)
+{
+    // 接入侧的 trace_key/span_id 是 size_t，>= 2^63 的 key 也要原样往返。
+    const std::string big_trace_id = "18446744073709551615";
+    persistence::TraceSummary summary = MakeSummary(big_trace_id);
+    ASSERT_TRUE(repo->SaveSingleTraceAtomic(summary,
+                                            {MakeSpan(big_trace_id, "9223372036854775808", ""),
+                                             MakeSpan(big_trace_id, "7", "9223372036854775808")},
+                                            nullptr));
+
+    std::optional<TraceDetailRecord> detail = repo->GetTraceDetail(big_trace_id);
+    ASSERT_TRUE(detail.has_value());
+    EXPECT_EQ(detail->trace_id, big_trace_id);
+    ASSERT_EQ(detail->spans.size(), 2u);
+    std::vector<std::string> span_ids = {detail->spans[0].span_id, detail->spans[1].span_id};
+    EXPECT_NE(std::find(span_ids.begin(), span_ids.end(), "9223372036854775808"), span_ids.end());
+    for (const TraceSpanDetail& span : detail->spans) {
+        if (span.span_id == "7") {
+            ASSERT_TRUE(span.parent_id.has_value());
+            EXPECT_EQ(span.parent_id.value(), "9223372036854775808");
+        }
+    }
+    TraceSearchRequest request;
+    request.trace_id = big_trace_id;
+    EXPECT_EQ(repo->SearchTraces(request).total, 1u);
+
+    EXPECT_EQ(QueryCount("SELECT COUNT(*) FROM trace_span WHERE typeof(trace_id) = 'integer' AND typeof(span_id) = 'integer';"), 2);
+    EXPECT_EQ(QueryCount("SELECT COUNT(*) FROM sqlite_master WHERE name = 'trace_span' AND sql LIKE '%WITHOUT ROWID%';"), 1);
+    EXPECT_EQ(QueryCount("PRAGMA user_version;"), 2);
+
+    // 非整数 id 写不进新 schema，整批回滚；按非整数 id 查询直接视为不存在。
+    EXPECT_FALSE(repo->SaveSingleTraceAtomic(MakeSummary("not-a-number"), {}, nullptr));
+    EXPECT_FALSE(repo->SavePrimaryBatch({MakeSummary("200")}, {MakeSpan("200", "bad-span", "")}));
+    EXPECT_EQ(QueryCount("SELECT COUNT(*) FROM trace_summary;"), 1);
+    EXPECT_FALSE(repo->GetTraceDetail("not-a-number").has_value());
+    request.trace_id = "not-a-number";
+    EXPECT_EQ(repo->SearchTraces(request).total, 0u);
+    EXPECT_FALSE(repo->DeleteTraceById("not-a-number"));
+}
+
+TEST_F(SqliteTraceRepositoryTest, LegacyTextKeySchemaMigratesInBackgroundWhileAcceptingWrites)
+{
+    repo.reset();
+    std::filesystem::remove(db_path);
+
+    // 按旧版建表语句造一个 TEXT 主键的库：1200 条可迁移 trace + 1 条 id 不是整数的脏数据。
+    {
+        sqlite3* db = nullptr;
+        ASSERT_EQ(sqlite3_open(db_path.c_str(), &db), SQLITE_OK);
+        const char* sql_legacy = R"(
+            PRAGMA journal_mode=WAL;
+            CREATE TABLE trace_summary (
+              trace_id TEXT PRIMARY KEY, service_name TEXT NOT NULL, start_time_ms INTEGER NOT NULL,
+              end_time_ms INTEGER, duration_ms INTEGER NOT NULL, span_count INTEGER NOT NULL,
+              token_count INTEGER NOT NULL, risk_level TEXT NOT NULL,
+              ai_status TEXT NOT NULL DEFAULT 'pending', ai_error TEXT NOT NULL DEFAULT '');
+            CREATE TABLE trace_span (
+              trace_id TEXT NOT NULL, span_id TEXT NOT NULL, parent_id TEXT, service_name TEXT NOT NULL,
+              operation TEXT NOT NULL, start_time_ms INTEGER NOT NULL, duration_ms INTEGER NOT NULL,
+              status TEXT NOT NULL, attributes_json TEXT NOT NULL,
+              PRIMARY KEY (trace_id, span_id), FOREIGN KEY (trace_id) REFERENCES trace_summary(trace_id));
+            CREATE TABLE trace_analysis (
+              trace_id TEXT PRIMARY KEY, risk_level TEXT NOT NULL, summary TEXT NOT NULL, root_cause TEXT NOT NULL,
+              solution TEXT NOT NULL, confidence REAL NOT NULL, FOREIGN KEY (trace_id) REFERENCES trace_summary(trace_id));
+            CREATE INDEX idx_trace_summary_start_time_trace_id ON trace_summary(start_time_ms DESC, trace_id DESC);
+            CREATE INDEX idx_trace_span_trace_start_time_span_id ON trace_span(trace_id, start_time_ms ASC, span_id ASC);
+            WITH RECURSIVE seq(n) AS (SELECT 1 UNION ALL SELECT n + 1 FROM seq WHERE n < 1200)
+            INSERT INTO trace_summary SELECT CAST(n AS TEXT), 'legacy-service', n * 10, n * 10 + 5, 5, 2, 3, 'info', 'completed', '' FROM seq;
+            INSERT INTO trace_span SELECT trace_id, '1', NULL, 'legacy-service', 'root', start_time_ms, 5, 'OK', '{}' FROM trace_summary;
+            INSERT INTO trace_span SELECT trace_id, '2', '1', 'legacy-db', 'query', start_time_ms + 1, 3, 'OK', '{}' FROM trace_summary;
+            INSERT INTO trace_analysis SELECT trace_id, 'warning', 'legacy summary', 'root', 'fix', 0.5 FROM trace_summary;
+            INSERT INTO trace_summary VALUES ('legacy-x', 'legacy-service', 1, 2, 1, 1, 1, 'info', 'completed', '');
+            INSERT INTO trace_span VALUES ('legacy-x', 'span-x', NULL, 'legacy-service', 'root', 1, 1, 'OK', '{}');
+        )";
+        ASSERT_EQ(sqlite3_exec(db, sql_legacy, nullptr, nullptr, nullptr), SQLITE_OK) << sqlite3_errmsg(db);
+        sqlite3_close(db);
+    }
+
+    repo = std::make_unique<SqliteTraceRepository>(db_path, /*read_pool_size*/1);
+    // 迁移期间新写入照常进新表。
+    persistence::TraceSummary fresh = MakeSummary("5000");
+    ASSERT_TRUE(repo->SavePrimaryBatch({fresh}, {MakeSpan(fresh.trace_id, "1", "")}));
+
+    for (int i = 0; i < 1000 && repo->LegacyMigrationPending(); ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    ASSERT_FALSE(repo->LegacyMigrationPending());
+
+    const SqliteTraceRepository::RuntimeStatsSnapshot stats = repo->SnapshotRuntimeStats();
+    EXPECT_EQ(stats.legacy_migrated_traces, 1200u);
+    EXPECT_EQ(stats.legacy_skipped_traces, 1u);
+    EXPECT_FALSE(TableExists("legacy_trace_summary"));
+    EXPECT_FALSE(TableExists("legacy_trace_span"));
+    EXPECT_FALSE(TableExists("legacy_trace_analysis"));
+    EXPECT_EQ(QueryCount("SELECT COUNT(*) FROM trace_summary;"), 1201);
+    EXPECT_EQ(QueryCount("SELECT COUNT(*) FROM trace_span;"), 2401);
+    EXPECT_EQ(QueryCount("SELECT COUNT(*) FROM trace_analysis;"), 1200);
+
+    std::optional<TraceDetailRecord> detail = repo->GetTraceDetail("1200");
+    ASSERT_TRUE(detail.has_value());
+    EXPECT_EQ(detail->service_name, "legacy-service");
+    EXPECT_EQ(detail->ai_status, "completed");
+    ASSERT_TRUE(detail->analysis.has_value());
+    EXPECT_EQ(detail->analysis->summary, "legacy summary");
+    ASSERT_EQ(detail->spans.size(), 2u);
+    EXPECT_EQ(detail->spans[0].span_id, "1");
+    ASSERT_TRUE(detail->spans[1].parent_id.has_value());
+    EXPECT_EQ(detail->spans[1].parent_id.value(), "1");
+
+    // 迁移完成后重开不会再触发迁移。
+    repo.reset();
+    repo = std::make_unique<SqliteTraceRepository>(db_path);
+    EXPECT_FALSE(repo->LegacyMigrationPending());
+    EXPECT_EQ(repo->SearchTraces(TraceSearchRequest{}).total, 1201u);
+}
+
+TEST_F(SqliteTraceRepositoryTest, DayPartitionsRouteTracesByStartTimeAndPageAcrossPartitions)
+{
+    const std::filesystem::path dir = "./test_trace_repo_partitions";
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir);
+    const std::string partitioned_path = (dir / "traces.db").string();
+    constexpr int64_t kDayMs = 24LL * 60 * 60 * 1000;
+    // 19792 天 = 2024-03-10 00:00 UTC。
+    const int64_t day0_ms = 19792 * kDayMs;
+
+    {
+        SqliteTraceRepository partitioned(partitioned_path, /*read_pool_size*/2, TracePartitionMode::Day);
+        std::vector<persistence::TraceSummary> summaries;
+        std::vector<persistence::TraceSpanRecord> spans;
+        for (int day = 0; day < 3; ++day) {
+            for (int k = 1; k <= 2; ++k) {
+                persistence::TraceSummary summary = MakeSummary(std::to_string((day + 1) * 10 + k));
+                summary.start_time_ms = day0_ms + day * kDayMs + k * 1000;
+                summary.end_time_ms = summary.start_time_ms + 100;
+                summaries.push_back(summary);
+                spans.push_back(MakeSpan(summary.trace_id, "1", ""));
+                spans.push_back(MakeSpan(summary.trace_id, "2", "1"));
+            }
+        }
+        ASSERT_TRUE(partitioned.SavePrimaryBatch(summaries, spans));
+        // 批里没有 summary 的迟到 span 要跟着自己的 trace 落进 03-10 的分区，而不是按 span 时间另建分区。
+        persistence::TraceSpanRecord late_span = MakeSpan("11", "3", "1");
+        late_span.start_time_ms = day0_ms + 5 * kDayMs;
+        ASSERT_TRUE(partitioned.SavePrimaryBatch({}, {late_span}));
+
+        EXPECT_EQ(partitioned.PartitionNames(),
+                  (std::vector<std::string>{"p20240310", "p20240311", "p20240312"}));
+        EXPECT_TRUE(std::filesystem::exists(partitioned_path + ".p20240310"));
+        EXPECT_EQ(QueryCountAt(partitioned_path, "SELECT COUNT(*) FROM trace_summary;"), 0);
+        EXPECT_EQ(QueryCountAt(partitioned_path + ".p20240311", "SELECT COUNT(*) FROM trace_summary;"), 2);
+        EXPECT_EQ(QueryCountAt(partitioned_path + ".p20240310", "SELECT COUNT(*) FROM trace_span;"), 5);
+
+        // 分区之间时间段不重叠，分页跨分区时顺序和单库一致。
+        TraceSearchRequest request;
+        request.page_size = 4;
+        TraceSearchResult first_page = partitioned.SearchTraces(request);
+        ASSERT_EQ(first_page.total, 6u);
+        ASSERT_EQ(first_page.items.size(), 4u);
+        EXPECT_EQ(first_page.items[0].trace_id, "32");
+        EXPECT_EQ(first_page.items[3].trace_id, "21");
+        request.page = 2;
+        TraceSearchResult second_page = partitioned.SearchTraces(request);
+        ASSERT_EQ(second_page.items.size(), 2u);
+        EXPECT_EQ(second_page.items[0].trace_id, "12");
+        EXPECT_EQ(second_page.items[1].trace_id, "11");
+
+        TraceSearchRequest window;
+        window.start_time_ms = day0_ms + kDayMs;
+        window.end_time_ms = day0_ms + 2 * kDayMs;
+        TraceSearchResult windowed = partitioned.SearchTraces(window);
+        ASSERT_EQ(windowed.total, 2u);
+        EXPECT_EQ(windowed.items[0].trace_id, "22");
+
+        std::optional<TraceDetailRecord> detail = partitioned.GetTraceDetail("11");
+        ASSERT_TRUE(detail.has_value());
+        EXPECT_EQ(detail->spans.size(), 3u);
+
+        ASSERT_TRUE(partitioned.SaveAnalysisBatch({MakeAnalysis("11"), MakeAnalysis("31")}));
+        ASSERT_TRUE(partitioned.UpdateTraceAiState("21", "failed", "timeout"));
+        detail = partitioned.GetTraceDetail("11");
+        ASSERT_TRUE(detail.has_value() && detail->analysis.has_value());
+        EXPECT_EQ(detail->risk_level, "warning");
+        detail = partitioned.GetTraceDetail("21");
+        ASSERT_TRUE(detail.has_value());
+        EXPECT_EQ(detail->ai_status, "failed");
+
+        EXPECT_TRUE(partitioned.DeleteTraceById("22"));
+        EXPECT_EQ(partitioned.SearchTraces(window).total, 1u);
+        EXPECT_EQ(partitioned.SnapshotRuntimeStats().partitions, 3u);
+    }
+
+    // 重启后从文件名恢复分区目录。
+    SqliteTraceRepository reopened(partitioned_path, /*read_pool_size*/0, TracePartitionMode::Day);
+    EXPECT_EQ(reopened.PartitionNames().size(), 3u);
+    EXPECT_EQ(reopened.SearchTraces(TraceSearchRequest{}).total, 5u);
+    std::filesystem::remove_all(dir);
+}
+
+TEST_F(SqliteTraceRepositoryTest, HourPartitionsBeyondAttachLimitStaySearchableAndDropAsWholeFiles)
+{
+    const std::filesystem::path dir = "./test_trace_repo_hour_partitions";
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir);
+    const std::string partitioned_path = (dir / "traces.db").string();
+    constexpr int64_t kHourMs = 60LL * 60 * 1000;
+    const int64_t hour0_ms = 19792LL * 24 * kHourMs;
+
+    SqliteTraceRepository partitioned(partitioned_path, /*read_pool_size*/1, TracePartitionMode::Hour);
+    // 一批横跨 12 个小时，超过 SQLite 默认的 10 个 ATTACH 上限：最老的两个小时写进主库，整批仍然一个事务提交。
+    std::vector<persistence::TraceSummary> summaries;
+    std::vector<persistence::TraceSpanRecord> spans;
+    for (int hour = 0; hour < 12; ++hour) {
+        persistence::TraceSummary summary = MakeSummary(std::to_string(100 + hour));
+        summary.start_time_ms = hour0_ms + hour * kHourMs + 1000;
+        summary.end_time_ms = summary.start_time_ms + 100;
+        summaries.push_back(summary);
+        spans.push_back(MakeSpan(summary.trace_id, "1", ""));
+    }
+    ASSERT_TRUE(partitioned.SavePrimaryBatch(summaries, spans));
+    EXPECT_EQ(partitioned.PartitionNames().size(), 12u);
+    EXPECT_EQ(QueryCountAt(partitioned_path, "SELECT COUNT(*) FROM trace_summary;"), 2);
+
+    // 只读连接同样只能同时挂 10 个分区，逐段分页时按 LRU 换入换出，结果仍然完整有序。
+    TraceSearchRequest request;
+    request.page_size = 100;
+    TraceSearchResult all = partitioned.SearchTraces(request);
+    ASSERT_EQ(all.total, 12u);
+    ASSERT_EQ(all.items.size(), 12u);
+    for (size_t index = 0; index < all.items.size(); ++index) {
+        EXPECT_EQ(all.items[index].trace_id, std::to_string(111 - index));
+    }
+    // 游标翻页在分区和主库之间归并，顺序和一次取全相同。
+    TraceSearchRequest cursor_request;
+    cursor_request.page_size = 5;
+    std::vector<std::string> walked;
+    while (true) {
+        TraceSearchResult page = partitioned.SearchTraces(cursor_request);
+        for (const auto& item : page.items) {
+            walked.push_back(item.trace_id);
+        }
+        if (!page.next_cursor.has_value()) {
+            break;
+        }
+        cursor_request.cursor = page.next_cursor;
+    }
+    ASSERT_EQ(walked.size(), 12u);
+    for (size_t index = 0; index < walked.size(); ++index) {
+        EXPECT_EQ(walked[index], std::to_string(111 - index));
+    }
+    ASSERT_TRUE(partitioned.GetTraceDetail("102").has_value());
+
+    const int64_t cutoff_ms = hour0_ms + 5 * kHourMs;
+    EXPECT_EQ(partitioned.DropExpiredPartitions(cutoff_ms), 5u);
+    EXPECT_EQ(partitioned.PartitionNames().size(), 7u);
+    EXPECT_FALSE(std::filesystem::exists(partitioned_path + ".p2024031002"));
+    EXPECT_FALSE(partitioned.GetTraceDetail("102").has_value());
+    // 主库里那两条未分区数据不随分区删除，还是按批删。
+    EXPECT_EQ(partitioned.SearchTraces(request).total, 9u);
+    EXPECT_EQ(partitioned.DeleteExpiredTracesBatch(cutoff_ms, 100), 2u);
+    EXPECT_EQ(partitioned.SearchTraces(request).total, 7u);
+
+    // 已删分区时间段里的迟到数据不再把分区文件建回来，落主库等批量删除。
+    persistence::TraceSummary late = MakeSummary("999");
+    late.start_time_ms = hour0_ms + 3 * kHourMs;
+    ASSERT_TRUE(partitioned.SavePrimaryBatch({late}, {MakeSpan(late.trace_id, "1", "")}));
+    EXPECT_EQ(partitioned.PartitionNames().size(), 7u);
+    EXPECT_EQ(QueryCountAt(partitioned_path, "SELECT COUNT(*) FROM trace_summary;"), 1);
+
+    const SqliteTraceRepository::RuntimeStatsSnapshot stats = partitioned.SnapshotRuntimeStats();
+    EXPECT_EQ(stats.partitions, 7u);
+    EXPECT_EQ(stats.dropped_partitions, 5u);
+    EXPECT_GT(stats.partition_attaches, 12u);
+    std::filesystem::remove_all(dir);
+}
+
+TEST_F(SqliteTraceRepositoryTest, KeysetCursorPagesInSortOrderAndTotalsFollowHourlyCounters)
+{
+    constexpr int64_t kHourMs = 60LL * 60 * 1000;
+    const int64_t hour0_ms = 19792LL * 24 * kHourMs;
+    // 三个小时、每小时 4 条，每两条共用同一个 start_time_ms，验证游标在时间相同时按 trace_id 继续往下走。
+    std::vector<persistence::TraceSummary> summaries;
+    for (int index = 0; index < 12; ++index) {
+        persistence::TraceSummary summary = MakeSummary(std::to_string(300 + index));
+        summary.service_name = index % 3 == 0 ? "checkout" : "service";
+        summary.start_time_ms = hour0_ms + (index / 4) * kHourMs + (index % 4) / 2 * 1000;
+        summaries.push_back(summary);
+    }
+    ASSERT_TRUE(repo->SavePrimaryBatch(summaries, {}));
+
+    TraceSearchRequest request;
+    request.page_size = 100;
+    const TraceSearchResult all = repo->SearchTraces(request);
+    ASSERT_EQ(all.items.size(), 12u);
+    EXPECT_FALSE(all.next_cursor.has_value());
+
+    request.page_size = 5;
+    std::vector<std::string> walked;
+    TraceSearchResult page = repo->SearchTraces(request);
+    EXPECT_EQ(page.total, 12u);
+    EXPECT_FALSE(page.total_is_approximate);
+    while (true) {
+        for (const auto& item : page.items) {
+            walked.push_back(item.trace_id);
+        }
+        if (!page.next_cursor.has_value()) {
+            break;
+        }
+        request.cursor = page.next_cursor;
+        page = repo->SearchTraces(request);
+        // 游标模式下总数照样返回，还是整个过滤条件下的总数。
+        EXPECT_EQ(page.total, 12u);
+    }
+    ASSERT_EQ(walked.size(), all.items.size());
+    for (size_t index = 0; index < walked.size(); ++index) {
+        EXPECT_EQ(walked[index], all.items[index].trace_id);
+    }
+
+    // 时间窗两头都不在整点上：整小时走计数表，边角走精确 COUNT，结果和逐条数出来的一样。
+    TraceSearchRequest window;
+    window.start_time_ms = hour0_ms + 1000;
+    window.end_time_ms = hour0_ms + 2 * kHourMs + 1000;
+    EXPECT_EQ(repo->SearchTraces(window).total, 8u);
+    window.service_name = "checkout";
+    EXPECT_EQ(repo->SearchTraces(window).total, 3u);
+
+    // 删除和 AI 回写改风险等级都由触发器同步到计数表。
+    ASSERT_TRUE(repo->DeleteTraceById("304"));
+    ASSERT_TRUE(repo->SaveAnalysisBatch({MakeAnalysis("305"), MakeAnalysis("306")}));
+    TraceSearchRequest risk;
+    risk.risk_levels = {"warning"};
+    EXPECT_EQ(repo->SearchTraces(risk).total, 2u);
+    risk.risk_levels = {"unknown"};
+    EXPECT_EQ(repo->SearchTraces(risk).total, 9u);
+    EXPECT_EQ(QueryCount("SELECT SUM(trace_count) FROM trace_summary_hourly_counts;"), 11);
+    EXPECT_EQ(QueryCount("SELECT COUNT(*) FROM trace_summary_hourly_counts WHERE trace_count <= 0;"), 0);
+}
+
+TEST_F(SqliteTraceRepositoryTest, HourlyCountersAreBackfilledForDatabasesCreatedWithoutThem)
+{
+    for (int index = 0; index < 5; ++index) {
+        persistence::TraceSummary summary = MakeSummary(std::to_string(400 + index));
+        summary.start_time_ms = 1000 + index * 60LL * 60 * 1000;
+        ASSERT_TRUE(repo->SaveSingleTraceAtomic(summary, {}, nullptr));
+    }
+    repo.reset();
+
+    // 模拟升级前的库：没有计数表和触发器。
+    sqlite3* db = nullptr;
+    ASSERT_EQ(sqlite3_open(db_path.c_str(), &db), SQLITE_OK);
+    ASSERT_EQ(sqlite3_exec(db,
+                           "DROP TRIGGER trg_trace_summary_count_insert;"
+                           "DROP TRIGGER trg_trace_summary_count_delete;"
+                           "DROP TRIGGER trg_trace_summary_count_update;"
+                           "DROP TABLE trace_summary_hourly_counts;",
+                           nullptr,
+                           nullptr,
+                           nullptr),
+              SQLITE_OK);
+    sqlite3_close(db);
+
+    repo = std::make_unique<SqliteTraceRepository>(db_path);
+    EXPECT_EQ(QueryCount("SELECT SUM(trace_count) FROM trace_summary_hourly_counts;"), 5);
+    EXPECT_EQ(repo->SearchTraces(TraceSearchRequest{}).total, 5u);
+    // 回填之后的新写入由触发器继续记账，不会重复计数。
+    ASSERT_TRUE(repo->SaveSingleTraceAtomic(MakeSummary("405"), {}, nullptr));
+    EXPECT_EQ(repo->SearchTraces(TraceSearchRequest{}).total, 6u);
+}
+
+TEST_F(SqliteTraceRepositoryTest, DenseEdgeHourTotalIsApproximatedWhilePagingStaysExact)
+{
+    constexpr int64_t kHourMs = 60LL * 60 * 1000;
+    const int64_t hour0_ms = 19792LL * 24 * kHourMs;
+    // 一个小时里塞 12000 条，均匀铺满整小时，超过边角精确 COUNT 的上限。
+    std::vector<persistence::TraceSummary> summaries;
+    summaries.reserve(12000);
+    for (int index = 0; index < 12000; ++index) {
+        persistence::TraceSummary summary = MakeSummary(std::to_string(10000 + index));
+        summary.start_time_ms = hour0_ms + index * 300;
+        summaries.push_back(std::move(summary));
+    }
+    ASSERT_TRUE(repo->SavePrimaryBatch(summaries, {}));
+
+    // 时间窗只覆盖这个小时的后一半：总数按时长比例折算，误差在一条以内。
+    TraceSearchRequest request;
+    request.start_time_ms = hour0_ms + kHourMs / 2;
+    request.end_time_ms = hour0_ms + 2 * kHourMs;
+    request.page_size = 100;
+    TraceSearchResult first_page = repo->SearchTraces(request);
+    EXPECT_TRUE(first_page.total_is_approximate);
+    EXPECT_NEAR(static_cast<double>(first_page.total), 6000.0, 1.0);
+    ASSERT_EQ(first_page.items.size(), 100u);
+    EXPECT_EQ(first_page.items.front().trace_id, "21999");
+    ASSERT_TRUE(first_page.next_cursor.has_value());
+
+    // 深页码照样精确落位；游标翻到的第二页和页码第二页一致。
+    request.page = 60;
+    TraceSearchResult last_page = repo->SearchTraces(request);
+    ASSERT_EQ(last_page.items.size(), 100u);
+    EXPECT_EQ(last_page.items.back().trace_id, "16000");
+    request.page = 2;
+    TraceSearchResult second_page = repo->SearchTraces(request);
+    request.page = 1;
+    request.cursor = first_page.next_cursor;
+    TraceSearchResult cursor_page = repo->SearchTraces(request);
+    ASSERT_EQ(cursor_page.items.size(), second_page.items.size());
+    EXPECT_EQ(cursor_page.items.front().trace_id, second_page.items.front().trace_id);
+    EXPECT_EQ(cursor_page.items.back().trace_id, second_page.items.back().trace_id);
 }
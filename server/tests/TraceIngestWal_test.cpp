@@ -0,0 +1,221 @@
+#include <filesystem>
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+
+#include "core/TraceIngestWal.h"
+#include "core/TraceSessionManager.h"
+
+class TraceIngestWalTest : public ::testing::Test
+{
+protected:
+    void SetUp() override
+    {
+        wal_dir_ = "./test_trace_ingest_wal.d";
+        std::filesystem::remove_all(wal_dir_);
+    }
+
+    void TearDown() override
+    {
+        std::filesystem::remove_all(wal_dir_);
+    }
+
+    TraceIngestWal::Options MakeOptions(uint64_t segment_bytes = 64 * 1024 * 1024)
+    {
+        TraceIngestWal::Options options;
+        options.dir = wal_dir_;
+        options.segment_bytes = segment_bytes;
+        // 间隔拉长，测试里的落盘时机全部由显式 Sync 决定。
+        options.sync_interval_ms = 60000;
+        return options;
+    }
+
+    SpanEvent MakeSpan(size_t trace_key, size_t span_id)
+    {
+        SpanEvent span;
+        span.trace_key = trace_key;
+        span.span_id = span_id;
+        span.start_time_ms = 1710000000000 + static_cast<int64_t>(span_id);
+        span.name = "GET /inventory";
+        span.service_name = "inventory-service";
+        return span;
+    }
+
+    size_t SegmentFileCount() const
+    {
+        size_t count = 0;
+        for (const auto& entry : std::filesystem::directory_iterator(wal_dir_))
+        {
+            count += entry.path().extension() == ".wal" ? 1 : 0;
+        }
+        return count;
+    }
+
+    std::string wal_dir_;
+};
+
+TEST_F(TraceIngestWalTest, UnreleasedSpansSurviveRestartWithAllFieldsAndReleasedTracesAreSkipped)
+{
+    {
+        TraceIngestWal wal(MakeOptions());
+        SpanEvent root = MakeSpan(101, 1);
+        root.end_time = root.start_time_ms + 40;
+        root.status = SpanEvent::Status::Error;
+        root.kind = SpanEvent::Kind::Server;
+        root.attributes["db.statement"] = "SELECT stock FROM inventory";
+        root.attributes["peer"] = "库存库";
+        wal.Append(root, true);
+        wal.Append(MakeSpan(202, 1), true);
+        SpanEvent child = MakeSpan(101, 2);
+        child.parent_span_id = 1;
+        child.trace_end = true;
+        wal.Append(child, false);
+
+        // 202 的主数据已经交给 SavePrimaryBatch：重启后不该再重放。
+        persistence::TraceSummary summary;
+        summary.trace_id = "202";
+        wal.ReleaseTraces({summary});
+        ASSERT_TRUE(wal.Sync());
+        // 模拟崩溃：101 既没释放，WAL 也没有任何正常收尾动作可以依赖。
+    }
+
+    TraceIngestWal reopened(MakeOptions());
+    const std::vector<SpanEvent> recovered = reopened.TakeRecoveredSpans();
+    ASSERT_EQ(recovered.size(), 2u);
+    EXPECT_EQ(recovered[0].trace_key, 101u);
+    EXPECT_EQ(recovered[0].span_id, 1u);
+    EXPECT_FALSE(recovered[0].parent_span_id.has_value());
+    EXPECT_EQ(recovered[0].end_time, std::optional<int64_t>(1710000000041));
+    EXPECT_EQ(recovered[0].status, std::optional<SpanEvent::Status>(SpanEvent::Status::Error));
+    EXPECT_EQ(recovered[0].kind, std::optional<SpanEvent::Kind>(SpanEvent::Kind::Server));
+    EXPECT_EQ(recovered[0].attributes.at("peer"), "库存库");
+    EXPECT_EQ(recovered[0].attributes.at("db.statement"), "SELECT stock FROM inventory");
+    EXPECT_EQ(recovered[1].parent_span_id, std::optional<size_t>(1));
+    EXPECT_EQ(recovered[1].trace_end, std::optional<bool>(true));
+    EXPECT_FALSE(recovered[1].end_time.has_value());
+    EXPECT_EQ(reopened.SnapshotStats().recovered_skipped_spans, 1u);
+
+    // 重放进新段并落盘之后，旧段才删；目录里只剩本次启动的段。
+    reopened.Append(recovered[0], true);
+    reopened.Append(recovered[1], false);
+    ASSERT_TRUE(reopened.Sync());
+    reopened.DropRecoveredSegments();
+    EXPECT_EQ(SegmentFileCount(), 1u);
+}
+
+TEST_F(TraceIngestWalTest, SegmentsRollAndAreDeletedOnlyAfterEveryPinnedTraceIsReleased)
+{
+    // 段上限压到只装得下一两条记录；一轮 group commit 整块写进同一段，每条 trace 单独 Sync 一次逼出多段。
+    TraceIngestWal wal(MakeOptions(/*segment_bytes*/128));
+    for (size_t trace_key = 1; trace_key <= 4; ++trace_key)
+    {
+        wal.Append(MakeSpan(trace_key, 1), true);
+        wal.Append(MakeSpan(trace_key, 2), false);
+        ASSERT_TRUE(wal.Sync());
+    }
+    const size_t rolled_segments = SegmentFileCount();
+    ASSERT_GE(rolled_segments, 4u);
+    EXPECT_EQ(wal.SnapshotStats().pinned_traces, 4u);
+
+    // 先释放后面的 trace：最老的段还被 1 钉着，一个段都不能删（释放标记自己可能切出新段，文件只多不少）。
+    wal.ReleaseTrace(3);
+    wal.ReleaseTrace(4);
+    ASSERT_TRUE(wal.Sync());
+    EXPECT_GE(SegmentFileCount(), rolled_segments);
+    EXPECT_EQ(wal.SnapshotStats().deleted_segments, 0u);
+
+    wal.ReleaseTrace(1);
+    wal.ReleaseTrace(2);
+    ASSERT_TRUE(wal.Sync());
+    // 全部解钉后只剩写盘线程正开着的当前段。
+    EXPECT_EQ(SegmentFileCount(), 1u);
+    const TraceIngestWal::Stats stats = wal.SnapshotStats();
+    EXPECT_EQ(stats.pinned_traces, 0u);
+    EXPECT_EQ(stats.live_segments, 1u);
+    // 释放标记本身也可能把当前段写满、切出新段，所以旧段至少删掉 rolled_segments - 1 个。
+    EXPECT_GE(stats.deleted_segments, rolled_segments - 1);
+    EXPECT_EQ(stats.appended_spans, 8u);
+    EXPECT_EQ(stats.released_traces, 4u);
+}
+
+TEST_F(TraceIngestWalTest, TornTailStopsReplayAtTheLastCompleteRecord)
+{
+    {
+        TraceIngestWal wal(MakeOptions());
+        wal.Append(MakeSpan(7, 1), true);
+        wal.Append(MakeSpan(7, 2), false);
+        ASSERT_TRUE(wal.Sync());
+    }
+    // 模拟最后一次 group commit 只写了一半。
+    std::filesystem::path segment;
+    for (const auto& entry : std::filesystem::directory_iterator(wal_dir_))
+    {
+        segment = entry.path();
+    }
+    std::filesystem::resize_file(segment, std::filesystem::file_size(segment) - 3);
+
+    TraceIngestWal reopened(MakeOptions());
+    const std::vector<SpanEvent> recovered = reopened.TakeRecoveredSpans();
+    ASSERT_EQ(recovered.size(), 1u);
+    EXPECT_EQ(recovered[0].span_id, 1u);
+    // 只能取一次，避免同一批 span 被重放两遍。
+    EXPECT_TRUE(reopened.TakeRecoveredSpans().empty());
+}
+
+TEST_F(TraceIngestWalTest, FailedSyncReportsFailureAndRetriesTheSameRecordsInANewSegment)
+{
+    TraceIngestWal wal(MakeOptions(/*segment_bytes*/128));
+    wal.Append(MakeSpan(1, 1), true);
+    ASSERT_TRUE(wal.Sync());
+
+    // 目录被删：下一轮要切新段（当前段装不下），新段建不出来，这一轮写盘失败，Sync 必须如实返回 false。
+    std::filesystem::remove_all(wal_dir_);
+    wal.Append(MakeSpan(2, 1), true);
+    wal.Append(MakeSpan(2, 2), false);
+    EXPECT_FALSE(wal.Sync());
+    TraceIngestWal::Stats stats = wal.SnapshotStats();
+    EXPECT_GE(stats.sync_fail_count, 1u);
+    EXPECT_GT(stats.backlog_bytes, 0u);
+
+    // 磁盘恢复后，积压的记录原样写进新段，不需要调用方重新追加。
+    std::filesystem::create_directories(wal_dir_);
+    EXPECT_TRUE(wal.Sync());
+    stats = wal.SnapshotStats();
+    EXPECT_EQ(stats.backlog_bytes, 0u);
+    EXPECT_EQ(stats.dropped_bytes, 0u);
+
+    TraceIngestWal reopened(MakeOptions());
+    const std::vector<SpanEvent> recovered = reopened.TakeRecoveredSpans();
+    ASSERT_EQ(recovered.size(), 2u);
+    EXPECT_EQ(recovered[0].trace_key, 2u);
+    EXPECT_EQ(recovered[1].span_id, 2u);
+}
+
+TEST_F(TraceIngestWalTest, ReplayKeepsRecoveredSegmentsUntilEverySpanIsAccepted)
+{
+    {
+        TraceIngestWal wal(MakeOptions());
+        wal.Append(MakeSpan(5, 1), true);
+        wal.Append(MakeSpan(5, 2), false);
+        ASSERT_TRUE(wal.Sync());
+    }
+
+    {
+        // 没有线程池的 manager 拒收一切（RejectedUnavailable）：重放只能等着重试，关停时放弃，旧段不能删。
+        TraceIngestWal reopened(MakeOptions());
+        TraceSessionManager manager(nullptr, nullptr, nullptr, /*capacity*/10, /*token_limit*/0);
+        int polls = 0;
+        const TraceIngestWal::ReplayResult result =
+            reopened.ReplayRecovered(manager, /*chunk_spans*/1, /*retry_delay_ms*/1, [&polls]() { return ++polls > 3; });
+        EXPECT_EQ(result.recovered_spans, 2u);
+        EXPECT_EQ(result.accepted_spans, 0u);
+        EXPECT_GE(result.retries, 1u);
+        EXPECT_FALSE(result.segments_dropped);
+    }
+
+    // 旧段还在，下次启动照样能把两个 span 读回来。
+    TraceIngestWal again(MakeOptions());
+    const std::vector<SpanEvent> recovered = again.TakeRecoveredSpans();
+    ASSERT_EQ(recovered.size(), 2u);
+    EXPECT_EQ(recovered[0].trace_key, 5u);
+}
@@ -115,19 +115,19 @@ TEST_F(TraceRetentionServiceTest, StartupCleanupDeletesExpiredTracesWithinBatchB
     ThreadPool query_tpool(1);
     const int64_t now_ms = 10LL * 24 * 60 * 60 * 1000;
 
-    auto old_a = MakeSummary("old-a", 1000, 2000);
-    auto old_b = MakeSummary("old-b", 3000, 4000);
-    auto old_c = MakeSummary("old-c", 5000, 6000);
-    auto fresh = MakeSummary("fresh", now_ms - 2LL * 24 * 60 * 60 * 1000, now_ms - 2LL * 24 * 60 * 60 * 1000 + 100);
+    auto old_a = MakeSummary("1", 1000, 2000);
+    auto old_b = MakeSummary("2", 3000, 4000);
+    auto old_c = MakeSummary("3", 5000, 6000);
+    auto fresh = MakeSummary("4", now_ms - 2LL * 24 * 60 * 60 * 1000, now_ms - 2LL * 24 * 60 * 60 * 1000 + 100);
     auto old_a_analysis = MakeAnalysis(old_a.trace_id);
     auto old_b_analysis = MakeAnalysis(old_b.trace_id);
     auto old_c_analysis = MakeAnalysis(old_c.trace_id);
     auto fresh_analysis = MakeAnalysis(fresh.trace_id);
 
-    ASSERT_TRUE(repo.SaveSingleTraceAtomic(old_a, {MakeSpan(old_a.trace_id, "span-old-a")}, &old_a_analysis));
-    ASSERT_TRUE(repo.SaveSingleTraceAtomic(old_b, {MakeSpan(old_b.trace_id, "span-old-b")}, &old_b_analysis));
-    ASSERT_TRUE(repo.SaveSingleTraceAtomic(old_c, {MakeSpan(old_c.trace_id, "span-old-c")}, &old_c_analysis));
-    ASSERT_TRUE(repo.SaveSingleTraceAtomic(fresh, {MakeSpan(fresh.trace_id, "span-fresh")}, &fresh_analysis));
+    ASSERT_TRUE(repo.SaveSingleTraceAtomic(old_a, {MakeSpan(old_a.trace_id, "11")}, &old_a_analysis));
+    ASSERT_TRUE(repo.SaveSingleTraceAtomic(old_b, {MakeSpan(old_b.trace_id, "12")}, &old_b_analysis));
+    ASSERT_TRUE(repo.SaveSingleTraceAtomic(old_c, {MakeSpan(old_c.trace_id, "13")}, &old_c_analysis));
+    ASSERT_TRUE(repo.SaveSingleTraceAtomic(fresh, {MakeSpan(fresh.trace_id, "14")}, &fresh_analysis));
 
     TraceRetentionService::Config config;
     config.retention_days = 7;
@@ -155,10 +155,10 @@ TEST_F(TraceRetentionServiceTest, DisabledRetentionDoesNotScheduleCleanup)
     ThreadPool query_tpool(1);
     const int64_t now_ms = 10LL * 24 * 60 * 60 * 1000;
 
-    auto expired = MakeSummary("expired", 1000, 2000);
+    auto expired = MakeSummary("5", 1000, 2000);
     auto expired_analysis = MakeAnalysis(expired.trace_id);
     ASSERT_TRUE(repo.SaveSingleTraceAtomic(expired,
-                                           {MakeSpan(expired.trace_id, "span-expired")},
+                                           {MakeSpan(expired.trace_id, "15")},
                                            &expired_analysis));
 
     TraceRetentionService::Config config;
@@ -177,3 +177,45 @@ TEST_F(TraceRetentionServiceTest, DisabledRetentionDoesNotScheduleCleanup)
 
     query_tpool.shutdown();
 }
+
+TEST_F(TraceRetentionServiceTest, PartitionedRetentionDropsWholeExpiredPartitions)
+{
+    const std::filesystem::path dir = "./test_trace_retention_partitions";
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir);
+    const std::string partitioned_path = (dir / "traces.db").string();
+    constexpr int64_t kDayMs = 24LL * 60 * 60 * 1000;
+    const int64_t now_ms = 20 * kDayMs;
+
+    SqliteTraceRepository repo(partitioned_path, 0, TracePartitionMode::Day);
+    ThreadPool query_tpool(1);
+    auto old_a = MakeSummary("1", kDayMs + 1000, kDayMs + 2000);
+    auto old_b = MakeSummary("2", 2 * kDayMs + 1000, 2 * kDayMs + 2000);
+    auto fresh = MakeSummary("3", now_ms - kDayMs, now_ms - kDayMs + 100);
+    ASSERT_TRUE(repo.SavePrimaryBatch({old_a, old_b, fresh},
+                                      {MakeSpan(old_a.trace_id, "11"),
+                                       MakeSpan(old_b.trace_id, "12"),
+                                       MakeSpan(fresh.trace_id, "13")}));
+    ASSERT_EQ(repo.PartitionNames().size(), 3u);
+
+    TraceRetentionService::Config config;
+    config.retention_days = 7;
+    config.batch_size = 1;
+    config.max_batches_per_run = 1;
+    auto service = std::make_shared<TraceRetentionService>(
+        &repo, &query_tpool, config, [now_ms]() { return now_ms; });
+
+    // 分区删除不受批次预算限制：一次清理就把整天过期的分区都删掉，不再逐条 DELETE。
+    service->TriggerStartupCleanup();
+
+    // 分区目录先摘、文件后删，所以等到文件真正消失再断言。
+    ASSERT_TRUE(WaitUntil([&partitioned_path]() {
+        return !std::filesystem::exists(partitioned_path + ".p19700102") &&
+               !std::filesystem::exists(partitioned_path + ".p19700103");
+    }));
+    EXPECT_EQ(repo.PartitionNames().size(), 1u);
+    EXPECT_EQ(repo.SearchTraces(TraceSearchRequest{}).total, 1u);
+
+    query_tpool.shutdown();
+    std::filesystem::remove_all(dir);
+}
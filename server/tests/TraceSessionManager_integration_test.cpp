@@ -493,7 +493,7 @@ TEST_F(TraceSessionManagerIntegrationTest, BufferedRepositoryDestructorDrainsRem
             return manager.SnapshotRuntimeStats().worker_done_count >= 1;
         }, std::chrono::seconds(2)));
 
-        // 这里必须还是 0，才能证明后面查到的数据来自 StopFlushThread 的 drain，而不是时间到自动刷盘。
+        // 这里必须还是 0，才能证明后面查到的数据来自 StopFlushThreads 的 drain，而不是时间到自动刷盘。
         EXPECT_EQ(QueryCount("SELECT COUNT(*) FROM trace_summary;"), 0);
         EXPECT_EQ(QueryCount("SELECT COUNT(*) FROM trace_span;"), 0);
         EXPECT_EQ(QueryCount("SELECT COUNT(*) FROM trace_analysis;"), 0);
@@ -1,7 +1,10 @@
 #include <gtest/gtest.h>
 
+#include <algorithm>
 #include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <filesystem>
 #include <functional>
 #include <mutex>
 #include <optional>
@@ -9,16 +12,18 @@
 #include <stdexcept>
 #include <string>
 #include <thread>
+#include <unordered_map>
 #include <vector>
 
 #include "ai/TraceAiProvider.h"
 #include "ai/TraceProxyProtocol.h"
 #define private public
 #include "core/TraceSessionManager.h"
+#include "persistence/BufferedTraceRepository.h"
 #undef private
 #include "notification/INotifier.h"
 #include "core/SystemRuntimeAccumulator.h"
-#include "persistence/BufferedTraceRepository.h"
+#include "core/TraceIngestWal.h"
 #include "persistence/TraceRepository.h"
 #include "core/TokenEstimator.h"
 #include "threadpool/ThreadPool.h"
@@ -59,6 +64,15 @@ public:
     std::optional<TraceAnalysisRecord> last_analysis;
     std::string last_ai_status;
     std::string last_ai_error;
+    // 每条落库 analysis 要回写到 summary 的 ai_status，按落库顺序记下；缓存用例靠它区分真调用和缓存复用。
+    std::vector<std::string> saved_analysis_statuses;
+    mutable std::mutex saved_analysis_statuses_mutex;
+
+    std::vector<std::string> SavedAnalysisStatuses() const
+    {
+        std::lock_guard<std::mutex> lock(saved_analysis_statuses_mutex);
+        return saved_analysis_statuses;
+    }
 
     bool SaveSingleTraceSummary(const TraceSummary& summary) override
     {
@@ -113,6 +127,12 @@ public:
     {
         if (!analyses.empty()) {
             last_analysis = analyses.back();
+            {
+                std::lock_guard<std::mutex> lock(saved_analysis_statuses_mutex);
+                for (const auto& analysis : analyses) {
+                    saved_analysis_statuses.push_back(analysis.ai_status);
+                }
+            }
             save_analysis_called.store(true, std::memory_order_release);
             save_analysis_count.fetch_add(static_cast<int>(analyses.size()), std::memory_order_acq_rel);
         }
@@ -153,6 +173,76 @@ public:
         }
         return true;
     }
+
+    // 模拟“崩溃前已经分析过”的 trace：只在测试开始前填好，之后只读。
+    std::set<std::string> analyzed_trace_ids;
+
+    bool HasTraceAnalysis(const std::string& trace_id) override
+    {
+        return analyzed_trace_ids.count(trace_id) > 0;
+    }
+};
+
+// 按调用顺序记录 primary / analysis 落库，并且可以把写入卡在 sink 里，
+// 用来验证两条 flush 线程之间的写锁调度和外键屏障，而不是靠 sleep 猜时序。
+class GatedRecordingTraceRepository : public FakeTraceRepository
+{
+public:
+    // 置位后照常记录调用，但直接返回 false，模拟 SQLite 写失败（BUSY / 磁盘满）。
+    std::atomic<bool> fail{false};
+
+    bool SavePrimaryBatch(const std::vector<TraceSummary>& summaries,
+                          const std::vector<TraceSpanRecord>& spans) override
+    {
+        EnterAndWaitForGate(summaries.empty() ? "P" : "P:" + summaries.front().trace_id);
+        if (fail.load(std::memory_order_acquire)) {
+            return false;
+        }
+        return FakeTraceRepository::SavePrimaryBatch(summaries, spans);
+    }
+
+    bool SaveAnalysisBatch(const std::vector<TraceAnalysisRecord>& analyses) override
+    {
+        EnterAndWaitForGate(analyses.empty() ? "A" : "A:" + analyses.front().trace_id);
+        if (fail.load(std::memory_order_acquire)) {
+            return false;
+        }
+        return FakeTraceRepository::SaveAnalysisBatch(analyses);
+    }
+
+    void CloseGate()
+    {
+        std::lock_guard<std::mutex> lock(gate_mutex_);
+        gate_open_ = false;
+    }
+
+    void OpenGate()
+    {
+        {
+            std::lock_guard<std::mutex> lock(gate_mutex_);
+            gate_open_ = true;
+        }
+        gate_cv_.notify_all();
+    }
+
+    std::vector<std::string> Calls() const
+    {
+        std::lock_guard<std::mutex> lock(gate_mutex_);
+        return calls_;
+    }
+
+private:
+    void EnterAndWaitForGate(const std::string& call)
+    {
+        std::unique_lock<std::mutex> lock(gate_mutex_);
+        calls_.push_back(call);
+        gate_cv_.wait(lock, [this]() { return gate_open_; });
+    }
+
+    mutable std::mutex gate_mutex_;
+    std::condition_variable gate_cv_;
+    bool gate_open_ = true;
+    std::vector<std::string> calls_;
 };
 
 // 用 StubAi 固定返回值，目的是稳定覆盖 critical/non-critical 分支，避免单测受网络和模型波动影响。
@@ -195,6 +285,74 @@ public:
     }
 };
 
+// AsyncStubTraceAi 模拟真正的异步 provider：AnalyzeTraceAsync 只把回调攒起来立即返回，
+// 由测试线程决定什么时候、以成功还是失败完成，用来锁定“AI 在途期间 worker 不被占住”的语义。
+class AsyncStubTraceAi : public TraceAiProvider
+{
+public:
+    TraceAiResponse response{
+        .analysis =
+            LogAnalysisResult{
+                .summary = "async-summary",
+                .risk_level = RiskLevel::WARNING,
+                .root_cause = "async-root-cause",
+                .solution = "async-solution",
+            },
+        .usage = std::nullopt,
+    };
+    std::atomic<int> sync_called_count{0};
+
+    TraceAiResponse AnalyzeTrace(const std::string&) override
+    {
+        sync_called_count.fetch_add(1, std::memory_order_acq_rel);
+        return response;
+    }
+
+    bool SupportsAsync() const override
+    {
+        return true;
+    }
+
+    void AnalyzeTraceAsync(const std::string&, TraceAiCallback callback) override
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending.push_back(std::move(callback));
+    }
+
+    size_t PendingCount()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return pending.size();
+    }
+
+    // 在独立线程里完成全部挂起请求，模拟 provider 自己的 IO loop 回调；返回这条“loop 线程”的 id。
+    std::thread::id CompleteAll(bool fail)
+    {
+        std::vector<TraceAiCallback> callbacks;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            callbacks.swap(pending);
+        }
+        std::thread loop([&callbacks, fail, this]() {
+            for (TraceAiCallback& callback : callbacks) {
+                if (fail) {
+                    callback(TraceAiResponse{},
+                             std::make_exception_ptr(std::runtime_error("async primary failed")));
+                } else {
+                    callback(response, nullptr);
+                }
+            }
+        });
+        const std::thread::id loop_id = loop.get_id();
+        loop.join();
+        return loop_id;
+    }
+
+private:
+    std::mutex mutex;
+    std::vector<TraceAiCallback> pending;
+};
+
 // 用 SpyNotifier 只记录是否触发通知以及最后一次事件，目的是验证“何时通知”而不是测试 webhook 发送细节。
 class SpyNotifier : public INotifier
 {
@@ -204,6 +362,7 @@ public:
     std::string last_trace_id;
     nlohmann::json last_content;
     TraceAlertEvent last_event;
+    std::thread::id alert_thread;
 
     void notify(const std::string& trace_id, const nlohmann::json& content) override
     {
@@ -215,9 +374,96 @@ public:
     void notifyTraceAlert(const TraceAlertEvent& event) override
     {
         last_event = event;
+        alert_thread = std::this_thread::get_id();
         notify_trace_alert_called.store(true, std::memory_order_release);
     }
 };
+
+// 改成扁平索引和流式写出之前的 DOM 版本，原样留作对照：新实现必须和它逐字节一致。
+std::string SerializeTraceWithDom(const TraceSession& session)
+{
+    // 索引也按原来的哈希表版本现建一份，这样对照的是整条“建索引 + 序列化”链路。
+    std::unordered_map<size_t, const SpanEvent*> span_map;
+    std::unordered_map<size_t, std::vector<size_t>> children;
+    std::vector<size_t> roots;
+    for (const auto& span : session.spans) {
+        span_map[span.span_id] = &span;
+    }
+    for (const auto& span : session.spans) {
+        if (span.parent_span_id.has_value() && span_map.count(span.parent_span_id.value()) > 0) {
+            children[span.parent_span_id.value()].push_back(span.span_id);
+            continue;
+        }
+        roots.push_back(span.span_id);
+    }
+
+    nlohmann::json output;
+    std::set<size_t> visited;
+    std::vector<size_t> cycle_spans;
+    auto build_node = [&](size_t span_id, const auto& self_ref) -> nlohmann::json {
+        nlohmann::json node;
+        if (!visited.insert(span_id).second) {
+            cycle_spans.push_back(span_id);
+            return node;
+        }
+        auto span_iter = span_map.find(span_id);
+        if (span_iter == span_map.end()) {
+            return node;
+        }
+        const SpanEvent& span = *span_iter->second;
+        static const char* kStatus[] = {"UNSET", "OK", "ERROR"};
+        static const char* kKind[] = {"INTERNAL", "SERVER", "CLIENT", "PRODUCER", "CONSUMER"};
+        node["trace_id"] = span.trace_key;
+        node["span_id"] = span.span_id;
+        node["parent_id"] = span.parent_span_id.has_value() ? nlohmann::json(span.parent_span_id.value())
+                                                            : nlohmann::json(nullptr);
+        node["name"] = span.name;
+        node["service_name"] = span.service_name;
+        node["start_time_ms"] = span.start_time_ms;
+        node["end_time_ms"] = span.end_time.has_value() ? nlohmann::json(span.end_time.value())
+                                                        : nlohmann::json(nullptr);
+        node["status"] = span.status.has_value() ? nlohmann::json(kStatus[static_cast<int>(span.status.value())])
+                                                 : nlohmann::json(nullptr);
+        node["kind"] = span.kind.has_value() ? nlohmann::json(kKind[static_cast<int>(span.kind.value())])
+                                             : nlohmann::json(nullptr);
+        node["attributes"] = span.attributes;
+        node["children"] = nlohmann::json::array();
+        auto child_iter = children.find(span_id);
+        if (child_iter != children.end()) {
+            std::vector<size_t> ordered_children = child_iter->second;
+            std::sort(ordered_children.begin(), ordered_children.end(), [&span_map](size_t left, size_t right) {
+                const SpanEvent& left_span = *span_map.at(left);
+                const SpanEvent& right_span = *span_map.at(right);
+                if (left_span.start_time_ms != right_span.start_time_ms) {
+                    return left_span.start_time_ms < right_span.start_time_ms;
+                }
+                return left_span.span_id < right_span.span_id;
+            });
+            for (size_t child_id : ordered_children) {
+                nlohmann::json child_node = self_ref(child_id, self_ref);
+                if (!child_node.is_null() && !child_node.empty()) {
+                    node["children"].push_back(std::move(child_node));
+                }
+            }
+        }
+        return node;
+    };
+    output["spans"] = nlohmann::json::array();
+    for (size_t root_id : roots) {
+        nlohmann::json root_node = build_node(root_id, build_node);
+        if (!root_node.is_null() && !root_node.empty()) {
+            output["spans"].push_back(std::move(root_node));
+        }
+    }
+    if (!cycle_spans.empty()) {
+        nlohmann::json anomalies = nlohmann::json::array();
+        for (size_t span_id : cycle_spans) {
+            anomalies.push_back({{"type", "cycle_detected"}, {"span_id", span_id}});
+        }
+        output["anomalies"] = std::move(anomalies);
+    }
+    return output.dump();
+}
 } // namespace
 
 TEST(TraceProxyProtocolTest, ParsesSuccessfulTraceResponseWithUsage)
@@ -305,17 +551,17 @@ protected:
         // dispatch 线程改造后，sweep 返回并不等于“session 已经同步回滚完成”。
         // 所以测试里如果要看 ReadyRetryLater / retry_count 这类状态，必须等回滚线程把 session 真正放回 manager。
         return WaitUntil([&manager, trace_key, &predicate]() {
-            auto iter = manager.index_by_trace_.find(trace_key);
-            if (iter == manager.index_by_trace_.end()) {
+            auto iter = manager.shards_[0]->index_by_trace_.find(trace_key);
+            if (iter == manager.shards_[0]->index_by_trace_.end()) {
                 return false;
             }
-            if (iter->second >= manager.sessions_.size()) {
+            if (iter->second >= manager.shards_[0]->sessions_.size()) {
                 return false;
             }
-            if (!manager.sessions_[iter->second]) {
+            if (!manager.shards_[0]->sessions_[iter->second]) {
                 return false;
             }
-            return predicate(*manager.sessions_[iter->second]);
+            return predicate(*manager.shards_[0]->sessions_[iter->second]);
         }, timeout_ms);
     }
 
@@ -327,6 +573,66 @@ protected:
         manager.SweepExpiredSessions(now_ms, idle_timeout_ms, max_dispatch_per_tick);
     }
 
+    // 结构指纹缓存用例共用的构造：异步派发打开，缓存容量/TTL 由用例指定，其余参数保持生产默认。
+    std::unique_ptr<TraceSessionManager> MakeCachingManager(ThreadPool* pool,
+                                                            BufferedTraceRepository* buffered_repo,
+                                                            TraceAiProvider* trace_ai,
+                                                            SystemRuntimeAccumulator* system_runtime_accumulator,
+                                                            size_t cache_capacity,
+                                                            int64_t cache_ttl_ms = 600000)
+    {
+        return std::make_unique<TraceSessionManager>(pool,
+                                                     buffered_repo,
+                                                     trace_ai,
+                                                     /*capacity*/10,
+                                                     /*token_limit*/0,
+                                                     /*notifier*/nullptr,
+                                                     /*idle_timeout_ms*/5000,
+                                                     /*wheel_tick_ms*/500,
+                                                     /*sealed_grace_window_ms*/1000,
+                                                     /*retry_base_delay_ms*/500,
+                                                     /*wheel_size*/512,
+                                                     /*buffered_span_hard_limit*/4096,
+                                                     /*active_session_hard_limit*/1024,
+                                                     /*active_session_overload_percent*/75,
+                                                     /*active_session_critical_percent*/90,
+                                                     /*buffered_spans_overload_percent*/75,
+                                                     /*buffered_spans_critical_percent*/90,
+                                                     /*pending_tasks_overload_percent*/75,
+                                                     /*pending_tasks_critical_percent*/90,
+                                                     /*service_runtime_accumulator*/nullptr,
+                                                     system_runtime_accumulator,
+                                                     /*ai_analysis_enabled*/true,
+                                                     /*ai_circuit_breaker_enabled*/true,
+                                                     /*ai_failure_threshold*/5,
+                                                     /*ai_cooldown_ms*/60000,
+                                                     /*fallback_trace_ai*/nullptr,
+                                                     /*ai_auto_degrade_enabled*/false,
+                                                     /*session_shard_count*/1,
+                                                     /*ai_async_dispatch_enabled*/true,
+                                                     cache_capacity,
+                                                     cache_ttl_ms);
+    }
+
+    // 两个 span 的小调用链：root(gateway) -> child(db)。同一 shape 下 trace_key/span_id 可以随便换。
+    void PushTwoSpanTrace(TraceSessionManager& manager, size_t trace_key, size_t first_span_id)
+    {
+        SpanEvent root = MakeSpan(trace_key, first_span_id, 1000);
+        root.service_name = "gateway";
+        root.name = "GET /orders";
+        root.end_time = 1040;
+        root.status = SpanEvent::Status::Ok;
+        SpanEvent child = MakeSpan(trace_key, first_span_id + 1, 1005);
+        child.parent_span_id = first_span_id;
+        child.service_name = "db";
+        child.name = "SELECT orders";
+        child.end_time = 1035;
+        child.status = SpanEvent::Status::Error;
+        child.trace_end = true;
+        ASSERT_EQ(manager.Push(root), TraceSessionManager::PushResult::Accepted);
+        ASSERT_EQ(manager.Push(child), TraceSessionManager::PushResult::Accepted);
+    }
+
     void SweepTraceEndSealWindow(TraceSessionManager& manager,
                                  int64_t idle_timeout_ms = 5000,
                                  size_t max_dispatch_per_tick = 8)
@@ -351,11 +657,11 @@ TEST_F(TraceSessionManagerUnitTest, PushSealsWhenTraceEndIsTrueAndDispatchesAfte
 
     ASSERT_EQ(manager.Push(span), TraceSessionManager::PushResult::Accepted);
     ASSERT_EQ(manager.size(), 1u);
-    auto iter = manager.index_by_trace_.find(11);
-    ASSERT_NE(iter, manager.index_by_trace_.end());
-    ASSERT_TRUE(manager.sessions_[iter->second] != nullptr);
-    EXPECT_EQ(manager.sessions_[iter->second]->lifecycle_state, TraceSession::LifecycleState::Sealed);
-    EXPECT_EQ(manager.sessions_[iter->second]->sealed_deadline_tick, 2u);
+    auto iter = manager.shards_[0]->index_by_trace_.find(11);
+    ASSERT_NE(iter, manager.shards_[0]->index_by_trace_.end());
+    ASSERT_TRUE(manager.shards_[0]->sessions_[iter->second] != nullptr);
+    EXPECT_EQ(manager.shards_[0]->sessions_[iter->second]->lifecycle_state, TraceSession::LifecycleState::Sealed);
+    EXPECT_EQ(manager.shards_[0]->sessions_[iter->second]->sealed_deadline_tick, 2u);
     EXPECT_FALSE(repo.save_atomic_called.load(std::memory_order_acquire));
 
     SweepOneTick(manager, /*now_ms*/1000);
@@ -422,6 +728,342 @@ TEST_F(TraceSessionManagerUnitTest, RuntimeStatsTrackDispatchWorkerAiEnqueueAndB
     pool.shutdown();
 }
 
+TEST_F(TraceSessionManagerUnitTest, BufferedAnalysisFlushWaitsForItsPrimaryInsteadOfPrimaryInterval)
+{
+    // 目的：analysis 有自己的 flush 线程和更短的间隔，但它依赖 trace_summary 外键，
+    // 所以必须排在自己的 primary 后面落库；同时也不能傻等 primary 的 60s 时间阈值，而是把 primary 提前催出来。
+    GatedRecordingTraceRepository repo;
+    BufferedTraceRepository::Config buffer_config;
+    buffer_config.primary_flush_interval_ms = 60 * 1000;
+    buffer_config.analysis_flush_interval_ms = 10;
+    auto sink = std::shared_ptr<TraceRepository>(&repo, [](TraceRepository*) {});
+    auto buffered_repo = std::make_unique<BufferedTraceRepository>(std::move(sink), buffer_config);
+
+    BufferedTraceRepository::TracePrimaryWrite primary;
+    primary.summary.trace_id = "920";
+    primary.spans.resize(1);
+    primary.spans.front().trace_id = "920";
+    ASSERT_TRUE(buffered_repo->AppendPrimary(std::move(primary)));
+    TraceRepository::TraceAnalysisRecord analysis;
+    analysis.trace_id = "920";
+    ASSERT_TRUE(buffered_repo->AppendAnalysis({analysis}));
+
+    ASSERT_TRUE(WaitUntil([&repo]() { return repo.Calls().size() == 2; }, 2000));
+    EXPECT_EQ(repo.Calls(), (std::vector<std::string>{"P:920", "A:920"}));
+}
+
+TEST_F(TraceSessionManagerUnitTest, BufferedWriterLockGoesToBufferOldestRelativeToItsInterval)
+{
+    // 目的：两条流水线同时等 SQLite 写锁时，按“等了几个自己的 flush 间隔”排优先级。
+    // 场景：P1 卡在 sink 里占着写锁；A0 已经超过 analysis 间隔好几倍，P2 刚满桶。
+    // P1 放行后即使 primary 线程马上回头申请写锁，也要让 A0 先写。
+    GatedRecordingTraceRepository repo;
+    BufferedTraceRepository::Config buffer_config;
+    buffer_config.primary_span_reserve = 1;
+    buffer_config.primary_flush_interval_ms = 60 * 1000;
+    buffer_config.analysis_flush_interval_ms = 100;
+    auto sink = std::shared_ptr<TraceRepository>(&repo, [](TraceRepository*) {});
+    auto buffered_repo = std::make_unique<BufferedTraceRepository>(std::move(sink), buffer_config);
+
+    auto append_primary = [&buffered_repo](const std::string& trace_id) {
+        BufferedTraceRepository::TracePrimaryWrite primary;
+        primary.summary.trace_id = trace_id;
+        primary.spans.resize(1);
+        primary.spans.front().trace_id = trace_id;
+        return buffered_repo->AppendPrimary(std::move(primary));
+    };
+
+    ASSERT_TRUE(append_primary("930"));
+    ASSERT_TRUE(WaitUntil([&repo]() { return repo.Calls().size() == 1; }, 2000));
+
+    repo.CloseGate();
+    TraceRepository::TraceAnalysisRecord analysis;
+    analysis.trace_id = "930";
+    ASSERT_TRUE(buffered_repo->AppendAnalysis({analysis}));
+    ASSERT_TRUE(append_primary("931"));
+    ASSERT_TRUE(WaitUntil([&repo]() { return repo.Calls().size() == 2; }, 2000));
+    // 让 A0 过了时间阈值、进入等写锁的状态，并且老化到 analysis 间隔的好几倍。
+    std::this_thread::sleep_for(std::chrono::milliseconds(400));
+    ASSERT_TRUE(append_primary("932"));
+    repo.OpenGate();
+
+    ASSERT_TRUE(WaitUntil([&repo]() { return repo.Calls().size() == 4; }, 2000));
+    EXPECT_EQ(repo.Calls(), (std::vector<std::string>{"P:930", "P:931", "A:930", "P:932"}));
+
+    const BufferedTraceRepository::RuntimeStatsSnapshot stats = buffered_repo->SnapshotRuntimeStats();
+    EXPECT_EQ(stats.primary_flush_calls, 3u);
+    EXPECT_EQ(stats.analysis_flush_calls, 1u);
+    EXPECT_GE(stats.analysis_queue_latency_max_ms, 400u);
+    EXPECT_EQ(stats.analysis_queue_latency_total_ms, stats.analysis_queue_latency_max_ms);
+    EXPECT_GE(stats.analysis_writer_wait_total_ns, 1u);
+    EXPECT_GE(stats.primary_writer_wait_total_ns, 1u);
+    EXPECT_GE(stats.primary_queue_latency_total_ms, stats.primary_queue_latency_max_ms);
+    EXPECT_NE(buffered_repo->DescribeRuntimeStats().find("analysis_queue_latency_max_ms="), std::string::npos);
+}
+
+TEST_F(TraceSessionManagerUnitTest, BufferedWriterGrantPicksOneOwnerWhenWaiterUrgenciesCross)
+{
+    // 目的：两条流水线的优先级会随时间交叉，写锁必须由一方用同一个时间点一次指派。
+    // 200ms 间隔的 primary 在 t=1000 入桶，500ms 间隔的 analysis 在 t=0 入桶：t=1666 还是 analysis 优先，t=1667 就换成 primary。
+    // 以前两个等待方被唤醒后各自拿 NowMs() 比较，primary 在 1666、analysis 在 1667 各看到对方优先，一起睡死，写锁空着没人拿。
+    FakeTraceRepository repo;
+    auto sink = std::shared_ptr<TraceRepository>(&repo, [](TraceRepository*) {});
+    BufferedTraceRepository buffered_repo(std::move(sink), BufferedTraceRepository::Config{});
+    using Pipeline = BufferedTraceRepository::Pipeline;
+
+    std::lock_guard<std::mutex> lock(buffered_repo.writer_mutex_);
+    auto& primary = buffered_repo.writer_requests_[static_cast<size_t>(Pipeline::Primary)];
+    auto& analysis = buffered_repo.writer_requests_[static_cast<size_t>(Pipeline::Analysis)];
+    primary.waiting = true;
+    primary.first_enqueue_ms = 1000;
+    analysis.waiting = true;
+    analysis.first_enqueue_ms = 0;
+    ASSERT_TRUE(buffered_repo.OtherPipelineHasPriorityLocked(Pipeline::Primary, 1666));
+    ASSERT_TRUE(buffered_repo.OtherPipelineHasPriorityLocked(Pipeline::Analysis, 1667));
+
+    buffered_repo.GrantWriterLocked(1666);
+    EXPECT_TRUE(analysis.granted);
+    EXPECT_FALSE(primary.granted);
+    EXPECT_TRUE(primary.waiting);
+    EXPECT_TRUE(buffered_repo.writer_busy_);
+
+    // 写锁被占着时不会再指派第二个持有者。
+    buffered_repo.GrantWriterLocked(1667);
+    EXPECT_FALSE(primary.granted);
+
+    // analysis 写完释放：剩下的 primary 立刻被指派，不依赖它自己醒来再比较。
+    analysis.granted = false;
+    buffered_repo.writer_busy_ = false;
+    buffered_repo.GrantWriterLocked(1667);
+    EXPECT_TRUE(primary.granted);
+    EXPECT_FALSE(primary.waiting);
+
+    primary.granted = false;
+    buffered_repo.writer_busy_ = false;
+}
+
+TEST_F(TraceSessionManagerUnitTest, BufferedRepositoryRejectsPrimaryOverPendingFlushBytesUntilSqliteCatchesUp)
+{
+    // 目的：SQLite 卡住时缓冲层不能无限收 primary。待刷字节超过上限后 AppendPrimary 返回 false，
+    // analysis 照收不误；卡住的批次刷完、字节扣回以后再恢复放行。
+    GatedRecordingTraceRepository repo;
+    repo.CloseGate();
+    BufferedTraceRepository::Config buffer_config;
+    buffer_config.primary_span_reserve = 1;
+    buffer_config.max_pending_flush_bytes = 1;
+    auto sink = std::shared_ptr<TraceRepository>(&repo, [](TraceRepository*) {});
+    auto buffered_repo = std::make_unique<BufferedTraceRepository>(std::move(sink), buffer_config);
+
+    auto append_primary = [&buffered_repo](const std::string& trace_id) {
+        BufferedTraceRepository::TracePrimaryWrite primary;
+        primary.summary.trace_id = trace_id;
+        primary.spans.resize(1);
+        primary.spans.front().trace_id = trace_id;
+        return buffered_repo->AppendPrimary(std::move(primary));
+    };
+
+    // 缓冲层空着时单条 trace 即使超过上限也放行，否则它永远进不来。
+    ASSERT_TRUE(append_primary("940"));
+    ASSERT_TRUE(WaitUntil([&repo]() { return repo.Calls().size() == 1; }, 2000));
+    const size_t stuck_bytes = buffered_repo->PendingFlushBytes();
+    EXPECT_GE(stuck_bytes, sizeof(TraceRepository::TraceSummary) + sizeof(TraceRepository::TraceSpanRecord));
+
+    EXPECT_FALSE(append_primary("941"));
+    TraceRepository::TraceAnalysisRecord analysis;
+    analysis.trace_id = "940";
+    EXPECT_TRUE(buffered_repo->AppendAnalysis({analysis}));
+    EXPECT_GT(buffered_repo->PendingFlushBytes(), stuck_bytes);
+
+    BufferedTraceRepository::RuntimeStatsSnapshot stats = buffered_repo->SnapshotRuntimeStats();
+    EXPECT_EQ(stats.primary_append_rejected_count, 1u);
+    EXPECT_EQ(stats.pending_flush_bytes, buffered_repo->PendingFlushBytes());
+
+    repo.OpenGate();
+    ASSERT_TRUE(WaitUntil([&buffered_repo]() { return buffered_repo->PendingFlushBytes() == 0; }, 2000));
+    EXPECT_TRUE(append_primary("942"));
+    ASSERT_TRUE(WaitUntil([&repo]() { return repo.Calls().size() == 3; }, 2000));
+    EXPECT_EQ(repo.Calls(), (std::vector<std::string>{"P:940", "A:940", "P:942"}));
+}
+
+TEST_F(TraceSessionManagerUnitTest, BufferedRepositorySpillsFailedFlushesAndReplaysThemInOrder)
+{
+    // 目的：sink 写失败的 primary / analysis 批次不能直接丢，要按失败顺序进溢出文件；
+    // sink 恢复（有一次真实写入成功）以后立刻回放，先 primary 后 analysis，外键依赖才不会被打乱。
+    const std::string spill_path = "./test_buffered_spill_replay.spill";
+    std::filesystem::remove(spill_path);
+    GatedRecordingTraceRepository repo;
+    repo.fail.store(true);
+    BufferedTraceRepository::Config buffer_config;
+    buffer_config.primary_span_reserve = 1;
+    buffer_config.analysis_reserve = 1;
+    buffer_config.spill_path = spill_path;
+    // 回放间隔拉得很长：下面的回放只能由“sink 恢复成功”触发，而不是定时重试碰巧赶上。
+    buffer_config.spill_replay_interval_ms = 60000;
+    auto sink = std::shared_ptr<TraceRepository>(&repo, [](TraceRepository*) {});
+    auto buffered_repo = std::make_unique<BufferedTraceRepository>(std::move(sink), buffer_config);
+
+    BufferedTraceRepository::TracePrimaryWrite primary;
+    primary.summary.trace_id = "960";
+    primary.spans.resize(1);
+    primary.spans.front().trace_id = "960";
+    ASSERT_TRUE(buffered_repo->AppendPrimary(std::move(primary)));
+    TraceRepository::TraceAnalysisRecord analysis;
+    analysis.trace_id = "960";
+    ASSERT_TRUE(buffered_repo->AppendAnalysis({analysis}));
+    ASSERT_TRUE(WaitUntil([&buffered_repo]() {
+        return buffered_repo->SnapshotRuntimeStats().spill_pending_records == 2;
+    }, 2000));
+    EXPECT_EQ(buffered_repo->SnapshotRuntimeStats().spill_written_records, 2u);
+    EXPECT_EQ(buffered_repo->PendingFlushBytes(), 0u);
+
+    repo.fail.store(false);
+    BufferedTraceRepository::TracePrimaryWrite next;
+    next.summary.trace_id = "961";
+    next.spans.resize(1);
+    next.spans.front().trace_id = "961";
+    ASSERT_TRUE(buffered_repo->AppendPrimary(std::move(next)));
+    ASSERT_TRUE(WaitUntil([&buffered_repo]() {
+        return buffered_repo->SnapshotRuntimeStats().spill_replayed_records == 2;
+    }, 3000));
+
+    EXPECT_EQ(repo.Calls(), (std::vector<std::string>{"P:960", "A:960", "P:961", "P:960", "A:960"}));
+    const BufferedTraceRepository::RuntimeStatsSnapshot stats = buffered_repo->SnapshotRuntimeStats();
+    EXPECT_EQ(stats.spill_pending_records, 0u);
+    EXPECT_EQ(stats.spill_dropped_records, 0u);
+    // 队列清空后溢出文件截回只剩文件头。
+    EXPECT_EQ(std::filesystem::file_size(spill_path), 8u);
+
+    buffered_repo.reset();
+    std::filesystem::remove(spill_path);
+}
+
+TEST_F(TraceSessionManagerUnitTest, SpilledBatchesSurviveRestartAndReplayOnNextStartup)
+{
+    // 目的：进程退出时 sink 还没恢复，溢出记录要留在文件里；下次用同一个溢出文件启动，sink 正常就把它们补写进去。
+    const std::string spill_path = "./test_buffered_spill_restart.spill";
+    std::filesystem::remove(spill_path);
+    BufferedTraceRepository::Config buffer_config;
+    buffer_config.primary_span_reserve = 1;
+    buffer_config.spill_path = spill_path;
+
+    {
+        GatedRecordingTraceRepository failing_repo;
+        failing_repo.fail.store(true);
+        auto sink = std::shared_ptr<TraceRepository>(&failing_repo, [](TraceRepository*) {});
+        BufferedTraceRepository buffered_repo(std::move(sink), buffer_config);
+        BufferedTraceRepository::TracePrimaryWrite primary;
+        primary.summary.trace_id = "970";
+        primary.spans.resize(1);
+        ASSERT_TRUE(buffered_repo.AppendPrimary(std::move(primary)));
+        ASSERT_TRUE(WaitUntil([&buffered_repo]() {
+            return buffered_repo.SnapshotRuntimeStats().spill_pending_records == 1;
+        }, 2000));
+    }
+
+    GatedRecordingTraceRepository repo;
+    auto sink = std::shared_ptr<TraceRepository>(&repo, [](TraceRepository*) {});
+    auto buffered_repo = std::make_unique<BufferedTraceRepository>(std::move(sink), buffer_config);
+    EXPECT_EQ(buffered_repo->SnapshotRuntimeStats().spill_pending_records, 1u);
+    ASSERT_TRUE(WaitUntil([&buffered_repo]() {
+        return buffered_repo->SnapshotRuntimeStats().spill_replayed_records == 1;
+    }, 2000));
+    EXPECT_EQ(repo.Calls(), (std::vector<std::string>{"P:970"}));
+    ASSERT_EQ(repo.saved_trace_ids.size(), 1u);
+    EXPECT_EQ(repo.saved_trace_ids.front(), "970");
+
+    buffered_repo.reset();
+    std::filesystem::remove(spill_path);
+}
+
+TEST_F(TraceSessionManagerUnitTest, PrimaryFlushedCallbackFiresOnlyWhenBatchIsInSqliteOrSpillFile)
+{
+    // 目的：on_primary_flushed 是入口 WAL 解钉的依据，只能在这批数据有了别的落盘副本之后才回调。
+    // 写成功、写失败但进了溢出文件都回调；写失败又没有溢出文件兜底时不回调，WAL 里那份就是最后的副本。
+    const std::string spill_path = "./test_buffered_flushed_callback.spill";
+    std::filesystem::remove(spill_path);
+    std::mutex flushed_mutex;
+    std::vector<std::string> flushed;
+    auto make_config = [&flushed_mutex, &flushed](const std::string& path) {
+        BufferedTraceRepository::Config buffer_config;
+        buffer_config.primary_span_reserve = 1;
+        buffer_config.spill_path = path;
+        buffer_config.spill_replay_interval_ms = 60000;
+        buffer_config.on_primary_flushed = [&flushed_mutex, &flushed](const std::vector<TraceRepository::TraceSummary>& summaries) {
+            std::lock_guard<std::mutex> lock(flushed_mutex);
+            for (const auto& summary : summaries) {
+                flushed.push_back(summary.trace_id);
+            }
+        };
+        return buffer_config;
+    };
+    auto append_primary = [](BufferedTraceRepository& buffered_repo, const std::string& trace_id) {
+        BufferedTraceRepository::TracePrimaryWrite primary;
+        primary.summary.trace_id = trace_id;
+        primary.spans.resize(1);
+        primary.spans.front().trace_id = trace_id;
+        return buffered_repo.AppendPrimary(std::move(primary));
+    };
+    auto flushed_ids = [&flushed_mutex, &flushed]() {
+        std::lock_guard<std::mutex> lock(flushed_mutex);
+        return flushed;
+    };
+
+    GatedRecordingTraceRepository repo;
+    auto sink = std::shared_ptr<TraceRepository>(&repo, [](TraceRepository*) {});
+    {
+        BufferedTraceRepository buffered_repo(sink, make_config(spill_path));
+        ASSERT_TRUE(append_primary(buffered_repo, "970"));
+        ASSERT_TRUE(WaitUntil([&buffered_repo]() { return buffered_repo.SnapshotRuntimeStats().primary_flush_calls == 1; }, 2000));
+        repo.fail.store(true);
+        ASSERT_TRUE(append_primary(buffered_repo, "971"));
+        ASSERT_TRUE(WaitUntil([&buffered_repo]() { return buffered_repo.SnapshotRuntimeStats().spill_written_records == 1; }, 2000));
+        ASSERT_TRUE(WaitUntil([&flushed_ids]() { return flushed_ids().size() == 2; }, 2000));
+        EXPECT_EQ(flushed_ids(), (std::vector<std::string>{"970", "971"}));
+    }
+
+    // 没有溢出文件：写失败的批次没有任何落盘副本，不能回调。
+    {
+        BufferedTraceRepository buffered_repo(sink, make_config(""));
+        ASSERT_TRUE(append_primary(buffered_repo, "972"));
+        ASSERT_TRUE(WaitUntil([&buffered_repo]() { return buffered_repo.SnapshotRuntimeStats().primary_flush_fail_count == 1; }, 2000));
+    }
+    EXPECT_EQ(flushed_ids(), (std::vector<std::string>{"970", "971"}));
+    std::filesystem::remove(spill_path);
+}
+
+TEST_F(TraceSessionManagerUnitTest, PendingFlushWatermarkRejectsNewTraceWhileSqliteLags)
+{
+    // 目的：聚合态完全空着，但下游待刷字节已经顶到上限时，入口也要按持久化滞后拒新 trace；
+    // 下游刷完以后水位回落，新 trace 恢复放行。
+    ThreadPool pool(1);
+    GatedRecordingTraceRepository repo;
+    repo.CloseGate();
+    BufferedTraceRepository::Config buffer_config;
+    buffer_config.primary_span_reserve = 1;
+    buffer_config.max_pending_flush_bytes = 1;
+    auto sink = std::shared_ptr<TraceRepository>(&repo, [](TraceRepository*) {});
+    auto buffered_repo = std::make_unique<BufferedTraceRepository>(std::move(sink), buffer_config);
+    TraceSessionManager manager(&pool, buffered_repo.get(), nullptr, /*capacity*/10, /*token_limit*/0);
+
+    BufferedTraceRepository::TracePrimaryWrite primary;
+    primary.summary.trace_id = "950";
+    primary.spans.resize(1);
+    ASSERT_TRUE(buffered_repo->AppendPrimary(std::move(primary)));
+    ASSERT_TRUE(WaitUntil([&repo]() { return repo.Calls().size() == 1; }, 2000));
+
+    EXPECT_EQ(manager.Push(MakeSpan(951, 1, 1000)), TraceSessionManager::PushResult::RejectedOverload);
+    EXPECT_EQ(manager.overload_state_.load(), TraceSessionManager::OverloadState::Critical);
+    EXPECT_EQ(manager.SnapshotRuntimeStats().pending_flush_bytes, buffered_repo->PendingFlushBytes());
+    EXPECT_GT(manager.SnapshotRuntimeStats().pending_flush_bytes, 0u);
+
+    repo.OpenGate();
+    ASSERT_TRUE(WaitUntil([&buffered_repo]() { return buffered_repo->PendingFlushBytes() == 0; }, 2000));
+    EXPECT_EQ(manager.Push(MakeSpan(952, 1, 1001)), TraceSessionManager::PushResult::Accepted);
+    EXPECT_EQ(manager.overload_state_.load(), TraceSessionManager::OverloadState::Normal);
+
+    pool.shutdown();
+}
+
 TEST_F(TraceSessionManagerUnitTest, SealedSessionAcceptsLateSpanWithoutRenewingDeadline)
 {
     // 目的：验证 sealed 短窗口内的新 span 可以并入当前 session，但 sealed_deadline_tick 不会被向后续命。
@@ -435,18 +1077,18 @@ TEST_F(TraceSessionManagerUnitTest, SealedSessionAcceptsLateSpanWithoutRenewingD
     SpanEvent late = MakeSpan(912, 91202, 1100);
 
     ASSERT_EQ(manager.Push(first), TraceSessionManager::PushResult::Accepted);
-    auto iter = manager.index_by_trace_.find(912);
-    ASSERT_NE(iter, manager.index_by_trace_.end());
-    ASSERT_TRUE(manager.sessions_[iter->second] != nullptr);
-    EXPECT_EQ(manager.sessions_[iter->second]->sealed_deadline_tick, 2u);
+    auto iter = manager.shards_[0]->index_by_trace_.find(912);
+    ASSERT_NE(iter, manager.shards_[0]->index_by_trace_.end());
+    ASSERT_TRUE(manager.shards_[0]->sessions_[iter->second] != nullptr);
+    EXPECT_EQ(manager.shards_[0]->sessions_[iter->second]->sealed_deadline_tick, 2u);
 
     ASSERT_EQ(manager.Push(late), TraceSessionManager::PushResult::Accepted);
-    iter = manager.index_by_trace_.find(912);
-    ASSERT_NE(iter, manager.index_by_trace_.end());
-    ASSERT_TRUE(manager.sessions_[iter->second] != nullptr);
-    EXPECT_EQ(manager.sessions_[iter->second]->lifecycle_state, TraceSession::LifecycleState::Sealed);
-    EXPECT_EQ(manager.sessions_[iter->second]->sealed_deadline_tick, 2u);
-    EXPECT_EQ(manager.sessions_[iter->second]->spans.size(), 2u);
+    iter = manager.shards_[0]->index_by_trace_.find(912);
+    ASSERT_NE(iter, manager.shards_[0]->index_by_trace_.end());
+    ASSERT_TRUE(manager.shards_[0]->sessions_[iter->second] != nullptr);
+    EXPECT_EQ(manager.shards_[0]->sessions_[iter->second]->lifecycle_state, TraceSession::LifecycleState::Sealed);
+    EXPECT_EQ(manager.shards_[0]->sessions_[iter->second]->sealed_deadline_tick, 2u);
+    EXPECT_EQ(manager.shards_[0]->sessions_[iter->second]->spans.size(), 2u);
 
     SweepOneTick(manager, /*now_ms*/1000);
     EXPECT_FALSE(repo.save_atomic_called.load(std::memory_order_acquire));
@@ -483,12 +1125,12 @@ TEST_F(TraceSessionManagerUnitTest, PushSealsWhenCapacityReachedAndDispatchesAft
     ASSERT_EQ(manager.Push(span1), TraceSessionManager::PushResult::Accepted);
     ASSERT_EQ(manager.Push(span2), TraceSessionManager::PushResult::Accepted);
     ASSERT_EQ(manager.size(), 1u);
-    auto iter = manager.index_by_trace_.find(22);
-    ASSERT_NE(iter, manager.index_by_trace_.end());
-    ASSERT_TRUE(manager.sessions_[iter->second] != nullptr);
-    EXPECT_EQ(manager.sessions_[iter->second]->lifecycle_state, TraceSession::LifecycleState::Sealed);
-    EXPECT_EQ(manager.sessions_[iter->second]->seal_reason, TraceSession::SealReason::Capacity);
-    EXPECT_EQ(manager.sessions_[iter->second]->sealed_deadline_tick, 1u);
+    auto iter = manager.shards_[0]->index_by_trace_.find(22);
+    ASSERT_NE(iter, manager.shards_[0]->index_by_trace_.end());
+    ASSERT_TRUE(manager.shards_[0]->sessions_[iter->second] != nullptr);
+    EXPECT_EQ(manager.shards_[0]->sessions_[iter->second]->lifecycle_state, TraceSession::LifecycleState::Sealed);
+    EXPECT_EQ(manager.shards_[0]->sessions_[iter->second]->seal_reason, TraceSession::SealReason::Capacity);
+    EXPECT_EQ(manager.shards_[0]->sessions_[iter->second]->sealed_deadline_tick, 1u);
     EXPECT_FALSE(repo.save_atomic_called.load(std::memory_order_acquire));
 
     SweepOneTick(manager, /*now_ms*/1000);
@@ -543,12 +1185,12 @@ TEST_F(TraceSessionManagerUnitTest, PushSealsWhenTokenLimitReachedAndDispatchesA
     EXPECT_EQ(manager.size(), 1u);
 
     ASSERT_EQ(manager.Push(span2), TraceSessionManager::PushResult::Accepted);
-    auto iter = manager.index_by_trace_.find(77);
-    ASSERT_NE(iter, manager.index_by_trace_.end());
-    ASSERT_TRUE(manager.sessions_[iter->second] != nullptr);
-    EXPECT_EQ(manager.sessions_[iter->second]->lifecycle_state, TraceSession::LifecycleState::Sealed);
-    EXPECT_EQ(manager.sessions_[iter->second]->seal_reason, TraceSession::SealReason::TokenLimit);
-    EXPECT_EQ(manager.sessions_[iter->second]->sealed_deadline_tick, 1u);
+    auto iter = manager.shards_[0]->index_by_trace_.find(77);
+    ASSERT_NE(iter, manager.shards_[0]->index_by_trace_.end());
+    ASSERT_TRUE(manager.shards_[0]->sessions_[iter->second] != nullptr);
+    EXPECT_EQ(manager.shards_[0]->sessions_[iter->second]->lifecycle_state, TraceSession::LifecycleState::Sealed);
+    EXPECT_EQ(manager.shards_[0]->sessions_[iter->second]->seal_reason, TraceSession::SealReason::TokenLimit);
+    EXPECT_EQ(manager.shards_[0]->sessions_[iter->second]->sealed_deadline_tick, 1u);
     EXPECT_FALSE(repo.save_atomic_called.load(std::memory_order_acquire));
 
     SweepOneTick(manager, /*now_ms*/1000);
@@ -586,19 +1228,19 @@ TEST_F(TraceSessionManagerUnitTest, PushSealsWhenDuplicateSpanIdAppearsAndDispat
     ASSERT_EQ(manager.Push(span), TraceSessionManager::PushResult::Accepted);
     ASSERT_EQ(manager.Push(span), TraceSessionManager::PushResult::Accepted);
 
-    auto iter = manager.index_by_trace_.find(33);
-    ASSERT_NE(iter, manager.index_by_trace_.end());
-    ASSERT_LT(iter->second, manager.sessions_.size());
-    ASSERT_TRUE(manager.sessions_[iter->second] != nullptr);
+    auto iter = manager.shards_[0]->index_by_trace_.find(33);
+    ASSERT_NE(iter, manager.shards_[0]->index_by_trace_.end());
+    ASSERT_LT(iter->second, manager.shards_[0]->sessions_.size());
+    ASSERT_TRUE(manager.shards_[0]->sessions_[iter->second] != nullptr);
 
     // 第二次 Push 只是把会话封口，不会立刻落库；
     // 这样重复 span 也能复用和 trace_end/capacity 一样的 sweep -> dispatch 统一主链。
-    EXPECT_EQ(manager.sessions_[iter->second]->lifecycle_state, TraceSession::LifecycleState::Sealed);
-    EXPECT_EQ(manager.sessions_[iter->second]->seal_reason, TraceSession::SealReason::DuplicateSpan);
-    EXPECT_EQ(manager.sessions_[iter->second]->sealed_deadline_tick, 1u);
-    EXPECT_EQ(manager.sessions_[iter->second]->spans.size(), 1u);
-    ASSERT_TRUE(manager.sessions_[iter->second]->duplicate_span_id.has_value());
-    EXPECT_EQ(manager.sessions_[iter->second]->duplicate_span_id.value(), 301u);
+    EXPECT_EQ(manager.shards_[0]->sessions_[iter->second]->lifecycle_state, TraceSession::LifecycleState::Sealed);
+    EXPECT_EQ(manager.shards_[0]->sessions_[iter->second]->seal_reason, TraceSession::SealReason::DuplicateSpan);
+    EXPECT_EQ(manager.shards_[0]->sessions_[iter->second]->sealed_deadline_tick, 1u);
+    EXPECT_EQ(manager.shards_[0]->sessions_[iter->second]->spans.size(), 1u);
+    ASSERT_TRUE(manager.shards_[0]->sessions_[iter->second]->duplicate_span_id.has_value());
+    EXPECT_EQ(manager.shards_[0]->sessions_[iter->second]->duplicate_span_id.value(), 301u);
     EXPECT_FALSE(repo.save_atomic_called.load(std::memory_order_acquire));
 
     // DuplicateSpan 当前配置为 1 tick grace；推进一轮 sweep 后才应该真正进入异步分发。
@@ -673,12 +1315,12 @@ TEST_F(TraceSessionManagerUnitTest, DispatchMarksCycleAsAnomalyWithoutInfiniteLo
     SpanEvent span_a = MakeSpan(100, 1001, 1000);
     SpanEvent span_b = MakeSpan(100, 1002, 1100);
 
+    // 节点 0 是 1001、节点 1 是 1002，两者互为子节点。
     TraceSessionManager::TraceIndex index;
-    index.span_map[1001] = &span_a;
-    index.span_map[1002] = &span_b;
-    index.children[1001] = {1002};
-    index.children[1002] = {1001};
-    index.roots = {1001};
+    index.nodes = {&span_a, &span_b};
+    index.child_offsets = {0, 1, 2};
+    index.children = {1, 0};
+    index.roots = {0};
 
     std::vector<const SpanEvent*> order;
     const std::string payload = manager.SerializeTrace(index, &order);
@@ -1359,16 +2001,16 @@ TEST_F(TraceSessionManagerUnitTest, SealedTraceRollsBackToReadyRetryLaterWhenSub
 
     EXPECT_EQ(manager.Push(span), TraceSessionManager::PushResult::Accepted);
     EXPECT_EQ(manager.size(), 1u);
-    auto iter = manager.index_by_trace_.find(123);
-    ASSERT_NE(iter, manager.index_by_trace_.end());
-    ASSERT_LT(iter->second, manager.sessions_.size());
-    ASSERT_TRUE(manager.sessions_[iter->second] != nullptr);
-    EXPECT_EQ(manager.sessions_[iter->second]->lifecycle_state,
+    auto iter = manager.shards_[0]->index_by_trace_.find(123);
+    ASSERT_NE(iter, manager.shards_[0]->index_by_trace_.end());
+    ASSERT_LT(iter->second, manager.shards_[0]->sessions_.size());
+    ASSERT_TRUE(manager.shards_[0]->sessions_[iter->second] != nullptr);
+    EXPECT_EQ(manager.shards_[0]->sessions_[iter->second]->lifecycle_state,
               TraceSession::LifecycleState::Sealed);
-    EXPECT_EQ(manager.sessions_[iter->second]->sealed_deadline_tick, 2u);
+    EXPECT_EQ(manager.shards_[0]->sessions_[iter->second]->sealed_deadline_tick, 2u);
 
     SweepOneTick(manager, /*now_ms*/1000);
-    EXPECT_EQ(manager.sessions_[iter->second]->lifecycle_state,
+    EXPECT_EQ(manager.shards_[0]->sessions_[iter->second]->lifecycle_state,
               TraceSession::LifecycleState::Sealed);
 
     SweepOneTick(manager, /*now_ms*/1500);
@@ -1377,16 +2019,16 @@ TEST_F(TraceSessionManagerUnitTest, SealedTraceRollsBackToReadyRetryLaterWhenSub
                session.retry_count == 1u &&
                session.next_retry_tick == 3u;
     }));
-    EXPECT_EQ(manager.active_sessions_, 1u);
-    EXPECT_EQ(manager.total_buffered_spans_, 1u);
-    iter = manager.index_by_trace_.find(123);
-    ASSERT_NE(iter, manager.index_by_trace_.end());
-    ASSERT_LT(iter->second, manager.sessions_.size());
-    ASSERT_TRUE(manager.sessions_[iter->second] != nullptr);
-    EXPECT_EQ(manager.sessions_[iter->second]->lifecycle_state,
+    EXPECT_EQ(manager.active_sessions_.load(), 1u);
+    EXPECT_EQ(manager.total_buffered_spans_.load(), 1u);
+    iter = manager.shards_[0]->index_by_trace_.find(123);
+    ASSERT_NE(iter, manager.shards_[0]->index_by_trace_.end());
+    ASSERT_LT(iter->second, manager.shards_[0]->sessions_.size());
+    ASSERT_TRUE(manager.shards_[0]->sessions_[iter->second] != nullptr);
+    EXPECT_EQ(manager.shards_[0]->sessions_[iter->second]->lifecycle_state,
               TraceSession::LifecycleState::ReadyRetryLater);
-    EXPECT_EQ(manager.sessions_[iter->second]->retry_count, 1u);
-    EXPECT_EQ(manager.sessions_[iter->second]->next_retry_tick, 3u);
+    EXPECT_EQ(manager.shards_[0]->sessions_[iter->second]->retry_count, 1u);
+    EXPECT_EQ(manager.shards_[0]->sessions_[iter->second]->next_retry_tick, 3u);
     EXPECT_FALSE(repo.save_atomic_called.load(std::memory_order_acquire));
 
     const TraceSessionManager::RuntimeStatsSnapshot stats = manager.SnapshotRuntimeStats();
@@ -1420,11 +2062,11 @@ TEST_F(TraceSessionManagerUnitTest, RetryDelayBackoffGrowsOnRepeatedSubmitFailur
                session.next_retry_tick == 3u;
     }));
 
-    auto iter = manager.index_by_trace_.find(124);
-    ASSERT_NE(iter, manager.index_by_trace_.end());
-    ASSERT_TRUE(manager.sessions_[iter->second] != nullptr);
-    EXPECT_EQ(manager.sessions_[iter->second]->retry_count, 1u);
-    EXPECT_EQ(manager.sessions_[iter->second]->next_retry_tick, 3u);
+    auto iter = manager.shards_[0]->index_by_trace_.find(124);
+    ASSERT_NE(iter, manager.shards_[0]->index_by_trace_.end());
+    ASSERT_TRUE(manager.shards_[0]->sessions_[iter->second] != nullptr);
+    EXPECT_EQ(manager.shards_[0]->sessions_[iter->second]->retry_count, 1u);
+    EXPECT_EQ(manager.shards_[0]->sessions_[iter->second]->next_retry_tick, 3u);
 
     manager.SweepExpiredSessions(/*now_ms*/2000, /*idle_timeout_ms*/5000, /*max_dispatch_per_tick*/8);
     ASSERT_TRUE(WaitUntilSessionSatisfies(manager, 124, [](const TraceSession& session) {
@@ -1433,13 +2075,13 @@ TEST_F(TraceSessionManagerUnitTest, RetryDelayBackoffGrowsOnRepeatedSubmitFailur
                session.next_retry_tick == 5u;
     }));
 
-    iter = manager.index_by_trace_.find(124);
-    ASSERT_NE(iter, manager.index_by_trace_.end());
-    ASSERT_TRUE(manager.sessions_[iter->second] != nullptr);
-    EXPECT_EQ(manager.sessions_[iter->second]->lifecycle_state,
+    iter = manager.shards_[0]->index_by_trace_.find(124);
+    ASSERT_NE(iter, manager.shards_[0]->index_by_trace_.end());
+    ASSERT_TRUE(manager.shards_[0]->sessions_[iter->second] != nullptr);
+    EXPECT_EQ(manager.shards_[0]->sessions_[iter->second]->lifecycle_state,
               TraceSession::LifecycleState::ReadyRetryLater);
-    EXPECT_EQ(manager.sessions_[iter->second]->retry_count, 2u);
-    EXPECT_EQ(manager.sessions_[iter->second]->next_retry_tick, 5u);
+    EXPECT_EQ(manager.shards_[0]->sessions_[iter->second]->retry_count, 2u);
+    EXPECT_EQ(manager.shards_[0]->sessions_[iter->second]->next_retry_tick, 5u);
 
     pool.shutdown();
 }
@@ -1464,44 +2106,44 @@ TEST_F(TraceSessionManagerUnitTest, RetryBackoffDoesNotRetryBeforeNextRetryTick)
                session.next_retry_tick == 3u;
     }));
 
-    auto iter = manager.index_by_trace_.find(125);
-    ASSERT_NE(iter, manager.index_by_trace_.end());
-    ASSERT_TRUE(manager.sessions_[iter->second] != nullptr);
-    EXPECT_EQ(manager.sessions_[iter->second]->retry_count, 1u);
-    EXPECT_EQ(manager.sessions_[iter->second]->next_retry_tick, 3u);
+    auto iter = manager.shards_[0]->index_by_trace_.find(125);
+    ASSERT_NE(iter, manager.shards_[0]->index_by_trace_.end());
+    ASSERT_TRUE(manager.shards_[0]->sessions_[iter->second] != nullptr);
+    EXPECT_EQ(manager.shards_[0]->sessions_[iter->second]->retry_count, 1u);
+    EXPECT_EQ(manager.shards_[0]->sessions_[iter->second]->next_retry_tick, 3u);
 
     // tick=3：允许第一次 retry，因此会再次失败并把 next_retry_tick 推到 5。
     manager.SweepExpiredSessions(/*now_ms*/2000, /*idle_timeout_ms*/5000, /*max_dispatch_per_tick*/8);
     ASSERT_TRUE(WaitUntilSessionSatisfies(manager, 125, [](const TraceSession& session) {
         return session.retry_count == 2u && session.next_retry_tick == 5u;
     }));
-    iter = manager.index_by_trace_.find(125);
-    ASSERT_NE(iter, manager.index_by_trace_.end());
-    ASSERT_TRUE(manager.sessions_[iter->second] != nullptr);
-    EXPECT_EQ(manager.sessions_[iter->second]->retry_count, 2u);
-    EXPECT_EQ(manager.sessions_[iter->second]->next_retry_tick, 5u);
+    iter = manager.shards_[0]->index_by_trace_.find(125);
+    ASSERT_NE(iter, manager.shards_[0]->index_by_trace_.end());
+    ASSERT_TRUE(manager.shards_[0]->sessions_[iter->second] != nullptr);
+    EXPECT_EQ(manager.shards_[0]->sessions_[iter->second]->retry_count, 2u);
+    EXPECT_EQ(manager.shards_[0]->sessions_[iter->second]->next_retry_tick, 5u);
 
     // tick=4：还没到 next_retry_tick=5，不应该提前再次重试。
     manager.SweepExpiredSessions(/*now_ms*/2500, /*idle_timeout_ms*/5000, /*max_dispatch_per_tick*/8);
     ASSERT_TRUE(WaitUntilSessionSatisfies(manager, 125, [](const TraceSession& session) {
         return session.retry_count == 2u && session.next_retry_tick == 5u;
     }));
-    iter = manager.index_by_trace_.find(125);
-    ASSERT_NE(iter, manager.index_by_trace_.end());
-    ASSERT_TRUE(manager.sessions_[iter->second] != nullptr);
-    EXPECT_EQ(manager.sessions_[iter->second]->retry_count, 2u);
-    EXPECT_EQ(manager.sessions_[iter->second]->next_retry_tick, 5u);
+    iter = manager.shards_[0]->index_by_trace_.find(125);
+    ASSERT_NE(iter, manager.shards_[0]->index_by_trace_.end());
+    ASSERT_TRUE(manager.shards_[0]->sessions_[iter->second] != nullptr);
+    EXPECT_EQ(manager.shards_[0]->sessions_[iter->second]->retry_count, 2u);
+    EXPECT_EQ(manager.shards_[0]->sessions_[iter->second]->next_retry_tick, 5u);
 
     // tick=5：此时才允许第三次尝试，因此 retry_count 应增加到 3。
     manager.SweepExpiredSessions(/*now_ms*/3000, /*idle_timeout_ms*/5000, /*max_dispatch_per_tick*/8);
     ASSERT_TRUE(WaitUntilSessionSatisfies(manager, 125, [](const TraceSession& session) {
         return session.retry_count == 3u && session.next_retry_tick == 9u;
     }));
-    iter = manager.index_by_trace_.find(125);
-    ASSERT_NE(iter, manager.index_by_trace_.end());
-    ASSERT_TRUE(manager.sessions_[iter->second] != nullptr);
-    EXPECT_EQ(manager.sessions_[iter->second]->retry_count, 3u);
-    EXPECT_EQ(manager.sessions_[iter->second]->next_retry_tick, 9u);
+    iter = manager.shards_[0]->index_by_trace_.find(125);
+    ASSERT_NE(iter, manager.shards_[0]->index_by_trace_.end());
+    ASSERT_TRUE(manager.shards_[0]->sessions_[iter->second] != nullptr);
+    EXPECT_EQ(manager.shards_[0]->sessions_[iter->second]->retry_count, 3u);
+    EXPECT_EQ(manager.shards_[0]->sessions_[iter->second]->next_retry_tick, 9u);
 
     pool.shutdown();
 }
@@ -1532,10 +2174,10 @@ TEST_F(TraceSessionManagerUnitTest, RetrySuccessDoesNotAppendPrimaryTwiceAfterSu
                session.primary_enqueued;
     }));
 
-    auto iter = manager.index_by_trace_.find(126);
-    ASSERT_NE(iter, manager.index_by_trace_.end());
-    ASSERT_TRUE(manager.sessions_[iter->second] != nullptr);
-    EXPECT_TRUE(manager.sessions_[iter->second]->primary_enqueued);
+    auto iter = manager.shards_[0]->index_by_trace_.find(126);
+    ASSERT_NE(iter, manager.shards_[0]->index_by_trace_.end());
+    ASSERT_TRUE(manager.shards_[0]->sessions_[iter->second] != nullptr);
+    EXPECT_TRUE(manager.shards_[0]->sessions_[iter->second]->primary_enqueued);
 
     ASSERT_TRUE(WaitUntil([&repo]() {
         return repo.save_summary_count.load(std::memory_order_acquire) >= 1 &&
@@ -1581,24 +2223,24 @@ TEST_F(TraceSessionManagerUnitTest, ReadyRetryLaterDoesNotMergeLateSpan)
         return session.lifecycle_state == TraceSession::LifecycleState::ReadyRetryLater;
     }));
 
-    auto iter = manager.index_by_trace_.find(127);
-    ASSERT_NE(iter, manager.index_by_trace_.end());
-    ASSERT_TRUE(manager.sessions_[iter->second] != nullptr);
-    EXPECT_EQ(manager.sessions_[iter->second]->lifecycle_state,
+    auto iter = manager.shards_[0]->index_by_trace_.find(127);
+    ASSERT_NE(iter, manager.shards_[0]->index_by_trace_.end());
+    ASSERT_TRUE(manager.shards_[0]->sessions_[iter->second] != nullptr);
+    EXPECT_EQ(manager.shards_[0]->sessions_[iter->second]->lifecycle_state,
               TraceSession::LifecycleState::ReadyRetryLater);
-    EXPECT_EQ(manager.sessions_[iter->second]->spans.size(), 1u);
+    EXPECT_EQ(manager.shards_[0]->sessions_[iter->second]->spans.size(), 1u);
 
     SpanEvent late = MakeSpan(127, 12702, 1100);
     EXPECT_EQ(manager.Push(late), TraceSessionManager::PushResult::AcceptedDeferred);
 
-    iter = manager.index_by_trace_.find(127);
-    ASSERT_NE(iter, manager.index_by_trace_.end());
-    ASSERT_TRUE(manager.sessions_[iter->second] != nullptr);
-    EXPECT_EQ(manager.sessions_[iter->second]->lifecycle_state,
+    iter = manager.shards_[0]->index_by_trace_.find(127);
+    ASSERT_NE(iter, manager.shards_[0]->index_by_trace_.end());
+    ASSERT_TRUE(manager.shards_[0]->sessions_[iter->second] != nullptr);
+    EXPECT_EQ(manager.shards_[0]->sessions_[iter->second]->lifecycle_state,
               TraceSession::LifecycleState::ReadyRetryLater);
-    EXPECT_EQ(manager.sessions_[iter->second]->spans.size(), 1u);
-    EXPECT_EQ(manager.sessions_[iter->second]->span_ids.count(12702), 0u);
-    EXPECT_EQ(manager.total_buffered_spans_, 1u);
+    EXPECT_EQ(manager.shards_[0]->sessions_[iter->second]->spans.size(), 1u);
+    EXPECT_EQ(manager.shards_[0]->sessions_[iter->second]->span_ids.count(12702), 0u);
+    EXPECT_EQ(manager.total_buffered_spans_.load(), 1u);
 
     pool.shutdown();
 }
@@ -1622,8 +2264,8 @@ TEST_F(TraceSessionManagerUnitTest, CompletedTombstoneAbsorbsLateSpanWithoutCrea
                repo.save_spans_count.load(std::memory_order_acquire) >= 1;
     }));
     EXPECT_EQ(manager.size(), 0u);
-    ASSERT_EQ(manager.completed_trace_expire_tick_.count(128), 1u);
-    EXPECT_GT(manager.completed_trace_expire_tick_[128], manager.current_tick_);
+    ASSERT_EQ(manager.shards_[0]->completed_trace_expire_tick_.count(128), 1u);
+    EXPECT_GT(manager.shards_[0]->completed_trace_expire_tick_[128], manager.shards_[0]->current_tick_);
 
     const int summary_count_before = repo.save_summary_count.load(std::memory_order_acquire);
     const int span_batch_count_before = repo.save_spans_count.load(std::memory_order_acquire);
@@ -1631,7 +2273,7 @@ TEST_F(TraceSessionManagerUnitTest, CompletedTombstoneAbsorbsLateSpanWithoutCrea
     SpanEvent late = MakeSpan(128, 12802, 1100);
     EXPECT_EQ(manager.Push(late), TraceSessionManager::PushResult::Accepted);
     EXPECT_EQ(manager.size(), 0u);
-    EXPECT_EQ(manager.completed_trace_expire_tick_.count(128), 1u);
+    EXPECT_EQ(manager.shards_[0]->completed_trace_expire_tick_.count(128), 1u);
     EXPECT_EQ(repo.save_summary_count.load(std::memory_order_acquire), summary_count_before);
     EXPECT_EQ(repo.save_spans_count.load(std::memory_order_acquire), span_batch_count_before);
 
@@ -1656,17 +2298,17 @@ TEST_F(TraceSessionManagerUnitTest, CompletedTombstoneExpiresAndAllowsTraceKeyRe
         return repo.save_summary_count.load(std::memory_order_acquire) >= 1 &&
                repo.save_spans_count.load(std::memory_order_acquire) >= 1;
     }));
-    ASSERT_EQ(manager.completed_trace_expire_tick_.count(129), 1u);
+    ASSERT_EQ(manager.shards_[0]->completed_trace_expire_tick_.count(129), 1u);
 
     // 当前 tick 约为 2；tombstone 默认保留 25 tick。
     // 这里一次性推进 30 tick，验证即使没有活跃 session，completed wheel 也会被正常回收。
     manager.SweepExpiredSessions(/*now_ms*/16500, /*idle_timeout_ms*/5000, /*max_dispatch_per_tick*/8);
-    EXPECT_EQ(manager.completed_trace_expire_tick_.count(129), 0u);
+    EXPECT_EQ(manager.shards_[0]->completed_trace_expire_tick_.count(129), 0u);
 
     SpanEvent reused = MakeSpan(129, 12902, 1200);
     EXPECT_EQ(manager.Push(reused), TraceSessionManager::PushResult::Accepted);
     EXPECT_EQ(manager.size(), 1u);
-    EXPECT_EQ(manager.index_by_trace_.count(129), 1u);
+    EXPECT_EQ(manager.shards_[0]->index_by_trace_.count(129), 1u);
 
     pool.shutdown();
 }
@@ -1696,27 +2338,20 @@ TEST_F(TraceSessionManagerUnitTest, RebuildTimeWheelKeepsReadyRetryLaterOnRetryS
         return session.lifecycle_state == TraceSession::LifecycleState::ReadyRetryLater;
     }));
 
-    auto idx_iter = manager.index_by_trace_.find(124);
-    ASSERT_NE(idx_iter, manager.index_by_trace_.end());
-    ASSERT_LT(idx_iter->second, manager.sessions_.size());
-    TraceSession& session = *manager.sessions_[idx_iter->second];
+    auto idx_iter = manager.shards_[0]->index_by_trace_.find(124);
+    ASSERT_NE(idx_iter, manager.shards_[0]->index_by_trace_.end());
+    ASSERT_LT(idx_iter->second, manager.shards_[0]->sessions_.size());
+    TraceSession& session = *manager.shards_[0]->sessions_[idx_iter->second];
     ASSERT_EQ(session.lifecycle_state, TraceSession::LifecycleState::ReadyRetryLater);
 
     manager.RebuildTimeWheel();
 
     const uint64_t expected_retry_tick = session.next_retry_tick;
-    const size_t expected_slot = static_cast<size_t>(expected_retry_tick % manager.wheel_size_);
-    bool found_retry_node = false;
-    for (const auto& node : manager.time_wheel_[expected_slot]) {
-        if (node.trace_key == session.trace_key &&
-            node.version == session.timer_version &&
-            node.epoch == session.session_epoch &&
-            node.expire_tick == expected_retry_tick) {
-            found_retry_node = true;
-            break;
-        }
-    }
-    EXPECT_TRUE(found_retry_node);
+    EXPECT_TRUE(session.timer_node.linked());
+    EXPECT_EQ(session.timer_node.key(), session.trace_key);
+    EXPECT_EQ(session.timer_node.expire_tick(), expected_retry_tick);
+    // 重建是先清空再重排，轮上只剩这一条 session 的一份计划。
+    EXPECT_EQ(manager.shards_[0]->time_wheel_.GetStats().occupancy, 1u);
 
     pool.shutdown();
 }
@@ -1822,9 +2457,15 @@ TEST_F(TraceSessionManagerUnitTest, SweepTimeout_TraceKeyReuseDoesNotTriggerNewS
     manager.SweepExpiredSessions(/*now_ms*/1000, /*idle_timeout_ms*/5000, /*max_dispatch_per_tick*/1);
     EXPECT_FALSE(repo.save_atomic_called.load(std::memory_order_acquire));
 
-    // 模拟“老会话已被其他路径分发并移除”，但旧轮子节点还残留在槽里。
-    manager.sessions_.clear();
-    manager.index_by_trace_.clear();
+    // 模拟“老会话已被其他路径分发并移除”：离开 shard 的路径都会把 timer_node 从轮上摘掉，
+    // 新会话复用同一个 trace_key 时只能命中它自己的计划。
+    {
+        std::lock_guard<std::mutex> lock(manager.shards_[0]->mutex_);
+        auto old_session = manager.DetachSessionLocked(*manager.shards_[0], 301, nullptr);
+        ASSERT_NE(old_session, nullptr);
+        EXPECT_FALSE(old_session->timer_node.linked());
+    }
+    EXPECT_EQ(manager.shards_[0]->time_wheel_.GetStats().occupancy, 0u);
 
     SpanEvent new_span = MakeSpan(301, 3002, 1200);
     ASSERT_EQ(manager.Push(new_span), TraceSessionManager::PushResult::Accepted);
@@ -1889,7 +2530,7 @@ TEST_F(TraceSessionManagerUnitTest, SweepTimeout_MaxDispatchPerTickDefersRemaini
 
 TEST_F(TraceSessionManagerUnitTest, SweepTimeout_DeduplicatesSameTraceInSingleSweep)
 {
-    // 目的：验证同一槽里出现同 trace 的重复有效节点时，只会分发一次。
+    // 目的：验证同一条 trace 被反复重排时，轮上始终只有一份计划，到期后只会分发一次。
     ThreadPool pool(1);
     FakeTraceRepository repo;
     auto buffered_repo = MakeBufferedTraceRepository(&repo);
@@ -1905,19 +2546,20 @@ TEST_F(TraceSessionManagerUnitTest, SweepTimeout_DeduplicatesSameTraceInSingleSw
 
     ASSERT_EQ(manager.Push(MakeSpan(501, 5001, 1000)), TraceSessionManager::PushResult::Accepted);
     ASSERT_EQ(manager.size(), 1u);
-    auto idx_iter = manager.index_by_trace_.find(501);
-    ASSERT_NE(idx_iter, manager.index_by_trace_.end());
-    TraceSession& session = *manager.sessions_[idx_iter->second];
-    const uint64_t expire_tick = manager.current_tick_ + manager.timeout_ticks_;
-    const size_t slot = static_cast<size_t>(expire_tick % manager.wheel_size_);
-
-    // 人工塞一个“同 trace + 同 version + 同 epoch”的重复节点，模拟异常重复入槽。
-    TraceSessionManager::TimeWheelNode duplicate;
-    duplicate.trace_key = session.trace_key;
-    duplicate.version = session.timer_version;
-    duplicate.epoch = session.session_epoch;
-    duplicate.expire_tick = expire_tick;
-    manager.time_wheel_[slot].push_back(duplicate);
+    auto idx_iter = manager.shards_[0]->index_by_trace_.find(501);
+    ASSERT_NE(idx_iter, manager.shards_[0]->index_by_trace_.end());
+    TraceSession& session = *manager.shards_[0]->sessions_[idx_iter->second];
+    const uint64_t expire_tick = manager.shards_[0]->current_tick_ + manager.timeout_ticks_.load();
+
+    // 人工对同一 session 重复排程，模拟热 trace 连续续命：旧计划必须被原地摘掉，而不是在槽里堆成重复节点。
+    const uint64_t relinks_before = manager.shards_[0]->time_wheel_.GetStats().relinked;
+    for (int i = 0; i < 3; ++i) {
+        manager.ScheduleTimeoutNode(*manager.shards_[0], session);
+    }
+    const HierarchicalTimingWheel::Stats wheel_stats = manager.shards_[0]->time_wheel_.GetStats();
+    EXPECT_EQ(wheel_stats.occupancy, 1u);
+    EXPECT_EQ(wheel_stats.relinked, relinks_before + 3);
+    EXPECT_EQ(session.timer_node.expire_tick(), expire_tick);
 
     manager.SweepExpiredSessions(/*now_ms*/1000, /*idle_timeout_ms*/5000, /*max_dispatch_per_tick*/8);
     EXPECT_EQ(repo.save_atomic_count.load(std::memory_order_acquire), 0);
@@ -1926,6 +2568,7 @@ TEST_F(TraceSessionManagerUnitTest, SweepTimeout_DeduplicatesSameTraceInSingleSw
     ASSERT_TRUE(WaitUntil([&repo]() { return repo.save_atomic_count.load(std::memory_order_acquire) >= 1; }));
     EXPECT_EQ(repo.save_atomic_count.load(std::memory_order_acquire), 1);
     EXPECT_EQ(repo.last_summary.trace_id, "501");
+    EXPECT_EQ(manager.shards_[0]->time_wheel_.GetStats().occupancy, 0u);
 
     pool.shutdown();
 }
@@ -1965,6 +2608,46 @@ TEST_F(TraceSessionManagerUnitTest, SweepTimeout_RebuildOnIdleTimeoutChangeUsesN
     pool.shutdown();
 }
 
+TEST_F(TraceSessionManagerUnitTest, SweepTimeout_IdleShardKeepsTickCurrentSoNextTraceIsNotDispatchedEarly)
+{
+    // 目的：验证 shard 空闲期间 tick 也跟着时间走。
+    // 否则空闲很久之后来的第一条 trace 会按陈旧的 current_tick_ 排超时计划，下一次 sweep 补 tick 时立刻被分发。
+    ThreadPool pool(1);
+    FakeTraceRepository repo;
+    auto buffered_repo = MakeBufferedTraceRepository(&repo);
+    TraceSessionManager manager(
+        &pool,
+        buffered_repo.get(),
+        nullptr,
+        /*capacity*/10,
+        /*token_limit*/0,
+        /*notifier*/nullptr,
+        /*idle_timeout_ms*/5000,
+        /*wheel_tick_ms*/500);
+
+    ASSERT_EQ(manager.Push(MakeSpan(611, 6101, 1000)), TraceSessionManager::PushResult::Accepted);
+    manager.SweepExpiredSessions(/*now_ms*/1000, /*idle_timeout_ms*/5000, /*max_dispatch_per_tick*/8);
+    manager.SweepExpiredSessions(/*now_ms*/6000, /*idle_timeout_ms*/5000, /*max_dispatch_per_tick*/8);
+    ASSERT_TRUE(WaitUntil([&repo]() { return repo.save_atomic_count.load(std::memory_order_acquire) >= 1; }));
+    // 再推进 30 tick 让 tombstone 过期，shard 变成真正的空 shard。
+    manager.SweepExpiredSessions(/*now_ms*/21000, /*idle_timeout_ms*/5000, /*max_dispatch_per_tick*/8);
+    ASSERT_TRUE(manager.shards_[0]->completed_trace_expire_tick_.empty());
+
+    // 空闲一分钟：sweep 照常跑，只是 shard 里什么都没有。
+    manager.SweepExpiredSessions(/*now_ms*/81000, /*idle_timeout_ms*/5000, /*max_dispatch_per_tick*/8);
+
+    ASSERT_EQ(manager.Push(MakeSpan(612, 6201, 81000)), TraceSessionManager::PushResult::Accepted);
+    manager.SweepExpiredSessions(/*now_ms*/81500, /*idle_timeout_ms*/5000, /*max_dispatch_per_tick*/8);
+    EXPECT_EQ(manager.size(), 1u);
+    EXPECT_EQ(repo.save_atomic_count.load(std::memory_order_acquire), 1);
+
+    manager.SweepExpiredSessions(/*now_ms*/86500, /*idle_timeout_ms*/5000, /*max_dispatch_per_tick*/8);
+    ASSERT_TRUE(WaitUntil([&repo]() { return repo.save_atomic_count.load(std::memory_order_acquire) >= 2; }));
+    EXPECT_EQ(repo.last_summary.trace_id, "612");
+
+    pool.shutdown();
+}
+
 TEST_F(TraceSessionManagerUnitTest, PushRejectsNewTraceButAllowsExistingTraceWhenOverload)
 {
     // 目的：验证进入 overload 后只拒绝新 trace，已在内存中的老 trace 仍尽量放行，避免聚合被截断。
@@ -1992,19 +2675,19 @@ TEST_F(TraceSessionManagerUnitTest, PushRejectsNewTraceButAllowsExistingTraceWhe
                   TraceSessionManager::PushResult::Accepted);
     }
 
-    EXPECT_EQ(manager.overload_state_, TraceSessionManager::OverloadState::Overload);
-    EXPECT_EQ(manager.total_buffered_spans_, 7u);
-    EXPECT_EQ(manager.active_sessions_, 1u);
+    EXPECT_EQ(manager.overload_state_.load(), TraceSessionManager::OverloadState::Overload);
+    EXPECT_EQ(manager.total_buffered_spans_.load(), 7u);
+    EXPECT_EQ(manager.active_sessions_.load(), 1u);
 
     EXPECT_EQ(manager.Push(MakeSpan(702, 7101, 2000)),
               TraceSessionManager::PushResult::RejectedOverload);
-    EXPECT_EQ(manager.total_buffered_spans_, 7u);
-    EXPECT_EQ(manager.active_sessions_, 1u);
+    EXPECT_EQ(manager.total_buffered_spans_.load(), 7u);
+    EXPECT_EQ(manager.active_sessions_.load(), 1u);
 
     EXPECT_EQ(manager.Push(MakeSpan(701, 7008, 2001)),
               TraceSessionManager::PushResult::Accepted);
-    EXPECT_EQ(manager.total_buffered_spans_, 8u);
-    EXPECT_EQ(manager.active_sessions_, 1u);
+    EXPECT_EQ(manager.total_buffered_spans_.load(), 8u);
+    EXPECT_EQ(manager.active_sessions_.load(), 1u);
 
     pool.shutdown();
 }
@@ -2035,16 +2718,16 @@ TEST_F(TraceSessionManagerUnitTest, PushRejectsExistingTraceWhenCritical)
                   TraceSessionManager::PushResult::Accepted);
     }
 
-    EXPECT_EQ(manager.overload_state_, TraceSessionManager::OverloadState::Critical);
-    EXPECT_EQ(manager.total_buffered_spans_, 9u);
-    EXPECT_EQ(manager.active_sessions_, 1u);
+    EXPECT_EQ(manager.overload_state_.load(), TraceSessionManager::OverloadState::Critical);
+    EXPECT_EQ(manager.total_buffered_spans_.load(), 9u);
+    EXPECT_EQ(manager.active_sessions_.load(), 1u);
 
     EXPECT_EQ(manager.Push(MakeSpan(801, 8010, 2000)),
               TraceSessionManager::PushResult::RejectedOverload);
     EXPECT_EQ(manager.Push(MakeSpan(802, 8201, 2001)),
               TraceSessionManager::PushResult::RejectedOverload);
-    EXPECT_EQ(manager.total_buffered_spans_, 9u);
-    EXPECT_EQ(manager.active_sessions_, 1u);
+    EXPECT_EQ(manager.total_buffered_spans_.load(), 9u);
+    EXPECT_EQ(manager.active_sessions_.load(), 1u);
 
     pool.shutdown();
 }
@@ -2078,9 +2761,9 @@ TEST_F(TraceSessionManagerUnitTest, PushReturnsAcceptedDeferredWhenSubmitFails)
 
     EXPECT_EQ(result, TraceSessionManager::PushResult::Accepted);
     ASSERT_EQ(manager.size(), 1u);
-    auto iter = manager.index_by_trace_.find(901);
-    ASSERT_NE(iter, manager.index_by_trace_.end());
-    EXPECT_EQ(manager.sessions_[iter->second]->lifecycle_state,
+    auto iter = manager.shards_[0]->index_by_trace_.find(901);
+    ASSERT_NE(iter, manager.shards_[0]->index_by_trace_.end());
+    EXPECT_EQ(manager.shards_[0]->sessions_[iter->second]->lifecycle_state,
               TraceSession::LifecycleState::Sealed);
     
     SweepOneTick(manager, /*now_ms*/1000);
@@ -2089,13 +2772,91 @@ TEST_F(TraceSessionManagerUnitTest, PushReturnsAcceptedDeferredWhenSubmitFails)
                session.retry_count == 1u &&
                session.next_retry_tick == 2u;
     }));
-    iter = manager.index_by_trace_.find(901);
-    ASSERT_NE(iter, manager.index_by_trace_.end());
-    EXPECT_EQ(manager.sessions_[iter->second]->lifecycle_state,
+    iter = manager.shards_[0]->index_by_trace_.find(901);
+    ASSERT_NE(iter, manager.shards_[0]->index_by_trace_.end());
+    EXPECT_EQ(manager.shards_[0]->sessions_[iter->second]->lifecycle_state,
               TraceSession::LifecycleState::ReadyRetryLater);
     EXPECT_EQ(manager.size(), 1u);
-    EXPECT_EQ(manager.sessions_[iter->second]->retry_count, 1u);
-    EXPECT_EQ(manager.sessions_[iter->second]->next_retry_tick, 2u);
+    EXPECT_EQ(manager.shards_[0]->sessions_[iter->second]->retry_count, 1u);
+    EXPECT_EQ(manager.shards_[0]->sessions_[iter->second]->next_retry_tick, 2u);
+}
+
+TEST_F(TraceSessionManagerUnitTest, EstimateSpanBytesScalesWithStringsAndAttributes)
+{
+    SpanEvent small = MakeSpan(1, 1, 1000);
+    SpanEvent fat = small;
+    fat.attributes["http.request.body"] = std::string(50 * 1024, 'x');
+    const size_t small_bytes = TraceSessionManager::EstimateSpanBytes(small);
+    const size_t fat_bytes = TraceSessionManager::EstimateSpanBytes(fat);
+    EXPECT_GE(small_bytes, sizeof(SpanEvent) + small.name.size() + small.service_name.size());
+    EXPECT_GT(fat_bytes, small_bytes + 50 * 1024);
+    EXPECT_LT(fat_bytes, small_bytes + 50 * 1024 + 256);
+}
+
+TEST_F(TraceSessionManagerUnitTest, BufferedBytesWatermarkRejectsNewTraceWhenSpanCountIsLow)
+{
+    // 目的：span 条数远没到水位时，少量大 span 按字节预算也要把状态推进 overload；分发后字节计数原样扣回。
+    ThreadPool pool(1, /*max_queue_size*/100);
+    FakeTraceRepository repo;
+    auto buffered_repo = MakeBufferedTraceRepository(&repo);
+    TraceSessionManager manager(&pool,
+                                buffered_repo.get(),
+                                /*trace_ai*/nullptr,
+                                /*capacity*/100,
+                                /*token_limit*/0,
+                                /*notifier*/nullptr,
+                                /*idle_timeout_ms*/5000,
+                                /*wheel_tick_ms*/500,
+                                /*sealed_grace_window_ms*/1000,
+                                /*retry_base_delay_ms*/500,
+                                /*wheel_size*/512,
+                                /*buffered_span_hard_limit*/4096,
+                                /*active_session_hard_limit*/1024,
+                                /*active_session_overload_percent*/75,
+                                /*active_session_critical_percent*/90,
+                                /*buffered_spans_overload_percent*/75,
+                                /*buffered_spans_critical_percent*/90,
+                                /*pending_tasks_overload_percent*/75,
+                                /*pending_tasks_critical_percent*/90,
+                                /*service_runtime_accumulator*/nullptr,
+                                /*system_runtime_accumulator*/nullptr,
+                                /*ai_analysis_enabled*/true,
+                                /*ai_circuit_breaker_enabled*/true,
+                                /*ai_failure_threshold*/5,
+                                /*ai_cooldown_ms*/60000,
+                                /*fallback_trace_ai*/nullptr,
+                                /*ai_auto_degrade_enabled*/false,
+                                /*session_shard_count*/1,
+                                /*ai_async_dispatch_enabled*/false,
+                                /*ai_result_cache_capacity*/0,
+                                /*ai_result_cache_ttl_ms*/600000,
+                                /*session_pool_size*/0,
+                                /*buffered_bytes_hard_limit*/64 * 1024,
+                                /*buffered_bytes_overload_percent*/75,
+                                /*buffered_bytes_critical_percent*/90);
+
+    // 一个 50KB attribute 的 span 就越过 48KB 的 overload 线，但还没到 critical。
+    SpanEvent fat = MakeSpan(801, 1, 1000);
+    fat.attributes["http.request.body"] = std::string(50 * 1024, 'x');
+    const size_t fat_bytes = TraceSessionManager::EstimateSpanBytes(fat);
+    ASSERT_EQ(manager.Push(fat), TraceSessionManager::PushResult::Accepted);
+    EXPECT_EQ(manager.total_buffered_spans_.load(), 1u);
+    EXPECT_EQ(manager.total_buffered_bytes_.load(), fat_bytes);
+    EXPECT_EQ(manager.overload_state_.load(), TraceSessionManager::OverloadState::Overload);
+
+    EXPECT_EQ(manager.Push(MakeSpan(802, 1, 1001)), TraceSessionManager::PushResult::RejectedOverload);
+    const SpanEvent late = MakeSpan(801, 2, 1002);
+    ASSERT_EQ(manager.Push(late), TraceSessionManager::PushResult::Accepted);
+    const TraceSessionManager::RuntimeStatsSnapshot stats = manager.SnapshotRuntimeStats();
+    EXPECT_EQ(stats.buffered_spans, 2u);
+    EXPECT_EQ(stats.buffered_bytes, fat_bytes + TraceSessionManager::EstimateSpanBytes(late));
+
+    ASSERT_TRUE(manager.Dispatch(801));
+    EXPECT_EQ(manager.total_buffered_bytes_.load(), 0u);
+    EXPECT_EQ(manager.Push(MakeSpan(802, 1, 1003)), TraceSessionManager::PushResult::Accepted);
+    EXPECT_EQ(manager.overload_state_.load(), TraceSessionManager::OverloadState::Normal);
+
+    pool.shutdown();
 }
 
 TEST_F(TraceSessionManagerUnitTest, BackpressureRecoversWhenWatermarkDropsBelowLow)
@@ -2124,7 +2885,7 @@ TEST_F(TraceSessionManagerUnitTest, BackpressureRecoversWhenWatermarkDropsBelowL
     for (size_t i = 0; i < 76; ++i) {
         manager.Push(MakeSpan(1001, 10000 + i, 1000));
     }
-    EXPECT_EQ(manager.overload_state_, TraceSessionManager::OverloadState::Overload);
+    EXPECT_EQ(manager.overload_state_.load(), TraceSessionManager::OverloadState::Overload);
 
     // 2. 此时拒绝新 Trace。
     EXPECT_EQ(manager.Push(MakeSpan(1002, 20000, 1000)), 
@@ -2135,9 +2896,1376 @@ TEST_F(TraceSessionManagerUnitTest, BackpressureRecoversWhenWatermarkDropsBelowL
     manager.Dispatch(1001);
     
     // 4. 验证状态机恢复，且新 Trace 现在能被接收。
-    EXPECT_EQ(manager.overload_state_, TraceSessionManager::OverloadState::Normal);
+    EXPECT_EQ(manager.overload_state_.load(), TraceSessionManager::OverloadState::Normal);
     EXPECT_EQ(manager.Push(MakeSpan(1002, 20000, 1000)), 
               TraceSessionManager::PushResult::Accepted);
     
     pool.shutdown();
 }
+
+TEST_F(TraceSessionManagerUnitTest, ShardedManagerRoutesTraceToSingleShardAndKeepsGlobalWatermark)
+{
+    // 目的：验证分片后同一 trace 的 span 只落在 ShardFor 选中的 shard，
+    // 而背压水位仍按所有 shard 的合计判断，不会因为拆锁变成“每片各算各的”。
+    ThreadPool pool(1, 100);
+    FakeTraceRepository repo;
+    auto buffered_repo = MakeBufferedTraceRepository(&repo);
+    TraceSessionManager manager(&pool,
+                                buffered_repo.get(),
+                                nullptr,
+                                /*capacity*/100,
+                                /*token_limit*/0,
+                                nullptr,
+                                /*idle_timeout_ms*/5000,
+                                /*wheel_tick_ms*/500,
+                                /*sealed_grace_window_ms*/1000,
+                                /*retry_base_delay_ms*/500,
+                                /*wheel_size*/512,
+                                /*buffered_span_hard_limit*/100,
+                                /*active_session_hard_limit*/10,
+                                75, 90, 75, 90, 75, 90,
+                                nullptr,
+                                nullptr,
+                                /*ai_analysis_enabled*/true,
+                                /*ai_circuit_breaker_enabled*/true,
+                                /*ai_failure_threshold*/5,
+                                /*ai_cooldown_ms*/60000,
+                                /*fallback_trace_ai*/nullptr,
+                                /*ai_auto_degrade_enabled*/false,
+                                /*session_shard_count*/4);
+    ASSERT_EQ(manager.shards_.size(), 4u);
+
+    // active_session_hard_limit=10 -> high=7；7 条不同 trace 分散在多个 shard，合计仍应触发 overload。
+    for (size_t trace_key = 1; trace_key <= 7; ++trace_key) {
+        ASSERT_EQ(manager.Push(MakeSpan(trace_key, trace_key * 10, 1000)),
+                  TraceSessionManager::PushResult::Accepted);
+    }
+    EXPECT_EQ(manager.size(), 7u);
+    EXPECT_EQ(manager.active_sessions_.load(), 7u);
+    EXPECT_EQ(manager.total_buffered_spans_.load(), 7u);
+    EXPECT_EQ(manager.overload_state_.load(), TraceSessionManager::OverloadState::Overload);
+
+    std::set<const TraceSessionManager::Shard*> used_shards;
+    for (size_t trace_key = 1; trace_key <= 7; ++trace_key) {
+        const TraceSessionManager::Shard& owner = manager.ShardFor(trace_key);
+        used_shards.insert(&owner);
+        for (const auto& shard : manager.shards_) {
+            const bool found = shard->index_by_trace_.count(trace_key) > 0;
+            EXPECT_EQ(found, shard.get() == &owner) << "trace_key=" << trace_key;
+        }
+    }
+    EXPECT_GT(used_shards.size(), 1u);
+
+    // 新 trace 被全局水位拒绝；已有 trace 仍可继续追加。
+    EXPECT_EQ(manager.Push(MakeSpan(8, 80, 1000)),
+              TraceSessionManager::PushResult::RejectedOverload);
+    EXPECT_EQ(manager.Push(MakeSpan(3, 31, 1001)),
+              TraceSessionManager::PushResult::Accepted);
+    EXPECT_EQ(manager.total_buffered_spans_.load(), 8u);
+
+    pool.shutdown();
+}
+
+TEST_F(TraceSessionManagerUnitTest, ShardedManagerAcceptsConcurrentPushesWithoutLosingSpans)
+{
+    // 目的：多个 IO 线程并发 Push 不同 trace 时，各 shard 独立加锁，全局计数仍要精确守恒。
+    ThreadPool pool(1, 1000);
+    FakeTraceRepository repo;
+    auto buffered_repo = MakeBufferedTraceRepository(&repo);
+    TraceSessionManager manager(&pool,
+                                buffered_repo.get(),
+                                nullptr,
+                                /*capacity*/1000,
+                                /*token_limit*/0,
+                                nullptr,
+                                /*idle_timeout_ms*/5000,
+                                /*wheel_tick_ms*/500,
+                                /*sealed_grace_window_ms*/1000,
+                                /*retry_base_delay_ms*/500,
+                                /*wheel_size*/512,
+                                /*buffered_span_hard_limit*/100000,
+                                /*active_session_hard_limit*/10000,
+                                75, 90, 75, 90, 75, 90,
+                                nullptr,
+                                nullptr,
+                                true,
+                                true,
+                                5,
+                                60000,
+                                nullptr,
+                                false,
+                                /*session_shard_count*/8);
+
+    constexpr size_t kThreads = 4;
+    constexpr size_t kTracesPerThread = 50;
+    constexpr size_t kSpansPerTrace = 5;
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < kThreads; ++t) {
+        threads.emplace_back([&, t]() {
+            for (size_t i = 0; i < kTracesPerThread; ++i) {
+                const size_t trace_key = 100000 + t * kTracesPerThread + i;
+                for (size_t s = 0; s < kSpansPerTrace; ++s) {
+                    EXPECT_EQ(manager.Push(MakeSpan(trace_key, s + 1, 1000)),
+                              TraceSessionManager::PushResult::Accepted);
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    EXPECT_EQ(manager.size(), kThreads * kTracesPerThread);
+    EXPECT_EQ(manager.active_sessions_.load(), kThreads * kTracesPerThread);
+    EXPECT_EQ(manager.total_buffered_spans_.load(), kThreads * kTracesPerThread * kSpansPerTrace);
+
+    pool.shutdown();
+}
+
+TEST_F(TraceSessionManagerUnitTest, PushBatchKeepsPerTraceOrderAndReturnsResultsByIndex)
+{
+    // 目的：批量 Push 分组后仍要保持同一 trace 内的到达顺序，
+    // 所以 trace_end 之后同批的 late span 走 sealed 吸收，重复 span 也按原顺序识别。
+    ThreadPool pool(1, 100);
+    FakeTraceRepository repo;
+    auto buffered_repo = MakeBufferedTraceRepository(&repo);
+    TraceSessionManager manager(&pool, buffered_repo.get(), nullptr, /*capacity*/100, /*token_limit*/0);
+
+    SpanEvent end_span = MakeSpan(1201, 2, 1001);
+    end_span.trace_end = true;
+    const std::vector<SpanEvent> batch = {
+        MakeSpan(1201, 1, 1000),
+        MakeSpan(1202, 1, 1000),
+        end_span,
+        MakeSpan(1201, 3, 1002),
+    };
+    const std::vector<TraceSessionManager::PushResult> results = manager.PushBatch(batch);
+
+    ASSERT_EQ(results.size(), batch.size());
+    for (const auto result : results) {
+        EXPECT_EQ(result, TraceSessionManager::PushResult::Accepted);
+    }
+    EXPECT_EQ(manager.size(), 2u);
+    EXPECT_EQ(manager.total_buffered_spans_.load(), 4u);
+    auto iter = manager.shards_[0]->index_by_trace_.find(1201);
+    ASSERT_NE(iter, manager.shards_[0]->index_by_trace_.end());
+    const TraceSession& session = *manager.shards_[0]->sessions_[iter->second];
+    EXPECT_EQ(session.lifecycle_state, TraceSession::LifecycleState::Sealed);
+    ASSERT_EQ(session.spans.size(), 3u);
+    EXPECT_EQ(session.spans[0].span_id, 1u);
+    EXPECT_EQ(session.spans[1].span_id, 2u);
+    EXPECT_EQ(session.spans[2].span_id, 3u);
+
+    EXPECT_TRUE(manager.PushBatch({}).empty());
+
+    pool.shutdown();
+}
+
+TEST_F(TraceSessionManagerUnitTest, AsyncAiDispatchKeepsManyCallsInFlightOnSingleWorker)
+{
+    // 单 worker 线程下同时发出三条 trace 的 AI 请求：同步模式里第二条必须等第一条模型返回，
+    // 异步模式里 worker 只负责发起，三条请求应该同时挂在 provider 上。
+    ThreadPool pool(1);
+    FakeTraceRepository repo;
+    AsyncStubTraceAi async_ai;
+    auto buffered_repo = MakeBufferedTraceRepository(&repo);
+    auto manager = std::make_unique<TraceSessionManager>(&pool,
+                                buffered_repo.get(),
+                                &async_ai,
+                                /*capacity*/10,
+                                /*token_limit*/0,
+                                /*notifier*/nullptr,
+                                /*idle_timeout_ms*/5000,
+                                /*wheel_tick_ms*/500,
+                                /*sealed_grace_window_ms*/1000,
+                                /*retry_base_delay_ms*/500,
+                                /*wheel_size*/512,
+                                /*buffered_span_hard_limit*/4096,
+                                /*active_session_hard_limit*/1024,
+                                /*active_session_overload_percent*/75,
+                                /*active_session_critical_percent*/90,
+                                /*buffered_spans_overload_percent*/75,
+                                /*buffered_spans_critical_percent*/90,
+                                /*pending_tasks_overload_percent*/75,
+                                /*pending_tasks_critical_percent*/90,
+                                /*service_runtime_accumulator*/nullptr,
+                                /*system_runtime_accumulator*/nullptr,
+                                /*ai_analysis_enabled*/true,
+                                /*ai_circuit_breaker_enabled*/true,
+                                /*ai_failure_threshold*/5,
+                                /*ai_cooldown_ms*/60000,
+                                /*fallback_trace_ai*/nullptr,
+                                /*ai_auto_degrade_enabled*/false,
+                                /*session_shard_count*/1,
+                                /*ai_async_dispatch_enabled*/true);
+
+    for (size_t trace_key = 5101; trace_key <= 5103; ++trace_key) {
+        SpanEvent span = MakeSpan(trace_key, 1, 1000);
+        span.trace_end = true;
+        ASSERT_EQ(manager->Push(span), TraceSessionManager::PushResult::Accepted);
+    }
+    SweepTraceEndSealWindow(*manager);
+
+    ASSERT_TRUE(WaitUntil([&async_ai]() { return async_ai.PendingCount() == 3; }));
+    EXPECT_EQ(manager->SnapshotRuntimeStats().ai_async_inflight, 3u);
+    EXPECT_EQ(async_ai.sync_called_count.load(std::memory_order_acquire), 0);
+    EXPECT_EQ(repo.save_analysis_count.load(std::memory_order_acquire), 0);
+
+    async_ai.CompleteAll(/*fail*/false);
+    ASSERT_TRUE(WaitUntil([&repo]() {
+        return repo.save_analysis_count.load(std::memory_order_acquire) == 3;
+    }));
+    ASSERT_TRUE(WaitUntil([&manager]() { return manager->SnapshotRuntimeStats().ai_async_inflight == 0; }));
+    ASSERT_TRUE(repo.last_analysis.has_value());
+    EXPECT_EQ(repo.last_analysis->summary, "async-summary");
+    EXPECT_EQ(manager->SnapshotRuntimeStats().worker_done_count, 3u);
+
+    manager.reset();
+    pool.shutdown();
+}
+
+TEST_F(TraceSessionManagerUnitTest, AsyncAiDispatchFallsBackToSecondaryWhenAsyncPrimaryFails)
+{
+    ThreadPool pool(1);
+    FakeTraceRepository repo;
+    AsyncStubTraceAi primary_ai;
+    StubTraceAi fallback_ai;
+    fallback_ai.response.analysis.summary = "fallback-summary";
+    fallback_ai.response.analysis.risk_level = RiskLevel::WARNING;
+    auto buffered_repo = MakeBufferedTraceRepository(&repo);
+    auto manager = std::make_unique<TraceSessionManager>(&pool,
+                                buffered_repo.get(),
+                                &primary_ai,
+                                /*capacity*/10,
+                                /*token_limit*/0,
+                                /*notifier*/nullptr,
+                                /*idle_timeout_ms*/5000,
+                                /*wheel_tick_ms*/500,
+                                /*sealed_grace_window_ms*/1000,
+                                /*retry_base_delay_ms*/500,
+                                /*wheel_size*/512,
+                                /*buffered_span_hard_limit*/4096,
+                                /*active_session_hard_limit*/1024,
+                                /*active_session_overload_percent*/75,
+                                /*active_session_critical_percent*/90,
+                                /*buffered_spans_overload_percent*/75,
+                                /*buffered_spans_critical_percent*/90,
+                                /*pending_tasks_overload_percent*/75,
+                                /*pending_tasks_critical_percent*/90,
+                                /*service_runtime_accumulator*/nullptr,
+                                /*system_runtime_accumulator*/nullptr,
+                                /*ai_analysis_enabled*/true,
+                                /*ai_circuit_breaker_enabled*/true,
+                                /*ai_failure_threshold*/5,
+                                /*ai_cooldown_ms*/60000,
+                                /*fallback_trace_ai*/&fallback_ai,
+                                /*ai_auto_degrade_enabled*/true,
+                                /*session_shard_count*/1,
+                                /*ai_async_dispatch_enabled*/true);
+
+    SpanEvent span = MakeSpan(5201, 1, 1000);
+    span.trace_end = true;
+    ASSERT_EQ(manager->Push(span), TraceSessionManager::PushResult::Accepted);
+    SweepTraceEndSealWindow(*manager);
+
+    ASSERT_TRUE(WaitUntil([&primary_ai]() { return primary_ai.PendingCount() == 1; }));
+    primary_ai.CompleteAll(/*fail*/true);
+    ASSERT_TRUE(WaitUntil([&repo]() { return repo.save_analysis_called.load(std::memory_order_acquire); }));
+
+    // 异步主路失败后的降级语义和同步路径完全一致：备路成功就按 completed 落 analysis，不写失败状态。
+    EXPECT_TRUE(fallback_ai.called.load(std::memory_order_acquire));
+    ASSERT_TRUE(repo.last_analysis.has_value());
+    EXPECT_EQ(repo.last_analysis->summary, "fallback-summary");
+    EXPECT_FALSE(repo.update_ai_state_called.load(std::memory_order_acquire));
+
+    manager.reset();
+    pool.shutdown();
+}
+
+TEST_F(TraceSessionManagerUnitTest, AsyncAiCompletionNeverRunsOnProviderLoopWhenPoolRejects)
+{
+    // 回调到来时线程池已经拒收：收尾（落库 + 告警）必须转给专用完成线程，不能就地跑在 provider 的 loop 线程上。
+    ThreadPool pool(1);
+    FakeTraceRepository repo;
+    AsyncStubTraceAi async_ai;
+    async_ai.response.analysis.risk_level = RiskLevel::CRITICAL;
+    SpyNotifier notifier;
+    auto buffered_repo = MakeBufferedTraceRepository(&repo);
+    auto manager = std::make_unique<TraceSessionManager>(&pool,
+                                buffered_repo.get(),
+                                &async_ai,
+                                /*capacity*/10,
+                                /*token_limit*/0,
+                                /*notifier*/&notifier,
+                                /*idle_timeout_ms*/5000,
+                                /*wheel_tick_ms*/500,
+                                /*sealed_grace_window_ms*/1000,
+                                /*retry_base_delay_ms*/500,
+                                /*wheel_size*/512,
+                                /*buffered_span_hard_limit*/4096,
+                                /*active_session_hard_limit*/1024,
+                                /*active_session_overload_percent*/75,
+                                /*active_session_critical_percent*/90,
+                                /*buffered_spans_overload_percent*/75,
+                                /*buffered_spans_critical_percent*/90,
+                                /*pending_tasks_overload_percent*/75,
+                                /*pending_tasks_critical_percent*/90,
+                                /*service_runtime_accumulator*/nullptr,
+                                /*system_runtime_accumulator*/nullptr,
+                                /*ai_analysis_enabled*/true,
+                                /*ai_circuit_breaker_enabled*/true,
+                                /*ai_failure_threshold*/5,
+                                /*ai_cooldown_ms*/60000,
+                                /*fallback_trace_ai*/nullptr,
+                                /*ai_auto_degrade_enabled*/false,
+                                /*session_shard_count*/1,
+                                /*ai_async_dispatch_enabled*/true);
+
+    SpanEvent span = MakeSpan(5251, 1, 1000);
+    span.trace_end = true;
+    ASSERT_EQ(manager->Push(span), TraceSessionManager::PushResult::Accepted);
+    SweepTraceEndSealWindow(*manager);
+    ASSERT_TRUE(WaitUntil([&async_ai]() { return async_ai.PendingCount() == 1; }));
+
+    pool.shutdown();
+    const std::thread::id loop_id = async_ai.CompleteAll(/*fail*/false);
+
+    ASSERT_TRUE(WaitUntil([&notifier]() {
+        return notifier.notify_trace_alert_called.load(std::memory_order_acquire);
+    }));
+    EXPECT_NE(notifier.alert_thread, loop_id);
+    ASSERT_TRUE(WaitUntil([&repo]() { return repo.save_analysis_called.load(std::memory_order_acquire); }));
+    ASSERT_TRUE(WaitUntil([&manager]() { return manager->SnapshotRuntimeStats().ai_async_inflight == 0; }));
+    EXPECT_EQ(manager->SnapshotRuntimeStats().ai_completion_overflow, 1u);
+
+    manager.reset();
+}
+
+TEST_F(TraceSessionManagerUnitTest, AsyncAiDispatchIssuesFallbackAsynchronouslyWhenSupported)
+{
+    // 主路异步失败后，支持异步的备路也走 AnalyzeTraceAsync，不在收尾线程上同步阻塞等模型。
+    ThreadPool pool(1);
+    FakeTraceRepository repo;
+    AsyncStubTraceAi primary_ai;
+    AsyncStubTraceAi fallback_ai;
+    fallback_ai.response.analysis.summary = "async-fallback-summary";
+    auto buffered_repo = MakeBufferedTraceRepository(&repo);
+    auto manager = std::make_unique<TraceSessionManager>(&pool,
+                                buffered_repo.get(),
+                                &primary_ai,
+                                /*capacity*/10,
+                                /*token_limit*/0,
+                                /*notifier*/nullptr,
+                                /*idle_timeout_ms*/5000,
+                                /*wheel_tick_ms*/500,
+                                /*sealed_grace_window_ms*/1000,
+                                /*retry_base_delay_ms*/500,
+                                /*wheel_size*/512,
+                                /*buffered_span_hard_limit*/4096,
+                                /*active_session_hard_limit*/1024,
+                                /*active_session_overload_percent*/75,
+                                /*active_session_critical_percent*/90,
+                                /*buffered_spans_overload_percent*/75,
+                                /*buffered_spans_critical_percent*/90,
+                                /*pending_tasks_overload_percent*/75,
+                                /*pending_tasks_critical_percent*/90,
+                                /*service_runtime_accumulator*/nullptr,
+                                /*system_runtime_accumulator*/nullptr,
+                                /*ai_analysis_enabled*/true,
+                                /*ai_circuit_breaker_enabled*/true,
+                                /*ai_failure_threshold*/5,
+                                /*ai_cooldown_ms*/60000,
+                                /*fallback_trace_ai*/&fallback_ai,
+                                /*ai_auto_degrade_enabled*/true,
+                                /*session_shard_count*/1,
+                                /*ai_async_dispatch_enabled*/true);
+
+    SpanEvent span = MakeSpan(5261, 1, 1000);
+    span.trace_end = true;
+    ASSERT_EQ(manager->Push(span), TraceSessionManager::PushResult::Accepted);
+    SweepTraceEndSealWindow(*manager);
+
+    ASSERT_TRUE(WaitUntil([&primary_ai]() { return primary_ai.PendingCount() == 1; }));
+    primary_ai.CompleteAll(/*fail*/true);
+    ASSERT_TRUE(WaitUntil([&fallback_ai]() { return fallback_ai.PendingCount() == 1; }));
+    EXPECT_EQ(fallback_ai.sync_called_count.load(std::memory_order_acquire), 0);
+    // 备路还在途时 trace 仍算一条在途调用，析构会等它收尾。
+    EXPECT_EQ(manager->SnapshotRuntimeStats().ai_async_inflight, 1u);
+    EXPECT_FALSE(repo.save_analysis_called.load(std::memory_order_acquire));
+
+    fallback_ai.CompleteAll(/*fail*/false);
+    ASSERT_TRUE(WaitUntil([&repo]() { return repo.save_analysis_called.load(std::memory_order_acquire); }));
+    ASSERT_TRUE(repo.last_analysis.has_value());
+    EXPECT_EQ(repo.last_analysis->summary, "async-fallback-summary");
+    EXPECT_FALSE(repo.update_ai_state_called.load(std::memory_order_acquire));
+    ASSERT_TRUE(WaitUntil([&manager]() { return manager->SnapshotRuntimeStats().ai_async_inflight == 0; }));
+
+    manager.reset();
+    pool.shutdown();
+}
+
+TEST_F(TraceSessionManagerUnitTest, AsyncCapableProviderStaysSynchronousWhenAsyncDispatchDisabled)
+{
+    ThreadPool pool(1);
+    FakeTraceRepository repo;
+    AsyncStubTraceAi async_ai;
+    auto buffered_repo = MakeBufferedTraceRepository(&repo);
+    TraceSessionManager manager(&pool, buffered_repo.get(), &async_ai, /*capacity*/10, /*token_limit*/0);
+
+    SpanEvent span = MakeSpan(5301, 1, 1000);
+    span.trace_end = true;
+    ASSERT_EQ(manager.Push(span), TraceSessionManager::PushResult::Accepted);
+    SweepTraceEndSealWindow(manager);
+
+    ASSERT_TRUE(WaitUntil([&repo]() { return repo.save_analysis_called.load(std::memory_order_acquire); }));
+    EXPECT_EQ(async_ai.sync_called_count.load(std::memory_order_acquire), 1);
+    EXPECT_EQ(async_ai.PendingCount(), 0u);
+
+    pool.shutdown();
+}
+
+TEST_F(TraceSessionManagerUnitTest, TraceFingerprintIgnoresIdsTimestampsAndAttributes)
+{
+    ThreadPool pool(1);
+    TraceSessionManager manager(&pool, nullptr, nullptr, /*capacity*/10, /*token_limit*/0);
+
+    auto build = [this](size_t trace_key, size_t base_span_id, int64_t base_ms, bool reverse_arrival) {
+        TraceSession session(10);
+        SpanEvent root = MakeSpan(trace_key, base_span_id, base_ms);
+        root.end_time = base_ms + 40;
+        root.attributes["http.url"] = "/orders/" + std::to_string(trace_key);
+        SpanEvent left = MakeSpan(trace_key, base_span_id + 1, base_ms + 1);
+        left.parent_span_id = base_span_id;
+        left.service_name = "cache";
+        left.end_time = base_ms + 3;
+        SpanEvent right = MakeSpan(trace_key, base_span_id + 2, base_ms + 5);
+        right.parent_span_id = base_span_id;
+        right.service_name = "db";
+        right.end_time = base_ms + 35;
+        if (reverse_arrival) {
+            session.spans = {right, left, root};
+        } else {
+            session.spans = {root, left, right};
+        }
+        return session;
+    };
+
+    // trace/span id、绝对时间、attributes 和 span 到达顺序都不一样，但调用树、状态和耗时量级一样。
+    TraceSession first = build(1, 100, 1000, false);
+    TraceSession second = build(2, 900, 50000, true);
+    EXPECT_EQ(manager.ComputeTraceFingerprint(manager.BuildTraceIndex(first)),
+              manager.ComputeTraceFingerprint(manager.BuildTraceIndex(second)));
+
+    pool.shutdown();
+}
+
+TEST_F(TraceSessionManagerUnitTest, TraceFingerprintTracksStatusShapeAndDurationBucket)
+{
+    ThreadPool pool(1);
+    TraceSessionManager manager(&pool, nullptr, nullptr, /*capacity*/10, /*token_limit*/0);
+
+    auto fingerprint_of = [&manager, this](int64_t child_duration_ms,
+                                           std::optional<SpanEvent::Status> child_status,
+                                           bool child_under_root) {
+        TraceSession session(10);
+        SpanEvent root = MakeSpan(1, 1, 1000);
+        root.end_time = 1100;
+        SpanEvent child = MakeSpan(1, 2, 1010);
+        if (child_under_root) {
+            child.parent_span_id = 1;
+        }
+        child.end_time = 1010 + child_duration_ms;
+        child.status = child_status;
+        session.spans = {root, child};
+        return manager.ComputeTraceFingerprint(manager.BuildTraceIndex(session));
+    };
+
+    const uint64_t baseline = fingerprint_of(11, SpanEvent::Status::Ok, true);
+    // 11ms 和 14ms 落在同一个 2 的幂桶里，指纹不变。
+    EXPECT_EQ(baseline, fingerprint_of(14, SpanEvent::Status::Ok, true));
+    // 跨桶的耗时、不同的状态、不同的树形状都要换指纹。
+    EXPECT_NE(baseline, fingerprint_of(40, SpanEvent::Status::Ok, true));
+    EXPECT_NE(baseline, fingerprint_of(11, SpanEvent::Status::Error, true));
+    EXPECT_NE(baseline, fingerprint_of(11, std::nullopt, true));
+    EXPECT_NE(baseline, fingerprint_of(11, SpanEvent::Status::Ok, false));
+
+    pool.shutdown();
+}
+
+TEST_F(TraceSessionManagerUnitTest, AiResultCacheCoalescesSameShapeTracesAndMarksCacheHits)
+{
+    ThreadPool pool(1);
+    FakeTraceRepository repo;
+    AsyncStubTraceAi async_ai;
+    auto buffered_repo = MakeBufferedTraceRepository(&repo);
+    int64_t now_ms = 0;
+    SystemRuntimeAccumulator system_runtime_accumulator(/*latency_sample_limit*/4,
+                                                       /*series_limit*/8,
+                                                       [&now_ms]() { return now_ms; },
+                                                       []() { return 0ULL; });
+    auto manager = MakeCachingManager(&pool, buffered_repo.get(), &async_ai, &system_runtime_accumulator,
+                                      /*cache_capacity*/16);
+
+    // 三条同形 trace 同时 dispatch：只有第一条真的调模型，后两条挂在它上面等结果。
+    PushTwoSpanTrace(*manager, 6101, 10);
+    PushTwoSpanTrace(*manager, 6102, 20);
+    PushTwoSpanTrace(*manager, 6103, 30);
+    SweepTraceEndSealWindow(*manager);
+
+    ASSERT_TRUE(WaitUntil([&manager]() { return manager->SnapshotRuntimeStats().ai_cache_waiting == 2; }));
+    EXPECT_EQ(async_ai.PendingCount(), 1u);
+    EXPECT_EQ(manager->SnapshotRuntimeStats().ai_calls, 1u);
+    EXPECT_EQ(manager->SnapshotRuntimeStats().ai_cache_coalesced, 2u);
+
+    async_ai.CompleteAll(/*fail*/false);
+    ASSERT_TRUE(WaitUntil([&repo]() { return repo.save_analysis_count.load(std::memory_order_acquire) == 3; }));
+
+    // 结果写进缓存后，再来一条同形 trace 直接命中，不再碰 provider。
+    PushTwoSpanTrace(*manager, 6104, 40);
+    for (int64_t sweep_ms = 2000; sweep_ms <= 3000; sweep_ms += 500) {
+        SweepOneTick(*manager, sweep_ms);
+    }
+    ASSERT_TRUE(WaitUntil([&repo]() { return repo.save_analysis_count.load(std::memory_order_acquire) == 4; }));
+    EXPECT_EQ(async_ai.PendingCount(), 0u);
+
+    std::vector<std::string> statuses = repo.SavedAnalysisStatuses();
+    std::sort(statuses.begin(), statuses.end());
+    EXPECT_EQ(statuses, (std::vector<std::string>{"completed", "completed_cache", "completed_cache", "completed_cache"}));
+    ASSERT_TRUE(repo.last_analysis.has_value());
+    EXPECT_EQ(repo.last_analysis->summary, "async-summary");
+
+    const TraceSessionManager::RuntimeStatsSnapshot stats = manager->SnapshotRuntimeStats();
+    EXPECT_EQ(stats.ai_calls, 1u);
+    EXPECT_EQ(stats.ai_cache_hits, 1u);
+    EXPECT_EQ(stats.ai_cache_misses, 1u);
+    EXPECT_EQ(stats.ai_cache_size, 1u);
+    EXPECT_EQ(stats.worker_done_count, 4u);
+
+    now_ms += 1000;
+    system_runtime_accumulator.OnTick();
+    const SystemRuntimeSnapshot snapshot = system_runtime_accumulator.BuildSnapshot();
+    EXPECT_EQ(snapshot.overview.ai_call_total, 1u);
+    EXPECT_EQ(snapshot.overview.ai_cache_hit_total, 3u);
+
+    manager.reset();
+    pool.shutdown();
+}
+
+TEST_F(TraceSessionManagerUnitTest, AiResultCacheWaitersRunTheirOwnCallWhenLeaderFails)
+{
+    ThreadPool pool(1);
+    FakeTraceRepository repo;
+    AsyncStubTraceAi async_ai;
+    auto buffered_repo = MakeBufferedTraceRepository(&repo);
+    auto manager = MakeCachingManager(&pool, buffered_repo.get(), &async_ai, nullptr, /*cache_capacity*/16);
+
+    PushTwoSpanTrace(*manager, 6201, 10);
+    PushTwoSpanTrace(*manager, 6202, 20);
+    PushTwoSpanTrace(*manager, 6203, 30);
+    SweepTraceEndSealWindow(*manager);
+    ASSERT_TRUE(WaitUntil([&manager]() { return manager->SnapshotRuntimeStats().ai_cache_waiting == 2; }));
+
+    // 领头失败不能把失败“传染”给等待者：它们各自重新发起调用，而失败结果也不进缓存。
+    async_ai.CompleteAll(/*fail*/true);
+    ASSERT_TRUE(WaitUntil([&async_ai]() { return async_ai.PendingCount() == 2; }));
+    EXPECT_EQ(repo.last_ai_status, "failed_primary");
+
+    async_ai.CompleteAll(/*fail*/false);
+    ASSERT_TRUE(WaitUntil([&repo]() { return repo.save_analysis_count.load(std::memory_order_acquire) == 2; }));
+    EXPECT_EQ(repo.SavedAnalysisStatuses(), (std::vector<std::string>{"completed", "completed"}));
+
+    const TraceSessionManager::RuntimeStatsSnapshot stats = manager->SnapshotRuntimeStats();
+    EXPECT_EQ(stats.ai_calls, 3u);
+    EXPECT_EQ(stats.ai_cache_hits, 0u);
+    EXPECT_EQ(stats.ai_cache_waiting, 0u);
+
+    manager.reset();
+    pool.shutdown();
+}
+
+TEST_F(TraceSessionManagerUnitTest, AiResultCacheWaitersResumeThroughCompletionQueueWhenPoolRejects)
+{
+    ThreadPool pool(1);
+    FakeTraceRepository repo;
+    AsyncStubTraceAi async_ai;
+    auto buffered_repo = MakeBufferedTraceRepository(&repo);
+    auto manager = MakeCachingManager(&pool, buffered_repo.get(), &async_ai, nullptr, /*cache_capacity*/16);
+
+    PushTwoSpanTrace(*manager, 6301, 10);
+    PushTwoSpanTrace(*manager, 6302, 20);
+    PushTwoSpanTrace(*manager, 6303, 30);
+    SweepTraceEndSealWindow(*manager);
+    ASSERT_TRUE(WaitUntil([&manager]() { return manager->SnapshotRuntimeStats().ai_cache_waiting == 2; }));
+
+    // 线程池拒收后，领头的收尾和两个等待者的唤醒都要经完成队列转交，而不是跟着领头就地跑：
+    // 等待者醒来要各自重新调模型，就地跑就等于在领头的收尾线程上发起模型调用。
+    pool.shutdown();
+    async_ai.CompleteAll(/*fail*/true);
+    ASSERT_TRUE(WaitUntil([&async_ai]() { return async_ai.PendingCount() == 2; }));
+    EXPECT_EQ(manager->SnapshotRuntimeStats().ai_completion_overflow, 3u);
+
+    async_ai.CompleteAll(/*fail*/false);
+    ASSERT_TRUE(WaitUntil([&repo]() { return repo.save_analysis_count.load(std::memory_order_acquire) == 2; }));
+    ASSERT_TRUE(WaitUntil([&manager]() { return manager->SnapshotRuntimeStats().ai_async_inflight == 0; }));
+    EXPECT_EQ(manager->SnapshotRuntimeStats().ai_cache_waiting, 0u);
+
+    manager.reset();
+}
+
+TEST_F(TraceSessionManagerUnitTest, SerializeTraceStreamsByteIdenticalOutputAndDfsOrder)
+{
+    ThreadPool pool(1);
+    TraceSessionManager manager(&pool, nullptr, nullptr, /*capacity*/16, /*token_limit*/0);
+
+    TraceSession session(16);
+    SpanEvent root = MakeSpan(7, 1, 1000);
+    root.end_time = 1200;
+    root.status = SpanEvent::Status::Ok;
+    root.kind = SpanEvent::Kind::Server;
+    // 覆盖转义的各条分支：引号、反斜杠、短转义控制字符、\u00xx、非 ASCII 原样输出。
+    root.name = "GET /orders?q=\"a\\b\"\t\n";
+    root.service_name = "网关-gateway";
+    root.attributes = {{"z.last", "1"}, {"a.first", "x\x01y\x1f"}, {"m.mid", "\r\b\f"}};
+    SpanEvent late_child = MakeSpan(7, 3, 1100);
+    late_child.parent_span_id = 1;
+    late_child.kind = SpanEvent::Kind::Client;
+    late_child.status = SpanEvent::Status::Error;
+    SpanEvent early_child = MakeSpan(7, 2, 1010);
+    early_child.parent_span_id = 1;
+    early_child.end_time = 1050;
+    early_child.kind = SpanEvent::Kind::Consumer;
+    early_child.status = SpanEvent::Status::Unset;
+    SpanEvent grandchild = MakeSpan(7, 4, 1020);
+    grandchild.parent_span_id = 2;
+    grandchild.kind = SpanEvent::Kind::Producer;
+    SpanEvent orphan = MakeSpan(7, 5, 900);
+    orphan.parent_span_id = 999;
+    orphan.kind = SpanEvent::Kind::Internal;
+    // 同一个 span_id 在 session 里出现两次，父节点的 children 里就会有两份，第二次访问按环记进 anomalies。
+    session.spans = {root, late_child, early_child, grandchild, orphan, grandchild};
+
+    const auto index = manager.BuildTraceIndex(session);
+    std::vector<const SpanEvent*> order;
+    const std::string streamed = manager.SerializeTrace(index, &order);
+    EXPECT_EQ(streamed, SerializeTraceWithDom(session));
+    EXPECT_NE(streamed.find("\"anomalies\":[{\"span_id\":4,\"type\":\"cycle_detected\"}]"), std::string::npos);
+
+    std::vector<size_t> order_ids;
+    for (const SpanEvent* span : order) {
+        order_ids.push_back(span->span_id);
+    }
+    EXPECT_EQ(order_ids, (std::vector<size_t>{1, 2, 4, 3, 5}));
+
+    // 空 trace 和没有环的 trace 也要对齐：前者只有空 spans 数组，后者不带 anomalies 字段。
+    TraceSession empty_session(4);
+    EXPECT_EQ(manager.SerializeTrace(manager.BuildTraceIndex(empty_session), nullptr), "{\"spans\":[]}");
+    TraceSession single(4);
+    single.spans = {MakeSpan(8, 1, 1000)};
+    const auto single_index = manager.BuildTraceIndex(single);
+    EXPECT_EQ(manager.SerializeTrace(single_index, nullptr),
+              SerializeTraceWithDom(single));
+
+    pool.shutdown();
+}
+
+TEST_F(TraceSessionManagerUnitTest, SerializeTraceKeepsDomBehaviorOnInvalidUtf8)
+{
+    ThreadPool pool(1);
+    TraceSessionManager manager(&pool, nullptr, nullptr, /*capacity*/4, /*token_limit*/0);
+
+    // 非法 UTF-8（孤立的续字节、被截断的三字节序列）在 DOM 版本里由 dump 抛 type_error，流式版本保持同样的失败方式。
+    for (const std::string& bad : {std::string("bad\x80"), std::string("cut\xE4\xB8")}) {
+        TraceSession session(4);
+        SpanEvent span = MakeSpan(9, 1, 1000);
+        span.name = bad;
+        session.spans = {span};
+        EXPECT_THROW(manager.SerializeTrace(manager.BuildTraceIndex(session), nullptr), nlohmann::json::type_error);
+    }
+
+    pool.shutdown();
+}
+
+TEST_F(TraceSessionManagerUnitTest, BuildTraceIndexUsesSortedNodesAndChildOffsets)
+{
+    TraceSessionManager manager(nullptr, nullptr, nullptr, /*capacity*/16, /*token_limit*/0);
+
+    TraceSession session(16);
+    SpanEvent root = MakeSpan(3, 30, 1000);
+    SpanEvent late_child = MakeSpan(3, 10, 1200);
+    late_child.parent_span_id = 30;
+    SpanEvent tie_child_b = MakeSpan(3, 25, 1100);
+    tie_child_b.parent_span_id = 30;
+    SpanEvent tie_child_a = MakeSpan(3, 20, 1100);
+    tie_child_a.parent_span_id = 30;
+    SpanEvent orphan = MakeSpan(3, 40, 900);
+    orphan.parent_span_id = 77;
+    // 同一个 span_id 后到的一份覆盖先到的一份：名字以最后一次上报为准。
+    SpanEvent late_child_retry = late_child;
+    late_child_retry.name = "retried";
+    session.spans = {root, late_child, tie_child_b, tie_child_a, orphan, late_child_retry};
+
+    const auto index = manager.BuildTraceIndex(session);
+
+    std::vector<size_t> node_ids;
+    for (const SpanEvent* node : index.nodes) {
+        node_ids.push_back(node->span_id);
+    }
+    EXPECT_EQ(node_ids, (std::vector<size_t>{10, 20, 25, 30, 40}));
+    ASSERT_NE(index.Find(10), TraceSessionManager::TraceIndex::npos);
+    EXPECT_EQ(index.nodes[index.Find(10)]->name, "retried");
+    EXPECT_EQ(index.Find(77), TraceSessionManager::TraceIndex::npos);
+
+    // roots 保持到达顺序；子节点集中在父节点的区间里，按 start_time、再按 span_id 排好，重复上报的 child 出现两次。
+    EXPECT_EQ(index.roots, (std::vector<uint32_t>{3, 4}));
+    ASSERT_EQ(index.child_offsets.size(), index.nodes.size() + 1);
+    const size_t root_node = index.Find(30);
+    std::vector<size_t> child_ids;
+    for (uint32_t i = index.child_offsets[root_node]; i < index.child_offsets[root_node + 1]; ++i) {
+        child_ids.push_back(index.nodes[index.children[i]]->span_id);
+    }
+    EXPECT_EQ(child_ids, (std::vector<size_t>{20, 25, 10, 10}));
+    EXPECT_EQ(index.child_offsets.back(), 4u);
+
+    EXPECT_EQ(manager.SerializeTrace(index, nullptr), SerializeTraceWithDom(session));
+}
+
+TEST_F(TraceSessionManagerUnitTest, BuildSpanRecordsWritesAttributesLikeJsonDump)
+{
+    TraceSessionManager manager(nullptr, nullptr, nullptr, /*capacity*/4, /*token_limit*/0);
+
+    SpanEvent span = MakeSpan(5, 1, 1000);
+    span.attributes = {{"z", "tail"}, {"a", "quote\"and\\slash"}, {"中文", "值\n"}};
+    SpanEvent empty = MakeSpan(5, 2, 1001);
+
+    const auto records = manager.BuildSpanRecords({&span, &empty});
+    ASSERT_EQ(records.size(), 2u);
+    EXPECT_EQ(records[0].attributes_json, nlohmann::json(span.attributes).dump());
+    EXPECT_EQ(records[1].attributes_json, "{}");
+}
+
+TEST_F(TraceSessionManagerUnitTest, TraceSessionResetKeepsCapacityAndReusesSpanSlots)
+{
+    TraceSession session(4);
+    session.trace_key = 77;
+    session.token_count = 30;
+    session.duplicate_span_id = 2;
+    session.lifecycle_state = TraceSession::LifecycleState::ReadyRetryLater;
+    session.primary_enqueued = true;
+    session.prepared_trace_payload = "{}";
+    session.prepared_fingerprint = 9;
+    SpanEvent first = MakeSpan(77, 1, 1000);
+    first.attributes = {{"http.method", "GET"}, {"peer.service", "inventory"}};
+    SpanEvent second = MakeSpan(77, 2, 1010);
+    session.AppendSpan(first);
+    session.AppendSpan(second);
+    session.span_ids = {1, 2};
+    const SpanEvent* spans_storage = session.spans.data();
+
+    session.Reset(/*max_slot_bytes*/16 * 1024);
+
+    // 除 capacity 外全部回到默认值；spans 数组本身不释放，上一轮的两个 span 进了槽位。
+    EXPECT_EQ(session.capacity, 4u);
+    EXPECT_EQ(session.trace_key, 0u);
+    EXPECT_EQ(session.token_count, 0u);
+    EXPECT_FALSE(session.duplicate_span_id.has_value());
+    EXPECT_EQ(session.lifecycle_state, TraceSession::LifecycleState::Collecting);
+    EXPECT_FALSE(session.primary_enqueued);
+    EXPECT_FALSE(session.prepared_trace_payload.has_value());
+    EXPECT_FALSE(session.prepared_fingerprint.has_value());
+    EXPECT_TRUE(session.spans.empty());
+    EXPECT_TRUE(session.span_ids.empty());
+    EXPECT_EQ(session.spans.data(), spans_storage);
+    EXPECT_GE(session.spans.capacity(), 4u);
+    EXPECT_EQ(session.span_slab.size(), 2u);
+
+    // 槽位被复用时内容必须整体换成新 span，不能残留上一条 trace 的 attributes。
+    SpanEvent next = MakeSpan(88, 5, 2000);
+    next.attributes = {{"db.system", "sqlite"}};
+    session.AppendSpan(next);
+    ASSERT_EQ(session.spans.size(), 1u);
+    EXPECT_EQ(session.span_slab.size(), 1u);
+    EXPECT_EQ(session.spans[0].trace_key, 88u);
+    EXPECT_EQ(session.spans[0].span_id, 5u);
+    EXPECT_EQ(session.spans[0].attributes, next.attributes);
+}
+
+TEST_F(TraceSessionManagerUnitTest, SessionPoolBoundsRetainedBytesPerSlotAndAcrossIdleSessions)
+{
+    // 目的：验证池子不会因为一波大 attribute 的 span 永久攥住峰值内存。
+    // 单个槽位超过 16KB 的不留；空闲 session 合计超过预算（聚合态字节上限的 1/8）时先清空槽位再放回。
+    ThreadPool pool(1);
+    FakeTraceRepository repo;
+    auto buffered_repo = MakeBufferedTraceRepository(&repo);
+    TraceSessionManager manager(&pool,
+                                buffered_repo.get(),
+                                /*trace_ai*/nullptr,
+                                /*capacity*/16,
+                                /*token_limit*/0,
+                                /*notifier*/nullptr,
+                                /*idle_timeout_ms*/5000,
+                                /*wheel_tick_ms*/500,
+                                /*sealed_grace_window_ms*/1000,
+                                /*retry_base_delay_ms*/500,
+                                /*wheel_size*/512,
+                                /*buffered_span_hard_limit*/4096,
+                                /*active_session_hard_limit*/1024,
+                                /*active_session_overload_percent*/75,
+                                /*active_session_critical_percent*/90,
+                                /*buffered_spans_overload_percent*/75,
+                                /*buffered_spans_critical_percent*/90,
+                                /*pending_tasks_overload_percent*/75,
+                                /*pending_tasks_critical_percent*/90,
+                                /*service_runtime_accumulator*/nullptr,
+                                /*system_runtime_accumulator*/nullptr,
+                                /*ai_analysis_enabled*/true,
+                                /*ai_circuit_breaker_enabled*/true,
+                                /*ai_failure_threshold*/5,
+                                /*ai_cooldown_ms*/60000,
+                                /*fallback_trace_ai*/nullptr,
+                                /*ai_auto_degrade_enabled*/false,
+                                /*session_shard_count*/1,
+                                /*ai_async_dispatch_enabled*/false,
+                                /*ai_result_cache_capacity*/0,
+                                /*ai_result_cache_ttl_ms*/600000,
+                                /*session_pool_size*/4,
+                                /*buffered_bytes_hard_limit*/1024 * 1024);
+    const size_t pool_budget = 1024 * 1024 / 8;
+
+    // 两条各 10 个 8KB attribute 的 trace：单条能放进预算，两条加起来放不下。
+    for (size_t trace_key = 91; trace_key <= 92; ++trace_key)
+    {
+        for (size_t span_id = 1; span_id <= 10; ++span_id)
+        {
+            SpanEvent span = MakeSpan(trace_key, span_id, 1000);
+            span.attributes["http.request.body"] = std::string(8 * 1024, 'x');
+            span.trace_end = span_id == 10;
+            ASSERT_EQ(manager.Push(span), TraceSessionManager::PushResult::Accepted);
+        }
+    }
+    // 一条带 64KB 堆栈的 trace：槽位本身超过单槽上限，Reset 时直接释放。
+    SpanEvent fat = MakeSpan(93, 1, 1000);
+    fat.attributes["exception.stacktrace"] = std::string(64 * 1024, 'y');
+    fat.trace_end = true;
+    ASSERT_EQ(manager.Push(fat), TraceSessionManager::PushResult::Accepted);
+
+    SweepTraceEndSealWindow(manager);
+    ASSERT_TRUE(WaitUntil([&manager]() { return manager.SnapshotRuntimeStats().session_pool_recycled == 3; }));
+
+    const TraceSessionManager::RuntimeStatsSnapshot stats = manager.SnapshotRuntimeStats();
+    EXPECT_EQ(stats.session_pool_idle, 3u);
+    EXPECT_EQ(stats.session_pool_trimmed, 1u);
+    EXPECT_LE(stats.session_pool_idle_bytes, pool_budget);
+    // 留下来的只有一条 trace 的 10 个 8KB 槽位，64KB 的那个没进池子。
+    EXPECT_GE(stats.session_pool_idle_bytes, 10u * 8 * 1024);
+    EXPECT_LT(stats.session_pool_idle_bytes, 10u * 8 * 1024 + 16 * 1024);
+    EXPECT_NE(manager.DescribeRuntimeStats().find("session_pool_trimmed=1"), std::string::npos);
+
+    // 池子里的 session 被取走时预算同步扣回。
+    ASSERT_EQ(manager.Push(MakeSpan(94, 1, 2000)), TraceSessionManager::PushResult::Accepted);
+    EXPECT_LT(manager.SnapshotRuntimeStats().session_pool_idle_bytes, stats.session_pool_idle_bytes);
+
+    pool.shutdown();
+}
+
+TEST_F(TraceSessionManagerUnitTest, SessionPoolRecyclesDispatchedSessionsForNewTraces)
+{
+    ThreadPool pool(1);
+    FakeTraceRepository repo;
+    auto buffered_repo = MakeBufferedTraceRepository(&repo);
+    TraceSessionManager manager(&pool,
+                                buffered_repo.get(),
+                                /*trace_ai*/nullptr,
+                                /*capacity*/10,
+                                /*token_limit*/0,
+                                /*notifier*/nullptr,
+                                /*idle_timeout_ms*/5000,
+                                /*wheel_tick_ms*/500,
+                                /*sealed_grace_window_ms*/1000,
+                                /*retry_base_delay_ms*/500,
+                                /*wheel_size*/512,
+                                /*buffered_span_hard_limit*/4096,
+                                /*active_session_hard_limit*/1024,
+                                /*active_session_overload_percent*/75,
+                                /*active_session_critical_percent*/90,
+                                /*buffered_spans_overload_percent*/75,
+                                /*buffered_spans_critical_percent*/90,
+                                /*pending_tasks_overload_percent*/75,
+                                /*pending_tasks_critical_percent*/90,
+                                /*service_runtime_accumulator*/nullptr,
+                                /*system_runtime_accumulator*/nullptr,
+                                /*ai_analysis_enabled*/true,
+                                /*ai_circuit_breaker_enabled*/true,
+                                /*ai_failure_threshold*/5,
+                                /*ai_cooldown_ms*/60000,
+                                /*fallback_trace_ai*/nullptr,
+                                /*ai_auto_degrade_enabled*/false,
+                                /*session_shard_count*/1,
+                                /*ai_async_dispatch_enabled*/false,
+                                /*ai_result_cache_capacity*/0,
+                                /*ai_result_cache_ttl_ms*/600000,
+                                /*session_pool_size*/4);
+
+    SpanEvent root = MakeSpan(81, 1, 1000);
+    root.attributes = {{"http.method", "GET"}, {"peer.service", "inventory"}};
+    SpanEvent child = MakeSpan(81, 2, 1010);
+    child.parent_span_id = 1;
+    child.trace_end = true;
+    ASSERT_EQ(manager.Push(root), TraceSessionManager::PushResult::Accepted);
+    ASSERT_EQ(manager.Push(child), TraceSessionManager::PushResult::Accepted);
+    SweepTraceEndSealWindow(manager);
+    ASSERT_TRUE(WaitUntil([&manager]() { return manager.SnapshotRuntimeStats().session_pool_recycled == 1; }));
+    ASSERT_TRUE(WaitUntil([&repo]() { return repo.save_atomic_count.load(std::memory_order_acquire) == 1; }));
+
+    // 第二条 trace 拿到的是回收的 session：span 槽位复用后落库的字段必须完全是新 trace 自己的。
+    SpanEvent next = MakeSpan(82, 7, 3000);
+    next.attributes = {{"db.system", "sqlite"}};
+    next.trace_end = true;
+    ASSERT_EQ(manager.Push(next), TraceSessionManager::PushResult::Accepted);
+    for (int64_t sweep_ms = 2000; sweep_ms <= 3000; sweep_ms += 500) {
+        SweepOneTick(manager, sweep_ms);
+    }
+    ASSERT_TRUE(WaitUntil([&repo]() { return repo.save_atomic_count.load(std::memory_order_acquire) == 2; }));
+    EXPECT_EQ(repo.last_summary.trace_id, "82");
+    EXPECT_EQ(repo.last_summary.span_count, 1u);
+    ASSERT_EQ(repo.last_spans.size(), 1u);
+    EXPECT_EQ(repo.last_spans[0].span_id, "7");
+    EXPECT_EQ(repo.last_spans[0].attributes_json, "{\"db.system\":\"sqlite\"}");
+
+    ASSERT_TRUE(WaitUntil([&manager]() { return manager.SnapshotRuntimeStats().session_pool_recycled == 2; }));
+    const TraceSessionManager::RuntimeStatsSnapshot stats = manager.SnapshotRuntimeStats();
+    EXPECT_EQ(stats.session_pool_created, 1u);
+    EXPECT_EQ(stats.session_pool_reused, 1u);
+    EXPECT_EQ(stats.session_pool_dropped, 0u);
+    EXPECT_EQ(stats.session_pool_idle, 1u);
+    EXPECT_NE(manager.DescribeRuntimeStats().find("session_pool_reused=1"), std::string::npos);
+
+    pool.shutdown();
+}
+
+TEST(HierarchicalTimingWheelTest, ExpiresOnExactTickAcrossCascadesAndOverflow)
+{
+    // 各种距离的到期点都要在精确 tick 上到期：跨 1~3 次降级的，以及超出 4 级总跨度、要重新分级的。
+    HierarchicalTimingWheel wheel;
+    const uint64_t start_tick = 10;
+    const std::vector<uint64_t> deltas = {1, 2, 53, 54, 63, 64, 65, 4095, 4096, 4097, 5000,
+                                          262143, 262144, 262145, 16777215, 16777216, 20000000};
+    std::vector<TimingWheelNode> nodes(deltas.size());
+    for (size_t i = 0; i < deltas.size(); ++i) {
+        wheel.Schedule(&nodes[i], i, start_tick + deltas[i], start_tick);
+    }
+    EXPECT_EQ(wheel.GetStats().occupancy, deltas.size());
+
+    std::vector<uint64_t> expired_at(deltas.size(), 0);
+    std::vector<size_t> due;
+    const uint64_t last_tick = start_tick + deltas.back();
+    for (uint64_t tick = start_tick + 1; tick <= last_tick; ++tick) {
+        due.clear();
+        wheel.Advance(tick, &due);
+        for (size_t key : due) {
+            ASSERT_LT(key, expired_at.size());
+            ASSERT_EQ(expired_at[key], 0u) << "key expired twice: " << key;
+            expired_at[key] = tick;
+        }
+    }
+    for (size_t i = 0; i < deltas.size(); ++i) {
+        EXPECT_EQ(expired_at[i], start_tick + deltas[i]) << "delta=" << deltas[i];
+        EXPECT_FALSE(nodes[i].linked());
+    }
+    const HierarchicalTimingWheel::Stats stats = wheel.GetStats();
+    EXPECT_EQ(stats.occupancy, 0u);
+    EXPECT_EQ(stats.expired, deltas.size());
+    EXPECT_GT(stats.cascaded, 0u);
+    for (size_t level_occupancy : stats.level_occupancy) {
+        EXPECT_EQ(level_occupancy, 0u);
+    }
+}
+
+TEST(HierarchicalTimingWheelTest, RescheduleAndCancelUnlinkInPlace)
+{
+    HierarchicalTimingWheel wheel;
+    TimingWheelNode node;
+    for (uint64_t i = 0; i < 1000; ++i) {
+        wheel.Schedule(&node, 7, 100 + i, 0);
+    }
+    HierarchicalTimingWheel::Stats stats = wheel.GetStats();
+    EXPECT_EQ(stats.occupancy, 1u);
+    EXPECT_EQ(stats.relinked, 999u);
+    EXPECT_EQ(node.expire_tick(), 1099u);
+
+    // 拷贝出来的节点不继承挂链状态，宿主对象整体拷贝/赋值时不会把链表指针带走。
+    TimingWheelNode copy(node);
+    EXPECT_TRUE(node.linked());
+    EXPECT_FALSE(copy.linked());
+
+    // 过去的到期点顺延到下一个 tick。
+    TimingWheelNode late;
+    wheel.Schedule(&late, 8, 3, 5);
+    EXPECT_EQ(late.expire_tick(), 6u);
+
+    wheel.Cancel(&node);
+    wheel.Cancel(&node);
+    EXPECT_FALSE(node.linked());
+    std::vector<size_t> due;
+    for (uint64_t tick = 1; tick <= 1200; ++tick) {
+        wheel.Advance(tick, &due);
+    }
+    ASSERT_EQ(due.size(), 1u);
+    EXPECT_EQ(due[0], 8u);
+    EXPECT_EQ(wheel.GetStats().occupancy, 0u);
+}
+
+TEST_F(TraceSessionManagerUnitTest, HotTraceKeepsSingleTimerNodeAndReportsWheelStats)
+{
+    ThreadPool pool(1);
+    FakeTraceRepository repo;
+    auto buffered_repo = MakeBufferedTraceRepository(&repo);
+    TraceSessionManager manager(
+        &pool,
+        buffered_repo.get(),
+        nullptr,
+        /*capacity*/100,
+        /*token_limit*/0,
+        /*notifier*/nullptr,
+        /*idle_timeout_ms*/5000,
+        /*wheel_tick_ms*/500);
+
+    // 同一条 trace 连续续命 50 次：轮上始终只挂一个节点，每次续命都记一次原地摘链。
+    for (size_t span_id = 1; span_id <= 50; ++span_id) {
+        ASSERT_EQ(manager.Push(MakeSpan(901, span_id, 1000 + static_cast<int64_t>(span_id))),
+                  TraceSessionManager::PushResult::Accepted);
+    }
+    TraceSessionManager::RuntimeStatsSnapshot stats = manager.SnapshotRuntimeStats();
+    EXPECT_EQ(stats.timer_wheel_occupancy, 1u);
+    EXPECT_EQ(stats.timer_wheel_level0, 1u);
+    EXPECT_EQ(stats.timer_wheel_relinks, 49u);
+    const std::string description = manager.DescribeRuntimeStats();
+    EXPECT_NE(description.find("timer_wheel_occupancy=1"), std::string::npos);
+    EXPECT_NE(description.find("timer_wheel_relinks=49"), std::string::npos);
+
+    manager.SweepExpiredSessions(/*now_ms*/1000, /*idle_timeout_ms*/5000, /*max_dispatch_per_tick*/8);
+    manager.SweepExpiredSessions(/*now_ms*/6000, /*idle_timeout_ms*/5000, /*max_dispatch_per_tick*/8);
+    ASSERT_TRUE(WaitUntil([&repo]() { return repo.save_atomic_count.load(std::memory_order_acquire) == 1; }));
+    ASSERT_TRUE(WaitUntil([&manager]() { return manager.SnapshotRuntimeStats().tombstone_wheel_entries == 1; }));
+    stats = manager.SnapshotRuntimeStats();
+    EXPECT_EQ(stats.timer_wheel_occupancy, 0u);
+    EXPECT_EQ(stats.tombstone_stale_skipped, 0u);
+
+    pool.shutdown();
+}
+
+TEST(TraceSamplerTest, KeepsErrorAndSlowTracesAndSamplesHealthyTracesByServiceRatio)
+{
+    TraceSamplingPolicy policy;
+    policy.healthy_keep_ratio = 0.3;
+    policy.service_keep_ratio["checkout"] = 0.0;
+    policy.slow_span_threshold_ms = 1000;
+    policy.operation_slow_threshold_ms["SELECT orders"] = 50;
+    ASSERT_TRUE(policy.SamplingEnabled());
+    TraceSampler sampler(policy);
+
+    auto make_session = [](size_t trace_key, const std::string& service, const std::string& operation, int64_t duration_ms) {
+        TraceSession session(4);
+        session.trace_key = trace_key;
+        SpanEvent span;
+        span.trace_key = trace_key;
+        span.span_id = 1;
+        span.service_name = service;
+        span.name = operation;
+        span.start_time_ms = 1000;
+        span.end_time = 1000 + duration_ms;
+        span.status = SpanEvent::Status::Ok;
+        session.AppendSpan(span);
+        return session;
+    };
+
+    // checkout 的健康 trace 比例是 0，一定丢；但错误和慢 span 不看比例。
+    TraceSession healthy = make_session(1, "checkout", "POST /pay", 10);
+    EXPECT_EQ(sampler.Decide(healthy), TraceSampler::Decision::Drop);
+    TraceSession failed = make_session(2, "checkout", "POST /pay", 10);
+    failed.spans[0].status = SpanEvent::Status::Error;
+    EXPECT_EQ(sampler.Decide(failed), TraceSampler::Decision::KeepError);
+    EXPECT_EQ(sampler.Decide(make_session(3, "checkout", "POST /pay", 1000)), TraceSampler::Decision::KeepSlow);
+    // 按 operation 覆盖的阈值优先于默认阈值。
+    EXPECT_EQ(sampler.Decide(make_session(4, "checkout", "SELECT orders", 60)), TraceSampler::Decision::KeepSlow);
+
+    // 其余服务按 30% 抽样：按 trace_key 哈希决定，结果稳定且比例接近配置值。
+    size_t kept = 0;
+    for (size_t trace_key = 1000; trace_key < 11000; ++trace_key) {
+        TraceSession session = make_session(trace_key, "gateway", "GET /orders", 10);
+        const TraceSampler::Decision decision = sampler.Decide(session);
+        EXPECT_EQ(sampler.Decide(session), decision);
+        kept += decision == TraceSampler::Decision::KeepSampled ? 1 : 0;
+    }
+    EXPECT_GT(kept, 2700u);
+    EXPECT_LT(kept, 3300u);
+
+    const TraceSampler::Stats stats = sampler.GetStats();
+    EXPECT_EQ(stats.kept_error, 1u);
+    EXPECT_EQ(stats.kept_slow, 2u);
+    EXPECT_EQ(stats.kept_sampled, kept * 2);
+    EXPECT_EQ(stats.dropped, 1u + (10000 - kept) * 2);
+
+    EXPECT_FALSE(TraceSamplingPolicy{}.SamplingEnabled());
+}
+
+TEST_F(TraceSessionManagerUnitTest, SampledOutTraceSkipsPrimaryAndAiButStillClosesLikeDispatch)
+{
+    ThreadPool pool(1);
+    FakeTraceRepository repo;
+    auto buffered_repo = MakeBufferedTraceRepository(&repo);
+    StubTraceAi trace_ai;
+    TraceSamplingPolicy policy;
+    policy.healthy_keep_ratio = 0.0;
+    TraceSessionManager manager(&pool,
+                                buffered_repo.get(),
+                                &trace_ai,
+                                /*capacity*/10,
+                                /*token_limit*/0,
+                                /*notifier*/nullptr,
+                                /*idle_timeout_ms*/5000,
+                                /*wheel_tick_ms*/500,
+                                /*sealed_grace_window_ms*/1000,
+                                /*retry_base_delay_ms*/500,
+                                /*wheel_size*/512,
+                                /*buffered_span_hard_limit*/4096,
+                                /*active_session_hard_limit*/1024,
+                                /*active_session_overload_percent*/75,
+                                /*active_session_critical_percent*/90,
+                                /*buffered_spans_overload_percent*/75,
+                                /*buffered_spans_critical_percent*/90,
+                                /*pending_tasks_overload_percent*/75,
+                                /*pending_tasks_critical_percent*/90,
+                                /*service_runtime_accumulator*/nullptr,
+                                /*system_runtime_accumulator*/nullptr,
+                                /*ai_analysis_enabled*/true,
+                                /*ai_circuit_breaker_enabled*/true,
+                                /*ai_failure_threshold*/5,
+                                /*ai_cooldown_ms*/60000,
+                                /*fallback_trace_ai*/nullptr,
+                                /*ai_auto_degrade_enabled*/false,
+                                /*session_shard_count*/1,
+                                /*ai_async_dispatch_enabled*/false,
+                                /*ai_result_cache_capacity*/0,
+                                /*ai_result_cache_ttl_ms*/600000,
+                                /*session_pool_size*/0,
+                                /*buffered_bytes_hard_limit*/0,
+                                /*buffered_bytes_overload_percent*/75,
+                                /*buffered_bytes_critical_percent*/90,
+                                policy);
+
+    SpanEvent healthy = MakeSpan(95, 1, 1000);
+    healthy.status = SpanEvent::Status::Ok;
+    healthy.trace_end = true;
+    ASSERT_EQ(manager.Push(healthy), TraceSessionManager::PushResult::Accepted);
+    PushTwoSpanTrace(manager, 96, 1);
+    SweepTraceEndSealWindow(manager);
+
+    ASSERT_TRUE(WaitUntil([&repo]() { return repo.save_atomic_count.load(std::memory_order_acquire) == 1; }));
+    ASSERT_TRUE(WaitUntil([&manager]() { return manager.SnapshotRuntimeStats().worker_done_count == 1; }));
+    EXPECT_EQ(repo.last_summary.trace_id, "96");
+    EXPECT_TRUE(trace_ai.called.load(std::memory_order_acquire));
+    EXPECT_EQ(trace_ai.last_payload.find("\"trace_id\":\"95\""), std::string::npos);
+
+    const TraceSessionManager::RuntimeStatsSnapshot stats = manager.SnapshotRuntimeStats();
+    EXPECT_EQ(stats.dispatch_count, 2u);
+    EXPECT_EQ(stats.sampling_dropped, 1u);
+    EXPECT_EQ(stats.sampling_kept_error, 1u);
+    EXPECT_EQ(stats.worker_begin_count, 1u);
+    EXPECT_NE(manager.DescribeRuntimeStats().find("sampling_dropped=1"), std::string::npos);
+
+    // 被丢弃的 trace 同样进 tombstone：晚到 span 幂等吸收，不会复活成新 session 再被判一次。
+    SpanEvent late = MakeSpan(95, 2, 1100);
+    EXPECT_EQ(manager.Push(late), TraceSessionManager::PushResult::Accepted);
+    EXPECT_EQ(manager.size(), 0u);
+
+    pool.shutdown();
+}
+
+TEST_F(TraceSessionManagerUnitTest, ReplayedTracesAlreadyAnalyzedSkipAiAndAlerts)
+{
+    // 目的：WAL 重放把崩溃前已经分析、告警过的 trace 再推一遍时，不能再调一次模型、再发一次告警；
+    // 库里还没有分析结果的重放 trace 照常分析告警，非重放 trace 也不去查库。
+    ThreadPool pool(1);
+    FakeTraceRepository repo;
+    repo.analyzed_trace_ids = {"8101", "8103"};
+    AsyncStubTraceAi trace_ai;
+    trace_ai.response.analysis.risk_level = RiskLevel::CRITICAL;
+    SpyNotifier notifier;
+    auto buffered_repo = MakeBufferedTraceRepository(&repo);
+    auto manager = std::make_unique<TraceSessionManager>(&pool,
+                                buffered_repo.get(),
+                                &trace_ai,
+                                /*capacity*/10,
+                                /*token_limit*/0,
+                                /*notifier*/&notifier,
+                                /*idle_timeout_ms*/5000,
+                                /*wheel_tick_ms*/500,
+                                /*sealed_grace_window_ms*/1000,
+                                /*retry_base_delay_ms*/500,
+                                /*wheel_size*/512,
+                                /*buffered_span_hard_limit*/4096,
+                                /*active_session_hard_limit*/1024,
+                                /*active_session_overload_percent*/75,
+                                /*active_session_critical_percent*/90,
+                                /*buffered_spans_overload_percent*/75,
+                                /*buffered_spans_critical_percent*/90,
+                                /*pending_tasks_overload_percent*/75,
+                                /*pending_tasks_critical_percent*/90,
+                                /*service_runtime_accumulator*/nullptr,
+                                /*system_runtime_accumulator*/nullptr,
+                                /*ai_analysis_enabled*/true,
+                                /*ai_circuit_breaker_enabled*/true,
+                                /*ai_failure_threshold*/5,
+                                /*ai_cooldown_ms*/60000,
+                                /*fallback_trace_ai*/nullptr,
+                                /*ai_auto_degrade_enabled*/false,
+                                /*session_shard_count*/1,
+                                /*ai_async_dispatch_enabled*/false);
+
+    SpanEvent analyzed = MakeSpan(8101, 1, 1000);
+    analyzed.trace_end = true;
+    analyzed.replayed = true;
+    ASSERT_EQ(manager->Push(analyzed), TraceSessionManager::PushResult::Accepted);
+    SweepTraceEndSealWindow(*manager);
+    ASSERT_TRUE(WaitUntil([&manager]() { return manager->SnapshotRuntimeStats().worker_done_count == 1; }));
+    EXPECT_EQ(manager->SnapshotRuntimeStats().replayed_analysis_skipped, 1u);
+    EXPECT_EQ(trace_ai.sync_called_count.load(std::memory_order_acquire), 0);
+    EXPECT_FALSE(notifier.notify_trace_alert_called.load(std::memory_order_acquire));
+
+    SpanEvent not_analyzed = MakeSpan(8102, 1, 1000);
+    not_analyzed.trace_end = true;
+    not_analyzed.replayed = true;
+    ASSERT_EQ(manager->Push(not_analyzed), TraceSessionManager::PushResult::Accepted);
+    SweepOneTick(*manager, /*now_ms*/2000);
+    SweepOneTick(*manager, /*now_ms*/2500);
+    ASSERT_TRUE(WaitUntil([&notifier]() {
+        return notifier.notify_trace_alert_called.load(std::memory_order_acquire);
+    }));
+    EXPECT_EQ(notifier.last_event.trace_id, "8102");
+    EXPECT_EQ(trace_ai.sync_called_count.load(std::memory_order_acquire), 1);
+
+    // 非重放 trace 即使库里“有”同 key 的分析结果也照常分析：只有重放才查库。
+    notifier.notify_trace_alert_called.store(false, std::memory_order_release);
+    SpanEvent fresh = MakeSpan(8103, 1, 1000);
+    fresh.trace_end = true;
+    ASSERT_EQ(manager->Push(fresh), TraceSessionManager::PushResult::Accepted);
+    SweepOneTick(*manager, /*now_ms*/3000);
+    SweepOneTick(*manager, /*now_ms*/3500);
+    ASSERT_TRUE(WaitUntil([&notifier]() {
+        return notifier.notify_trace_alert_called.load(std::memory_order_acquire);
+    }));
+    EXPECT_EQ(notifier.last_event.trace_id, "8103");
+    EXPECT_EQ(trace_ai.sync_called_count.load(std::memory_order_acquire), 2);
+    EXPECT_EQ(manager->SnapshotRuntimeStats().replayed_analysis_skipped, 1u);
+
+    manager.reset();
+    pool.shutdown();
+}
+
+TEST_F(TraceSessionManagerUnitTest, IngestWalKeepsOnlyTracesNotYetFlushedOrSampledOutForReplay)
+{
+    // 目的：入口 WAL 的钉子要在两条收尾路径上都拔掉——主数据交给 SavePrimaryBatch、被尾部采样丢弃；
+    // 还在聚合态里的 trace 保持钉住，“崩溃”重启后只重放它，重放进新段并落盘之后旧段才删。
+    const std::string wal_dir = "./test_manager_ingest_wal.d";
+    std::filesystem::remove_all(wal_dir);
+    TraceIngestWal::Options wal_options;
+    wal_options.dir = wal_dir;
+    wal_options.sync_interval_ms = 60000;
+    auto make_manager = [](ThreadPool* pool,
+                           BufferedTraceRepository* buffered_repo,
+                           const TraceSamplingPolicy& policy,
+                           TraceIngestWal* wal) {
+        return std::make_unique<TraceSessionManager>(pool,
+                                                     buffered_repo,
+                                                     nullptr,
+                                                     /*capacity*/10,
+                                                     /*token_limit*/0,
+                                                     /*notifier*/nullptr,
+                                                     /*idle_timeout_ms*/5000,
+                                                     /*wheel_tick_ms*/500,
+                                                     /*sealed_grace_window_ms*/1000,
+                                                     /*retry_base_delay_ms*/500,
+                                                     /*wheel_size*/512,
+                                                     /*buffered_span_hard_limit*/4096,
+                                                     /*active_session_hard_limit*/1024,
+                                                     /*active_session_overload_percent*/75,
+                                                     /*active_session_critical_percent*/90,
+                                                     /*buffered_spans_overload_percent*/75,
+                                                     /*buffered_spans_critical_percent*/90,
+                                                     /*pending_tasks_overload_percent*/75,
+                                                     /*pending_tasks_critical_percent*/90,
+                                                     /*service_runtime_accumulator*/nullptr,
+                                                     /*system_runtime_accumulator*/nullptr,
+                                                     /*ai_analysis_enabled*/true,
+                                                     /*ai_circuit_breaker_enabled*/true,
+                                                     /*ai_failure_threshold*/5,
+                                                     /*ai_cooldown_ms*/60000,
+                                                     /*fallback_trace_ai*/nullptr,
+                                                     /*ai_auto_degrade_enabled*/false,
+                                                     /*session_shard_count*/1,
+                                                     /*ai_async_dispatch_enabled*/false,
+                                                     /*ai_result_cache_capacity*/0,
+                                                     /*ai_result_cache_ttl_ms*/600000,
+                                                     /*session_pool_size*/0,
+                                                     /*buffered_bytes_hard_limit*/0,
+                                                     /*buffered_bytes_overload_percent*/75,
+                                                     /*buffered_bytes_critical_percent*/90,
+                                                     policy,
+                                                     wal);
+    };
+
+    {
+        TraceIngestWal wal(wal_options);
+        ThreadPool pool(1);
+        FakeTraceRepository repo;
+        BufferedTraceRepository::Config buffer_config;
+        buffer_config.on_primary_flushed = [&wal](const std::vector<TraceRepository::TraceSummary>& summaries) {
+            wal.ReleaseTraces(summaries);
+        };
+        auto sink = std::shared_ptr<TraceRepository>(&repo, [](TraceRepository*) {});
+        auto buffered_repo = std::make_unique<BufferedTraceRepository>(std::move(sink), buffer_config);
+        TraceSamplingPolicy policy;
+        policy.healthy_keep_ratio = 0.0;
+        std::unique_ptr<TraceSessionManager> manager = make_manager(&pool, buffered_repo.get(), policy, &wal);
+
+        // 95：健康 trace，会被采样丢弃；96：含错误 span，主数据写进 SQLite；97：还没结束，留在聚合态。
+        SpanEvent healthy = MakeSpan(95, 1, 1000);
+        healthy.status = SpanEvent::Status::Ok;
+        healthy.trace_end = true;
+        ASSERT_EQ(manager->Push(healthy), TraceSessionManager::PushResult::Accepted);
+        PushTwoSpanTrace(*manager, 96, 1);
+        ASSERT_EQ(manager->Push(MakeSpan(97, 1, 1000)), TraceSessionManager::PushResult::Accepted);
+        EXPECT_EQ(wal.SnapshotStats().pinned_traces, 3u);
+        EXPECT_EQ(wal.SnapshotStats().appended_spans, 4u);
+
+        SweepTraceEndSealWindow(*manager);
+        ASSERT_TRUE(WaitUntil([&wal]() { return wal.SnapshotStats().pinned_traces == 1; }, 2000));
+        EXPECT_EQ(repo.save_atomic_count.load(std::memory_order_acquire), 1);
+        EXPECT_EQ(wal.SnapshotStats().released_traces, 2u);
+        EXPECT_TRUE(wal.Sync());
+        pool.shutdown();
+    }
+
+    TraceIngestWal reopened(wal_options);
+    ThreadPool pool(1);
+    FakeTraceRepository repo;
+    auto buffered_repo = MakeBufferedTraceRepository(&repo);
+    std::unique_ptr<TraceSessionManager> manager = make_manager(&pool, buffered_repo.get(), {}, &reopened);
+    const TraceIngestWal::ReplayResult result =
+        reopened.ReplayRecovered(*manager, /*chunk_spans*/16, /*retry_delay_ms*/1, nullptr);
+    EXPECT_EQ(result.recovered_spans, 1u);
+    EXPECT_EQ(result.accepted_spans, 1u);
+    EXPECT_EQ(result.retries, 0u);
+    EXPECT_TRUE(result.segments_dropped);
+    EXPECT_EQ(reopened.SnapshotStats().recovered_skipped_spans, 3u);
+    EXPECT_EQ(manager->size(), 1u);
+    // 重放进来的 session 带着标记，落库时只有它的主键冲突会被当成“崩溃前已经写过”跳过。
+    EXPECT_TRUE(WaitUntilSessionSatisfies(*manager, 97, [](const TraceSession& session) { return session.replayed; }));
+    // 97 重新钉在新段上；旧段已删，目录里只剩本次启动写出的段。
+    EXPECT_EQ(reopened.SnapshotStats().pinned_traces, 1u);
+    EXPECT_EQ(reopened.SnapshotStats().live_segments, 1u);
+
+    pool.shutdown();
+    manager.reset();
+    std::filesystem::remove_all(wal_dir);
+}
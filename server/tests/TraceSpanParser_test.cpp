@@ -0,0 +1,271 @@
+#include <gtest/gtest.h>
+
+#include <nlohmann/json.hpp>
+#include <string>
+#include <vector>
+
+#include "core/TraceSessionManager.h"
+#include "handlers/TraceSpanParser.h"
+
+namespace
+{
+struct ParseOutcome
+{
+    TraceSpanParser::Status status = TraceSpanParser::Status::Ok;
+    std::string error;
+    SpanEvent span;
+};
+
+// 旧实现的口径：先整体建 DOM，再按对象逐字段取值。这里作为单遍解析器的对照基准。
+ParseOutcome ParseWithDom(const TraceSpanParser& parser, const std::string& body)
+{
+    ParseOutcome outcome;
+    nlohmann::json document;
+    try {
+        document = nlohmann::json::parse(body);
+    } catch (const nlohmann::json::parse_error&) {
+        outcome.status = TraceSpanParser::Status::InvalidJson;
+        return outcome;
+    }
+    outcome.status = parser.ParseObject(document, &outcome.span, &outcome.error);
+    return outcome;
+}
+
+ParseOutcome ParseWithStream(const TraceSpanParser& parser, const std::string& body)
+{
+    ParseOutcome outcome;
+    outcome.status = parser.ParseBody(body, &outcome.span, &outcome.error);
+    return outcome;
+}
+
+// 两条路径必须在状态、错误文案和解析出的每个字段上完全一致。
+void ExpectSameOutcome(const TraceSpanParser& parser, const std::string& body)
+{
+    SCOPED_TRACE(body);
+    const ParseOutcome dom = ParseWithDom(parser, body);
+    const ParseOutcome stream = ParseWithStream(parser, body);
+    ASSERT_EQ(dom.status, stream.status);
+    EXPECT_EQ(dom.error, stream.error);
+    if (dom.status != TraceSpanParser::Status::Ok) {
+        return;
+    }
+    EXPECT_EQ(dom.span.trace_key, stream.span.trace_key);
+    EXPECT_EQ(dom.span.span_id, stream.span.span_id);
+    EXPECT_EQ(dom.span.parent_span_id, stream.span.parent_span_id);
+    EXPECT_EQ(dom.span.start_time_ms, stream.span.start_time_ms);
+    EXPECT_EQ(dom.span.end_time, stream.span.end_time);
+    EXPECT_EQ(dom.span.name, stream.span.name);
+    EXPECT_EQ(dom.span.service_name, stream.span.service_name);
+    EXPECT_EQ(dom.span.status, stream.span.status);
+    EXPECT_EQ(dom.span.kind, stream.span.kind);
+    EXPECT_EQ(dom.span.trace_end, stream.span.trace_end);
+    EXPECT_EQ(dom.span.attributes, stream.span.attributes);
+}
+
+const char* kBaseFields =
+    "\"trace_key\":1,\"span_id\":2,\"start_time_ms\":1000,\"name\":\"op\",\"service_name\":\"svc\"";
+} // namespace
+
+TEST(TraceSpanParserTest, ParsesFullSpanInSinglePass)
+{
+    TraceSpanParser parser;
+    SpanEvent span;
+    std::string error;
+    const std::string body =
+        "{\"trace_key\":11,\"span_id\":22,\"parent_span_id\":7,\"start_time_ms\":1000,"
+        "\"end_time_ms\":1050,\"name\":\"GET /orders\",\"service_name\":\"gateway\","
+        "\"status\":\"error\",\"kind\":\"SERVER\",\"trace_end\":true,"
+        "\"attributes\":{\"http.status\":500,\"retry\":false},\"region\":\"cn-sh\"}";
+
+    ASSERT_EQ(parser.ParseBody(body, &span, &error), TraceSpanParser::Status::Ok) << error;
+    EXPECT_EQ(span.trace_key, 11u);
+    EXPECT_EQ(span.span_id, 22u);
+    EXPECT_EQ(span.parent_span_id, std::optional<size_t>(7));
+    EXPECT_EQ(span.start_time_ms, 1000);
+    EXPECT_EQ(span.end_time, std::optional<int64_t>(1050));
+    EXPECT_EQ(span.name, "GET /orders");
+    EXPECT_EQ(span.service_name, "gateway");
+    EXPECT_EQ(span.status, std::optional<SpanEvent::Status>(SpanEvent::Status::Error));
+    EXPECT_EQ(span.kind, std::optional<SpanEvent::Kind>(SpanEvent::Kind::Server));
+    EXPECT_EQ(span.trace_end, std::optional<bool>(true));
+    EXPECT_EQ(span.attributes.at("http.status"), "500");
+    EXPECT_EQ(span.attributes.at("retry"), "false");
+    EXPECT_EQ(span.attributes.at("region"), "cn-sh");
+}
+
+TEST(TraceSpanParserTest, MatchesDomPathOnValidAndFieldErrorCorpus)
+{
+    TraceSpanParser parser;
+    const std::string base = kBaseFields;
+    const std::vector<std::string> corpus = {
+        "{" + base + "}",
+        "{\"trace_id\":5,\"span_id\":2,\"start_time_ms\":1,\"name\":\"n\",\"service_name\":\"s\"}",
+        // trace_key 存在时即使是 null 也优先于 trace_id。
+        "{\"trace_key\":null,\"trace_id\":5,\"span_id\":2,\"start_time_ms\":1,\"name\":\"n\",\"service_name\":\"s\"}",
+        "{\"span_id\":2,\"start_time_ms\":1,\"name\":\"n\",\"service_name\":\"s\"}",
+        "{\"trace_key\":-1,\"span_id\":2,\"start_time_ms\":1,\"name\":\"n\",\"service_name\":\"s\"}",
+        "{\"trace_key\":1.5,\"span_id\":2,\"start_time_ms\":1,\"name\":\"n\",\"service_name\":\"s\"}",
+        "{\"trace_key\":1e2,\"span_id\":2,\"start_time_ms\":1,\"name\":\"n\",\"service_name\":\"s\"}",
+        "{\"trace_key\":\"1\",\"span_id\":2,\"start_time_ms\":1,\"name\":\"n\",\"service_name\":\"s\"}",
+        // 超过 int64 上限的无符号数按 get<int64_t>() 口径变成负数；超过 uint64 上限就退化成浮点数。
+        "{\"trace_key\":18446744073709551615,\"span_id\":2,\"start_time_ms\":1,\"name\":\"n\",\"service_name\":\"s\"}",
+        "{\"trace_key\":18446744073709551616,\"span_id\":2,\"start_time_ms\":1,\"name\":\"n\",\"service_name\":\"s\"}",
+        "{\"trace_key\":1,\"span_id\":2,\"start_time_ms\":-9223372036854775808,\"name\":\"n\",\"service_name\":\"s\"}",
+        "{\"trace_key\":1,\"span_id\":2,\"start_time_ms\":-9223372036854775809,\"name\":\"n\",\"service_name\":\"s\"}",
+        "{\"trace_key\":1,\"span_id\":2,\"name\":\"n\",\"service_name\":\"s\"}",
+        "{\"trace_key\":1,\"span_id\":2,\"start_time_ms\":1,\"name\":null,\"service_name\":\"s\"}",
+        "{\"trace_key\":1,\"span_id\":2,\"start_time_ms\":1,\"name\":\"n\"}",
+        "{" + base + ",\"parent_span_id\":null,\"end_time_ms\":null,\"status\":null,\"kind\":null,\"attributes\":null}",
+        "{" + base + ",\"parent_span_id\":-3}",
+        "{" + base + ",\"end_time_ms\":\"later\"}",
+        "{" + base + ",\"trace_end\":1}",
+        "{" + base + ",\"status\":\"done\"}",
+        "{" + base + ",\"status\":3}",
+        "{" + base + ",\"kind\":\"edge\"}",
+        "{" + base + ",\"kind\":[]}",
+        "{" + base + ",\"attributes\":[1,2]}",
+        "{" + base + ",\"attributes\":\"x\"}",
+        // 缺必填字段和后面的类型错误同时存在时，报错优先级要和 DOM 路径一致。
+        "{\"trace_key\":1,\"start_time_ms\":\"x\",\"name\":\"n\",\"service_name\":\"s\"}",
+        // 重复键：后出现的值覆盖前面的值，包括 attributes 整体被替换。
+        "{" + base + ",\"name\":\"second\",\"trace_key\":9}",
+        "{" + base + ",\"attributes\":{\"a\":\"1\",\"b\":\"2\"},\"attributes\":{\"c\":\"3\"}}",
+        "{" + base + ",\"attributes\":{\"a\":\"1\"},\"attributes\":null}",
+        "{" + base + ",\"attributes\":{\"a\":\"1\",\"a\":\"2\"}}",
+        "{" + base + ",\"extra\":1,\"extra\":\"two\"}",
+        // 显式 attributes 的值优先于同名顶层未知字段。
+        "{" + base + ",\"region\":\"top\",\"attributes\":{\"region\":\"explicit\"}}",
+        // 未知字段的各种值类型都要和 nlohmann dump 的写法逐字节一致。
+        "{" + base + ",\"f\":1.25,\"g\":-0,\"h\":-12,\"i\":1E3,\"j\":null,\"k\":true,"
+            "\"l\":{\"z\":1,\"a\":[1,2.5,\"x\"]},\"m\":[],\"n2\":\"\\u00e9\\n\"}",
+        "{" + base + ",\"attributes\":{\"nested\":{\"b\":1,\"a\":{\"c\":null}},\"num\":0.1,\"big\":18446744073709551615}}",
+        // 字符串转义：\uXXXX、代理对、常见短转义和原始 UTF-8 都要解码成同样的内容。
+        "{\"trace_key\":1,\"span_id\":2,\"start_time_ms\":1,\"name\":\"a\\\"b\\\\c\\/d\\b\\f\\r\\t\","
+            "\"service_name\":\"\\ud83d\\ude00 \xe4\xb8\xad\xe6\x96\x87\"}",
+        " \t\r\n{ \"trace_key\" : 1 , \"span_id\" : 2 , \"start_time_ms\" : 1 , \"name\" : \"n\" , \"service_name\" : \"s\" } \n",
+        "\xEF\xBB\xBF{" + base + "}",
+        "{}",
+    };
+    for (const std::string& body : corpus) {
+        ExpectSameOutcome(parser, body);
+    }
+}
+
+TEST(TraceSpanParserTest, MatchesDomPathOnMalformedJsonCorpus)
+{
+    TraceSpanParser parser;
+    const std::string base = kBaseFields;
+    const std::vector<std::string> corpus = {
+        "",
+        "   ",
+        "[]",
+        "[{" + base + "}]",
+        "42",
+        "\"span\"",
+        "null",
+        "{",
+        "{" + base,
+        "{" + base + ",}",
+        "{" + base + "} trailing",
+        "{" + base + "}{}",
+        "{trace_key:1}",
+        "{\"trace_key\" 1}",
+        "{" + base + ",\"x\":01}",
+        "{" + base + ",\"x\":1.}",
+        "{" + base + ",\"x\":.5}",
+        "{" + base + ",\"x\":1e}",
+        "{" + base + ",\"x\":-}",
+        "{" + base + ",\"x\":+1}",
+        "{" + base + ",\"x\":tru}",
+        "{" + base + ",\"x\":nul}",
+        "{" + base + ",\"x\":[1,]}",
+        "{" + base + ",\"x\":{\"a\":}}",
+        "{" + base + ",\"x\":\"\\x\"}",
+        "{" + base + ",\"x\":\"\\u12\"}",
+        "{" + base + ",\"x\":\"\\ud83d\"}",
+        "{" + base + ",\"x\":\"\\ude00\"}",
+        "{" + base + ",\"x\":\"\\ud83d\\u0041\"}",
+        "{" + base + ",\"x\":\"line\nbreak\"}",
+        "{" + base + ",\"x\":\"\xC0\xAF\"}",
+        "{" + base + ",\"x\":\"\xED\xA0\x80\"}",
+        "{" + base + ",\"x\":\"\xF4\x90\x80\x80\"}",
+        "{" + base + ",\"x\":\"\xE4\xB8\"}",
+        "{" + base + ",\"attributes\":{\"a\":1,}}",
+        "{" + base + ",\"name\":\"unterminated}",
+    };
+    for (const std::string& body : corpus) {
+        ExpectSameOutcome(parser, body);
+    }
+}
+
+TEST(TraceSpanParserTest, MatchesDomPathForConfiguredTraceEndAliases)
+{
+    // 主字段命中后不再看别名；主字段缺失时按别名顺序找第一个合法 bool；
+    // 主字段和别名都不会被折叠进 attributes。
+    TraceSpanParser parser("is_last", {"done", "finished"});
+    const std::string base = kBaseFields;
+    const std::vector<std::string> corpus = {
+        "{" + base + ",\"is_last\":true,\"done\":false}",
+        "{" + base + ",\"done\":false,\"finished\":true}",
+        "{" + base + ",\"finished\":true}",
+        "{" + base + ",\"is_last\":null,\"done\":true}",
+        "{" + base + ",\"done\":\"yes\"}",
+        "{" + base + ",\"trace_end\":true}",
+        "{" + base + ",\"is_last\":true,\"is_last\":false}",
+    };
+    for (const std::string& body : corpus) {
+        ExpectSameOutcome(parser, body);
+    }
+
+    SpanEvent span;
+    std::string error;
+    ASSERT_EQ(parser.ParseBody("{" + base + ",\"trace_end\":true,\"done\":true}", &span, &error),
+              TraceSpanParser::Status::Ok);
+    EXPECT_EQ(span.trace_end, std::optional<bool>(true));
+    // 默认字段名 trace_end 不在当前配置里时，就只是一个普通的未知字段。
+    EXPECT_EQ(span.attributes.at("trace_end"), "true");
+    EXPECT_EQ(span.attributes.count("done"), 0u);
+}
+
+TEST(TraceSpanParserTest, AliasNamedLikeKnownFieldKeepsBothMeanings)
+{
+    // 极端配置：别名恰好和某个已知字段同名。DOM 路径会同时按两种含义读取它，单遍路径也必须一样。
+    TraceSpanParser parser("trace_end", {"status", ""});
+    const std::string base = kBaseFields;
+    ExpectSameOutcome(parser, "{" + base + ",\"status\":\"OK\"}");
+    ExpectSameOutcome(parser, "{" + base + ",\"status\":true}");
+    ExpectSameOutcome(parser, "{" + base + ",\"\":true}");
+}
+
+TEST(TraceSpanParserTest, RejectsDeeplyNestedValuesInsteadOfRecursingWithoutBound)
+{
+    // 几十万层嵌套如果一路递归下去会打穿 IO 线程的栈；解析器必须在深度上限处直接判为非法 JSON。
+    TraceSpanParser parser;
+    const std::string base = kBaseFields;
+    const size_t levels = 200000;
+    const std::string deep_array = std::string(levels, '[') + std::string(levels, ']');
+    const std::string deep_object = [levels]() {
+        std::string value;
+        for (size_t i = 0; i < levels; ++i) {
+            value += "{\"a\":";
+        }
+        value += "1";
+        value += std::string(levels, '}');
+        return value;
+    }();
+
+    const std::vector<std::string> bodies = {
+        "{" + base + ",\"unknown\":" + deep_array + "}",
+        "{" + base + ",\"unknown\":" + deep_object + "}",
+        "{" + base + ",\"attributes\":{\"a\":" + deep_array + "}}",
+        "{" + base + ",\"name\":" + deep_array + "}",
+    };
+    for (const std::string& body : bodies) {
+        EXPECT_EQ(ParseWithStream(parser, body).status, TraceSpanParser::Status::InvalidJson);
+    }
+
+    // 上限以内的嵌套照常解析，结果和 DOM 路径一致。
+    const std::string shallow = std::string(32, '[') + std::string(32, ']');
+    ExpectSameOutcome(parser, "{" + base + ",\"unknown\":" + shallow + "}");
+    ExpectSameOutcome(parser, "{" + base + ",\"attributes\":{\"a\":" + shallow + "}}");
+}
@@ -0,0 +1,167 @@
+#include <filesystem>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <optional>
+#include <stdexcept>
+
+#include "persistence/TraceSpillQueue.h"
+
+using persistence::TraceSpillQueue;
+
+class TraceSpillQueueTest : public ::testing::Test
+{
+protected:
+    void SetUp() override
+    {
+        spill_path_ = "./test_trace_spill_queue.spill";
+        std::filesystem::remove(spill_path_);
+    }
+
+    void TearDown() override
+    {
+        std::filesystem::remove(spill_path_);
+    }
+
+    persistence::TraceSummary MakeSummary(const std::string& trace_id)
+    {
+        persistence::TraceSummary summary;
+        summary.trace_id = trace_id;
+        summary.service_name = "spill-service";
+        summary.start_time_ms = 1710000000123;
+        summary.end_time_ms = 1710000000456;
+        summary.duration_ms = 333;
+        summary.span_count = 2;
+        summary.token_count = 80;
+        summary.risk_level = "unknown";
+        summary.ai_error = "proxy \"timeout\"\n";
+        return summary;
+    }
+
+    persistence::TraceSpanRecord MakeSpan(const std::string& trace_id,
+                                          const std::string& span_id,
+                                          std::optional<std::string> parent_id)
+    {
+        persistence::TraceSpanRecord span;
+        span.trace_id = trace_id;
+        span.span_id = span_id;
+        span.parent_id = std::move(parent_id);
+        span.service_name = "inventory-db";
+        span.operation = "SELECT stock";
+        span.start_time_ms = 1710000000200;
+        span.duration_ms = 12;
+        span.status = "ERROR";
+        span.attributes_json = "{\"db.statement\":\"SELECT 1\"}";
+        return span;
+    }
+
+    std::string spill_path_;
+};
+
+TEST_F(TraceSpillQueueTest, RecordsRoundTripInOrderAndSurviveReopen)
+{
+    persistence::TraceAnalysisRecord analysis;
+    analysis.trace_id = "11";
+    analysis.risk_level = "critical";
+    analysis.summary = "库存库超时";
+    analysis.root_cause = "lock wait";
+    analysis.solution = "add index";
+    analysis.confidence = 0.875;
+    analysis.ai_status = "completed_cache";
+    analysis.replayed = true;
+    persistence::TraceSummary replayed_summary = MakeSummary("12");
+    replayed_summary.replayed = true;
+
+    {
+        TraceSpillQueue queue(spill_path_, 0);
+        ASSERT_TRUE(queue.AppendPrimary({MakeSummary("11")},
+                                        {MakeSpan("11", "1", std::nullopt), MakeSpan("11", "2", "1")}));
+        ASSERT_TRUE(queue.AppendAnalysis({analysis}));
+        ASSERT_TRUE(queue.AppendPrimary({replayed_summary, MakeSummary("13")}, {}));
+        EXPECT_EQ(queue.PendingRecords(), 3u);
+
+        // 第一条回放成功后出队；剩下两条跟着进程重启一起留在文件里。
+        TraceSpillQueue::Record record;
+        ASSERT_TRUE(queue.PeekFront(&record));
+        EXPECT_EQ(record.kind, TraceSpillQueue::RecordKind::PrimaryBatch);
+        queue.PopFront();
+        EXPECT_EQ(queue.PendingRecords(), 2u);
+    }
+
+    TraceSpillQueue reopened(spill_path_, 0);
+    ASSERT_EQ(reopened.PendingRecords(), 2u);
+
+    TraceSpillQueue::Record record;
+    ASSERT_TRUE(reopened.PeekFront(&record));
+    ASSERT_EQ(record.kind, TraceSpillQueue::RecordKind::AnalysisBatch);
+    ASSERT_EQ(record.analyses.size(), 1u);
+    EXPECT_EQ(record.analyses[0].trace_id, "11");
+    EXPECT_EQ(record.analyses[0].summary, "库存库超时");
+    EXPECT_DOUBLE_EQ(record.analyses[0].confidence, 0.875);
+    EXPECT_EQ(record.analyses[0].ai_status, "completed_cache");
+    // WAL 重放标记跟着溢出记录走，回放进 SQLite 时仍然只对这些行做冲突跳过。
+    EXPECT_TRUE(record.analyses[0].replayed);
+    reopened.PopFront();
+
+    ASSERT_TRUE(reopened.PeekFront(&record));
+    ASSERT_EQ(record.kind, TraceSpillQueue::RecordKind::PrimaryBatch);
+    ASSERT_EQ(record.summaries.size(), 2u);
+    EXPECT_EQ(record.summaries[0].trace_id, "12");
+    EXPECT_EQ(record.summaries[0].end_time_ms, std::optional<int64_t>(1710000000456));
+    EXPECT_EQ(record.summaries[0].ai_error, "proxy \"timeout\"\n");
+    EXPECT_TRUE(record.summaries[0].replayed);
+    EXPECT_FALSE(record.summaries[1].replayed);
+    EXPECT_TRUE(record.spans.empty());
+    reopened.PopFront();
+
+    // 队列清空后文件截断回只剩文件头，不会一直变大。
+    EXPECT_EQ(reopened.PendingRecords(), 0u);
+    EXPECT_EQ(reopened.PendingBytes(), 0u);
+    EXPECT_EQ(std::filesystem::file_size(spill_path_), 8u);
+}
+
+TEST_F(TraceSpillQueueTest, TornTailIsTruncatedOnReopenAndSpanFieldsSurvive)
+{
+    uintmax_t intact_size = 0;
+    {
+        TraceSpillQueue queue(spill_path_, 0);
+        ASSERT_TRUE(queue.AppendPrimary({MakeSummary("21")},
+                                        {MakeSpan("21", "1", std::nullopt), MakeSpan("21", "2", "1")}));
+        intact_size = std::filesystem::file_size(spill_path_);
+        ASSERT_TRUE(queue.AppendPrimary({MakeSummary("22")}, {MakeSpan("22", "1", std::nullopt)}));
+    }
+    // 模拟第二条记录写到一半掉电：砍掉最后几个字节。
+    std::filesystem::resize_file(spill_path_, std::filesystem::file_size(spill_path_) - 5);
+
+    TraceSpillQueue reopened(spill_path_, 0);
+    ASSERT_EQ(reopened.PendingRecords(), 1u);
+    EXPECT_EQ(std::filesystem::file_size(spill_path_), intact_size);
+
+    TraceSpillQueue::Record record;
+    ASSERT_TRUE(reopened.PeekFront(&record));
+    ASSERT_EQ(record.spans.size(), 2u);
+    EXPECT_FALSE(record.spans[0].parent_id.has_value());
+    EXPECT_EQ(record.spans[1].parent_id, std::optional<std::string>("1"));
+    EXPECT_EQ(record.spans[1].operation, "SELECT stock");
+    EXPECT_EQ(record.spans[1].attributes_json, "{\"db.statement\":\"SELECT 1\"}");
+
+    // 截掉脏尾巴以后还能接着追加。
+    ASSERT_TRUE(reopened.AppendPrimary({MakeSummary("23")}, {}));
+    EXPECT_EQ(reopened.PendingRecords(), 2u);
+}
+
+TEST_F(TraceSpillQueueTest, AppendFailsOnceFileWouldExceedLimitAndForeignFilesAreRejected)
+{
+    {
+        TraceSpillQueue queue(spill_path_, 200);
+        EXPECT_TRUE(queue.AppendPrimary({MakeSummary("31")}, {}));
+        EXPECT_FALSE(queue.AppendPrimary({MakeSummary("32")}, {MakeSpan("32", "1", std::nullopt)}));
+        EXPECT_EQ(queue.PendingRecords(), 1u);
+    }
+
+    std::filesystem::remove(spill_path_);
+    {
+        std::ofstream foreign(spill_path_, std::ios::binary);
+        foreign << "SQLite format 3";
+    }
+    EXPECT_THROW(TraceSpillQueue(spill_path_, 0), std::runtime_error);
+}
@@ -84,6 +84,26 @@ class AiProxyTraceProtocolTest(unittest.TestCase):
         self.assertEqual(error_payload["error_status"], "RESOURCE_EXHAUSTED")
         self.assertEqual(error_payload["error_message"], "quota exhausted")
 
+    def test_trace_batch_prompt_and_result_keep_ids(self):
+        module = load_module("ai_proxy_main", "ai/proxy/main.py")
+
+        traces = [{"id": "0", "trace_text": "span-a"}, {"id": "1", "trace_text": "span-b"}]
+        prompt = module.render_trace_batch_prompt("guidance\n{{TRACE_CONTEXT}}", traces)
+        # 批量 prompt 必须复用 C++ 下发的同一份模板，只把上下文换成带 id 的数组。
+        self.assertTrue(prompt.startswith("guidance\n"))
+        self.assertIn('"id": "1"', prompt)
+        self.assertIn("span-b", prompt)
+
+        normalized = module.normalize_trace_batch_result(
+            "mock",
+            [{"id": "0", "analysis": {"summary": "s"}}],
+        )
+        # 旧 analyze_batch 风格的裸列表也要收成统一外壳，C++ 只认 ok/results/usage。
+        self.assertTrue(normalized["ok"])
+        self.assertEqual(normalized["provider"], "mock")
+        self.assertEqual(normalized["results"][0]["id"], "0")
+        self.assertIsNone(normalized["usage"])
+
 
 if __name__ == "__main__":
     unittest.main()
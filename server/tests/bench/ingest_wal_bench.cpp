@@ -0,0 +1,107 @@
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "core/TraceIngestWal.h"
+#include "core/TraceSessionManager.h"
+
+// 入口 WAL 热路径基准：Push 放掉 shard 锁之后多做的就是一次 TraceIngestWal::Append，这里单独测它的每 span 耗时。
+// 条带数取默认的 16；多线程时各线程的 trace 散在不同条带上，看每 span 耗时是否随线程数保持平稳。
+// 用法：bench_ingest_wal [spans_per_thread] [threads] [sync_interval_ms]
+// 默认每线程 200000 个 span、1 和 4 线程各跑一遍、group commit 间隔 20ms；每 8 个 span 组成一条 trace，
+// 第一个 span 钉住 trace，最后一个 span 之后立刻解钉，模拟稳态下段文件边写边删。
+// span 带一个 http.method attribute，编码后约 120 字节，和 /logs/spans 的常见体量相当。
+// 只打印数值，不注册进 CTest；fdatasync 的耗时强依赖磁盘，看 wal_sync_avg_ms 判断 group commit 是否跟得上。
+namespace
+{
+SpanEvent MakeSpan(size_t trace_key, size_t span_id)
+{
+    SpanEvent span;
+    span.trace_key = trace_key;
+    span.span_id = span_id;
+    if (span_id > 1)
+    {
+        span.parent_span_id = span_id - 1;
+    }
+    span.start_time_ms = 1710000000000 + static_cast<int64_t>(span_id);
+    span.end_time = span.start_time_ms + 5;
+    span.name = "POST /api/v1/orders";
+    span.service_name = "order-service";
+    span.status = SpanEvent::Status::Ok;
+    span.kind = SpanEvent::Kind::Server;
+    span.attributes["http.method"] = "POST";
+    return span;
+}
+
+double RunOnce(const std::string& dir, size_t spans_per_thread, size_t threads, int64_t sync_interval_ms)
+{
+    std::filesystem::remove_all(dir);
+    TraceIngestWal::Options options;
+    options.dir = dir;
+    options.sync_interval_ms = sync_interval_ms;
+    TraceIngestWal wal(options);
+
+    constexpr size_t kSpansPerTrace = 8;
+    // span 预先构造好，计时里只剩 Append / ReleaseTrace 本身。
+    std::vector<std::vector<SpanEvent>> inputs(threads);
+    for (size_t t = 0; t < threads; ++t)
+    {
+        inputs[t].reserve(spans_per_thread);
+        for (size_t i = 0; i < spans_per_thread; ++i)
+        {
+            inputs[t].push_back(MakeSpan(t * spans_per_thread + i / kSpansPerTrace + 1, i % kSpansPerTrace + 1));
+        }
+    }
+
+    const auto begin = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < threads; ++t)
+    {
+        workers.emplace_back([&wal, &inputs, t]() {
+            const std::vector<SpanEvent>& spans = inputs[t];
+            for (size_t i = 0; i < spans.size(); ++i)
+            {
+                wal.Append(spans[i], i % kSpansPerTrace == 0);
+                if (i % kSpansPerTrace == kSpansPerTrace - 1)
+                {
+                    wal.ReleaseTrace(spans[i].trace_key);
+                }
+            }
+        });
+    }
+    for (std::thread& worker : workers)
+    {
+        worker.join();
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    wal.Sync();
+    std::cout << "threads=" << threads << ", spans=" << spans_per_thread * threads
+              << ", append_ns_per_span=" << seconds * 1e9 / static_cast<double>(spans_per_thread * threads) << '\n'
+              << "  " << wal.DescribeStats() << std::endl;
+    return seconds;
+}
+}
+
+int main(int argc, char** argv)
+{
+    const size_t spans_per_thread = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 200000;
+    const int64_t sync_interval_ms = argc > 3 ? std::strtoll(argv[3], nullptr, 10) : 20;
+    std::vector<size_t> thread_counts = {1, 4};
+    if (argc > 2)
+    {
+        thread_counts = {static_cast<size_t>(std::strtoull(argv[2], nullptr, 10))};
+    }
+
+    const std::string dir = "./bench_ingest_wal.d";
+    for (size_t threads : thread_counts)
+    {
+        RunOnce(dir, spans_per_thread, threads, sync_interval_ms);
+    }
+    std::filesystem::remove_all(dir);
+    return 0;
+}
@@ -0,0 +1,87 @@
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <vector>
+
+#include "core/TraceSessionManager.h"
+#include "handlers/TraceSpanParser.h"
+
+// `/logs/spans` 解析路径微基准：对比“nlohmann DOM + 逐字段取值”和“单遍解析器”的单条耗时。
+// 用法：bench_span_parser [iterations]，默认 200000 次。
+// 这里只打印数值，不做断言；数值跟机器、编译选项强相关，所以不注册进 CTest。
+namespace
+{
+std::vector<std::string> BuildSampleBodies()
+{
+    // 样本覆盖三种典型上报形态：最小必填字段、带 attributes 的常见 span、带较多顶层未知字段的 span。
+    return {
+        "{\"trace_key\":1001,\"span_id\":1,\"start_time_ms\":1710000000000,"
+        "\"name\":\"GET /orders\",\"service_name\":\"gateway\"}",
+
+        "{\"trace_key\":1001,\"span_id\":2,\"parent_span_id\":1,\"start_time_ms\":1710000000010,"
+        "\"end_time_ms\":1710000000042,\"name\":\"SELECT orders\",\"service_name\":\"order-db\","
+        "\"status\":\"OK\",\"kind\":\"CLIENT\","
+        "\"attributes\":{\"db.system\":\"sqlite\",\"db.rows\":42,\"cache.hit\":false}}",
+
+        "{\"trace_key\":1001,\"span_id\":3,\"parent_span_id\":1,\"start_time_ms\":1710000000050,"
+        "\"end_time_ms\":1710000000120,\"name\":\"POST /payment\",\"service_name\":\"payment\","
+        "\"status\":\"ERROR\",\"kind\":\"SERVER\",\"trace_end\":true,"
+        "\"http.method\":\"POST\",\"http.status_code\":502,\"peer.service\":\"bank-gateway\","
+        "\"retry.count\":2,\"region\":\"cn-shanghai\",\"user.tier\":\"gold\"}"
+    };
+}
+
+template <typename ParseFn>
+double MeasureNsPerSpan(const std::vector<std::string>& bodies, size_t iterations, ParseFn parse)
+{
+    size_t sink = 0;
+    const auto begin = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; ++i) {
+        SpanEvent span;
+        std::string error;
+        parse(bodies[i % bodies.size()], &span, &error);
+        // 把结果喂给 sink，防止编译器把整段解析优化掉。
+        sink += span.span_id + span.attributes.size();
+    }
+    const auto end = std::chrono::steady_clock::now();
+    if (sink == 0) {
+        std::cerr << "unexpected empty parse result" << std::endl;
+    }
+    const double total_ns = static_cast<double>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count());
+    return total_ns / static_cast<double>(iterations);
+}
+} // namespace
+
+int main(int argc, char** argv)
+{
+    size_t iterations = 200000;
+    if (argc > 1) {
+        iterations = static_cast<size_t>(std::strtoull(argv[1], nullptr, 10));
+        if (iterations == 0) {
+            std::cerr << "iterations must be > 0" << std::endl;
+            return 1;
+        }
+    }
+
+    const TraceSpanParser parser;
+    const std::vector<std::string> bodies = BuildSampleBodies();
+
+    const double dom_ns = MeasureNsPerSpan(bodies, iterations,
+        [&parser](const std::string& body, SpanEvent* span, std::string* error) {
+            const nlohmann::json document = nlohmann::json::parse(body);
+            parser.ParseObject(document, span, error);
+        });
+    const double stream_ns = MeasureNsPerSpan(bodies, iterations,
+        [&parser](const std::string& body, SpanEvent* span, std::string* error) {
+            parser.ParseBody(body, span, error);
+        });
+
+    std::cout << "iterations=" << iterations << "\n"
+              << "dom_parse_ns_per_span=" << dom_ns << "\n"
+              << "single_pass_ns_per_span=" << stream_ns << "\n"
+              << "speedup=" << (stream_ns > 0 ? dom_ns / stream_ns : 0.0) << "x" << std::endl;
+    return 0;
+}
@@ -0,0 +1,91 @@
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "threadpool/ThreadPool.h"
+
+// 线程池提交竞争微基准：多个提交线程同时往池里塞很小的任务，对比共享队列和 work-stealing 两种模式的吞吐。
+// 用法：bench_threadpool_contention [tasks_per_producer] [producers]，默认 200000 / 4。
+// worker 数固定扫 2/4/8/16；每组打印总耗时、每秒完成任务数和提交被拒次数（队列上限取得足够大，正常应为 0）。
+namespace
+{
+struct BenchResult
+{
+    double seconds = 0;
+    size_t rejected = 0;
+};
+
+BenchResult RunOnce(ThreadPool::Mode mode, size_t workers, size_t producers, size_t tasks_per_producer)
+{
+    const size_t total = producers * tasks_per_producer;
+    ThreadPool pool(workers, total, mode);
+    std::atomic<size_t> executed(0);
+    std::atomic<size_t> rejected(0);
+
+    const auto begin = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    threads.reserve(producers);
+    for (size_t p = 0; p < producers; ++p) {
+        threads.emplace_back([&]() {
+            for (size_t i = 0; i < tasks_per_producer; ++i) {
+                if (!pool.submit([&executed]() { executed.fetch_add(1, std::memory_order_relaxed); })) {
+                    rejected.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    // shutdown 会等队列里剩下的任务全部执行完，所以这里量到的是“全部提交 + 全部执行”的总耗时。
+    pool.shutdown();
+    const auto end = std::chrono::steady_clock::now();
+
+    BenchResult result;
+    result.seconds = std::chrono::duration<double>(end - begin).count();
+    result.rejected = rejected.load();
+    if (executed.load() + result.rejected != total) {
+        std::cerr << "task count mismatch: executed=" << executed.load() << " rejected=" << result.rejected << std::endl;
+    }
+    return result;
+}
+
+const char* ModeName(ThreadPool::Mode mode)
+{
+    return mode == ThreadPool::Mode::kWorkStealing ? "work_stealing" : "shared_queue";
+}
+} // namespace
+
+int main(int argc, char** argv)
+{
+    size_t tasks_per_producer = 200000;
+    size_t producers = 4;
+    if (argc > 1) {
+        tasks_per_producer = static_cast<size_t>(std::strtoull(argv[1], nullptr, 10));
+    }
+    if (argc > 2) {
+        producers = static_cast<size_t>(std::strtoull(argv[2], nullptr, 10));
+    }
+    if (tasks_per_producer == 0 || producers == 0) {
+        std::cerr << "tasks_per_producer and producers must be > 0" << std::endl;
+        return 1;
+    }
+
+    std::cout << "producers=" << producers << " tasks_per_producer=" << tasks_per_producer << "\n";
+    for (size_t workers : {2, 4, 8, 16}) {
+        for (ThreadPool::Mode mode : {ThreadPool::Mode::kSharedQueue, ThreadPool::Mode::kWorkStealing}) {
+            const BenchResult result = RunOnce(mode, workers, producers, tasks_per_producer);
+            const double throughput = static_cast<double>(producers * tasks_per_producer) / result.seconds;
+            std::cout << "workers=" << workers
+                      << " mode=" << ModeName(mode)
+                      << " seconds=" << result.seconds
+                      << " tasks_per_sec=" << static_cast<uint64_t>(throughput)
+                      << " rejected=" << result.rejected << "\n";
+        }
+    }
+    std::cout.flush();
+    return 0;
+}
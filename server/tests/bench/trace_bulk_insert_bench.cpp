@@ -0,0 +1,250 @@
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <sqlite3.h>
+
+#include "persistence/SqliteTraceRepository.h"
+
+// SavePrimaryBatch 写入路径对比基准：逐行 bind + step（改造前的写法）vs 仓库里的多行 INSERT 分块写入。
+// 用法：bench_trace_bulk_insert [flushes_per_size] [spans_per_trace] [flush_span_sizes...]
+// 默认每种 flush 大小跑 200 次、每条 trace 8 个 span，flush 大小取 16 / 64 / 256 / 512：
+// BufferedTraceRepository 攒满 primary_span_reserve（默认 512）个 span 就刷，否则每 200ms 刷一次，
+// 所以高峰期几乎都是满 buffer 的 512，低峰期是按时间刷出来的小批。线上的平均值可以用
+// primary_flushed_span_count / primary_flush_calls 算出来，按实际分布把大小传进来即可。
+// 两边用的是同一份 v2 schema（含计数触发器），逐行这边直接用原来的 SQL 手写一遍，多行这边走 SqliteTraceRepository 本身，
+// 所以多行的数字里还包含仓库层的加锁和 id 转换开销。只打印数值，不注册进 CTest。
+namespace
+{
+// 真实 trace_key 往往是哈希出来的 64 位整数，这里用 splitmix64 生成同样分布的 id。
+uint64_t MixKey(uint64_t x)
+{
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+// 按 span 数凑一批：trace 整条进 buffer，所以最后一条 trace 可能让批次略微超过目标大小，和线上一致。
+void BuildFlush(size_t* next_trace,
+                size_t target_spans,
+                size_t spans_per_trace,
+                std::vector<persistence::TraceSummary>* summaries,
+                std::vector<persistence::TraceSpanRecord>* spans)
+{
+    summaries->clear();
+    spans->clear();
+    while (spans->size() < target_spans) {
+        const size_t t = (*next_trace)++;
+        persistence::TraceSummary summary;
+        summary.trace_id = std::to_string(MixKey(t));
+        summary.service_name = t % 4 == 0 ? "checkout" : "gateway";
+        summary.start_time_ms = 1710000000000 + static_cast<int64_t>(t) * 10;
+        summary.end_time_ms = summary.start_time_ms + 120;
+        summary.duration_ms = 120;
+        summary.span_count = spans_per_trace;
+        summary.token_count = spans_per_trace * 40;
+        summary.risk_level = "unknown";
+        summaries->push_back(summary);
+        for (size_t s = 1; s <= spans_per_trace; ++s) {
+            persistence::TraceSpanRecord span;
+            span.trace_id = summary.trace_id;
+            span.span_id = std::to_string(MixKey(t * 1000 + s));
+            if (s > 1) {
+                span.parent_id = std::to_string(MixKey(t * 1000 + (s - 2) / 4 + 1));
+            }
+            span.service_name = s % 2 == 0 ? "order-service" : "inventory-db";
+            span.operation = "POST /api/v1/orders";
+            span.start_time_ms = summary.start_time_ms + static_cast<int64_t>(s);
+            span.duration_ms = 5;
+            span.status = "OK";
+            span.attributes_json = "{\"http.method\":\"POST\",\"http.status_code\":\"200\"}";
+            spans->push_back(std::move(span));
+        }
+    }
+}
+
+void Exec(sqlite3* db, const char* sql)
+{
+    char* errmsg = nullptr;
+    if (sqlite3_exec(db, sql, nullptr, nullptr, &errmsg) != SQLITE_OK) {
+        const std::string error = errmsg ? errmsg : "unknown";
+        sqlite3_free(errmsg);
+        throw std::runtime_error(error);
+    }
+}
+
+sqlite3_stmt* Prepare(sqlite3* db, const char* sql)
+{
+    sqlite3_stmt* stmt = nullptr;
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+        throw std::runtime_error(sqlite3_errmsg(db));
+    }
+    return stmt;
+}
+
+void Step(sqlite3* db, sqlite3_stmt* stmt)
+{
+    if (sqlite3_step(stmt) != SQLITE_DONE) {
+        throw std::runtime_error(sqlite3_errmsg(db));
+    }
+}
+
+sqlite3_int64 Key(const std::string& id)
+{
+    return static_cast<sqlite3_int64>(std::strtoull(id.c_str(), nullptr, 10));
+}
+
+void RemoveDb(const std::string& path)
+{
+    for (const char* suffix : {"", "-wal", "-shm"}) {
+        std::filesystem::remove(path + suffix);
+    }
+}
+
+struct BenchResult
+{
+    double seconds = 0;
+    size_t spans = 0;
+    size_t flushes = 0;
+};
+
+BenchResult RunRowByRow(const std::string& path, size_t flushes, size_t target_spans, size_t spans_per_trace)
+{
+    RemoveDb(path);
+    // 建表交给仓库本身，保证两边的表结构、索引和触发器完全一样。
+    { SqliteTraceRepository schema_only(path); }
+    sqlite3* db = nullptr;
+    sqlite3_open(path.c_str(), &db);
+    Exec(db, "PRAGMA foreign_keys = ON;");
+    sqlite3_stmt* summary_stmt = Prepare(db, R"(
+        INSERT INTO trace_summary
+        (trace_id, service_name, start_time_ms, end_time_ms, duration_ms, span_count, token_count, risk_level, ai_status, ai_error)
+        VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?);)");
+    sqlite3_stmt* span_stmt = Prepare(db, R"(
+        INSERT INTO trace_span
+        (trace_id, span_id, parent_id, service_name, operation, start_time_ms, duration_ms, status, attributes_json)
+        VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?);)");
+
+    BenchResult result;
+    size_t next_trace = 0;
+    std::vector<persistence::TraceSummary> summaries;
+    std::vector<persistence::TraceSpanRecord> spans;
+    for (size_t flush = 0; flush < flushes; ++flush) {
+        BuildFlush(&next_trace, target_spans, spans_per_trace, &summaries, &spans);
+        const auto begin = std::chrono::steady_clock::now();
+        Exec(db, "BEGIN TRANSACTION;");
+        for (const auto& summary : summaries) {
+            sqlite3_reset(summary_stmt);
+            sqlite3_bind_int64(summary_stmt, 1, Key(summary.trace_id));
+            sqlite3_bind_text(summary_stmt, 2, summary.service_name.c_str(), -1, SQLITE_STATIC);
+            sqlite3_bind_int64(summary_stmt, 3, summary.start_time_ms);
+            sqlite3_bind_int64(summary_stmt, 4, summary.end_time_ms.value());
+            sqlite3_bind_int64(summary_stmt, 5, summary.duration_ms);
+            sqlite3_bind_int64(summary_stmt, 6, static_cast<sqlite3_int64>(summary.span_count));
+            sqlite3_bind_int64(summary_stmt, 7, static_cast<sqlite3_int64>(summary.token_count));
+            sqlite3_bind_text(summary_stmt, 8, summary.risk_level.c_str(), -1, SQLITE_STATIC);
+            sqlite3_bind_text(summary_stmt, 9, summary.ai_status.c_str(), -1, SQLITE_STATIC);
+            sqlite3_bind_text(summary_stmt, 10, summary.ai_error.c_str(), -1, SQLITE_STATIC);
+            Step(db, summary_stmt);
+        }
+        for (const auto& span : spans) {
+            sqlite3_reset(span_stmt);
+            sqlite3_bind_int64(span_stmt, 1, Key(span.trace_id));
+            sqlite3_bind_int64(span_stmt, 2, Key(span.span_id));
+            if (span.parent_id.has_value()) {
+                sqlite3_bind_int64(span_stmt, 3, Key(*span.parent_id));
+            } else {
+                sqlite3_bind_null(span_stmt, 3);
+            }
+            sqlite3_bind_text(span_stmt, 4, span.service_name.c_str(), -1, SQLITE_STATIC);
+            sqlite3_bind_text(span_stmt, 5, span.operation.c_str(), -1, SQLITE_STATIC);
+            sqlite3_bind_int64(span_stmt, 6, span.start_time_ms);
+            sqlite3_bind_int64(span_stmt, 7, span.duration_ms);
+            sqlite3_bind_text(span_stmt, 8, span.status.c_str(), -1, SQLITE_STATIC);
+            sqlite3_bind_text(span_stmt, 9, span.attributes_json.c_str(), -1, SQLITE_STATIC);
+            Step(db, span_stmt);
+        }
+        Exec(db, "COMMIT;");
+        result.seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        result.spans += spans.size();
+        ++result.flushes;
+    }
+    sqlite3_finalize(summary_stmt);
+    sqlite3_finalize(span_stmt);
+    sqlite3_close(db);
+    return result;
+}
+
+BenchResult RunMultiRow(const std::string& path, size_t flushes, size_t target_spans, size_t spans_per_trace)
+{
+    RemoveDb(path);
+    SqliteTraceRepository repo(path);
+    BenchResult result;
+    size_t next_trace = 0;
+    std::vector<persistence::TraceSummary> summaries;
+    std::vector<persistence::TraceSpanRecord> spans;
+    for (size_t flush = 0; flush < flushes; ++flush) {
+        BuildFlush(&next_trace, target_spans, spans_per_trace, &summaries, &spans);
+        const auto begin = std::chrono::steady_clock::now();
+        if (!repo.SavePrimaryBatch(summaries, spans)) {
+            throw std::runtime_error("SavePrimaryBatch failed");
+        }
+        result.seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        result.spans += spans.size();
+        ++result.flushes;
+    }
+    return result;
+}
+
+void Print(const char* name, const BenchResult& result)
+{
+    std::cout << "  " << name
+              << " spans_per_sec=" << (result.seconds > 0 ? static_cast<double>(result.spans) / result.seconds : 0.0)
+              << " avg_flush_us=" << result.seconds * 1e6 / static_cast<double>(result.flushes) << std::endl;
+}
+} // namespace
+
+int main(int argc, char** argv)
+{
+    size_t flushes = 200;
+    size_t spans_per_trace = 8;
+    std::vector<size_t> flush_sizes = {16, 64, 256, 512};
+    if (argc > 1) {
+        flushes = static_cast<size_t>(std::strtoull(argv[1], nullptr, 10));
+    }
+    if (argc > 2) {
+        spans_per_trace = static_cast<size_t>(std::strtoull(argv[2], nullptr, 10));
+    }
+    if (argc > 3) {
+        flush_sizes.clear();
+        for (int index = 3; index < argc; ++index) {
+            flush_sizes.push_back(static_cast<size_t>(std::strtoull(argv[index], nullptr, 10)));
+        }
+    }
+    if (flushes == 0 || spans_per_trace == 0) {
+        std::cerr << "usage: bench_trace_bulk_insert [flushes_per_size] [spans_per_trace] [flush_span_sizes...]"
+                  << std::endl;
+        return 1;
+    }
+
+    const std::filesystem::path dir = std::filesystem::temp_directory_path();
+    const std::string row_path = (dir / "bench_trace_bulk_row.db").string();
+    const std::string multi_path = (dir / "bench_trace_bulk_multi.db").string();
+    std::cout << "flushes_per_size=" << flushes << " spans_per_trace=" << spans_per_trace << std::endl;
+    for (const size_t target_spans : flush_sizes) {
+        if (target_spans == 0) {
+            continue;
+        }
+        std::cout << "flush_spans=" << target_spans << std::endl;
+        Print("row_by_row", RunRowByRow(row_path, flushes, target_spans, spans_per_trace));
+        Print("multi_row ", RunMultiRow(multi_path, flushes, target_spans, spans_per_trace));
+    }
+    RemoveDb(row_path);
+    RemoveDb(multi_path);
+    return 0;
+}
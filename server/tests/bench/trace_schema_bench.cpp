@@ -0,0 +1,298 @@
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <sqlite3.h>
+
+#include "persistence/SqliteTraceRepository.h"
+
+// Trace 表 schema 对比基准：旧版 TEXT 主键（十进制字符串 id + 额外的 span 排序索引）vs 新版整数 key + WITHOUT ROWID。
+// 用法：bench_trace_schema [traces] [spans_per_trace]，默认 20000 / 20，每 200 条 trace 一个写事务（贴近 flush 批量）。
+// 打印三项：库文件大小（checkpoint 之后）、批量写入吞吐（spans/s）、GetTraceDetail 单次平均延迟。
+// 旧 schema 这边直接用原来的建表语句和 SQL 手写一遍写入/详情读取；新 schema 走 SqliteTraceRepository 本身，
+// 所以新版的数字里还包含仓库层的加锁和 id 转换开销。只打印数值，不注册进 CTest。
+namespace
+{
+constexpr size_t kBatchTraces = 200;
+constexpr size_t kDetailLookups = 5000;
+
+// 真实 trace_key 往往是哈希出来的 64 位整数，十进制最长 20 个字符，这里用 splitmix64 生成同样分布的 id。
+uint64_t MixKey(uint64_t x)
+{
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+void BuildBatch(size_t first_trace,
+                size_t trace_count,
+                size_t spans_per_trace,
+                std::vector<persistence::TraceSummary>* summaries,
+                std::vector<persistence::TraceSpanRecord>* spans)
+{
+    summaries->clear();
+    spans->clear();
+    for (size_t t = first_trace; t < first_trace + trace_count; ++t) {
+        persistence::TraceSummary summary;
+        summary.trace_id = std::to_string(MixKey(t));
+        summary.service_name = "gateway";
+        summary.start_time_ms = 1710000000000 + static_cast<int64_t>(t);
+        summary.end_time_ms = summary.start_time_ms + 120;
+        summary.duration_ms = 120;
+        summary.span_count = spans_per_trace;
+        summary.token_count = spans_per_trace * 40;
+        summary.risk_level = "unknown";
+        summaries->push_back(summary);
+        for (size_t s = 1; s <= spans_per_trace; ++s) {
+            persistence::TraceSpanRecord span;
+            span.trace_id = summary.trace_id;
+            span.span_id = std::to_string(MixKey(t * 1000 + s));
+            if (s > 1) {
+                span.parent_id = std::to_string(MixKey(t * 1000 + (s - 2) / 4 + 1));
+            }
+            span.service_name = s % 2 == 0 ? "order-service" : "inventory-db";
+            span.operation = "POST /api/v1/orders";
+            span.start_time_ms = summary.start_time_ms + static_cast<int64_t>(s);
+            span.duration_ms = 5;
+            span.status = "OK";
+            span.attributes_json = "{\"http.method\":\"POST\",\"http.status_code\":\"200\"}";
+            spans->push_back(std::move(span));
+        }
+    }
+}
+
+void Exec(sqlite3* db, const char* sql)
+{
+    char* errmsg = nullptr;
+    if (sqlite3_exec(db, sql, nullptr, nullptr, &errmsg) != SQLITE_OK) {
+        const std::string error = errmsg ? errmsg : "unknown";
+        sqlite3_free(errmsg);
+        throw std::runtime_error(error);
+    }
+}
+
+sqlite3_stmt* Prepare(sqlite3* db, const char* sql)
+{
+    sqlite3_stmt* stmt = nullptr;
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+        throw std::runtime_error(sqlite3_errmsg(db));
+    }
+    return stmt;
+}
+
+uintmax_t CheckpointedFileSize(const std::string& path)
+{
+    sqlite3* db = nullptr;
+    sqlite3_open(path.c_str(), &db);
+    sqlite3_exec(db, "PRAGMA wal_checkpoint(TRUNCATE);", nullptr, nullptr, nullptr);
+    sqlite3_close(db);
+    return std::filesystem::file_size(path);
+}
+
+void RemoveDb(const std::string& path)
+{
+    for (const char* suffix : {"", "-wal", "-shm"}) {
+        std::filesystem::remove(path + suffix);
+    }
+}
+
+struct BenchResult
+{
+    double insert_seconds = 0;
+    double detail_us = 0;
+    uintmax_t file_bytes = 0;
+};
+
+BenchResult RunLegacy(const std::string& path, size_t traces, size_t spans_per_trace)
+{
+    RemoveDb(path);
+    sqlite3* db = nullptr;
+    sqlite3_open(path.c_str(), &db);
+    Exec(db, R"(
+        PRAGMA foreign_keys = ON;
+        PRAGMA journal_mode=WAL;
+        CREATE TABLE trace_summary (
+          trace_id TEXT PRIMARY KEY, service_name TEXT NOT NULL, start_time_ms INTEGER NOT NULL,
+          end_time_ms INTEGER, duration_ms INTEGER NOT NULL, span_count INTEGER NOT NULL,
+          token_count INTEGER NOT NULL, risk_level TEXT NOT NULL,
+          ai_status TEXT NOT NULL DEFAULT 'pending', ai_error TEXT NOT NULL DEFAULT '');
+        CREATE TABLE trace_span (
+          trace_id TEXT NOT NULL, span_id TEXT NOT NULL, parent_id TEXT, service_name TEXT NOT NULL,
+          operation TEXT NOT NULL, start_time_ms INTEGER NOT NULL, duration_ms INTEGER NOT NULL,
+          status TEXT NOT NULL, attributes_json TEXT NOT NULL,
+          PRIMARY KEY (trace_id, span_id), FOREIGN KEY (trace_id) REFERENCES trace_summary(trace_id));
+        CREATE TABLE trace_analysis (
+          trace_id TEXT PRIMARY KEY, risk_level TEXT NOT NULL, summary TEXT NOT NULL, root_cause TEXT NOT NULL,
+          solution TEXT NOT NULL, confidence REAL NOT NULL, FOREIGN KEY (trace_id) REFERENCES trace_summary(trace_id));
+        CREATE INDEX idx_trace_summary_start_time_trace_id ON trace_summary(start_time_ms DESC, trace_id DESC);
+        CREATE INDEX idx_trace_summary_service_start_time_trace_id ON trace_summary(service_name, start_time_ms DESC, trace_id DESC);
+        CREATE INDEX idx_trace_span_trace_start_time_span_id ON trace_span(trace_id, start_time_ms ASC, span_id ASC);
+    )");
+    sqlite3_stmt* summary_stmt = Prepare(db, R"(
+        INSERT INTO trace_summary
+        (trace_id, service_name, start_time_ms, end_time_ms, duration_ms, span_count, token_count, risk_level, ai_status, ai_error)
+        VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?);)");
+    sqlite3_stmt* span_stmt = Prepare(db, R"(
+        INSERT INTO trace_span
+        (trace_id, span_id, parent_id, service_name, operation, start_time_ms, duration_ms, status, attributes_json)
+        VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?);)");
+
+    BenchResult result;
+    std::vector<persistence::TraceSummary> summaries;
+    std::vector<persistence::TraceSpanRecord> spans;
+    for (size_t first = 0; first < traces; first += kBatchTraces) {
+        BuildBatch(first, std::min(kBatchTraces, traces - first), spans_per_trace, &summaries, &spans);
+        const auto begin = std::chrono::steady_clock::now();
+        Exec(db, "BEGIN TRANSACTION;");
+        for (const auto& summary : summaries) {
+            sqlite3_reset(summary_stmt);
+            sqlite3_bind_text(summary_stmt, 1, summary.trace_id.c_str(), -1, SQLITE_STATIC);
+            sqlite3_bind_text(summary_stmt, 2, summary.service_name.c_str(), -1, SQLITE_STATIC);
+            sqlite3_bind_int64(summary_stmt, 3, summary.start_time_ms);
+            sqlite3_bind_int64(summary_stmt, 4, summary.end_time_ms.value());
+            sqlite3_bind_int64(summary_stmt, 5, summary.duration_ms);
+            sqlite3_bind_int64(summary_stmt, 6, static_cast<sqlite3_int64>(summary.span_count));
+            sqlite3_bind_int64(summary_stmt, 7, static_cast<sqlite3_int64>(summary.token_count));
+            sqlite3_bind_text(summary_stmt, 8, summary.risk_level.c_str(), -1, SQLITE_STATIC);
+            sqlite3_bind_text(summary_stmt, 9, summary.ai_status.c_str(), -1, SQLITE_STATIC);
+            sqlite3_bind_text(summary_stmt, 10, summary.ai_error.c_str(), -1, SQLITE_STATIC);
+            sqlite3_step(summary_stmt);
+        }
+        for (const auto& span : spans) {
+            sqlite3_reset(span_stmt);
+            sqlite3_bind_text(span_stmt, 1, span.trace_id.c_str(), -1, SQLITE_STATIC);
+            sqlite3_bind_text(span_stmt, 2, span.span_id.c_str(), -1, SQLITE_STATIC);
+            if (span.parent_id.has_value()) {
+                sqlite3_bind_text(span_stmt, 3, span.parent_id->c_str(), -1, SQLITE_STATIC);
+            } else {
+                sqlite3_bind_null(span_stmt, 3);
+            }
+            sqlite3_bind_text(span_stmt, 4, span.service_name.c_str(), -1, SQLITE_STATIC);
+            sqlite3_bind_text(span_stmt, 5, span.operation.c_str(), -1, SQLITE_STATIC);
+            sqlite3_bind_int64(span_stmt, 6, span.start_time_ms);
+            sqlite3_bind_int64(span_stmt, 7, span.duration_ms);
+            sqlite3_bind_text(span_stmt, 8, span.status.c_str(), -1, SQLITE_STATIC);
+            sqlite3_bind_text(span_stmt, 9, span.attributes_json.c_str(), -1, SQLITE_STATIC);
+            sqlite3_step(span_stmt);
+        }
+        Exec(db, "COMMIT;");
+        result.insert_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    }
+    sqlite3_finalize(summary_stmt);
+    sqlite3_finalize(span_stmt);
+
+    // 详情读取照搬旧实现：读事务里先查 summary + analysis，再按 start_time 排序查 spans。
+    sqlite3_stmt* detail_stmt = Prepare(db, R"(
+        SELECT s.trace_id, s.service_name, s.start_time_ms, s.end_time_ms, s.duration_ms, s.span_count, s.token_count,
+               COALESCE(a.risk_level, s.risk_level), s.ai_status, s.ai_error,
+               a.risk_level, a.summary, a.root_cause, a.solution, a.confidence
+        FROM trace_summary s LEFT JOIN trace_analysis a ON a.trace_id = s.trace_id
+        WHERE s.trace_id = ?;)");
+    sqlite3_stmt* spans_stmt = Prepare(db, R"(
+        SELECT span_id, parent_id, service_name, operation, start_time_ms, duration_ms, status
+        FROM trace_span WHERE trace_id = ? ORDER BY start_time_ms ASC, span_id ASC;)");
+    size_t sink = 0;
+    const auto detail_begin = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < kDetailLookups; ++i) {
+        const std::string trace_id = std::to_string(MixKey(MixKey(i) % traces));
+        Exec(db, "BEGIN;");
+        sqlite3_reset(detail_stmt);
+        sqlite3_bind_text(detail_stmt, 1, trace_id.c_str(), -1, SQLITE_TRANSIENT);
+        if (sqlite3_step(detail_stmt) == SQLITE_ROW) {
+            sink += std::string(reinterpret_cast<const char*>(sqlite3_column_text(detail_stmt, 1))).size();
+        }
+        sqlite3_reset(spans_stmt);
+        sqlite3_bind_text(spans_stmt, 1, trace_id.c_str(), -1, SQLITE_TRANSIENT);
+        while (sqlite3_step(spans_stmt) == SQLITE_ROW) {
+            sink += std::string(reinterpret_cast<const char*>(sqlite3_column_text(spans_stmt, 0))).size();
+        }
+        sqlite3_reset(detail_stmt);
+        sqlite3_reset(spans_stmt);
+        Exec(db, "COMMIT;");
+    }
+    result.detail_us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - detail_begin).count() /
+                       static_cast<double>(kDetailLookups);
+    if (sink == 0) {
+        std::cerr << "unexpected empty legacy detail result" << std::endl;
+    }
+    sqlite3_finalize(detail_stmt);
+    sqlite3_finalize(spans_stmt);
+    sqlite3_close(db);
+    result.file_bytes = CheckpointedFileSize(path);
+    return result;
+}
+
+BenchResult RunIntegerKeys(const std::string& path, size_t traces, size_t spans_per_trace)
+{
+    RemoveDb(path);
+    BenchResult result;
+    {
+        SqliteTraceRepository repo(path);
+        std::vector<persistence::TraceSummary> summaries;
+        std::vector<persistence::TraceSpanRecord> spans;
+        for (size_t first = 0; first < traces; first += kBatchTraces) {
+            BuildBatch(first, std::min(kBatchTraces, traces - first), spans_per_trace, &summaries, &spans);
+            const auto begin = std::chrono::steady_clock::now();
+            if (!repo.SavePrimaryBatch(summaries, spans)) {
+                throw std::runtime_error("SavePrimaryBatch failed");
+            }
+            result.insert_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        }
+
+        size_t sink = 0;
+        const auto detail_begin = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < kDetailLookups; ++i) {
+            const std::optional<TraceDetailRecord> detail = repo.GetTraceDetail(std::to_string(MixKey(MixKey(i) % traces)));
+            sink += detail.has_value() ? detail->spans.size() : 0;
+        }
+        result.detail_us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - detail_begin).count() /
+                           static_cast<double>(kDetailLookups);
+        if (sink == 0) {
+            std::cerr << "unexpected empty detail result" << std::endl;
+        }
+    }
+    result.file_bytes = CheckpointedFileSize(path);
+    return result;
+}
+
+void Print(const char* name, const BenchResult& result, size_t traces, size_t spans_per_trace)
+{
+    const double total_spans = static_cast<double>(traces * spans_per_trace);
+    std::cout << name
+              << " file_mb=" << static_cast<double>(result.file_bytes) / (1024.0 * 1024.0)
+              << " insert_spans_per_sec=" << (result.insert_seconds > 0 ? total_spans / result.insert_seconds : 0.0)
+              << " detail_avg_us=" << result.detail_us << std::endl;
+}
+} // namespace
+
+int main(int argc, char** argv)
+{
+    size_t traces = 20000;
+    size_t spans_per_trace = 20;
+    if (argc > 1) {
+        traces = static_cast<size_t>(std::strtoull(argv[1], nullptr, 10));
+    }
+    if (argc > 2) {
+        spans_per_trace = static_cast<size_t>(std::strtoull(argv[2], nullptr, 10));
+    }
+    if (traces == 0 || spans_per_trace == 0) {
+        std::cerr << "usage: bench_trace_schema [traces] [spans_per_trace]" << std::endl;
+        return 1;
+    }
+
+    const std::filesystem::path dir = std::filesystem::temp_directory_path();
+    const std::string legacy_path = (dir / "bench_trace_schema_legacy.db").string();
+    const std::string integer_path = (dir / "bench_trace_schema_v2.db").string();
+    std::cout << "traces=" << traces << " spans_per_trace=" << spans_per_trace
+              << " batch_traces=" << kBatchTraces << " detail_lookups=" << kDetailLookups << std::endl;
+    Print("legacy_text_keys ", RunLegacy(legacy_path, traces, spans_per_trace), traces, spans_per_trace);
+    Print("integer_keys_v2  ", RunIntegerKeys(integer_path, traces, spans_per_trace), traces, spans_per_trace);
+    RemoveDb(legacy_path);
+    RemoveDb(integer_path);
+    return 0;
+}
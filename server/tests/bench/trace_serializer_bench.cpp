@@ -0,0 +1,190 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <nlohmann/json.hpp>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// SerializeTrace / BuildTraceIndex 是 TraceSessionManager 的私有成员，基准里和单测一样直接打开访问权限。
+#define private public
+#include "core/TraceSessionManager.h"
+#undef private
+
+// trace 序列化微基准：对比“哈希表索引 + nlohmann DOM 建树再 dump”和
+// “扁平排序索引 + 迭代 DFS 直接写进预留好的 std::string”的单条耗时，两边都包含建索引这一步。
+// 用法：bench_trace_serializer [iterations]，默认每档 2000 次；分别跑 10/100/1000 个 span 的 trace。
+// 这里只打印数值，不做断言；数值跟机器、编译选项强相关，所以不注册进 CTest。
+namespace
+{
+// 改成扁平索引和流式写出之前的版本，原样留作对照组；计时前先确认两边输出逐字节一致。
+std::string SerializeTraceWithDom(const TraceSession& session)
+{
+    // 索引也按原来的哈希表版本现建一份，这样对照的是整条“建索引 + 序列化”链路。
+    std::unordered_map<size_t, const SpanEvent*> span_map;
+    std::unordered_map<size_t, std::vector<size_t>> children;
+    std::vector<size_t> roots;
+    for (const auto& span : session.spans) {
+        span_map[span.span_id] = &span;
+    }
+    for (const auto& span : session.spans) {
+        if (span.parent_span_id.has_value() && span_map.count(span.parent_span_id.value()) > 0) {
+            children[span.parent_span_id.value()].push_back(span.span_id);
+            continue;
+        }
+        roots.push_back(span.span_id);
+    }
+
+    nlohmann::json output;
+    std::set<size_t> visited;
+    std::vector<size_t> cycle_spans;
+    auto build_node = [&](size_t span_id, const auto& self_ref) -> nlohmann::json {
+        nlohmann::json node;
+        if (!visited.insert(span_id).second) {
+            cycle_spans.push_back(span_id);
+            return node;
+        }
+        auto span_iter = span_map.find(span_id);
+        if (span_iter == span_map.end()) {
+            return node;
+        }
+        const SpanEvent& span = *span_iter->second;
+        static const char* kStatus[] = {"UNSET", "OK", "ERROR"};
+        static const char* kKind[] = {"INTERNAL", "SERVER", "CLIENT", "PRODUCER", "CONSUMER"};
+        node["trace_id"] = span.trace_key;
+        node["span_id"] = span.span_id;
+        node["parent_id"] = span.parent_span_id.has_value() ? nlohmann::json(span.parent_span_id.value())
+                                                            : nlohmann::json(nullptr);
+        node["name"] = span.name;
+        node["service_name"] = span.service_name;
+        node["start_time_ms"] = span.start_time_ms;
+        node["end_time_ms"] = span.end_time.has_value() ? nlohmann::json(span.end_time.value())
+                                                        : nlohmann::json(nullptr);
+        node["status"] = span.status.has_value() ? nlohmann::json(kStatus[static_cast<int>(span.status.value())])
+                                                 : nlohmann::json(nullptr);
+        node["kind"] = span.kind.has_value() ? nlohmann::json(kKind[static_cast<int>(span.kind.value())])
+                                             : nlohmann::json(nullptr);
+        node["attributes"] = span.attributes;
+        node["children"] = nlohmann::json::array();
+        auto child_iter = children.find(span_id);
+        if (child_iter != children.end()) {
+            std::vector<size_t> ordered_children = child_iter->second;
+            std::sort(ordered_children.begin(), ordered_children.end(), [&span_map](size_t left, size_t right) {
+                const SpanEvent& left_span = *span_map.at(left);
+                const SpanEvent& right_span = *span_map.at(right);
+                if (left_span.start_time_ms != right_span.start_time_ms) {
+                    return left_span.start_time_ms < right_span.start_time_ms;
+                }
+                return left_span.span_id < right_span.span_id;
+            });
+            for (size_t child_id : ordered_children) {
+                nlohmann::json child_node = self_ref(child_id, self_ref);
+                if (!child_node.is_null() && !child_node.empty()) {
+                    node["children"].push_back(std::move(child_node));
+                }
+            }
+        }
+        return node;
+    };
+    output["spans"] = nlohmann::json::array();
+    for (size_t root_id : roots) {
+        nlohmann::json root_node = build_node(root_id, build_node);
+        if (!root_node.is_null() && !root_node.empty()) {
+            output["spans"].push_back(std::move(root_node));
+        }
+    }
+    if (!cycle_spans.empty()) {
+        nlohmann::json anomalies = nlohmann::json::array();
+        for (size_t span_id : cycle_spans) {
+            anomalies.push_back({{"type", "cycle_detected"}, {"span_id", span_id}});
+        }
+        output["anomalies"] = std::move(anomalies);
+    }
+    return output.dump();
+}
+
+TraceSession BuildSampleSession(size_t span_count)
+{
+    // 每个节点最多挂 4 个孩子，层数随规模增长；字段取值贴近真实上报（带 status/kind/end_time 和几条 attributes）。
+    TraceSession session(span_count);
+    static const char* kServices[] = {"gateway", "order-service", "payment", "inventory-db"};
+    for (size_t i = 1; i <= span_count; ++i) {
+        SpanEvent span;
+        span.trace_key = 42;
+        span.span_id = i;
+        if (i > 1) {
+            span.parent_span_id = (i - 2) / 4 + 1;
+        }
+        span.start_time_ms = 1710000000000 + static_cast<int64_t>(i * 3);
+        span.end_time = span.start_time_ms + static_cast<int64_t>(5 + i % 17);
+        span.name = "POST /api/v1/orders/" + std::to_string(i % 13);
+        span.service_name = kServices[i % 4];
+        span.status = (i % 29 == 0) ? SpanEvent::Status::Error : SpanEvent::Status::Ok;
+        span.kind = (i % 2 == 0) ? SpanEvent::Kind::Client : SpanEvent::Kind::Server;
+        span.attributes = {{"http.method", "POST"},
+                           {"http.status_code", i % 29 == 0 ? "502" : "200"},
+                           {"peer.service", kServices[(i + 1) % 4]}};
+        session.spans.push_back(std::move(span));
+    }
+    return session;
+}
+
+template <typename SerializeFn>
+double MeasureNsPerTrace(size_t iterations, SerializeFn serialize)
+{
+    size_t sink = 0;
+    const auto begin = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; ++i) {
+        // 把输出长度喂给 sink，防止编译器把整段序列化优化掉。
+        sink += serialize().size();
+    }
+    const auto end = std::chrono::steady_clock::now();
+    if (sink == 0) {
+        std::cerr << "unexpected empty serialize result" << std::endl;
+    }
+    const double total_ns = static_cast<double>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count());
+    return total_ns / static_cast<double>(iterations);
+}
+} // namespace
+
+int main(int argc, char** argv)
+{
+    size_t iterations = 2000;
+    if (argc > 1) {
+        iterations = static_cast<size_t>(std::strtoull(argv[1], nullptr, 10));
+        if (iterations == 0) {
+            std::cerr << "iterations must be > 0" << std::endl;
+            return 1;
+        }
+    }
+
+    // 只用到纯计算的序列化路径，不需要线程池、仓储和 AI。
+    TraceSessionManager manager(nullptr, nullptr, nullptr, /*capacity*/4096, /*token_limit*/0);
+    std::cout << "iterations=" << iterations << "\n";
+    for (size_t span_count : {10u, 100u, 1000u}) {
+        const TraceSession session = BuildSampleSession(span_count);
+        const std::string expected = SerializeTraceWithDom(session);
+        std::vector<const SpanEvent*> order;
+        if (manager.SerializeTrace(manager.BuildTraceIndex(session), &order) != expected) {
+            std::cerr << "streaming output differs from DOM output at spans=" << span_count << std::endl;
+            return 1;
+        }
+
+        const double dom_ns = MeasureNsPerTrace(iterations, [&session]() {
+            return SerializeTraceWithDom(session);
+        });
+        const double stream_ns = MeasureNsPerTrace(iterations, [&manager, &session, &order]() {
+            order.clear();
+            return manager.SerializeTrace(manager.BuildTraceIndex(session), &order);
+        });
+        std::cout << "spans=" << span_count
+                  << " bytes=" << expected.size()
+                  << " dom_ns_per_trace=" << dom_ns
+                  << " streaming_ns_per_trace=" << stream_ns
+                  << " speedup=" << (stream_ns > 0 ? dom_ns / stream_ns : 0.0) << "x" << std::endl;
+    }
+    return 0;
+}
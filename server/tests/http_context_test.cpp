@@ -170,4 +170,107 @@ C. 网络行为模拟 (Network Simulation)
             EXPECT_EQ(req.body_, "body");
             }
             EXPECT_EQ(buffer_.readableBytes(), 0);
-       }
\ No newline at end of file
+       }
+/*
+D. 零拷贝解析模式 (Zero-Copy)
+
+    和上面同一套输入，但 request 的各字段以 string_view 指向 Buffer：
+    handler 返回前 Buffer 不被消费，retrieveParsed 之后才真正 retrieve。
+*/
+
+TEST_F(HttpContextTest, ZeroCopyParseSimplePostKeepsViewsIntoBuffer) {
+    context_->setZeroCopy(true);
+    buffer_.append("POST /logs/spans HTTP/1.1\r\nHost: example.com\r\nContent-Length: 4\r\n\r\nbody");
+    const size_t total = buffer_.readableBytes();
+    ASSERT_EQ(context_->parseRequest(&buffer_), HttpContext::ParseResult::kSuccess);
+    ASSERT_TRUE(context_->gotAll());
+
+    const auto& req = context_->request();
+    EXPECT_TRUE(req.zero_copy_);
+    EXPECT_TRUE(req.method_.empty());
+    EXPECT_TRUE(req.body_.empty());
+    EXPECT_TRUE(req.headers_.empty());
+    EXPECT_EQ(req.methodView(), "POST");
+    EXPECT_EQ(req.pathView(), "/logs/spans");
+    EXPECT_EQ(req.versionView(), "1.1");
+    EXPECT_EQ(req.bodyView(), "body");
+    EXPECT_EQ(req.header_view_count_, 2u);
+    // 请求头查找保持大小写不敏感，和拷贝模式的 getHeader 口径一致。
+    EXPECT_EQ(req.headerView("content-length"), "4");
+    EXPECT_EQ(req.getHeader("HOST"), "example.com");
+    EXPECT_EQ(req.headerView("Missing"), "");
+    // view 直接指向 Buffer，handler 执行期间 Buffer 里的字节还没被消费。
+    EXPECT_EQ(req.bodyView().data(), buffer_.peek() + total - 4);
+    EXPECT_EQ(buffer_.readableBytes(), total);
+
+    context_->retrieveParsed(&buffer_);
+    context_->reset();
+    EXPECT_EQ(buffer_.readableBytes(), 0u);
+    EXPECT_FALSE(context_->request().zero_copy_);
+}
+
+TEST_F(HttpContextTest, ZeroCopyParseHalfPacketWaitsForWholeBody) {
+    context_->setZeroCopy(true);
+    buffer_.append("POST /api HTTP/1.1\r\nContent-Le");
+    ASSERT_EQ(context_->parseRequest(&buffer_), HttpContext::ParseResult::kNeedMoreData);
+    buffer_.append("ngth: 10\r\n\r\n0123");
+    ASSERT_EQ(context_->parseRequest(&buffer_), HttpContext::ParseResult::kNeedMoreData);
+    buffer_.append("456789");
+    ASSERT_EQ(context_->parseRequest(&buffer_), HttpContext::ParseResult::kSuccess);
+    EXPECT_EQ(context_->request().methodView(), "POST");
+    EXPECT_EQ(context_->request().bodyView(), "0123456789");
+}
+
+TEST_F(HttpContextTest, ZeroCopyParseStickyPacketAfterRetrieve) {
+    context_->setZeroCopy(true);
+    buffer_.append("GET  /path  HTTP/1.1\r\nHost :  example.com \r\n\r\n");
+    buffer_.append("POST /api/v1 HTTP/1.1\r\nContent-Length: 4\r\n\r\nbodyGET");
+    ASSERT_EQ(context_->parseRequest(&buffer_), HttpContext::ParseResult::kSuccess);
+    EXPECT_EQ(context_->request().methodView(), "GET");
+    EXPECT_EQ(context_->request().pathView(), "/path");
+    EXPECT_EQ(context_->request().headerView("host"), "example.com");
+    EXPECT_EQ(context_->request().bodyView(), "");
+    // 没有 retrieveParsed 之前重复调用不会越过当前请求。
+    ASSERT_EQ(context_->parseRequest(&buffer_), HttpContext::ParseResult::kSuccess);
+    EXPECT_EQ(context_->request().pathView(), "/path");
+    context_->retrieveParsed(&buffer_);
+    context_->reset();
+
+    ASSERT_EQ(context_->parseRequest(&buffer_), HttpContext::ParseResult::kSuccess);
+    EXPECT_EQ(context_->request().methodView(), "POST");
+    EXPECT_EQ(context_->request().pathView(), "/api/v1");
+    EXPECT_EQ(context_->request().bodyView(), "body");
+    context_->retrieveParsed(&buffer_);
+    context_->reset();
+    EXPECT_EQ(buffer_.readableBytes(), 3u);
+    ASSERT_EQ(context_->parseRequest(&buffer_), HttpContext::ParseResult::kNeedMoreData);
+}
+
+TEST_F(HttpContextTest, ZeroCopyParseRejectsMalformedRequests) {
+    const std::vector<std::string> inputs = {
+        "GET /testHTTP/1.1\r\nHost: example.com\r\n\r\n",
+        "GET /test HTTP/1.1\r\nHost example.com\r\n\r\n",
+        "POST /api/v1 HTTP/1.1\r\nHost: example.com\r\n\r\nbody",
+        "POST /api/v1 HTTP/1.1\r\nContent-Length: 4x\r\n\r\nbody",
+    };
+    for (const std::string& input : inputs) {
+        SCOPED_TRACE(input);
+        HttpContext context;
+        context.setZeroCopy(true);
+        MiniMuduo::net::Buffer buffer;
+        buffer.append(input);
+        EXPECT_EQ(context.parseRequest(&buffer), HttpContext::ParseResult::kError);
+    }
+
+    // 请求头超过固定数组上限时按解析错误处理，而不是悄悄丢掉多出来的头。
+    std::string many_headers = "GET /test HTTP/1.1\r\n";
+    for (size_t i = 0; i <= HttpRequest::kMaxHeaderViews; ++i) {
+        many_headers += "X-Header-" + std::to_string(i) + ": v\r\n";
+    }
+    many_headers += "\r\n";
+    HttpContext context;
+    context.setZeroCopy(true);
+    MiniMuduo::net::Buffer buffer;
+    buffer.append(many_headers);
+    EXPECT_EQ(context.parseRequest(&buffer), HttpContext::ParseResult::kError);
+}
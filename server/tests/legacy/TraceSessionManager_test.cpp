@@ -90,8 +90,9 @@ TEST_F(TraceSessionManagerTest, BuildTraceIndexRootsAndChildren)
     TraceSessionManager::TraceIndex index = manager.BuildTraceIndex(session);
 
     ASSERT_EQ(index.roots.size(), 2u);
-    EXPECT_EQ(index.children[1].size(), 1u);
-    EXPECT_EQ(index.children[1][0], 2u);
+    const size_t root_node = index.Find(1);
+    ASSERT_EQ(index.child_offsets[root_node + 1] - index.child_offsets[root_node], 1u);
+    EXPECT_EQ(index.nodes[index.children[index.child_offsets[root_node]]]->span_id, 2u);
 }
 
 TEST_F(TraceSessionManagerTest, SerializeTraceSortsChildrenByStartTime)
@@ -2,7 +2,39 @@
 #include <threadpool/ThreadPool.h>
 #include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <functional>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+// 替换全局 operator new，按线程统计堆分配次数，用来验证 ThreadPool::Task 的小缓冲优化确实没有碰堆。
+// 只数当前线程，避免 worker 或 gtest 自己在别的线程里的分配干扰断言。
+// noinline 是为了不让 GCC 把 malloc/free 内联进标准库容器后误报 -Wmismatched-new-delete。
+namespace {
+thread_local size_t tlsAllocationCount = 0;
+}
+
+[[gnu::noinline]] void* operator new(std::size_t size) {
+    ++tlsAllocationCount;
+    if (void* ptr = std::malloc(size == 0 ? 1 : size)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+[[gnu::noinline]] void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+[[gnu::noinline]] void operator delete(void* ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
 
 TEST(ThreadPoolTest, SubmitAndExecuteTasks) {
     ThreadPool pool(4);
@@ -59,3 +91,201 @@ TEST(ThreadPoolTest, SubmitAfterShutdown) {
     ASSERT_EQ(counter, 1);
     ASSERT_FALSE(submitted);
 }
+
+// 下面这组用例把两种调度模式放在同一份契约下对拍：
+// 不管内部是共享队列还是 work-stealing，submit/shutdown/pendingTasks/maxQueueSize 的外部行为必须一致。
+class ThreadPoolModeTest : public ::testing::TestWithParam<std::tuple<ThreadPool::Mode, size_t>>
+{
+};
+
+TEST_P(ThreadPoolModeTest, ExecutesEveryTaskFromConcurrentProducers)
+{
+    const ThreadPool::Mode mode = std::get<0>(GetParam());
+    const size_t workers = std::get<1>(GetParam());
+    constexpr int kProducers = 4;
+    constexpr int kTasksPerProducer = 2000;
+    ThreadPool pool(workers, kProducers * kTasksPerProducer, mode);
+    EXPECT_EQ(pool.mode(), mode);
+    std::atomic<int> counter(0);
+    std::atomic<int> rejected(0);
+
+    std::vector<std::thread> producers;
+    for (int p = 0; p < kProducers; ++p) {
+        producers.emplace_back([&]() {
+            for (int i = 0; i < kTasksPerProducer; ++i) {
+                if (!pool.submit([&counter]() { counter.fetch_add(1, std::memory_order_relaxed); })) {
+                    rejected++;
+                }
+            }
+        });
+    }
+    for (std::thread& producer : producers) {
+        producer.join();
+    }
+    pool.shutdown();
+
+    // 队列上限正好等于总任务数，所以一条都不该被拒绝；shutdown 之后队列里剩下的任务也必须执行完。
+    EXPECT_EQ(rejected.load(), 0);
+    EXPECT_EQ(counter.load(), kProducers * kTasksPerProducer);
+    EXPECT_EQ(pool.pendingTasks(), 0u);
+}
+
+TEST_P(ThreadPoolModeTest, RejectsWhenQueueIsFullAndReportsPendingTasks)
+{
+    const ThreadPool::Mode mode = std::get<0>(GetParam());
+    const size_t workers = std::get<1>(GetParam());
+    constexpr size_t kMaxQueue = 8;
+    ThreadPool pool(workers, kMaxQueue, mode);
+    EXPECT_EQ(pool.maxQueueSize(), kMaxQueue);
+
+    // 先用阻塞任务把所有 worker 占住，之后提交的任务只能排队，排满后必须被拒绝。
+    std::mutex gate_mutex;
+    std::condition_variable gate_cv;
+    bool gate_open = false;
+    std::atomic<size_t> started(0);
+    auto blocker = [&]() {
+        started++;
+        std::unique_lock<std::mutex> lock(gate_mutex);
+        gate_cv.wait(lock, [&]() { return gate_open; });
+    };
+    // 逐个提交并等它真正开始执行，避免阻塞任务自己先把有限的队列占满。
+    for (size_t i = 0; i < workers; ++i) {
+        ASSERT_TRUE(pool.submit(blocker));
+        while (started.load() < i + 1) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    std::atomic<int> counter(0);
+    for (size_t i = 0; i < kMaxQueue; ++i) {
+        ASSERT_TRUE(pool.submit([&counter]() { counter++; }));
+    }
+    EXPECT_EQ(pool.pendingTasks(), kMaxQueue);
+    EXPECT_FALSE(pool.submit([&counter]() { counter++; }));
+
+    {
+        std::lock_guard<std::mutex> lock(gate_mutex);
+        gate_open = true;
+    }
+    gate_cv.notify_all();
+    pool.shutdown();
+    EXPECT_EQ(counter.load(), static_cast<int>(kMaxQueue));
+    EXPECT_EQ(pool.pendingTasks(), 0u);
+    EXPECT_FALSE(pool.submit([]() {}));
+}
+
+TEST_P(ThreadPoolModeTest, ZeroQueueSizeRejectsEverySubmit)
+{
+    ThreadPool pool(std::get<1>(GetParam()), 0, std::get<0>(GetParam()));
+    EXPECT_FALSE(pool.submit([]() {}));
+    EXPECT_EQ(pool.pendingTasks(), 0u);
+    pool.shutdown();
+}
+
+TEST_P(ThreadPoolModeTest, TasksSubmittedFromWorkersAreExecuted)
+{
+    ThreadPool pool(std::get<1>(GetParam()), 1024, std::get<0>(GetParam()));
+    std::atomic<int> counter(0);
+    for (int i = 0; i < 64; ++i) {
+        ASSERT_TRUE(pool.submit([&]() {
+            // worker 内部再提交的任务在 work-stealing 模式下会优先进自己的队列，也必须能被执行或被偷走。
+            pool.submit([&counter]() { counter++; });
+            counter++;
+        }));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    pool.shutdown();
+    EXPECT_EQ(counter.load(), 128);
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    BothModes,
+    ThreadPoolModeTest,
+    ::testing::Combine(::testing::Values(ThreadPool::Mode::kSharedQueue, ThreadPool::Mode::kWorkStealing),
+                       ::testing::Values(size_t{2}, size_t{4}, size_t{8}, size_t{16})));
+
+TEST(ThreadPoolTaskTest, SmallCaptureStaysInlineWithoutHeapAllocation) {
+    std::vector<int> payload(64, 7);
+    std::unique_ptr<int> owned(new int(5));
+    int observed = 0;
+
+    const size_t before = tlsAllocationCount;
+    ThreadPool::Task task([payload = std::move(payload), owned = std::move(owned), &observed]() {
+        observed = payload.front() + *owned;
+    });
+    ThreadPool::Task moved(std::move(task));
+    moved();
+    const size_t allocations = tlsAllocationCount - before;
+
+    EXPECT_TRUE(moved.isInline());
+    EXPECT_FALSE(static_cast<bool>(task));
+    EXPECT_EQ(allocations, 0u);
+    EXPECT_EQ(observed, 12);
+}
+
+TEST(ThreadPoolTaskTest, StdFunctionNeedsHeapForTheSameCapture) {
+    // 对照组：同样的捕获体积，std::function 只能放到堆上（libstdc++ 的内联缓冲只有两个指针大）。
+    std::vector<int> payload(64, 7);
+    std::shared_ptr<int> owned = std::make_shared<int>(5);
+    int observed = 0;
+
+    const size_t before = tlsAllocationCount;
+    std::function<void()> task([payload = std::move(payload), owned, &observed]() {
+        observed = payload.front() + *owned;
+    });
+    task();
+    const size_t allocations = tlsAllocationCount - before;
+
+    EXPECT_GE(allocations, 1u);
+    EXPECT_EQ(observed, 12);
+}
+
+TEST(ThreadPoolTaskTest, OversizedCaptureFallsBackToHeap) {
+    struct Large {
+        char bytes[ThreadPool::kTaskInlineSize * 2] = {};
+    };
+    Large large;
+    large.bytes[0] = 3;
+    int observed = 0;
+
+    ThreadPool::Task task([large, &observed]() { observed = large.bytes[0]; });
+    ThreadPool::Task moved(std::move(task));
+    moved();
+
+    EXPECT_FALSE(moved.isInline());
+    EXPECT_EQ(observed, 3);
+}
+
+namespace {
+struct ReclaimableTask {
+    std::unique_ptr<int> state;
+    void operator()() {}
+};
+}
+
+TEST(ThreadPoolTaskTest, RejectedSubmitLeavesTaskReclaimable) {
+    for (ThreadPool::Mode mode : {ThreadPool::Mode::kSharedQueue, ThreadPool::Mode::kWorkStealing}) {
+        ThreadPool pool(1, 0, mode);
+        ReclaimableTask work;
+        work.state.reset(new int(42));
+        ThreadPool::Task task(std::move(work));
+
+        ASSERT_FALSE(pool.submit(std::move(task)));
+        ReclaimableTask* reclaimed = task.target<ReclaimableTask>();
+        ASSERT_NE(reclaimed, nullptr);
+        ASSERT_NE(reclaimed->state, nullptr);
+        EXPECT_EQ(*reclaimed->state, 42);
+        EXPECT_EQ(task.target<int>(), nullptr);
+        pool.shutdown();
+    }
+}
+
+TEST(ThreadPoolTaskTest, MoveOnlyCaptureRunsOnWorker) {
+    ThreadPool pool(2);
+    std::atomic<int> observed(0);
+    std::unique_ptr<int> owned(new int(9));
+
+    ASSERT_TRUE(pool.submit([owned = std::move(owned), &observed]() { observed = *owned; }));
+    pool.shutdown();
+    EXPECT_EQ(observed.load(), 9);
+}
@@ -21,6 +21,18 @@ DURATION="${DURATION:-30s}"
 WRK_THREADS="${WRK_THREADS:-1}"
 WORKER_THREAD_SET="${WORKER_THREAD_SET:-2 3 4}"
 CONNECTION_SET="${CONNECTION_SET:-100 200 500}"
+# IO_THREADS / TRACE_SESSION_SHARDS 用来观察 manager 分片后多 IO 线程的扩展性；
+# TRACE_SESSION_SHARDS=0 表示交给服务端按 IO 线程数自动推导。
+IO_THREADS="${IO_THREADS:-1}"
+TRACE_SESSION_SHARDS="${TRACE_SESSION_SHARDS:-0}"
+# HTTP_ZERO_COPY=1 时服务端用零拷贝方式解析 HTTP 请求，便于和默认拷贝路径做 A/B。
+HTTP_ZERO_COPY="${HTTP_ZERO_COPY:-0}"
+# WORKER_POOL_MODE=stealing 时 worker/query 线程池改用 work-stealing 调度，默认 shared。
+WORKER_POOL_MODE="${WORKER_POOL_MODE:-shared}"
+# TRACE_AI_ASYNC=1 时 worker 只发起 AI 请求，由 provider 的 curl-multi loop 等模型返回，默认关闭。
+TRACE_AI_ASYNC="${TRACE_AI_ASYNC:-0}"
+# TRACE_AI_BATCH_MAX_TRACES>1 时把 linger 窗口内的多条 trace 合成一次 proxy 请求，默认 0 不攒批。
+TRACE_AI_BATCH_MAX_TRACES="${TRACE_AI_BATCH_MAX_TRACES:-0}"
 SERVER_CPUSET="${SERVER_CPUSET:-}"
 WRK_CPUSET="${WRK_CPUSET:-}"
 WAIT_PORT_RETRY="${WAIT_PORT_RETRY:-50}"
@@ -53,6 +65,12 @@ usage() {
   WRK_THREADS=1
   WORKER_THREAD_SET="2 3 4"
   CONNECTION_SET="100 200 500"
+  IO_THREADS=1
+  TRACE_SESSION_SHARDS=0
+  HTTP_ZERO_COPY=0
+  WORKER_POOL_MODE=shared
+  TRACE_AI_ASYNC=0
+  TRACE_AI_BATCH_MAX_TRACES=0
   SERVER_CPUSET="1-2"
   WRK_CPUSET="0"
   STOP_RETRY=50
@@ -264,6 +282,12 @@ start_server() {
             --trace-ai-provider mock \
             --worker-threads "${worker_threads}" \
             --worker-queue-size "${WORKER_QUEUE_SIZE}" \
+            --io-threads "${IO_THREADS}" \
+            --trace-session-shards "${TRACE_SESSION_SHARDS}" \
+            --http-zero-copy "${HTTP_ZERO_COPY}" \
+            --worker-pool-mode "${WORKER_POOL_MODE}" \
+            --trace-ai-async "${TRACE_AI_ASYNC}" \
+            --trace-ai-batch-max-traces "${TRACE_AI_BATCH_MAX_TRACES}" \
             --trace-capacity "${TRACE_CAPACITY}" \
             --trace-token-limit "${TRACE_TOKEN_LIMIT}" \
             --trace-sweep-interval-ms "${TRACE_SWEEP_INTERVAL_MS}" \
@@ -281,6 +305,12 @@ start_server() {
             --trace-ai-provider mock \
             --worker-threads "${worker_threads}" \
             --worker-queue-size "${WORKER_QUEUE_SIZE}" \
+            --io-threads "${IO_THREADS}" \
+            --trace-session-shards "${TRACE_SESSION_SHARDS}" \
+            --http-zero-copy "${HTTP_ZERO_COPY}" \
+            --worker-pool-mode "${WORKER_POOL_MODE}" \
+            --trace-ai-async "${TRACE_AI_ASYNC}" \
+            --trace-ai-batch-max-traces "${TRACE_AI_BATCH_MAX_TRACES}" \
             --trace-capacity "${TRACE_CAPACITY}" \
             --trace-token-limit "${TRACE_TOKEN_LIMIT}" \
             --trace-sweep-interval-ms "${TRACE_SWEEP_INTERVAL_MS}" \
@@ -404,6 +434,12 @@ SUMMARY_LOG="${RUN_DIR}/run-summary.log"
     echo "wrk_threads=${WRK_THREADS}"
     echo "worker_thread_set=${WORKER_THREAD_SET}"
     echo "connection_set=${CONNECTION_SET}"
+    echo "io_threads=${IO_THREADS}"
+    echo "trace_session_shards=${TRACE_SESSION_SHARDS}"
+    echo "http_zero_copy=${HTTP_ZERO_COPY}"
+    echo "worker_pool_mode=${WORKER_POOL_MODE}"
+    echo "trace_ai_async=${TRACE_AI_ASYNC}"
+    echo "trace_ai_batch_max_traces=${TRACE_AI_BATCH_MAX_TRACES}"
     echo "server_cpuset=${SERVER_CPUSET:-<unset>}"
     echo "wrk_cpuset=${WRK_CPUSET:-<unset>}"
     echo "trace_capacity=${TRACE_CAPACITY}"
@@ -1,15 +1,34 @@
 #include <threadpool/ThreadPool.h>
 #include "ThreadPool.h"
 #include <MiniMuduo/base/LogMessage.h>
-bool ThreadPool::submit(Task t)
+
+namespace
+{
+// 当前线程如果本身就是某个 work-stealing 池的 worker，这里记下它属于哪个池、是几号 worker，
+// 这样 worker 内部再提交的任务可以优先进自己的队列，保持局部性。
+thread_local const ThreadPool* tlsOwnerPool = nullptr;
+thread_local size_t tlsWorkerIndex = 0;
+
+size_t RoundUpPowerOfTwo(size_t value)
+{
+    size_t result = 2;
+    while (result < value)
+        result <<= 1;
+    return result;
+}
+} // namespace
+
+bool ThreadPool::submit(Task&& t)
 {
+    if (mode_ == Mode::kWorkStealing)
+        return submitStealing(t);
     {
         std::unique_lock<std::mutex> mutex_(taskMutex_);
         if (stop_)
             return false;
         if(tasks_.size() < max_queue_size_)
             tasks_.push(std::move(t));
-        else 
+        else
             return false;
     }
     workCv_.notify_one();
@@ -31,18 +50,23 @@ void ThreadPool::working()
                 task_ = std::move(tasks_.front());
                 tasks_.pop();
             }
-            try
-            {
-                task_();
-            }
-            catch (const std::exception &e)
-            {
-                LOG_STREAM_ERROR << "Work Thread catch Exception : " << e.what();
-            }
+            runTask(task_);
         }
     }
 }
 
+void ThreadPool::runTask(Task &task)
+{
+    try
+    {
+        task();
+    }
+    catch (const std::exception &e)
+    {
+        LOG_STREAM_ERROR << "Work Thread catch Exception : " << e.what();
+    }
+}
+
 void ThreadPool::shutdown()
 {
     {
@@ -50,8 +74,186 @@ void ThreadPool::shutdown()
         stop_ = true;
     }
     workCv_.notify_all();
+    if (mode_ == Mode::kWorkStealing)
+    {
+        // 和提交方的唤醒一样，先拿 idleMutex_ 再 notify，保证不会有 worker 卡在“刚检查完条件、还没 wait”的窗口里。
+        std::lock_guard<std::mutex> lock(idleMutex_);
+        idleCv_.notify_all();
+    }
     for (std::thread &t : works_)
     {
-        t.join();
+        if (t.joinable())
+            t.join();
     }
-}
\ No newline at end of file
+}
+
+ThreadPool::WorkerQueue::WorkerQueue(size_t capacity)
+    : cells_(new Cell[RoundUpPowerOfTwo(capacity)]),
+      mask_(RoundUpPowerOfTwo(capacity) - 1)
+{
+    for (size_t i = 0; i <= mask_; ++i)
+        cells_[i].sequence.store(i, std::memory_order_relaxed);
+}
+
+bool ThreadPool::WorkerQueue::tryPush(Task &task)
+{
+    size_t pos = enqueuePos_.load(std::memory_order_relaxed);
+    Cell *cell = nullptr;
+    while (true)
+    {
+        cell = &cells_[pos & mask_];
+        const size_t seq = cell->sequence.load(std::memory_order_acquire);
+        const intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+        if (diff == 0)
+        {
+            if (enqueuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                break;
+        }
+        else if (diff < 0)
+        {
+            // 槽位还没被消费方释放，说明这条队列已满。
+            return false;
+        }
+        else
+        {
+            pos = enqueuePos_.load(std::memory_order_relaxed);
+        }
+    }
+    cell->task = std::move(task);
+    cell->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+}
+
+bool ThreadPool::WorkerQueue::tryPop(Task *task)
+{
+    size_t pos = dequeuePos_.load(std::memory_order_relaxed);
+    Cell *cell = nullptr;
+    while (true)
+    {
+        cell = &cells_[pos & mask_];
+        const size_t seq = cell->sequence.load(std::memory_order_acquire);
+        const intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+        if (diff == 0)
+        {
+            if (dequeuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                break;
+        }
+        else if (diff < 0)
+        {
+            return false;
+        }
+        else
+        {
+            pos = dequeuePos_.load(std::memory_order_relaxed);
+        }
+    }
+    *task = std::move(cell->task);
+    // 及时释放槽位里残留的可调用对象，避免捕获的大对象一直挂在环形队列里。
+    cell->task = nullptr;
+    cell->sequence.store(pos + mask_ + 1, std::memory_order_release);
+    return true;
+}
+
+void ThreadPool::initStealingQueues(size_t threadNums)
+{
+    if (threadNums == 0)
+        return;
+    // 每条队列按“总上限 / worker 数”向上取整再取 2 的幂。
+    // 总槽位数不小于 max_queue_size_，再加上 pending_ 先占位的约束，只要占位成功就一定能找到空槽。
+    const size_t perQueue = (max_queue_size_ + threadNums - 1) / threadNums;
+    queues_.reserve(threadNums);
+    for (size_t i = 0; i < threadNums; ++i)
+        queues_.emplace_back(std::make_unique<WorkerQueue>(perQueue));
+}
+
+bool ThreadPool::submitStealing(Task &t)
+{
+    if (queues_.empty())
+        return false;
+    // 先占位再检查 stop_：和 worker 的“stop_ 且 pending_==0 才退出”配合，
+    // 保证 shutdown 之后要么提交被拒绝，要么任务一定会被某个 worker 执行掉，不会悄悄丢失。
+    const size_t reserved = pending_.fetch_add(1);
+    if (reserved >= max_queue_size_ || stop_.load())
+    {
+        pending_.fetch_sub(1);
+        return false;
+    }
+
+    const size_t queueCount = queues_.size();
+    size_t start = 0;
+    if (tlsOwnerPool == this)
+        start = tlsWorkerIndex;
+    else
+        start = submitCursor_.fetch_add(1, std::memory_order_relaxed) % queueCount;
+    bool pushed = false;
+    // 占位成功时全局一定还有空槽，但别的提交方可能正和我们抢同一条队列的同一个槽，所以这里按轮转多试几圈。
+    for (size_t attempt = 0; attempt < queueCount * 64 && !pushed; ++attempt)
+    {
+        pushed = queues_[(start + attempt) % queueCount]->tryPush(t);
+        if (!pushed && attempt % queueCount == queueCount - 1)
+            std::this_thread::yield();
+    }
+    if (!pushed)
+    {
+        pending_.fetch_sub(1);
+        return false;
+    }
+
+    if (sleepers_.load() > 0)
+    {
+        std::lock_guard<std::mutex> lock(idleMutex_);
+        idleCv_.notify_one();
+    }
+    return true;
+}
+
+bool ThreadPool::tryTakeStealing(size_t index, Task *task)
+{
+    const size_t queueCount = queues_.size();
+    // 先看自己的队列，再从相邻的 worker 开始依次偷。
+    for (size_t offset = 0; offset < queueCount; ++offset)
+    {
+        if (queues_[(index + offset) % queueCount]->tryPop(task))
+        {
+            pending_.fetch_sub(1);
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::workingStealing(size_t index)
+{
+    tlsOwnerPool = this;
+    tlsWorkerIndex = index;
+    // 找不到任务时先短暂自旋让出 CPU，再进入条件变量睡眠；连续提交的场景里大多在自旋阶段就能接住新任务。
+    constexpr int kSpinRounds = 64;
+    while (true)
+    {
+        Task task;
+        bool found = false;
+        for (int spin = 0; spin < kSpinRounds && !found; ++spin)
+        {
+            found = tryTakeStealing(index, &task);
+            if (!found)
+            {
+                if (stop_.load() && pending_.load() == 0)
+                    return;
+                std::this_thread::yield();
+            }
+        }
+        if (found)
+        {
+            runTask(task);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(idleMutex_);
+        sleepers_.fetch_add(1);
+        // pending_ > 0 可能只是提交方占了位还没写完槽位；醒来后回到外层自旋，很快就能取到。
+        idleCv_.wait(lock, [this] { return pending_.load() > 0 || stop_.load(); });
+        sleepers_.fetch_sub(1);
+        if (stop_.load() && pending_.load() == 0)
+            return;
+    }
+}
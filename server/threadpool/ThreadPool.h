@@ -5,11 +5,40 @@
 #include<queue>
 #include<mutex>
 #include<condition_variable>
+#include<atomic>
+#include<memory>
+#include "threadpool/UniqueFunction.h"
 class ThreadPool{
     public:
-        explicit ThreadPool(size_t threadNums,size_t max_queue_size=10000)
+        // 任务类型用只支持移动的 UniqueFunction，而不是 std::function：
+        // 1) 提交方可以把 unique_ptr、大 vector/string 直接 move 进 lambda，不必为了“可拷贝”再包一层 shared_ptr；
+        // 2) 捕获体积不超过 kTaskInlineSize 的任务直接放在 Task 对象内部，入队/出队全程不碰堆。
+        // 128 字节是按 TraceSessionManager 派发给 worker 的任务体积选的（见 DispatchWorkerTask 上的 static_assert）。
+        static constexpr size_t kTaskInlineSize=128;
+        using Task=UniqueFunction<void(),kTaskInlineSize>;
+        // 两种调度模式对外契约完全一致（submit/shutdown/pendingTasks/maxQueueSize），只是内部排队方式不同：
+        // kSharedQueue：一把 taskMutex_ 护着一条共享队列，实现最简单，低并发下足够；
+        // kWorkStealing：每个 worker 一条无锁环形队列，提交方按轮转分散投递，空闲 worker 去别人队列里偷任务，
+        // 排队深度用原子计数维护，pendingTasks() 不再需要拿锁，适合 IO 线程多、提交很密的场景。
+        enum class Mode
+        {
+            kSharedQueue,
+            kWorkStealing
+        };
+
+        explicit ThreadPool(size_t threadNums,size_t max_queue_size=10000,Mode mode=Mode::kSharedQueue)
         {
             max_queue_size_=max_queue_size;
+            mode_=mode;
+            if(mode_==Mode::kWorkStealing)
+            {
+                initStealingQueues(threadNums);
+                for(size_t i=0;i<threadNums;i++)
+                {
+                    works_.emplace_back([this,i]{this->workingStealing(i);});
+                }
+                return;
+            }
             for(size_t i=0;i<threadNums;i++)
             {
                 works_.emplace_back([this]{this->working();});
@@ -20,25 +49,72 @@ class ThreadPool{
             if(!stop_)
                 shutdown();
         }
-        using Task=std::function<void()>;
-        bool submit(Task t);
+        // 只有提交成功时才会把 t 移走；被拒绝时 t 保持原样，调用方可以通过 t.target<T>() 把捕获的状态取回来。
+        bool submit(Task&& t);
         void shutdown();
         size_t pendingTasks(){
+            if(mode_==Mode::kWorkStealing)
+            {
+                // 原子计数只统计“已入队、还没被 worker 取走”的任务，口径和共享队列的 tasks_.size() 一致。
+                return pending_.load(std::memory_order_relaxed);
+            }
             std::lock_guard<std::mutex> lock(taskMutex_);
             return tasks_.size();
         }
         size_t maxQueueSize() const{
             return max_queue_size_;
         }
+        Mode mode() const{
+            return mode_;
+        }
     private:
+        // 单个 worker 的有界无锁队列（Vyukov 风格的 MPMC 环形队列）。
+        // 之所以不用 Chase-Lev 那种“只有 owner 能 push”的双端队列，是因为这里的任务几乎都来自 IO 线程
+        // 和 sweep 线程这些外部提交方；MPMC 环形队列允许任意线程投递，同时也允许别的 worker 直接来偷。
+        class WorkerQueue
+        {
+            public:
+                explicit WorkerQueue(size_t capacity);
+                bool tryPush(Task& task);
+                bool tryPop(Task* task);
+            private:
+                struct Cell
+                {
+                    std::atomic<size_t> sequence{0};
+                    Task task;
+                };
+                std::unique_ptr<Cell[]> cells_;
+                size_t mask_=0;
+                // 入队和出队游标分别独占缓存行，避免提交方和消费方互相踩同一行。
+                alignas(64) std::atomic<size_t> enqueuePos_{0};
+                alignas(64) std::atomic<size_t> dequeuePos_{0};
+        };
+
         void working();
+        void initStealingQueues(size_t threadNums);
+        void workingStealing(size_t index);
+        bool submitStealing(Task& t);
+        bool tryTakeStealing(size_t index,Task* task);
+        void runTask(Task& task);
+
         std::vector<std::thread> works_;
         std::queue<Task> tasks_;
         size_t max_queue_size_;
+        Mode mode_=Mode::kSharedQueue;
 
         std::mutex taskMutex_;
         std::condition_variable workCv_;
-        bool stop_=false;
+        std::atomic<bool> stop_{false};
+
+        // ---------------- kWorkStealing 模式专用 ----------------
+        std::vector<std::unique_ptr<WorkerQueue>> queues_;
+        // 已预留（含正在写入）但还没被取走的任务数；submit 先在这里占位，占不到就按队列满拒绝。
+        alignas(64) std::atomic<size_t> pending_{0};
+        alignas(64) std::atomic<size_t> submitCursor_{0};
+        // 只有在确实有 worker 睡着时，提交方才需要去碰 idleMutex_ 唤醒它，热路径上基本是纯原子操作。
+        alignas(64) std::atomic<size_t> sleepers_{0};
+        std::mutex idleMutex_;
+        std::condition_variable idleCv_;
 
 
 };
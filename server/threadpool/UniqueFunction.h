@@ -0,0 +1,205 @@
+#pragma once
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// UniqueFunction 是只支持移动的类型擦除可调用对象，带小缓冲优化（SBO）：
+// 1) 和 std::function 不同，它不要求被包装对象可拷贝，所以 lambda 可以直接按值捕获 unique_ptr、大 vector/string，
+//    不必再为了满足“可拷贝”去套一层 shared_ptr；
+// 2) 可调用对象不超过 InlineSize 字节、对齐不超过 max_align_t、且移动构造不抛异常时，直接放在对象内部的缓冲区里，
+//    构造/移动/销毁都不碰堆；超出时才退回到一次堆分配。
+// InlineSize 作为模板参数暴露出来，使用方（比如 ThreadPool::Task）按自己最大的常见任务体积来选。
+template <typename Signature, size_t InlineSize = 64>
+class UniqueFunction;
+
+template <typename R, typename... Args, size_t InlineSize>
+class UniqueFunction<R(Args...), InlineSize>
+{
+public:
+    UniqueFunction() noexcept = default;
+    UniqueFunction(std::nullptr_t) noexcept {}
+
+    template <typename F,
+              typename Fn = std::decay_t<F>,
+              typename = std::enable_if_t<!std::is_same<Fn, UniqueFunction>::value &&
+                                          std::is_invocable_r<R, Fn&, Args...>::value>>
+    UniqueFunction(F&& f)
+    {
+        if constexpr (FitsInline<Fn>())
+        {
+            ::new (static_cast<void*>(&storage_)) Fn(std::forward<F>(f));
+            ops_ = &InlineOps<Fn>::kOps;
+        }
+        else
+        {
+            Fn* heap = new Fn(std::forward<F>(f));
+            ::new (static_cast<void*>(&storage_)) Fn*(heap);
+            ops_ = &HeapOps<Fn>::kOps;
+        }
+    }
+
+    UniqueFunction(UniqueFunction&& other) noexcept
+    {
+        moveFrom(other);
+    }
+
+    UniqueFunction& operator=(UniqueFunction&& other) noexcept
+    {
+        if (this != &other)
+        {
+            reset();
+            moveFrom(other);
+        }
+        return *this;
+    }
+
+    UniqueFunction& operator=(std::nullptr_t) noexcept
+    {
+        reset();
+        return *this;
+    }
+
+    UniqueFunction(const UniqueFunction&) = delete;
+    UniqueFunction& operator=(const UniqueFunction&) = delete;
+
+    ~UniqueFunction()
+    {
+        reset();
+    }
+
+    explicit operator bool() const noexcept
+    {
+        return ops_ != nullptr;
+    }
+
+    R operator()(Args... args)
+    {
+        return ops_->invoke(&storage_, std::forward<Args>(args)...);
+    }
+
+    // 和 std::function::target 一样：类型匹配时返回被包装对象的指针，否则返回 nullptr。
+    // 主要给“提交失败后要把任务里捕获的状态取回来”的场景用，比如 submit 被拒后把 session 放回 manager。
+    template <typename T>
+    T* target() noexcept
+    {
+        if (!ops_ || ops_->type_tag != &TypeTag<T>::kTag)
+        {
+            return nullptr;
+        }
+        return static_cast<T*>(ops_->get(&storage_));
+    }
+
+    // 当前对象是否落在内部缓冲区里，测试和基准用它确认任务体积没有超出 InlineSize。
+    bool isInline() const noexcept
+    {
+        return ops_ != nullptr && ops_->is_inline;
+    }
+
+    static constexpr size_t inlineSize() noexcept
+    {
+        return InlineSize;
+    }
+
+private:
+    using Storage = std::aligned_storage_t<(InlineSize < sizeof(void*) ? sizeof(void*) : InlineSize),
+                                           alignof(std::max_align_t)>;
+
+    struct Ops
+    {
+        R (*invoke)(void* storage, Args&&... args);
+        // 把 src 缓冲区里的对象搬到 dst，并销毁 src 里的旧对象。
+        void (*relocate)(void* dst, void* src) noexcept;
+        void (*destroy)(void* storage) noexcept;
+        void* (*get)(void* storage) noexcept;
+        const void* type_tag;
+        bool is_inline;
+    };
+
+    template <typename T>
+    struct TypeTag
+    {
+        static constexpr char kTag = 0;
+    };
+
+    template <typename Fn>
+    static constexpr bool FitsInline()
+    {
+        return sizeof(Fn) <= sizeof(Storage) &&
+               alignof(Fn) <= alignof(Storage) &&
+               std::is_nothrow_move_constructible<Fn>::value;
+    }
+
+    template <typename Fn>
+    struct InlineOps
+    {
+        static R invoke(void* storage, Args&&... args)
+        {
+            return (*static_cast<Fn*>(storage))(std::forward<Args>(args)...);
+        }
+        static void relocate(void* dst, void* src) noexcept
+        {
+            Fn* from = static_cast<Fn*>(src);
+            ::new (dst) Fn(std::move(*from));
+            from->~Fn();
+        }
+        static void destroy(void* storage) noexcept
+        {
+            static_cast<Fn*>(storage)->~Fn();
+        }
+        static void* get(void* storage) noexcept
+        {
+            return storage;
+        }
+        static constexpr Ops kOps{&invoke, &relocate, &destroy, &get, &TypeTag<Fn>::kTag, true};
+    };
+
+    template <typename Fn>
+    struct HeapOps
+    {
+        static Fn* ptr(void* storage) noexcept
+        {
+            return *static_cast<Fn**>(storage);
+        }
+        static R invoke(void* storage, Args&&... args)
+        {
+            return (*ptr(storage))(std::forward<Args>(args)...);
+        }
+        static void relocate(void* dst, void* src) noexcept
+        {
+            // 堆上的对象本身不动，只搬指针。
+            ::new (dst) Fn*(ptr(src));
+        }
+        static void destroy(void* storage) noexcept
+        {
+            delete ptr(storage);
+        }
+        static void* get(void* storage) noexcept
+        {
+            return ptr(storage);
+        }
+        static constexpr Ops kOps{&invoke, &relocate, &destroy, &get, &TypeTag<Fn>::kTag, false};
+    };
+
+    void moveFrom(UniqueFunction& other) noexcept
+    {
+        if (other.ops_)
+        {
+            other.ops_->relocate(&storage_, &other.storage_);
+            ops_ = other.ops_;
+            other.ops_ = nullptr;
+        }
+    }
+
+    void reset() noexcept
+    {
+        if (ops_)
+        {
+            ops_->destroy(&storage_);
+            ops_ = nullptr;
+        }
+    }
+
+    Storage storage_;
+    const Ops* ops_ = nullptr;
+};